@@ -47,7 +47,7 @@ static void tau_sockaddr_setport(struct sockaddr* sa, tr_port port)
     }
 }
 
-static int tau_sendto(tr_session const* session, struct evutil_addrinfo* ai, tr_port port, void const* buf, size_t buflen)
+static int tau_sendto(tr_session* session, struct evutil_addrinfo* ai, tr_port port, void const* buf, size_t buflen)
 {
     auto sockfd = tr_socket_t{};
 
@@ -71,7 +71,10 @@ static int tau_sendto(tr_session const* session, struct evutil_addrinfo* ai, tr_
     }
 
     tau_sockaddr_setport(ai->ai_addr, port);
-    return sendto(sockfd, static_cast<char const*>(buf), buflen, 0, ai->ai_addr, ai->ai_addrlen);
+
+    // send it with the rest of this event loop iteration's UDP datagrams
+    tr_udpSendTo(session, sockfd, buf, buflen, ai->ai_addr, ai->ai_addrlen);
+    return static_cast<int>(buflen);
 }
 
 /****
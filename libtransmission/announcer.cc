@@ -1685,6 +1685,7 @@ static void onUpkeepTimer(evutil_socket_t /*fd*/, short /*what*/, void* vannounc
     auto* announcer = static_cast<tr_announcer*>(vannouncer);
     tr_session* session = announcer->session;
     auto const lock = session->unique_lock();
+    auto const timer = session->metrics.time(tr_metrics::Timer::AnnouncerUpkeep);
 
     bool const is_closing = session->isClosed;
     time_t const now = tr_time();
@@ -14,12 +14,16 @@
 #include "bandwidth.h"
 #include "crypto-utils.h" /* tr_rand_int_weak() */
 #include "log.h"
+#include "peer-common.h" /* MAX_BLOCK_SIZE */
 #include "peer-io.h"
 #include "tr-assert.h"
 #include "utils.h"
 
 #define dbgmsg(...) tr_logAddDeepNamed(nullptr, __VA_ARGS__)
 
+/* a block and its piece message header */
+static auto constexpr TcpIncrement = size_t{ MAX_BLOCK_SIZE + 13 };
+
 /***
 ****
 ***/
@@ -179,8 +183,11 @@ void Bandwidth::phaseOne(std::vector<tr_peerIo*>& peerArray, tr_direction dir)
 
         /* value of 3000 bytes chosen so that when using uTP we'll send a full-size
          * frame right away and leave enough buffered data for the next frame to go
-         * out in a timely manner. */
-        size_t const increment = 3000;
+         * out in a timely manner. An upload to a TCP socket that allocate() corked
+         * can take a whole piece message per write() instead; everything else,
+         * including all downloads, keeps to the small round-robin turns. */
+        auto const* const io = peerArray[i];
+        size_t const increment = dir == TR_UP && io->isCorked ? TcpIncrement : 3000;
 
         int const bytes_used = tr_peerIoFlush(peerArray[i], dir, increment);
 
@@ -229,6 +236,21 @@ void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
         }
     }
 
+    /* cork the sockets that have more to upload than one pass can send,
+     * so that their writes below leave as full-sized packets. A socket
+     * stays corked from pulse to pulse until its backlog runs down, so a
+     * busy peer's socket options are only set when that starts and ends */
+    if (dir == TR_UP)
+    {
+        for (auto* io : tmp)
+        {
+            if (io->socket.type == TR_PEER_SOCKET_TYPE_TCP && evbuffer_get_length(io->outbuf) > TcpIncrement)
+            {
+                tr_peerIoSetCorked(io, true);
+            }
+        }
+    }
+
     /* First phase of IO. Tries to distribute bandwidth fairly to keep faster
      * peers from starving the others. Loop through the peers, giving each a
      * small chunk of bandwidth. Keep looping until we run out of bandwidth
@@ -237,6 +259,17 @@ void Bandwidth::allocate(tr_direction dir, unsigned int period_msec)
     phaseOne(normal, dir);
     phaseOne(low, dir);
 
+    if (dir == TR_UP)
+    {
+        for (auto* io : tmp)
+        {
+            if (io->isCorked && evbuffer_get_length(io->outbuf) <= TcpIncrement)
+            {
+                tr_peerIoSetCorked(io, false);
+            }
+        }
+    }
+
     /* Second phase of IO. To help us scale in high bandwidth situations,
      * enable on-demand IO for peers with bandwidth left to burn.
      * This on-demand IO is enabled until (1) the peer runs out of bandwidth,
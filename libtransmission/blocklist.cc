@@ -6,10 +6,16 @@
  *
  */
 
+#include <algorithm>
+#include <array>
+#include <cctype> /* isdigit() */
 #include <cerrno>
 #include <cstdio>
-#include <cstdlib> /* bsearch(), qsort() */
 #include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "transmission.h"
 #include "blocklist.h"
@@ -24,33 +30,64 @@
 ****  PRIVATE
 ***/
 
-struct tr_ipv4_range
+/* The .bin2 files start with this header, followed by the sorted IPv4
+   ranges and then the sorted IPv6 ranges. Files without the header are
+   .bin files written by older versions and hold nothing but IPv4 ranges. */
+struct tr_blocklist_header
 {
-    uint32_t begin;
-    uint32_t end;
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint64_t ruleCount4;
+    uint64_t ruleCount6;
 };
 
+static auto constexpr BinMagic = std::array<char, 4>{ 'T', 'R', 'B', 'L' };
+static auto constexpr BinVersion = uint32_t{ 2 };
+
+/* The saved tr_blocklist_index starts with this header, followed by its
+   IPv4 ranges and then its IPv6 ranges, both in Eytzinger order. */
+struct tr_blocklist_index_header
+{
+    std::array<char, 4> magic;
+    uint32_t version;
+    uint64_t fingerprint; /* which lists it was built from */
+    uint64_t n_ranges4;
+    uint64_t n_ranges6;
+};
+
+static auto constexpr IndexMagic = std::array<char, 4>{ 'T', 'R', 'B', 'I' };
+static auto constexpr IndexVersion = uint32_t{ 1 };
+
 struct tr_blocklistFile
 {
     bool isEnabled;
+    bool isCounted; /* ruleCount and ruleCount6 are known, even if the file isn't mapped */
     tr_sys_file_t fd;
     size_t ruleCount;
+    size_t ruleCount6;
     uint64_t byteCount;
     char* filename;
-    struct tr_ipv4_range* rules;
+    void* map;
+    struct tr_ipv4_range const* rules;
+    struct tr_ipv6_range const* rules6;
 };
 
 static void blocklistClose(tr_blocklistFile* b)
 {
-    if (b->rules != nullptr)
+    if (b->map != nullptr)
     {
-        tr_sys_file_unmap(b->rules, b->byteCount, nullptr);
+        tr_sys_file_unmap(b->map, b->byteCount, nullptr);
         tr_sys_file_close(b->fd, nullptr);
+        b->map = nullptr;
         b->rules = nullptr;
+        b->rules6 = nullptr;
         b->ruleCount = 0;
+        b->ruleCount6 = 0;
         b->byteCount = 0;
         b->fd = TR_BAD_SYS_FILE;
     }
+
+    b->isCounted = false;
 }
 
 static void blocklistLoad(tr_blocklistFile* b)
@@ -80,8 +117,8 @@ static void blocklistLoad(tr_blocklistFile* b)
         return;
     }
 
-    b->rules = static_cast<struct tr_ipv4_range*>(tr_sys_file_map_for_reading(fd, 0, byteCount, &error));
-    if (b->rules == nullptr)
+    b->map = tr_sys_file_map_for_reading(fd, 0, byteCount, &error);
+    if (b->map == nullptr)
     {
         tr_logAddError(err_fmt, b->filename, error->message);
         tr_sys_file_close(fd, nullptr);
@@ -91,43 +128,178 @@ static void blocklistLoad(tr_blocklistFile* b)
 
     b->fd = fd;
     b->byteCount = byteCount;
-    b->ruleCount = byteCount / sizeof(struct tr_ipv4_range);
 
-    char* const base = tr_sys_path_basename(b->filename, nullptr);
-    tr_logAddInfo(_("Blocklist \"%s\" contains %zu entries"), base, b->ruleCount);
-    tr_free(base);
+    auto header = tr_blocklist_header{};
+    auto const* const base = static_cast<uint8_t const*>(b->map);
+    if (byteCount >= sizeof(header))
+    {
+        memcpy(&header, base, sizeof(header));
+    }
+
+    if (header.magic == BinMagic && header.version == BinVersion &&
+        byteCount == sizeof(header) + header.ruleCount4 * sizeof(tr_ipv4_range) + header.ruleCount6 * sizeof(tr_ipv6_range))
+    {
+        b->ruleCount = header.ruleCount4;
+        b->ruleCount6 = header.ruleCount6;
+        b->rules = reinterpret_cast<tr_ipv4_range const*>(base + sizeof(header));
+        b->rules6 = reinterpret_cast<tr_ipv6_range const*>(base + sizeof(header) + b->ruleCount * sizeof(tr_ipv4_range));
+    }
+    else
+    {
+        b->ruleCount = byteCount / sizeof(struct tr_ipv4_range);
+        b->rules = static_cast<tr_ipv4_range const*>(b->map);
+    }
+
+    b->isCounted = true;
+
+    char* const name = tr_sys_path_basename(b->filename, nullptr);
+    tr_logAddInfo(_("Blocklist \"%s\" contains %zu entries"), name, b->ruleCount + b->ruleCount6);
+    tr_free(name);
 }
 
 static void blocklistEnsureLoaded(tr_blocklistFile* b)
 {
-    if (b->rules == nullptr)
+    if (b->map == nullptr)
     {
         blocklistLoad(b);
     }
 }
 
-static int compareAddressToRange(void const* va, void const* vb)
+/* unmap the rules once they're in the index, but remember how many there were */
+static void blocklistRelease(tr_blocklistFile* b)
+{
+    auto const ruleCount = b->ruleCount;
+    auto const ruleCount6 = b->ruleCount6;
+    auto const isCounted = b->isCounted;
+
+    blocklistClose(b);
+
+    b->ruleCount = ruleCount;
+    b->ruleCount6 = ruleCount6;
+    b->isCounted = isCounted;
+}
+
+static void blocklistDelete(tr_blocklistFile* b)
+{
+    blocklistClose(b);
+    tr_sys_path_remove(b->filename, nullptr);
+}
+
+/* sort the ranges by their first address and merge the ones that overlap */
+template<typename Range>
+static void mergeRanges(std::vector<Range>& ranges)
+{
+    if (std::empty(ranges))
+    {
+        return;
+    }
+
+    std::sort(std::begin(ranges), std::end(ranges), [](auto const& a, auto const& b) { return a.begin < b.begin; });
+
+    auto keep = std::begin(ranges);
+
+    for (auto it = std::next(keep), end = std::end(ranges); it != end; ++it)
+    {
+        if (keep->end < it->begin)
+        {
+            *++keep = *it;
+        }
+        else if (keep->end < it->end)
+        {
+            keep->end = it->end;
+        }
+    }
+
+    ranges.erase(std::next(keep), std::end(ranges));
+
+#ifdef TR_ENABLE_ASSERTS
+
+    /* sanity checks: make sure the rules are sorted in ascending order and don't overlap */
+    for (size_t i = 0; i < std::size(ranges); ++i)
+    {
+        TR_ASSERT(!(ranges[i].end < ranges[i].begin));
+    }
+
+    for (size_t i = 1; i < std::size(ranges); ++i)
+    {
+        TR_ASSERT(ranges[i - 1].end < ranges[i].begin);
+    }
+
+#endif
+}
+
+/* copy the sorted ranges into `out` in Eytzinger order with an in-order walk of the implicit tree */
+template<typename Range>
+static size_t eytzingerFill(std::vector<Range> const& sorted, std::vector<Range>& out, size_t i, size_t k)
 {
-    auto const* a = static_cast<uint32_t const*>(va);
-    auto const* b = static_cast<struct tr_ipv4_range const*>(vb);
+    if (k < std::size(out))
+    {
+        i = eytzingerFill(sorted, out, i, 2 * k);
+        out[k] = sorted[i++];
+        i = eytzingerFill(sorted, out, i, 2 * k + 1);
+    }
 
-    if (*a < b->begin)
+    return i;
+}
+
+template<typename Range, typename Address>
+static bool eytzingerContains(Range const* ranges, size_t n, Address const& addr)
+{
+    /* descend to the leaves, going right whenever the range ends before `addr` */
+    auto k = size_t{ 1 };
+    while (k < n)
     {
-        return -1;
+        k = 2 * k + (ranges[k].end < addr ? 1 : 0);
     }
 
-    if (*a > b->end)
+    /* undo the trailing right turns and the last left one
+       to get the first range that ends at or after `addr` */
+    while ((k & 1) != 0)
     {
-        return 1;
+        k >>= 1;
     }
 
-    return 0;
+    k >>= 1;
+
+    return k != 0 && !(addr < ranges[k].begin);
 }
 
-static void blocklistDelete(tr_blocklistFile* b)
+static bool hasEnabledBlocklist(std::list<tr_blocklistFile*> const& blocklists)
 {
-    blocklistClose(b);
-    tr_sys_path_remove(b->filename, nullptr);
+    return std::any_of(std::begin(blocklists), std::end(blocklists), [](auto const* b) { return b->isEnabled; });
+}
+
+/* identifies the enabled blocklists' .bin files as they are now, with an FNV-1a hash
+   of their names, sizes and modification times. `newest` is set to the newest of those. */
+static uint64_t blocklistsFingerprint(std::list<tr_blocklistFile*> const& blocklists, time_t* newest)
+{
+    auto hash = uint64_t{ 14695981039346656037ULL };
+    auto const mix = [&hash](void const* data, size_t len)
+    {
+        auto const* const bytes = static_cast<uint8_t const*>(data);
+        for (size_t i = 0; i < len; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 1099511628211ULL;
+        }
+    };
+
+    *newest = 0;
+
+    for (auto const* const b : blocklists)
+    {
+        auto info = tr_sys_path_info{};
+        if (!b->isEnabled || !tr_sys_path_get_info(b->filename, 0, &info, nullptr))
+        {
+            continue;
+        }
+
+        mix(b->filename, strlen(b->filename) + 1);
+        mix(&info.size, sizeof(info.size));
+        mix(&info.last_modified_at, sizeof(info.last_modified_at));
+        *newest = std::max(*newest, info.last_modified_at);
+    }
+
+    return hash;
 }
 
 /***
@@ -163,9 +335,13 @@ bool tr_blocklistFileExists(tr_blocklistFile const* b)
 
 int tr_blocklistFileGetRuleCount(tr_blocklistFile const* b)
 {
-    blocklistEnsureLoaded((tr_blocklistFile*)b);
+    if (!b->isCounted)
+    {
+        blocklistLoad((tr_blocklistFile*)b);
+        blocklistRelease((tr_blocklistFile*)b);
+    }
 
-    return b->ruleCount;
+    return b->ruleCount + b->ruleCount6;
 }
 
 bool tr_blocklistFileIsEnabled(tr_blocklistFile* b)
@@ -180,28 +356,256 @@ void tr_blocklistFileSetEnabled(tr_blocklistFile* b, bool isEnabled)
     b->isEnabled = isEnabled;
 }
 
-bool tr_blocklistFileHasAddress(tr_blocklistFile* b, tr_address const* addr)
+/***
+****
+***/
+
+tr_blocklist_index::~tr_blocklist_index()
+{
+    unmap();
+}
+
+void tr_blocklist_index::setFilename(std::string filename)
+{
+    filename_ = std::move(filename);
+}
+
+void tr_blocklist_index::open(std::list<tr_blocklistFile*> const& blocklists)
 {
-    TR_ASSERT(tr_address_is_valid(addr));
+    if (!hasEnabledBlocklist(blocklists))
+    {
+        clear();
+        return;
+    }
 
-    if (!b->isEnabled || addr->type == TR_AF_INET6)
+    auto newest = time_t{};
+    auto const fingerprint = blocklistsFingerprint(blocklists, &newest);
+
+    /* a list that changed in the same second the index was saved might not be in it */
+    auto info = tr_sys_path_info{};
+    if (!std::empty(filename_) && tr_sys_path_get_info(filename_.c_str(), 0, &info, nullptr) &&
+        newest < info.last_modified_at && map(fingerprint))
+    {
+        heap4_ = std::vector<tr_ipv4_range>(1);
+        heap6_ = std::vector<tr_ipv6_range>(1);
+        ++generation_;
+        return;
+    }
+
+    rebuild(blocklists);
+}
+
+void tr_blocklist_index::rebuild(std::list<tr_blocklistFile*> const& blocklists)
+{
+    /* don't overwrite the saved index just because the lists are off for now */
+    if (!hasEnabledBlocklist(blocklists))
+    {
+        clear();
+        return;
+    }
+
+    auto newest = time_t{};
+    auto const fingerprint = blocklistsFingerprint(blocklists, &newest);
+    auto ranges4 = std::vector<tr_ipv4_range>{};
+    auto ranges6 = std::vector<tr_ipv6_range>{};
+
+    for (auto* const b : blocklists)
+    {
+        if (!b->isEnabled)
+        {
+            continue;
+        }
+
+        blocklistEnsureLoaded(b);
+        ranges4.insert(std::end(ranges4), b->rules, b->rules + b->ruleCount);
+        ranges6.insert(std::end(ranges6), b->rules6, b->rules6 + b->ruleCount6);
+        blocklistRelease(b);
+    }
+
+    rebuild(std::move(ranges4), std::move(ranges6), fingerprint);
+}
+
+void tr_blocklist_index::rebuild(std::vector<tr_ipv4_range> ranges4, std::vector<tr_ipv6_range> ranges6)
+{
+    rebuild(std::move(ranges4), std::move(ranges6), 0);
+}
+
+void tr_blocklist_index::rebuild(std::vector<tr_ipv4_range> ranges4, std::vector<tr_ipv6_range> ranges6, uint64_t fingerprint)
+{
+    mergeRanges(ranges4);
+    auto eytzinger4 = std::vector<tr_ipv4_range>(std::size(ranges4) + 1);
+    eytzingerFill(ranges4, eytzinger4, 0, 1);
+
+    mergeRanges(ranges6);
+    auto eytzinger6 = std::vector<tr_ipv6_range>(std::size(ranges6) + 1);
+    eytzingerFill(ranges6, eytzinger6, 0, 1);
+
+    unmap();
+
+    if (save(eytzinger4, eytzinger6, fingerprint) && map(fingerprint))
+    {
+        heap4_ = std::vector<tr_ipv4_range>(1);
+        heap6_ = std::vector<tr_ipv6_range>(1);
+    }
+    else
+    {
+        useHeap(std::move(eytzinger4), std::move(eytzinger6));
+    }
+
+    ++generation_;
+}
+
+void tr_blocklist_index::clear()
+{
+    unmap();
+    useHeap(std::vector<tr_ipv4_range>(1), std::vector<tr_ipv6_range>(1));
+    ++generation_;
+}
+
+bool tr_blocklist_index::save(
+    std::vector<tr_ipv4_range> const& ranges4,
+    std::vector<tr_ipv6_range> const& ranges6,
+    uint64_t fingerprint) const
+{
+    if (std::empty(filename_))
     {
         return false;
     }
 
-    blocklistEnsureLoaded(b);
+    auto header = tr_blocklist_index_header{};
+    header.magic = IndexMagic;
+    header.version = IndexVersion;
+    header.fingerprint = fingerprint;
+    header.n_ranges4 = std::size(ranges4);
+    header.n_ranges6 = std::size(ranges6);
+
+    /* write it to the side so that a crash can't leave half an index behind */
+    auto const tmpname = filename_ + ".tmp";
+    tr_error* error = nullptr;
+
+    auto const flags = TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE | TR_SYS_FILE_TRUNCATE;
+    auto const fd = tr_sys_file_open(tmpname.c_str(), flags, 0666, &error);
+    auto ok = fd != TR_BAD_SYS_FILE && tr_sys_file_write(fd, &header, sizeof(header), nullptr, &error) &&
+        tr_sys_file_write(fd, std::data(ranges4), sizeof(tr_ipv4_range) * std::size(ranges4), nullptr, &error) &&
+        tr_sys_file_write(fd, std::data(ranges6), sizeof(tr_ipv6_range) * std::size(ranges6), nullptr, &error);
+
+    if (fd != TR_BAD_SYS_FILE)
+    {
+        tr_sys_file_close(fd, nullptr);
+    }
+
+    ok = ok && tr_sys_path_rename(tmpname.c_str(), filename_.c_str(), &error);
+
+    if (!ok)
+    {
+        tr_logAddError(_("Couldn't save file \"%1$s\": %2$s"), filename_.c_str(), error->message);
+        tr_error_free(error);
+        tr_sys_path_remove(tmpname.c_str(), nullptr);
+    }
+
+    return ok;
+}
+
+bool tr_blocklist_index::map(uint64_t fingerprint)
+{
+    unmap();
 
-    if (b->rules == nullptr || b->ruleCount == 0)
+    auto header = tr_blocklist_index_header{};
+    auto info = tr_sys_path_info{};
+    if (!tr_sys_path_get_info(filename_.c_str(), 0, &info, nullptr) || info.size < sizeof(header))
     {
         return false;
     }
 
-    auto const needle = ntohl(addr->addr.addr4.s_addr);
+    tr_error* error = nullptr;
+    auto const fd = tr_sys_file_open(filename_.c_str(), TR_SYS_FILE_READ, 0, &error);
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        tr_logAddError(_("Couldn't read \"%1$s\": %2$s"), filename_.c_str(), error->message);
+        tr_error_free(error);
+        return false;
+    }
 
-    auto const* range = static_cast<struct tr_ipv4_range const*>(
-        bsearch(&needle, b->rules, b->ruleCount, sizeof(struct tr_ipv4_range), compareAddressToRange));
+    /* the mapping outlives the descriptor */
+    auto* const map = tr_sys_file_map_for_reading(fd, 0, info.size, &error);
+    tr_sys_file_close(fd, nullptr);
+    if (map == nullptr)
+    {
+        tr_logAddError(_("Couldn't read \"%1$s\": %2$s"), filename_.c_str(), error->message);
+        tr_error_free(error);
+        return false;
+    }
+
+    memcpy(&header, map, sizeof(header));
+    auto const payload = info.size - sizeof(header);
+
+    if (header.magic != IndexMagic || header.version != IndexVersion || header.fingerprint != fingerprint ||
+        header.n_ranges4 == 0 || header.n_ranges6 == 0 || header.n_ranges4 > payload / sizeof(tr_ipv4_range) ||
+        header.n_ranges6 > payload / sizeof(tr_ipv6_range) ||
+        payload != header.n_ranges4 * sizeof(tr_ipv4_range) + header.n_ranges6 * sizeof(tr_ipv6_range))
+    {
+        tr_sys_file_unmap(map, info.size, nullptr);
+        return false;
+    }
+
+    auto const* const base = static_cast<uint8_t const*>(map) + sizeof(header);
+    map_ = map;
+    map_size_ = info.size;
+    ranges4_ = reinterpret_cast<tr_ipv4_range const*>(base);
+    n_ranges4_ = header.n_ranges4;
+    ranges6_ = reinterpret_cast<tr_ipv6_range const*>(base + n_ranges4_ * sizeof(tr_ipv4_range));
+    n_ranges6_ = header.n_ranges6;
+    return true;
+}
+
+void tr_blocklist_index::unmap()
+{
+    if (map_ != nullptr)
+    {
+        tr_sys_file_unmap(map_, map_size_, nullptr);
+        map_ = nullptr;
+        map_size_ = 0;
+    }
 
-    return range != nullptr;
+    ranges4_ = std::data(heap4_);
+    n_ranges4_ = std::size(heap4_);
+    ranges6_ = std::data(heap6_);
+    n_ranges6_ = std::size(heap6_);
+}
+
+void tr_blocklist_index::useHeap(std::vector<tr_ipv4_range> ranges4, std::vector<tr_ipv6_range> ranges6)
+{
+    TR_ASSERT(map_ == nullptr);
+
+    heap4_ = std::move(ranges4);
+    heap6_ = std::move(ranges6);
+    ranges4_ = std::data(heap4_);
+    n_ranges4_ = std::size(heap4_);
+    ranges6_ = std::data(heap6_);
+    n_ranges6_ = std::size(heap6_);
+}
+
+bool tr_blocklist_index::contains(tr_address const& addr) const
+{
+    TR_ASSERT(tr_address_is_valid(&addr));
+
+    if (addr.type == TR_AF_INET)
+    {
+        return eytzingerContains(ranges4_, n_ranges4_, ntohl(addr.addr.addr4.s_addr));
+    }
+
+    auto key = std::array<uint8_t, 16>{};
+    memcpy(std::data(key), &addr.addr.addr6, std::size(key));
+
+    /* check IPv4-mapped addresses, ::ffff:a.b.c.d, against the IPv4 ranges */
+    static auto constexpr V4MappedPrefix = std::array<uint8_t, 12>{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    if (std::equal(std::begin(V4MappedPrefix), std::end(V4MappedPrefix), std::begin(key)))
+    {
+        auto const addr4 = uint32_t{ key[12] } << 24 | uint32_t{ key[13] } << 16 | uint32_t{ key[14] } << 8 | key[15];
+        return eytzingerContains(ranges4_, n_ranges4_, addr4);
+    }
+
+    return eytzingerContains(ranges6_, n_ranges6_, key);
 }
 
 /*
@@ -335,17 +739,92 @@ static bool parseLine(char const* line, struct tr_ipv4_range* range)
     return parseLine1(line, range) || parseLine2(line, range) || parseLine3(line, range);
 }
 
-static int compareAddressRangesByFirstAddress(void const* va, void const* vb)
+static bool parseAddress6(std::string_view str, std::array<uint8_t, 16>* setme)
+{
+    auto addr = tr_address{};
+
+    if (!tr_address_from_string(&addr, tr_strvStrip(str)) || addr.type != TR_AF_INET6)
+    {
+        return false;
+    }
+
+    memcpy(std::data(*setme), &addr.addr.addr6, std::size(*setme));
+    return true;
+}
+
+/*
+ * P2P plaintext format with IPv6 addresses: "comment:x:x::x-y:y::y"
+ */
+static bool parseLine6P2P(std::string_view line, struct tr_ipv6_range* range)
 {
-    auto const* a = static_cast<struct tr_ipv4_range const*>(va);
-    auto const* b = static_cast<struct tr_ipv4_range const*>(vb);
+    auto const dash = line.rfind('-');
 
-    if (a->begin != b->begin)
+    if (dash == std::string_view::npos || !parseAddress6(line.substr(dash + 1), &range->end))
     {
-        return a->begin < b->begin ? -1 : 1;
+        return false;
+    }
+
+    /* the comment can contain colons too, so try each one
+       until what follows it is an IPv6 address */
+    auto const head = line.substr(0, dash);
+
+    for (auto colon = head.find(':'); colon != std::string_view::npos; colon = head.find(':', colon + 1))
+    {
+        if (parseAddress6(head.substr(colon + 1), &range->begin))
+        {
+            return !(range->end < range->begin);
+        }
     }
 
-    return 0;
+    return false;
+}
+
+/*
+ * CIDR notation with an IPv6 address: "2001:db8::/32"
+ */
+static bool parseLine6CIDR(std::string_view line, struct tr_ipv6_range* range)
+{
+    auto const slash = line.find('/');
+    auto addr = std::array<uint8_t, 16>{};
+
+    if (slash == std::string_view::npos || !parseAddress6(line.substr(0, slash), &addr))
+    {
+        return false;
+    }
+
+    auto const pflen_str = tr_strvStrip(line.substr(slash + 1));
+    auto pflen = size_t{ 0 };
+    if (std::empty(pflen_str) || std::size(pflen_str) > 3 ||
+        !std::all_of(std::begin(pflen_str), std::end(pflen_str), [](auto ch) { return isdigit(ch) != 0; }))
+    {
+        return false;
+    }
+
+    for (auto const ch : pflen_str)
+    {
+        pflen = pflen * 10 + static_cast<size_t>(ch - '0');
+    }
+
+    if (pflen > 128)
+    {
+        return false;
+    }
+
+    /* fill the non-prefix bits the way we need it */
+    for (size_t i = 0; i < std::size(addr); ++i)
+    {
+        auto const bits = std::min(size_t{ 8 }, pflen > i * 8 ? pflen - i * 8 : 0);
+        auto const mask = static_cast<uint8_t>(0xFF00 >> bits);
+        range->begin[i] = addr[i] & mask;
+        range->end[i] = addr[i] | static_cast<uint8_t>(~mask);
+    }
+
+    return true;
+}
+
+static bool parseLine6(char const* line, struct tr_ipv6_range* range)
+{
+    return parseLine6CIDR(line, range) || parseLine6P2P(line, range);
 }
 
 int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
@@ -353,10 +832,8 @@ int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
     int inCount = 0;
     char line[2048];
     char const* err_fmt = _("Couldn't read \"%1$s\": %2$s");
-    // TODO: should be a vector
-    struct tr_ipv4_range* ranges = nullptr;
-    size_t ranges_alloc = 0;
-    size_t ranges_count = 0;
+    auto ranges = std::vector<tr_ipv4_range>{};
+    auto ranges6 = std::vector<tr_ipv6_range>{};
     tr_error* error = nullptr;
 
     if (filename == nullptr)
@@ -388,68 +865,39 @@ int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
     while (tr_sys_file_read_line(in, line, sizeof(line), nullptr))
     {
         struct tr_ipv4_range range;
+        struct tr_ipv6_range range6;
 
         ++inCount;
 
-        if (!parseLine(line, &range))
+        if (parseLine(line, &range))
         {
-            /* don't try to display the actual lines - it causes issues */
-            tr_logAddError(_("blocklist skipped invalid address at line %d"), inCount);
-            continue;
+            ranges.push_back(range);
         }
-
-        if (ranges_alloc == ranges_count)
+        else if (parseLine6(line, &range6))
         {
-            ranges_alloc += 4096; /* arbitrary */
-            ranges = tr_renew(struct tr_ipv4_range, ranges, ranges_alloc);
+            ranges6.push_back(range6);
         }
-
-        ranges[ranges_count++] = range;
-    }
-
-    if (ranges_count > 0) /* sort and merge */
-    {
-        struct tr_ipv4_range* keep = ranges;
-
-        /* sort */
-        qsort(ranges, ranges_count, sizeof(struct tr_ipv4_range), compareAddressRangesByFirstAddress);
-
-        /* merge */
-        for (size_t i = 1; i < ranges_count; ++i)
+        else
         {
-            struct tr_ipv4_range const* r = &ranges[i];
-
-            if (keep->end < r->begin)
-            {
-                *++keep = *r;
-            }
-            else if (keep->end < r->end)
-            {
-                keep->end = r->end;
-            }
+            /* don't try to display the actual lines - it causes issues */
+            tr_logAddError(_("blocklist skipped invalid address at line %d"), inCount);
         }
+    }
 
-        ranges_count = keep + 1 - ranges;
+    mergeRanges(ranges);
+    mergeRanges(ranges6);
 
-#ifdef TR_ENABLE_ASSERTS
+    auto header = tr_blocklist_header{};
+    header.magic = BinMagic;
+    header.version = BinVersion;
+    header.ruleCount4 = std::size(ranges);
+    header.ruleCount6 = std::size(ranges6);
 
-        /* sanity checks: make sure the rules are sorted in ascending order and don't overlap */
-        {
-            for (size_t i = 0; i < ranges_count; ++i)
-            {
-                TR_ASSERT(ranges[i].begin <= ranges[i].end);
-            }
-
-            for (size_t i = 1; i < ranges_count; ++i)
-            {
-                TR_ASSERT(ranges[i - 1].end < ranges[i].begin);
-            }
-        }
-
-#endif
-    }
+    auto const ranges_count = std::size(ranges) + std::size(ranges6);
 
-    if (!tr_sys_file_write(out, ranges, sizeof(struct tr_ipv4_range) * ranges_count, nullptr, &error))
+    if (!tr_sys_file_write(out, &header, sizeof(header), nullptr, &error) ||
+        !tr_sys_file_write(out, std::data(ranges), sizeof(tr_ipv4_range) * std::size(ranges), nullptr, &error) ||
+        !tr_sys_file_write(out, std::data(ranges6), sizeof(tr_ipv6_range) * std::size(ranges6), nullptr, &error))
     {
         tr_logAddError(_("Couldn't save file \"%1$s\": %2$s"), b->filename, error->message);
         tr_error_free(error);
@@ -461,11 +909,12 @@ int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename)
         tr_free(base);
     }
 
-    tr_free(ranges);
     tr_sys_file_close(out, nullptr);
     tr_sys_file_close(in, nullptr);
 
+    /* count the rules, but leave mapping them to the index */
     blocklistLoad(b);
+    blocklistRelease(b);
 
     return ranges_count;
 }
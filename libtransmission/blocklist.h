@@ -12,12 +12,33 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
 #include "tr-macros.h"
 
 struct tr_address;
 
 struct tr_blocklistFile;
 
+/* an inclusive range of IPv4 addresses, in host byte order */
+struct tr_ipv4_range
+{
+    uint32_t begin;
+    uint32_t end;
+};
+
+/* an inclusive range of IPv6 addresses, in network byte order */
+struct tr_ipv6_range
+{
+    std::array<uint8_t, 16> begin;
+    std::array<uint8_t, 16> end;
+};
+
 tr_blocklistFile* tr_blocklistFileNew(char const* filename, bool isEnabled);
 
 bool tr_blocklistFileExists(tr_blocklistFile const* b);
@@ -32,6 +53,97 @@ bool tr_blocklistFileIsEnabled(tr_blocklistFile* b);
 
 void tr_blocklistFileSetEnabled(tr_blocklistFile* b, bool isEnabled);
 
-bool tr_blocklistFileHasAddress(tr_blocklistFile* b, struct tr_address const* addr);
-
 int tr_blocklistFileSetContent(tr_blocklistFile* b, char const* filename);
+
+/**
+ * The ranges of every enabled blocklist, merged into one index so that
+ * checking an address is a single O(log n) search no matter how many
+ * lists there are.
+ *
+ * Overlapping ranges are merged, and each address family's ranges are
+ * kept in one flat array in Eytzinger (BFS) order: the first few levels
+ * of the search tree share a handful of cache lines, and the search
+ * needs no branches that depend on the comparisons.
+ *
+ * The arrays are saved to one file that's mapped for reading, so the
+ * merged index costs no heap, and the lists' own .bin2 files are only
+ * mapped while the index is built. The file remembers which lists it
+ * was built from, so at startup it's reused unless they've changed.
+ *
+ * generation() changes whenever the index is rebuilt, so callers can
+ * cache lookups and know when their cached results are stale.
+ */
+class tr_blocklist_index
+{
+public:
+    tr_blocklist_index() = default;
+
+    tr_blocklist_index(tr_blocklist_index const&) = delete;
+    tr_blocklist_index& operator=(tr_blocklist_index const&) = delete;
+
+    ~tr_blocklist_index();
+
+    // where the index is saved. If it's empty, or the file can't be
+    // written, the index is kept on the heap instead.
+    void setFilename(std::string filename);
+
+    // use the index that was saved for these blocklists if they haven't
+    // changed since, or rebuild it if they have
+    void open(std::list<tr_blocklistFile*> const& blocklists);
+
+    // rebuild the index from the ranges of the enabled blocklists
+    void rebuild(std::list<tr_blocklistFile*> const& blocklists);
+
+    // rebuild the index from these ranges, which may overlap or be unsorted
+    void rebuild(std::vector<tr_ipv4_range> ranges4, std::vector<tr_ipv6_range> ranges6);
+
+    // empties the index. The saved file is kept for the next open().
+    void clear();
+
+    [[nodiscard]] bool contains(tr_address const& addr) const;
+
+    [[nodiscard]] size_t size() const
+    {
+        return n_ranges4_ + n_ranges6_ - 2;
+    }
+
+    // true if the index is mapped from its file rather than kept on the heap
+    [[nodiscard]] bool isMapped() const
+    {
+        return map_ != nullptr;
+    }
+
+    [[nodiscard]] uint64_t generation() const
+    {
+        return generation_;
+    }
+
+private:
+    void rebuild(std::vector<tr_ipv4_range> ranges4, std::vector<tr_ipv6_range> ranges6, uint64_t fingerprint);
+    [[nodiscard]] bool save(
+        std::vector<tr_ipv4_range> const& ranges4,
+        std::vector<tr_ipv6_range> const& ranges6,
+        uint64_t fingerprint) const;
+    [[nodiscard]] bool map(uint64_t fingerprint);
+    void unmap();
+    void useHeap(std::vector<tr_ipv4_range> ranges4, std::vector<tr_ipv6_range> ranges6);
+
+    std::string filename_;
+
+    void* map_ = nullptr;
+    uint64_t map_size_ = 0;
+
+    // used when the index isn't mapped
+    std::vector<tr_ipv4_range> heap4_ = std::vector<tr_ipv4_range>(1);
+    std::vector<tr_ipv6_range> heap6_ = std::vector<tr_ipv6_range>(1);
+
+    // 1-based Eytzinger layout; index 0 is unused.
+    // These point into either map_ or the heap vectors.
+    tr_ipv4_range const* ranges4_ = std::data(heap4_);
+    size_t n_ranges4_ = 1;
+    tr_ipv6_range const* ranges6_ = std::data(heap6_);
+    size_t n_ranges6_ = 1;
+
+    // 0 is reserved for "never checked"
+    uint64_t generation_ = 1;
+};
@@ -6,7 +6,9 @@
  *
  */
 
+#include <algorithm>
 #include <cstdlib> /* qsort() */
+#include <optional>
 
 #include <event2/buffer.h>
 
@@ -45,16 +47,141 @@ struct cache_block
 
 struct tr_cache
 {
-    tr_ptrArray blocks;
-    int max_blocks;
-    size_t max_bytes;
+    tr_ptrArray blocks = {};
+    int max_blocks = 0;
+    size_t max_bytes = 0;
 
-    size_t disk_writes;
-    size_t disk_write_bytes;
-    size_t cache_writes;
-    size_t cache_write_bytes;
+    size_t disk_writes = 0;
+    size_t disk_write_bytes = 0;
+    size_t cache_writes = 0;
+    size_t cache_write_bytes = 0;
+
+    tr_read_cache read_cache;
 };
 
+/****
+*****  Read cache
+****/
+
+void tr_read_cache::setLimit(size_t max_bytes)
+{
+    max_bytes_ = max_bytes;
+    evict();
+}
+
+uint8_t const* tr_read_cache::get(Key const& key)
+{
+    auto const found = index_.find(key);
+    if (found == std::end(index_))
+    {
+        ++stats_.misses;
+        return nullptr;
+    }
+
+    // 2Q: a span in `in_` stays where it is, so a burst of requests
+    // for one span doesn't look like it's popular
+    auto const it = found->second;
+    if (it->in_main)
+    {
+        main_.splice(std::begin(main_), main_, it);
+    }
+
+    ++stats_.hits;
+    return it->data.get();
+}
+
+uint8_t* tr_read_cache::add(Key const& key, size_t len)
+{
+    // a span bigger than `in_`'s share of the budget would evict itself
+    if (len == 0 || len > max_bytes_ / 4)
+    {
+        return nullptr;
+    }
+
+    remove(key);
+
+    // if it fell out of `in_` and was asked for again, it's popular
+    auto in_main = false;
+    if (auto const ghost = ghost_index_.find(key); ghost != std::end(ghost_index_))
+    {
+        ghost_bytes_ -= ghost->second->second;
+        ghosts_.erase(ghost->second);
+        ghost_index_.erase(ghost);
+        in_main = true;
+    }
+
+    auto& list = in_main ? main_ : in_;
+    list.push_front(Entry{ key, std::unique_ptr<uint8_t[]>{ new uint8_t[len] }, len, in_main });
+    index_.emplace(key, std::begin(list));
+    (in_main ? main_bytes_ : in_bytes_) += len;
+
+    evict();
+    return list.front().data.get();
+}
+
+void tr_read_cache::remove(Key const& key)
+{
+    if (auto const found = index_.find(key); found != std::end(index_))
+    {
+        erase(found->second);
+    }
+}
+
+void tr_read_cache::removeTorrent(int tor_id)
+{
+    for (auto* const list : { &in_, &main_ })
+    {
+        for (auto it = std::begin(*list); it != std::end(*list);)
+        {
+            auto const next = std::next(it);
+
+            if (it->key.tor_id == tor_id)
+            {
+                erase(it);
+            }
+
+            it = next;
+        }
+    }
+}
+
+void tr_read_cache::erase(Entries::iterator it)
+{
+    index_.erase(it->key);
+    (it->in_main ? main_bytes_ : in_bytes_) -= it->len;
+    (it->in_main ? main_ : in_).erase(it);
+}
+
+void tr_read_cache::evict()
+{
+    while (size() > max_bytes_)
+    {
+        if (in_bytes_ > max_bytes_ / 4 || std::empty(main_))
+        {
+            // remember the key of what we're evicting from `in_`
+            auto const& entry = in_.back();
+            auto const len = entry.len;
+            ghosts_.emplace_front(entry.key, len);
+            ghost_index_[entry.key] = std::begin(ghosts_);
+            ghost_bytes_ += len;
+            erase(std::prev(std::end(in_)));
+        }
+        else
+        {
+            erase(std::prev(std::end(main_)));
+        }
+    }
+
+    // remember about half the budget's worth of evicted keys
+    while (ghost_bytes_ > max_bytes_ / 2)
+    {
+        auto const& [key, len] = ghosts_.back();
+        ghost_bytes_ -= len;
+        ghost_index_.erase(key);
+        ghosts_.pop_back();
+    }
+}
+
 /****
 *****
 ****/
@@ -169,6 +296,8 @@ static int flushContiguous(tr_cache* cache, int pos, int n)
     tr_torrent* tor = b->tor;
     tr_piece_index_t const piece = b->piece;
     uint32_t const offset = b->offset;
+    auto& metrics = tor->session->metrics;
+    auto const timer = metrics.time(tr_metrics::Timer::CacheFlush);
 
     for (int i = 0; i < n; ++i)
     {
@@ -186,6 +315,7 @@ static int flushContiguous(tr_cache* cache, int pos, int n)
 
     ++cache->disk_writes;
     cache->disk_write_bytes += walk - buf;
+    metrics.add(tr_metrics::Counter::BytesCopied, walk - buf);
     return err;
 }
 
@@ -263,10 +393,29 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
     return cache->max_bytes;
 }
 
+void tr_cacheSetReadLimit(tr_cache* cache, int64_t max_bytes)
+{
+    char buf[128];
+
+    cache->read_cache.setLimit(max_bytes);
+
+    tr_formatter_mem_B(buf, max_bytes, sizeof(buf));
+    tr_logAddNamedDbg(MY_NAME, "Maximum read cache size set to %s", buf);
+}
+
+int64_t tr_cacheGetReadLimit(tr_cache const* cache)
+{
+    return cache->read_cache.limit();
+}
+
+tr_read_cache::Stats tr_cacheGetReadStats(tr_cache const* cache)
+{
+    return cache->read_cache.stats();
+}
+
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* const cache = new tr_cache{};
     cache->max_bytes = max_bytes;
     cache->max_blocks = getMaxBlocks(max_bytes);
     return cache;
@@ -281,7 +430,7 @@ void tr_cacheFree(tr_cache* cache)
     TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
 
     tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
+    delete cache;
 }
 
 /***
@@ -339,10 +488,16 @@ int tr_cacheWriteBlock(
         cb->block = torrent->blockOf(piece, offset);
         cb->evbuf = evbuffer_new();
         tr_ptrArrayInsertSorted(&cache->blocks, cb, cache_block_compare);
+        torrent->session->metrics.add(tr_metrics::Counter::BlocksCached);
     }
 
     TR_ASSERT(cb->length == length);
 
+    // the read cache's copy of this span is out of date now
+    auto const span = offset / tr_read_cache::SpanSize;
+    cache->read_cache.remove({ torrent->uniqueId, piece, span });
+    cache->read_cache.remove({ torrent->uniqueId, piece, (offset + length - 1) / tr_read_cache::SpanSize });
+
     cb->time = tr_time();
 
     evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
@@ -354,6 +509,94 @@ int tr_cacheWriteBlock(
     return cacheTrim(cache);
 }
 
+static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
+{
+    struct cache_block key;
+    key.tor = torrent;
+    key.block = block;
+    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
+}
+
+// Which read cache span holds [offset, offset + len), if it can be cached.
+// Only spans of pieces we have, and that aren't waiting to be written, can be.
+static std::optional<tr_read_cache::Key> getReadSpan(
+    tr_cache* cache,
+    tr_torrent* tor,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len)
+{
+    if (cache->read_cache.limit() == 0 || !tor->hasPiece(piece))
+    {
+        return {};
+    }
+
+    auto const span = offset / tr_read_cache::SpanSize;
+    auto const span_begin = span * tr_read_cache::SpanSize;
+    auto const span_end = std::min(span_begin + tr_read_cache::SpanSize, tor->pieceSize(piece));
+    if (offset + len > span_end)
+    {
+        return {};
+    }
+
+    auto const first_block = tor->blockOf(piece, span_begin);
+    auto const last_block = tor->blockOf(piece, span_end - 1);
+    auto const pos = findBlockPos(cache, tor, first_block);
+    if (pos < tr_ptrArraySize(&cache->blocks))
+    {
+        auto const* const b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+        if (b->tor == tor && b->block <= last_block)
+        {
+            return {};
+        }
+    }
+
+    return tr_read_cache::Key{ tor->uniqueId, piece, span };
+}
+
+// Copies a block out of the read cache, filling its span from disk first if needed
+static int readFromReadCache(
+    tr_cache* cache,
+    tr_torrent* tor,
+    tr_read_cache::Key const& key,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme)
+{
+    auto& metrics = tor->session->metrics;
+    auto const span_begin = key.span * tr_read_cache::SpanSize;
+    auto const span_len = std::min(span_begin + tr_read_cache::SpanSize, tor->pieceSize(key.piece)) - span_begin;
+
+    uint8_t const* data = cache->read_cache.get(key);
+
+    if (data != nullptr)
+    {
+        metrics.add(tr_metrics::Counter::ReadCacheHits);
+    }
+    else
+    {
+        metrics.add(tr_metrics::Counter::ReadCacheMisses);
+
+        auto* const buf = cache->read_cache.add(key, span_len);
+        if (buf == nullptr)
+        {
+            return tr_ioRead(tor, key.piece, offset, len, setme);
+        }
+
+        if (int const err = tr_ioRead(tor, key.piece, span_begin, span_len, buf); err != 0)
+        {
+            cache->read_cache.remove(key);
+            return err;
+        }
+
+        data = buf;
+    }
+
+    std::copy_n(data + (offset - span_begin), len, setme);
+    metrics.add(tr_metrics::Counter::BytesCopied, len);
+    return 0;
+}
+
 int tr_cacheReadBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -368,6 +611,11 @@ int tr_cacheReadBlock(
     if (cb != nullptr)
     {
         evbuffer_copyout(cb->evbuf, setme, len);
+        torrent->session->metrics.add(tr_metrics::Counter::BytesCopied, len);
+    }
+    else if (auto const key = getReadSpan(cache, torrent, piece, offset, len); key)
+    {
+        err = readFromReadCache(cache, torrent, *key, offset, len, setme);
     }
     else
     {
@@ -382,7 +630,22 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
     int err = 0;
     struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
 
-    if (cb == nullptr)
+    if (cb != nullptr)
+    {
+        return err;
+    }
+
+    // if the span will be read whole on a miss, prefetch all of it
+    if (auto const key = getReadSpan(cache, torrent, piece, offset, len); key)
+    {
+        if (!cache->read_cache.has(*key))
+        {
+            auto const span_begin = key->span * tr_read_cache::SpanSize;
+            auto const span_end = std::min(span_begin + tr_read_cache::SpanSize, torrent->pieceSize(piece));
+            err = tr_ioPrefetch(torrent, piece, span_begin, span_end - span_begin);
+        }
+    }
+    else
     {
         err = tr_ioPrefetch(torrent, piece, offset, len);
     }
@@ -390,18 +653,20 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
     return err;
 }
 
+void tr_cacheDropPiece(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece)
+{
+    auto const n_spans = (torrent->pieceSize(piece) + tr_read_cache::SpanSize - 1) / tr_read_cache::SpanSize;
+
+    for (uint32_t span = 0; span < n_spans; ++span)
+    {
+        cache->read_cache.remove({ torrent->uniqueId, piece, span });
+    }
+}
+
 /***
 ****
 ***/
 
-static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
-{
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = block;
-    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
-}
-
 int tr_cacheFlushDone(tr_cache* cache)
 {
     int err = 0;
@@ -458,6 +723,10 @@ int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
     int err = 0;
     int const pos = findBlockPos(cache, torrent, 0);
 
+    // this is called before the torrent's files are closed, moved, or
+    // deleted, so its spans in the read cache can't be trusted afterwards
+    cache->read_cache.removeTorrent(torrent->uniqueId);
+
     /* flush out all the blocks in that torrent */
     while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
     {
@@ -12,11 +12,133 @@
 #error only libtransmission should #include this header.
 #endif
 
-#include "tr-macros.h"
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint64_t
+#include <functional> // std::hash
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "transmission.h"
 
 struct evbuffer;
 struct tr_cache;
 
+/**
+ * The read side of tr_cache, for seeding.
+ *
+ * When a peer asks for a block of a piece we have, the aligned span of
+ * the piece around it is read from disk once and later requests for that
+ * span are served from memory.
+ *
+ * Eviction follows 2Q so that a single pass over a big torrent can't push
+ * out the spans that many peers keep asking for. A new span goes into a
+ * FIFO that gets a quarter of the budget. When it falls out of the FIFO
+ * only its key is remembered. If the span is asked for again while its
+ * key is remembered, it goes into the main LRU list instead.
+ */
+class tr_read_cache
+{
+public:
+    // pieces are split into spans of this size, so that big pieces aren't read whole
+    static auto constexpr SpanSize = uint32_t{ 1024 * 1024 };
+
+    struct Key
+    {
+        int tor_id;
+        tr_piece_index_t piece;
+        uint32_t span; // the span's index in the piece
+
+        [[nodiscard]] bool operator==(Key const& that) const
+        {
+            return tor_id == that.tor_id && piece == that.piece && span == that.span;
+        }
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t cached_bytes = 0;
+    };
+
+    explicit tr_read_cache(size_t max_bytes = 0)
+        : max_bytes_{ max_bytes }
+    {
+    }
+
+    void setLimit(size_t max_bytes);
+
+    [[nodiscard]] size_t limit() const
+    {
+        return max_bytes_;
+    }
+
+    // how many bytes of spans are cached
+    [[nodiscard]] size_t size() const
+    {
+        return in_bytes_ + main_bytes_;
+    }
+
+    [[nodiscard]] Stats stats() const
+    {
+        auto stats = stats_;
+        stats.cached_bytes = size();
+        return stats;
+    }
+
+    [[nodiscard]] bool has(Key const& key) const
+    {
+        return index_.count(key) != 0;
+    }
+
+    // Returns the span's bytes if it's cached, or nullptr if it isn't.
+    // Good until the next call to add() or remove().
+    [[nodiscard]] uint8_t const* get(Key const& key);
+
+    // Makes room for a span and returns a buffer for the caller to fill,
+    // or nullptr if the span is too big for the budget.
+    [[nodiscard]] uint8_t* add(Key const& key, size_t len);
+
+    void remove(Key const& key);
+
+    void removeTorrent(int tor_id);
+
+private:
+    struct KeyHash
+    {
+        size_t operator()(Key const& key) const
+        {
+            return std::hash<uint64_t>{}((uint64_t(key.tor_id) << 40) ^ (uint64_t(key.piece) << 8) ^ key.span);
+        }
+    };
+
+    struct Entry
+    {
+        Key key;
+        std::unique_ptr<uint8_t[]> data; // not zeroed, since it's read into right away
+        size_t len = 0;
+        bool in_main = false;
+    };
+
+    using Entries = std::list<Entry>;
+    using Ghosts = std::list<std::pair<Key, size_t>>;
+
+    void erase(Entries::iterator it);
+    void evict();
+
+    Entries in_; // spans seen once, oldest last
+    Entries main_; // spans seen again, least recently used last
+    Ghosts ghosts_; // keys of spans evicted from in_, oldest last
+    std::unordered_map<Key, Entries::iterator, KeyHash> index_;
+    std::unordered_map<Key, Ghosts::iterator, KeyHash> ghost_index_;
+    size_t in_bytes_ = 0;
+    size_t main_bytes_ = 0;
+    size_t ghost_bytes_ = 0;
+    size_t max_bytes_ = 0;
+    Stats stats_;
+};
+
 /***
 ****
 ***/
@@ -33,6 +155,12 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes);
 
 int64_t tr_cacheGetLimit(tr_cache const*);
 
+void tr_cacheSetReadLimit(tr_cache* cache, int64_t max_bytes);
+
+int64_t tr_cacheGetReadLimit(tr_cache const*);
+
+tr_read_cache::Stats tr_cacheGetReadStats(tr_cache const*);
+
 int tr_cacheWriteBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -51,6 +179,9 @@ int tr_cacheReadBlock(
 
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
+/* Forget the read cache's copy of a piece, e.g. before checking it against the disk */
+void tr_cacheDropPiece(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece);
+
 /***
 ****
 ***/
@@ -38,16 +38,6 @@ uint64_t tr_completion::computeHasValid() const
     return size;
 }
 
-uint64_t tr_completion::hasValid() const
-{
-    if (!has_valid_)
-    {
-        has_valid_ = computeHasValid();
-    }
-
-    return *has_valid_;
-}
-
 uint64_t tr_completion::computeSizeWhenDone() const
 {
     if (hasAll())
@@ -55,9 +45,14 @@ uint64_t tr_completion::computeSizeWhenDone() const
         return block_info_->total_size;
     }
 
+    return countSizeWhenDone(0, block_info_->n_pieces);
+}
+
+uint64_t tr_completion::countSizeWhenDone(tr_piece_index_t begin, tr_piece_index_t end) const
+{
     // count bytes that we want or that we already have
-    auto size = size_t{ 0 };
-    for (tr_piece_index_t piece = 0; piece < block_info_->n_pieces; ++piece)
+    auto size = uint64_t{ 0 };
+    for (tr_piece_index_t piece = begin; piece < end; ++piece)
     {
         if (tor_->pieceIsWanted(piece))
         {
@@ -154,10 +149,23 @@ void tr_completion::addBlock(tr_block_index_t block)
         return; // already had it
     }
 
+    auto const block_size = block_info_->blockSize(block);
     blocks_.set(block);
-    size_now_ += block_info_->blockSize(block);
+    size_now_ += block_size;
+    updateFileBytes(block, true);
 
-    has_valid_.reset();
+    auto const piece = block_info_->pieceForBlock(block);
+
+    if (hasPiece(piece))
+    {
+        has_valid_ += block_info_->pieceSize(piece);
+    }
+
+    // wanted pieces already count in full
+    if (size_when_done_ && !tor_->pieceIsWanted(piece))
+    {
+        *size_when_done_ += block_size;
+    }
 }
 
 void tr_completion::setBlocks(tr_bitfield blocks)
@@ -167,7 +175,8 @@ void tr_completion::setBlocks(tr_bitfield blocks)
     blocks_ = std::move(blocks);
     size_now_ = countHasBytesInSpan({ 0, tr_block_index_t(std::size(blocks_)) });
     size_when_done_.reset();
-    has_valid_.reset();
+    has_valid_ = computeHasValid();
+    recountFileBytes();
 }
 
 void tr_completion::addPiece(tr_piece_index_t piece)
@@ -182,10 +191,34 @@ void tr_completion::addPiece(tr_piece_index_t piece)
 
 void tr_completion::removePiece(tr_piece_index_t piece)
 {
-    auto const [begin, end] = block_info_->blockSpanForPiece(piece);
-    size_now_ -= countHasBytesInSpan(block_info_->blockSpanForPiece(piece));
-    has_valid_.reset();
-    blocks_.unsetSpan(begin, end);
+    auto const span = block_info_->blockSpanForPiece(piece);
+    auto const n_bytes = countHasBytesInSpan(span);
+
+    if (n_bytes == 0)
+    {
+        return; // nothing to remove
+    }
+
+    if (hasPiece(piece))
+    {
+        has_valid_ -= block_info_->pieceSize(piece);
+    }
+
+    if (size_when_done_ && !tor_->pieceIsWanted(piece))
+    {
+        *size_when_done_ -= n_bytes;
+    }
+
+    for (tr_block_index_t block = span.begin; block < span.end; ++block)
+    {
+        if (hasBlock(block))
+        {
+            updateFileBytes(block, false);
+        }
+    }
+
+    size_now_ -= n_bytes;
+    blocks_.unsetSpan(span.begin, span.end);
 }
 
 uint64_t tr_completion::countHasBytesInSpan(tr_block_span_t span) const
@@ -202,3 +235,66 @@ uint64_t tr_completion::countHasBytesInSpan(tr_block_span_t span) const
 
     return n;
 }
+
+uint64_t tr_completion::countHasBytesInByteSpan(tr_file_piece_map::byte_span_t bytes) const
+{
+    if (bytes.begin >= bytes.end)
+    {
+        return 0;
+    }
+
+    auto const block_size = uint64_t{ block_info_->block_size };
+    auto const first = block_info_->blockOf(bytes.begin);
+    auto const last = block_info_->blockOf(bytes.end - 1);
+
+    if (first == last)
+    {
+        return hasBlock(first) ? bytes.end - bytes.begin : 0;
+    }
+
+    auto n = uint64_t{ 0 };
+
+    if (hasBlock(first))
+    {
+        n += block_size * (first + 1) - bytes.begin;
+    }
+
+    if (last - first > 1)
+    {
+        n += blocks_.count(first + 1, last) * block_size;
+    }
+
+    if (hasBlock(last))
+    {
+        n += bytes.end - block_size * last;
+    }
+
+    return n;
+}
+
+void tr_completion::updateFileBytes(tr_block_index_t block, bool has)
+{
+    if (fpm_ == nullptr)
+    {
+        return;
+    }
+
+    auto const block_begin = uint64_t{ block_info_->block_size } * block;
+    auto const block_end = block_begin + block_info_->blockSize(block);
+    auto const [begin, end] = fpm_->fileSpan(tr_file_piece_map::byte_span_t{ block_begin, block_end });
+
+    for (tr_file_index_t file = begin; file < end; ++file)
+    {
+        auto const file_bytes = fpm_->byteSpan(file);
+        auto const n = std::min(file_bytes.end, block_end) - std::max(file_bytes.begin, block_begin);
+        file_bytes_[file] = has ? file_bytes_[file] + n : file_bytes_[file] - n;
+    }
+}
+
+void tr_completion::recountFileBytes()
+{
+    for (tr_file_index_t file = 0, n = std::size(file_bytes_); file < n; ++file)
+    {
+        file_bytes_[file] = countHasBytesInByteSpan(fpm_->byteSpan(file));
+    }
+}
@@ -21,9 +21,14 @@
 
 #include "block-info.h"
 #include "bitfield.h"
+#include "file-piece-map.h"
 
 /**
  * @brief knows which blocks and pieces we have
+ *
+ * The byte counts that stats are built from -- bytes we have, verified
+ * bytes, bytes when done, and bytes per file -- are updated as blocks
+ * are added and removed, so reading them doesn't need to walk the blocks.
  */
 struct tr_completion
 {
@@ -34,10 +39,16 @@ struct tr_completion
         virtual ~torrent_view() = default;
     };
 
-    explicit tr_completion(torrent_view const* tor, tr_block_info const* block_info)
+    // per-file counts are only kept if `fpm` is given
+    explicit tr_completion(
+        torrent_view const* tor,
+        tr_block_info const* block_info,
+        tr_file_piece_map const* fpm = nullptr)
         : tor_{ tor }
         , block_info_{ block_info }
+        , fpm_{ fpm }
         , blocks_{ block_info_->n_blocks }
+        , file_bytes_(fpm_ != nullptr ? std::size(*fpm_) : 0)
     {
         blocks_.setHasNone();
     }
@@ -77,7 +88,10 @@ struct tr_completion
         return size_now_;
     }
 
-    [[nodiscard]] uint64_t hasValid() const;
+    [[nodiscard]] constexpr uint64_t hasValid() const
+    {
+        return has_valid_;
+    }
 
     [[nodiscard]] bool isDone() const
     {
@@ -107,6 +121,11 @@ struct tr_completion
     [[nodiscard]] size_t countMissingBlocksInPiece(tr_piece_index_t) const;
     [[nodiscard]] size_t countMissingBytesInPiece(tr_piece_index_t) const;
 
+    [[nodiscard]] uint64_t countHasBytesInFile(tr_file_index_t file) const
+    {
+        return file_bytes_[file];
+    }
+
     void amountDone(float* tab, size_t n_tabs) const;
 
     void addBlock(tr_block_index_t i);
@@ -132,6 +151,25 @@ struct tr_completion
         size_when_done_.reset();
     }
 
+    /**
+     * Changes whether some pieces are wanted, keeping sizeWhenDone() up to
+     * date without recounting every piece. `change_wanted` must only change
+     * the pieces in [begin, end).
+     */
+    template<typename ChangeWantedFunc>
+    void updateWanted(tr_piece_index_t begin, tr_piece_index_t end, ChangeWantedFunc&& change_wanted)
+    {
+        if (!size_when_done_)
+        {
+            change_wanted();
+            return;
+        }
+
+        *size_when_done_ -= countSizeWhenDone(begin, end);
+        change_wanted();
+        *size_when_done_ += countSizeWhenDone(begin, end);
+    }
+
 private:
     [[nodiscard]] constexpr bool hasMetainfo() const
     {
@@ -140,20 +178,29 @@ private:
 
     [[nodiscard]] uint64_t computeHasValid() const;
     [[nodiscard]] uint64_t computeSizeWhenDone() const;
+    [[nodiscard]] uint64_t countSizeWhenDone(tr_piece_index_t begin, tr_piece_index_t end) const;
     [[nodiscard]] uint64_t countHasBytesInSpan(tr_block_span_t) const;
+    [[nodiscard]] uint64_t countHasBytesInByteSpan(tr_file_piece_map::byte_span_t) const;
+
+    void updateFileBytes(tr_block_index_t block, bool has);
+    void recountFileBytes();
 
     torrent_view const* tor_;
     tr_block_info const* block_info_;
+    tr_file_piece_map const* fpm_;
 
     tr_bitfield blocks_{ 0 };
 
     // Number of bytes we'll have when done downloading. [0..info.totalSize]
-    // Mutable because lazy-calculated
+    // Mutable because lazy-calculated, and counted again when which
+    // pieces are wanted changes without updateWanted()
     mutable std::optional<uint64_t> size_when_done_;
 
     // Number of verified bytes we have right now. [0..info.totalSize]
-    // Mutable because lazy-calculated
-    mutable std::optional<uint64_t> has_valid_;
+    uint64_t has_valid_ = 0;
+
+    // Number of bytes we have now in each file
+    std::vector<uint64_t> file_bytes_;
 
     // Number of bytes we have now. [0..sizeWhenDone]
     uint64_t size_now_ = 0;
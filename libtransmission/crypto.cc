@@ -6,6 +6,7 @@
  *
  */
 
+#include <algorithm>
 #include <cstring> /* memcpy(), memmove(), memset() */
 
 #include <arc4.h>
@@ -13,6 +14,7 @@
 #include "transmission.h"
 #include "crypto.h"
 #include "crypto-utils.h"
+#include "dh-pool.h"
 #include "tr-assert.h"
 #include "utils.h"
 
@@ -40,23 +42,44 @@ static uint8_t const dh_G[] = { 2 };
 ***
 **/
 
+tr_dh_ctx_t tr_cryptoNewKey(uint8_t* setme_public_key)
+{
+    size_t public_key_length = 0;
+    tr_dh_ctx_t dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
+    tr_dh_make_key(dh, DH_PRIVKEY_LEN, setme_public_key, &public_key_length);
+
+    TR_ASSERT(public_key_length == KEY_LEN);
+
+    return dh;
+}
+
 static void ensureKeyExists(tr_crypto* crypto)
 {
-    if (crypto->dh == nullptr)
+    // once the secret's been computed, the private key may have been handed off
+    if (crypto->dh != nullptr || crypto->mySecret != nullptr)
     {
-        size_t public_key_length = 0;
-        crypto->dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
-        tr_dh_make_key(crypto->dh, DH_PRIVKEY_LEN, crypto->myPublicKey, &public_key_length);
+        return;
+    }
 
-        TR_ASSERT(public_key_length == KEY_LEN);
+    if (crypto->dh_pool != nullptr)
+    {
+        if (auto const keypair = crypto->dh_pool->take(); keypair)
+        {
+            crypto->dh = keypair->dh;
+            std::copy(std::begin(keypair->public_key), std::end(keypair->public_key), crypto->myPublicKey);
+            return;
+        }
     }
+
+    crypto->dh = tr_cryptoNewKey(crypto->myPublicKey);
 }
 
-void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming)
+void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming, tr_dh_pool* dh_pool)
 {
     memset(crypto, 0, sizeof(tr_crypto));
 
     crypto->isIncoming = isIncoming;
+    crypto->dh_pool = dh_pool;
     tr_cryptoSetTorrentHash(crypto, torrentHash);
 }
 
@@ -79,6 +102,21 @@ bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey)
     return crypto->mySecret != nullptr;
 }
 
+tr_dh_ctx_t tr_cryptoTakeKey(tr_crypto* crypto)
+{
+    ensureKeyExists(crypto);
+
+    tr_dh_ctx_t const dh = crypto->dh;
+    crypto->dh = nullptr;
+    return dh;
+}
+
+void tr_cryptoSetSecret(tr_crypto* crypto, tr_dh_secret_t secret)
+{
+    tr_dh_secret_free(crypto->mySecret);
+    crypto->mySecret = secret;
+}
+
 uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len)
 {
     ensureKeyExists((tr_crypto*)crypto);
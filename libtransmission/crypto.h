@@ -29,12 +29,15 @@ enum
     KEY_LEN = 96
 };
 
+class tr_dh_pool;
+
 /** @brief Holds state information for encrypted peer communications */
 struct tr_crypto
 {
     struct arc4_context* dec_key;
     struct arc4_context* enc_key;
     tr_dh_ctx_t dh;
+    tr_dh_pool* dh_pool;
     uint8_t myPublicKey[KEY_LEN];
     tr_dh_secret_t mySecret;
     uint8_t torrentHash[SHA_DIGEST_LENGTH];
@@ -42,8 +45,8 @@ struct tr_crypto
     bool torrentHashIsSet;
 };
 
-/** @brief construct a new tr_crypto object */
-void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming);
+/** @brief construct a new tr_crypto object. If `dh_pool` isn't null, its keypair is taken from there. */
+void tr_cryptoConstruct(tr_crypto* crypto, uint8_t const* torrentHash, bool isIncoming, tr_dh_pool* dh_pool = nullptr);
 
 /** @brief destruct an existing tr_crypto object */
 void tr_cryptoDestruct(tr_crypto* crypto);
@@ -56,6 +59,15 @@ bool tr_cryptoHasTorrentHash(tr_crypto const* crypto);
 
 bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey);
 
+/** @brief hand over our private key, e.g. to compute the secret on another thread. The public key is kept. */
+tr_dh_ctx_t tr_cryptoTakeKey(tr_crypto* crypto);
+
+/** @brief use a secret that was computed elsewhere. `crypto` takes ownership of it. */
+void tr_cryptoSetSecret(tr_crypto* crypto, tr_dh_secret_t secret);
+
+/** @brief make a new MSE keypair. Safe to call from any thread. */
+tr_dh_ctx_t tr_cryptoNewKey(uint8_t* setme_public_key);
+
 uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len);
 
 void tr_cryptoDecryptInit(tr_crypto* crypto);
@@ -0,0 +1,206 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "transmission.h"
+#include "dh-pool.h"
+#include "platform.h" // tr_threadNew()
+#include "tr-assert.h"
+#include "trevent.h"
+
+class tr_dh_pool::Job
+{
+public:
+    tr_session* session;
+    tr_dh_ctx_t dh;
+    std::array<uint8_t, KEY_LEN> other_public_key;
+    AgreeFunc callback;
+    void* user_data;
+    tr_dh_secret_t secret = nullptr;
+    bool cancelled = false;
+};
+
+namespace
+{
+
+void onAgreed(void* vjob)
+{
+    auto* const job = static_cast<tr_dh_pool::Job*>(vjob);
+
+    if (job->cancelled)
+    {
+        tr_dh_secret_free(job->secret);
+    }
+    else
+    {
+        (*job->callback)(job->secret, job->user_data);
+    }
+
+    delete job;
+}
+
+} // namespace
+
+tr_dh_pool::tr_dh_pool(tr_session* session, size_t capacity)
+    : session_{ session }
+    , capacity_{ capacity }
+{
+    keypairs_.reserve(capacity_);
+    tr_threadNew(threadFunc, this);
+}
+
+tr_dh_pool::~tr_dh_pool()
+{
+    {
+        auto lock = std::unique_lock(mutex_);
+        stopping_ = true;
+        cv_.notify_one();
+        stopped_cv_.wait(lock, [this]() { return !running_; });
+    }
+
+    for (auto const& keypair : keypairs_)
+    {
+        tr_dh_free(keypair.dh);
+    }
+
+    for (auto* job : jobs_)
+    {
+        tr_dh_free(job->dh);
+        delete job;
+    }
+}
+
+std::optional<tr_dh_pool::Keypair> tr_dh_pool::makeKeypair()
+{
+    auto keypair = Keypair{};
+    keypair.dh = tr_cryptoNewKey(std::data(keypair.public_key));
+    return keypair.dh != nullptr ? keypair : std::optional<Keypair>{};
+}
+
+bool tr_dh_pool::needsRefill() const
+{
+    return std::size(keypairs_) < capacity_ / 2;
+}
+
+std::optional<tr_dh_pool::Keypair> tr_dh_pool::take()
+{
+    auto lock = std::unique_lock(mutex_);
+
+    if (std::empty(keypairs_))
+    {
+        ++stats_.misses;
+        cv_.notify_one();
+        return {};
+    }
+
+    ++stats_.hits;
+    auto const keypair = keypairs_.back();
+    keypairs_.pop_back();
+
+    if (needsRefill())
+    {
+        lock.unlock();
+        cv_.notify_one();
+    }
+
+    return keypair;
+}
+
+tr_dh_pool::Job* tr_dh_pool::agree(tr_dh_ctx_t dh, uint8_t const* other_public_key, AgreeFunc callback, void* user_data)
+{
+    TR_ASSERT(session_ != nullptr);
+    TR_ASSERT(dh != nullptr);
+    TR_ASSERT(callback != nullptr);
+
+    auto* const job = new Job{ session_, dh, {}, callback, user_data };
+    std::copy_n(other_public_key, KEY_LEN, std::begin(job->other_public_key));
+
+    {
+        auto const lock = std::lock_guard(mutex_);
+        jobs_.push_back(job);
+    }
+
+    cv_.notify_one();
+    return job;
+}
+
+void tr_dh_pool::cancel(Job* job)
+{
+    TR_ASSERT(tr_amInEventThread(job->session));
+
+    job->cancelled = true;
+}
+
+size_t tr_dh_pool::size() const
+{
+    auto const lock = std::lock_guard(mutex_);
+    return std::size(keypairs_);
+}
+
+tr_dh_pool::Stats tr_dh_pool::stats() const
+{
+    auto const lock = std::lock_guard(mutex_);
+    return stats_;
+}
+
+void tr_dh_pool::threadFunc(void* vpool)
+{
+    static_cast<tr_dh_pool*>(vpool)->run();
+}
+
+void tr_dh_pool::run()
+{
+    auto lock = std::unique_lock(mutex_);
+
+    // once a refill starts, keep going until the pool is full
+    auto refilling = false;
+
+    while (!stopping_)
+    {
+        if (!std::empty(jobs_))
+        {
+            auto* const job = jobs_.front();
+            jobs_.pop_front();
+
+            lock.unlock();
+            job->secret = tr_dh_agree(job->dh, std::data(job->other_public_key), KEY_LEN);
+            tr_dh_free(job->dh);
+            job->dh = nullptr;
+            tr_runInEventThread(job->session, onAgreed, job);
+            lock.lock();
+            continue;
+        }
+
+        refilling = (refilling || needsRefill()) && std::size(keypairs_) < capacity_;
+        if (!refilling)
+        {
+            cv_.wait(lock, [this]() { return stopping_ || !std::empty(jobs_) || needsRefill(); });
+            continue;
+        }
+
+        lock.unlock();
+        auto const keypair = makeKeypair();
+        lock.lock();
+
+        if (keypair)
+        {
+            keypairs_.push_back(*keypair);
+        }
+        else
+        {
+            // don't spin if the crypto backend can't make keys right now
+            cv_.wait_for(lock, std::chrono::seconds(1));
+        }
+    }
+
+    // still holding the lock, so the destructor can't go on until we've let go of the pool
+    running_ = false;
+    stopped_cv_.notify_one();
+}
@@ -0,0 +1,113 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <condition_variable>
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint64_t
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "crypto.h" // KEY_LEN
+#include "crypto-utils.h" // tr_dh_ctx_t, tr_dh_secret_t
+
+struct tr_session;
+
+/**
+ * Keeps the Diffie-Hellman math of encrypted handshakes off the event thread.
+ *
+ * Making an MSE keypair is a 768-bit modexp, and so is agreeing on a
+ * shared secret with a peer. During connection storms, e.g. at startup,
+ * hundreds of those a second would otherwise run on the event thread.
+ *
+ * A worker thread keeps a stock of pregenerated keypairs that take()
+ * hands out, topping it up whenever it falls below half of `capacity`.
+ * The same worker also runs agree() jobs, which take priority over
+ * the refills, and passes their results back to the event thread.
+ */
+class tr_dh_pool
+{
+public:
+    struct Keypair
+    {
+        tr_dh_ctx_t dh = nullptr;
+        std::array<uint8_t, KEY_LEN> public_key = {};
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0; // take() found a keypair
+        uint64_t misses = 0; // take() found the pool empty
+    };
+
+    // called in the event thread with the shared secret, or with nullptr if it couldn't be computed.
+    // The callback owns the secret.
+    using AgreeFunc = void (*)(tr_dh_secret_t secret, void* user_data);
+
+    class Job;
+
+    // `session` is where agree() callbacks are run. It may be null if agree() isn't used.
+    tr_dh_pool(tr_session* session, size_t capacity);
+
+    tr_dh_pool(tr_dh_pool const&) = delete;
+    tr_dh_pool& operator=(tr_dh_pool const&) = delete;
+
+    // stops the worker and frees the pooled keypairs and any jobs it hadn't started
+    ~tr_dh_pool();
+
+    // Returns a pregenerated keypair, or nothing if the pool has run dry.
+    // The caller owns the keypair's `dh`.
+    [[nodiscard]] std::optional<Keypair> take();
+
+    // Computes the secret shared by `dh` and the peer's public key on the worker.
+    // The pool takes ownership of `dh`.
+    Job* agree(tr_dh_ctx_t dh, uint8_t const* other_public_key, AgreeFunc callback, void* user_data);
+
+    // Keeps a job's callback from being called, e.g. because the handshake that
+    // was waiting on it has been aborted. Must be called in the event thread.
+    static void cancel(Job* job);
+
+    [[nodiscard]] size_t size() const;
+
+    [[nodiscard]] size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    [[nodiscard]] Stats stats() const;
+
+    // makes a keypair without the pool's help
+    [[nodiscard]] static std::optional<Keypair> makeKeypair();
+
+private:
+    static void threadFunc(void* vpool);
+    void run();
+    [[nodiscard]] bool needsRefill() const;
+
+    tr_session* const session_;
+    size_t const capacity_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Keypair> keypairs_;
+    std::deque<Job*> jobs_;
+    Stats stats_;
+    bool stopping_ = false;
+
+    // the worker is a detached tr_thread, so the destructor waits on this instead of joining it
+    std::condition_variable stopped_cv_;
+    bool running_ = true;
+};
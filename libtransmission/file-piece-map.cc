@@ -19,6 +19,8 @@ void tr_file_piece_map::reset(tr_block_info const& block_info, uint64_t const* f
 {
     files_.resize(n_files);
     files_.shrink_to_fit();
+    file_bytes_.resize(n_files);
+    file_bytes_.shrink_to_fit();
 
     uint64_t offset = 0;
     for (tr_file_index_t i = 0; i < n_files; ++i)
@@ -37,6 +39,7 @@ void tr_file_piece_map::reset(tr_block_info const& block_info, uint64_t const* f
             end_piece = begin_piece + 1;
         }
         files_[i] = piece_span_t{ begin_piece, end_piece };
+        file_bytes_[i] = byte_span_t{ offset, offset + file_size };
         offset += file_size;
     }
 }
@@ -94,6 +97,16 @@ tr_file_piece_map::file_span_t tr_file_piece_map::fileSpan(tr_piece_index_t piec
     return { tr_piece_index_t(std::distance(begin, equal_begin)), tr_piece_index_t(std::distance(begin, equal_end)) };
 }
 
+tr_file_piece_map::file_span_t tr_file_piece_map::fileSpan(byte_span_t bytes) const
+{
+    // the files are in order, so both their begins and ends are sorted
+    auto const begin = std::begin(file_bytes_);
+    auto const end = std::end(file_bytes_);
+    auto const first = std::partition_point(begin, end, [&bytes](auto const& file) { return file.end <= bytes.begin; });
+    auto const last = std::partition_point(first, end, [&bytes](auto const& file) { return file.begin < bytes.end; });
+    return { tr_file_index_t(std::distance(begin, first)), tr_file_index_t(std::distance(begin, last)) };
+}
+
 /***
 ****
 ***/
@@ -31,6 +31,7 @@ public:
     };
     using file_span_t = index_span_t<tr_file_index_t>;
     using piece_span_t = index_span_t<tr_piece_index_t>;
+    using byte_span_t = index_span_t<uint64_t>;
 
     explicit tr_file_piece_map(tr_info const& info)
     {
@@ -45,6 +46,15 @@ public:
 
     [[nodiscard]] piece_span_t pieceSpan(tr_file_index_t file) const;
     [[nodiscard]] file_span_t fileSpan(tr_piece_index_t piece) const;
+
+    // the files that overlap these bytes, including any empty ones in between
+    [[nodiscard]] file_span_t fileSpan(byte_span_t bytes) const;
+
+    [[nodiscard]] byte_span_t byteSpan(tr_file_index_t file) const
+    {
+        return file_bytes_[file];
+    }
+
     [[nodiscard]] size_t size() const
     {
         return std::size(files_);
@@ -52,6 +62,7 @@ public:
 
 private:
     std::vector<piece_span_t> files_;
+    std::vector<byte_span_t> file_bytes_;
 };
 
 class tr_file_priorities
@@ -347,6 +347,27 @@ bool tr_sys_path_is_same(char const* path1, char const* path2, tr_error** error)
     return ret;
 }
 
+bool tr_sys_path_is_same_filesystem(char const* path1, char const* path2, tr_error** error)
+{
+    TR_ASSERT(path1 != nullptr);
+    TR_ASSERT(path2 != nullptr);
+
+    bool ret = false;
+    struct stat sb1;
+    struct stat sb2;
+
+    if (stat(path1, &sb1) != -1 && stat(path2, &sb2) != -1)
+    {
+        ret = sb1.st_dev == sb2.st_dev;
+    }
+    else
+    {
+        set_system_error_if_file_found(error, errno);
+    }
+
+    return ret;
+}
+
 char* tr_sys_path_resolve(char const* path, tr_error** error)
 {
     TR_ASSERT(path != nullptr);
@@ -434,15 +455,73 @@ bool tr_sys_path_rename(char const* src_path, char const* dst_path, tr_error** e
 /* We try to do a fast (in-kernel) copy using a variety of non-portable system
  * calls. If the current implementation does not support in-kernel copying, we
  * use a user-space fallback instead. */
+#if defined(USE_COPYFILE)
+
+struct copyfile_progress_data
+{
+    tr_sys_path_copy_progress_func progress;
+    void* user_data;
+    bool cancelled;
+};
+
+static int copyfile_progress_callback(
+    int what,
+    int stage,
+    copyfile_state_t state,
+    char const* /*src*/,
+    char const* /*dst*/,
+    void* vdata)
+{
+    auto* const data = static_cast<copyfile_progress_data*>(vdata);
+
+    if (what == COPYFILE_COPY_DATA && stage == COPYFILE_PROGRESS)
+    {
+        auto copied = off_t{};
+
+        if (copyfile_state_get(state, COPYFILE_STATE_COPIED, &copied) == 0 && !data->progress(copied, data->user_data))
+        {
+            data->cancelled = true;
+            return COPYFILE_QUIT;
+        }
+    }
+
+    return COPYFILE_CONTINUE;
+}
+
+#endif /* USE_COPYFILE */
+
 bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** error)
+{
+    return tr_sys_path_copy(src_path, dst_path, nullptr, nullptr, error);
+}
+
+bool tr_sys_path_copy(
+    char const* src_path,
+    char const* dst_path,
+    tr_sys_path_copy_progress_func progress,
+    void* user_data,
+    tr_error** error)
 {
     TR_ASSERT(src_path != nullptr);
     TR_ASSERT(dst_path != nullptr);
 
 #if defined(USE_COPYFILE)
-    if (copyfile(src_path, dst_path, nullptr, COPYFILE_CLONE | COPYFILE_ALL) < 0)
+    auto data = copyfile_progress_data{ progress, user_data, false };
+    copyfile_state_t state = copyfile_state_alloc();
+
+    if (progress != nullptr)
     {
-        set_system_error(error, errno);
+        copyfile_state_set(state, COPYFILE_STATE_STATUS_CB, reinterpret_cast<void const*>(&copyfile_progress_callback));
+        copyfile_state_set(state, COPYFILE_STATE_STATUS_CTX, &data);
+    }
+
+    int const rc = copyfile(src_path, dst_path, state, COPYFILE_CLONE | COPYFILE_ALL);
+    int const err = data.cancelled ? ECANCELED : errno;
+    copyfile_state_free(state);
+
+    if (rc < 0)
+    {
+        set_system_error(error, err);
         return false;
     }
 
@@ -475,12 +554,20 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
     }
 
     uint64_t file_size = info.size;
+    uint64_t bytes_copied = 0;
+    bool cancelled = false;
+    bool copy_in_user_space = true;
 
 #if defined(USE_COPY_FILE_RANGE) || defined(USE_SENDFILE64)
 
+    copy_in_user_space = false;
+
+    /* with a progress callback, copy in chunks so that it gets called regularly */
+    uint64_t const max_chunk_size = progress != nullptr ? uint64_t{ 16 * 1024 * 1024 } : uint64_t{ SSIZE_MAX };
+
     while (file_size > 0)
     {
-        size_t const chunk_size = std::min(file_size, uint64_t{ SSIZE_MAX });
+        size_t const chunk_size = std::min(file_size, max_chunk_size);
         ssize_t const copied =
 #ifdef USE_COPY_FILE_RANGE
             copy_file_range(in, nullptr, out, nullptr, chunk_size, 0);
@@ -493,6 +580,15 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
 
         if (copied == -1)
         {
+#ifdef USE_COPY_FILE_RANGE
+            /* since Linux 5.19, copy_file_range() won't copy between different kinds of filesystems */
+            if (bytes_copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP))
+            {
+                copy_in_user_space = true;
+                break;
+            }
+#endif
+
             set_system_error(error, errno);
             break;
         }
@@ -500,45 +596,66 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
         TR_ASSERT(copied >= 0 && ((uint64_t)copied) <= file_size);
         TR_ASSERT(copied >= 0 && ((uint64_t)copied) <= chunk_size);
         file_size -= copied;
-    }
-
-#else /* USE_COPY_FILE_RANGE || USE_SENDFILE64 */
+        bytes_copied += copied;
 
-    /* Fallback to user-space copy. */
+        if (progress != nullptr && !progress(bytes_copied, user_data))
+        {
+            cancelled = true;
+            break;
+        }
+    }
 
-    size_t const buflen = 1024 * 1024; /* 1024 KiB buffer */
-    auto* buf = static_cast<char*>(tr_malloc(buflen));
+#endif /* USE_COPY_FILE_RANGE || USE_SENDFILE64 */
 
-    while (file_size > 0)
+    if (copy_in_user_space)
     {
-        uint64_t const chunk_size = std::min(file_size, uint64_t{ buflen });
-        uint64_t bytes_read;
-        uint64_t bytes_written;
+        /* Fallback to user-space copy. */
 
-        if (!tr_sys_file_read(in, buf, chunk_size, &bytes_read, error))
-        {
-            break;
-        }
+        size_t const buflen = 1024 * 1024; /* 1024 KiB buffer */
+        auto* buf = static_cast<char*>(tr_malloc(buflen));
 
-        if (!tr_sys_file_write(out, buf, bytes_read, &bytes_written, error))
+        while (file_size > 0)
         {
-            break;
-        }
+            uint64_t const chunk_size = std::min(file_size, uint64_t{ buflen });
+            uint64_t bytes_read;
+            uint64_t bytes_written;
 
-        TR_ASSERT(bytes_read == bytes_written);
-        TR_ASSERT(bytes_written <= file_size);
-        file_size -= bytes_written;
-    }
+            if (!tr_sys_file_read(in, buf, chunk_size, &bytes_read, error))
+            {
+                break;
+            }
 
-    /* cleanup */
-    tr_free(buf);
+            if (!tr_sys_file_write(out, buf, bytes_read, &bytes_written, error))
+            {
+                break;
+            }
 
-#endif /* USE_COPY_FILE_RANGE || USE_SENDFILE64 */
+            TR_ASSERT(bytes_read == bytes_written);
+            TR_ASSERT(bytes_written <= file_size);
+            file_size -= bytes_written;
+            bytes_copied += bytes_written;
+
+            if (progress != nullptr && !progress(bytes_copied, user_data))
+            {
+                cancelled = true;
+                break;
+            }
+        }
+
+        /* cleanup */
+        tr_free(buf);
+    }
 
     /* cleanup */
     tr_sys_file_close(out, nullptr);
     tr_sys_file_close(in, nullptr);
 
+    if (cancelled)
+    {
+        set_system_error(error, ECANCELED);
+        return false;
+    }
+
     if (file_size != 0)
     {
         tr_error_prefix(error, "Unable to read/write: ");
@@ -571,6 +571,68 @@ cleanup:
     return ret;
 }
 
+bool tr_sys_path_is_same_filesystem(char const* path1, char const* path2, tr_error** error)
+{
+    TR_ASSERT(path1 != nullptr);
+    TR_ASSERT(path2 != nullptr);
+
+    bool ret = false;
+    wchar_t* wide_path1 = nullptr;
+    wchar_t* wide_path2 = nullptr;
+    HANDLE handle1 = INVALID_HANDLE_VALUE;
+    HANDLE handle2 = INVALID_HANDLE_VALUE;
+    BY_HANDLE_FILE_INFORMATION fi1, fi2;
+
+    wide_path1 = path_to_native_path(path1);
+
+    if (wide_path1 == nullptr)
+    {
+        goto fail;
+    }
+
+    wide_path2 = path_to_native_path(path2);
+
+    if (wide_path2 == nullptr)
+    {
+        goto fail;
+    }
+
+    handle1 = CreateFileW(wide_path1, 0, 0, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+
+    if (handle1 == INVALID_HANDLE_VALUE)
+    {
+        goto fail;
+    }
+
+    handle2 = CreateFileW(wide_path2, 0, 0, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+
+    if (handle2 == INVALID_HANDLE_VALUE)
+    {
+        goto fail;
+    }
+
+    if (!GetFileInformationByHandle(handle1, &fi1) || !GetFileInformationByHandle(handle2, &fi2))
+    {
+        goto fail;
+    }
+
+    ret = fi1.dwVolumeSerialNumber == fi2.dwVolumeSerialNumber;
+
+    goto cleanup;
+
+fail:
+    set_system_error_if_file_found(error, GetLastError());
+
+cleanup:
+    CloseHandle(handle2);
+    CloseHandle(handle1);
+
+    tr_free(wide_path2);
+    tr_free(wide_path1);
+
+    return ret;
+}
+
 char* tr_sys_path_resolve(char const* path, tr_error** error)
 {
     TR_ASSERT(path != nullptr);
@@ -786,12 +848,46 @@ bool tr_sys_path_rename(char const* src_path, char const* dst_path, tr_error** e
     return ret;
 }
 
+struct copy_progress_data
+{
+    tr_sys_path_copy_progress_func progress;
+    void* user_data;
+};
+
+static DWORD CALLBACK copy_progress_routine(
+    LARGE_INTEGER /*total_file_size*/,
+    LARGE_INTEGER total_bytes_transferred,
+    LARGE_INTEGER /*stream_size*/,
+    LARGE_INTEGER /*stream_bytes_transferred*/,
+    DWORD /*stream_number*/,
+    DWORD /*callback_reason*/,
+    HANDLE /*source_file*/,
+    HANDLE /*destination_file*/,
+    LPVOID vdata)
+{
+    auto const* const data = static_cast<copy_progress_data const*>(vdata);
+
+    return data->progress(total_bytes_transferred.QuadPart, data->user_data) ? PROGRESS_CONTINUE : PROGRESS_CANCEL;
+}
+
 bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** error)
+{
+    return tr_sys_path_copy(src_path, dst_path, nullptr, nullptr, error);
+}
+
+bool tr_sys_path_copy(
+    char const* src_path,
+    char const* dst_path,
+    tr_sys_path_copy_progress_func progress,
+    void* user_data,
+    tr_error** error)
 {
     TR_ASSERT(src_path != nullptr);
     TR_ASSERT(dst_path != nullptr);
 
     bool ret = false;
+    auto data = copy_progress_data{ progress, user_data };
+    LPPROGRESS_ROUTINE const routine = progress != nullptr ? copy_progress_routine : nullptr;
 
     wchar_t* wide_src_path = path_to_native_path(src_path);
     wchar_t* wide_dst_path = path_to_native_path(dst_path);
@@ -804,7 +900,7 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
 
     auto cancel = BOOL{ FALSE };
     DWORD const flags = COPY_FILE_ALLOW_DECRYPTED_DESTINATION | COPY_FILE_FAIL_IF_EXISTS;
-    if (CopyFileExW(wide_src_path, wide_dst_path, nullptr, nullptr, &cancel, flags) == 0)
+    if (CopyFileExW(wide_src_path, wide_dst_path, routine, &data, &cancel, flags) == 0)
     {
         set_system_error(error, GetLastError());
         goto out;
@@ -147,6 +147,39 @@ struct tr_sys_path_info
  */
 bool tr_sys_path_copy(char const* src_path, char const* dst_path, struct tr_error** error);
 
+/**
+ * @brief Called as a file is being copied. Return `false` to cancel the copy.
+ *
+ * @param[in] bytes_copied How many bytes have been copied so far.
+ * @param[in] user_data    The pointer that was passed to @ref tr_sys_path_copy.
+ */
+using tr_sys_path_copy_progress_func = bool (*)(uint64_t bytes_copied, void* user_data);
+
+/**
+ * @brief Like @ref tr_sys_path_copy, but reports its progress while copying.
+ *
+ * The copy is done in chunks so that `progress` is called regularly even for
+ * large files. If `progress` returns `false`, the copy stops and fails with
+ * `ECANCELED` (or `ERROR_REQUEST_ABORTED` on Windows); the partially written
+ * destination file is left behind for the caller to remove.
+ *
+ * @param[in]  src_path  Path to source file.
+ * @param[in]  dst_path  Path to destination file.
+ * @param[in]  progress  Progress callback. Optional, pass `nullptr` if you are
+ *                       not interested in progress.
+ * @param[in]  user_data Pointer to pass to `progress`.
+ * @param[out] error     Pointer to error object. Optional, pass `nullptr` if
+ *                       you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_path_copy(
+    char const* src_path,
+    char const* dst_path,
+    tr_sys_path_copy_progress_func progress,
+    void* user_data,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `stat()`.
  *
@@ -199,6 +232,22 @@ bool tr_sys_path_is_relative(std::string_view path);
  */
 bool tr_sys_path_is_same(char const* path1, char const* path2, struct tr_error** error);
 
+/**
+ * @brief Test to see if two paths are on the same filesystem, i.e. whether
+ *        one could be renamed to the other without copying it.
+ *
+ * @param[in]  path1 Path to first file or directory.
+ * @param[in]  path2 Path to second file or directory.
+ * @param[out] error Pointer to error object. Optional, pass `nullptr` if
+ *                   you are not interested in error details.
+ *
+ * @return `True` if both paths exist and are on the same filesystem, `false`
+ *         otherwise. Note that `false` will also be returned in case of error;
+ *         if you need to distinguish the two, check if `error` is `nullptr`
+ *         afterwards.
+ */
+bool tr_sys_path_is_same_filesystem(char const* path1, char const* path2, struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `realpath()`.
  *
@@ -16,6 +16,7 @@
 #include "transmission.h"
 #include "clients.h"
 #include "crypto-utils.h"
+#include "dh-pool.h"
 #include "handshake.h"
 #include "log.h"
 #include "peer-io.h"
@@ -99,6 +100,8 @@ enum handshake_state_t
     AWAITING_VC,
     AWAITING_CRYPTO_SELECT,
     AWAITING_PAD_D,
+    /* either */
+    AWAITING_SECRET,
     /* */
     N_STATES
 };
@@ -120,6 +123,10 @@ struct tr_handshake
     uint8_t myReq1[SHA_DIGEST_LENGTH];
     struct event* timeout_timer;
 
+    /* while the shared secret is computed in the background: the job, and where to pick up again */
+    tr_dh_pool::Job* secret_job;
+    ReadState (*on_secret)(tr_handshake* handshake);
+
     std::optional<tr_peer_id_t> peer_id;
 
     tr_handshake_done_func done_func;
@@ -155,7 +162,8 @@ static char const* getStateName(handshake_state_t const state)
         "awaiting yb", /* AWAITING_YB */
         "awaiting vc", /* AWAITING_VC */
         "awaiting crypto select", /* AWAITING_CRYPTO_SELECT */
-        "awaiting pad d" /* AWAITING_PAD_D */
+        "awaiting pad d", /* AWAITING_PAD_D */
+        "awaiting secret" /* AWAITING_SECRET */
     };
 
     return state < N_STATES ? state_strings[state] : "unknown state";
@@ -365,6 +373,58 @@ static void computeRequestHash(tr_handshake const* handshake, char const* name,
     tr_cryptoSecretKeySha1(handshake->crypto, name, 4, nullptr, 0, hash);
 }
 
+static void onSecretComputed(tr_dh_secret_t secret, void* vhandshake)
+{
+    auto* const handshake = static_cast<tr_handshake*>(vhandshake);
+    auto* const io = handshake->io;
+
+    handshake->secret_job = nullptr;
+
+    if (secret == nullptr)
+    {
+        tr_handshakeDone(handshake, false);
+        return;
+    }
+
+    tr_cryptoSetSecret(handshake->crypto, secret);
+
+    /* the handshake may be done after this, so hold onto the io */
+    tr_peerIoRef(io);
+    (*handshake->on_secret)(handshake);
+
+    /* catch up on anything the peer sent while we were busy */
+    tr_peerIoProcessReadBuffer(io);
+    tr_peerIoUnref(io);
+}
+
+/* Computes the secret shared with the peer, then continues with `on_secret`.
+ * If the session offloads handshakes, the math is done on the DH pool's
+ * worker and the handshake waits in AWAITING_SECRET until it's done. */
+static ReadState computeSecret(
+    tr_handshake* handshake,
+    uint8_t const* peer_public_key,
+    ReadState (*on_secret)(tr_handshake* handshake))
+{
+    auto* const pool = handshake->session->dh_pool.get();
+
+    if (pool == nullptr || !handshake->session->isHandshakeOffloadEnabled)
+    {
+        if (!tr_cryptoComputeSecret(handshake->crypto, peer_public_key))
+        {
+            return tr_handshakeDone(handshake, false);
+        }
+
+        return (*on_secret)(handshake);
+    }
+
+    handshake->on_secret = on_secret;
+    handshake->secret_job = pool->agree(tr_cryptoTakeKey(handshake->crypto), peer_public_key, onSecretComputed, handshake);
+    setState(handshake, AWAITING_SECRET);
+    return READ_LATER;
+}
+
+static ReadState sendCryptoProvide(tr_handshake* handshake);
+
 static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
 {
     uint8_t yb[KEY_LEN];
@@ -401,12 +461,11 @@ static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
 
     /* compute the secret */
     evbuffer_remove(inbuf, yb, KEY_LEN);
+    return computeSecret(handshake, yb, sendCryptoProvide);
+}
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, yb))
-    {
-        return tr_handshakeDone(handshake, false);
-    }
-
+static ReadState sendCryptoProvide(tr_handshake* handshake)
+{
     /* now send these: HASH('req1', S), HASH('req2', SKEY) xor HASH('req3', S),
      * ENCRYPT(VC, crypto_provide, len(PadC), PadC, len(IA)), ENCRYPT(IA) */
     evbuffer* const outbuf = evbuffer_new();
@@ -708,6 +767,8 @@ static ReadState readPeerId(tr_handshake* handshake, struct evbuffer* inbuf)
     return tr_handshakeDone(handshake, !connected_to_self);
 }
 
+static ReadState sendYb(tr_handshake* handshake);
+
 static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
 {
     dbgmsg(handshake, "in readYa... need %d, have %zu", KEY_LEN, evbuffer_get_length(inbuf));
@@ -720,12 +781,11 @@ static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
     /* read the incoming peer's public key */
     uint8_t ya[KEY_LEN];
     evbuffer_remove(inbuf, ya, KEY_LEN);
+    return computeSecret(handshake, ya, sendYb);
+}
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, ya))
-    {
-        return tr_handshakeDone(handshake, false);
-    }
-
+static ReadState sendYb(tr_handshake* handshake)
+{
     computeRequestHash(handshake, "req1", handshake->myReq1);
 
     /* send our public key to the peer */
@@ -1039,6 +1099,10 @@ static ReadState canRead(tr_peerIo* io, void* vhandshake, size_t* piece)
             ret = readPadD(handshake, inbuf);
             break;
 
+        case AWAITING_SECRET:
+            ret = READ_LATER;
+            break;
+
         default:
 #ifdef TR_ENABLE_ASSERTS
             TR_ASSERT_MSG(false, "unhandled handshake state %d", (int)handshake->state);
@@ -1084,6 +1148,11 @@ static bool fireDoneFunc(tr_handshake* handshake, bool isConnected)
 
 static void tr_handshakeFree(tr_handshake* handshake)
 {
+    if (handshake->secret_job != nullptr)
+    {
+        tr_dh_pool::cancel(handshake->secret_job);
+    }
+
     if (handshake->io != nullptr)
     {
         tr_peerIoUnref(handshake->io); /* balanced by the ref in tr_handshakeNew */
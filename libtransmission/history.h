@@ -36,6 +36,7 @@ public:
         {
             newest = (newest + 1) % TR_RECENT_HISTORY_PERIOD_SEC;
             slices[newest].time = now;
+            slices[newest].n = 0;
         }
 
         slices[newest].n += n;
@@ -106,6 +106,12 @@ static int readOrWriteBytes(
                 /* make a note that we just created a file */
                 tr_statsFileCreated(tor->session);
             }
+
+            /* the file may have been created, or may not be where we thought */
+            if (fd == TR_BAD_SYS_FILE || doWrite)
+            {
+                tor->invalidateFileLocation(fileIndex);
+            }
         }
 
         tr_free(subpath);
@@ -127,6 +133,9 @@ static int readOrWriteBytes(
                 tr_logAddTorErr(tor, "read failed for \"%s\": %s", file.name, error->message);
                 tr_error_free(error);
             }
+
+            session->metrics.add(tr_metrics::Counter::DiskReads);
+            session->metrics.add(tr_metrics::Counter::DiskReadBytes, buflen);
         }
         else if (ioMode == TR_IO_WRITE)
         {
@@ -136,6 +145,9 @@ static int readOrWriteBytes(
                 tr_logAddTorErr(tor, "write failed for \"%s\": %s", file.name, error->message);
                 tr_error_free(error);
             }
+
+            session->metrics.add(tr_metrics::Counter::DiskWrites);
+            session->metrics.add(tr_metrics::Counter::DiskWriteBytes, buflen);
         }
         else if (ioMode == TR_IO_PREFETCH)
         {
@@ -263,6 +275,7 @@ static std::optional<tr_sha1_digest_t> recalculateHash(tr_torrent* tor, tr_piece
 
     auto bytes_left = size_t{ tor->pieceSize(piece) };
     auto offset = uint32_t{};
+    tr_cacheDropPiece(tor->session->cache, tor, piece); // check what's on disk, not a copy of it
     tr_ioPrefetch(tor, piece, offset, bytes_left);
 
     auto sha = tr_sha1_init();
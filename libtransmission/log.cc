@@ -6,11 +6,25 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
 #include <cstdio>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
 
-#include <event2/buffer.h>
+#ifndef _WIN32
+#include <pthread.h> /* pthread_atfork() */
+#endif
+
+#include <event2/util.h> /* evutil_vsnprintf() */
 
 #include "transmission.h"
 #include "file.h"
@@ -50,6 +64,8 @@ tr_log_level tr_logGetLevel(void)
 
 static std::recursive_mutex message_mutex_;
 
+static std::atomic<tr_log_format> log_format_ = TR_LOG_FORMAT_TEXT;
+
 tr_sys_file_t tr_logGetFile(void)
 {
     static bool initialized = false;
@@ -70,6 +86,13 @@ tr_sys_file_t tr_logGetFile(void)
             break;
         }
 
+        char* const format = tr_env_get_string("TR_LOG_FORMAT", nullptr);
+        if (tr_strcmp0(format, "json") == 0)
+        {
+            log_format_ = TR_LOG_FORMAT_JSON;
+        }
+        tr_free(format);
+
         initialized = true;
     }
 
@@ -81,6 +104,18 @@ void tr_logSetLevel(tr_log_level level)
     __tr_message_level = level;
 }
 
+void tr_logSetFormat(tr_log_format format)
+{
+    tr_logGetFile(); // so that TR_LOG_FORMAT doesn't override this later
+    log_format_ = format;
+}
+
+tr_log_format tr_logGetFormat(void)
+{
+    tr_logGetFile();
+    return log_format_;
+}
+
 void tr_logSetQueueEnabled(bool isEnabled)
 {
     myQueueEnabled = isEnabled;
@@ -119,10 +154,8 @@ void tr_logFreeQueue(tr_log_message* list)
 ***
 **/
 
-char* tr_logGetTimeStr(char* buf, size_t buflen)
+static char* formatTime(struct timeval const& tv, char* buf, size_t buflen)
 {
-    struct timeval tv;
-    tr_gettimeofday(&tv);
     time_t const seconds = tv.tv_sec;
     int const milliseconds = (int)(tv.tv_usec / 1000);
     char msec_str[8];
@@ -137,6 +170,13 @@ char* tr_logGetTimeStr(char* buf, size_t buflen)
     return buf;
 }
 
+char* tr_logGetTimeStr(char* buf, size_t buflen)
+{
+    struct timeval tv;
+    tr_gettimeofday(&tv);
+    return formatTime(tv, buf, buflen);
+}
+
 bool tr_logGetDeepEnabled(void)
 {
     static int8_t deepLoggingIsActive = -1;
@@ -149,138 +189,582 @@ bool tr_logGetDeepEnabled(void)
     return deepLoggingIsActive != 0;
 }
 
-void tr_logAddDeep(char const* file, int line, char const* name, char const* fmt, ...)
+/***
+****  The logging pipeline.
+****
+****  Callers only format their message into a fixed-size record in a
+****  lock-free ring buffer. A writer thread drains the ring, builds the
+****  output lines, and does the file I/O in batches. The level has been
+****  checked by the tr_logAdd*() macros before any of this happens.
+***/
+
+namespace
 {
-    tr_sys_file_t const fp = tr_logGetFile();
 
-    if (fp != TR_BAD_SYS_FILE || IsDebuggerPresent())
+struct LogRecord
+{
+    static auto constexpr NameSize = size_t{ 128 };
+    static auto constexpr MessageSize = size_t{ 1024 };
+
+    struct timeval when;
+    char const* file; /* a __FILE__ literal, so it outlives the record */
+    int line;
+    tr_log_level level;
+    bool deep; /* from tr_logAddDeep() */
+    bool has_name;
+    size_t message_len;
+    char name[NameSize];
+    char message[MessageSize];
+};
+
+char const* levelName(tr_log_level level)
+{
+    switch (level)
     {
-        struct evbuffer* buf = evbuffer_new();
-        char* base = tr_sys_path_basename(file, nullptr);
+    case TR_LOG_SILENT:
+        return "silent";
 
-        char timestr[64];
-        evbuffer_add_printf(buf, "[%s] ", tr_logGetTimeStr(timestr, sizeof(timestr)));
+    case TR_LOG_ERROR:
+        return "error";
 
-        if (name != nullptr)
-        {
-            evbuffer_add_printf(buf, "%s ", name);
-        }
+    case TR_LOG_INFO:
+        return "info";
 
-        va_list args;
-        va_start(args, fmt);
-        evbuffer_add_vprintf(buf, fmt, args);
-        va_end(args);
-        evbuffer_add_printf(buf, " (%s:%d)" TR_NATIVE_EOL_STR, base, line);
+    case TR_LOG_DEBUG:
+        return "debug";
 
-        size_t message_len = 0;
-        char* const message = evbuffer_free_to_str(buf, &message_len);
+    default:
+        return "firehose";
+    }
+}
 
-#ifdef _WIN32
-        OutputDebugStringA(message);
-#endif
+void appendJsonString(std::string& out, std::string_view str)
+{
+    out += '"';
 
-        if (fp != TR_BAD_SYS_FILE)
+    for (auto const ch : str)
+    {
+        switch (ch)
         {
-            tr_sys_file_write(fp, message, message_len, nullptr, nullptr);
+        case '"':
+            out += "\\\"";
+            break;
+
+        case '\\':
+            out += "\\\\";
+            break;
+
+        case '\n':
+            out += "\\n";
+            break;
+
+        case '\r':
+            out += "\\r";
+            break;
+
+        case '\t':
+            out += "\\t";
+            break;
+
+        default:
+            if (uint8_t(ch) < 0x20)
+            {
+                char buf[8];
+                tr_snprintf(buf, sizeof(buf), "\\u%04x", unsigned(ch));
+                out += buf;
+            }
+            else
+            {
+                out += ch;
+            }
+            break;
         }
+    }
 
-        tr_free(message);
+    out += '"';
+}
+
+// one JSON object per line, for log collectors
+void appendJson(std::string& out, LogRecord const& rec)
+{
+    auto const msec = int64_t{ rec.when.tv_sec } * 1000 + rec.when.tv_usec / 1000;
+
+    out += tr_strvJoin("{\"time\":", std::to_string(msec), ",\"level\":\"", levelName(rec.level), "\",\"file\":");
+    appendJsonString(out, rec.file);
+    out += tr_strvJoin(",\"line\":", std::to_string(rec.line));
+
+    if (rec.has_name)
+    {
+        out += ",\"name\":";
+        appendJsonString(out, rec.name);
+    }
+
+    out += ",\"message\":";
+    appendJsonString(out, std::string_view{ rec.message, rec.message_len });
+    out += "}\n";
+}
+
+void appendText(std::string& out, LogRecord const& rec)
+{
+    char timestr[64];
+    formatTime(rec.when, timestr, sizeof(timestr));
+
+    auto const message = std::string_view{ rec.message, rec.message_len };
+
+    if (rec.deep)
+    {
+        char* const base = tr_sys_path_basename(rec.file, nullptr);
+        out += tr_strvJoin(
+            "[",
+            timestr,
+            "] ",
+            rec.has_name ? rec.name : "",
+            rec.has_name ? " " : "",
+            message,
+            " (",
+            base != nullptr ? base : rec.file,
+            ":",
+            std::to_string(rec.line),
+            ")" TR_NATIVE_EOL_STR);
         tr_free(base);
     }
+    else
+    {
+        out += tr_strvJoin("[", timestr, "] ", rec.has_name ? rec.name : "", rec.has_name ? ": " : "", message);
+        out += TR_NATIVE_EOL_STR;
+    }
 }
 
-/***
-****
-***/
+// add a regular message to the queue that the clients poll with tr_logGetQueue()
+void enqueueMessage(LogRecord const& rec)
+{
+    auto const lock = std::lock_guard(message_mutex_);
 
-void tr_logAddMessage(char const* file, int line, tr_log_level level, char const* name, char const* fmt, ...)
+    auto* const newmsg = tr_new0(tr_log_message, 1);
+    newmsg->level = rec.level;
+    newmsg->when = rec.when.tv_sec;
+    newmsg->message = tr_strndup(rec.message, rec.message_len);
+    newmsg->file = rec.file;
+    newmsg->line = rec.line;
+    newmsg->name = rec.has_name ? tr_strdup(rec.name) : nullptr;
+
+    *myQueueTail = newmsg;
+    myQueueTail = &newmsg->next;
+    ++myQueueLength;
+
+    if (myQueueLength > TR_LOG_MAX_QUEUE_LENGTH)
+    {
+        tr_log_message* old = myQueue;
+        myQueue = old->next;
+        old->next = nullptr;
+        tr_logFreeQueue(old);
+        --myQueueLength;
+        TR_ASSERT(myQueueLength == TR_LOG_MAX_QUEUE_LENGTH);
+    }
+}
+
+/* Format `recs` and write them out. Called by the writer thread,
+ * or by a caller when the pipeline can't take its record. */
+void writeRecords(LogRecord const* recs, size_t n_recs, size_t n_dropped)
 {
-    int const err = errno; /* message logging shouldn't affect errno */
-    char buf[1024];
-    va_list ap;
+    auto const json = tr_logGetFormat() == TR_LOG_FORMAT_JSON;
+    tr_sys_file_t const file = tr_logGetFile();
+    auto out = std::string{};
 
-    auto const lock = std::lock_guard(message_mutex_);
+    if (n_dropped != 0)
+    {
+        auto rec = LogRecord{};
+        tr_gettimeofday(&rec.when);
+        rec.file = __FILE__;
+        rec.line = __LINE__;
+        rec.level = TR_LOG_ERROR;
+        rec.message_len = size_t(tr_snprintf(rec.message, sizeof(rec.message), "%zu log messages were dropped", n_dropped));
+        (json ? appendJson : appendText)(out, rec);
+    }
 
-    /* build the text message */
-    *buf = '\0';
-    va_start(ap, fmt);
-    int const buf_len = evutil_vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
+    for (auto const* rec = recs, * const end = recs + n_recs; rec != end; ++rec)
+    {
+        if (!rec->deep && rec->message_len == 0)
+        {
+            continue;
+        }
+
+        if (!rec->deep && tr_logGetQueueEnabled())
+        {
+            enqueueMessage(*rec);
+            continue;
+        }
 
-    if (buf_len < 0)
+        // deep messages are only logged to TR_DEBUG_FD and to the debugger
+        if (rec->deep && file == TR_BAD_SYS_FILE && !IsDebuggerPresent())
+        {
+            continue;
+        }
+
+        (json ? appendJson : appendText)(out, *rec);
+    }
+
+    if (std::empty(out))
     {
-        goto FINISH;
+        return;
     }
 
 #ifdef _WIN32
+    OutputDebugStringA(out.c_str());
+#endif
 
-    if ((size_t)buf_len < sizeof(buf) - 3)
+    tr_sys_file_t const fp = file != TR_BAD_SYS_FILE ? file : tr_sys_file_get_std(TR_STD_SYS_FILE_ERR, nullptr);
+    tr_sys_file_write(fp, std::data(out), std::size(out), nullptr, nullptr);
+    tr_sys_file_flush(fp, nullptr);
+}
+
+/**
+ * A bounded multi-producer, single-consumer ring of LogRecords.
+ *
+ * Each slot has a sequence number that tells producers when it's free
+ * and the consumer when it's been published, so producers only contend
+ * on one atomic increment and nobody takes a lock.
+ */
+class LogPipeline
+{
+public:
+#ifdef TR_LIGHTWEIGHT
+    static auto constexpr Capacity = size_t{ 64 };
+#else
+    static auto constexpr Capacity = size_t{ 512 };
+#endif
+
+    LogPipeline()
+        : slots_{ std::make_unique<Slot[]>(Capacity) }
     {
-        buf[buf_len + 0] = '\r';
-        buf[buf_len + 1] = '\n';
-        buf[buf_len + 2] = '\0';
-        OutputDebugStringA(buf);
-        buf[buf_len + 0] = '\0';
+        for (size_t i = 0; i < Capacity; ++i)
+        {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        thread_ = std::thread(&LogPipeline::run, this);
     }
-    else
+
+    LogPipeline(LogPipeline const&) = delete;
+    LogPipeline& operator=(LogPipeline const&) = delete;
+
+    ~LogPipeline()
     {
-        OutputDebugStringA(buf);
+        {
+            auto const lock = std::lock_guard(mutex_);
+            stopping_ = true;
+        }
+
+        wake_.notify_one();
+        thread_.join();
     }
 
-#endif
+    // Returns a slot for the caller to fill and then publish(), or nullptr if the ring is full.
+    LogRecord* claim(size_t* setme_pos)
+    {
+        auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            auto& slot = slots_[pos % Capacity];
+            auto const seq = slot.sequence.load(std::memory_order_acquire);
+            auto const diff = intptr_t(seq) - intptr_t(pos);
 
-    if (!tr_str_is_empty(buf))
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    *setme_pos = pos;
+                    return &slot.record;
+                }
+            }
+            else if (diff < 0)
+            {
+                return nullptr;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Like claim(), but if the ring is full, waits for the writer to make room.
+    // Returns nullptr if that wait could never end: on the writer itself, or
+    // once it's stopping.
+    LogRecord* claimWaiting(size_t* setme_pos)
     {
-        if (tr_logGetQueueEnabled())
+        for (;;)
         {
-            auto* const newmsg = tr_new0(tr_log_message, 1);
-            newmsg->level = level;
-            newmsg->when = tr_time();
-            newmsg->message = tr_strndup(buf, buf_len);
-            newmsg->file = file;
-            newmsg->line = line;
-            newmsg->name = tr_strdup(name);
-
-            *myQueueTail = newmsg;
-            myQueueTail = &newmsg->next;
-            ++myQueueLength;
-
-            if (myQueueLength > TR_LOG_MAX_QUEUE_LENGTH)
+            if (auto* const rec = claim(setme_pos); rec != nullptr)
+            {
+                return rec;
+            }
+
+            if (std::this_thread::get_id() == thread_.get_id())
+            {
+                return nullptr;
+            }
+
+            auto lock = std::unique_lock(mutex_);
+
+            if (stopping_)
             {
-                tr_log_message* old = myQueue;
-                myQueue = old->next;
-                old->next = nullptr;
-                tr_logFreeQueue(old);
-                --myQueueLength;
-                TR_ASSERT(myQueueLength == TR_LOG_MAX_QUEUE_LENGTH);
+                return nullptr;
             }
+
+            // the writer frees slots a batch at a time, notifying flushed_ after each one.
+            // Don't wait past IdleWait in case that happened before we took the lock.
+            wake_.notify_one();
+            flushed_.wait_for(lock, IdleWait);
+        }
+    }
+
+    // count a record that was dropped because the ring was full
+    void drop()
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void publish(size_t pos)
+    {
+        slots_[pos % Capacity].sequence.store(pos + 1, std::memory_order_release);
+
+        if (writer_is_idle_.load())
+        {
+            wake_.notify_one();
         }
-        else
+    }
+
+    // wait for everything that's been published so far to be written
+    void flush()
+    {
+        auto const target = enqueue_pos_.load();
+        auto lock = std::unique_lock(mutex_);
+        wake_.notify_one();
+        flushed_.wait_for(lock, std::chrono::seconds(5), [this, target]() { return written_pos_ >= target; });
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        LogRecord record;
+    };
+
+    // how long an idle writer sleeps if it misses a wakeup
+    static auto constexpr IdleWait = std::chrono::milliseconds(100);
+
+    static auto constexpr BatchSize = size_t{ 64 };
+
+    void run()
+    {
+        auto batch = std::make_unique<LogRecord[]>(BatchSize);
+        auto pos = size_t{};
+
+        for (;;)
         {
-            char timestr[64];
+            auto n = size_t{};
+
+            while (n < BatchSize)
+            {
+                auto& slot = slots_[pos % Capacity];
+
+                if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+                {
+                    break;
+                }
 
-            tr_sys_file_t fp = tr_logGetFile();
+                batch[n++] = slot.record;
+                slot.sequence.store(pos + Capacity, std::memory_order_release);
+                ++pos;
+            }
 
-            if (fp == TR_BAD_SYS_FILE)
+            auto const n_dropped = dropped_.exchange(0, std::memory_order_relaxed);
+            if (n != 0 || n_dropped != 0)
             {
-                fp = tr_sys_file_get_std(TR_STD_SYS_FILE_ERR, nullptr);
+                writeRecords(batch.get(), n, n_dropped);
             }
 
-            tr_logGetTimeStr(timestr, sizeof(timestr));
+            auto lock = std::unique_lock(mutex_);
+            written_pos_ = pos;
+            flushed_.notify_all();
 
-            if (name != nullptr)
+            if (n == BatchSize)
             {
-                tr_sys_file_write_fmt(fp, "[%s] %s: %s" TR_NATIVE_EOL_STR, nullptr, timestr, name, buf);
+                continue;
             }
-            else
+
+            if (stopping_)
             {
-                tr_sys_file_write_fmt(fp, "[%s] %s" TR_NATIVE_EOL_STR, nullptr, timestr, buf);
+                break;
             }
 
-            tr_sys_file_flush(fp, nullptr);
+            writer_is_idle_ = true;
+            if (slots_[pos % Capacity].sequence.load(std::memory_order_acquire) != pos + 1)
+            {
+                wake_.wait_for(lock, IdleWait);
+            }
+            writer_is_idle_ = false;
         }
     }
 
-FINISH:
+    std::unique_ptr<Slot[]> const slots_;
+    std::atomic<size_t> enqueue_pos_ = 0;
+    std::atomic<size_t> dropped_ = 0;
+    std::atomic<bool> writer_is_idle_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    size_t written_pos_ = 0;
+    bool stopping_ = false;
+
+    std::thread thread_;
+};
+
+std::atomic<LogPipeline*> pipeline_ = nullptr;
+std::mutex pipeline_mutex_;
+bool pipeline_is_shut_down_ = false;
+
+// Stops the writer at exit. Anything logged after that is written synchronously.
+struct PipelineShutdown
+{
+    ~PipelineShutdown()
+    {
+        auto const lock = std::lock_guard(pipeline_mutex_);
+        pipeline_is_shut_down_ = true;
+        delete pipeline_.exchange(nullptr);
+    }
+} pipeline_shutdown_;
+
+LogPipeline* getPipeline()
+{
+    if (auto* const pipeline = pipeline_.load(std::memory_order_acquire); pipeline != nullptr)
+    {
+        return pipeline;
+    }
+
+    auto const lock = std::lock_guard(pipeline_mutex_);
+
+    if (pipeline_ == nullptr && !pipeline_is_shut_down_)
+    {
+#ifndef _WIN32
+        // The writer doesn't survive a fork, e.g. when the daemon detaches,
+        // so the child leaks the old pipeline and starts a new one.
+        static auto const atfork_registered = pthread_atfork(
+            []()
+            {
+                message_mutex_.lock();
+                pipeline_mutex_.lock();
+            },
+            []()
+            {
+                pipeline_mutex_.unlock();
+                message_mutex_.unlock();
+            },
+            []()
+            {
+                pipeline_.store(nullptr);
+                pipeline_mutex_.unlock();
+                message_mutex_.unlock();
+            });
+        (void)atfork_registered;
+#endif
+
+        pipeline_ = new LogPipeline{};
+    }
+
+    return pipeline_;
+}
+
+void addRecord(char const* file, int line, tr_log_level level, bool deep, char const* name, char const* fmt, va_list args)
+{
+    auto* const pipeline = getPipeline();
+    auto pos = size_t{};
+    LogRecord* rec = nullptr;
+
+    // When the ring is full, messages that clients show to users wait for
+    // the writer to make room, so that they're neither lost nor written
+    // ahead of older messages still in the ring. Debug messages are dropped.
+    if (pipeline != nullptr)
+    {
+        rec = level > TR_LOG_INFO ? pipeline->claim(&pos) : pipeline->claimWaiting(&pos);
+
+        if (rec == nullptr && level > TR_LOG_INFO)
+        {
+            pipeline->drop();
+            return;
+        }
+    }
+
+    // without a writer to hand it to, the record is written here and now
+    auto local = std::unique_ptr<LogRecord>{};
+    if (rec == nullptr)
+    {
+        local = std::make_unique<LogRecord>();
+        rec = local.get();
+    }
+
+    tr_gettimeofday(&rec->when);
+    rec->file = file;
+    rec->line = line;
+    rec->level = level;
+    rec->deep = deep;
+    rec->has_name = name != nullptr;
+    if (rec->has_name)
+    {
+        tr_strlcpy(rec->name, name, sizeof(rec->name));
+    }
+
+    int const len = evutil_vsnprintf(rec->message, sizeof(rec->message), fmt, args);
+    rec->message_len = len < 0 ? 0 : std::min(size_t(len), sizeof(rec->message) - 1);
+
+    if (local)
+    {
+        writeRecords(rec, 1, 0);
+    }
+    else
+    {
+        pipeline->publish(pos);
+    }
+}
+
+} // namespace
+
+void tr_logFlush(void)
+{
+    if (auto* const pipeline = pipeline_.load(); pipeline != nullptr)
+    {
+        pipeline->flush();
+    }
+}
+
+void tr_logAddDeep(char const* file, int line, char const* name, char const* fmt, ...)
+{
+    if (tr_logGetFile() != TR_BAD_SYS_FILE || IsDebuggerPresent())
+    {
+        int const err = errno; /* message logging shouldn't affect errno */
+        va_list args;
+        va_start(args, fmt);
+        addRecord(file, line, TR_LOG_FIREHOSE, true, name, fmt, args);
+        va_end(args);
+        errno = err;
+    }
+}
+
+/***
+****
+***/
+
+void tr_logAddMessage(char const* file, int line, tr_log_level level, char const* name, char const* fmt, ...)
+{
+    int const err = errno; /* message logging shouldn't affect errno */
+
+    va_list args;
+    va_start(args, fmt);
+    addRecord(file, line, level, false, name, fmt, args);
+    va_end(args);
+
     errno = err;
 }
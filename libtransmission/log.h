@@ -67,6 +67,14 @@ void tr_logAddDeep(char const* file, int line, char const* name, char const* fmt
         } \
     } while (0)
 
+/**
+ * @brief wait for the messages logged so far to be written.
+ *
+ * Messages are formatted and written by a background thread,
+ * so they may not have reached the log file or queue yet.
+ */
+void tr_logFlush(void);
+
 /** @brief set the buffer with the current time formatted for deep logging. */
 char* tr_logGetTimeStr(char* buf, size_t buflen) TR_GNUC_NONNULL(1);
 
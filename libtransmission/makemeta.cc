@@ -7,10 +7,15 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdlib> /* qsort */
 #include <cstring> /* strcmp, strlen */
+#include <deque>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include <event2/util.h> /* evutil_ascii_strcasecmp() */
 
@@ -222,6 +227,11 @@ bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* b, uint32_t bytes)
     return true;
 }
 
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* b, uint32_t n_threads)
+{
+    b->threadCount = std::min(n_threads, uint32_t{ TR_MAKEMETA_MAX_THREADS });
+}
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 {
     if (builder != nullptr)
@@ -251,11 +261,175 @@ void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 *****
 ****/
 
+/* Hashes pieces on a pool of worker threads while the caller reads the next ones.
+ * Each hash is written straight to its piece's slot in `hashes`, so they end up
+ * in piece order no matter which worker finishes first. */
+class PieceHasher
+{
+public:
+    PieceHasher(uint8_t* hashes, uint32_t piece_size, size_t n_threads)
+        : hashes_{ hashes }
+    {
+        /* one buffer per worker, plus a couple for the reader to fill meanwhile */
+        for (size_t i = 0; i < n_threads + 2; ++i)
+        {
+            free_.emplace_back(piece_size);
+        }
+
+        for (size_t i = 0; i < n_threads; ++i)
+        {
+            threads_.emplace_back(&PieceHasher::run, this);
+        }
+    }
+
+    PieceHasher(PieceHasher const&) = delete;
+    PieceHasher& operator=(PieceHasher const&) = delete;
+
+    ~PieceHasher()
+    {
+        {
+            auto const lock = std::lock_guard(mutex_);
+            stopping_ = true;
+        }
+
+        work_cv_.notify_all();
+
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    /* blocks until a buffer is free */
+    std::vector<uint8_t> getBuffer()
+    {
+        auto lock = std::unique_lock(mutex_);
+        done_cv_.wait(lock, [this]() { return !std::empty(free_); });
+        auto buf = std::move(free_.back());
+        free_.pop_back();
+        return buf;
+    }
+
+    void submit(tr_piece_index_t piece, std::vector<uint8_t> buf, uint32_t len)
+    {
+        {
+            auto const lock = std::lock_guard(mutex_);
+            work_.push_back(Work{ piece, len, std::move(buf) });
+        }
+
+        work_cv_.notify_one();
+    }
+
+    /* blocks until every piece that was submitted has been hashed */
+    void wait()
+    {
+        auto lock = std::unique_lock(mutex_);
+        done_cv_.wait(lock, [this]() { return std::empty(work_) && n_busy_ == 0; });
+    }
+
+    [[nodiscard]] uint32_t hashedCount() const
+    {
+        return n_hashed_;
+    }
+
+private:
+    struct Work
+    {
+        tr_piece_index_t piece;
+        uint32_t len;
+        std::vector<uint8_t> buf;
+    };
+
+    void run()
+    {
+        for (;;)
+        {
+            auto work = Work{};
+
+            {
+                auto lock = std::unique_lock(mutex_);
+                work_cv_.wait(lock, [this]() { return stopping_ || !std::empty(work_); });
+
+                if (std::empty(work_))
+                {
+                    return;
+                }
+
+                work = std::move(work_.front());
+                work_.pop_front();
+                ++n_busy_;
+            }
+
+            tr_sha1(hashes_ + size_t{ work.piece } * SHA_DIGEST_LENGTH, std::data(work.buf), (int)work.len, nullptr);
+            ++n_hashed_;
+
+            {
+                auto const lock = std::lock_guard(mutex_);
+                free_.push_back(std::move(work.buf));
+                --n_busy_;
+            }
+
+            done_cv_.notify_all();
+        }
+    }
+
+    uint8_t* const hashes_;
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Work> work_;
+    std::vector<std::vector<uint8_t>> free_;
+    size_t n_busy_ = 0;
+    bool stopping_ = false;
+    std::atomic<uint32_t> n_hashed_ = 0;
+
+    std::vector<std::thread> threads_;
+};
+
+static uint32_t getHashThreadCount(tr_metainfo_builder const* b)
+{
+    if (b->threadCount != 0)
+    {
+        return b->threadCount;
+    }
+
+    /* one per core. hardware_concurrency() returns 0 if it doesn't know */
+    return std::clamp(std::thread::hardware_concurrency(), 1U, uint32_t{ TR_MAKEMETA_MAX_THREADS });
+}
+
+static void setReadError(tr_metainfo_builder* b, uint32_t fileIndex, int err)
+{
+    b->my_errno = err;
+    tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
+    b->result = TR_MAKEMETA_IO_READ;
+}
+
+static tr_sys_file_t openFileForHashing(tr_metainfo_builder* b, uint32_t fileIndex)
+{
+    tr_error* error = nullptr;
+    tr_sys_file_t const fd = tr_sys_file_open(
+        b->files[fileIndex].filename,
+        TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL,
+        0,
+        &error);
+
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        setReadError(b, fileIndex, error->code);
+        tr_error_free(error);
+    }
+
+    return fd;
+}
+
 static uint8_t* getHashInfo(tr_metainfo_builder* b)
 {
+    /* how many pieces ahead of the reader to ask the OS to prefetch */
+    auto constexpr ReadAheadPieces = uint64_t{ 4 };
+
     uint32_t fileIndex = 0;
     uint8_t* ret = tr_new0(uint8_t, SHA_DIGEST_LENGTH * b->pieceCount);
-    uint8_t* walk = ret;
     uint64_t off = 0;
     tr_error* error = nullptr;
 
@@ -264,67 +438,81 @@ static uint8_t* getHashInfo(tr_metainfo_builder* b)
         return ret;
     }
 
-    auto* const buf = static_cast<uint8_t*>(tr_malloc(b->pieceSize));
     b->pieceIndex = 0;
     uint64_t totalRemain = b->totalSize;
+    uint64_t const readAhead = b->pieceSize * ReadAheadPieces;
+    uint64_t advisedUntil = 0;
+    tr_piece_index_t piece = 0;
+    bool ok = true;
 
-    tr_sys_file_t fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
+    tr_sys_file_t fd = openFileForHashing(b, fileIndex);
     if (fd == TR_BAD_SYS_FILE)
     {
-        b->my_errno = error->code;
-        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-        b->result = TR_MAKEMETA_IO_READ;
-        tr_free(buf);
         tr_free(ret);
-        tr_error_free(error);
         return nullptr;
     }
 
+    /* this thread reads the pieces in order while the hasher's workers hash them */
+    auto hasher = PieceHasher{ ret, b->pieceSize, getHashThreadCount(b) };
+
     while (totalRemain != 0)
     {
-        TR_ASSERT(b->pieceIndex < b->pieceCount);
+        TR_ASSERT(piece < b->pieceCount);
 
-        uint8_t* bufptr = buf;
+        auto buf = hasher.getBuffer();
+        uint8_t* bufptr = std::data(buf);
         uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
         uint64_t leftInPiece = thisPieceSize;
 
-        while (leftInPiece != 0)
+        while (ok && leftInPiece != 0)
         {
-            uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
+            uint64_t const fileSize = b->files[fileIndex].size;
+            uint64_t const n_this_pass = std::min(fileSize - off, leftInPiece);
+
+            if (off + n_this_pass > advisedUntil)
+            {
+                advisedUntil = std::min(off + readAhead, fileSize);
+                (void)tr_sys_file_advise(fd, off, advisedUntil - off, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+            }
+
             uint64_t n_read = 0;
-            (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
+            if (n_this_pass != 0 && (!tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, &error) || n_read == 0))
+            {
+                /* a read error, or the file got shorter since we looked at it */
+                setReadError(b, fileIndex, error != nullptr ? error->code : EIO);
+                tr_error_clear(&error);
+                ok = false;
+                break;
+            }
+
             bufptr += n_read;
             off += n_read;
             leftInPiece -= n_read;
 
-            if (off == b->files[fileIndex].size)
+            if (off == fileSize)
             {
                 off = 0;
+                advisedUntil = 0;
                 tr_sys_file_close(fd, nullptr);
                 fd = TR_BAD_SYS_FILE;
 
                 if (++fileIndex < b->fileCount)
                 {
-                    fd = tr_sys_file_open(b->files[fileIndex].filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, &error);
-
-                    if (fd == TR_BAD_SYS_FILE)
-                    {
-                        b->my_errno = error->code;
-                        tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
-                        b->result = TR_MAKEMETA_IO_READ;
-                        tr_free(buf);
-                        tr_free(ret);
-                        tr_error_free(error);
-                        return nullptr;
-                    }
+                    fd = openFileForHashing(b, fileIndex);
+                    ok = fd != TR_BAD_SYS_FILE;
                 }
             }
         }
 
-        TR_ASSERT(bufptr - buf == (int)thisPieceSize);
+        if (!ok)
+        {
+            break;
+        }
+
+        TR_ASSERT(bufptr - std::data(buf) == (int)thisPieceSize);
         TR_ASSERT(leftInPiece == 0);
-        tr_sha1(walk, buf, (int)thisPieceSize, nullptr);
-        walk += SHA_DIGEST_LENGTH;
+        hasher.submit(piece, std::move(buf), thisPieceSize);
+        b->pieceIndex = hasher.hashedCount();
 
         if (b->abortFlag)
         {
@@ -333,18 +521,26 @@ static uint8_t* getHashInfo(tr_metainfo_builder* b)
         }
 
         totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
+        ++piece;
     }
 
-    TR_ASSERT(b->abortFlag || walk - ret == (int)(SHA_DIGEST_LENGTH * b->pieceCount));
-    TR_ASSERT(b->abortFlag || !totalRemain);
+    hasher.wait();
+    b->pieceIndex = hasher.hashedCount();
+
+    TR_ASSERT(!ok || b->abortFlag || piece == b->pieceCount);
+    TR_ASSERT(!ok || b->abortFlag || !totalRemain);
 
     if (fd != TR_BAD_SYS_FILE)
     {
         tr_sys_file_close(fd, nullptr);
     }
 
-    tr_free(buf);
+    if (!ok)
+    {
+        tr_free(ret);
+        return nullptr;
+    }
+
     return ret;
 }
 
@@ -510,9 +706,14 @@ static void tr_realMakeMetaInfo(tr_metainfo_builder* builder)
 ****
 ***/
 
+/* how many builders to run at once. Each one has its own pool of
+ * hashing threads, so this is mostly about overlapping one builder's
+ * reads with another's hashing; more would just fight over the disk. */
+static auto constexpr MaxWorkerThreads = size_t{ 2 };
+
 static tr_metainfo_builder* queue = nullptr;
 
-static tr_thread* workerThread = nullptr;
+static size_t workerThreadCount = 0;
 
 static std::recursive_mutex queue_mutex_;
 
@@ -530,10 +731,14 @@ static void makeMetaWorkerFunc(void* /*user_data*/)
             builder = queue;
             queue = queue->nextBuilder;
         }
+        else
+        {
+            /* if no builders, this worker thread is done */
+            --workerThreadCount;
+        }
 
         queue_mutex_.unlock();
 
-        /* if no builders, this worker thread is done */
         if (builder == nullptr)
         {
             break;
@@ -541,8 +746,6 @@ static void makeMetaWorkerFunc(void* /*user_data*/)
 
         tr_realMakeMetaInfo(builder);
     }
-
-    workerThread = nullptr;
 }
 
 void tr_makeMetaInfo(
@@ -598,8 +801,9 @@ void tr_makeMetaInfo(
     builder->nextBuilder = queue;
     queue = builder;
 
-    if (workerThread == nullptr)
+    if (workerThreadCount < MaxWorkerThreads)
     {
-        workerThread = tr_threadNew(makeMetaWorkerFunc, nullptr);
+        ++workerThreadCount;
+        tr_threadNew(makeMetaWorkerFunc, nullptr);
     }
 }
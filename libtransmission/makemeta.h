@@ -11,6 +11,8 @@
 #include "tr-macros.h"
 #include "transmission.h"
 
+#define TR_MAKEMETA_MAX_THREADS 64
+
 struct tr_metainfo_builder_file
 {
     char* filename;
@@ -41,6 +43,10 @@ struct tr_metainfo_builder
     uint32_t pieceCount;
     bool isFolder;
 
+    /* how many threads to hash pieces with. 0 means one per CPU core.
+     * Use tr_metaInfoBuilderSetThreadCount() to change it. */
+    uint32_t threadCount;
+
     /**
     ***  These are set inside tr_makeMetaInfo()
     ***  by copying the arguments passed to it,
@@ -91,6 +97,13 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFile);
  */
 bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* builder, uint32_t bytes);
 
+/**
+ * Call this before tr_makeMetaInfo() to set how many threads hash the
+ * pieces while they're being read. 0, the default, means one per CPU core.
+ * Values above TR_MAKEMETA_MAX_THREADS are clamped to it.
+ */
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* builder, uint32_t n_threads);
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder*);
 
 /**
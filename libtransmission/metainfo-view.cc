@@ -0,0 +1,769 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstring> // memcpy()
+#include <limits>
+
+#include "transmission.h"
+
+#include "crypto-utils.h" // tr_sha1()
+#include "metainfo-view.h"
+#include "tr-assert.h"
+
+using namespace std::literals;
+
+namespace
+{
+
+auto constexpr MaxStrLength = size_t{ 128 * 1024 * 1024 }; // same as the variant parser's
+
+bool isValueStart(char ch)
+{
+    return ('0' <= ch && ch <= '9') || ch == 'i' || ch == 'l' || ch == 'd' || ch == 'e';
+}
+
+// like tr_variantParseBenc(), march past bytes that can't start a value
+void skipJunk(std::string_view& benc)
+{
+    while (!std::empty(benc) && !isValueStart(benc.front()))
+    {
+        benc.remove_prefix(1);
+    }
+}
+
+bool peek(std::string_view& benc, char ch)
+{
+    skipJunk(benc);
+    return !std::empty(benc) && benc.front() == ch;
+}
+
+bool peekStr(std::string_view& benc)
+{
+    skipJunk(benc);
+    return !std::empty(benc) && '0' <= benc.front() && benc.front() <= '9';
+}
+
+// same rules as tr_bencParseInt()
+std::optional<int64_t> readInt(std::string_view& benc)
+{
+    if (!peek(benc, 'i'))
+    {
+        return {};
+    }
+
+    auto walk = benc.substr(1);
+    auto const negative = !std::empty(walk) && walk.front() == '-';
+    if (negative)
+    {
+        walk.remove_prefix(1);
+    }
+
+    auto const end = walk.find('e');
+    if (end == 0 || end == std::string_view::npos || (walk.front() == '0' && end > 1) || (negative && walk.front() == '0'))
+    {
+        return {};
+    }
+
+    auto value = uint64_t{};
+    for (auto const ch : walk.substr(0, end))
+    {
+        if (ch < '0' || '9' < ch || value > (std::numeric_limits<uint64_t>::max() - 9) / 10)
+        {
+            return {};
+        }
+
+        value = value * 10 + (ch - '0');
+    }
+
+    if (value > uint64_t(std::numeric_limits<int64_t>::max()) + (negative ? 1 : 0))
+    {
+        return {};
+    }
+
+    benc = walk.substr(end + 1);
+    return negative ? int64_t(0 - value) : int64_t(value);
+}
+
+// same rules as tr_bencParseStr()
+std::optional<std::string_view> readStr(std::string_view& benc)
+{
+    if (!peekStr(benc))
+    {
+        return {};
+    }
+
+    auto const colon = benc.find(':');
+    if (colon == std::string_view::npos)
+    {
+        return {};
+    }
+
+    auto len = size_t{};
+    for (auto const ch : benc.substr(0, colon))
+    {
+        if (ch < '0' || '9' < ch || len >= MaxStrLength)
+        {
+            return {};
+        }
+
+        len = len * 10 + (ch - '0');
+    }
+
+    if (len >= MaxStrLength || std::size(benc) - colon - 1 < len)
+    {
+        return {};
+    }
+
+    auto const ret = benc.substr(colon + 1, len);
+    benc.remove_prefix(colon + 1 + len);
+    return ret;
+}
+
+// skips one value of any type, without recursing
+bool skipValue(std::string_view& benc)
+{
+    auto depth = size_t{};
+
+    do
+    {
+        skipJunk(benc);
+        if (std::empty(benc))
+        {
+            return false;
+        }
+
+        switch (benc.front())
+        {
+        case 'i':
+            if (!readInt(benc))
+            {
+                return false;
+            }
+            break;
+
+        case 'l':
+        case 'd':
+            benc.remove_prefix(1);
+            ++depth;
+            break;
+
+        case 'e':
+            if (depth == 0)
+            {
+                return false;
+            }
+            benc.remove_prefix(1);
+            --depth;
+            break;
+
+        default:
+            if (!readStr(benc))
+            {
+                return false;
+            }
+            break;
+        }
+    } while (depth > 0);
+
+    return true;
+}
+
+// Calls `on_item(benc)` for each item in the list at the front of `benc`.
+// `on_item` must consume the item and return false if it can't.
+template<typename OnItem>
+bool readList(std::string_view& benc, OnItem&& on_item)
+{
+    if (!peek(benc, 'l'))
+    {
+        return false;
+    }
+
+    benc.remove_prefix(1);
+
+    while (!peek(benc, 'e'))
+    {
+        if (std::empty(benc) || !on_item(benc))
+        {
+            return false;
+        }
+    }
+
+    benc.remove_prefix(1);
+    return true;
+}
+
+// Calls `on_entry(key, benc)` for each entry in the dict at the front of `benc`.
+// `on_entry` must consume the value and return false if it can't.
+template<typename OnEntry>
+bool readDict(std::string_view& benc, OnEntry&& on_entry)
+{
+    if (!peek(benc, 'd'))
+    {
+        return false;
+    }
+
+    benc.remove_prefix(1);
+
+    while (!peek(benc, 'e'))
+    {
+        auto const key = readStr(benc);
+        if (!key || !on_entry(*key, benc))
+        {
+            return false;
+        }
+    }
+
+    benc.remove_prefix(1);
+    return true;
+}
+
+// Reads a string into `setme`, unless it's already set by an earlier
+// duplicate key. Values of other types are skipped.
+bool readStrInto(std::string_view& benc, std::optional<std::string_view>& setme)
+{
+    if (!peekStr(benc))
+    {
+        return skipValue(benc);
+    }
+
+    auto const str = readStr(benc);
+    if (str && !setme)
+    {
+        setme = str;
+    }
+
+    return str.has_value();
+}
+
+bool readIntInto(std::string_view& benc, std::optional<int64_t>& setme)
+{
+    if (!peek(benc, 'i'))
+    {
+        return skipValue(benc);
+    }
+
+    auto const i = readInt(benc);
+    if (i && !setme)
+    {
+        setme = i;
+    }
+
+    return i.has_value();
+}
+
+// records the bencoded text of a value, unless an earlier duplicate key did
+bool readSpanInto(std::string_view& benc, std::string_view& setme)
+{
+    skipJunk(benc);
+    auto const* const begin = std::data(benc);
+
+    if (!skipValue(benc))
+    {
+        return false;
+    }
+
+    if (std::empty(setme))
+    {
+        setme = std::string_view{ begin, size_t(std::data(benc) - begin) };
+    }
+
+    return true;
+}
+
+} // namespace
+
+/***
+****
+***/
+
+tr_metainfo_view::Path::Iterator::Iterator(std::string_view items)
+    : rest_{ items }
+{
+    ++*this;
+}
+
+tr_metainfo_view::Path::Iterator& tr_metainfo_view::Path::Iterator::operator++()
+{
+    // the path was validated by parse(), so this can't fail
+    auto const str = std::empty(rest_) ? std::nullopt : readStr(rest_);
+    if (str)
+    {
+        component_ = *str;
+    }
+    else
+    {
+        rest_ = {};
+        component_ = {};
+    }
+
+    return *this;
+}
+
+tr_metainfo_view::FileIterator::FileIterator(std::string_view rest, bool is_end)
+    : rest_{ is_end ? std::string_view{} : rest }
+    , is_end_{ is_end }
+{
+    if (!is_end_)
+    {
+        ++*this;
+    }
+}
+
+tr_metainfo_view::FileIterator& tr_metainfo_view::FileIterator::operator++()
+{
+    auto path = std::string_view{};
+    auto path_utf8 = std::string_view{};
+    auto length = std::optional<int64_t>{};
+
+    // the files were validated by parse(), so this only fails at the end
+    auto const ok = !std::empty(rest_) && !peek(rest_, 'e') &&
+        readDict(
+            rest_,
+            [&path, &path_utf8, &length](std::string_view key, std::string_view& benc)
+            {
+                if (key == "length"sv)
+                {
+                    return readIntInto(benc, length);
+                }
+
+                if ((key == "path"sv || key == "path.utf-8"sv) && peek(benc, 'l'))
+                {
+                    return readSpanInto(benc, key == "path"sv ? path : path_utf8);
+                }
+
+                return skipValue(benc);
+            });
+
+    if (!ok)
+    {
+        rest_ = {};
+        is_end_ = true;
+        return *this;
+    }
+
+    // strip the list's 'l' and 'e'
+    auto const& list = !std::empty(path_utf8) ? path_utf8 : path;
+    file_.path.items_ = list.substr(1, std::size(list) - 2);
+    file_.length = length.value_or(0);
+    return *this;
+}
+
+/***
+****
+***/
+
+std::optional<tr_metainfo_view> tr_metainfo_view::parse(std::string_view benc)
+{
+    auto view = tr_metainfo_view{};
+    view.benc_ = benc;
+
+    auto comment = std::optional<std::string_view>{};
+    auto comment_utf8 = std::optional<std::string_view>{};
+    auto creator = std::optional<std::string_view>{};
+    auto creator_utf8 = std::optional<std::string_view>{};
+    auto announce = std::optional<std::string_view>{};
+    auto source = std::optional<std::string_view>{};
+    auto date_created = std::optional<int64_t>{};
+    auto is_private = std::optional<int64_t>{};
+
+    auto const ok = readDict(
+        benc,
+        [&](std::string_view key, std::string_view& walk)
+        {
+            if (key == "info"sv)
+            {
+                if (!std::empty(view.info_dict_) || !peek(walk, 'd'))
+                {
+                    return skipValue(walk);
+                }
+
+                auto const* const begin = std::data(walk);
+                if (!view.parseInfoDict(walk))
+                {
+                    return false;
+                }
+
+                view.info_dict_ = std::string_view{ begin, size_t(std::data(walk) - begin) };
+                return true;
+            }
+
+            if (key == "magnet-info"sv)
+            {
+                if (!peek(walk, 'd'))
+                {
+                    return skipValue(walk);
+                }
+
+                auto info_hash = std::optional<std::string_view>{};
+                auto display_name = std::optional<std::string_view>{};
+                auto const magnet_ok = readDict(
+                    walk,
+                    [&info_hash, &display_name](std::string_view magnet_key, std::string_view& magnet_walk)
+                    {
+                        if (magnet_key == "info_hash"sv)
+                        {
+                            return readStrInto(magnet_walk, info_hash);
+                        }
+
+                        if (magnet_key == "display-name"sv)
+                        {
+                            return readStrInto(magnet_walk, display_name);
+                        }
+
+                        return skipValue(magnet_walk);
+                    });
+
+                view.has_magnet_info_ = true;
+                view.magnet_info_hash_ = info_hash.value_or(std::string_view{});
+                view.display_name_ = display_name.value_or(std::string_view{});
+                return magnet_ok;
+            }
+
+            if (key == "announce"sv)
+            {
+                return readStrInto(walk, announce);
+            }
+
+            if (key == "announce-list"sv)
+            {
+                return peek(walk, 'l') ? readSpanInto(walk, view.announce_list_) : skipValue(walk);
+            }
+
+            if (key == "url-list"sv)
+            {
+                // either a list of urls or a single url
+                return peek(walk, 'l') || peekStr(walk) ? readSpanInto(walk, view.url_list_) : skipValue(walk);
+            }
+
+            if (key == "comment"sv)
+            {
+                return readStrInto(walk, comment);
+            }
+
+            if (key == "comment.utf-8"sv)
+            {
+                return readStrInto(walk, comment_utf8);
+            }
+
+            if (key == "created by"sv)
+            {
+                return readStrInto(walk, creator);
+            }
+
+            if (key == "created by.utf-8"sv)
+            {
+                return readStrInto(walk, creator_utf8);
+            }
+
+            if (key == "creation date"sv)
+            {
+                return readIntInto(walk, date_created);
+            }
+
+            if (key == "private"sv)
+            {
+                return readIntInto(walk, is_private);
+            }
+
+            if (key == "source"sv)
+            {
+                return readStrInto(walk, source);
+            }
+
+            return skipValue(walk);
+        });
+
+    if (!ok)
+    {
+        return {};
+    }
+
+    view.comment_ = comment_utf8 ? *comment_utf8 : comment.value_or(std::string_view{});
+    view.creator_ = creator_utf8 ? *creator_utf8 : creator.value_or(std::string_view{});
+    view.announce_ = announce.value_or(std::string_view{});
+    view.date_created_ = date_created.value_or(0);
+
+    // the info dict's values take precedence
+    if (!view.source_)
+    {
+        view.source_ = source;
+    }
+
+    if (!view.is_private_ && is_private)
+    {
+        view.is_private_ = *is_private != 0;
+    }
+
+    return view;
+}
+
+bool tr_metainfo_view::parseInfoDict(std::string_view& benc)
+{
+    auto name = std::optional<std::string_view>{};
+    auto name_utf8 = std::optional<std::string_view>{};
+    auto pieces = std::optional<std::string_view>{};
+    auto source = std::optional<std::string_view>{};
+    auto length = std::optional<int64_t>{};
+    auto piece_size = std::optional<int64_t>{};
+    auto is_private = std::optional<int64_t>{};
+
+    auto const ok = readDict(
+        benc,
+        [&](std::string_view key, std::string_view& walk)
+        {
+            if (key == "files"sv)
+            {
+                if (has_files_ || !peek(walk, 'l'))
+                {
+                    return skipValue(walk);
+                }
+
+                has_files_ = true;
+                return parseFiles(walk);
+            }
+
+            if (key == "length"sv)
+            {
+                return readIntInto(walk, length);
+            }
+
+            if (key == "name"sv)
+            {
+                return readStrInto(walk, name);
+            }
+
+            if (key == "name.utf-8"sv)
+            {
+                return readStrInto(walk, name_utf8);
+            }
+
+            if (key == "piece length"sv)
+            {
+                return readIntInto(walk, piece_size);
+            }
+
+            if (key == "pieces"sv)
+            {
+                return readStrInto(walk, pieces);
+            }
+
+            if (key == "private"sv)
+            {
+                return readIntInto(walk, is_private);
+            }
+
+            if (key == "source"sv)
+            {
+                return readStrInto(walk, source);
+            }
+
+            return skipValue(walk);
+        });
+
+    name_ = name_utf8 ? *name_utf8 : name.value_or(std::string_view{});
+    pieces_ = pieces.value_or(std::string_view{});
+    source_ = source;
+    length_ = length;
+    piece_size_ = piece_size.value_or(0);
+    if (is_private)
+    {
+        is_private_ = *is_private != 0;
+    }
+    return ok;
+}
+
+// Checks each entry in the "files" list and sums their lengths,
+// so that iterating them later can't fail.
+bool tr_metainfo_view::parseFiles(std::string_view& benc)
+{
+    auto const* const begin = std::data(benc) + 1; // past the 'l'
+
+    auto const ok = readList(
+        benc,
+        [this](std::string_view& walk)
+        {
+            if (!peek(walk, 'd'))
+            {
+                files_error_ = files_error_ != nullptr ? files_error_ : "files";
+                return skipValue(walk);
+            }
+
+            // a path is a list of strings. "path.utf-8" is used if it's there.
+            auto path_ok = std::optional<bool>{};
+            auto path_utf8_ok = std::optional<bool>{};
+            auto length = std::optional<int64_t>{};
+
+            auto const file_ok = readDict(
+                walk,
+                [&](std::string_view key, std::string_view& file_walk)
+                {
+                    if (key == "length"sv)
+                    {
+                        return readIntInto(file_walk, length);
+                    }
+
+                    auto const is_path = key == "path"sv;
+                    auto const is_path_utf8 = key == "path.utf-8"sv;
+                    if ((!is_path && !is_path_utf8) || !peek(file_walk, 'l'))
+                    {
+                        return skipValue(file_walk);
+                    }
+
+                    // the first list of each kind is the one that's used
+                    auto& setme = is_path ? path_ok : path_utf8_ok;
+                    auto all_strings = true;
+                    auto const list_ok = readList(
+                        file_walk,
+                        [&all_strings](std::string_view& component_walk)
+                        {
+                            if (peekStr(component_walk))
+                            {
+                                return readStr(component_walk).has_value();
+                            }
+
+                            all_strings = false;
+                            return skipValue(component_walk);
+                        });
+
+                    if (!setme)
+                    {
+                        setme = all_strings;
+                    }
+
+                    return list_ok;
+                });
+
+            if (!file_ok)
+            {
+                return false;
+            }
+
+            if (files_error_ == nullptr)
+            {
+                if (!path_utf8_ok.value_or(path_ok.value_or(false)))
+                {
+                    files_error_ = "path";
+                }
+                else if (!length)
+                {
+                    files_error_ = "length";
+                }
+            }
+
+            ++file_count_;
+            total_size_ += length.value_or(0);
+            return true;
+        });
+
+    files_ = ok ? std::string_view{ begin, size_t(std::data(benc) - 1 - begin) } : std::string_view{};
+    return ok;
+}
+
+/***
+****
+***/
+
+std::optional<tr_sha1_digest_t> tr_metainfo_view::infoHash() const
+{
+    auto hash = tr_sha1_digest_t{};
+
+    if (!std::empty(info_dict_))
+    {
+        tr_sha1(reinterpret_cast<uint8_t*>(std::data(hash)), std::data(info_dict_), int(std::size(info_dict_)), nullptr);
+        return hash;
+    }
+
+    if (std::size(magnet_info_hash_) == std::size(hash))
+    {
+        std::copy_n(reinterpret_cast<std::byte const*>(std::data(magnet_info_hash_)), std::size(hash), std::data(hash));
+        return hash;
+    }
+
+    return {};
+}
+
+tr_sha1_digest_t tr_metainfo_view::pieceHash(size_t piece) const
+{
+    TR_ASSERT(piece < pieceCount());
+
+    auto hash = tr_sha1_digest_t{};
+    std::memcpy(std::data(hash), std::data(pieces_) + piece * std::size(hash), std::size(hash));
+    return hash;
+}
+
+std::vector<tr_metainfo_view::Tracker> tr_metainfo_view::announceList() const
+{
+    auto ret = std::vector<Tracker>{};
+    auto benc = announce_list_;
+    auto tier = size_t{};
+
+    (void)readList(
+        benc,
+        [&ret, &tier](std::string_view& walk)
+        {
+            if (!peek(walk, 'l'))
+            {
+                ++tier;
+                return skipValue(walk);
+            }
+
+            auto const ok = readList(
+                walk,
+                [&ret, tier](std::string_view& tier_walk)
+                {
+                    if (!peekStr(tier_walk))
+                    {
+                        return skipValue(tier_walk);
+                    }
+
+                    auto const url = readStr(tier_walk);
+                    if (url)
+                    {
+                        ret.push_back({ tier, *url });
+                    }
+                    return url.has_value();
+                });
+
+            ++tier;
+            return ok;
+        });
+
+    return ret;
+}
+
+std::vector<std::string_view> tr_metainfo_view::urlList() const
+{
+    auto ret = std::vector<std::string_view>{};
+    auto benc = url_list_;
+
+    if (peekStr(benc))
+    {
+        ret.push_back(*readStr(benc));
+        return ret;
+    }
+
+    (void)readList(
+        benc,
+        [&ret](std::string_view& walk)
+        {
+            if (!peekStr(walk))
+            {
+                return skipValue(walk);
+            }
+
+            auto const url = readStr(walk);
+            if (url)
+            {
+                ret.push_back(*url);
+            }
+            return url.has_value();
+        });
+
+    return ret;
+}
@@ -0,0 +1,292 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // int64_t
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h"
+
+/**
+ * A read-only view of a bencoded .torrent that doesn't build a tr_variant
+ * or copy anything out of it.
+ *
+ * parse() makes a single pass over the text, checking its structure and
+ * remembering where the interesting values are. The file list is walked
+ * again only when it's iterated, and nothing is hashed until it's asked for.
+ *
+ * Every string_view returned points into the parsed text,
+ * so the text must outlive the view.
+ */
+class tr_metainfo_view
+{
+public:
+    // the components of a file's path, unsanitized
+    class Path
+    {
+    public:
+        class Iterator
+        {
+        public:
+            [[nodiscard]] std::string_view operator*() const
+            {
+                return component_;
+            }
+
+            Iterator& operator++();
+
+            [[nodiscard]] bool operator==(Iterator const& that) const
+            {
+                return std::data(rest_) == std::data(that.rest_) && std::data(component_) == std::data(that.component_);
+            }
+
+            [[nodiscard]] bool operator!=(Iterator const& that) const
+            {
+                return !(*this == that);
+            }
+
+        private:
+            friend class Path;
+
+            explicit Iterator(std::string_view items);
+
+            std::string_view rest_;
+            std::string_view component_;
+        };
+
+        [[nodiscard]] Iterator begin() const
+        {
+            return Iterator{ items_ };
+        }
+
+        [[nodiscard]] Iterator end() const
+        {
+            return Iterator{ {} };
+        }
+
+    private:
+        friend class tr_metainfo_view;
+
+        // the bencoded strings between a list's 'l' and 'e'
+        std::string_view items_;
+    };
+
+    struct File
+    {
+        Path path;
+        int64_t length = 0;
+    };
+
+    class FileIterator
+    {
+    public:
+        [[nodiscard]] File const& operator*() const
+        {
+            return file_;
+        }
+
+        [[nodiscard]] File const* operator->() const
+        {
+            return &file_;
+        }
+
+        FileIterator& operator++();
+
+        [[nodiscard]] bool operator==(FileIterator const& that) const
+        {
+            return std::data(rest_) == std::data(that.rest_) && is_end_ == that.is_end_;
+        }
+
+        [[nodiscard]] bool operator!=(FileIterator const& that) const
+        {
+            return !(*this == that);
+        }
+
+    private:
+        friend class tr_metainfo_view;
+
+        FileIterator(std::string_view rest, bool is_end);
+
+        std::string_view rest_;
+        bool is_end_ = true;
+        File file_;
+    };
+
+    struct Tracker
+    {
+        size_t tier; // its list's index in "announce-list"
+        std::string_view announce;
+    };
+
+    // Returns nothing if `benc` isn't a well-formed bencoded dict.
+    // Missing keys aren't errors here; that's for the caller to decide.
+    [[nodiscard]] static std::optional<tr_metainfo_view> parse(std::string_view benc);
+
+    // the bencoded "info" dict, or an empty view if there isn't one
+    [[nodiscard]] std::string_view infoDict() const
+    {
+        return info_dict_;
+    }
+
+    [[nodiscard]] size_t infoDictOffset() const
+    {
+        return std::data(info_dict_) - std::data(benc_);
+    }
+
+    // the SHA1 of the info dict, or a magnet's "info_hash"
+    [[nodiscard]] std::optional<tr_sha1_digest_t> infoHash() const;
+
+    // true if there's no info dict but there is a "magnet-info" dict
+    [[nodiscard]] bool isMagnet() const
+    {
+        return std::empty(info_dict_) && has_magnet_info_;
+    }
+
+    [[nodiscard]] std::string_view displayName() const
+    {
+        return display_name_;
+    }
+
+    // "name.utf-8" if it's present, else "name"
+    [[nodiscard]] std::string_view name() const
+    {
+        return name_;
+    }
+
+    [[nodiscard]] std::string_view comment() const
+    {
+        return comment_;
+    }
+
+    [[nodiscard]] std::string_view creator() const
+    {
+        return creator_;
+    }
+
+    // the info dict's "source" if it's present, else the top-level one
+    [[nodiscard]] std::string_view source() const
+    {
+        return source_.value_or(std::string_view{});
+    }
+
+    [[nodiscard]] int64_t dateCreated() const
+    {
+        return date_created_;
+    }
+
+    // the info dict's "private" flag if it's present, else the top-level one
+    [[nodiscard]] bool isPrivate() const
+    {
+        return is_private_.value_or(false);
+    }
+
+    [[nodiscard]] int64_t pieceSize() const
+    {
+        return piece_size_;
+    }
+
+    // the concatenated piece hashes
+    [[nodiscard]] std::string_view pieces() const
+    {
+        return pieces_;
+    }
+
+    [[nodiscard]] size_t pieceCount() const
+    {
+        return std::size(pieces_) / TR_SHA1_DIGEST_LEN;
+    }
+
+    [[nodiscard]] tr_sha1_digest_t pieceHash(size_t piece) const;
+
+    // true if the info dict has a "files" list
+    [[nodiscard]] bool isFolder() const
+    {
+        return has_files_;
+    }
+
+    // in single-file torrents, the info dict's "length"
+    [[nodiscard]] std::optional<int64_t> length() const
+    {
+        return length_;
+    }
+
+    // nullptr if every entry in "files" has a path and a length,
+    // or else the key that's missing or malformed
+    [[nodiscard]] char const* filesError() const
+    {
+        return files_error_;
+    }
+
+    [[nodiscard]] size_t fileCount() const
+    {
+        return file_count_;
+    }
+
+    [[nodiscard]] int64_t totalSize() const
+    {
+        return total_size_;
+    }
+
+    [[nodiscard]] FileIterator filesBegin() const
+    {
+        return FileIterator{ files_, files_error_ != nullptr || file_count_ == 0 };
+    }
+
+    [[nodiscard]] FileIterator filesEnd() const
+    {
+        return FileIterator{ {}, true };
+    }
+
+    [[nodiscard]] std::string_view announce() const
+    {
+        return announce_;
+    }
+
+    // the strings in "announce-list"'s lists, in order
+    [[nodiscard]] std::vector<Tracker> announceList() const;
+
+    // the strings in "url-list", which can be a list or a single string
+    [[nodiscard]] std::vector<std::string_view> urlList() const;
+
+private:
+    tr_metainfo_view() = default;
+
+    bool parseInfoDict(std::string_view& benc);
+    bool parseFiles(std::string_view& benc);
+
+    std::string_view benc_;
+    std::string_view info_dict_;
+    std::string_view name_;
+    std::string_view comment_;
+    std::string_view creator_;
+    std::string_view pieces_;
+    std::string_view files_; // the bencoded "files" list's contents
+    std::string_view announce_;
+    std::string_view announce_list_; // the bencoded "announce-list"
+    std::string_view url_list_; // the bencoded "url-list"
+    std::string_view magnet_info_hash_;
+    std::string_view display_name_;
+    std::optional<std::string_view> source_;
+    std::optional<int64_t> length_;
+    std::optional<bool> is_private_;
+    int64_t date_created_ = 0;
+    int64_t piece_size_ = 0;
+    int64_t total_size_ = 0;
+    size_t file_count_ = 0;
+    char const* files_error_ = nullptr;
+    bool has_files_ = false;
+    bool has_magnet_info_ = false;
+};
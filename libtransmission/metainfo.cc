@@ -20,6 +20,7 @@
 #include "error-types.h"
 #include "file.h"
 #include "log.h"
+#include "metainfo-view.h"
 #include "metainfo.h"
 #include "platform.h" /* tr_getTorrentDir() */
 #include "session.h"
@@ -111,58 +112,44 @@ bool tr_metainfoAppendSanitizedPathComponent(std::string& out, std::string_view
     return std::size(out) > original_out_len;
 }
 
-static bool getfile(char** setme, bool* is_adjusted, std::string_view root, tr_variant* path, std::string& buf)
+static bool getfile(
+    char** setme,
+    bool* is_adjusted,
+    std::string_view root,
+    tr_metainfo_view::Path const& path,
+    std::string& buf)
 {
-    bool success = false;
-
     *setme = nullptr;
     *is_adjusted = false;
 
-    if (tr_variantIsList(path))
-    {
-        success = true;
-
-        buf = root;
+    buf = root;
 
-        for (int i = 0, n = tr_variantListSize(path); i < n; i++)
+    for (auto const raw : path)
+    {
+        auto is_component_adjusted = bool{};
+        auto const pos = std::size(buf);
+        if (!tr_metainfoAppendSanitizedPathComponent(buf, raw, &is_component_adjusted))
         {
-            auto raw = std::string_view{};
-            if (!tr_variantGetStrView(tr_variantListChild(path, i), &raw))
-            {
-                success = false;
-                break;
-            }
-
-            auto is_component_adjusted = bool{};
-            auto const pos = std::size(buf);
-            if (!tr_metainfoAppendSanitizedPathComponent(buf, raw, &is_component_adjusted))
-            {
-                continue;
-            }
-
-            buf.insert(std::begin(buf) + pos, TR_PATH_DELIMITER);
-
-            *is_adjusted |= is_component_adjusted;
+            continue;
         }
-    }
 
-    if (success && std::size(buf) <= std::size(root))
-    {
-        success = false;
+        buf.insert(std::begin(buf) + pos, TR_PATH_DELIMITER);
+
+        *is_adjusted |= is_component_adjusted;
     }
 
-    if (success)
+    if (std::size(buf) <= std::size(root))
     {
-        *setme = tr_utf8clean(buf);
-        *is_adjusted |= buf != *setme;
+        return false;
     }
 
-    return success;
+    *setme = tr_utf8clean(buf);
+    *is_adjusted |= buf != *setme;
+    return true;
 }
 
-static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const* length)
+static char const* parseFiles(tr_info* inf, tr_metainfo_view const& view)
 {
-    int64_t len = 0;
     inf->totalSize = 0;
 
     bool is_root_adjusted = false;
@@ -172,68 +159,48 @@ static char const* parseFiles(tr_info* inf, tr_variant* files, tr_variant const*
         return "path";
     }
 
-    char const* errstr = nullptr;
-
-    if (tr_variantIsList(files)) /* multi-file mode */
+    if (view.isFolder()) /* multi-file mode */
     {
-        auto buf = std::string{};
-        errstr = nullptr;
+        if (auto const* const errstr = view.filesError(); errstr != nullptr)
+        {
+            return errstr;
+        }
 
         inf->isFolder = true;
-        inf->fileCount = tr_variantListSize(files);
+        inf->fileCount = view.fileCount();
         inf->files = tr_new0(tr_file, inf->fileCount);
 
-        for (tr_file_index_t i = 0; i < inf->fileCount; i++)
+        auto buf = std::string{};
+        auto i = tr_file_index_t{ 0 };
+        for (auto it = view.filesBegin(), end = view.filesEnd(); it != end; ++it, ++i)
         {
-            auto* const file = tr_variantListChild(files, i);
-
-            if (!tr_variantIsDict(file))
-            {
-                errstr = "files";
-                break;
-            }
-
-            tr_variant* path = nullptr;
-            if (!tr_variantDictFindList(file, TR_KEY_path_utf_8, &path) && !tr_variantDictFindList(file, TR_KEY_path, &path))
-            {
-                errstr = "path";
-                break;
-            }
-
             bool is_file_adjusted = false;
-            if (!getfile(&inf->files[i].name, &is_file_adjusted, root_name, path, buf))
-            {
-                errstr = "path";
-                break;
-            }
-
-            if (!tr_variantDictFindInt(file, TR_KEY_length, &len))
+            if (!getfile(&inf->files[i].name, &is_file_adjusted, root_name, it->path, buf))
             {
-                errstr = "length";
-                break;
+                return "path";
             }
 
-            inf->files[i].length = len;
+            inf->files[i].length = it->length;
             inf->files[i].priv.is_renamed = is_root_adjusted || is_file_adjusted;
-            inf->totalSize += len;
+            inf->totalSize += it->length;
         }
     }
-    else if (tr_variantGetInt(length, &len)) /* single-file mode */
+    else if (auto const len = view.length(); len) /* single-file mode */
     {
         inf->isFolder = false;
         inf->fileCount = 1;
         inf->files = tr_new0(tr_file, 1);
         inf->files[0].name = tr_strndup(root_name.c_str(), std::size(root_name));
-        inf->files[0].length = len;
+        inf->files[0].length = *len;
         inf->files[0].priv.is_renamed = is_root_adjusted;
-        inf->totalSize += len;
+        inf->totalSize += *len;
     }
     else
     {
-        errstr = "length";
+        return "length";
     }
 
-    return errstr;
+    return nullptr;
 }
 
 static char* tr_convertAnnounceToScrape(std::string_view url)
@@ -272,57 +239,40 @@ static char* tr_convertAnnounceToScrape(std::string_view url)
     return scrape;
 }
 
-static char const* getannounce(tr_info* inf, tr_variant* meta)
+static char const* getannounce(tr_info* inf, tr_metainfo_view const& view)
 {
     tr_tracker_info* trackers = nullptr;
     int trackerCount = 0;
-    auto url = std::string_view{};
 
     /* Announce-list */
-    tr_variant* tiers = nullptr;
-    if (tr_variantDictFindList(meta, TR_KEY_announce_list, &tiers))
+    if (auto const announce_list = view.announceList(); !std::empty(announce_list))
     {
-        int const numTiers = tr_variantListSize(tiers);
-        int n = 0;
-
-        for (int i = 0; i < numTiers; i++)
-        {
-            n += tr_variantListSize(tr_variantListChild(tiers, i));
-        }
-
-        trackers = tr_new0(tr_tracker_info, n);
+        trackers = tr_new0(tr_tracker_info, std::size(announce_list));
 
+        // number the tiers that have at least one valid tracker
         int validTiers = 0;
-        for (int i = 0; i < numTiers; ++i)
+        auto prev_tier = std::optional<size_t>{};
+        for (auto const& tracker : announce_list)
         {
-            tr_variant* tier = tr_variantListChild(tiers, i);
-            int const tierSize = tr_variantListSize(tier);
-            bool anyAdded = false;
-
-            for (int j = 0; j < tierSize; j++)
+            auto const url = tr_strvStrip(tracker.announce);
+            if (!tr_urlIsValidTracker(url))
             {
-                if (tr_variantGetStrView(tr_variantListChild(tier, j), &url))
-                {
-                    url = tr_strvStrip(url);
-
-                    if (tr_urlIsValidTracker(url))
-                    {
-                        tr_tracker_info* t = trackers + trackerCount;
-                        t->tier = validTiers;
-                        t->announce = tr_strvDup(url);
-                        t->scrape = tr_convertAnnounceToScrape(url);
-                        t->id = trackerCount;
-
-                        anyAdded = true;
-                        ++trackerCount;
-                    }
-                }
+                continue;
             }
 
-            if (anyAdded)
+            if (prev_tier && *prev_tier != tracker.tier)
             {
                 ++validTiers;
             }
+
+            prev_tier = tracker.tier;
+
+            tr_tracker_info* t = trackers + trackerCount;
+            t->tier = validTiers;
+            t->announce = tr_strvDup(url);
+            t->scrape = tr_convertAnnounceToScrape(url);
+            t->id = trackerCount;
+            ++trackerCount;
         }
 
         /* did we use any of the tiers? */
@@ -334,19 +284,14 @@ static char const* getannounce(tr_info* inf, tr_variant* meta)
     }
 
     /* Regular announce value */
-    if (trackerCount == 0 && tr_variantDictFindStrView(meta, TR_KEY_announce, &url))
-    {
-        url = tr_strvStrip(url);
-
-        if (tr_urlIsValidTracker(url))
-        {
-            trackers = tr_new0(tr_tracker_info, 1);
-            trackers[trackerCount].tier = 0;
-            trackers[trackerCount].announce = tr_strvDup(url);
-            trackers[trackerCount].scrape = tr_convertAnnounceToScrape(url);
-            trackers[trackerCount].id = 0;
-            trackerCount++;
-        }
+    if (auto const url = tr_strvStrip(view.announce()); trackerCount == 0 && tr_urlIsValidTracker(url))
+    {
+        trackers = tr_new0(tr_tracker_info, 1);
+        trackers[trackerCount].tier = 0;
+        trackers[trackerCount].announce = tr_strvDup(url);
+        trackers[trackerCount].scrape = tr_convertAnnounceToScrape(url);
+        trackers[trackerCount].id = 0;
+        trackerCount++;
     }
 
     inf->trackers = trackers;
@@ -383,38 +328,23 @@ static char* fix_webseed_url(tr_info const* inf, std::string_view url)
     return tr_strvDup(url);
 }
 
-static void geturllist(tr_info* inf, tr_variant* meta)
+static void geturllist(tr_info* inf, tr_metainfo_view const& view)
 {
-    tr_variant* urls = nullptr;
-    auto url = std::string_view{};
-
-    if (tr_variantDictFindList(meta, TR_KEY_url_list, &urls))
+    auto const urls = view.urlList();
+    if (std::empty(urls))
     {
-        int const n = tr_variantListSize(urls);
+        return;
+    }
 
-        inf->webseedCount = 0;
-        inf->webseeds = tr_new0(char*, n);
+    inf->webseedCount = 0;
+    inf->webseeds = tr_new0(char*, std::size(urls));
 
-        for (int i = 0; i < n; i++)
-        {
-            if (tr_variantGetStrView(tr_variantListChild(urls, i), &url))
-            {
-                char* const fixed_url = fix_webseed_url(inf, url);
-                if (fixed_url != nullptr)
-                {
-                    inf->webseeds[inf->webseedCount++] = fixed_url;
-                }
-            }
-        }
-    }
-    else if (tr_variantDictFindStrView(meta, TR_KEY_url_list, &url)) /* handle single items in webseeds */
+    for (auto const url : urls)
     {
         char* const fixed_url = fix_webseed_url(inf, url);
         if (fixed_url != nullptr)
         {
-            inf->webseedCount = 1;
-            inf->webseeds = tr_new0(char*, 1);
-            inf->webseeds[0] = fixed_url;
+            inf->webseeds[inf->webseedCount++] = fixed_url;
         }
     }
 }
@@ -424,158 +354,98 @@ static char const* tr_metainfoParseImpl(
     tr_info* inf,
     std::vector<tr_sha1_digest_t>* pieces,
     uint64_t* infoDictLength,
-    tr_variant const* meta_in)
+    std::string_view benc,
+    std::string_view default_name)
 {
-    int64_t i = 0;
-    auto sv = std::string_view{};
-    tr_variant* const meta = const_cast<tr_variant*>(meta_in);
-    bool isMagnet = false;
+    auto const view = tr_metainfo_view::parse(benc);
+    if (!view)
+    {
+        return "metainfo";
+    }
 
     /* info_hash: urlencoded 20-byte SHA1 hash of the value of the info key
      * from the Metainfo file. Note that the value will be a bencoded
      * dictionary, given the definition of the info key above. */
-    tr_variant* infoDict = nullptr;
-    if (bool b = tr_variantDictFindDict(meta, TR_KEY_info, &infoDict); !b)
+    auto const is_magnet = view->isMagnet();
+    if (!is_magnet && std::empty(view->infoDict()))
     {
-        /* no info dictionary... is this a magnet link? */
-        if (tr_variant* d = nullptr; tr_variantDictFindDict(meta, TR_KEY_magnet_info, &d))
-        {
-            isMagnet = true;
-
-            // get the info-hash
-            if (!tr_variantDictFindStrView(d, TR_KEY_info_hash, &sv))
-            {
-                return "info_hash";
-            }
-
-            if (std::size(sv) != SHA_DIGEST_LENGTH)
-            {
-                return "info_hash";
-            }
-
-            std::copy(std::begin(sv), std::end(sv), inf->hash);
-            tr_sha1_to_hex(inf->hashString, inf->hash);
-
-            // maybe get the display name
-            if (tr_variantDictFindStrView(d, TR_KEY_display_name, &sv))
-            {
-                tr_free(inf->name);
-                tr_free(inf->originalName);
-                inf->name = tr_strvDup(sv);
-                inf->originalName = tr_strvDup(sv);
-            }
-
-            if (inf->name == nullptr)
-            {
-                inf->name = tr_strdup(inf->hashString);
-            }
-
-            if (inf->originalName == nullptr)
-            {
-                inf->originalName = tr_strdup(inf->hashString);
-            }
-        }
-        else // not a magnet link and has no info dict...
-        {
-            return "info";
-        }
+        // not a magnet link and has no info dict...
+        return "info";
     }
-    else
+
+    auto const hash = view->infoHash();
+    if (!hash)
     {
-        size_t blen = 0;
-        char* bstr = tr_variantToStr(infoDict, TR_VARIANT_FMT_BENC, &blen);
-        tr_sha1(inf->hash, bstr, (int)blen, nullptr);
-        tr_sha1_to_hex(inf->hashString, inf->hash);
+        return "info_hash";
+    }
 
-        if (infoDictLength != nullptr)
-        {
-            *infoDictLength = blen;
-        }
+    std::copy_n(reinterpret_cast<uint8_t const*>(std::data(*hash)), std::size(*hash), inf->hash);
+    tr_sha1_to_hex(inf->hashString, inf->hash);
 
-        tr_free(bstr);
+    if (infoDictLength != nullptr && !is_magnet)
+    {
+        *infoDictLength = std::size(view->infoDict());
     }
 
     /* name */
-    if (!isMagnet)
-    {
-        if (!tr_variantDictFindStrView(infoDict, TR_KEY_name_utf_8, &sv) &&
-            !tr_variantDictFindStrView(infoDict, TR_KEY_name, &sv))
-        {
-            sv = ""sv;
-        }
+    tr_free(inf->name);
+    tr_free(inf->originalName);
 
-        if (std::empty(sv))
+    if (is_magnet)
+    {
+        // maybe get the display name
+        auto const display_name = view->displayName();
+        inf->name = tr_strvDup(!std::empty(display_name) ? display_name : inf->hashString);
+        inf->originalName = tr_strdup(inf->name);
+    }
+    else
+    {
+        auto const name = !std::empty(view->name()) ? view->name() : default_name;
+        if (std::empty(name))
         {
+            inf->name = nullptr;
+            inf->originalName = nullptr;
             return "name";
         }
 
-        tr_free(inf->name);
-        tr_free(inf->originalName);
-        inf->name = tr_utf8clean(sv);
+        inf->name = tr_utf8clean(name);
         inf->originalName = tr_strdup(inf->name);
     }
 
     /* comment */
-    if (!tr_variantDictFindStrView(meta, TR_KEY_comment_utf_8, &sv) && !tr_variantDictFindStrView(meta, TR_KEY_comment, &sv))
-    {
-        sv = ""sv;
-    }
-
     tr_free(inf->comment);
-    inf->comment = tr_utf8clean(sv);
+    inf->comment = tr_utf8clean(view->comment());
 
     /* created by */
-    if (!tr_variantDictFindStrView(meta, TR_KEY_created_by_utf_8, &sv) &&
-        !tr_variantDictFindStrView(meta, TR_KEY_created_by, &sv))
-    {
-        sv = ""sv;
-    }
-
     tr_free(inf->creator);
-    inf->creator = tr_utf8clean(sv);
+    inf->creator = tr_utf8clean(view->creator());
 
     /* creation date */
-    i = 0;
-    (void)!tr_variantDictFindInt(meta, TR_KEY_creation_date, &i);
-    inf->dateCreated = i;
+    inf->dateCreated = view->dateCreated();
 
     /* private */
-    if (!tr_variantDictFindInt(infoDict, TR_KEY_private, &i) && !tr_variantDictFindInt(meta, TR_KEY_private, &i))
-    {
-        i = 0;
-    }
-
-    inf->isPrivate = i != 0;
+    inf->isPrivate = view->isPrivate();
 
     /* source */
-    if (!tr_variantDictFindStrView(infoDict, TR_KEY_source, &sv) && !tr_variantDictFindStrView(meta, TR_KEY_source, &sv))
-    {
-        sv = ""sv;
-    }
-
     tr_free(inf->source);
-    inf->source = tr_utf8clean(sv);
+    inf->source = tr_utf8clean(view->source());
 
     /* piece length */
-    if (!isMagnet)
+    if (!is_magnet)
     {
-        if (!tr_variantDictFindInt(infoDict, TR_KEY_piece_length, &i) || (i < 1))
+        if (view->pieceSize() < 1)
         {
             return "piece length";
         }
 
-        inf->pieceSize = i;
+        inf->pieceSize = view->pieceSize();
     }
 
     /* pieces and files */
-    if (!isMagnet)
+    if (!is_magnet)
     {
-        if (!tr_variantDictFindStrView(infoDict, TR_KEY_pieces, &sv))
-        {
-            return "pieces";
-        }
-
-        if (std::size(sv) % SHA_DIGEST_LENGTH != 0)
+        auto const sv = view->pieces();
+        if (std::empty(sv) || std::size(sv) % SHA_DIGEST_LENGTH != 0)
         {
             return "pieces";
         }
@@ -583,12 +453,9 @@ static char const* tr_metainfoParseImpl(
         auto const n_pieces = std::size(sv) / SHA_DIGEST_LENGTH;
         inf->pieceCount = n_pieces;
         pieces->resize(n_pieces);
-        std::copy_n(std::data(sv), std::size(sv), reinterpret_cast<uint8_t*>(std::data(*pieces)));
+        std::copy_n(std::data(sv), std::size(sv), reinterpret_cast<char*>(std::data(*pieces)));
 
-        auto const* const errstr = parseFiles(
-            inf,
-            tr_variantDictFind(infoDict, TR_KEY_files),
-            tr_variantDictFind(infoDict, TR_KEY_length));
+        auto const* const errstr = parseFiles(inf, *view);
         if (errstr != nullptr)
         {
             return errstr;
@@ -606,14 +473,14 @@ static char const* tr_metainfoParseImpl(
     }
 
     /* get announce or announce-list */
-    auto const* const errstr = getannounce(inf, meta);
+    auto const* const errstr = getannounce(inf, *view);
     if (errstr != nullptr)
     {
         return errstr;
     }
 
     /* get the url-list */
-    geturllist(inf, meta);
+    geturllist(inf, *view);
 
     /* filename of Transmission's copy */
     tr_free(inf->torrent);
@@ -622,11 +489,21 @@ static char const* tr_metainfoParseImpl(
     return nullptr;
 }
 
-std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr_variant const* meta_in, tr_error** error)
+std::optional<tr_metainfo_parsed> tr_metainfoParse(
+    tr_session const* session,
+    std::string_view benc,
+    tr_error** error,
+    std::string_view default_name)
 {
     auto out = tr_metainfo_parsed{};
 
-    char const* bad_tag = tr_metainfoParseImpl(session, &out.info, &out.pieces, &out.info_dict_length, meta_in);
+    char const* bad_tag = tr_metainfoParseImpl(
+        session,
+        &out.info,
+        &out.pieces,
+        &out.info_dict_length,
+        benc,
+        default_name);
     if (bad_tag != nullptr)
     {
         tr_error_set(error, TR_ERROR_EINVAL, _("Error parsing metainfo: %s"), bad_tag);
@@ -637,6 +514,15 @@ std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr
     return std::optional<tr_metainfo_parsed>{ std::move(out) };
 }
 
+std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr_variant const* meta_in, tr_error** error)
+{
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(meta_in, TR_VARIANT_FMT_BENC, &len);
+    auto ret = tr_metainfoParse(session, std::string_view{ benc, len }, error);
+    tr_free(benc);
+    return ret;
+}
+
 void tr_metainfoFree(tr_info* inf)
 {
     for (unsigned int i = 0; i < inf->webseedCount; i++)
@@ -54,6 +54,14 @@ struct tr_metainfo_parsed
     }
 };
 
+// Parses a bencoded .torrent without building a tr_variant of it.
+// `default_name` is used if the info dict doesn't have a name.
+std::optional<tr_metainfo_parsed> tr_metainfoParse(
+    tr_session const* session,
+    std::string_view benc,
+    tr_error** error,
+    std::string_view default_name = {});
+
 std::optional<tr_metainfo_parsed> tr_metainfoParse(tr_session const* session, tr_variant const* variant, tr_error** error);
 
 void tr_metainfoRemoveSaved(tr_session const* session, tr_info const* info);
@@ -0,0 +1,272 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes> // PRIu64
+#include <cstdarg>
+#include <cstdio> // snprintf()
+
+#include <event2/event.h>
+
+#include "transmission.h"
+
+#include "metrics.h"
+#include "quark.h"
+#include "tr-assert.h"
+#include "utils.h" // tr_timerAddMsec()
+#include "variant.h"
+
+using namespace std::literals;
+
+namespace
+{
+
+auto constexpr TimerNames = std::array<std::string_view, static_cast<size_t>(tr_metrics::Timer::N_TIMERS)>{
+    "event-loop-lag"sv, "event-queue-wait"sv, "run-in-event-thread"sv, "bandwidth-pulse"sv, "rechoke-pulse"sv,
+    "atom-pulse"sv,     "queue-pulse"sv,      "announcer-upkeep"sv,    "cache-flush"sv,     "rpc-request"sv,
+};
+
+auto constexpr CounterNames = std::array<std::string_view, static_cast<size_t>(tr_metrics::Counter::N_COUNTERS)>{
+    "bytes-copied"sv, "blocks-cached"sv,    "disk-reads"sv,      "disk-read-bytes"sv,
+    "disk-writes"sv,  "disk-write-bytes"sv, "read-cache-hits"sv, "read-cache-misses"sv,
+    "peer-writes"sv,  "peer-write-bytes"sv,
+};
+
+// "event-loop-lag" -> "transmission_event_loop_lag"
+std::string prometheusName(std::string_view name)
+{
+    auto ret = tr_strvJoin("transmission_"sv, name);
+    std::replace(std::begin(ret), std::end(ret), '-', '_');
+    return ret;
+}
+
+// usec -> "seconds.micros", without going through the locale's decimal point
+std::string formatSeconds(uint64_t usec)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%" PRIu64 ".%06" PRIu64, usec / 1000000, usec % 1000000);
+    return buf;
+}
+
+void appendf(std::string& out, char const* fmt, ...) TR_GNUC_PRINTF(2, 3);
+
+void appendf(std::string& out, char const* fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    auto const len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len > 0)
+    {
+        out.append(buf, std::min(size_t(len), sizeof(buf) - 1));
+    }
+}
+
+} // namespace
+
+tr_metrics::~tr_metrics()
+{
+    stopLagTimer();
+}
+
+uint64_t tr_metrics::nowUsec() noexcept
+{
+    auto const now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+size_t tr_metrics::bucketOf(uint64_t usec) noexcept
+{
+    // the number of bits needed to hold `usec`, so bucket `i` holds [2^(i-1) .. 2^i)
+    auto bits = size_t{ 0 };
+
+    while (usec != 0 && bits < NumBuckets - 1)
+    {
+        usec >>= 1;
+        ++bits;
+    }
+
+    return bits;
+}
+
+void tr_metrics::record(Timer which, uint64_t usec) noexcept
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    auto& h = timers_[static_cast<size_t>(which)];
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.total_usec.fetch_add(usec, std::memory_order_relaxed);
+    h.buckets[bucketOf(usec)].fetch_add(1, std::memory_order_relaxed);
+
+    auto max = h.max_usec.load(std::memory_order_relaxed);
+    while (usec > max && !h.max_usec.compare_exchange_weak(max, usec, std::memory_order_relaxed))
+    {
+    }
+}
+
+tr_metrics::Histogram tr_metrics::get(Timer which) const noexcept
+{
+    auto const& h = timers_[static_cast<size_t>(which)];
+
+    auto ret = Histogram{};
+    ret.count = h.count.load(std::memory_order_relaxed);
+    ret.total_usec = h.total_usec.load(std::memory_order_relaxed);
+    ret.max_usec = h.max_usec.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < NumBuckets; ++i)
+    {
+        ret.buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+void tr_metrics::reset() noexcept
+{
+    for (auto& h : timers_)
+    {
+        h.count = 0;
+        h.total_usec = 0;
+        h.max_usec = 0;
+
+        for (auto& bucket : h.buckets)
+        {
+            bucket = 0;
+        }
+    }
+
+    for (auto& counter : counters_)
+    {
+        counter = 0;
+    }
+}
+
+std::string_view tr_metrics::name(Timer which)
+{
+    return TimerNames[static_cast<size_t>(which)];
+}
+
+std::string_view tr_metrics::name(Counter which)
+{
+    return CounterNames[static_cast<size_t>(which)];
+}
+
+/***
+****  Event loop lag
+***/
+
+void tr_metrics::startLagTimer(struct event_base* base)
+{
+    if (lag_timer_ != nullptr)
+    {
+        return;
+    }
+
+    lag_timer_ = evtimer_new(
+        base,
+        [](evutil_socket_t /*fd*/, short /*what*/, void* vself)
+        {
+            auto* const self = static_cast<tr_metrics*>(vself);
+            auto const now = nowUsec();
+
+            self->record(Timer::EventLoopLag, now > self->lag_timer_due_usec_ ? now - self->lag_timer_due_usec_ : 0);
+
+            self->lag_timer_due_usec_ = now + LagIntervalMsec * 1000;
+            tr_timerAddMsec(self->lag_timer_, LagIntervalMsec);
+        },
+        this);
+
+    lag_timer_due_usec_ = nowUsec() + LagIntervalMsec * 1000;
+    tr_timerAddMsec(lag_timer_, LagIntervalMsec);
+}
+
+void tr_metrics::stopLagTimer()
+{
+    if (lag_timer_ != nullptr)
+    {
+        event_free(lag_timer_);
+        lag_timer_ = nullptr;
+    }
+}
+
+/***
+****  Output
+***/
+
+void tr_metrics::toVariant(tr_variant* setme) const
+{
+    TR_ASSERT(tr_variantIsDict(setme));
+
+    tr_variantDictAddBool(setme, TR_KEY_metrics_enabled, isEnabled());
+
+    auto* const timers = tr_variantDictAddDict(setme, TR_KEY_timers, std::size(TimerNames));
+    for (size_t i = 0; i < std::size(TimerNames); ++i)
+    {
+        auto const h = get(static_cast<Timer>(i));
+        auto* const d = tr_variantDictAddDict(timers, tr_quark_new(TimerNames[i]), 4);
+        tr_variantDictAddInt(d, TR_KEY_count, h.count);
+        tr_variantDictAddInt(d, TR_KEY_total_usec, h.total_usec);
+        tr_variantDictAddInt(d, TR_KEY_max_usec, h.max_usec);
+
+        auto* const buckets = tr_variantDictAddList(d, TR_KEY_buckets, std::size(h.buckets));
+        for (auto const n : h.buckets)
+        {
+            tr_variantListAddInt(buckets, n);
+        }
+    }
+
+    auto* const counters = tr_variantDictAddDict(setme, TR_KEY_counters, std::size(CounterNames));
+    for (size_t i = 0; i < std::size(CounterNames); ++i)
+    {
+        tr_variantDictAddInt(counters, tr_quark_new(CounterNames[i]), get(static_cast<Counter>(i)));
+    }
+}
+
+std::string tr_metrics::toPrometheus() const
+{
+    auto out = std::string{};
+    out.reserve(16384);
+
+    for (size_t i = 0; i < std::size(TimerNames); ++i)
+    {
+        auto const h = get(static_cast<Timer>(i));
+        auto const metric = prometheusName(TimerNames[i]) + "_seconds";
+
+        appendf(out, "# TYPE %s histogram\n", metric.c_str());
+
+        // Prometheus buckets are cumulative and inclusive, so bucket `b`'s
+        // upper bound is the largest value that fits in it: 2^b - 1 usec
+        auto cumulative = uint64_t{ 0 };
+        for (size_t b = 0; b + 1 < NumBuckets; ++b)
+        {
+            cumulative += h.buckets[b];
+            auto const le = (uint64_t{ 1 } << b) - 1;
+            appendf(out, "%s_bucket{le=\"%s\"} %" PRIu64 "\n", metric.c_str(), formatSeconds(le).c_str(), cumulative);
+        }
+
+        // sum the buckets rather than using h.count, which may have moved on since
+        cumulative += h.buckets.back();
+        appendf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", metric.c_str(), cumulative);
+        appendf(out, "%s_sum %s\n", metric.c_str(), formatSeconds(h.total_usec).c_str());
+        appendf(out, "%s_count %" PRIu64 "\n", metric.c_str(), cumulative);
+    }
+
+    for (size_t i = 0; i < std::size(CounterNames); ++i)
+    {
+        auto const metric = prometheusName(CounterNames[i]) + "_total";
+        appendf(out, "# TYPE %s counter\n", metric.c_str());
+        appendf(out, "%s %" PRIu64 "\n", metric.c_str(), get(static_cast<Counter>(i)));
+    }
+
+    return out;
+}
@@ -0,0 +1,181 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <string>
+#include <string_view>
+
+struct event;
+struct event_base;
+struct tr_variant;
+
+/**
+ * Latency histograms and counters for the session's hot paths.
+ *
+ * Timers record how long a callback took, in microseconds, into
+ * power-of-two buckets: bucket `i` counts samples under 2^i usec,
+ * and the last bucket also counts everything bigger than that.
+ * Counters are running totals.
+ *
+ * Everything is off until setEnabled(true). While it's off, timing a
+ * scope costs one relaxed load and no clock reads, and nothing is
+ * recorded. Recording is lock-free so it's safe from any thread.
+ */
+class tr_metrics
+{
+public:
+    enum class Timer
+    {
+        EventLoopLag, // how late a timer due every LagIntervalMsec actually ran
+        EventQueueWait, // how long tr_runInEventThread() work waited to run
+        RunInEventThread, // how long tr_runInEventThread() work took
+        BandwidthPulse,
+        RechokePulse,
+        AtomPulse,
+        QueuePulse,
+        AnnouncerUpkeep,
+        CacheFlush,
+        RpcRequest,
+        N_TIMERS
+    };
+
+    enum class Counter
+    {
+        BytesCopied, // bytes copied out of the block cache
+        BlocksCached,
+        DiskReads,
+        DiskReadBytes,
+        DiskWrites,
+        DiskWriteBytes,
+        ReadCacheHits, // blocks served from the seeding read cache
+        ReadCacheMisses, // blocks whose span had to be read from disk first
+        PeerWrites, // write syscalls on peers' TCP sockets
+        PeerWriteBytes,
+        N_COUNTERS
+    };
+
+    static auto constexpr NumBuckets = size_t{ 24 };
+    static auto constexpr LagIntervalMsec = 100;
+
+    struct Histogram
+    {
+        uint64_t count = 0;
+        uint64_t total_usec = 0;
+        uint64_t max_usec = 0;
+        std::array<uint64_t, NumBuckets> buckets = {};
+    };
+
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(tr_metrics* metrics, Timer which) noexcept
+            : metrics_{ metrics }
+            , which_{ which }
+            , begin_usec_{ metrics != nullptr ? nowUsec() : 0 }
+        {
+        }
+
+        ScopedTimer(ScopedTimer const&) = delete;
+        ScopedTimer& operator=(ScopedTimer const&) = delete;
+
+        ~ScopedTimer()
+        {
+            if (metrics_ != nullptr)
+            {
+                metrics_->record(which_, nowUsec() - begin_usec_);
+            }
+        }
+
+    private:
+        tr_metrics* const metrics_;
+        Timer const which_;
+        uint64_t const begin_usec_;
+    };
+
+    tr_metrics() = default;
+    ~tr_metrics();
+    tr_metrics(tr_metrics const&) = delete;
+    tr_metrics& operator=(tr_metrics const&) = delete;
+
+    [[nodiscard]] bool isEnabled() const noexcept
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    void setEnabled(bool enabled) noexcept
+    {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+    // usage: `auto const timer = session->metrics.time(tr_metrics::Timer::RechokePulse);`
+    [[nodiscard]] ScopedTimer time(Timer which) noexcept
+    {
+        return ScopedTimer{ isEnabled() ? this : nullptr, which };
+    }
+
+    void record(Timer which, uint64_t usec) noexcept;
+
+    void add(Counter which, uint64_t n = 1) noexcept
+    {
+        if (isEnabled())
+        {
+            counters_[static_cast<size_t>(which)].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] Histogram get(Timer which) const noexcept;
+
+    [[nodiscard]] uint64_t get(Counter which) const noexcept
+    {
+        return counters_[static_cast<size_t>(which)].load(std::memory_order_relaxed);
+    }
+
+    void reset() noexcept;
+
+    // Sample how late `base` runs a timer that's due every LagIntervalMsec.
+    // Must be called from the thread running `base`.
+    void startLagTimer(struct event_base* base);
+    void stopLagTimer();
+
+    // the session's "session-metrics" RPC response
+    void toVariant(tr_variant* setme) const;
+
+    // the Prometheus text exposition format, version 0.0.4
+    [[nodiscard]] std::string toPrometheus() const;
+
+    [[nodiscard]] static std::string_view name(Timer which);
+    [[nodiscard]] static std::string_view name(Counter which);
+
+    [[nodiscard]] static size_t bucketOf(uint64_t usec) noexcept;
+    [[nodiscard]] static uint64_t nowUsec() noexcept;
+
+private:
+    struct AtomicHistogram
+    {
+        std::atomic<uint64_t> count = {};
+        std::atomic<uint64_t> total_usec = {};
+        std::atomic<uint64_t> max_usec = {};
+        std::array<std::atomic<uint64_t>, NumBuckets> buckets = {};
+    };
+
+    std::array<AtomicHistogram, static_cast<size_t>(Timer::N_TIMERS)> timers_ = {};
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::N_COUNTERS)> counters_ = {};
+    std::atomic<bool> enabled_ = false;
+
+    struct event* lag_timer_ = nullptr;
+    uint64_t lag_timer_due_usec_ = 0;
+};
@@ -30,7 +30,7 @@
 #ifdef _WIN32
 #include <ws2tcpip.h>
 #else
-#include <netinet/tcp.h> /* TCP_CONGESTION */
+#include <netinet/tcp.h> /* TCP_CONGESTION, TCP_CORK */
 #endif
 
 #include <event2/util.h>
@@ -212,6 +212,21 @@ void tr_netSetCongestionControl([[maybe_unused]] tr_socket_t s, [[maybe_unused]]
 #endif
 }
 
+bool tr_netSetCorked([[maybe_unused]] tr_socket_t s, [[maybe_unused]] bool corked)
+{
+    /* hold back partial segments until uncorked, so that a run of
+     * small writes leaves as full-sized packets */
+#if defined(TCP_CORK)
+    int const opt = corked ? 1 : 0;
+    return setsockopt(s, IPPROTO_TCP, TCP_CORK, reinterpret_cast<char const*>(&opt), sizeof(opt)) != -1;
+#elif defined(TCP_NOPUSH)
+    int const opt = corked ? 1 : 0;
+    return setsockopt(s, IPPROTO_TCP, TCP_NOPUSH, reinterpret_cast<char const*>(&opt), sizeof(opt)) != -1;
+#else
+    return false;
+#endif
+}
+
 bool tr_address_from_sockaddr_storage(tr_address* setme_addr, tr_port* setme_port, struct sockaddr_storage const* from)
 {
     if (from->ss_family == AF_INET)
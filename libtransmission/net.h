@@ -142,6 +142,9 @@ void tr_netSetTOS(tr_socket_t s, int tos, tr_address_type type);
 
 void tr_netSetCongestionControl(tr_socket_t s, char const* algorithm);
 
+/** @brief cork or uncork a TCP socket. Returns false if that's not supported. */
+bool tr_netSetCorked(tr_socket_t s, bool corked);
+
 void tr_netClose(tr_session* session, tr_socket_t s);
 
 void tr_netCloseSocket(tr_socket_t fd);
@@ -259,6 +259,13 @@ static void canReadWrapper(tr_peerIo* io)
     tr_peerIoUnref(io);
 }
 
+void tr_peerIoProcessReadBuffer(tr_peerIo* io)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+
+    canReadWrapper(io);
+}
+
 static void event_read_cb(evutil_socket_t fd, short /*event*/, void* vio)
 {
     auto* io = static_cast<tr_peerIo*>(vio);
@@ -340,6 +347,13 @@ static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
     int const e = EVUTIL_SOCKET_ERROR();
     dbgmsg(io, "wrote %d to peer (%s)", n, (n == -1 ? tr_net_strerror(errstr, sizeof(errstr), e) : ""));
 
+    auto& metrics = io->session->metrics;
+    metrics.add(tr_metrics::Counter::PeerWrites);
+    if (n > 0)
+    {
+        metrics.add(tr_metrics::Counter::PeerWriteBytes, n);
+    }
+
     return n;
 }
 
@@ -631,7 +645,7 @@ static tr_peerIo* tr_peerIoNew(
     }
 
     auto* io = new tr_peerIo{ session, *addr, port, isSeed };
-    tr_cryptoConstruct(&io->crypto, torrentHash, isIncoming);
+    tr_cryptoConstruct(&io->crypto, torrentHash, isIncoming, session->dh_pool.get());
     io->socket = socket;
     io->bandwidth = new Bandwidth(parent);
     io->bandwidth->setPeer(io);
@@ -720,6 +734,26 @@ tr_peerIo* tr_peerIoNewOutgoing(
     return tr_peerIoNew(session, parent, addr, port, torrentHash, false, isSeed, socket);
 }
 
+#ifdef LIBTRANSMISSION_BENCH_HOOKS
+
+tr_peerIo* tr_peerIoNewOutgoingConnected(
+    tr_session* session,
+    Bandwidth* parent,
+    tr_address const* addr,
+    tr_port port,
+    uint8_t const* torrentHash,
+    bool isSeed,
+    struct tr_peer_socket const socket)
+{
+    TR_ASSERT(session != nullptr);
+    TR_ASSERT(tr_address_is_valid(addr));
+    TR_ASSERT(torrentHash != nullptr);
+
+    return tr_peerIoNew(session, parent, addr, port, torrentHash, false, isSeed, socket);
+}
+
+#endif
+
 /***
 ****
 ***/
@@ -1386,6 +1420,17 @@ int tr_peerIoFlush(tr_peerIo* io, tr_direction dir, size_t limit)
     return bytesUsed;
 }
 
+void tr_peerIoSetCorked(tr_peerIo* io, bool corked)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+
+    if (io->socket.type == TR_PEER_SOCKET_TYPE_TCP && io->isCorked != corked)
+    {
+        tr_netSetCorked(io->socket.handle.tcp, corked);
+        io->isCorked = corked;
+    }
+}
+
 int tr_peerIoFlushOutgoingProtocolMsgs(tr_peerIo* io)
 {
     size_t byteCount = 0;
@@ -121,6 +121,7 @@ public:
     tr_priority_t priority = TR_PRI_NORMAL;
 
     bool const isSeed;
+    bool isCorked = false;
     bool dhtSupported = false;
     bool extendedProtocolSupported = false;
     bool fastExtensionSupported = false;
@@ -140,6 +141,20 @@ tr_peerIo* tr_peerIoNewOutgoing(
     bool isSeed,
     bool utp);
 
+#ifdef LIBTRANSMISSION_BENCH_HOOKS
+
+/* Like tr_peerIoNewOutgoing(), but for a socket that's already connected */
+tr_peerIo* tr_peerIoNewOutgoingConnected(
+    tr_session* session,
+    Bandwidth* parent,
+    struct tr_address const* addr,
+    tr_port port,
+    uint8_t const* torrentHash,
+    bool isSeed,
+    struct tr_peer_socket const socket);
+
+#endif
+
 tr_peerIo* tr_peerIoNewIncoming(
     tr_session* session,
     Bandwidth* parent,
@@ -332,10 +347,20 @@ static inline unsigned int tr_peerIoGetPieceSpeed_Bps(tr_peerIo const* io, uint6
 
 void tr_peerIoSetEnabled(tr_peerIo* io, tr_direction dir, bool isEnabled);
 
+/* Pass what's already in the read buffer to the read callback again,
+ * e.g. because it returned READ_LATER while waiting on something besides the peer */
+void tr_peerIoProcessReadBuffer(tr_peerIo* io);
+
 int tr_peerIoFlush(tr_peerIo* io, tr_direction dir, size_t byteLimit);
 
 int tr_peerIoFlushOutgoingProtocolMsgs(tr_peerIo* io);
 
+/* While corked, a TCP peer's socket holds back partial segments, so a
+ * run of tr_peerIoFlush() calls goes out in full-sized packets.
+ * The socket is only touched when the state changes.
+ * This is a no-op for uTP peers. */
+void tr_peerIoSetCorked(tr_peerIo* io, bool corked);
+
 /**
 ***
 **/
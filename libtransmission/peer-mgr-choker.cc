@@ -0,0 +1,473 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <climits> /* INT_MAX */
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+
+#include "crypto-utils.h" // tr_rand_int_weak()
+#include "peer-mgr-choker.h"
+#include "tr-assert.h"
+
+namespace
+{
+
+// an optimistically unchoked peer is immune from rechoking
+// for this many calls to rechoke().
+auto constexpr OptimisticUnchokeMultiplier = int{ 4 };
+
+// new peers are this many times more likely to be optimistically unchoked
+auto constexpr NewPeerOptimisticWeight = unsigned{ 3 };
+
+// a peer is only re-ranked when its rate moves by more than
+// this many bytes per second and more than 1/RerankDivisor of its old rate
+auto constexpr MinRerankRateDelta = unsigned{ 1024 };
+auto constexpr RerankDivisor = unsigned{ 8 };
+
+// in round-robin mode, how many rechokes a peer keeps its slot
+// for when other peers are waiting for one
+auto constexpr RoundRobinSliceRechokes = uint64_t{ 3 };
+
+} // namespace
+
+class Choker::Impl
+{
+public:
+    void add(Peer const& peer)
+    {
+        auto [it, inserted] = entries_.try_emplace(peer.msgs);
+        auto& entry = it->second;
+
+        if (inserted)
+        {
+            // new entries aren't ranked yet, so queue them up for ranking
+            pending_.push_back(&entry);
+        }
+
+        if (inserted || entry.seen == 0)
+        {
+            // brand new, or a new peer that reused a removed peer's address
+            entry = Entry{};
+            entry.dirty = true;
+        }
+        else if (isSignificantChange(entry.ranked_rate, peer.rate))
+        {
+            entry.dirty = true;
+        }
+
+        entry.peer = peer;
+        entry.seen = round_;
+    }
+
+    void remove(tr_peerMsgs const* msgs)
+    {
+        // don't erase the entry yet because ranked_ and pending_ point to it.
+        // rechoke() will clean it up.
+        if (auto const it = entries_.find(msgs); it != std::end(entries_))
+        {
+            it->second.seen = 0;
+        }
+
+        if (optimistic_ == msgs)
+        {
+            optimistic_ = nullptr;
+        }
+    }
+
+    [[nodiscard]] std::vector<std::pair<tr_peerMsgs*, bool>> const& rechoke(
+        tr_choke_algorithm algorithm,
+        size_t slots,
+        bool is_seeding,
+        bool is_maxed_out)
+    {
+        rerank();
+
+        if (algorithm == TR_CHOKE_ROUND_ROBIN && is_seeding)
+        {
+            optimistic_ = nullptr;
+            rechokeRoundRobin(slots, is_maxed_out);
+        }
+        else
+        {
+            rechokeTitForTat(slots, is_maxed_out);
+        }
+
+        result_.clear();
+        result_.reserve(std::size(ranked_));
+        for (auto* const entry : ranked_)
+        {
+            if (entry->choke)
+            {
+                entry->slot_since = 0;
+            }
+            else
+            {
+                entry->last_slot = round_;
+            }
+
+            result_.emplace_back(entry->peer.msgs, entry->choke);
+        }
+
+        ++round_;
+        return result_;
+    }
+
+    [[nodiscard]] tr_peerMsgs* optimistic() const
+    {
+        return optimistic_;
+    }
+
+private:
+    struct Entry
+    {
+        Peer peer;
+
+        // the sort keys used the last time this peer was ranked
+        unsigned int ranked_rate = 0;
+        bool ranked_unchoked = false;
+        int salt = 0;
+
+        // the round in which this peer was last add()ed, or 0 if removed
+        uint64_t seen = 0;
+
+        // round-robin bookkeeping: when this peer got its current slot,
+        // and the last round in which it had a slot
+        uint64_t slot_since = 0;
+        uint64_t last_slot = 0;
+
+        bool dirty = false;
+        bool choke = true;
+    };
+
+    [[nodiscard]] static bool isSignificantChange(unsigned int old_rate, unsigned int new_rate)
+    {
+        auto const delta = old_rate > new_rate ? old_rate - new_rate : new_rate - old_rate;
+        return delta > MinRerankRateDelta && delta > old_rate / RerankDivisor;
+    }
+
+    [[nodiscard]] static bool isBetter(Entry const* a, Entry const* b)
+    {
+        if (a->ranked_rate != b->ranked_rate) // prefer higher overall speeds
+        {
+            return a->ranked_rate > b->ranked_rate;
+        }
+
+        if (a->ranked_unchoked != b->ranked_unchoked) // prefer unchoked
+        {
+            return a->ranked_unchoked;
+        }
+
+        return a->salt < b->salt; // random order
+    }
+
+    // Drop the peers that weren't added this round, then re-rank the
+    // new peers and the ones whose rates changed. Everyone else keeps
+    // their place, so this is O(n + k log k) for k re-ranked peers.
+    void rerank()
+    {
+        dirty_.clear();
+
+        auto const sift = [this](std::vector<Entry*>& entries)
+        {
+            auto out = std::begin(entries);
+
+            for (auto* const entry : entries)
+            {
+                if (entry->seen != round_)
+                {
+                    entries_.erase(entry->peer.msgs);
+                }
+                else if (entry->dirty)
+                {
+                    dirty_.push_back(entry);
+                }
+                else
+                {
+                    *out++ = entry;
+                }
+            }
+
+            entries.erase(out, std::end(entries));
+        };
+
+        sift(ranked_);
+        sift(pending_);
+        TR_ASSERT(std::empty(pending_));
+
+        if (std::empty(dirty_))
+        {
+            return;
+        }
+
+        for (auto* const entry : dirty_)
+        {
+            entry->ranked_rate = entry->peer.rate;
+            entry->ranked_unchoked = !entry->peer.is_choked;
+            entry->salt = tr_rand_int_weak(INT_MAX);
+            entry->dirty = false;
+        }
+
+        std::sort(std::begin(dirty_), std::end(dirty_), isBetter);
+
+        merged_.clear();
+        merged_.reserve(std::size(ranked_) + std::size(dirty_));
+        std::merge(
+            std::begin(ranked_),
+            std::end(ranked_),
+            std::begin(dirty_),
+            std::end(dirty_),
+            std::back_inserter(merged_),
+            isBetter);
+        std::swap(ranked_, merged_);
+    }
+
+    /**
+     * Reciprocation and number of uploads capping is managed by unchoking
+     * the N peers which have the best upload rate and are interested.
+     * This maximizes the client's download rate. These N peers are
+     * referred to as downloaders, because they are interested in downloading
+     * from the client.
+     *
+     * Peers which have a better upload rate (as compared to the downloaders)
+     * but aren't interested get unchoked. If they become interested, the
+     * downloader with the worst upload rate gets choked. If a client has
+     * a complete file, it uses its upload rate rather than its download
+     * rate to decide which peers to unchoke.
+     *
+     * If our bandwidth is maxed out, don't unchoke any more peers.
+     */
+    void rechokeTitForTat(size_t slots, bool is_maxed_out)
+    {
+        // an optimistic unchoke peer's "optimistic"
+        // state lasts for N calls to rechoke().
+        if (optimistic_rechokes_left_ > 0)
+        {
+            --optimistic_rechokes_left_;
+        }
+        else
+        {
+            optimistic_ = nullptr;
+        }
+
+        if (auto const it = entries_.find(optimistic_); it == std::end(entries_) || it->second.seen != round_)
+        {
+            optimistic_ = nullptr;
+        }
+
+        auto unchoked_interested = size_t{ 0 };
+        auto n_checked = size_t{ 0 };
+
+        for (auto* const entry : ranked_)
+        {
+            if (entry->peer.msgs == optimistic_)
+            {
+                entry->choke = false;
+                ++n_checked;
+            }
+            else if (unchoked_interested < slots)
+            {
+                entry->choke = is_maxed_out ? entry->peer.is_choked : false;
+                ++n_checked;
+
+                if (entry->peer.is_interested)
+                {
+                    ++unchoked_interested;
+                }
+            }
+            else
+            {
+                entry->choke = true;
+            }
+        }
+
+        if (optimistic_ != nullptr || is_maxed_out || n_checked >= std::size(ranked_))
+        {
+            return;
+        }
+
+        // pick a weighted-random optimistic unchoke from the choked, interested peers
+        auto const weight = [](Entry const* entry)
+        {
+            if (!entry->choke || !entry->peer.is_interested)
+            {
+                return 0U;
+            }
+
+            return entry->peer.is_new ? NewPeerOptimisticWeight : 1U;
+        };
+
+        auto total = unsigned{};
+        for (auto const* const entry : ranked_)
+        {
+            total += weight(entry);
+        }
+
+        if (total == 0)
+        {
+            return;
+        }
+
+        auto pick = static_cast<unsigned>(tr_rand_int_weak(static_cast<int>(total)));
+        for (auto* const entry : ranked_)
+        {
+            auto const w = weight(entry);
+            if (pick < w)
+            {
+                entry->choke = false;
+                optimistic_ = entry->peer.msgs;
+                optimistic_rechokes_left_ = OptimisticUnchokeMultiplier;
+                break;
+            }
+
+            pick -= w;
+        }
+    }
+
+    /**
+     * Seed-oriented round robin: rather than rewarding the fastest peers
+     * forever, every interested peer gets a turn. A peer keeps its slot for
+     * RoundRobinSliceRechokes rechokes and then gives it up to whoever has
+     * been waiting longest. If nobody is waiting, it keeps the slot.
+     */
+    void rechokeRoundRobin(size_t slots, bool is_maxed_out)
+    {
+        holders_.clear();
+        waiting_.clear();
+
+        for (auto* const entry : ranked_)
+        {
+            entry->choke = true;
+
+            if (!entry->peer.is_interested)
+            {
+                continue;
+            }
+
+            if (entry->peer.is_choked)
+            {
+                waiting_.push_back(entry);
+            }
+            else
+            {
+                if (entry->slot_since == 0)
+                {
+                    entry->slot_since = round_;
+                }
+
+                holders_.push_back(entry);
+            }
+        }
+
+        auto const expired_begin = std::stable_partition(
+            std::begin(holders_),
+            std::end(holders_),
+            [this](Entry const* entry) { return round_ - entry->slot_since < RoundRobinSliceRechokes; });
+
+        auto free_slots = slots;
+        auto const grant = [&free_slots](Entry* entry)
+        {
+            entry->choke = false;
+            --free_slots;
+        };
+
+        // peers whose turn isn't over yet keep their slots
+        for (auto it = std::begin(holders_); it != expired_begin && free_slots > 0; ++it)
+        {
+            grant(*it);
+        }
+
+        // then the peers that have been waiting longest get the free slots
+        if (!is_maxed_out && free_slots > 0 && !std::empty(waiting_))
+        {
+            auto const n = std::min(free_slots, std::size(waiting_));
+            auto const waited_longer = [](Entry const* a, Entry const* b)
+            {
+                return a->last_slot != b->last_slot ? a->last_slot < b->last_slot : a->salt < b->salt;
+            };
+
+            std::nth_element(std::begin(waiting_), std::begin(waiting_) + (n - 1), std::end(waiting_), waited_longer);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                waiting_[i]->slot_since = round_;
+                grant(waiting_[i]);
+            }
+        }
+
+        // and anything left over goes back to the peers whose turn is up
+        for (auto it = expired_begin; it != std::end(holders_) && free_slots > 0; ++it)
+        {
+            grant(*it);
+        }
+    }
+
+    // node-based container, so Entry addresses are stable
+    std::unordered_map<tr_peerMsgs const*, Entry> entries_;
+
+    // best-first ranking of the peers
+    std::vector<Entry*> ranked_;
+
+    // peers that have been added but not ranked yet
+    std::vector<Entry*> pending_;
+
+    // scratch space that's kept around to avoid reallocating every rechoke
+    std::vector<Entry*> dirty_;
+    std::vector<Entry*> merged_;
+    std::vector<Entry*> holders_;
+    std::vector<Entry*> waiting_;
+    std::vector<std::pair<tr_peerMsgs*, bool>> result_;
+
+    // 0 is reserved for "removed", so start counting at 1
+    uint64_t round_ = 1;
+
+    tr_peerMsgs* optimistic_ = nullptr;
+    int optimistic_rechokes_left_ = 0;
+};
+
+/***
+****
+***/
+
+Choker::Choker()
+    : impl_{ std::make_unique<Impl>() }
+{
+}
+
+Choker::~Choker() = default;
+
+void Choker::add(Peer const& peer)
+{
+    impl_->add(peer);
+}
+
+void Choker::remove(tr_peerMsgs const* msgs)
+{
+    impl_->remove(msgs);
+}
+
+std::vector<std::pair<tr_peerMsgs*, bool>> const& Choker::rechoke(
+    tr_choke_algorithm algorithm,
+    size_t slots,
+    bool is_seeding,
+    bool is_maxed_out)
+{
+    return impl_->rechoke(algorithm, slots, is_seeding, is_maxed_out);
+}
+
+tr_peerMsgs* Choker::optimistic() const
+{
+    return impl_->optimistic();
+}
@@ -0,0 +1,84 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "transmission.h" // tr_choke_algorithm
+
+class tr_peerMsgs;
+
+/**
+ * Decides which of a swarm's peers get our upload slots.
+ *
+ * The choker remembers its ranking of the peers between rechokes and
+ * only re-ranks a peer when its rate has changed significantly, so that
+ * rechoking a big swarm is mostly a linear pass instead of a full sort.
+ * Its buffers are reused from one rechoke to the next.
+ *
+ * Usage: call add() for every peer that may be unchoked, then rechoke().
+ * Peers that weren't added since the previous rechoke are forgotten.
+ */
+class Choker
+{
+public:
+    Choker();
+    ~Choker();
+
+    Choker(Choker const&) = delete;
+    Choker& operator=(Choker const&) = delete;
+
+    struct Peer
+    {
+        tr_peerMsgs* msgs = nullptr;
+
+        // the rate used to rank this peer, in bytes per second
+        unsigned int rate = 0;
+
+        bool is_interested = false;
+        bool is_choked = true;
+
+        // recently-connected peers are more likely to be optimistically unchoked
+        bool is_new = false;
+    };
+
+    void add(Peer const& peer);
+
+    // forget `msgs`, e.g. because it's being disconnected
+    void remove(tr_peerMsgs const* msgs);
+
+    /**
+     * Decide who to unchoke among the peers added since the last rechoke.
+     *
+     * @param slots how many interested peers can be unchoked at once
+     * @param is_seeding true if we're only uploading
+     * @param is_maxed_out true if we're already uploading as fast as we're
+     *                     allowed to, so that no more peers should be unchoked
+     * @return each added peer and whether or not it should be choked
+     */
+    [[nodiscard]] std::vector<std::pair<tr_peerMsgs*, bool>> const& rechoke(
+        tr_choke_algorithm algorithm,
+        size_t slots,
+        bool is_seeding,
+        bool is_maxed_out);
+
+    // the optimistically-unchoked peer, or nullptr if none
+    [[nodiscard]] tr_peerMsgs* optimistic() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> const impl_;
+};
@@ -0,0 +1,198 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+
+#include "peer-mgr-pex.h"
+#include "tr-assert.h"
+#include "utils.h" // tr_free()
+#include "variant.h"
+
+namespace
+{
+
+struct PexLess
+{
+    bool operator()(tr_pex const& a, tr_pex const& b) const
+    {
+        return tr_pexCompare(&a, &b) < 0;
+    }
+};
+
+void addCompact(tr_variant* dict, tr_quark key, tr_quark flags_key, std::vector<tr_pex> const& pex, tr_address_type type)
+{
+    auto const addr_len = type == TR_AF_INET ? size_t{ 4 } : size_t{ 16 };
+    auto compact = std::string{};
+    auto flags = std::string{};
+
+    for (auto const& p : pex)
+    {
+        if (p.addr.type != type)
+        {
+            continue;
+        }
+
+        auto const* const addr = type == TR_AF_INET ? reinterpret_cast<char const*>(&p.addr.addr.addr4) :
+                                                      reinterpret_cast<char const*>(&p.addr.addr.addr6.s6_addr);
+        compact.append(addr, addr_len);
+        compact.append(reinterpret_cast<char const*>(&p.port), sizeof(p.port));
+
+        // unset each holepunch flag because we don't support it.
+        flags += char(p.flags & ~ADDED_F_HOLEPUNCH);
+    }
+
+    if (std::empty(compact))
+    {
+        return;
+    }
+
+    tr_variantDictAddRaw(dict, key, std::data(compact), std::size(compact));
+
+    if (flags_key != TR_KEY_NONE)
+    {
+        tr_variantDictAddRaw(dict, flags_key, std::data(flags), std::size(flags));
+    }
+}
+
+} // namespace
+
+void PexSnapshot::update(std::vector<tr_pex> peers)
+{
+    TR_ASSERT(std::is_sorted(std::begin(peers), std::end(peers), PexLess{}));
+
+    auto change = Change{};
+    std::set_difference(
+        std::begin(peers),
+        std::end(peers),
+        std::begin(peers_),
+        std::end(peers_),
+        std::back_inserter(change.added),
+        PexLess{});
+    std::set_difference(
+        std::begin(peers_),
+        std::end(peers_),
+        std::begin(peers),
+        std::end(peers),
+        std::back_inserter(change.dropped),
+        PexLess{});
+
+    peers_ = std::move(peers);
+
+    if (std::empty(change.added) && std::empty(change.dropped))
+    {
+        return;
+    }
+
+    change.version = ++version_;
+    log_.push_back(std::move(change));
+    if (std::size(log_) > MaxLogSize)
+    {
+        log_.pop_front();
+    }
+
+    messages_.clear();
+}
+
+void PexSnapshot::diff(Version from, std::vector<tr_pex>& setme_added, std::vector<tr_pex>& setme_dropped) const
+{
+    setme_added.clear();
+    setme_dropped.clear();
+
+    if (from == version_)
+    {
+        return;
+    }
+
+    // too far behind to replay the log, so start over
+    if (from > version_ || std::empty(log_) || from + 1 < log_.front().version)
+    {
+        setme_added = peers_;
+        return;
+    }
+
+    // pex -> true if it was added since `from`, false if it was dropped
+    auto net = std::map<tr_pex, bool, PexLess>{};
+
+    for (auto const& change : log_)
+    {
+        if (change.version <= from)
+        {
+            continue;
+        }
+
+        for (auto const& pex : change.dropped)
+        {
+            if (auto const it = net.find(pex); it != std::end(net) && it->second)
+            {
+                net.erase(it);
+            }
+            else
+            {
+                net.insert_or_assign(pex, false);
+            }
+        }
+
+        for (auto const& pex : change.added)
+        {
+            if (auto const it = net.find(pex); it != std::end(net) && !it->second)
+            {
+                net.erase(it);
+            }
+            else
+            {
+                net.insert_or_assign(pex, true);
+            }
+        }
+    }
+
+    for (auto const& [pex, added] : net)
+    {
+        (added ? setme_added : setme_dropped).push_back(pex);
+    }
+}
+
+std::string const& PexSnapshot::message(Version from)
+{
+    auto const [it, inserted] = messages_.try_emplace(from);
+    auto& message = it->second;
+
+    if (!inserted)
+    {
+        return message;
+    }
+
+    auto added = std::vector<tr_pex>{};
+    auto dropped = std::vector<tr_pex>{};
+    diff(from, added, dropped);
+
+    if (std::empty(added) && std::empty(dropped))
+    {
+        return message;
+    }
+
+    auto val = tr_variant{};
+    tr_variantInitDict(&val, 6);
+    addCompact(&val, TR_KEY_added, TR_KEY_added_f, added, TR_AF_INET);
+    addCompact(&val, TR_KEY_dropped, TR_KEY_NONE, dropped, TR_AF_INET);
+    addCompact(&val, TR_KEY_added6, TR_KEY_added6_f, added, TR_AF_INET6);
+    addCompact(&val, TR_KEY_dropped6, TR_KEY_NONE, dropped, TR_AF_INET6);
+
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(&val, TR_VARIANT_FMT_BENC, &len);
+    message.assign(benc, len);
+    tr_free(benc);
+    tr_variantFree(&val);
+
+    return message;
+}
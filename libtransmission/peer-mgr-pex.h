@@ -0,0 +1,84 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef LIBTRANSMISSION_PEER_MODULE
+#error only the libtransmission peer module should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "peer-mgr.h" // tr_pex
+
+/**
+ * A versioned snapshot of a swarm's connected peers that all of the
+ * swarm's ut_pex messages are built from.
+ *
+ * Rather than keeping its own copy of the peer list to diff against,
+ * each peer only remembers the version it last sent. The snapshot logs
+ * what each new version added and dropped, so a peer's changes are found
+ * by replaying the log from its version. The encoded message is cached
+ * too, so peers that were at the same version share it.
+ */
+class PexSnapshot
+{
+public:
+    using Version = uint32_t;
+
+    // some peers give us error messages if we send more than this many
+    // peers of an address family in a single pex message
+    // http://wiki.theory.org/BitTorrentPeerExchangeConventions
+    static auto constexpr MaxPeers = size_t{ 50 };
+
+    // how many versions' changes are kept. Peers further behind than
+    // this get the whole snapshot as "added" and miss some "dropped"s.
+    static auto constexpr MaxLogSize = size_t{ 256 };
+
+    // Version 0 is the empty snapshot, which is where new peers start.
+    [[nodiscard]] Version version() const
+    {
+        return version_;
+    }
+
+    [[nodiscard]] std::vector<tr_pex> const& peers() const
+    {
+        return peers_;
+    }
+
+    // Replaces the snapshot with `peers`, which must be sorted with tr_pexCompare().
+    // Makes a new version if that changed anything.
+    void update(std::vector<tr_pex> peers);
+
+    // The bencoded ut_pex payload that brings a peer at version `from` up to
+    // version(), or an empty string if nothing changed. The reference is good
+    // until the next update().
+    [[nodiscard]] std::string const& message(Version from);
+
+private:
+    struct Change
+    {
+        Version version;
+        std::vector<tr_pex> added;
+        std::vector<tr_pex> dropped;
+    };
+
+    void diff(Version from, std::vector<tr_pex>& setme_added, std::vector<tr_pex>& setme_dropped) const;
+
+    Version version_ = 0;
+    std::vector<tr_pex> peers_;
+    std::deque<Change> log_;
+
+    // version diffed from -> message
+    std::map<Version, std::string> messages_;
+};
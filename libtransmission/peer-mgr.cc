@@ -37,6 +37,8 @@
 #include "peer-io.h"
 #include "peer-mgr.h"
 #include "peer-mgr-active-requests.h"
+#include "peer-mgr-choker.h"
+#include "peer-mgr-pex.h"
 #include "peer-mgr-wishlist.h"
 #include "peer-msgs.h"
 #include "ptrarray.h"
@@ -54,13 +56,13 @@ static auto constexpr AtomPeriodMsec = int{ 60 * 1000 };
 // how frequently to change which peers are choked
 static auto constexpr RechokePeriodMsec = int{ 10 * 1000 };
 
-// an optimistically unchoked peer is immune from rechoking
-// for this many calls to rechokeUploads().
-static auto constexpr OptimisticUnchokeMultiplier = int{ 4 };
-
 // how frequently to reallocate bandwidth
 static auto constexpr BandwidthPeriodMsec = int{ 500 };
 
+// how frequently to re-check the queues when nothing has changed,
+// e.g. to notice when an active torrent has become stalled
+static auto constexpr QueuePeriodMsec = int{ 10 * 1000 };
+
 // how frequently to age out old piece request lists
 static auto constexpr RefillUpkeepPeriodMsec = int{ 10 * 1000 };
 
@@ -115,7 +117,8 @@ struct peer_atom
     uint8_t fromBest; /* the "best" value of where the peer has been found */
     uint8_t flags; /* these match the added_f flags */
     uint8_t flags2; /* flags that aren't defined in added_f */
-    int8_t blocklisted; /* -1 for unknown, true for blocklisted, false for not blocklisted */
+    bool blocklisted; /* whether the peer is blocklisted... */
+    uint64_t blocklist_generation; /* ...as of this blocklist generation, or 0 if not checked yet */
 
     tr_port port;
     bool utp_failed; /* We recently failed to connect over uTP */
@@ -153,6 +156,20 @@ static char const* tr_atomAddrStr(struct peer_atom const* atom)
     return atom != nullptr ? tr_address_and_port_to_string(addrstr, sizeof(addrstr), &atom->addr, atom->port) : "[no atom]";
 }
 
+enum tr_rechoke_state
+{
+    RECHOKE_STATE_GOOD,
+    RECHOKE_STATE_UNTESTED,
+    RECHOKE_STATE_BAD
+};
+
+struct tr_rechoke_info
+{
+    tr_peerMsgs* peer;
+    int salt;
+    int rechoke_state;
+};
+
 /** @brief Opaque, per-torrent data structure for peer connection information */
 class tr_swarm
 {
@@ -174,9 +191,6 @@ public:
     tr_peerMgr* const manager;
     tr_torrent* const tor;
 
-    tr_peerMsgs* optimistic = nullptr; /* the optimistic peer, or nullptr if none */
-    int optimisticUnchokeTimeScaler = 0;
-
     bool poolIsAllSeeds = false;
     bool poolIsAllSeedsDirty = true; /* true if poolIsAllSeeds needs to be recomputed */
     bool isRunning = false;
@@ -185,6 +199,26 @@ public:
 
     ActiveRequests active_requests;
     Wishlist wishlist;
+    Choker choker;
+
+    // scratch space for rechokeDownloads(), kept to avoid reallocating every rechoke
+    std::vector<bool> piece_is_interesting;
+    std::vector<tr_rechoke_info> rechoke_infos;
+
+    // tr_peerMgrGetDesiredAvailable()'s last answer, and the completion it was based on.
+    // It's only recounted when that changes or when a peer comes, goes, or gets pieces.
+    uint64_t desiredAvailable = 0;
+    uint64_t desiredAvailableHasTotal = 0;
+    uint64_t desiredAvailableSizeWhenDone = 0;
+    bool desiredAvailableIsDirty = true;
+
+    // pieces completed since the last pulse, whose Haves haven't been sent yet
+    std::vector<tr_piece_index_t> pendingHaves;
+
+    // the connected peers that are advertised in ut_pex messages
+    PexSnapshot pex;
+    bool pexIsDirty = false; /* true if `peers` has changed since `pex` was built */
+    time_t pexBuiltAt = 0;
 
     int interestedCount = 0;
     int maxPeers = 0;
@@ -204,6 +238,7 @@ struct tr_peerMgr
     struct event* rechokeTimer;
     struct event* refillUpkeepTimer;
     struct event* atomTimer;
+    struct event* queueTimer;
 };
 
 #define tordbg(t, ...) tr_logAddDeepNamed(tr_torrentName((t)->tor), __VA_ARGS__)
@@ -399,6 +434,7 @@ static void deleteTimers(struct tr_peerMgr* m)
     deleteTimer(&m->bandwidthTimer);
     deleteTimer(&m->rechokeTimer);
     deleteTimer(&m->refillUpkeepTimer);
+    deleteTimer(&m->queueTimer);
 }
 
 void tr_peerMgrFree(tr_peerMgr* manager)
@@ -423,30 +459,17 @@ void tr_peerMgrFree(tr_peerMgr* manager)
 ****
 ***/
 
-void tr_peerMgrOnBlocklistChanged(tr_peerMgr* mgr)
-{
-    /* we cache whether or not a peer is blocklisted...
-       since the blocklist has changed, erase that cached value */
-    for (auto* tor : mgr->session->torrents)
-    {
-        tr_swarm* s = tor->swarm;
-
-        for (int i = 0, n = tr_ptrArraySize(&s->pool); i < n; ++i)
-        {
-            auto* const atom = static_cast<struct peer_atom*>(tr_ptrArrayNth(&s->pool, i));
-            atom->blocklisted = -1;
-        }
-    }
-}
-
+/* we cache whether or not a peer is blocklisted, and recheck
+   whenever the blocklist has changed since we last checked */
 static bool isAtomBlocklisted(tr_session const* session, struct peer_atom* atom)
 {
-    if (atom->blocklisted < 0)
+    if (auto const generation = session->blocklist_index.generation(); atom->blocklist_generation != generation)
     {
-        atom->blocklisted = (int8_t)tr_sessionIsAddressBlocked(session, &atom->addr);
+        atom->blocklisted = tr_sessionIsAddressBlocked(session, &atom->addr);
+        atom->blocklist_generation = generation;
     }
 
-    return atom->blocklisted != 0;
+    return atom->blocklisted;
 }
 
 /***
@@ -748,19 +771,16 @@ void tr_peerMgrPieceCompleted(tr_torrent* tor, tr_piece_index_t p)
     tr_swarm* const s = tor->swarm;
 
     /* walk through our peers */
-    for (int i = 0, n = tr_ptrArraySize(&s->peers); i < n; ++i)
+    for (int i = 0, n = tr_ptrArraySize(&s->peers); i < n && !pieceCameFromPeers; ++i)
     {
-        auto* peer = static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, i));
-
-        // notify the peer that we now have this piece
-        peer->on_piece_completed(p);
-
-        if (!pieceCameFromPeers)
-        {
-            pieceCameFromPeers = peer->blame.test(p);
-        }
+        auto const* const peer = static_cast<tr_peerMsgs const*>(tr_ptrArrayNth(&s->peers, i));
+        pieceCameFromPeers = peer->blame.test(p);
     }
 
+    // the peers are told about it on the next pulse, along with
+    // any other pieces that get completed before then
+    s->pendingHaves.push_back(p);
+
     if (pieceCameFromPeers) /* webseed downloads don't belong in announce totals */
     {
         tr_announcerAddBytes(tor, TR_ANN_DOWN, tor->pieceSize(p));
@@ -820,8 +840,7 @@ static void peerCallbackFunc(tr_peer* peer, tr_peer_event const* e, void* vs)
     case TR_PEER_CLIENT_GOT_HAVE_ALL:
     case TR_PEER_CLIENT_GOT_HAVE_NONE:
     case TR_PEER_CLIENT_GOT_BITFIELD:
-        /* TODO: if we don't need these, should these events be removed? */
-        /* noop */
+        s->desiredAvailableIsDirty = true;
         break;
 
     case TR_PEER_CLIENT_GOT_REJ:
@@ -935,7 +954,6 @@ static struct peer_atom* ensureAtomExists(
         a->fromFirst = from;
         a->fromBest = from;
         a->shelf_date = tr_time() + getDefaultShelfLife(from) + jitter;
-        a->blocklisted = -1;
         tr_ptrArrayInsertSorted(&s->pool, a, compareAtomsByAddress);
 
         tordbg(s, "got a new atom: %s", tr_atomAddrStr(a));
@@ -978,7 +996,9 @@ static void createBitTorrentPeer(tr_torrent* tor, tr_peerIo* io, struct peer_ato
     atom->peer = peer;
 
     tr_ptrArrayInsertSorted(&swarm->peers, peer, peerCompare);
+    swarm->pexIsDirty = true;
     ++swarm->stats.peerCount;
+    swarm->desiredAvailableIsDirty = true;
     ++swarm->stats.peerFromCount[atom->fromFirst];
 
     TR_ASSERT(swarm->stats.peerCount == tr_ptrArraySize(&swarm->peers));
@@ -1143,6 +1163,41 @@ void tr_peerMgrAddIncoming(tr_peerMgr* manager, tr_address* addr, tr_port port,
     }
 }
 
+#ifdef LIBTRANSMISSION_BENCH_HOOKS
+
+void tr_peerMgrAddOutgoing(tr_torrent* tor, tr_address const* addr, tr_port port, struct tr_peer_socket const socket)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    auto const lock = tor->unique_lock();
+
+    tr_swarm* const s = tor->swarm;
+    tr_peerMgr* const mgr = s->manager;
+    tr_peerIo* const io = tr_peerIoNewOutgoingConnected(
+        mgr->session,
+        mgr->session->bandwidth,
+        addr,
+        port,
+        tor->info.hash,
+        tor->completeness == TR_SEED,
+        socket);
+    tr_handshake* const handshake = tr_handshakeNew(io, mgr->session->encryptionMode, on_handshake_done, mgr);
+
+    tr_peerIoUnref(io); /* balanced by the initial ref in tr_peerIoNewOutgoingConnected() */
+
+    tr_ptrArrayInsertSorted(&s->outgoingHandshakes, handshake, handshakeCompare);
+}
+
+size_t tr_peerMgrHandshakeCount(tr_torrent const* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    auto const lock = tor->unique_lock();
+
+    tr_swarm const* const s = tor->swarm;
+    return static_cast<size_t>(tr_ptrArraySize(&s->manager->incomingHandshakes) + tr_ptrArraySize(&s->outgoingHandshakes));
+}
+
+#endif
+
 void tr_peerMgrSetSwarmIsAllSeeds(tr_torrent* tor)
 {
     auto const lock = tor->unique_lock();
@@ -1421,8 +1476,41 @@ int tr_peerMgrGetPeers(tr_torrent const* tor, tr_pex** setme_pex, uint8_t af, ui
     return count;
 }
 
+std::string const& tr_peerMgrGetPexMessage(tr_torrent* tor, uint32_t* version)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(version != nullptr);
+    auto const lock = tor->unique_lock();
+
+    tr_swarm* const s = tor->swarm;
+    auto const now = tr_time();
+
+    if (s->pexIsDirty && s->pexBuiltAt != now)
+    {
+        auto peers = std::vector<tr_pex>{};
+
+        for (auto const af : { TR_AF_INET, TR_AF_INET6 })
+        {
+            tr_pex* pex = nullptr;
+            int const n = tr_peerMgrGetPeers(tor, &pex, af, TR_PEERS_CONNECTED, int(PexSnapshot::MaxPeers));
+            peers.insert(std::end(peers), pex, pex + n);
+            tr_free(pex);
+        }
+
+        std::sort(std::begin(peers), std::end(peers), [](auto const& a, auto const& b) { return tr_pexCompare(&a, &b) < 0; });
+        s->pex.update(std::move(peers));
+        s->pexIsDirty = false;
+        s->pexBuiltAt = now;
+    }
+
+    auto const& message = s->pex.message(*version);
+    *version = s->pex.version();
+    return message;
+}
+
 static void atomPulse(evutil_socket_t, short, void*);
 static void bandwidthPulse(evutil_socket_t, short, void*);
+static void queuePulse(evutil_socket_t, short, void*);
 static void rechokePulse(evutil_socket_t, short, void*);
 static void reconnectPulse(evutil_socket_t, short, void*);
 
@@ -1454,6 +1542,20 @@ static void ensureMgrTimersExist(struct tr_peerMgr* m)
     {
         m->refillUpkeepTimer = createTimer(m->session, RefillUpkeepPeriodMsec, refillUpkeep, m);
     }
+
+    if (m->queueTimer == nullptr)
+    {
+        m->queueTimer = createTimer(m->session, QueuePeriodMsec, queuePulse, m);
+    }
+}
+
+void tr_peerMgrQueueChanged(tr_peerMgr* manager)
+{
+    if (manager != nullptr && manager->queueTimer != nullptr)
+    {
+        // pump the queues on the next pass through the event loop
+        tr_timerAdd(manager->queueTimer, 0, 0);
+    }
 }
 
 void tr_peerMgrStartTorrent(tr_torrent* tor)
@@ -1477,6 +1579,7 @@ static void removeAllPeers(tr_swarm*);
 static void stopSwarm(tr_swarm* swarm)
 {
     swarm->isRunning = false;
+    swarm->pendingHaves.clear();
 
     removeAllPeers(swarm);
 
@@ -1641,29 +1744,9 @@ bool tr_peerIsSeed(tr_peer const* peer)
     return (peer != nullptr) && ((peer->progress >= 1.0) || atomIsSeed(peer->atom));
 }
 
-/* count how many bytes we want that connected peers have */
-uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
+static uint64_t countDesiredAvailable(tr_torrent const* tor, tr_swarm const* s)
 {
-    TR_ASSERT(tr_isTorrent(tor));
-
-    // common shortcuts...
-
-    if (!tor->isRunning || tor->isStopping || tr_torrentIsSeed(tor) || !tr_torrentHasMetadata(tor))
-    {
-        return 0;
-    }
-
-    tr_swarm const* const s = tor->swarm;
-    if (s == nullptr || !s->isRunning)
-    {
-        return 0;
-    }
-
     size_t const n_peers = tr_ptrArraySize(&s->peers);
-    if (n_peers == 0)
-    {
-        return 0;
-    }
 
     tr_peer const** const peers = (tr_peer const**)tr_ptrArrayBase(&s->peers);
     for (size_t i = 0; i < n_peers; ++i)
@@ -1704,6 +1787,46 @@ uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
     return desired_available;
 }
 
+/* count how many bytes we want that connected peers have */
+uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    // common shortcuts...
+
+    if (!tor->isRunning || tor->isStopping || tr_torrentIsSeed(tor) || !tr_torrentHasMetadata(tor))
+    {
+        return 0;
+    }
+
+    tr_swarm* const s = tor->swarm;
+    if (s == nullptr || !s->isRunning || s->stats.peerCount == 0)
+    {
+        return 0;
+    }
+
+    auto const has_total = tor->hasTotal();
+    auto const size_when_done = tor->completion.sizeWhenDone();
+    if (s->desiredAvailableIsDirty || s->desiredAvailableHasTotal != has_total ||
+        s->desiredAvailableSizeWhenDone != size_when_done)
+    {
+        s->desiredAvailable = countDesiredAvailable(tor, s);
+        s->desiredAvailableHasTotal = has_total;
+        s->desiredAvailableSizeWhenDone = size_when_done;
+        s->desiredAvailableIsDirty = false;
+    }
+
+    return s->desiredAvailable;
+}
+
+void tr_peerMgrFilesChanged(tr_torrent* tor)
+{
+    if (tr_swarm* const s = tor->swarm; s != nullptr)
+    {
+        s->desiredAvailableIsDirty = true;
+    }
+}
+
 double* tr_peerMgrWebSpeeds_KBps(tr_torrent const* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1774,7 +1897,7 @@ static auto getPeerStats(tr_peerMsgs const* peer, time_t now, uint64_t now_msec)
         *pch++ = 'T';
     }
 
-    if (peer->swarm->optimistic == peer)
+    if (peer->swarm->choker.optimistic() == peer)
     {
         *pch++ = 'O';
     }
@@ -1871,7 +1994,7 @@ void tr_peerMgrClearInterest(tr_torrent* tor)
 }
 
 /* does this peer have any pieces that we want? */
-static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_interesting, tr_peer const* const peer)
+static bool isPeerInteresting(tr_torrent* const tor, std::vector<bool> const& piece_is_interesting, tr_peer const* const peer)
 {
     /* these cases should have already been handled by the calling code... */
     TR_ASSERT(!tr_torrentIsSeed(tor));
@@ -1893,39 +2016,21 @@ static bool isPeerInteresting(tr_torrent* const tor, bool const* const piece_is_
     return false;
 }
 
-enum tr_rechoke_state
-{
-    RECHOKE_STATE_GOOD,
-    RECHOKE_STATE_UNTESTED,
-    RECHOKE_STATE_BAD
-};
-
-struct tr_rechoke_info
+static constexpr bool isBetterRechokeInfo(tr_rechoke_info const& a, tr_rechoke_info const& b)
 {
-    tr_peerMsgs* peer;
-    int salt;
-    int rechoke_state;
-};
-
-static constexpr int compare_rechoke_info(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct tr_rechoke_info const*>(va);
-    auto const* const b = static_cast<struct tr_rechoke_info const*>(vb);
-
-    if (a->rechoke_state != b->rechoke_state)
+    if (a.rechoke_state != b.rechoke_state)
     {
-        return a->rechoke_state - b->rechoke_state;
+        return a.rechoke_state < b.rechoke_state;
     }
 
-    return a->salt - b->salt;
+    return a.salt < b.salt;
 }
 
 /* determines who we send "interested" messages to */
 static void rechokeDownloads(tr_swarm* s)
 {
     int maxPeers = 0;
-    int rechoke_count = 0;
-    struct tr_rechoke_info* rechoke = nullptr;
+    auto& rechoke = s->rechoke_infos;
     auto constexpr MinInterestingPeers = 5;
     int const peerCount = tr_ptrArraySize(&s->peers);
     time_t const now = tr_time();
@@ -2012,15 +2117,18 @@ static void rechokeDownloads(tr_swarm* s)
 
     s->maxPeers = maxPeers;
 
+    rechoke.clear();
+
     if (peerCount > 0)
     {
         tr_torrent const* const tor = s->tor;
-        int const n = tor->info.pieceCount;
+        auto const n = tor->info.pieceCount;
 
         /* build a bitfield of interesting pieces... */
-        bool* const piece_is_interesting = tr_new(bool, n);
+        auto& piece_is_interesting = s->piece_is_interesting;
+        piece_is_interesting.resize(n);
 
-        for (int i = 0; i < n; ++i)
+        for (tr_piece_index_t i = 0; i < n; ++i)
         {
             piece_is_interesting[i] = tor->pieceIsWanted(i) && !tor->hasPiece(i);
         }
@@ -2061,76 +2169,32 @@ static void rechokeDownloads(tr_swarm* s)
                     rechoke_state = RECHOKE_STATE_BAD;
                 }
 
-                if (rechoke == nullptr)
-                {
-                    rechoke = tr_new(struct tr_rechoke_info, peerCount);
-                }
-
-                rechoke[rechoke_count].peer = peer;
-                rechoke[rechoke_count].rechoke_state = rechoke_state;
-                rechoke[rechoke_count].salt = tr_rand_int_weak(INT_MAX);
-                rechoke_count++;
+                rechoke.push_back({ peer, tr_rand_int_weak(INT_MAX), rechoke_state });
             }
         }
-
-        tr_free(piece_is_interesting);
     }
 
-    if ((rechoke != nullptr) && (rechoke_count > 0))
-    {
-        qsort(rechoke, rechoke_count, sizeof(struct tr_rechoke_info), compare_rechoke_info);
-    }
+    /* now that we know which & how many peers to be interested in... update the peer interest.
+     * We only need to know which peers make the cut, not their order, so a partial sort is enough. */
 
-    /* now that we know which & how many peers to be interested in... update the peer interest */
+    s->interestedCount = std::min(maxPeers, int(std::size(rechoke)));
 
-    s->interestedCount = std::min(maxPeers, rechoke_count);
-
-    for (int i = 0; i < rechoke_count; ++i)
+    auto const cut = std::begin(rechoke) + s->interestedCount;
+    if (cut != std::end(rechoke))
     {
-        rechoke[i].peer->set_interested(i < s->interestedCount);
+        std::nth_element(std::begin(rechoke), cut, std::end(rechoke), isBetterRechokeInfo);
     }
 
-    /* cleanup */
-    tr_free(rechoke);
+    for (auto it = std::begin(rechoke); it != std::end(rechoke); ++it)
+    {
+        it->peer->set_interested(it < cut);
+    }
 }
 
 /**
 ***
 **/
 
-struct ChokeData
-{
-    bool isInterested;
-    bool wasChoked;
-    bool isChoked;
-    int rate;
-    int salt;
-    tr_peerMsgs* msgs;
-};
-
-static int compareChoke(void const* va, void const* vb)
-{
-    auto const* const a = static_cast<struct ChokeData const*>(va);
-    auto const* const b = static_cast<struct ChokeData const*>(vb);
-
-    if (a->rate != b->rate) /* prefer higher overall speeds */
-    {
-        return a->rate > b->rate ? -1 : 1;
-    }
-
-    if (a->wasChoked != b->wasChoked) /* prefer unchoked */
-    {
-        return a->wasChoked ? 1 : -1;
-    }
-
-    if (a->salt != b->salt) /* random order */
-    {
-        return a->salt - b->salt;
-    }
-
-    return 0;
-}
-
 /* is this a new connection? */
 static bool isNew(tr_peerMsgs const* msgs)
 {
@@ -2180,30 +2244,14 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
     auto const lock = s->manager->unique_lock();
 
     int const peerCount = tr_ptrArraySize(&s->peers);
-    tr_peerMsgs** peers = (tr_peerMsgs**)tr_ptrArrayBase(&s->peers);
-    struct ChokeData* choke = tr_new0(struct ChokeData, peerCount);
+    auto** const peers = reinterpret_cast<tr_peerMsgs**>(tr_ptrArrayBase(&s->peers));
     tr_session const* session = s->manager->session;
     bool const chokeAll = !tr_torrentIsPieceTransferAllowed(s->tor, TR_CLIENT_TO_PEER);
     bool const isMaxedOut = isBandwidthMaxedOut(s->tor->bandwidth, now, TR_UP);
 
-    /* an optimistic unchoke peer's "optimistic"
-     * state lasts for N calls to rechokeUploads(). */
-    if (s->optimisticUnchokeTimeScaler > 0)
-    {
-        s->optimisticUnchokeTimeScaler--;
-    }
-    else
-    {
-        s->optimistic = nullptr;
-    }
-
-    int size = 0;
-
-    /* sort the peers by preference and rate */
     for (int i = 0; i < peerCount; ++i)
     {
         auto* const peer = peers[i];
-        struct peer_atom* const atom = peer->atom;
 
         if (tr_peerIsSeed(peer))
         {
@@ -2215,92 +2263,35 @@ static void rechokeUploads(tr_swarm* s, uint64_t const now)
             /* choke everyone if we're not uploading */
             peer->set_choke(true);
         }
-        else if (peer != s->optimistic)
+        else
         {
-            struct ChokeData* n = &choke[size++];
-            n->msgs = peer;
-            n->isInterested = peer->is_peer_interested();
-            n->wasChoked = peer->is_peer_choked();
-            n->rate = getRate(s->tor, atom, now);
-            n->salt = tr_rand_int_weak(INT_MAX);
-            n->isChoked = true;
+            auto candidate = Choker::Peer{};
+            candidate.msgs = peer;
+            candidate.rate = getRate(s->tor, peer->atom, now);
+            candidate.is_interested = peer->is_peer_interested();
+            candidate.is_choked = peer->is_peer_choked();
+            candidate.is_new = isNew(peer);
+            s->choker.add(candidate);
         }
     }
 
-    qsort(choke, size, sizeof(struct ChokeData), compareChoke);
+    auto const& decisions = s->choker.rechoke(
+        tr_torrentGetChokeAlgorithm(s->tor),
+        std::max(session->uploadSlotsPerTorrent, 0),
+        tr_torrentIsSeed(s->tor),
+        isMaxedOut);
 
-    /**
-     * Reciprocation and number of uploads capping is managed by unchoking
-     * the N peers which have the best upload rate and are interested.
-     * This maximizes the client's download rate. These N peers are
-     * referred to as downloaders, because they are interested in downloading
-     * from the client.
-     *
-     * Peers which have a better upload rate (as compared to the downloaders)
-     * but aren't interested get unchoked. If they become interested, the
-     * downloader with the worst upload rate gets choked. If a client has
-     * a complete file, it uses its upload rate rather than its download
-     * rate to decide which peers to unchoke.
-     *
-     * If our bandwidth is maxed out, don't unchoke any more peers.
-     */
-    int checkedChokeCount = 0;
-    int unchokedInterested = 0;
-
-    for (int i = 0; i < size && unchokedInterested < session->uploadSlotsPerTorrent; ++i)
+    for (auto const& [msgs, choke] : decisions)
     {
-        choke[i].isChoked = isMaxedOut ? choke[i].wasChoked : false;
-
-        ++checkedChokeCount;
-
-        if (choke[i].isInterested)
-        {
-            ++unchokedInterested;
-        }
+        msgs->set_choke(choke);
     }
-
-    /* optimistic unchoke */
-    if (s->optimistic == nullptr && !isMaxedOut && checkedChokeCount < size)
-    {
-        auto randPool = std::vector<ChokeData*>{};
-
-        for (int i = checkedChokeCount; i < size; ++i)
-        {
-            if (choke[i].isInterested)
-            {
-                tr_peerMsgs const* msgs = choke[i].msgs;
-                int const x = isNew(msgs) ? 3 : 1;
-
-                for (int y = 0; y < x; ++y)
-                {
-                    randPool.push_back(&choke[i]);
-                }
-            }
-        }
-
-        auto const n = std::size(randPool);
-        if (n != 0)
-        {
-            auto* c = randPool[tr_rand_int_weak(n)];
-            c->isChoked = false;
-            s->optimistic = c->msgs;
-            s->optimisticUnchokeTimeScaler = OptimisticUnchokeMultiplier;
-        }
-    }
-
-    for (int i = 0; i < size; ++i)
-    {
-        choke[i].msgs->set_choke(choke[i].isChoked);
-    }
-
-    /* cleanup */
-    tr_free(choke);
 }
 
 static void rechokePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     auto const lock = mgr->unique_lock();
+    auto const timer = mgr->session->metrics.time(tr_metrics::Timer::RechokePulse);
     uint64_t const now = tr_time_msec();
 
     for (auto* tor : mgr->session->torrents)
@@ -2438,7 +2429,10 @@ static void removePeer(tr_peer* peer)
     atom->time = tr_time();
 
     tr_ptrArrayRemoveSortedPointer(&s->peers, peer, peerCompare);
+    s->pexIsDirty = true;
+    s->choker.remove(static_cast<tr_peerMsgs const*>(peer));
     --s->stats.peerCount;
+    s->desiredAvailableIsDirty = true;
     --s->stats.peerFromCount[atom->fromFirst];
 
     TR_ASSERT(s->stats.peerCount == tr_ptrArraySize(&s->peers));
@@ -2633,20 +2627,29 @@ static void pumpAllPeers(tr_peerMgr* mgr)
     for (auto* tor : mgr->session->torrents)
     {
         tr_swarm* s = tor->swarm;
+        auto const haves = std::move(s->pendingHaves);
+        s->pendingHaves.clear();
 
         for (int j = 0, n = tr_ptrArraySize(&s->peers); j < n; ++j)
         {
-            static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, j))->pulse();
+            auto* const peer = static_cast<tr_peerMsgs*>(tr_ptrArrayNth(&s->peers, j));
+
+            if (!std::empty(haves))
+            {
+                peer->on_pieces_completed(haves);
+            }
+
+            peer->pulse();
         }
     }
 }
 
-static void queuePulse(tr_session* session, tr_direction dir)
+static void pumpQueue(tr_session* session, tr_direction dir)
 {
     TR_ASSERT(tr_isSession(session));
     TR_ASSERT(tr_isDirection(dir));
 
-    if (tr_sessionGetQueueEnabled(session, dir))
+    if (tr_sessionGetQueueEnabled(session, dir) && session->torrentQueue.countWaiting(dir) != 0)
     {
         auto const n = tr_sessionCountQueueFreeSlots(session, dir);
 
@@ -2662,11 +2665,28 @@ static void queuePulse(tr_session* session, tr_direction dir)
     }
 }
 
+static void queuePulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
+{
+    auto* mgr = static_cast<tr_peerMgr*>(vmgr);
+    auto const lock = mgr->unique_lock();
+    tr_session* session = mgr->session;
+    auto const timer = session->metrics.time(tr_metrics::Timer::QueuePulse);
+
+    if (!session->isClosing())
+    {
+        pumpQueue(session, TR_UP);
+        pumpQueue(session, TR_DOWN);
+    }
+
+    tr_timerAddMsec(mgr->queueTimer, QueuePeriodMsec);
+}
+
 static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     auto const lock = mgr->unique_lock();
     tr_session* session = mgr->session;
+    auto const timer = session->metrics.time(tr_metrics::Timer::BandwidthPulse);
 
     pumpAllPeers(mgr);
 
@@ -2698,10 +2718,6 @@ static void bandwidthPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
         tor->swarm->stats.activeWebseedCount = countActiveWebseeds(tor->swarm);
     }
 
-    /* pump the queues */
-    queuePulse(session, TR_UP);
-    queuePulse(session, TR_DOWN);
-
     reconnectPulse(0, 0, mgr);
 
     tr_timerAddMsec(mgr->bandwidthTimer, BandwidthPeriodMsec);
@@ -2772,6 +2788,7 @@ static void atomPulse(evutil_socket_t /*fd*/, short /*what*/, void* vmgr)
 {
     auto* mgr = static_cast<tr_peerMgr*>(vmgr);
     auto const lock = mgr->unique_lock();
+    auto const timer = mgr->session->metrics.time(tr_metrics::Timer::AtomPulse);
 
     for (auto* tor : mgr->session->torrents)
     {
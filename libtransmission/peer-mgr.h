@@ -13,6 +13,7 @@
 #endif
 
 #include <inttypes.h> /* uint16_t */
+#include <string>
 
 #ifdef _WIN32
 #include <winsock2.h> /* struct in_addr */
@@ -89,6 +90,20 @@ size_t tr_peerMgrCountActiveRequestsToPeer(tr_torrent const* torrent, tr_peer co
 
 void tr_peerMgrAddIncoming(tr_peerMgr* manager, tr_address* addr, tr_port port, struct tr_peer_socket const socket);
 
+#ifdef LIBTRANSMISSION_BENCH_HOOKS
+
+/**
+ * Starts an outgoing handshake over a socket that the caller already
+ * connected. The usual outgoing path won't dial loopback addresses,
+ * so this is how in-process tests and benchmarks wire sessions together.
+ */
+void tr_peerMgrAddOutgoing(tr_torrent* tor, tr_address const* addr, tr_port port, struct tr_peer_socket const socket);
+
+/** @brief How many handshakes are still in progress, both incoming ones and the torrent's outgoing ones */
+size_t tr_peerMgrHandshakeCount(tr_torrent const* tor);
+
+#endif
+
 tr_pex* tr_peerMgrCompactToPex(
     void const* compact,
     size_t compactLen,
@@ -120,6 +135,18 @@ int tr_peerMgrGetPeers(
     uint8_t peer_list_mode,
     int max_peer_count);
 
+/**
+ * @brief the ut_pex payload that tells a peer what's changed in the swarm's
+ *        list of connected peers since the version it last sent.
+ *
+ * All of a swarm's peers share one snapshot of that list, which is rebuilt
+ * at most once a second. Peers that were at the same version get the same
+ * payload. `version` is updated to the snapshot's current version.
+ *
+ * @return the bencoded payload, or an empty string if nothing changed.
+ */
+std::string const& tr_peerMgrGetPexMessage(tr_torrent* tor, uint32_t* version);
+
 void tr_peerMgrStartTorrent(tr_torrent* tor);
 
 void tr_peerMgrStopTorrent(tr_torrent* tor);
@@ -132,9 +159,15 @@ void tr_peerMgrTorrentAvailability(tr_torrent const* tor, int8_t* tab, unsigned
 
 uint64_t tr_peerMgrGetDesiredAvailable(tr_torrent const* tor);
 
+/* Call when the torrent's wanted files or file priorities change. */
+void tr_peerMgrFilesChanged(tr_torrent* tor);
+
 void tr_peerMgrOnTorrentGotMetainfo(tr_torrent* tor);
 
-void tr_peerMgrOnBlocklistChanged(tr_peerMgr* manager);
+/* Schedule a pass over the download and seed queues to start any
+ * queued torrents that now have a free slot. Call this whenever a
+ * slot may have opened up instead of waiting for the next poll. */
+void tr_peerMgrQueueChanged(tr_peerMgr* manager);
 
 struct tr_peer_stat* tr_peerMgrPeerStats(tr_torrent const* tor, int* setmeCount);
 
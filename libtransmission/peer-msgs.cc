@@ -14,6 +14,7 @@
 #include <iostream>
 #include <memory> // std::unique_ptr
 #include <optional>
+#include <vector>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
@@ -36,6 +37,7 @@
 #include "tr-dht.h"
 #include "utils.h"
 #include "variant.h"
+#include "verify.h"
 #include "version.h"
 
 #ifndef EBADMSG
@@ -189,7 +191,7 @@ static void peerPulse(void* vmsgs);
 static void pexPulse(evutil_socket_t fd, short what, void* vmsgs);
 static void protocolSendCancel(tr_peerMsgsImpl* msgs, struct peer_request const& req);
 static void protocolSendChoke(tr_peerMsgsImpl* msgs, bool choke);
-static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index);
+static void protocolSendHaves(tr_peerMsgsImpl* msgs, std::vector<tr_piece_index_t> const& pieces);
 static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port);
 static void sendInterest(tr_peerMsgsImpl* msgs, bool b);
 static void sendLtepHandshake(tr_peerMsgsImpl* msgs);
@@ -285,8 +287,6 @@ public:
         }
 
         evbuffer_free(this->outMessages);
-        tr_free(this->pex6);
-        tr_free(this->pex);
     }
 
     bool is_transferring_pieces(uint64_t now, tr_direction direction, unsigned int* setme_Bps) const override
@@ -395,9 +395,9 @@ public:
         peerPulse(this);
     }
 
-    void on_piece_completed(tr_piece_index_t piece) override
+    void on_pieces_completed(std::vector<tr_piece_index_t> const& pieces) override
     {
-        protocolSendHave(this, piece);
+        protocolSendHaves(this, pieces);
 
         // since we have more pieces now, we might not be interested in this peer
         update_interest();
@@ -595,8 +595,6 @@ public:
     uint8_t state = AwaitingBtLength;
     uint8_t ut_pex_id = 0;
     uint8_t ut_metadata_id = 0;
-    uint16_t pexCount = 0;
-    uint16_t pexCount6 = 0;
 
     tr_port dht_port = 0;
 
@@ -619,8 +617,8 @@ public:
     int peerAskedForMetadata[MetadataReqQ] = {};
     int peerAskedForMetadataCount = 0;
 
-    tr_pex* pex = nullptr;
-    tr_pex* pex6 = nullptr;
+    // the version of the swarm's pex snapshot that we last sent this peer
+    uint32_t pexVersion = 0;
 
     time_t clientSentAnythingAt = 0;
 
@@ -772,15 +770,21 @@ static void protocolSendPort(tr_peerMsgsImpl* msgs, uint16_t port)
     evbuffer_add_uint16(out, port);
 }
 
-static void protocolSendHave(tr_peerMsgsImpl* msgs, tr_piece_index_t index)
+static void protocolSendHaves(tr_peerMsgsImpl* msgs, std::vector<tr_piece_index_t> const& pieces)
 {
     struct evbuffer* out = msgs->outMessages;
 
-    evbuffer_add_uint32(out, sizeof(uint8_t) + sizeof(uint32_t));
-    evbuffer_add_uint8(out, BtHave);
-    evbuffer_add_uint32(out, index);
+    auto constexpr MsgLen = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+    evbuffer_expand(out, MsgLen * std::size(pieces));
 
-    dbgmsg(msgs, "sending Have %u", index);
+    for (auto const index : pieces)
+    {
+        evbuffer_add_uint32(out, sizeof(uint8_t) + sizeof(uint32_t));
+        evbuffer_add_uint8(out, BtHave);
+        evbuffer_add_uint32(out, index);
+    }
+
+    dbgmsg(msgs, "sending %zu Haves", std::size(pieces));
     dbgOutMessageLen(msgs);
     pokeBatchPeriod(msgs, LowPriorityIntervalSecs);
 }
@@ -1454,6 +1458,40 @@ static void updatePeerProgress(tr_peerMsgsImpl* msgs)
     msgs->update_interest();
 }
 
+// Like popNextRequest(), but skips requests for pieces that haven't been
+// checked since the torrent was resumed. Those are queued to be checked in
+// the background and are answered on a later pulse, once they pass. If a
+// piece can't be read, it's marked missing and its requests are rejected.
+static bool popNextReadyRequest(tr_peerMsgsImpl* msgs, struct peer_request* setme)
+{
+    auto* const tor = msgs->torrent;
+
+    for (int i = 0; i < msgs->pendingReqsToClient; ++i)
+    {
+        struct peer_request const* req = msgs->peerAskedFor + i;
+
+        if (requestIsValid(msgs, req) && tor->hasPiece(req->index) && !tor->isPieceChecked(req->index))
+        {
+            tr_verifyPieceAdd(tor, req->index);
+            continue;
+        }
+
+        *setme = *req;
+
+        tr_removeElementFromArray(msgs->peerAskedFor, i, sizeof(struct peer_request), msgs->pendingReqsToClient);
+        --msgs->pendingReqsToClient;
+
+        if (i < msgs->prefetchCount)
+        {
+            --msgs->prefetchCount;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
 static void prefetchPieces(tr_peerMsgsImpl* msgs)
 {
     if (!msgs->session->isPrefetchEnabled)
@@ -2191,10 +2229,8 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     ***  Data Blocks
     **/
 
-    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->block_size && popNextRequest(msgs, &req))
+    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->block_size && popNextReadyRequest(msgs, &req))
     {
-        --msgs->prefetchCount;
-
         if (requestIsValid(msgs, &req) && msgs->torrent->hasPiece(req.index))
         {
             uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
@@ -2219,19 +2255,6 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
             iovec[0].iov_len = req.length;
             evbuffer_commit_space(out, iovec, 1);
 
-            /* check the piece if it needs checking... */
-            if (!err)
-            {
-                err = !msgs->torrent->ensurePieceIsChecked(req.index);
-                if (err)
-                {
-                    tr_torrentSetLocalError(
-                        msgs->torrent,
-                        _("Please Verify Local Data! Piece #%zu is corrupt."),
-                        (size_t)req.index);
-                }
-            }
-
             if (err)
             {
                 if (fext)
@@ -2241,6 +2264,17 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
             }
             else
             {
+                /* the block is going out now anyway, so send any pending
+                 * protocol messages along with it in the same write */
+                if (auto const len = evbuffer_get_length(msgs->outMessages); len != 0)
+                {
+                    dbgmsg(msgs, "flushing outMessages with a block (length is %zu)", len);
+                    tr_peerIoWriteBuf(msgs->io, msgs->outMessages, false);
+                    msgs->outMessagesBatchedAt = 0;
+                    msgs->outMessagesBatchPeriod = LowPriorityIntervalSecs;
+                    bytesWritten += len;
+                }
+
                 size_t const n = evbuffer_get_length(out);
                 dbgmsg(msgs, "sending block %u:%u->%u", req.index, req.offset, req.length);
                 TR_ASSERT(n == msglen);
@@ -2357,321 +2391,31 @@ static void tellPeerWhatWeHave(tr_peerMsgsImpl* msgs)
 ***
 **/
 
-/* some peers give us error messages if we send
-   more than this many peers in a single pex message
-   http://wiki.theory.org/BitTorrentPeerExchangeConventions */
-#define MAX_PEX_ADDED 50
-#define MAX_PEX_DROPPED 50
-
-struct PexDiffs
-{
-    tr_pex* added;
-    tr_pex* dropped;
-    tr_pex* elements;
-    int addedCount;
-    int droppedCount;
-    int elementCount;
-};
-
-static void pexAddedCb(void const* vpex, void* userData)
-{
-    auto* diffs = static_cast<PexDiffs*>(userData);
-    auto const* pex = static_cast<tr_pex const*>(vpex);
-
-    if (diffs->addedCount < MAX_PEX_ADDED)
-    {
-        diffs->added[diffs->addedCount++] = *pex;
-        diffs->elements[diffs->elementCount++] = *pex;
-    }
-}
-
-static constexpr void pexDroppedCb(void const* vpex, void* userData)
-{
-    auto* diffs = static_cast<PexDiffs*>(userData);
-    auto const* pex = static_cast<tr_pex const*>(vpex);
-
-    if (diffs->droppedCount < MAX_PEX_DROPPED)
-    {
-        diffs->dropped[diffs->droppedCount++] = *pex;
-    }
-}
-
-static constexpr void pexElementCb(void const* vpex, void* userData)
-{
-    auto* diffs = static_cast<PexDiffs*>(userData);
-    auto const* pex = static_cast<tr_pex const*>(vpex);
-
-    diffs->elements[diffs->elementCount++] = *pex;
-}
-
-using tr_set_func = void (*)(void const* element, void* userData);
-
-/**
- * @brief find the differences and commonalities in two sorted sets
- * @param a the first set
- * @param aCount the number of elements in the set 'a'
- * @param b the second set
- * @param bCount the number of elements in the set 'b'
- * @param compare the sorting method for both sets
- * @param elementSize the sizeof the element in the two sorted sets
- * @param in_a called for items in set 'a' but not set 'b'
- * @param in_b called for items in set 'b' but not set 'a'
- * @param in_both called for items that are in both sets
- * @param userData user data passed along to in_a, in_b, and in_both
- */
-static void tr_set_compare(
-    void const* va,
-    size_t aCount,
-    void const* vb,
-    size_t bCount,
-    tr_voidptr_compare_func compare,
-    size_t elementSize,
-    tr_set_func in_a_cb,
-    tr_set_func in_b_cb,
-    tr_set_func in_both_cb,
-    void* userData)
-{
-    auto* a = static_cast<uint8_t const*>(va);
-    auto* b = static_cast<uint8_t const*>(vb);
-    uint8_t const* aend = a + elementSize * aCount;
-    uint8_t const* bend = b + elementSize * bCount;
-
-    while (a != aend || b != bend)
-    {
-        if (a == aend)
-        {
-            (*in_b_cb)(b, userData);
-            b += elementSize;
-        }
-        else if (b == bend)
-        {
-            (*in_a_cb)(a, userData);
-            a += elementSize;
-        }
-        else
-        {
-            int const val = (*compare)(a, b);
-
-            if (val == 0)
-            {
-                (*in_both_cb)(a, userData);
-                a += elementSize;
-                b += elementSize;
-            }
-            else if (val < 0)
-            {
-                (*in_a_cb)(a, userData);
-                a += elementSize;
-            }
-            else if (val > 0)
-            {
-                (*in_b_cb)(b, userData);
-                b += elementSize;
-            }
-        }
-    }
-}
-
 static void sendPex(tr_peerMsgsImpl* msgs)
 {
     if (msgs->peerSupportsPex && tr_torrentAllowsPex(msgs->torrent))
     {
-        PexDiffs diffs;
-        PexDiffs diffs6;
-        tr_pex* newPex = nullptr;
-        tr_pex* newPex6 = nullptr;
-        int const newCount = tr_peerMgrGetPeers(msgs->torrent, &newPex, TR_AF_INET, TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
-        int const newCount6 = tr_peerMgrGetPeers(msgs->torrent, &newPex6, TR_AF_INET6, TR_PEERS_CONNECTED, MAX_PEX_PEER_COUNT);
-
-        /* build the diffs */
-        diffs.added = tr_new(tr_pex, newCount);
-        diffs.addedCount = 0;
-        diffs.dropped = tr_new(tr_pex, msgs->pexCount);
-        diffs.droppedCount = 0;
-        diffs.elements = tr_new(tr_pex, newCount + msgs->pexCount);
-        diffs.elementCount = 0;
-        tr_set_compare(
-            msgs->pex,
-            msgs->pexCount,
-            newPex,
-            newCount,
-            tr_pexCompare,
-            sizeof(tr_pex),
-            pexDroppedCb,
-            pexAddedCb,
-            pexElementCb,
-            &diffs);
-        diffs6.added = tr_new(tr_pex, newCount6);
-        diffs6.addedCount = 0;
-        diffs6.dropped = tr_new(tr_pex, msgs->pexCount6);
-        diffs6.droppedCount = 0;
-        diffs6.elements = tr_new(tr_pex, newCount6 + msgs->pexCount6);
-        diffs6.elementCount = 0;
-        tr_set_compare(
-            msgs->pex6,
-            msgs->pexCount6,
-            newPex6,
-            newCount6,
-            tr_pexCompare,
-            sizeof(tr_pex),
-            pexDroppedCb,
-            pexAddedCb,
-            pexElementCb,
-            &diffs6);
+        auto const old_version = msgs->pexVersion;
+        auto const& payload = tr_peerMgrGetPexMessage(msgs->torrent, &msgs->pexVersion);
         dbgmsg(
             msgs,
-            "pex: old peer count %d+%d, new peer count %d+%d, added %d+%d, removed %d+%d",
-            msgs->pexCount,
-            msgs->pexCount6,
-            newCount,
-            newCount6,
-            diffs.addedCount,
-            diffs6.addedCount,
-            diffs.droppedCount,
-            diffs6.droppedCount);
-
-        if (diffs.addedCount == 0 && diffs.droppedCount == 0 && diffs6.addedCount == 0 && diffs6.droppedCount == 0)
-        {
-            tr_free(diffs.elements);
-            tr_free(diffs6.elements);
-        }
-        else
-        {
-            uint8_t* tmp = nullptr;
-            uint8_t* walk = nullptr;
-            evbuffer* const out = msgs->outMessages;
-
-            /* update peer */
-            tr_free(msgs->pex);
-            msgs->pex = diffs.elements;
-            msgs->pexCount = diffs.elementCount;
-            tr_free(msgs->pex6);
-            msgs->pex6 = diffs6.elements;
-            msgs->pexCount6 = diffs6.elementCount;
-
-            /* build the pex payload */
-            auto val = tr_variant{};
-            tr_variantInitDict(&val, 3); /* ipv6 support: left as 3: speed vs. likelihood? */
-
-            if (diffs.addedCount > 0)
-            {
-                /* "added" */
-                tmp = walk = tr_new(uint8_t, diffs.addedCount * 6);
-
-                for (int i = 0; i < diffs.addedCount; ++i)
-                {
-                    memcpy(walk, &diffs.added[i].addr.addr, 4);
-                    walk += 4;
-                    memcpy(walk, &diffs.added[i].port, 2);
-                    walk += 2;
-                }
-
-                TR_ASSERT(walk - tmp == diffs.addedCount * 6);
-                tr_variantDictAddRaw(&val, TR_KEY_added, tmp, walk - tmp);
-                tr_free(tmp);
-
-                /* "added.f"
-                 * unset each holepunch flag because we don't support it. */
-                tmp = walk = tr_new(uint8_t, diffs.addedCount);
-
-                for (int i = 0; i < diffs.addedCount; ++i)
-                {
-                    *walk++ = diffs.added[i].flags & ~ADDED_F_HOLEPUNCH;
-                }
-
-                TR_ASSERT(walk - tmp == diffs.addedCount);
-                tr_variantDictAddRaw(&val, TR_KEY_added_f, tmp, walk - tmp);
-                tr_free(tmp);
-            }
-
-            if (diffs.droppedCount > 0)
-            {
-                /* "dropped" */
-                tmp = walk = tr_new(uint8_t, diffs.droppedCount * 6);
-
-                for (int i = 0; i < diffs.droppedCount; ++i)
-                {
-                    memcpy(walk, &diffs.dropped[i].addr.addr, 4);
-                    walk += 4;
-                    memcpy(walk, &diffs.dropped[i].port, 2);
-                    walk += 2;
-                }
-
-                TR_ASSERT(walk - tmp == diffs.droppedCount * 6);
-                tr_variantDictAddRaw(&val, TR_KEY_dropped, tmp, walk - tmp);
-                tr_free(tmp);
-            }
-
-            if (diffs6.addedCount > 0)
-            {
-                /* "added6" */
-                tmp = walk = tr_new(uint8_t, diffs6.addedCount * 18);
-
-                for (int i = 0; i < diffs6.addedCount; ++i)
-                {
-                    memcpy(walk, &diffs6.added[i].addr.addr.addr6.s6_addr, 16);
-                    walk += 16;
-                    memcpy(walk, &diffs6.added[i].port, 2);
-                    walk += 2;
-                }
-
-                TR_ASSERT(walk - tmp == diffs6.addedCount * 18);
-                tr_variantDictAddRaw(&val, TR_KEY_added6, tmp, walk - tmp);
-                tr_free(tmp);
-
-                /* "added6.f"
-                 * unset each holepunch flag because we don't support it. */
-                tmp = walk = tr_new(uint8_t, diffs6.addedCount);
-
-                for (int i = 0; i < diffs6.addedCount; ++i)
-                {
-                    *walk++ = diffs6.added[i].flags & ~ADDED_F_HOLEPUNCH;
-                }
-
-                TR_ASSERT(walk - tmp == diffs6.addedCount);
-                tr_variantDictAddRaw(&val, TR_KEY_added6_f, tmp, walk - tmp);
-                tr_free(tmp);
-            }
-
-            if (diffs6.droppedCount > 0)
-            {
-                /* "dropped6" */
-                tmp = walk = tr_new(uint8_t, diffs6.droppedCount * 18);
-
-                for (int i = 0; i < diffs6.droppedCount; ++i)
-                {
-                    memcpy(walk, &diffs6.dropped[i].addr.addr.addr6.s6_addr, 16);
-                    walk += 16;
-                    memcpy(walk, &diffs6.dropped[i].port, 2);
-                    walk += 2;
-                }
-
-                TR_ASSERT(walk - tmp == diffs6.droppedCount * 18);
-                tr_variantDictAddRaw(&val, TR_KEY_dropped6, tmp, walk - tmp);
-                tr_free(tmp);
-            }
+            "pex: snapshot version %" PRIu32 " -> %" PRIu32 ", payload is %zu bytes",
+            old_version,
+            msgs->pexVersion,
+            std::size(payload));
 
+        if (!std::empty(payload))
+        {
             /* write the pex message */
-            auto* const payload = tr_variantToBuf(&val, TR_VARIANT_FMT_BENC);
-            evbuffer_add_uint32(out, 2 * sizeof(uint8_t) + evbuffer_get_length(payload));
+            evbuffer* const out = msgs->outMessages;
+            evbuffer_add_uint32(out, 2 * sizeof(uint8_t) + std::size(payload));
             evbuffer_add_uint8(out, BtLtep);
             evbuffer_add_uint8(out, msgs->ut_pex_id);
-            evbuffer_add_buffer(out, payload);
+            evbuffer_add(out, std::data(payload), std::size(payload));
             pokeBatchPeriod(msgs, HighPriorityIntervalSecs);
             dbgmsg(msgs, "sending a pex message; outMessage size is now %zu", evbuffer_get_length(out));
             dbgOutMessageLen(msgs);
-
-            evbuffer_free(payload);
-            tr_variantFree(&val);
         }
-
-        /* cleanup */
-        tr_free(diffs.added);
-        tr_free(diffs.dropped);
-        tr_free(newPex);
-        tr_free(diffs6.added);
-        tr_free(diffs6.dropped);
-        tr_free(newPex6);
     }
 }
 
@@ -13,6 +13,8 @@
 #endif
 
 #include <inttypes.h>
+#include <vector>
+
 #include "peer-common.h"
 
 class tr_peer;
@@ -57,7 +59,8 @@ public:
 
     virtual void pulse() = 0;
 
-    virtual void on_piece_completed(tr_piece_index_t) = 0;
+    // we finished verifying these pieces since the last pulse
+    virtual void on_pieces_completed(std::vector<tr_piece_index_t> const& pieces) = 0;
 };
 
 tr_peerMsgs* tr_peerMsgsNew(
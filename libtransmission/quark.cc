@@ -23,7 +23,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
+auto constexpr my_static = std::array<std::string_view, 428>{ ""sv,
                                                               "activeTorrentCount"sv,
                                                               "activity-date"sv,
                                                               "activityDate"sv,
@@ -58,8 +58,12 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "blocklist-updates-enabled"sv,
                                                               "blocklist-url"sv,
                                                               "blocks"sv,
+                                                              "buckets"sv,
                                                               "bytesCompleted"sv,
                                                               "cache-size-mb"sv,
+                                                              "cachedBytes"sv,
+                                                              "choke-algorithm"sv,
+                                                              "chokeAlgorithm"sv,
                                                               "clientIsChoked"sv,
                                                               "clientIsInterested"sv,
                                                               "clientName"sv,
@@ -71,6 +75,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "cookies"sv,
                                                               "corrupt"sv,
                                                               "corruptEver"sv,
+                                                              "count"sv,
+                                                              "counters"sv,
                                                               "created by"sv,
                                                               "created by.utf-8"sv,
                                                               "creation date"sv,
@@ -85,6 +91,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "details-window-height"sv,
                                                               "details-window-width"sv,
                                                               "dht-enabled"sv,
+                                                              "dht-stats"sv,
                                                               "display-name"sv,
                                                               "dnd"sv,
                                                               "done-date"sv,
@@ -137,12 +144,14 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "fromLtep"sv,
                                                               "fromPex"sv,
                                                               "fromTracker"sv,
+                                                              "handshake-offload-enabled"sv,
                                                               "hasAnnounced"sv,
                                                               "hasScraped"sv,
                                                               "hashString"sv,
                                                               "have"sv,
                                                               "haveUnchecked"sv,
                                                               "haveValid"sv,
+                                                              "hits"sv,
                                                               "honorsSessionLimits"sv,
                                                               "host"sv,
                                                               "id"sv,
@@ -187,6 +196,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "length"sv,
                                                               "location"sv,
                                                               "lpd-enabled"sv,
+                                                              "lpd-pack-announces"sv,
                                                               "m"sv,
                                                               "magnet-info"sv,
                                                               "magnetLink"sv,
@@ -198,6 +208,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "main-window-y"sv,
                                                               "manualAnnounceTime"sv,
                                                               "max-peers"sv,
+                                                              "max-usec"sv,
                                                               "maxConnectedPeers"sv,
                                                               "memory-bytes"sv,
                                                               "memory-units"sv,
@@ -206,9 +217,12 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "metadata_size"sv,
                                                               "metainfo"sv,
                                                               "method"sv,
+                                                              "metrics-enabled"sv,
                                                               "min interval"sv,
                                                               "min_request_interval"sv,
+                                                              "misses"sv,
                                                               "move"sv,
+                                                              "moves"sv,
                                                               "msg_type"sv,
                                                               "mtimes"sv,
                                                               "name"sv,
@@ -219,6 +233,13 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "nodes6"sv,
                                                               "open-dialog-dir"sv,
                                                               "p"sv,
+                                                              "packetsPerReceiveCall"sv,
+                                                              "packetsPerSendCall"sv,
+                                                              "packetsReceived"sv,
+                                                              "packetsReceivedPerSecond"sv,
+                                                              "packetsSent"sv,
+                                                              "packetsSentPerSecond"sv,
+                                                              "packetsSentWithGso"sv,
                                                               "path"sv,
                                                               "path.utf-8"sv,
                                                               "paused"sv,
@@ -240,6 +261,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "peers2-6"sv,
                                                               "peers6"sv,
                                                               "peersConnected"sv,
+                                                              "peersFoundPerSearch"sv,
                                                               "peersFrom"sv,
                                                               "peersGettingFromUs"sv,
                                                               "peersSendingToUs"sv,
@@ -279,6 +301,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ratio-limit"sv,
                                                               "ratio-limit-enabled"sv,
                                                               "ratio-mode"sv,
+                                                              "read-cache-size-mb"sv,
+                                                              "read-cache-stats"sv,
                                                               "recent-download-dir-1"sv,
                                                               "recent-download-dir-2"sv,
                                                               "recent-download-dir-3"sv,
@@ -293,7 +317,10 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "removed"sv,
                                                               "rename-partial-files"sv,
                                                               "reqq"sv,
+                                                              "requests"sv,
+                                                              "responses"sv,
                                                               "result"sv,
+                                                              "resume-fsync"sv,
                                                               "rpc-authentication-required"sv,
                                                               "rpc-bind-address"sv,
                                                               "rpc-enabled"sv,
@@ -315,6 +342,12 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "script-torrent-added-filename"sv,
                                                               "script-torrent-done-enabled"sv,
                                                               "script-torrent-done-filename"sv,
+                                                              "scrub-speed-limit"sv,
+                                                              "searchesDone"sv,
+                                                              "searchesFailed"sv,
+                                                              "searchesInFlight"sv,
+                                                              "searchesQueued"sv,
+                                                              "searchesStarted"sv,
                                                               "seconds-active"sv,
                                                               "secondsActive"sv,
                                                               "secondsDownloading"sv,
@@ -361,6 +394,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "tag"sv,
                                                               "tier"sv,
                                                               "time-checked"sv,
+                                                              "timers"sv,
                                                               "torrent-added"sv,
                                                               "torrent-added-notification-command"sv,
                                                               "torrent-added-notification-enabled"sv,
@@ -375,6 +409,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "torrentCount"sv,
                                                               "torrentFile"sv,
                                                               "torrents"sv,
+                                                              "total-usec"sv,
                                                               "totalSize"sv,
                                                               "total_size"sv,
                                                               "tracker id"sv,
@@ -385,6 +420,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "trackers"sv,
                                                               "trash-can-enabled"sv,
                                                               "trash-original-torrent-files"sv,
+                                                              "udp-stats"sv,
                                                               "umask"sv,
                                                               "units"sv,
                                                               "upload-slots-per-torrent"sv,
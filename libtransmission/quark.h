@@ -61,8 +61,12 @@ enum
     TR_KEY_blocklist_updates_enabled,
     TR_KEY_blocklist_url,
     TR_KEY_blocks,
+    TR_KEY_buckets,
     TR_KEY_bytesCompleted,
     TR_KEY_cache_size_mb,
+    TR_KEY_cachedBytes,
+    TR_KEY_choke_algorithm,
+    TR_KEY_chokeAlgorithm,
     TR_KEY_clientIsChoked,
     TR_KEY_clientIsInterested,
     TR_KEY_clientName,
@@ -74,6 +78,8 @@ enum
     TR_KEY_cookies,
     TR_KEY_corrupt,
     TR_KEY_corruptEver,
+    TR_KEY_count,
+    TR_KEY_counters,
     TR_KEY_created_by,
     TR_KEY_created_by_utf_8,
     TR_KEY_creation_date,
@@ -88,6 +94,7 @@ enum
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
     TR_KEY_dht_enabled,
+    TR_KEY_dht_stats,
     TR_KEY_display_name,
     TR_KEY_dnd,
     TR_KEY_done_date,
@@ -140,12 +147,14 @@ enum
     TR_KEY_fromLtep,
     TR_KEY_fromPex,
     TR_KEY_fromTracker,
+    TR_KEY_handshake_offload_enabled,
     TR_KEY_hasAnnounced,
     TR_KEY_hasScraped,
     TR_KEY_hashString,
     TR_KEY_have,
     TR_KEY_haveUnchecked,
     TR_KEY_haveValid,
+    TR_KEY_hits,
     TR_KEY_honorsSessionLimits,
     TR_KEY_host,
     TR_KEY_id,
@@ -190,6 +199,7 @@ enum
     TR_KEY_length,
     TR_KEY_location,
     TR_KEY_lpd_enabled,
+    TR_KEY_lpd_pack_announces,
     TR_KEY_m,
     TR_KEY_magnet_info,
     TR_KEY_magnetLink,
@@ -201,6 +211,7 @@ enum
     TR_KEY_main_window_y,
     TR_KEY_manualAnnounceTime,
     TR_KEY_max_peers,
+    TR_KEY_max_usec,
     TR_KEY_maxConnectedPeers,
     TR_KEY_memory_bytes,
     TR_KEY_memory_units,
@@ -209,9 +220,12 @@ enum
     TR_KEY_metadata_size,
     TR_KEY_metainfo,
     TR_KEY_method,
+    TR_KEY_metrics_enabled,
     TR_KEY_min_interval,
     TR_KEY_min_request_interval,
+    TR_KEY_misses,
     TR_KEY_move,
+    TR_KEY_moves,
     TR_KEY_msg_type,
     TR_KEY_mtimes,
     TR_KEY_name,
@@ -222,6 +236,13 @@ enum
     TR_KEY_nodes6,
     TR_KEY_open_dialog_dir,
     TR_KEY_p,
+    TR_KEY_packetsPerReceiveCall,
+    TR_KEY_packetsPerSendCall,
+    TR_KEY_packetsReceived,
+    TR_KEY_packetsReceivedPerSecond,
+    TR_KEY_packetsSent,
+    TR_KEY_packetsSentPerSecond,
+    TR_KEY_packetsSentWithGso,
     TR_KEY_path,
     TR_KEY_path_utf_8,
     TR_KEY_paused,
@@ -243,6 +264,7 @@ enum
     TR_KEY_peers2_6,
     TR_KEY_peers6,
     TR_KEY_peersConnected,
+    TR_KEY_peersFoundPerSearch,
     TR_KEY_peersFrom,
     TR_KEY_peersGettingFromUs,
     TR_KEY_peersSendingToUs,
@@ -282,6 +304,8 @@ enum
     TR_KEY_ratio_limit,
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
+    TR_KEY_read_cache_size_mb,
+    TR_KEY_read_cache_stats,
     TR_KEY_recent_download_dir_1,
     TR_KEY_recent_download_dir_2,
     TR_KEY_recent_download_dir_3,
@@ -296,7 +320,10 @@ enum
     TR_KEY_removed,
     TR_KEY_rename_partial_files,
     TR_KEY_reqq,
+    TR_KEY_requests,
+    TR_KEY_responses,
     TR_KEY_result,
+    TR_KEY_resume_fsync,
     TR_KEY_rpc_authentication_required,
     TR_KEY_rpc_bind_address,
     TR_KEY_rpc_enabled,
@@ -318,6 +345,12 @@ enum
     TR_KEY_script_torrent_added_filename,
     TR_KEY_script_torrent_done_enabled,
     TR_KEY_script_torrent_done_filename,
+    TR_KEY_scrub_speed_limit,
+    TR_KEY_searchesDone,
+    TR_KEY_searchesFailed,
+    TR_KEY_searchesInFlight,
+    TR_KEY_searchesQueued,
+    TR_KEY_searchesStarted,
     TR_KEY_seconds_active,
     TR_KEY_secondsActive,
     TR_KEY_secondsDownloading,
@@ -364,6 +397,7 @@ enum
     TR_KEY_tag,
     TR_KEY_tier,
     TR_KEY_time_checked,
+    TR_KEY_timers,
     TR_KEY_torrent_added,
     TR_KEY_torrent_added_notification_command,
     TR_KEY_torrent_added_notification_enabled,
@@ -378,6 +412,7 @@ enum
     TR_KEY_torrentCount,
     TR_KEY_torrentFile,
     TR_KEY_torrents,
+    TR_KEY_total_usec,
     TR_KEY_totalSize,
     TR_KEY_total_size,
     TR_KEY_tracker_id,
@@ -388,6 +423,7 @@ enum
     TR_KEY_trackers,
     TR_KEY_trash_can_enabled,
     TR_KEY_trash_original_torrent_files,
+    TR_KEY_udp_stats,
     TR_KEY_umask,
     TR_KEY_units,
     TR_KEY_upload_slots_per_torrent,
@@ -0,0 +1,281 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "transmission.h"
+#include "error.h"
+#include "log.h"
+#include "platform.h" // tr_threadNew()
+#include "resume-writer.h"
+#include "torrent.h"
+#include "trevent.h"
+#include "utils.h"
+
+namespace
+{
+
+struct save_failed_data
+{
+    tr_session* session;
+    int tor_id;
+    std::string message;
+};
+
+void onSaveFailed(void* vdata)
+{
+    auto const data = std::unique_ptr<save_failed_data>(static_cast<save_failed_data*>(vdata));
+
+    if (auto* const tor = tr_torrentFindFromId(data->session, data->tor_id); tor != nullptr)
+    {
+        tr_torrentSetLocalError(tor, "Unable to save resume file: %s", data->message.c_str());
+    }
+}
+
+} // namespace
+
+struct tr_resume_writer::State
+{
+    struct Pending
+    {
+        int tor_id = 0;
+        std::string contents;
+    };
+
+    explicit State(tr_session* session_in)
+        : session{ session_in }
+    {
+    }
+
+    [[nodiscard]] bool isBusy(std::string const& filename) const
+    {
+        return pending.count(filename) != 0 || writing.count(filename) != 0;
+    }
+
+    [[nodiscard]] bool isIdle() const
+    {
+        return std::empty(pending) && std::empty(writing);
+    }
+
+    void run();
+
+    tr_session* const session;
+
+    mutable std::mutex mutex;
+    std::condition_variable work_cv; // wakes the workers
+    std::condition_variable done_cv; // wakes wait(), cancel(), flush(), and the destructor
+    std::unordered_map<std::string, Pending> pending;
+    std::deque<std::string> queue; // filenames in pending, oldest first
+    std::unordered_set<std::string> writing;
+    Stats stats;
+    size_t n_workers = 0;
+    bool fsync = false;
+    bool reporting = true;
+    bool stopping = false;
+};
+
+tr_resume_writer::tr_resume_writer(tr_session* session, size_t n_workers)
+    : state_{ std::make_shared<State>(session) }
+{
+    n_workers = std::max(n_workers, size_t{ 1 });
+    state_->n_workers = n_workers;
+
+    for (size_t i = 0; i < n_workers; ++i)
+    {
+        tr_threadNew(workerFunc, new std::shared_ptr<State>{ state_ });
+    }
+}
+
+tr_resume_writer::~tr_resume_writer()
+{
+    auto const deadline = std::chrono::steady_clock::now() + ShutdownTimeout;
+    auto& state = *state_;
+    auto lock = std::unique_lock(state.mutex);
+
+    // the workers keep going until the queue is empty
+    state.stopping = true;
+    state.reporting = false;
+
+    if (!state.done_cv.wait_until(lock, deadline, [&state]() { return state.isIdle(); }))
+    {
+        tr_logAddError(
+            _("Gave up waiting for %zu resume files to be saved"),
+            std::size(state.pending) + std::size(state.writing));
+        state.queue.clear();
+        state.pending.clear();
+    }
+
+    // A worker that's stuck in a write is left to finish it on its own.
+    // It holds its own reference to the state, so that's still safe.
+    state.work_cv.notify_all();
+    if (!state.done_cv.wait_until(lock, deadline, [&state]() { return state.n_workers == 0; }))
+    {
+        tr_logAddError(_("Gave up waiting for %zu resume file writers to stop"), state.n_workers);
+    }
+}
+
+void tr_resume_writer::stopReporting()
+{
+    auto const lock = std::lock_guard(state_->mutex);
+    state_->reporting = false;
+}
+
+void tr_resume_writer::save(int tor_id, std::string filename, std::string contents)
+{
+    auto& state = *state_;
+
+    {
+        auto const lock = std::lock_guard(state.mutex);
+
+        ++state.stats.saves;
+
+        if (auto const it = state.pending.find(filename); it != std::end(state.pending))
+        {
+            // the queued write hasn't started yet, so just give it the newer contents
+            ++state.stats.coalesced;
+            it->second = State::Pending{ tor_id, std::move(contents) };
+            return;
+        }
+
+        state.queue.push_back(filename);
+        state.pending.try_emplace(std::move(filename), State::Pending{ tor_id, std::move(contents) });
+    }
+
+    state.work_cv.notify_one();
+}
+
+void tr_resume_writer::cancel(std::string const& filename)
+{
+    auto& state = *state_;
+    auto lock = std::unique_lock(state.mutex);
+
+    if (state.pending.erase(filename) != 0)
+    {
+        state.queue.erase(std::find(std::begin(state.queue), std::end(state.queue), filename));
+    }
+
+    state.done_cv.wait(lock, [&state, &filename]() { return state.writing.count(filename) == 0; });
+}
+
+void tr_resume_writer::wait(std::string const& filename)
+{
+    auto& state = *state_;
+    auto lock = std::unique_lock(state.mutex);
+    state.done_cv.wait(lock, [&state, &filename]() { return !state.isBusy(filename); });
+}
+
+bool tr_resume_writer::flush(std::chrono::milliseconds timeout)
+{
+    auto& state = *state_;
+    auto lock = std::unique_lock(state.mutex);
+    return state.done_cv.wait_for(lock, timeout, [&state]() { return state.isIdle(); });
+}
+
+void tr_resume_writer::setFsync(bool fsync)
+{
+    auto const lock = std::lock_guard(state_->mutex);
+    state_->fsync = fsync;
+}
+
+bool tr_resume_writer::fsync() const
+{
+    auto const lock = std::lock_guard(state_->mutex);
+    return state_->fsync;
+}
+
+size_t tr_resume_writer::pending() const
+{
+    auto const lock = std::lock_guard(state_->mutex);
+    return std::size(state_->pending) + std::size(state_->writing);
+}
+
+tr_resume_writer::Stats tr_resume_writer::stats() const
+{
+    auto const lock = std::lock_guard(state_->mutex);
+    return state_->stats;
+}
+
+void tr_resume_writer::workerFunc(void* vstate)
+{
+    auto const state = std::unique_ptr<std::shared_ptr<State>>(static_cast<std::shared_ptr<State>*>(vstate));
+    (*state)->run();
+}
+
+void tr_resume_writer::State::run()
+{
+    auto lock = std::unique_lock(mutex);
+
+    for (;;)
+    {
+        // take the oldest file that no other worker is writing
+        auto const it = std::find_if(
+            std::begin(queue),
+            std::end(queue),
+            [this](auto const& filename) { return writing.count(filename) == 0; });
+
+        if (it == std::end(queue))
+        {
+            if (stopping)
+            {
+                break;
+            }
+
+            work_cv.wait(lock);
+            continue;
+        }
+
+        auto const filename = *it;
+        queue.erase(it);
+        auto node = pending.extract(filename);
+        auto const tor_id = node.mapped().tor_id;
+        auto const contents = std::move(node.mapped().contents);
+        auto const do_fsync = fsync;
+        writing.insert(filename);
+
+        lock.unlock();
+
+        tr_error* error = nullptr;
+        auto const ok = tr_saveFile(filename.c_str(), contents, &error, do_fsync);
+        if (!ok)
+        {
+            tr_logAddError(_("Error saving \"%s\": %s (%d)"), filename.c_str(), error->message, error->code);
+        }
+
+        lock.lock();
+
+        // decided here rather than when the write started, since the
+        // session may have started closing while we were writing
+        if (!ok && reporting && session != nullptr)
+        {
+            tr_runInEventThread(session, onSaveFailed, new save_failed_data{ session, tor_id, error->message });
+        }
+
+        tr_error_clear(&error);
+
+        ++stats.writes;
+        stats.errors += ok ? 0 : 1;
+        writing.erase(filename);
+
+        // a newer version of this file may have been skipped while we wrote it
+        done_cv.notify_all();
+        if (pending.count(filename) != 0)
+        {
+            work_cv.notify_one();
+        }
+    }
+
+    --n_workers;
+    done_cv.notify_all();
+}
@@ -0,0 +1,98 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <chrono>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <memory>
+#include <string>
+
+struct tr_session;
+
+/**
+ * Writes .resume files on worker threads so that the event thread
+ * doesn't wait on the disk.
+ *
+ * save() queues a file's new contents. If an older version of that
+ * file is still waiting to be written, it's replaced rather than queued
+ * again, so a torrent that changes several times in quick succession
+ * is only written once. A file is never written by two workers at once,
+ * so the newest contents always win.
+ *
+ * Each write goes to a temporary that's renamed into place, and is
+ * fsync()ed first if setFsync() asks for it.
+ *
+ * The workers share the queue with the writer through a shared_ptr, so
+ * that one stuck in a write that never returns can be left behind at
+ * shutdown instead of holding it up.
+ */
+class tr_resume_writer
+{
+public:
+    struct Stats
+    {
+        uint64_t saves = 0; // calls to save()
+        uint64_t writes = 0; // files written, successfully or not
+        uint64_t coalesced = 0; // saves that replaced one that hadn't been written yet
+        uint64_t errors = 0; // writes that failed
+    };
+
+    // how long the destructor waits for queued writes, and for the workers to
+    // stop, before it gives up on them
+    static auto constexpr ShutdownTimeout = std::chrono::seconds{ 10 };
+
+    // `session` is where failed writes are reported. It may be null.
+    tr_resume_writer(tr_session* session, size_t n_workers);
+
+    tr_resume_writer(tr_resume_writer const&) = delete;
+    tr_resume_writer& operator=(tr_resume_writer const&) = delete;
+
+    // writes what's queued, then stops the workers, waiting up to ShutdownTimeout in all
+    ~tr_resume_writer();
+
+    // Stops telling the session about failed writes, e.g. once it starts closing
+    // and its torrents are going away. They're still logged.
+    void stopReporting();
+
+    // Queues `contents` to be written to `filename`.
+    // If the write fails, torrent `tor_id` gets a local error.
+    void save(int tor_id, std::string filename, std::string contents);
+
+    // Forgets a queued write of `filename` and waits for one that's in progress,
+    // e.g. before the file is removed or renamed.
+    void cancel(std::string const& filename);
+
+    // Waits until `filename` has been written, e.g. before it's read back.
+    void wait(std::string const& filename);
+
+    // Waits up to `timeout` for every queued write to finish.
+    // Returns true if they did.
+    bool flush(std::chrono::milliseconds timeout);
+
+    void setFsync(bool fsync);
+
+    [[nodiscard]] bool fsync() const;
+
+    // the number of files that are queued or being written
+    [[nodiscard]] size_t pending() const;
+
+    [[nodiscard]] Stats stats() const;
+
+private:
+    struct State;
+
+    static void workerFunc(void* vstate);
+
+    std::shared_ptr<State> const state_;
+};
@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -684,6 +685,7 @@ void tr_torrentSaveResume(tr_torrent* tor)
     tr_variantDictAddInt(&top, TR_KEY_uploaded, tor->uploadedPrev + tor->uploadedCur);
     tr_variantDictAddInt(&top, TR_KEY_max_peers, tor->maxConnectedPeers);
     tr_variantDictAddInt(&top, TR_KEY_bandwidth_priority, tr_torrentGetPriority(tor));
+    tr_variantDictAddInt(&top, TR_KEY_choke_algorithm, tr_torrentGetChokeAlgorithm(tor));
     tr_variantDictAddBool(&top, TR_KEY_paused, !tor->isRunning && !tor->isQueued);
     savePeers(&top, tor);
 
@@ -701,12 +703,15 @@ void tr_torrentSaveResume(tr_torrent* tor)
     saveName(&top, tor);
     saveLabels(&top, tor);
 
-    std::string const filename = getResumeFilename(tor, TR_METAINFO_BASENAME_HASH);
-    int const err = tr_variantToFile(&top, TR_VARIANT_FMT_BENC, filename.c_str());
-    if (err != 0)
-    {
-        tr_torrentSetLocalError(tor, "Unable to save resume file: %s", tr_strerror(err));
-    }
+    // the variant holds views of the torrent's strings, so encode it here
+    // and leave the disk to the session's resume writer
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+    tor->session->resume_writer->save(
+        tr_torrentId(tor),
+        getResumeFilename(tor, TR_METAINFO_BASENAME_HASH),
+        std::string{ benc, len });
+    tr_free(benc);
 
     tr_variantFree(&top);
 }
@@ -730,10 +735,15 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
 
     std::string const filename = getResumeFilename(tor, TR_METAINFO_BASENAME_HASH);
 
+    // don't read it while a newer version is waiting to be written
+    tor->session->resume_writer->wait(filename);
+
     auto buf = std::vector<char>{};
+    auto arena = tr_variant_arena{};
     if (!tr_loadFile(buf, filename.c_str(), &error) ||
         !tr_variantFromBuf(
             &top,
+            arena,
             TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
             { std::data(buf), std::size(buf) },
             nullptr,
@@ -861,6 +871,13 @@ static uint64_t loadFromFile(tr_torrent* tor, uint64_t fieldsToLoad, bool* didRe
         fieldsLoaded |= TR_FR_BANDWIDTH_PRIORITY;
     }
 
+    if ((fieldsToLoad & TR_FR_CHOKE_ALGORITHM) != 0 && tr_variantDictFindInt(&top, TR_KEY_choke_algorithm, &i) &&
+        (i == TR_CHOKE_TIT_FOR_TAT || i == TR_CHOKE_ROUND_ROBIN))
+    {
+        tr_torrentSetChokeAlgorithm(tor, tr_choke_algorithm(i));
+        fieldsLoaded |= TR_FR_CHOKE_ALGORITHM;
+    }
+
     if ((fieldsToLoad & TR_FR_PEERS) != 0)
     {
         fieldsLoaded |= loadPeers(&top, tor);
@@ -984,6 +1001,7 @@ uint64_t tr_torrentLoadResume(tr_torrent* tor, uint64_t fieldsToLoad, tr_ctor co
 void tr_torrentRemoveResume(tr_torrent const* tor)
 {
     std::string filename = getResumeFilename(tor, TR_METAINFO_BASENAME_HASH);
+    tor->session->resume_writer->cancel(filename);
     tr_sys_path_remove(filename.c_str(), nullptr);
 
     filename = getResumeFilename(tor, TR_METAINFO_BASENAME_NAME_AND_PARTIAL_HASH);
@@ -195,7 +195,11 @@ static void handle_upload(struct evhttp_request* req, tr_rpc_server* server)
                     tr_variantDictAddStrView(args, TR_KEY_filename, body);
                     have_source = true;
                 }
-                else if (tr_variantFromBuf(&test, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, body))
+                else if (tr_variantFromBuf(
+                             &test,
+                             server->request_arena,
+                             TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
+                             body))
                 {
                     auto* b64 = static_cast<char*>(tr_base64_encode(body.c_str(), body_len, nullptr));
                     tr_variantDictAddStr(args, TR_KEY_metainfo, b64);
@@ -209,6 +213,8 @@ static void handle_upload(struct evhttp_request* req, tr_rpc_server* server)
                 }
 
                 tr_variantFree(&top);
+                tr_variantFree(&test);
+                server->request_arena.reset();
             }
         }
 
@@ -458,7 +464,11 @@ static void rpc_response_func(tr_session* /*session*/, tr_variant* response, voi
 static void handle_rpc_from_json(struct evhttp_request* req, tr_rpc_server* server, std::string_view json)
 {
     auto top = tr_variant{};
-    auto const have_content = tr_variantFromBuf(&top, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, json);
+    auto const have_content = tr_variantFromBuf(
+        &top,
+        server->request_arena,
+        TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE,
+        json);
 
     auto* const data = tr_new0(struct rpc_response_data, 1);
     data->req = req;
@@ -470,6 +480,8 @@ static void handle_rpc_from_json(struct evhttp_request* req, tr_rpc_server* serv
     {
         tr_variantFree(&top);
     }
+
+    server->request_arena.reset();
 }
 
 static void handle_rpc(struct evhttp_request* req, tr_rpc_server* server)
@@ -499,6 +511,30 @@ static void handle_rpc(struct evhttp_request* req, tr_rpc_server* server)
     send_simple_response(req, 405, nullptr);
 }
 
+static void handle_metrics(struct evhttp_request* req, tr_rpc_server* server)
+{
+    auto const& metrics = server->session->metrics;
+
+    if (!metrics.isEnabled())
+    {
+        send_simple_response(req, HTTP_NOTFOUND, "<p>Metrics are turned off. See the 'metrics-enabled' setting.</p>");
+        return;
+    }
+
+    if (req->type != EVHTTP_REQ_GET)
+    {
+        send_simple_response(req, 405, nullptr);
+        return;
+    }
+
+    auto const text = metrics.toPrometheus();
+    struct evbuffer* buf = evbuffer_new();
+    evbuffer_add(buf, std::data(text), std::size(text));
+    evhttp_add_header(req->output_headers, "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+    evhttp_send_reply(req, HTTP_OK, "OK", buf);
+    evbuffer_free(buf);
+}
+
 static bool isAddressAllowed(tr_rpc_server const* server, char const* address)
 {
     auto const& src = server->whitelist;
@@ -685,6 +721,11 @@ static void handle_request(struct evhttp_request* req, void* arg)
             send_simple_response(req, 421, tmp);
             tr_free(tmp);
         }
+        else if (location == "metrics"sv)
+        {
+            /* read-only, and scrapers can't do the session-id dance */
+            handle_metrics(req, server);
+        }
 #ifdef REQUIRE_SESSION_ID
         else if (!test_session_id(server, req))
         {
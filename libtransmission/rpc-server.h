@@ -26,8 +26,7 @@
 #include "transmission.h"
 
 #include "net.h"
-
-struct tr_variant;
+#include "variant.h" // tr_variant_arena
 
 class tr_rpc_server
 {
@@ -42,6 +41,9 @@ public:
 
     z_stream stream = {};
 
+    // requests are parsed into this. It's reset after each one, keeping its memory for the next
+    tr_variant_arena request_arena;
+
     std::list<std::string> hostWhitelist;
     std::list<std::string> whitelist;
     std::string salted_password;
@@ -10,10 +10,13 @@
 #include <array>
 #include <cctype> /* isdigit */
 #include <cerrno>
+#include <climits> /* INT_MAX */
 #include <cstdlib> /* strtol */
 #include <cstring> /* strcmp */
 #include <iterator>
 #include <numeric>
+#include <optional>
+#include <set>
 #include <string_view>
 #include <vector>
 
@@ -23,6 +26,7 @@
 #include <zlib.h>
 
 #include "transmission.h"
+#include "cache.h" /* tr_cacheGetReadStats() */
 #include "completion.h"
 #include "crypto-utils.h"
 #include "error.h"
@@ -36,6 +40,8 @@
 #include "stats.h"
 #include "torrent.h"
 #include "tr-assert.h"
+#include "tr-dht.h" /* tr_dhtGetStats() */
+#include "tr-udp-batch.h"
 #include "tr-macros.h"
 #include "utils.h"
 #include "variant.h"
@@ -67,10 +73,38 @@ enum tr_format
 ****
 ***/
 
+/* While a "batch" request runs, its sub-requests share one resolution of
+ * the batch's "ids", and the "torrent changed" and "queue positions changed"
+ * notifications they'd each send are held back and sent once at the end. */
+struct rpc_batch
+{
+    tr_session* session = nullptr;
+    std::optional<std::vector<int>> ids; // the batch's "ids", if it had any
+    std::set<int> changed; // ids of torrents to send TR_RPC_TORRENT_CHANGED for
+    bool queue_changed = false;
+};
+
+static rpc_batch* current_batch = nullptr;
+
 static tr_rpc_callback_status notify(tr_session* session, tr_rpc_callback_type type, tr_torrent* tor)
 {
     tr_rpc_callback_status status = TR_RPC_OK;
 
+    if (auto* const batch = current_batch; batch != nullptr && batch->session == session)
+    {
+        if (type == TR_RPC_TORRENT_CHANGED)
+        {
+            batch->changed.insert(tr_torrentId(tor));
+            return status;
+        }
+
+        if (type == TR_RPC_SESSION_QUEUE_POSITIONS_CHANGED)
+        {
+            batch->queue_changed = true;
+            return status;
+        }
+    }
+
     if (session->rpc_func != nullptr)
     {
         status = (*session->rpc_func)(session, type, tor, session->rpc_func_user_data);
@@ -115,6 +149,11 @@ static void tr_idle_function_done(struct tr_rpc_idle_data* data, char const* res
 ****
 ***/
 
+static bool hasIds(tr_variant* args)
+{
+    return tr_variantDictFind(args, TR_KEY_ids) != nullptr || tr_variantDictFind(args, TR_KEY_id) != nullptr;
+}
+
 static auto getTorrents(tr_session* session, tr_variant* args)
 {
     auto torrents = std::vector<tr_torrent*>{};
@@ -123,7 +162,21 @@ static auto getTorrents(tr_session* session, tr_variant* args)
     auto sv = std::string_view{};
     tr_variant* ids = nullptr;
 
-    if (tr_variantDictFindList(args, TR_KEY_ids, &ids))
+    if (auto const* const batch = current_batch; batch != nullptr && batch->session == session && batch->ids && !hasIds(args))
+    {
+        // a batch's sub-requests default to the batch's torrents.
+        // some of them may have been removed by an earlier sub-request.
+        torrents.reserve(std::size(*batch->ids));
+
+        for (auto const batch_id : *batch->ids)
+        {
+            if (auto* const tor = tr_torrentFindFromId(session, batch_id); tor != nullptr)
+            {
+                torrents.push_back(tor);
+            }
+        }
+    }
+    else if (tr_variantDictFindList(args, TR_KEY_ids, &ids))
     {
         size_t const n = tr_variantListSize(ids);
         torrents.reserve(n);
@@ -245,11 +298,49 @@ static char const* queueMoveBottom(
     return nullptr;
 }
 
+static char const* queueReorder(
+    tr_session* session,
+    tr_variant* args_in,
+    tr_variant* /*args_out*/,
+    tr_rpc_idle_data* /*idle_data*/)
+{
+    tr_variant* moves = nullptr;
+    if (!tr_variantDictFindList(args_in, TR_KEY_moves, &moves))
+    {
+        return "no moves specified";
+    }
+
+    auto moved = std::vector<tr_torrent*>{};
+
+    for (size_t i = 0, n = tr_variantListSize(moves); i < n; ++i)
+    {
+        tr_variant* const move = tr_variantListChild(moves, i);
+        auto pos = int64_t{};
+
+        // don't let a move without ids fall through to "all torrents"
+        if (!tr_variantIsDict(move) || !tr_variantDictFindInt(move, TR_KEY_queuePosition, &pos) || !hasIds(move))
+        {
+            continue;
+        }
+
+        // place the torrents one after another, starting at `pos`
+        for (auto* tor : getTorrents(session, move))
+        {
+            tr_torrentSetQueuePosition(tor, static_cast<int>(std::clamp(pos, int64_t{ 0 }, int64_t{ INT_MAX })));
+            moved.push_back(tor);
+            ++pos;
+        }
+    }
+
+    notifyBatchQueueChange(session, moved);
+    return nullptr;
+}
+
 struct CompareTorrentByQueuePosition
 {
     bool operator()(tr_torrent const* a, tr_torrent const* b) const
     {
-        return a->queuePosition < b->queuePosition;
+        return tr_torrentGetQueuePosition(a) < tr_torrentGetQueuePosition(b);
     }
 };
 
@@ -516,6 +607,10 @@ static void initField(
         tr_variantInitInt(initme, tr_torrentGetPriority(tor));
         break;
 
+    case TR_KEY_chokeAlgorithm:
+        tr_variantInitInt(initme, tr_torrentGetChokeAlgorithm(tor));
+        break;
+
     case TR_KEY_comment:
         tr_variantInitStr(initme, std::string_view{ inf->comment != nullptr ? inf->comment : "" });
         break;
@@ -1254,6 +1349,12 @@ static char const* torrentSet(
             }
         }
 
+        if (tr_variantDictFindInt(args_in, TR_KEY_chokeAlgorithm, &tmp) &&
+            (tmp == TR_CHOKE_TIT_FOR_TAT || tmp == TR_CHOKE_ROUND_ROBIN))
+        {
+            tr_torrentSetChokeAlgorithm(tor, tr_choke_algorithm(tmp));
+        }
+
         if (errmsg == nullptr && tr_variantDictFindList(args_in, TR_KEY_labels, &tmp_variant))
         {
             errmsg = setLabels(tor, tmp_variant);
@@ -1390,6 +1491,20 @@ static char const* torrentSetLocation(
     return nullptr;
 }
 
+static char const* torrentSetLocationCancel(
+    tr_session* session,
+    tr_variant* args_in,
+    tr_variant* /*args_out*/,
+    tr_rpc_idle_data* /*idle_data*/)
+{
+    for (auto* tor : getTorrents(session, args_in))
+    {
+        tr_torrentCancelSetLocation(tor);
+    }
+
+    return nullptr;
+}
+
 /***
 ****
 ***/
@@ -1870,6 +1985,21 @@ static char const* sessionSet(
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindInt(args_in, TR_KEY_read_cache_size_mb, &i))
+    {
+        tr_sessionSetReadCacheLimit_MB(session, i);
+    }
+
+    if (tr_variantDictFindInt(args_in, TR_KEY_scrub_speed_limit, &i))
+    {
+        tr_sessionSetScrubSpeedLimit_KBps(session, i);
+    }
+
+    if (tr_variantDictFindBool(args_in, TR_KEY_resume_fsync, &boolVal))
+    {
+        tr_sessionSetResumeFsync(session, boolVal);
+    }
+
     if (tr_variantDictFindInt(args_in, TR_KEY_alt_speed_up, &i))
     {
         tr_sessionSetAltSpeed_KBps(session, TR_UP, i);
@@ -1980,6 +2110,11 @@ static char const* sessionSet(
         tr_sessionSetLPDEnabled(session, boolVal);
     }
 
+    if (tr_variantDictFindBool(args_in, TR_KEY_lpd_pack_announces, &boolVal))
+    {
+        tr_sessionSetLPDPackAnnounces(session, boolVal);
+    }
+
     if (tr_variantDictFindBool(args_in, TR_KEY_peer_port_random_on_start, &boolVal))
     {
         tr_sessionSetPeerPortRandomOnStart(session, boolVal);
@@ -2106,6 +2241,11 @@ static char const* sessionSet(
         tr_sessionSetAntiBruteForceEnabled(session, boolVal);
     }
 
+    if (tr_variantDictFindBool(args_in, TR_KEY_metrics_enabled, &boolVal))
+    {
+        tr_sessionSetMetricsEnabled(session, boolVal);
+    }
+
     notify(session, TR_RPC_SESSION_CHANGED, nullptr);
 
     return nullptr;
@@ -2149,6 +2289,36 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    auto dhtStats = tr_dht_stats{};
+    tr_dhtGetStats(session, &dhtStats);
+    d = tr_variantDictAddDict(args_out, TR_KEY_dht_stats, 8);
+    tr_variantDictAddReal(d, TR_KEY_packetsReceivedPerSecond, dhtStats.packets_received_per_second);
+    tr_variantDictAddReal(d, TR_KEY_packetsSentPerSecond, dhtStats.packets_sent_per_second);
+    tr_variantDictAddReal(d, TR_KEY_peersFoundPerSearch, dhtStats.peers_per_search);
+    tr_variantDictAddInt(d, TR_KEY_searchesDone, dhtStats.searches_done);
+    tr_variantDictAddInt(d, TR_KEY_searchesFailed, dhtStats.searches_failed);
+    tr_variantDictAddInt(d, TR_KEY_searchesInFlight, dhtStats.searches_in_flight);
+    tr_variantDictAddInt(d, TR_KEY_searchesQueued, dhtStats.searches_queued);
+    tr_variantDictAddInt(d, TR_KEY_searchesStarted, dhtStats.searches_started);
+
+    auto const udpStats = session->udp_batch != nullptr ? session->udp_batch->stats() : tr_udp_batch::Stats{};
+    auto const perCall = [](uint64_t packets, uint64_t calls)
+    {
+        return calls != 0 ? static_cast<double>(packets) / calls : 0.0;
+    };
+    d = tr_variantDictAddDict(args_out, TR_KEY_udp_stats, 5);
+    tr_variantDictAddReal(d, TR_KEY_packetsPerReceiveCall, perCall(udpStats.packets_received, udpStats.receive_calls));
+    tr_variantDictAddReal(d, TR_KEY_packetsPerSendCall, perCall(udpStats.packets_sent, udpStats.send_calls));
+    tr_variantDictAddInt(d, TR_KEY_packetsReceived, udpStats.packets_received);
+    tr_variantDictAddInt(d, TR_KEY_packetsSent, udpStats.packets_sent);
+    tr_variantDictAddInt(d, TR_KEY_packetsSentWithGso, udpStats.packets_sent_with_gso);
+
+    auto const readStats = tr_cacheGetReadStats(session->cache);
+    d = tr_variantDictAddDict(args_out, TR_KEY_read_cache_stats, 3);
+    tr_variantDictAddInt(d, TR_KEY_cachedBytes, readStats.cached_bytes);
+    tr_variantDictAddInt(d, TR_KEY_hits, readStats.hits);
+    tr_variantDictAddInt(d, TR_KEY_misses, readStats.misses);
+
     return nullptr;
 }
 
@@ -2211,6 +2381,18 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_variantDictAddInt(d, key, tr_sessionGetCacheLimit_MB(s));
         break;
 
+    case TR_KEY_read_cache_size_mb:
+        tr_variantDictAddInt(d, key, tr_sessionGetReadCacheLimit_MB(s));
+        break;
+
+    case TR_KEY_scrub_speed_limit:
+        tr_variantDictAddInt(d, key, tr_sessionGetScrubSpeedLimit_KBps(s));
+        break;
+
+    case TR_KEY_resume_fsync:
+        tr_variantDictAddBool(d, key, tr_sessionGetResumeFsync(s));
+        break;
+
     case TR_KEY_blocklist_size:
         tr_variantDictAddInt(d, key, tr_blocklistGetRuleCount(s));
         break;
@@ -2267,6 +2449,14 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_variantDictAddBool(d, key, tr_sessionIsLPDEnabled(s));
         break;
 
+    case TR_KEY_lpd_pack_announces:
+        tr_variantDictAddBool(d, key, tr_sessionGetLPDPackAnnounces(s));
+        break;
+
+    case TR_KEY_metrics_enabled:
+        tr_variantDictAddBool(d, key, tr_sessionGetMetricsEnabled(s));
+        break;
+
     case TR_KEY_peer_port:
         tr_variantDictAddInt(d, key, tr_sessionGetPeerPort(s));
         break;
@@ -2458,6 +2648,16 @@ static char const* freeSpace(
     return err;
 }
 
+static char const* sessionMetrics(
+    tr_session* session,
+    tr_variant* /*args_in*/,
+    tr_variant* args_out,
+    tr_rpc_idle_data* /*idle_data*/)
+{
+    session->metrics.toVariant(args_out);
+    return nullptr;
+}
+
 /***
 ****
 ***/
@@ -2485,7 +2685,14 @@ struct rpc_method
     handler func;
 };
 
-static auto constexpr Methods = std::array<rpc_method, 22>{ {
+static char const* batchRequests(
+    tr_session* session,
+    tr_variant* args_in,
+    tr_variant* args_out,
+    tr_rpc_idle_data* idle_data);
+
+static auto constexpr Methods = std::array<rpc_method, 26>{ {
+    { "batch"sv, true, batchRequests },
     { "blocklist-update"sv, false, blocklistUpdate },
     { "free-space"sv, true, freeSpace },
     { "port-test"sv, false, portTest },
@@ -2493,8 +2700,10 @@ static auto constexpr Methods = std::array<rpc_method, 22>{ {
     { "queue-move-down"sv, true, queueMoveDown },
     { "queue-move-top"sv, true, queueMoveTop },
     { "queue-move-up"sv, true, queueMoveUp },
+    { "queue-reorder"sv, true, queueReorder },
     { "session-close"sv, true, sessionClose },
     { "session-get"sv, true, sessionGet },
+    { "session-metrics"sv, true, sessionMetrics },
     { "session-set"sv, true, sessionSet },
     { "session-stats"sv, true, sessionStats },
     { "torrent-add"sv, false, torrentAdd },
@@ -2504,12 +2713,102 @@ static auto constexpr Methods = std::array<rpc_method, 22>{ {
     { "torrent-rename-path"sv, false, torrentRenamePath },
     { "torrent-set"sv, true, torrentSet },
     { "torrent-set-location"sv, true, torrentSetLocation },
+    { "torrent-set-location-cancel"sv, true, torrentSetLocationCancel },
     { "torrent-start"sv, true, torrentStart },
     { "torrent-start-now"sv, true, torrentStartNow },
     { "torrent-stop"sv, true, torrentStop },
     { "torrent-verify"sv, true, torrentVerify },
 } };
 
+static rpc_method const* findMethod(std::string_view name)
+{
+    auto const it = std::find_if(std::begin(Methods), std::end(Methods), [&name](auto const& row) { return row.name == name; });
+    return it == std::end(Methods) ? nullptr : &*it;
+}
+
+static char const* batchRequests(
+    tr_session* session,
+    tr_variant* args_in,
+    tr_variant* args_out,
+    tr_rpc_idle_data* /*idle_data*/)
+{
+    tr_variant* requests = nullptr;
+    if (!tr_variantDictFindList(args_in, TR_KEY_requests, &requests))
+    {
+        return "no requests specified";
+    }
+
+    auto batch = rpc_batch{};
+    batch.session = session;
+
+    if (hasIds(args_in))
+    {
+        auto const torrents = getTorrents(session, args_in);
+        batch.ids.emplace();
+        batch.ids->reserve(std::size(torrents));
+        std::transform(std::begin(torrents), std::end(torrents), std::back_inserter(*batch.ids), tr_torrentId);
+    }
+
+    auto const n_requests = tr_variantListSize(requests);
+    tr_variant* const responses = tr_variantDictAddList(args_out, TR_KEY_responses, n_requests);
+
+    current_batch = &batch;
+
+    for (size_t i = 0; i < n_requests; ++i)
+    {
+        tr_variant* const request = tr_variantListChild(requests, i);
+        tr_variant* const response = tr_variantListAddDict(responses, 3);
+        tr_variant* const response_args = tr_variantDictAddDict(response, TR_KEY_arguments, 0);
+        char const* result = nullptr;
+
+        auto name = std::string_view{};
+        rpc_method const* method = nullptr;
+        if (!tr_variantIsDict(request) || !tr_variantDictFindStrView(request, TR_KEY_method, &name))
+        {
+            result = "no method name";
+        }
+        else if (method = findMethod(name); method == nullptr)
+        {
+            result = "method name not recognized";
+        }
+        else if (!method->immediate || method->func == batchRequests)
+        {
+            // the batch's response can't wait on these
+            result = "method can't be batched";
+        }
+        else
+        {
+            result = (*method->func)(session, tr_variantDictFind(request, TR_KEY_arguments), response_args, nullptr);
+        }
+
+        tr_variantDictAddStr(response, TR_KEY_result, result != nullptr ? result : "success");
+
+        auto tag = int64_t{};
+        if (tr_variantIsDict(request) && tr_variantDictFindInt(request, TR_KEY_tag, &tag))
+        {
+            tr_variantDictAddInt(response, TR_KEY_tag, tag);
+        }
+    }
+
+    current_batch = nullptr;
+
+    // send the notifications that the sub-requests held back
+    for (auto const id : batch.changed)
+    {
+        if (auto* const tor = tr_torrentFindFromId(session, id); tor != nullptr)
+        {
+            notify(session, TR_RPC_TORRENT_CHANGED, tor);
+        }
+    }
+
+    if (batch.queue_changed)
+    {
+        notify(session, TR_RPC_SESSION_QUEUE_POSITIONS_CHANGED, nullptr);
+    }
+
+    return nullptr;
+}
+
 static void noop_response_callback(tr_session* /*session*/, tr_variant* /*response*/, void* /*user_data*/)
 {
 }
@@ -2529,6 +2828,8 @@ void tr_rpc_request_exec_json(
         callback = noop_response_callback;
     }
 
+    auto const timer = session->metrics.time(tr_metrics::Timer::RpcRequest);
+
     // parse the request's method name
     auto sv = std::string_view{};
     rpc_method const* method = nullptr;
@@ -2536,17 +2837,9 @@ void tr_rpc_request_exec_json(
     {
         result = "no method name";
     }
-    else
+    else if (method = findMethod(sv); method == nullptr)
     {
-        auto const it = std::find_if(std::begin(Methods), std::end(Methods), [&sv](auto const& row) { return row.name == sv; });
-        if (it == std::end(Methods))
-        {
-            result = "method name not recognized";
-        }
-        else
-        {
-            method = &*it;
-        }
+        result = "method name not recognized";
     }
 
     /* if we couldn't figure out which method to use, return an error */
@@ -71,11 +71,20 @@ std::recursive_mutex tr_session::session_mutex_;
 
 #ifdef TR_LIGHTWEIGHT
 static auto constexpr DefaultCacheSizeMB = int{ 2 };
+static auto constexpr DefaultReadCacheSizeMB = int{ 0 };
 static auto constexpr DefaultPrefetchEnabled = bool{ false };
+static auto constexpr DefaultHandshakeOffloadEnabled = bool{ false };
+static auto constexpr DhPoolSize = size_t{ 8 };
+static auto constexpr ResumeWriterThreads = size_t{ 1 };
 #else
 static auto constexpr DefaultCacheSizeMB = int{ 4 };
+static auto constexpr DefaultReadCacheSizeMB = int{ 16 };
 static auto constexpr DefaultPrefetchEnabled = bool{ true };
+static auto constexpr DefaultHandshakeOffloadEnabled = bool{ true };
+static auto constexpr DhPoolSize = size_t{ 64 };
+static auto constexpr ResumeWriterThreads = size_t{ 4 };
 #endif
+static auto constexpr DefaultScrubSpeedLimitKBps = int{ 1024 };
 static auto constexpr SaveIntervalSecs = int{ 360 };
 
 #define dbgmsg(...) tr_logAddDeepNamed(nullptr, __VA_ARGS__)
@@ -324,13 +333,18 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 69);
+    tr_variantDictReserve(d, 74);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStrView(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist"sv);
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DefaultCacheSizeMB);
+    tr_variantDictAddInt(d, TR_KEY_read_cache_size_mb, DefaultReadCacheSizeMB);
+    tr_variantDictAddInt(d, TR_KEY_scrub_speed_limit, DefaultScrubSpeedLimitKBps);
+    tr_variantDictAddBool(d, TR_KEY_resume_fsync, false);
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, true);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, true);
     tr_variantDictAddBool(d, TR_KEY_lpd_enabled, false);
+    tr_variantDictAddBool(d, TR_KEY_lpd_pack_announces, true);
+    tr_variantDictAddBool(d, TR_KEY_metrics_enabled, false);
     tr_variantDictAddStr(d, TR_KEY_download_dir, tr_getDefaultDownloadDir());
     tr_variantDictAddInt(d, TR_KEY_speed_limit_down, 100);
     tr_variantDictAddBool(d, TR_KEY_speed_limit_down_enabled, false);
@@ -353,6 +367,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, DefaultPrefetchEnabled);
+    tr_variantDictAddBool(d, TR_KEY_handshake_offload_enabled, DefaultHandshakeOffloadEnabled);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, 6);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, 30);
@@ -400,13 +415,18 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 68);
+    tr_variantDictReserve(d, 73);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, s->useBlocklist());
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, s->blocklistUrl());
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
+    tr_variantDictAddInt(d, TR_KEY_read_cache_size_mb, tr_sessionGetReadCacheLimit_MB(s));
+    tr_variantDictAddInt(d, TR_KEY_scrub_speed_limit, tr_sessionGetScrubSpeedLimit_KBps(s));
+    tr_variantDictAddBool(d, TR_KEY_resume_fsync, tr_sessionGetResumeFsync(s));
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, s->isDHTEnabled);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, s->isUTPEnabled);
     tr_variantDictAddBool(d, TR_KEY_lpd_enabled, s->isLPDEnabled);
+    tr_variantDictAddBool(d, TR_KEY_lpd_pack_announces, s->isLPDPackingEnabled);
+    tr_variantDictAddBool(d, TR_KEY_metrics_enabled, tr_sessionGetMetricsEnabled(s));
     tr_variantDictAddStr(d, TR_KEY_download_dir, tr_sessionGetDownloadDir(s));
     tr_variantDictAddInt(d, TR_KEY_download_queue_size, tr_sessionGetQueueSize(s, TR_DOWN));
     tr_variantDictAddBool(d, TR_KEY_download_queue_enabled, tr_sessionGetQueueEnabled(s, TR_DOWN));
@@ -430,6 +450,7 @@ void tr_sessionGetSettings(tr_session* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, tr_sessionIsPortForwardingEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, s->isPrefetchEnabled);
+    tr_variantDictAddBool(d, TR_KEY_handshake_offload_enabled, s->isHandshakeOffloadEnabled);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, s->peer_id_ttl_hours);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, tr_sessionGetQueueStalledEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, tr_sessionGetQueueStalledMinutes(s));
@@ -656,6 +677,8 @@ static void onNowTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
 
     tr_dhtUpkeep(session);
 
+    tr_verifyScrub(session, session->scrubSpeedLimit_Bps);
+
     if (session->turtle.isClockEnabled)
     {
         turtleCheckClock(session, &session->turtle);
@@ -726,6 +749,8 @@ static void tr_sessionInitImpl(void* vdata)
     tr_setConfigDir(session, data->configDir);
 
     session->peerMgr = tr_peerMgrNew(session);
+    session->dh_pool = std::make_unique<tr_dh_pool>(session, DhPoolSize);
+    session->resume_writer = std::make_unique<tr_resume_writer>(session, ResumeWriterThreads);
 
     session->shared = tr_sharedInit(session);
 
@@ -807,6 +832,21 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_read_cache_size_mb, &i))
+    {
+        tr_sessionSetReadCacheLimit_MB(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_scrub_speed_limit, &i))
+    {
+        tr_sessionSetScrubSpeedLimit_KBps(session, i);
+    }
+
+    if (tr_variantDictFindBool(settings, TR_KEY_resume_fsync, &boolVal))
+    {
+        tr_sessionSetResumeFsync(session, boolVal);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_peer_limit_per_torrent, &i))
     {
         tr_sessionSetPeerLimitPerTorrent(session, i);
@@ -832,6 +872,11 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetLPDEnabled(session, boolVal);
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_lpd_pack_announces, &boolVal))
+    {
+        tr_sessionSetLPDPackAnnounces(session, boolVal);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_encryption, &i))
     {
         tr_sessionSetEncryption(session, tr_encryption_mode(i));
@@ -908,6 +953,11 @@ static void sessionSetImpl(void* vdata)
         session->isPrefetchEnabled = boolVal;
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_handshake_offload_enabled, &boolVal))
+    {
+        session->isHandshakeOffloadEnabled = boolVal;
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_preallocation, &i))
     {
         session->preallocationMode = tr_preallocation_mode(i);
@@ -1124,6 +1174,11 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetAntiBruteForceEnabled(session, boolVal);
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_metrics_enabled, &boolVal))
+    {
+        tr_sessionSetMetricsEnabled(session, boolVal);
+    }
+
     data->done = true;
 }
 
@@ -1818,6 +1873,9 @@ static void sessionCloseImplStart(tr_session* session)
 {
     session->is_closing_ = true;
 
+    // the torrents are about to go away; failed saves are still logged
+    session->resume_writer->stopReporting();
+
     free_incoming_peer_port(session);
 
     if (session->isLPDEnabled)
@@ -1834,6 +1892,8 @@ static void sessionCloseImplStart(tr_session* session)
     event_free(session->nowTimer);
     session->nowTimer = nullptr;
 
+    session->metrics.stopLagTimer();
+
     tr_verifyClose(session);
     tr_sharedClose(session);
     session->rpc_server_.reset();
@@ -1910,6 +1970,14 @@ static void sessionCloseImplFinish(tr_session* session)
 
     tr_statsClose(session);
     tr_peerMgrFree(session->peerMgr);
+    session->peerMgr = nullptr;
+
+    // no handshakes are left to wait on it
+    session->dh_pool.reset();
+
+    // the torrents queued their final saves when they were freed.
+    // the writer's threads have been at them since; wait for the rest.
+    session->resume_writer.reset();
 
     closeBlocklists(session);
 
@@ -2006,6 +2074,9 @@ void tr_sessionClose(tr_session* session)
     tr_free(session->resumeDir);
     tr_free(session->torrentDir);
     delete session;
+
+    /* so the clients see the shutdown's messages in the queue */
+    tr_logFlush();
 }
 
 struct sessionLoadTorrentsData
@@ -2228,6 +2299,20 @@ bool tr_sessionAllowsLPD(tr_session const* session)
     return tr_sessionIsLPDEnabled(session);
 }
 
+void tr_sessionSetLPDPackAnnounces(tr_session* session, bool pack)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    session->isLPDPackingEnabled = pack;
+}
+
+bool tr_sessionGetLPDPackAnnounces(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->isLPDPackingEnabled;
+}
+
 /***
 ****
 ***/
@@ -2246,6 +2331,48 @@ int tr_sessionGetCacheLimit_MB(tr_session const* session)
     return toMemMB(tr_cacheGetLimit(session->cache));
 }
 
+void tr_sessionSetReadCacheLimit_MB(tr_session* session, int max_bytes)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_cacheSetReadLimit(session->cache, toMemBytes(max_bytes));
+}
+
+int tr_sessionGetReadCacheLimit_MB(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return toMemMB(tr_cacheGetReadLimit(session->cache));
+}
+
+void tr_sessionSetScrubSpeedLimit_KBps(tr_session* session, unsigned int KBps)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    session->scrubSpeedLimit_Bps = toSpeedBytes(KBps);
+}
+
+unsigned int tr_sessionGetScrubSpeedLimit_KBps(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return toSpeedKBps(session->scrubSpeedLimit_Bps);
+}
+
+void tr_sessionSetResumeFsync(tr_session* session, bool fsync)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    session->resume_writer->setFsync(fsync);
+}
+
+bool tr_sessionGetResumeFsync(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->resume_writer->fsync();
+}
+
 /***
 ****
 ***/
@@ -2290,11 +2417,22 @@ static bool tr_stringEndsWith(char const* strval, char const* end)
     return slen >= elen && memcmp(&strval[slen - elen], end, elen) == 0;
 }
 
+/* Lists are compiled into .bin2 files. Older versions load every .bin
+   file as bare IPv4 ranges, so they'd misread our header and IPv6 ranges
+   if we wrote those to a .bin. Their .bin files are still used until a
+   .bin2 replaces them, and are left alone so that they can go back. */
+static auto constexpr BinSuffix = ".bin2"sv;
+static auto constexpr LegacyBinSuffix = ".bin"sv;
+static auto constexpr LegacyBlocklistFilename = "blocklist.bin";
+
 static void loadBlocklists(tr_session* session)
 {
     auto loadme = std::unordered_set<std::string>{};
+    auto legacy = std::vector<std::string>{};
     auto const isEnabled = session->useBlocklist();
 
+    session->blocklist_index.setFilename(tr_strvPath(session->configDir, "blocklists.index"sv));
+
     /* walk the blocklist directory... */
     auto const dirname = tr_strvPath(session->configDir, "blocklists"sv);
     auto const odir = tr_sys_dir_open(dirname.c_str(), nullptr);
@@ -2314,16 +2452,20 @@ static void loadBlocklists(tr_session* session)
             continue;
         }
 
-        if (auto const path = tr_strvPath(dirname, name); tr_strvEndsWith(path, ".bin"sv))
+        if (auto const path = tr_strvPath(dirname, name); tr_strvEndsWith(path, BinSuffix))
         {
             load = path;
         }
+        else if (tr_strvEndsWith(path, LegacyBinSuffix))
+        {
+            legacy.push_back(path);
+        }
         else
         {
             tr_sys_path_info path_info;
             tr_sys_path_info binname_info;
 
-            auto const binname = tr_strvJoin(dirname, TR_PATH_DELIMITER_STR, name, ".bin"sv);
+            auto const binname = tr_strvJoin(dirname, TR_PATH_DELIMITER_STR, name, BinSuffix);
 
             if (!tr_sys_path_get_info(binname.c_str(), 0, &binname_info, nullptr)) /* create it */
             {
@@ -2366,12 +2508,26 @@ static void loadBlocklists(tr_session* session)
         }
     }
 
+    /* use an older version's .bin unless it's been compiled anew */
+    for (auto const& path : legacy)
+    {
+        auto stem = std::string_view{ path };
+        stem.remove_suffix(std::size(LegacyBinSuffix));
+        auto const binname = tr_strvJoin(stem, BinSuffix);
+
+        if (!tr_sys_path_exists(binname.c_str(), nullptr))
+        {
+            loadme.emplace(path);
+        }
+    }
+
     session->blocklists.clear();
     std::transform(
         std::begin(loadme),
         std::end(loadme),
         std::back_inserter(session->blocklists),
         [&isEnabled](auto const& path) { return tr_blocklistFileNew(path.c_str(), isEnabled); });
+    session->blocklist_index.open(session->blocklists);
 
     /* cleanup */
     tr_sys_dir_close(odir, nullptr);
@@ -2382,14 +2538,13 @@ static void closeBlocklists(tr_session* session)
     auto& src = session->blocklists;
     std::for_each(std::begin(src), std::end(src), [](auto* b) { tr_blocklistFileFree(b); });
     src.clear();
+    session->blocklist_index.clear();
 }
 
 void tr_sessionReloadBlocklists(tr_session* session)
 {
     closeBlocklists(session);
     loadBlocklists(session);
-
-    tr_peerMgrOnBlocklistChanged(session->peerMgr);
 }
 
 int tr_blocklistGetRuleCount(tr_session const* session)
@@ -2419,6 +2574,8 @@ void tr_session::useBlocklist(bool enabled)
         std::begin(blocklists),
         std::end(blocklists),
         [enabled](auto* blocklist) { tr_blocklistFileSetEnabled(blocklist, enabled); });
+
+    blocklist_index.open(blocklists);
 }
 
 void tr_blocklistSetEnabled(tr_session* session, bool enabled)
@@ -2449,6 +2606,20 @@ int tr_blocklistSetContent(tr_session* session, char const* contentFilename)
         [&name](auto const* blocklist) { return tr_stringEndsWith(tr_blocklistFileGetFilename(blocklist), name); });
     if (it == std::end(src))
     {
+        // the new one replaces the default blocklist an older version left behind
+        auto const legacy = std::find_if(
+            std::begin(src),
+            std::end(src),
+            [](auto const* blocklist)
+            {
+                return tr_stringEndsWith(tr_blocklistFileGetFilename(blocklist), LegacyBlocklistFilename);
+            });
+        if (legacy != std::end(src))
+        {
+            tr_blocklistFileFree(*legacy);
+            src.erase(legacy);
+        }
+
         auto path = tr_strvJoin(session->configDir, "blocklists"sv, name);
         b = tr_blocklistFileNew(path.c_str(), session->useBlocklist());
         src.push_back(b);
@@ -2460,16 +2631,13 @@ int tr_blocklistSetContent(tr_session* session, char const* contentFilename)
 
     // set the default blocklist's content
     int const ruleCount = tr_blocklistFileSetContent(b, contentFilename);
+    session->blocklist_index.rebuild(src);
     return ruleCount;
 }
 
 bool tr_sessionIsAddressBlocked(tr_session const* session, tr_address const* addr)
 {
-    auto& src = session->blocklists;
-    return std::any_of(
-        std::begin(src),
-        std::end(src),
-        [&addr](auto* blocklist) { return tr_blocklistFileHasAddress(blocklist, addr); });
+    return session->blocklist_index.contains(*addr);
 }
 
 void tr_blocklistSetURL(tr_session* session, char const* url)
@@ -2659,6 +2827,7 @@ void tr_sessionSetQueueSize(tr_session* session, tr_direction dir, int n)
     TR_ASSERT(tr_isDirection(dir));
 
     session->queueSize[dir] = n;
+    tr_peerMgrQueueChanged(session->peerMgr);
 }
 
 int tr_sessionGetQueueSize(tr_session const* session, tr_direction dir)
@@ -2675,6 +2844,7 @@ void tr_sessionSetQueueEnabled(tr_session* session, tr_direction dir, bool is_en
     TR_ASSERT(tr_isDirection(dir));
 
     session->queueEnabled[dir] = is_enabled;
+    tr_peerMgrQueueChanged(session->peerMgr);
 }
 
 bool tr_sessionGetQueueEnabled(tr_session const* session, tr_direction dir)
@@ -2691,6 +2861,7 @@ void tr_sessionSetQueueStalledMinutes(tr_session* session, int minutes)
     TR_ASSERT(minutes > 0);
 
     session->queueStalledMinutes = minutes;
+    tr_peerMgrQueueChanged(session->peerMgr);
 }
 
 void tr_sessionSetQueueStalledEnabled(tr_session* session, bool is_enabled)
@@ -2698,6 +2869,7 @@ void tr_sessionSetQueueStalledEnabled(tr_session* session, bool is_enabled)
     TR_ASSERT(tr_isSession(session));
 
     session->stalledEnabled = is_enabled;
+    tr_peerMgrQueueChanged(session->peerMgr);
 }
 
 bool tr_sessionGetQueueStalledEnabled(tr_session const* session)
@@ -2742,35 +2914,45 @@ int tr_sessionGetAntiBruteForceThreshold(tr_session const* session)
     return tr_rpcGetAntiBruteForceThreshold(session->rpc_server_.get());
 }
 
-std::vector<tr_torrent*> tr_sessionGetNextQueuedTorrents(tr_session* session, tr_direction direction, size_t num_wanted)
+/***
+****
+***/
+
+static void updateMetricsLagTimer(void* vsession)
 {
-    TR_ASSERT(tr_isSession(session));
-    TR_ASSERT(tr_isDirection(direction));
+    auto* const session = static_cast<tr_session*>(vsession);
 
-    // build an array of the candidates
-    auto candidates = std::vector<tr_torrent*>{};
-    candidates.reserve(tr_sessionCountTorrents(session));
-    for (auto* tor : session->torrents)
+    if (session->metrics.isEnabled() && !session->isClosing())
     {
-        if (tr_torrentIsQueued(tor) && (direction == tr_torrentGetQueueDirection(tor)))
-        {
-            candidates.push_back(tor);
-        }
+        session->metrics.startLagTimer(session->event_base);
     }
-
-    // find the best n candidates
-    num_wanted = std::min(num_wanted, std::size(candidates));
-    if (num_wanted < candidates.size())
+    else
     {
-        std::partial_sort(
-            std::begin(candidates),
-            std::begin(candidates) + num_wanted,
-            std::end(candidates),
-            [](auto const* a, auto const* b) { return tr_torrentGetQueuePosition(a) < tr_torrentGetQueuePosition(b); });
-        candidates.resize(num_wanted);
+        session->metrics.stopLagTimer();
     }
+}
+
+void tr_sessionSetMetricsEnabled(tr_session* session, bool enabled)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    session->metrics.setEnabled(enabled);
+    tr_runInEventThread(session, updateMetricsLagTimer, session);
+}
+
+bool tr_sessionGetMetricsEnabled(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->metrics.isEnabled();
+}
+
+std::vector<tr_torrent*> tr_sessionGetNextQueuedTorrents(tr_session* session, tr_direction direction, size_t num_wanted)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(tr_isDirection(direction));
 
-    return candidates;
+    return session->torrentQueue.nextWaiting(direction, num_wanted);
 }
 
 int tr_sessionCountQueueFreeSlots(tr_session* session, tr_direction dir)
@@ -2820,14 +3002,33 @@ void tr_sessionAddTorrent(tr_session* session, tr_torrent* tor)
 {
     session->torrents.insert(tor);
     session->torrentsById.insert_or_assign(tor->uniqueId, tor);
-    session->torrentsByHash.insert_or_assign(tor->info.hash, tor);
+    session->torrentsByHash.insert_or_assign(tr_torrentInfoHash(tor), tor);
     session->torrentsByHashString.insert_or_assign(tor->info.hashString, tor);
+
+    if (!session->torrentQueue.contains(tor))
+    {
+        session->torrentQueue.push_back(tor);
+    }
 }
 
 void tr_sessionRemoveTorrent(tr_session* session, tr_torrent* tor)
 {
     session->torrents.erase(tor);
     session->torrentsById.erase(tor->uniqueId);
-    session->torrentsByHash.erase(tor->info.hash);
+    session->torrentsByHash.erase(tr_torrentInfoHash(tor));
     session->torrentsByHashString.erase(tor->info.hashString);
+
+    // "so you die, captain, and we all move up in rank."
+    // Their positions changed, so "recently-active" should report them.
+    if (session->torrentQueue.contains(tor))
+    {
+        auto const now = tr_time();
+        auto const pos = session->torrentQueue.position(tor);
+        for (auto* const behind : session->torrentQueue.range(pos + 1, std::size(session->torrentQueue)))
+        {
+            behind->anyDate = now;
+        }
+    }
+
+    session->torrentQueue.erase(tor);
 }
@@ -15,13 +15,14 @@
 #define TR_NAME "Transmission"
 
 #include <array>
-#include <cstring> // memcmp()
+#include <cstring> // memcmp(), memcpy()
 #include <list>
 #include <mutex>
 #include <map>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -30,8 +31,14 @@
 #include "transmission.h"
 
 #include "bandwidth.h"
+#include "blocklist.h"
+#include "dh-pool.h"
+#include "metrics.h"
 #include "net.h"
+#include "resume-writer.h"
 #include "rpc-server.h"
+#include "torrent-magnet.h"
+#include "torrent-queue.h"
 #include "tr-macros.h"
 #include "utils.h" // tr_speed_K
 
@@ -51,6 +58,7 @@ class tr_bitfield;
 struct tr_address;
 struct tr_announcer;
 struct tr_announcer_udp;
+class tr_udp_batch;
 struct tr_bindsockets;
 struct tr_blocklistFile;
 struct tr_cache;
@@ -97,11 +105,14 @@ struct tr_turtle_info
     tr_auto_switch_state_t autoTurtleState;
 };
 
-struct CompareHash
+struct DigestHash
 {
-    bool operator()(uint8_t const* const a, uint8_t const* const b) const
+    // info_dict hashes are already uniformly distributed
+    size_t operator()(tr_sha1_digest_t const& digest) const
     {
-        return std::memcmp(a, b, SHA_DIGEST_LENGTH) < 0;
+        auto ret = size_t{};
+        std::memcpy(&ret, std::data(digest), sizeof(ret));
+        return ret;
     }
 };
 
@@ -270,7 +281,9 @@ public:
     bool isDHTEnabled;
     bool isUTPEnabled;
     bool isLPDEnabled;
+    bool isLPDPackingEnabled = true;
     bool isPrefetchEnabled;
+    bool isHandshakeOffloadEnabled = false;
     bool is_closing_ = false;
     bool isClosed;
     bool isRatioLimited;
@@ -290,6 +303,8 @@ public:
     int queueSize[2];
     int queueStalledMinutes;
 
+    tr_torrent_queue torrentQueue;
+
     int umask;
 
     unsigned int speedLimit_Bps[2];
@@ -322,6 +337,12 @@ public:
     struct event* udp_event;
     struct event* udp6_event;
 
+    /* Batches reads and writes on the UDP sockets. */
+    tr_udp_batch* udp_batch;
+    struct event* udp_flush_event;
+    struct event* udp_write_event;
+    struct event* udp6_write_event;
+
     struct event* utp_timer;
 
     /* The open port on the local machine for incoming peer requests */
@@ -340,7 +361,7 @@ public:
 
     std::unordered_set<tr_torrent*> torrents;
     std::map<int, tr_torrent*> torrentsById;
-    std::map<uint8_t const*, tr_torrent*, CompareHash> torrentsByHash;
+    std::unordered_map<tr_sha1_digest_t, tr_torrent*, DigestHash> torrentsByHash;
     std::map<std::string_view, tr_torrent*, CaseInsensitiveStringCompare> torrentsByHashString;
 
     char* configDir;
@@ -348,6 +369,11 @@ public:
     char* torrentDir;
 
     std::list<tr_blocklistFile*> blocklists;
+    tr_blocklist_index blocklist_index;
+
+    /* Recently-served info dicts, for answering ut_metadata requests */
+    tr_info_dict_cache info_dict_cache;
+
     struct tr_peerMgr* peerMgr;
     struct tr_shared* shared;
 
@@ -377,11 +403,23 @@ public:
 
     uint16_t idleLimitMinutes;
 
+    /* How fast idle torrents' unchecked pieces are checked. See tr_verifyScrub(). */
+    unsigned int scrubSpeedLimit_Bps = 0;
+
     struct tr_bindinfo* bind_ipv4;
     struct tr_bindinfo* bind_ipv6;
 
     std::unique_ptr<tr_rpc_server> rpc_server_;
 
+    /* Pregenerated keypairs for encrypted handshakes, and a worker for their shared secrets */
+    std::unique_ptr<tr_dh_pool> dh_pool;
+
+    /* Writes the torrents' .resume files in the background. See tr_torrentSaveResume(). */
+    std::unique_ptr<tr_resume_writer> resume_writer;
+
+    /* Latency histograms and counters. See tr_sessionSetMetricsEnabled(). */
+    tr_metrics metrics;
+
 private:
     static std::recursive_mutex session_mutex_;
 
@@ -16,6 +16,7 @@
 #include "error.h"
 #include "file.h"
 #include "magnet-metainfo.h"
+#include "metainfo-view.h"
 #include "session.h"
 #include "torrent.h" /* tr_ctorGetSave() */
 #include "tr-assert.h"
@@ -41,9 +42,11 @@ struct tr_ctor
 
     tr_priority_t priority = TR_PRI_NORMAL;
     bool isSet_metainfo = false;
-    tr_variant metainfo = {};
     std::string source_file;
 
+    // the name to use if the metainfo doesn't have one
+    std::string default_name;
+
     struct optional_args optional_args[2];
 
     std::string incomplete_dir;
@@ -56,6 +59,9 @@ struct tr_ctor
 
     std::vector<char> contents;
 
+    // where the "info" dict is in `contents`
+    std::optional<uint64_t> info_dict_offset;
+
     explicit tr_ctor(tr_session const* session_in)
         : session{ session_in }
     {
@@ -73,20 +79,23 @@ static void setSourceFile(tr_ctor* ctor, char const* source_file)
 
 static void clearMetainfo(tr_ctor* ctor)
 {
-    if (ctor->isSet_metainfo)
-    {
-        ctor->isSet_metainfo = false;
-        tr_variantFree(&ctor->metainfo);
-    }
-
+    ctor->isSet_metainfo = false;
+    ctor->info_dict_offset.reset();
+    ctor->default_name.clear();
     setSourceFile(ctor, nullptr);
 }
 
+// Only checks that the contents are well-formed; tr_metainfoParse() does the rest
 static int parseMetainfoContents(tr_ctor* ctor)
 {
-    auto& contents = ctor->contents;
-    auto sv = std::string_view{ std::data(contents), std::size(contents) };
-    ctor->isSet_metainfo = tr_variantFromBuf(&ctor->metainfo, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, sv);
+    auto const view = tr_metainfo_view::parse({ std::data(ctor->contents), std::size(ctor->contents) });
+    ctor->isSet_metainfo = view.has_value();
+
+    if (view && !std::empty(view->infoDict()))
+    {
+        ctor->info_dict_offset = view->infoDictOffset();
+    }
+
     return ctor->isSet_metainfo ? 0 : EILSEQ;
 }
 
@@ -140,26 +149,11 @@ int tr_ctorSetMetainfoFromFile(tr_ctor* ctor, char const* filename)
 
     setSourceFile(ctor, filename);
 
-    /* if no `name' field was set, then set it from the filename */
-    if (tr_variant* info = nullptr; tr_variantDictFindDict(&ctor->metainfo, TR_KEY_info, &info))
+    /* if no `name' field was set, then use the filename */
+    if (char* base = tr_sys_path_basename(filename, nullptr); base != nullptr)
     {
-        auto name = std::string_view{};
-
-        if (!tr_variantDictFindStrView(info, TR_KEY_name_utf_8, &name) && !tr_variantDictFindStrView(info, TR_KEY_name, &name))
-        {
-            name = ""sv;
-        }
-
-        if (std::empty(name))
-        {
-            char* base = tr_sys_path_basename(filename, nullptr);
-
-            if (base != nullptr)
-            {
-                tr_variantDictAddStr(info, TR_KEY_name, base);
-                tr_free(base);
-            }
-        }
+        ctor->default_name = base;
+        tr_free(base);
     }
 
     return 0;
@@ -352,19 +346,24 @@ bool tr_ctorGetIncompleteDir(tr_ctor const* ctor, char const** setme)
     return true;
 }
 
-bool tr_ctorGetMetainfo(tr_ctor const* ctor, tr_variant const** setme)
+std::optional<std::string_view> tr_ctorGetMetainfo(tr_ctor const* ctor)
 {
     if (!ctor->isSet_metainfo)
     {
-        return false;
+        return {};
     }
 
-    if (setme != nullptr)
-    {
-        *setme = &ctor->metainfo;
-    }
+    return std::string_view{ std::data(ctor->contents), std::size(ctor->contents) };
+}
 
-    return true;
+std::string_view tr_ctorGetDefaultName(tr_ctor const* ctor)
+{
+    return ctor->default_name;
+}
+
+std::optional<uint64_t> tr_ctorGetInfoDictOffset(tr_ctor const* ctor)
+{
+    return ctor->info_dict_offset;
 }
 
 tr_session* tr_ctorGetSession(tr_ctor const* ctor)
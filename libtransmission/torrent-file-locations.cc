@@ -0,0 +1,176 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+
+#include "transmission.h"
+
+#include "file.h"
+#include "torrent-file-locations.h"
+#include "utils.h"
+
+using namespace std::literals;
+
+namespace
+{
+
+// folder -> the names in it
+using folder_listing_t = std::map<std::string_view, std::set<std::string, std::less<>>>;
+
+void splitName(std::string_view name, std::string_view* setme_folder, std::string_view* setme_basename)
+{
+    auto const pos = name.rfind('/');
+    *setme_folder = pos == std::string_view::npos ? ""sv : name.substr(0, pos);
+    *setme_basename = pos == std::string_view::npos ? name : name.substr(pos + 1);
+}
+
+// list each of the files' folders under `dir` once
+size_t listFolders(std::string_view dir, tr_file const* files, size_t n_files, folder_listing_t& setme)
+{
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        auto folder = std::string_view{};
+        auto basename = std::string_view{};
+        splitName(files[i].name, &folder, &basename);
+        setme.try_emplace(folder);
+    }
+
+    for (auto& [folder, names] : setme)
+    {
+        auto const path = std::empty(folder) ? std::string{ dir } : tr_strvPath(dir, folder);
+        auto const odir = tr_sys_dir_open(path.c_str(), nullptr);
+        if (odir == TR_BAD_SYS_DIR)
+        {
+            continue;
+        }
+
+        char const* name = nullptr;
+        while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+        {
+            names.emplace(name);
+        }
+
+        tr_sys_dir_close(odir, nullptr);
+    }
+
+    return std::size(setme);
+}
+
+} // namespace
+
+void tr_file_locations::reset(size_t n_files)
+{
+    auto const lock = std::lock_guard(mutex_);
+
+    locations_.assign(n_files, Location::Unknown);
+    locations_.shrink_to_fit();
+    ++generation_;
+}
+
+tr_file_locations::Location tr_file_locations::get(tr_file_index_t file) const
+{
+    auto const lock = std::lock_guard(mutex_);
+
+    return file < std::size(locations_) ? locations_[file] : Location::Unknown;
+}
+
+void tr_file_locations::set(tr_file_index_t file, Location location)
+{
+    auto const lock = std::lock_guard(mutex_);
+
+    if (file < std::size(locations_))
+    {
+        locations_[file] = location;
+        ++generation_;
+    }
+}
+
+void tr_file_locations::invalidateAll()
+{
+    auto const lock = std::lock_guard(mutex_);
+
+    std::fill(std::begin(locations_), std::end(locations_), Location::Unknown);
+    ++generation_;
+}
+
+size_t tr_file_locations::refresh(
+    std::string_view download_dir,
+    std::string_view incomplete_dir,
+    tr_file const* files,
+    size_t n_files)
+{
+    auto const generation = [this]()
+    {
+        auto const lock = std::lock_guard(mutex_);
+        return generation_;
+    }();
+
+    auto n_listed = size_t{ 0 };
+
+    auto download = folder_listing_t{};
+    if (!std::empty(download_dir))
+    {
+        n_listed += listFolders(download_dir, files, n_files, download);
+    }
+
+    auto incomplete = folder_listing_t{};
+    if (!std::empty(incomplete_dir))
+    {
+        n_listed += listFolders(incomplete_dir, files, n_files, incomplete);
+    }
+
+    auto found = std::vector<Location>(n_files, Location::Unknown);
+    auto partial = std::string{};
+
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        auto folder = std::string_view{};
+        auto basename = std::string_view{};
+        splitName(files[i].name, &folder, &basename);
+        tr_buildBuf(partial, basename, ".part"sv);
+
+        // look in the same order as tr_torrent::findFile()
+        auto const has = [&folder](folder_listing_t const& listing, std::string_view name)
+        {
+            auto const it = listing.find(folder);
+            return it != std::end(listing) && it->second.count(name) != 0;
+        };
+
+        if (has(download, basename))
+        {
+            found[i] = Location::Download;
+        }
+        else if (has(download, partial))
+        {
+            found[i] = Location::DownloadPartial;
+        }
+        else if (has(incomplete, basename))
+        {
+            found[i] = Location::Incomplete;
+        }
+        else if (has(incomplete, partial))
+        {
+            found[i] = Location::IncompletePartial;
+        }
+    }
+
+    auto const lock = std::lock_guard(mutex_);
+
+    // don't overwrite anything that was learned or invalidated while we were listing
+    if (generation_ == generation && std::size(locations_) == n_files)
+    {
+        locations_ = std::move(found);
+        ++generation_;
+    }
+
+    return n_listed;
+}
@@ -0,0 +1,87 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t, uint64_t
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h" // tr_file, tr_file_index_t
+
+/**
+ * Remembers where each of a torrent's files was last found, so that
+ * finding a file doesn't mean stat()ing up to four paths each time.
+ * On network filesystems every one of those is a round trip.
+ *
+ * Files that weren't found aren't remembered, since they can appear at
+ * any time. The cache can't tell when files change behind its back, so
+ * code that creates, moves, renames or removes a torrent's files must
+ * invalidate them. refresh() relearns where every file is by listing
+ * each of the torrent's folders once instead of checking each file. If the
+ * cache changes while it's listing, e.g. because a file was moved, what it
+ * found may already be stale, so it's thrown away.
+ *
+ * Safe to use from more than one thread.
+ */
+class tr_file_locations
+{
+public:
+    enum class Location : uint8_t
+    {
+        Unknown, // not looked for yet, or not found
+        Download, // ${download_dir}/${name}
+        DownloadPartial, // ${download_dir}/${name}.part
+        Incomplete, // ${incomplete_dir}/${name}
+        IncompletePartial // ${incomplete_dir}/${name}.part
+    };
+
+    void reset(size_t n_files);
+
+    [[nodiscard]] Location get(tr_file_index_t file) const;
+
+    void set(tr_file_index_t file, Location location);
+
+    void invalidate(tr_file_index_t file)
+    {
+        set(file, Location::Unknown);
+    }
+
+    void invalidateAll();
+
+    /**
+     * Finds every file by listing the folders they're in. Either dir may be
+     * empty if the torrent doesn't have one. Returns how many folders were
+     * listed, even if the results were thrown away.
+     */
+    size_t refresh(std::string_view download_dir, std::string_view incomplete_dir, tr_file const* files, size_t n_files);
+
+    [[nodiscard]] static constexpr bool isPartial(Location location)
+    {
+        return location == Location::DownloadPartial || location == Location::IncompletePartial;
+    }
+
+    [[nodiscard]] static constexpr bool isIncomplete(Location location)
+    {
+        return location == Location::Incomplete || location == Location::IncompletePartial;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<Location> locations_;
+
+    // bumped by everything that writes to locations_, even if the value's the same,
+    // since invalidating a file that wasn't known still means the disk has changed
+    uint64_t generation_ = 0;
+};
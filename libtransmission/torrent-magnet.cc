@@ -6,8 +6,13 @@
  *
  */
 
+#include <algorithm>
 #include <climits> /* INT_MAX */
 #include <cstring> /* memcpy(), memset(), memcmp() */
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include <event2/buffer.h>
 
@@ -19,6 +24,7 @@
 #include "magnet-metainfo.h"
 #include "metainfo.h"
 #include "resume.h"
+#include "session.h"
 #include "torrent-magnet.h"
 #include "torrent.h"
 #include "tr-assert.h"
@@ -109,47 +115,160 @@ bool tr_torrentSetMetadataSizeHint(tr_torrent* tor, int64_t size)
     return true;
 }
 
-static size_t findInfoDictOffset(tr_torrent const* tor)
+/***
+****
+***/
+
+std::string const* tr_info_dict_cache::get(tr_sha1_digest_t const& info_hash)
 {
-    size_t offset = 0;
+    auto const it = std::find_if(
+        std::begin(entries_),
+        std::end(entries_),
+        [&info_hash](auto const& entry) { return entry.first == info_hash; });
 
-    /* load the file, and find the info dict's offset inside the file */
-    auto fileLen = size_t{};
-    uint8_t* const fileContents = tr_loadFile(tor->info.torrent, &fileLen, nullptr);
-    if (fileContents != nullptr)
+    if (it == std::end(entries_))
     {
-        auto top = tr_variant{};
-        auto const contents_sv = std::string_view{ reinterpret_cast<char const*>(fileContents), fileLen };
-        if (tr_variantFromBuf(&top, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, contents_sv))
-        {
-            tr_variant* infoDict = nullptr;
-            if (tr_variantDictFindDict(&top, TR_KEY_info, &infoDict))
-            {
-                auto infoLen = size_t{};
-                char* infoContents = tr_variantToStr(infoDict, TR_VARIANT_FMT_BENC, &infoLen);
-                uint8_t const* i = (uint8_t const*)tr_memmem((char*)fileContents, fileLen, infoContents, infoLen);
-                offset = i != nullptr ? i - fileContents : 0;
-                tr_free(infoContents);
-            }
+        return nullptr;
+    }
+
+    entries_.splice(std::begin(entries_), entries_, it);
+    return &entries_.front().second;
+}
+
+std::string const* tr_info_dict_cache::add(tr_sha1_digest_t const& info_hash, std::string&& info_dict)
+{
+    erase(info_hash);
+
+    bytes_ += std::size(info_dict);
+    entries_.emplace_front(info_hash, std::move(info_dict));
+
+    // always keep the newest one, even if it's bigger than max_bytes_ on its own
+    while (std::size(entries_) > 1 && (std::size(entries_) > max_entries_ || bytes_ > max_bytes_))
+    {
+        bytes_ -= std::size(entries_.back().second);
+        entries_.pop_back();
+    }
+
+    return &entries_.front().second;
+}
+
+void tr_info_dict_cache::erase(tr_sha1_digest_t const& info_hash)
+{
+    auto const it = std::find_if(
+        std::begin(entries_),
+        std::end(entries_),
+        [&info_hash](auto const& entry) { return entry.first == info_hash; });
+
+    if (it != std::end(entries_))
+    {
+        bytes_ -= std::size(it->second);
+        entries_.erase(it);
+    }
+}
+
+static bool isInfoDict(tr_torrent const* tor, std::string_view benc)
+{
+    uint8_t sha1[SHA_DIGEST_LENGTH];
+    return std::size(benc) == tor->infoDictLength && tr_sha1(sha1, std::data(benc), int(std::size(benc)), nullptr) &&
+        memcmp(sha1, tor->info.hash, SHA_DIGEST_LENGTH) == 0;
+}
+
+/* read the info dict straight out of the .torrent file, if we know where it is */
+static std::optional<std::string> readInfoDict(tr_torrent const* tor)
+{
+    if (!tor->infoDictOffset)
+    {
+        return {};
+    }
+
+    auto const fd = tr_sys_file_open(tor->info.torrent, TR_SYS_FILE_READ, 0, nullptr);
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        return {};
+    }
 
-            tr_variantFree(&top);
+    auto info_dict = std::string(tor->infoDictLength, '\0');
+    auto n_read = uint64_t{};
+    bool const ok = tr_sys_file_read_at(fd, std::data(info_dict), std::size(info_dict), *tor->infoDictOffset, &n_read, nullptr) &&
+        n_read == std::size(info_dict);
+    tr_sys_file_close(fd, nullptr);
+
+    // make sure the file hasn't changed since we found the offset
+    if (!ok || !isInfoDict(tor, info_dict))
+    {
+        return {};
+    }
+
+    return info_dict;
+}
+
+/* parse the .torrent file to find the info dict */
+static std::optional<std::string> loadInfoDict(tr_torrent* tor)
+{
+    auto contents = std::vector<char>{};
+    if (!tr_loadFile(contents, tor->info.torrent))
+    {
+        return {};
+    }
+
+    auto top = tr_variant{};
+    auto arena = tr_variant_arena{};
+    auto const contents_sv = std::string_view{ std::data(contents), std::size(contents) };
+    auto info_dict_sv = std::string_view{};
+    if (!tr_variantFromBenc(
+            &top,
+            TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
+            contents_sv,
+            TR_KEY_info,
+            &info_dict_sv,
+            nullptr,
+            &arena))
+    {
+        return {};
+    }
+
+    auto ret = std::optional<std::string>{};
+
+    if (isInfoDict(tor, info_dict_sv))
+    {
+        tor->infoDictOffset = std::data(info_dict_sv) - std::data(contents_sv);
+        ret = info_dict_sv;
+    }
+    else if (tr_variant* info_dict = nullptr; tr_variantDictFindDict(&top, TR_KEY_info, &info_dict))
+    {
+        // the file's info dict isn't in canonical form, so it's not
+        // byte-for-byte what was hashed. Serve the canonical form.
+        auto len = size_t{};
+        char* benc = tr_variantToStr(info_dict, TR_VARIANT_FMT_BENC, &len);
+        if (isInfoDict(tor, { benc, len }))
+        {
+            ret.emplace(benc, len);
         }
 
-        tr_free(fileContents);
+        tr_free(benc);
     }
 
-    return offset;
+    tr_variantFree(&top);
+    return ret;
 }
 
-static void ensureInfoDictOffsetIsCached(tr_torrent* tor)
+static std::string const* getInfoDict(tr_torrent* tor)
 {
-    TR_ASSERT(tr_torrentHasMetadata(tor));
+    auto& cache = tor->session->info_dict_cache;
+    auto const info_hash = tr_torrentInfoHash(tor);
+
+    if (auto const* const info_dict = cache.get(info_hash); info_dict != nullptr)
+    {
+        return info_dict;
+    }
 
-    if (!tor->infoDictOffsetIsCached)
+    auto info_dict = readInfoDict(tor);
+    if (!info_dict)
     {
-        tor->infoDictOffset = findInfoDictOffset(tor);
-        tor->infoDictOffsetIsCached = true;
+        info_dict = loadInfoDict(tor);
     }
+
+    return info_dict ? cache.add(info_hash, std::move(*info_dict)) : nullptr;
 }
 
 void* tr_torrentGetMetadataPiece(tr_torrent* tor, int piece, size_t* len)
@@ -162,36 +281,18 @@ void* tr_torrentGetMetadataPiece(tr_torrent* tor, int piece, size_t* len)
 
     if (tr_torrentHasMetadata(tor))
     {
-        ensureInfoDictOffsetIsCached(tor);
-
         TR_ASSERT(tor->infoDictLength > 0);
 
-        auto const fd = tr_sys_file_open(tor->info.torrent, TR_SYS_FILE_READ, 0, nullptr);
-        if (fd != TR_BAD_SYS_FILE)
+        if (auto const* const info_dict = getInfoDict(tor); info_dict != nullptr)
         {
             size_t const o = piece * METADATA_PIECE_SIZE;
 
-            if (tr_sys_file_seek(fd, tor->infoDictOffset + o, TR_SEEK_SET, nullptr, nullptr))
+            if (o < std::size(*info_dict))
             {
-                size_t const l = o + METADATA_PIECE_SIZE <= tor->infoDictLength ? METADATA_PIECE_SIZE : tor->infoDictLength - o;
-
-                if (0 < l && l <= METADATA_PIECE_SIZE)
-                {
-                    char* buf = tr_new(char, l);
-                    auto n = uint64_t{};
-
-                    if (tr_sys_file_read(fd, buf, l, &n, nullptr) && n == l)
-                    {
-                        *len = l;
-                        ret = buf;
-                        buf = nullptr;
-                    }
-
-                    tr_free(buf);
-                }
+                size_t const l = std::min(std::size(*info_dict) - o, size_t{ METADATA_PIECE_SIZE });
+                ret = static_cast<char*>(tr_memdup(std::data(*info_dict) + o, l));
+                *len = l;
             }
-
-            tr_sys_file_close(fd, nullptr);
         }
     }
 
@@ -278,15 +379,26 @@ void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, in
         {
             /* checksum passed; now try to parse it as benc */
             auto infoDict = tr_variant{};
+            auto arena = tr_variant_arena{};
             auto const metadata_sv = std::string_view{ m->metadata, m->metadata_size };
-            metainfoParsed = tr_variantFromBuf(&infoDict, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, metadata_sv);
+            metainfoParsed = tr_variantFromBuf(
+                &infoDict,
+                arena,
+                TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
+                metadata_sv);
             if (metainfoParsed)
             {
                 /* yay we have bencoded metainfo... merge it into our .torrent file */
-                tr_variant newMetainfo;
+                auto newMetainfo = tr_variant{};
+                auto contents = std::vector<char>{};
                 char* path = tr_strdup(tor->info.torrent);
 
-                if (tr_variantFromFile(&newMetainfo, TR_VARIANT_PARSE_BENC, path, nullptr))
+                if (tr_loadFile(contents, path) &&
+                    tr_variantFromBuf(
+                        &newMetainfo,
+                        arena,
+                        TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
+                        { std::data(contents), std::size(contents) }))
                 {
                     /* remove any old .torrent and .resume files */
                     tr_sys_path_remove(path, nullptr);
@@ -310,6 +422,10 @@ void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, in
 
                         /* save the new .torrent file */
                         tr_variantToFile(&newMetainfo, TR_VARIANT_FMT_BENC, tor->info.torrent);
+
+                        /* peers are likely to ask us for the metadata we just got */
+                        tor->infoDictOffset.reset();
+                        tor->session->info_dict_cache.add(tr_torrentInfoHash(tor), std::string{ metadata_sv });
                         tr_torrentGotNewInfoDict(tor);
                         tr_torrentSetDirty(tor);
                     }
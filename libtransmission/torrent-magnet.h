@@ -12,12 +12,67 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
 #include <inttypes.h>
+#include <list>
+#include <string>
 #include <time.h>
+#include <utility>
+
+#include "tr-macros.h" // tr_sha1_digest_t
 
 // defined by BEP #9
 inline constexpr int METADATA_PIECE_SIZE = 1024 * 16;
 
+/**
+ * The bencoded "info" dicts of the torrents whose metadata peers have
+ * asked for most recently, so that serving ut_metadata requests doesn't
+ * have to go back to the .torrent file for every piece.
+ *
+ * A peer that wants the metadata asks for all of its pieces in a row,
+ * and a swarm that's missing it tends to ask for the same torrent's,
+ * so a handful of entries covers nearly all of the requests.
+ */
+class tr_info_dict_cache
+{
+public:
+    static auto constexpr DefaultMaxEntries = size_t{ 16 };
+    static auto constexpr DefaultMaxBytes = size_t{ 16 * 1024 * 1024 };
+
+    explicit tr_info_dict_cache(size_t max_entries = DefaultMaxEntries, size_t max_bytes = DefaultMaxBytes)
+        : max_entries_{ max_entries }
+        , max_bytes_{ max_bytes }
+    {
+    }
+
+    // returns the info dict and marks it as the most recently used, or nullptr if it's not cached.
+    // The pointer is good until the next call to add() or erase().
+    [[nodiscard]] std::string const* get(tr_sha1_digest_t const& info_hash);
+
+    // caches an info dict, evicting the least recently used ones if the cache is full
+    std::string const* add(tr_sha1_digest_t const& info_hash, std::string&& info_dict);
+
+    void erase(tr_sha1_digest_t const& info_hash);
+
+    [[nodiscard]] size_t size() const
+    {
+        return std::size(entries_);
+    }
+
+    [[nodiscard]] size_t bytes() const
+    {
+        return bytes_;
+    }
+
+private:
+    // most recently used first
+    std::list<std::pair<tr_sha1_digest_t, std::string>> entries_;
+    size_t bytes_ = 0;
+
+    size_t const max_entries_;
+    size_t const max_bytes_;
+};
+
 void* tr_torrentGetMetadataPiece(tr_torrent* tor, int piece, size_t* len);
 
 void tr_torrentSetMetadataPiece(tr_torrent* tor, int piece, void const* data, int len);
@@ -0,0 +1,420 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "transmission.h"
+
+#include "torrent-queue.h"
+#include "tr-assert.h"
+
+/**
+ * The queue is an implicit treap: a randomized binary tree whose in-order
+ * traversal is the queue order. Nodes don't store their position; instead
+ * each node knows the size of its subtree, so a torrent's position is found
+ * by walking from its node up to the root.
+ */
+class tr_torrent_queue::Impl
+{
+public:
+    void push_back(tr_torrent* tor)
+    {
+        TR_ASSERT(!contains(tor));
+
+        auto& node = nodes_[tor];
+        node.tor = tor;
+        node.priority = static_cast<uint32_t>(rng_());
+        root_ = merge(root_, &node);
+        root_->parent = nullptr;
+    }
+
+    void erase(tr_torrent const* tor)
+    {
+        auto const it = nodes_.find(tor);
+        if (it == std::end(nodes_))
+        {
+            return;
+        }
+
+        detach(&it->second);
+        nodes_.erase(it);
+    }
+
+    void move(tr_torrent const* tor, size_t pos)
+    {
+        auto* const node = find(tor);
+        if (node == nullptr)
+        {
+            return;
+        }
+
+        detach(node);
+
+        auto [left, right] = split(root_, std::min(pos, sizeOf(root_)));
+        root_ = merge(merge(left, node), right);
+        root_->parent = nullptr;
+    }
+
+    void setWaiting(tr_torrent const* tor, std::optional<tr_direction> dir)
+    {
+        auto* node = find(tor);
+        if (node == nullptr || node->waiting_dir == dir)
+        {
+            return;
+        }
+
+        node->waiting_dir = dir;
+
+        for (; node != nullptr; node = node->parent)
+        {
+            update(node);
+        }
+    }
+
+    [[nodiscard]] bool contains(tr_torrent const* tor) const
+    {
+        return nodes_.count(tor) != 0;
+    }
+
+    [[nodiscard]] size_t position(tr_torrent const* tor) const
+    {
+        auto const* node = find(tor);
+        if (node == nullptr)
+        {
+            return size();
+        }
+
+        auto pos = sizeOf(node->left);
+
+        for (; node->parent != nullptr; node = node->parent)
+        {
+            if (node == node->parent->right)
+            {
+                pos += sizeOf(node->parent->left) + 1;
+            }
+        }
+
+        return pos;
+    }
+
+    [[nodiscard]] tr_torrent* at(size_t pos) const
+    {
+        TR_ASSERT(pos < size());
+
+        auto const* node = root_;
+
+        while (node != nullptr)
+        {
+            auto const left_size = sizeOf(node->left);
+
+            if (pos < left_size)
+            {
+                node = node->left;
+            }
+            else if (pos == left_size)
+            {
+                return node->tor;
+            }
+            else
+            {
+                pos -= left_size + 1;
+                node = node->right;
+            }
+        }
+
+        return nullptr;
+    }
+
+    [[nodiscard]] std::vector<tr_torrent*> range(size_t begin, size_t end) const
+    {
+        end = std::min(end, size());
+
+        auto ret = std::vector<tr_torrent*>{};
+        if (begin < end)
+        {
+            ret.reserve(end - begin);
+            collectRange(root_, 0, begin, end, ret);
+        }
+
+        return ret;
+    }
+
+    [[nodiscard]] std::vector<tr_torrent*> nextWaiting(tr_direction dir, size_t n) const
+    {
+        auto ret = std::vector<tr_torrent*>{};
+        ret.reserve(std::min(n, countWaiting(dir)));
+        collectWaiting(root_, dir, n, ret);
+        return ret;
+    }
+
+    [[nodiscard]] size_t countWaiting(tr_direction dir) const
+    {
+        return waitingOf(root_, dir);
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return sizeOf(root_);
+    }
+
+private:
+    struct Node
+    {
+        tr_torrent* tor = nullptr;
+
+        Node* left = nullptr;
+        Node* right = nullptr;
+        Node* parent = nullptr;
+
+        uint32_t priority = 0;
+
+        // number of nodes in this subtree
+        size_t size = 1;
+
+        // number of nodes in this subtree waiting in each direction's queue
+        std::array<size_t, 2> waiting = {};
+
+        std::optional<tr_direction> waiting_dir;
+    };
+
+    [[nodiscard]] static size_t sizeOf(Node const* node)
+    {
+        return node != nullptr ? node->size : 0;
+    }
+
+    [[nodiscard]] static size_t waitingOf(Node const* node, tr_direction dir)
+    {
+        return node != nullptr ? node->waiting[dir] : 0;
+    }
+
+    static void update(Node* node)
+    {
+        node->size = 1 + sizeOf(node->left) + sizeOf(node->right);
+
+        for (auto const dir : { TR_UP, TR_DOWN })
+        {
+            auto const self = node->waiting_dir == dir ? 1 : 0;
+            node->waiting[dir] = waitingOf(node->left, dir) + waitingOf(node->right, dir) + self;
+        }
+
+        if (node->left != nullptr)
+        {
+            node->left->parent = node;
+        }
+
+        if (node->right != nullptr)
+        {
+            node->right->parent = node;
+        }
+    }
+
+    // split `node`'s subtree into its first `n` nodes and the rest
+    static std::pair<Node*, Node*> split(Node* node, size_t n)
+    {
+        if (node == nullptr)
+        {
+            return {};
+        }
+
+        if (auto const left_size = sizeOf(node->left); n <= left_size)
+        {
+            auto [left, right] = split(node->left, n);
+            node->left = right;
+            update(node);
+            if (left != nullptr)
+            {
+                left->parent = nullptr;
+            }
+            return { left, node };
+        }
+        else
+        {
+            auto [left, right] = split(node->right, n - left_size - 1);
+            node->right = left;
+            update(node);
+            if (right != nullptr)
+            {
+                right->parent = nullptr;
+            }
+            return { node, right };
+        }
+    }
+
+    // join two subtrees, with every node in `a` ordered before every node in `b`
+    static Node* merge(Node* a, Node* b)
+    {
+        if (a == nullptr)
+        {
+            return b;
+        }
+
+        if (b == nullptr)
+        {
+            return a;
+        }
+
+        if (a->priority > b->priority)
+        {
+            a->right = merge(a->right, b);
+            update(a);
+            return a;
+        }
+
+        b->left = merge(a, b->left);
+        update(b);
+        return b;
+    }
+
+    // unlink `node` from the tree, leaving it as a lone node
+    void detach(Node* node)
+    {
+        auto const pos = position(node->tor);
+
+        auto [left, rest] = split(root_, pos);
+        auto [middle, right] = split(rest, 1);
+        TR_ASSERT(middle == node);
+
+        root_ = merge(left, right);
+        if (root_ != nullptr)
+        {
+            root_->parent = nullptr;
+        }
+
+        middle->left = middle->right = middle->parent = nullptr;
+        update(middle);
+    }
+
+    // `offset` is the position of the first node in `node`'s subtree
+    static void collectRange(Node const* node, size_t offset, size_t begin, size_t end, std::vector<tr_torrent*>& setme)
+    {
+        if (node == nullptr || offset >= end || offset + node->size <= begin)
+        {
+            return;
+        }
+
+        auto const pos = offset + sizeOf(node->left);
+
+        collectRange(node->left, offset, begin, end, setme);
+
+        if (begin <= pos && pos < end)
+        {
+            setme.push_back(node->tor);
+        }
+
+        collectRange(node->right, pos + 1, begin, end, setme);
+    }
+
+    static void collectWaiting(Node const* node, tr_direction dir, size_t n, std::vector<tr_torrent*>& setme)
+    {
+        if (node == nullptr || node->waiting[dir] == 0 || std::size(setme) >= n)
+        {
+            return;
+        }
+
+        collectWaiting(node->left, dir, n, setme);
+
+        if (std::size(setme) < n && node->waiting_dir == dir)
+        {
+            setme.push_back(node->tor);
+        }
+
+        collectWaiting(node->right, dir, n, setme);
+    }
+
+    [[nodiscard]] Node* find(tr_torrent const* tor)
+    {
+        auto const it = nodes_.find(tor);
+        return it != std::end(nodes_) ? &it->second : nullptr;
+    }
+
+    [[nodiscard]] Node const* find(tr_torrent const* tor) const
+    {
+        auto const it = nodes_.find(tor);
+        return it != std::end(nodes_) ? &it->second : nullptr;
+    }
+
+    // node-based container, so Node addresses are stable
+    std::unordered_map<tr_torrent const*, Node> nodes_;
+
+    Node* root_ = nullptr;
+
+    std::minstd_rand rng_;
+};
+
+/***
+****
+***/
+
+tr_torrent_queue::tr_torrent_queue()
+    : impl_{ std::make_unique<Impl>() }
+{
+}
+
+tr_torrent_queue::~tr_torrent_queue() = default;
+
+void tr_torrent_queue::push_back(tr_torrent* tor)
+{
+    impl_->push_back(tor);
+}
+
+void tr_torrent_queue::erase(tr_torrent const* tor)
+{
+    impl_->erase(tor);
+}
+
+void tr_torrent_queue::move(tr_torrent const* tor, size_t pos)
+{
+    impl_->move(tor, pos);
+}
+
+void tr_torrent_queue::setWaiting(tr_torrent const* tor, std::optional<tr_direction> dir)
+{
+    impl_->setWaiting(tor, dir);
+}
+
+bool tr_torrent_queue::contains(tr_torrent const* tor) const
+{
+    return impl_->contains(tor);
+}
+
+size_t tr_torrent_queue::position(tr_torrent const* tor) const
+{
+    return impl_->position(tor);
+}
+
+tr_torrent* tr_torrent_queue::at(size_t pos) const
+{
+    return impl_->at(pos);
+}
+
+std::vector<tr_torrent*> tr_torrent_queue::range(size_t begin, size_t end) const
+{
+    return impl_->range(begin, end);
+}
+
+std::vector<tr_torrent*> tr_torrent_queue::nextWaiting(tr_direction dir, size_t n) const
+{
+    return impl_->nextWaiting(dir, n);
+}
+
+size_t tr_torrent_queue::countWaiting(tr_direction dir) const
+{
+    return impl_->countWaiting(dir);
+}
+
+size_t tr_torrent_queue::size() const
+{
+    return impl_->size();
+}
@@ -0,0 +1,76 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "transmission.h" // tr_direction, tr_torrent
+
+/**
+ * The session's download/seed queue.
+ *
+ * Torrents are kept in queue order in an order-statistic tree, so that
+ * looking up a torrent's position, moving it, adding it, and removing it
+ * are all O(log n) and never need to renumber the rest of the queue.
+ *
+ * Each torrent can also be flagged as waiting for a slot in one of the
+ * two directions. Those flags are aggregated in the tree so that finding
+ * the next torrents to start is O(k log n) instead of a scan + sort.
+ */
+class tr_torrent_queue
+{
+public:
+    tr_torrent_queue();
+    ~tr_torrent_queue();
+
+    tr_torrent_queue(tr_torrent_queue const&) = delete;
+    tr_torrent_queue& operator=(tr_torrent_queue const&) = delete;
+
+    // add `tor` to the end of the queue
+    void push_back(tr_torrent* tor);
+
+    // remove `tor` from the queue. Everything behind it moves up one place.
+    void erase(tr_torrent const* tor);
+
+    // move `tor` to `pos`. Positions past the end are clamped to the end.
+    void move(tr_torrent const* tor, size_t pos);
+
+    // flag `tor` as waiting for a slot in `dir`'s queue, or as not waiting at all
+    void setWaiting(tr_torrent const* tor, std::optional<tr_direction> dir);
+
+    [[nodiscard]] bool contains(tr_torrent const* tor) const;
+
+    // returns the zero-based position of `tor` in the queue
+    [[nodiscard]] size_t position(tr_torrent const* tor) const;
+
+    // returns the torrent at zero-based position `pos`
+    [[nodiscard]] tr_torrent* at(size_t pos) const;
+
+    // returns the torrents at positions [begin, end), in queue order. O(log n + k)
+    [[nodiscard]] std::vector<tr_torrent*> range(size_t begin, size_t end) const;
+
+    // returns up to `n` of the torrents waiting in `dir`'s queue, in queue order
+    [[nodiscard]] std::vector<tr_torrent*> nextWaiting(tr_direction dir, size_t n) const;
+
+    // returns the number of torrents waiting in `dir`'s queue
+    [[nodiscard]] size_t countWaiting(tr_direction dir) const;
+
+    [[nodiscard]] size_t size() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> const impl_;
+};
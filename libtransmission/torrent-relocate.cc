@@ -0,0 +1,251 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include "transmission.h"
+
+#include "error.h"
+#include "file.h"
+#include "torrent-relocate.h"
+#include "tr-assert.h"
+#include "utils.h"
+
+using namespace std::literals;
+
+namespace
+{
+
+auto next_relocation_id = std::atomic<uint64_t>{ 1 };
+
+} // namespace
+
+struct tr_relocation::CopyProgress
+{
+    tr_relocation* job;
+    uint64_t bytes_copied;
+};
+
+tr_relocation::tr_relocation(
+    std::string location,
+    std::vector<File> files,
+    double volatile* setme_progress,
+    int volatile* setme_state)
+    : id_{ next_relocation_id++ }
+    , location_{ std::move(location) }
+    , files_{ std::move(files) }
+    , setme_progress_{ setme_progress }
+    , setme_state_{ setme_state }
+{
+    for (auto const& file : files_)
+    {
+        total_bytes_ += file.length;
+    }
+}
+
+tr_relocation::~tr_relocation()
+{
+    cancel();
+    join();
+}
+
+void tr_relocation::start(NotifyFunc notify, void* user_data)
+{
+    TR_ASSERT(std::empty(threads_));
+
+    notify_ = notify;
+    notify_user_data_ = user_data;
+
+    auto const n_threads = std::clamp(std::size(files_), size_t{ 1 }, MaxThreads);
+    n_running_ = n_threads;
+
+    for (size_t i = 0; i < n_threads; ++i)
+    {
+        threads_.emplace_back(&tr_relocation::run, this);
+    }
+}
+
+void tr_relocation::join()
+{
+    for (auto& thread : threads_)
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    threads_.clear();
+}
+
+void tr_relocation::run()
+{
+    for (;;)
+    {
+        auto const i = next_file_++;
+
+        if (i >= std::size(files_) || cancelled_)
+        {
+            break;
+        }
+
+        if (!prepare(files_[i]))
+        {
+            cancelled_ = true;
+        }
+    }
+
+    // the last one out says we're done
+    if (--n_running_ == 0)
+    {
+        done_ = true;
+        notify();
+    }
+}
+
+bool tr_relocation::prepare(File& file)
+{
+    // an earlier job already copied it
+    if (!std::empty(file.tmppath))
+    {
+        addBytesDone(file.length);
+        return true;
+    }
+
+    tr_error* error = nullptr;
+
+    char* const newdir = tr_sys_path_dirname(file.newpath, &error);
+    bool ok = newdir != nullptr && tr_sys_dir_create(newdir, TR_SYS_DIR_CREATE_PARENTS, 0777, &error);
+
+    // a rename is instant, so wait for the switch-over
+    if (ok && tr_sys_path_is_same_filesystem(file.oldpath.c_str(), newdir, nullptr))
+    {
+        file.tmppath.clear();
+        addBytesDone(file.length);
+        tr_free(newdir);
+        return true;
+    }
+
+    tr_free(newdir);
+
+    if (ok)
+    {
+        file.tmppath = tr_strvJoin(file.newpath, ".relocating");
+
+        // leftovers from an earlier attempt
+        tr_sys_path_remove(file.tmppath.c_str(), nullptr);
+
+        auto progress = CopyProgress{ this, 0 };
+        auto const on_progress = [](uint64_t bytes_copied, void* vprogress)
+        {
+            auto* const p = static_cast<CopyProgress*>(vprogress);
+            p->job->addBytesDone(bytes_copied - p->bytes_copied);
+            p->bytes_copied = bytes_copied;
+            return !p->job->isCancelled();
+        };
+
+        ok = tr_sys_path_copy(file.oldpath.c_str(), file.tmppath.c_str(), on_progress, &progress, &error);
+
+        // the file may be smaller than its length if it isn't complete yet
+        if (ok && progress.bytes_copied < file.length)
+        {
+            addBytesDone(file.length - progress.bytes_copied);
+        }
+    }
+
+    if (!ok && !isCancelled())
+    {
+        auto const lock = std::lock_guard(error_mutex_);
+
+        if (std::empty(error_message_))
+        {
+            error_message_ = tr_strvJoin(
+                "error moving \""sv,
+                file.oldpath,
+                "\" to \""sv,
+                file.newpath,
+                "\": "sv,
+                error != nullptr ? error->message : "");
+        }
+    }
+
+    tr_error_clear(&error);
+    return ok;
+}
+
+void tr_relocation::addBytesDone(uint64_t n_bytes)
+{
+    auto const bytes_done = bytes_done_ += n_bytes;
+
+    if (total_bytes_ == 0)
+    {
+        return;
+    }
+
+    // only the worker that moves it along gets to say so
+    auto const percent = std::min(uint64_t{ 100 }, bytes_done * 100 / total_bytes_);
+    auto notified = percent_notified_.load();
+    while (notified < percent)
+    {
+        if (percent_notified_.compare_exchange_weak(notified, percent))
+        {
+            notify();
+            break;
+        }
+    }
+}
+
+void tr_relocation::notify()
+{
+    if (notify_ != nullptr && !notify_pending_.exchange(true))
+    {
+        notify_(notify_user_data_);
+    }
+}
+
+void tr_relocation::removeTempFiles() const
+{
+    for (auto const& file : files_)
+    {
+        if (!std::empty(file.tmppath))
+        {
+            tr_sys_path_remove(file.tmppath.c_str(), nullptr);
+        }
+    }
+}
+
+void tr_relocation::publishProgress() const
+{
+    if (total_bytes_ > 0)
+    {
+        setProgress(std::min(1.0, static_cast<double>(bytes_done_) / total_bytes_));
+    }
+}
+
+void tr_relocation::setProgress(double progress) const
+{
+    if (setme_progress_ != nullptr)
+    {
+        *setme_progress_ = progress;
+    }
+}
+
+void tr_relocation::setState(int state) const
+{
+    if (setme_state_ != nullptr)
+    {
+        *setme_state_ = state;
+    }
+}
+
+std::string tr_relocation::errorMessage() const
+{
+    auto const lock = std::lock_guard(error_mutex_);
+    return error_message_;
+}
@@ -0,0 +1,190 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transmission.h" // tr_file_index_t
+
+/**
+ * The slow half of moving a torrent's data: a background job that gets
+ * each file ready to be switched over to its new location.
+ *
+ * Files that are on the same filesystem as their new location will be
+ * renamed at the switch-over, so there's nothing to do for them here.
+ * The rest are copied next to their new path, several at a time, on
+ * worker threads. The originals aren't touched, so the torrent keeps
+ * seeding from them while the copies are made.
+ *
+ * The workers don't touch the caller's progress and state themselves.
+ * Instead they call `notify` whenever the job is another percent along,
+ * and once more when every file is ready; the caller then calls
+ * clearNotified(), publishes the progress with publishProgress() and
+ * checks isDone() on its own thread. Until clearNotified() is called,
+ * further notifications are folded into the one that's pending.
+ * Doing the switch-over itself is up to the caller. If some files changed
+ * while they were being copied, the caller can start another job for
+ * them, passing along the copies that are still good.
+ */
+class tr_relocation
+{
+public:
+    struct File
+    {
+        tr_file_index_t index = {};
+        std::string oldpath;
+        std::string newpath;
+
+        // where the copy is made. Empty if the file will be renamed instead.
+        // If it's set when the job starts, an earlier job already made the copy.
+        std::string tmppath;
+
+        uint64_t length = 0;
+
+        // how many bytes of the file we had when the copy was made,
+        // so the caller can tell if it changed while being copied
+        uint64_t has_bytes = 0;
+    };
+
+    // how many files to copy at once
+    static auto constexpr MaxThreads = size_t{ 4 };
+
+    using NotifyFunc = void (*)(void* user_data);
+
+    tr_relocation(
+        std::string location,
+        std::vector<File> files,
+        double volatile* setme_progress,
+        int volatile* setme_state);
+
+    tr_relocation(tr_relocation const&) = delete;
+    tr_relocation& operator=(tr_relocation const&) = delete;
+
+    // cancels the job and waits for its threads to finish
+    ~tr_relocation();
+
+    void start(NotifyFunc notify, void* user_data);
+
+    // asks the job to stop. `notify` is still called when it has.
+    void cancel()
+    {
+        cancelled_ = true;
+    }
+
+    // waits for the worker threads to exit
+    void join();
+
+    // removes any copies that have been made
+    void removeTempFiles() const;
+
+    // lets the workers call `notify` again. Call it before looking at the job.
+    void clearNotified()
+    {
+        notify_pending_ = false;
+    }
+
+    // these write to the caller's progress and state, so call them from the caller's thread
+    void publishProgress() const;
+    void setProgress(double progress) const;
+    void setState(int state) const;
+
+    [[nodiscard]] bool isCancelled() const
+    {
+        return cancelled_;
+    }
+
+    // true once every worker has finished
+    [[nodiscard]] bool isDone() const
+    {
+        return done_;
+    }
+
+    // whether the torrent was stopped to keep its files from changing during
+    // the job, and so should be started again when it's over
+    void setRestartTorrent(bool restart)
+    {
+        restart_torrent_ = restart;
+    }
+
+    [[nodiscard]] bool restartTorrent() const
+    {
+        return restart_torrent_;
+    }
+
+    // if the job failed, the reason why
+    [[nodiscard]] std::string errorMessage() const;
+
+    [[nodiscard]] uint64_t id() const
+    {
+        return id_;
+    }
+
+    [[nodiscard]] std::string const& location() const
+    {
+        return location_;
+    }
+
+    [[nodiscard]] std::vector<File> const& files() const
+    {
+        return files_;
+    }
+
+    // where progress and state are reported, so that a follow-up job can do the same
+    [[nodiscard]] double volatile* progressTarget() const
+    {
+        return setme_progress_;
+    }
+
+    [[nodiscard]] int volatile* stateTarget() const
+    {
+        return setme_state_;
+    }
+
+private:
+    struct CopyProgress;
+
+    void run();
+    bool prepare(File& file);
+    void addBytesDone(uint64_t n_bytes);
+    void notify();
+
+    uint64_t const id_;
+    std::string const location_;
+    std::vector<File> files_;
+    double volatile* const setme_progress_;
+    int volatile* const setme_state_;
+
+    uint64_t total_bytes_ = 0;
+    std::atomic<uint64_t> bytes_done_ = 0;
+    std::atomic<uint64_t> percent_notified_ = 0;
+
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_file_ = 0;
+    std::atomic<size_t> n_running_ = 0;
+    std::atomic<bool> cancelled_ = false;
+    std::atomic<bool> done_ = false;
+    bool restart_torrent_ = false;
+
+    NotifyFunc notify_ = nullptr;
+    void* notify_user_data_ = nullptr;
+    std::atomic<bool> notify_pending_ = false;
+
+    mutable std::mutex error_mutex_;
+    std::string error_message_;
+};
@@ -15,10 +15,12 @@
 #include <cstdarg>
 #include <cstdlib> /* qsort */
 #include <cstring> /* memcmp */
+#include <optional>
 #include <set>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifndef _WIN32
@@ -51,8 +53,10 @@
 #include "session.h"
 #include "subprocess.h"
 #include "torrent-magnet.h"
+#include "torrent-relocate.h"
 #include "torrent.h"
 #include "tr-assert.h"
+#include "tr-lpd.h"
 #include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 #include "variant.h"
@@ -105,14 +109,16 @@ tr_torrent* tr_torrentFindFromHashString(tr_session* session, std::string_view h
 
 tr_torrent* tr_torrentFindFromHash(tr_session* session, uint8_t const* hash)
 {
-    auto& src = session->torrentsByHash;
-    auto it = src.find(hash);
-    return it == std::end(src) ? nullptr : it->second;
+    auto digest = tr_sha1_digest_t{};
+    std::copy_n(reinterpret_cast<std::byte const*>(hash), SHA_DIGEST_LENGTH, std::begin(digest));
+    return tr_torrentFindFromHash(session, digest);
 }
 
 tr_torrent* tr_torrentFindFromHash(tr_session* session, tr_sha1_digest_t const& info_dict_hash)
 {
-    return tr_torrentFindFromHash(session, reinterpret_cast<uint8_t const*>(std::data(info_dict_hash)));
+    auto& src = session->torrentsByHash;
+    auto it = src.find(info_dict_hash);
+    return it == std::end(src) ? nullptr : it->second;
 }
 
 tr_torrent* tr_torrentFindFromMagnetLink(tr_session* session, char const* magnet_link)
@@ -453,6 +459,30 @@ bool tr_torrentGetSeedIdle(tr_torrent const* tor, uint16_t* idleMinutes)
     return isLimited;
 }
 
+/***
+****
+***/
+
+void tr_torrentSetChokeAlgorithm(tr_torrent* tor, tr_choke_algorithm algorithm)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(algorithm == TR_CHOKE_TIT_FOR_TAT || algorithm == TR_CHOKE_ROUND_ROBIN);
+
+    if (algorithm != tor->chokeAlgorithm)
+    {
+        tor->chokeAlgorithm = algorithm;
+
+        tr_torrentSetDirty(tor);
+    }
+}
+
+tr_choke_algorithm tr_torrentGetChokeAlgorithm(tr_torrent const* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    return tor->chokeAlgorithm;
+}
+
 static bool tr_torrentIsSeedIdleLimitDone(tr_torrent* tor)
 {
     auto idleMinutes = uint16_t{};
@@ -597,7 +627,11 @@ static void tr_torrentFireMetadataCompleted(tr_torrent* tor);
 void tr_torrentGotNewInfoDict(tr_torrent* tor)
 {
     tor->initSizes(tor->info.totalSize, tor->info.pieceSize);
-    tor->completion = tr_completion{ tor, tor };
+    tor->fpm_.reset(tor->info);
+    tor->file_priorities_.reset(&tor->fpm_);
+    tor->files_wanted_.reset(&tor->fpm_);
+    tor->file_locations_.reset(tor->info.fileCount);
+    tor->completion = tr_completion{ tor, tor, &tor->fpm_ };
     tr_torrentInitFileOffsets(tor);
 
     tr_peerMgrOnTorrentGotMetainfo(tor);
@@ -608,12 +642,25 @@ void tr_torrentGotNewInfoDict(tr_torrent* tor)
 static bool hasAnyLocalData(tr_torrent const* tor)
 {
     auto filename = std::string{};
+    auto info = tr_sys_path_info{};
 
-    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    // usually the data's there, and checking the first file says so
+    if (tor->findFile(filename, 0, &info))
+    {
+        return true;
+    }
+
+    // otherwise list each folder once instead of looking for every file
+    if (tor->fileCount() > 1)
     {
-        if (tor->findFile(filename, i))
+        tor->refreshFileLocations();
+
+        for (tr_file_index_t i = 1, n = tor->fileCount(); i < n; ++i)
         {
-            return true;
+            if (tor->hasFileLocation(i))
+            {
+                return true;
+            }
         }
     }
 
@@ -663,10 +710,10 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
     tor->fpm_.reset(tor->info);
     tor->file_priorities_.reset(&tor->fpm_);
     tor->files_wanted_.reset(&tor->fpm_);
+    tor->file_locations_.reset(tor->info.fileCount);
 
     tor->session = session;
     tor->uniqueId = nextUniqueId++;
-    tor->queuePosition = tr_sessionCountTorrents(session);
 
     tor->dnd_pieces_ = tr_bitfield{ tor->info.pieceCount };
     tor->checked_pieces_ = tr_bitfield{ tor->info.pieceCount };
@@ -703,7 +750,7 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
     tr_torrentSetDateAdded(tor, tr_time()); /* this is a default value to be overwritten by the resume file */
 
     tor->initSizes(tor->info.totalSize, tor->info.pieceSize);
-    tor->completion = tr_completion{ tor, tor };
+    tor->completion = tr_completion{ tor, tor, &tor->fpm_ };
     tr_torrentInitFileOffsets(tor);
 
     // tr_torrentLoadResume() calls a lot of tr_torrentSetFoo() methods
@@ -797,13 +844,13 @@ static void torrentInit(tr_torrent* tor, tr_ctor const* ctor)
 
 tr_parse_result tr_torrentParse(tr_ctor const* ctor, tr_info* setmeInfo)
 {
-    tr_variant const* metainfo = nullptr;
-    if (!tr_ctorGetMetainfo(ctor, &metainfo))
+    auto const metainfo = tr_ctorGetMetainfo(ctor);
+    if (!metainfo)
     {
         return TR_PARSE_ERR;
     }
 
-    auto parsed = tr_metainfoParse(tr_ctorGetSession(ctor), metainfo, nullptr);
+    auto parsed = tr_metainfoParse(tr_ctorGetSession(ctor), *metainfo, nullptr, tr_ctorGetDefaultName(ctor));
     if (!parsed)
     {
         return TR_PARSE_ERR;
@@ -824,9 +871,8 @@ tr_torrent* tr_torrentNew(tr_ctor const* ctor, int* setme_error, int* setme_dupl
     auto* const session = tr_ctorGetSession(ctor);
     TR_ASSERT(tr_isSession(session));
 
-    tr_variant const* metainfo = nullptr;
-    tr_ctorGetMetainfo(ctor, &metainfo);
-    auto parsed = tr_metainfoParse(session, metainfo, nullptr);
+    auto const metainfo = tr_ctorGetMetainfo(ctor).value_or(std::string_view{});
+    auto parsed = tr_metainfoParse(session, metainfo, nullptr, tr_ctorGetDefaultName(ctor));
     if (!parsed)
     {
         if (setme_error != nullptr)
@@ -855,6 +901,7 @@ tr_torrent* tr_torrentNew(tr_ctor const* ctor, int* setme_error, int* setme_dupl
 
     auto* tor = new tr_torrent{ parsed->info };
     tor->swapMetainfo(*parsed);
+    tor->infoDictOffset = tr_ctorGetInfoDictOffset(ctor);
     torrentInit(tor, ctor);
     return tor;
 }
@@ -871,6 +918,7 @@ void tr_torrentSetDownloadDir(tr_torrent* tor, char const* path)
     {
         tr_free(tor->downloadDir);
         tor->downloadDir = tr_strdup(path);
+        tor->invalidateFileLocations();
 
         tr_torrentMarkEdited(tor);
         tr_torrentSetDirty(tor);
@@ -1017,7 +1065,7 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     s->id = tor->uniqueId;
     s->activity = tr_torrentGetActivity(tor);
     s->error = tor->error;
-    s->queuePosition = tor->queuePosition;
+    s->queuePosition = tr_torrentGetQueuePosition(tor);
     s->idleSecs = torrentGetIdleSecs(tor, s->activity);
     s->isStalled = tr_torrentIsStalled(tor, s->idleSecs);
     s->errorString = tor->errorString;
@@ -1033,11 +1081,23 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
         s->peersFrom[i] = swarm_stats.peerFromCount[i];
     }
 
-    s->rawUploadSpeed_KBps = toSpeedKBps(tor->bandwidth->getRawSpeedBytesPerSecond(now, TR_UP));
-    s->rawDownloadSpeed_KBps = toSpeedKBps(tor->bandwidth->getRawSpeedBytesPerSecond(now, TR_DOWN));
-    auto const pieceUploadSpeed_Bps = tor->bandwidth->getPieceSpeedBytesPerSecond(now, TR_UP);
+    /* Nothing can be transferred without a peer or a webseed, so once the
+     * speeds have wound down to zero they stay there until one connects.
+     * Idle torrents skip reading their speed histories. */
+    auto pieceUploadSpeed_Bps = 0U;
+    auto pieceDownloadSpeed_Bps = 0U;
+    bool const is_quiet = swarm_stats.peerCount == 0 && swarm_stats.activeWebseedCount == 0 &&
+        s->rawUploadSpeed_KBps == 0 && s->rawDownloadSpeed_KBps == 0;
+
+    if (!is_quiet)
+    {
+        s->rawUploadSpeed_KBps = toSpeedKBps(tor->bandwidth->getRawSpeedBytesPerSecond(now, TR_UP));
+        s->rawDownloadSpeed_KBps = toSpeedKBps(tor->bandwidth->getRawSpeedBytesPerSecond(now, TR_DOWN));
+        pieceUploadSpeed_Bps = tor->bandwidth->getPieceSpeedBytesPerSecond(now, TR_UP);
+        pieceDownloadSpeed_Bps = tor->bandwidth->getPieceSpeedBytesPerSecond(now, TR_DOWN);
+    }
+
     s->pieceUploadSpeed_KBps = toSpeedKBps(pieceUploadSpeed_Bps);
-    auto const pieceDownloadSpeed_Bps = tor->bandwidth->getPieceSpeedBytesPerSecond(now, TR_DOWN);
     s->pieceDownloadSpeed_KBps = toSpeedKBps(pieceDownloadSpeed_Bps);
 
     s->percentComplete = tor->completion.percentComplete();
@@ -1168,52 +1228,6 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
 ****
 ***/
 
-static uint64_t countFileBytesCompleted(tr_torrent const* tor, tr_file_index_t index)
-{
-    tr_file const& f = tor->info.files[index];
-    if (f.length == 0)
-    {
-        return 0;
-    }
-
-    auto const [begin, end] = tr_torGetFileBlockSpan(tor, index);
-    auto const n = end - begin;
-
-    if (n == 0)
-    {
-        return 0;
-    }
-
-    if (n == 1)
-    {
-        return tor->hasBlock(begin) ? f.length : 0;
-    }
-
-    auto total = uint64_t{};
-
-    // the first block
-    if (tor->hasBlock(begin))
-    {
-        total += tor->block_size - f.priv.offset % tor->block_size;
-    }
-
-    // the middle blocks
-    if (end - begin > 2)
-    {
-        uint64_t u = tor->completion.blocks().count(begin + 1, end - 1);
-        u *= tor->block_size;
-        total += u;
-    }
-
-    // the last block
-    if (tor->hasBlock(end - 1))
-    {
-        total += f.priv.offset + f.length - (uint64_t)tor->block_size * (end - 1);
-    }
-
-    return total;
-}
-
 tr_file_view tr_torrentFile(tr_torrent const* torrent, tr_file_index_t i)
 {
     TR_ASSERT(tr_isTorrent(torrent));
@@ -1230,7 +1244,7 @@ tr_file_view tr_torrentFile(tr_torrent const* torrent, tr_file_index_t i)
         return { name, length, length, 1.0, priority, wanted };
     }
 
-    auto const have = countFileBytesCompleted(torrent, i);
+    auto const have = torrent->completion.countHasBytesInFile(i);
     return { name, have, length, have >= length ? 1.0 : have / double(length), priority, wanted };
 }
 
@@ -1309,9 +1323,7 @@ static void tr_torrentResetTransferStats(tr_torrent* tor)
 ****
 ***/
 
-#ifdef TR_ENABLE_ASSERTS
-static bool queueIsSequenced(tr_session*);
-#endif
+static void abortRelocation(tr_torrent* tor);
 
 static void freeTorrent(tr_torrent* tor)
 {
@@ -1319,35 +1331,22 @@ static void freeTorrent(tr_torrent* tor)
 
     TR_ASSERT(!tor->isRunning);
 
+    abortRelocation(tor);
+
     tr_session* session = tor->session;
     tr_info* inf = &tor->info;
-    time_t const now = tr_time();
 
     tr_peerMgrRemoveTorrent(tor);
 
     tr_announcerRemoveTorrent(session->announcer, tor);
 
+    session->info_dict_cache.erase(tr_torrentInfoHash(tor));
+
     tr_free(tor->downloadDir);
     tr_free(tor->incompleteDir);
 
     tr_sessionRemoveTorrent(session, tor);
 
-    if (!session->isClosing())
-    {
-        // "so you die, captain, and we all move up in rank."
-        // resequence the queue positions
-        for (auto* t : session->torrents)
-        {
-            if (t->queuePosition > tor->queuePosition)
-            {
-                t->queuePosition--;
-                t->anyDate = now;
-            }
-        }
-
-        TR_ASSERT(queueIsSequenced(session));
-    }
-
     delete tor->bandwidth;
 
     tr_metainfoFree(inf);
@@ -1381,9 +1380,7 @@ static void torrentStartImpl(void* vtor)
 
     tr_torrentResetTransferStats(tor);
     tr_announcerTorrentStarted(tor);
-    tor->dhtAnnounceAt = now + tr_rand_int_weak(20);
-    tor->dhtAnnounce6At = now + tr_rand_int_weak(20);
-    tor->lpdAnnounceAt = now;
+    tr_lpdTorrentStarted(tor);
     tr_peerMgrStartTorrent(tor);
 }
 
@@ -1621,6 +1618,9 @@ static void stopTorrent(void* vtor)
 
     torrentSetQueued(tor, false);
 
+    // a slot may have opened up for a queued torrent
+    tr_peerMgrQueueChanged(tor->session->peerMgr);
+
     if (tor->magnetVerify)
     {
         tor->magnetVerify = false;
@@ -1632,6 +1632,14 @@ static void stopTorrent(void* vtor)
     }
 }
 
+static void torrentMarkStopped(tr_torrent* tor)
+{
+    tor->isRunning = false;
+    tor->isStopping = false;
+    tor->prefetchMagnetMetadata = false;
+    tr_torrentSetDirty(tor);
+}
+
 void tr_torrentStop(tr_torrent* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
@@ -1640,10 +1648,7 @@ void tr_torrentStop(tr_torrent* tor)
     {
         auto const lock = tor->unique_lock();
 
-        tor->isRunning = false;
-        tor->isStopping = false;
-        tor->prefetchMagnetMetadata = false;
-        tr_torrentSetDirty(tor);
+        torrentMarkStopped(tor);
         tr_runInEventThread(tor->session, stopTorrent, tor);
     }
 }
@@ -1700,6 +1705,9 @@ static void removeTorrent(void* vdata)
     auto* data = static_cast<struct remove_data*>(vdata);
     auto const lock = data->tor->unique_lock();
 
+    /* don't leave copies behind, or delete files out from under the copiers */
+    abortRelocation(data->tor);
+
     if (data->deleteFlag)
     {
         tr_torrentDeleteLocalData(data->tor, data->deleteFunc);
@@ -1879,6 +1887,11 @@ static void torrentCallScript(tr_torrent const* tor, char const* script)
     tr_free(torrent_dir);
 }
 
+void tr_torrent::onFilesChanged()
+{
+    tr_peerMgrFilesChanged(this);
+}
+
 void tr_torrent::recheckCompleteness()
 {
     auto const lock = unique_lock();
@@ -1903,6 +1916,15 @@ void tr_torrent::recheckCompleteness()
         this->completeness = new_completeness;
         tr_fdTorrentClose(this->session, this->uniqueId);
 
+        // the torrent may have moved between the download and seed queues,
+        // or freed up a download slot
+        if (tr_torrentIsQueued(this))
+        {
+            session->torrentQueue.setWaiting(this, tr_torrentGetQueueDirection(this));
+        }
+
+        tr_peerMgrQueueChanged(session->peerMgr);
+
         if (tr_torrentIsSeed(this))
         {
             if (recentChange)
@@ -2161,6 +2183,8 @@ bool tr_torrentSetAnnounceList(tr_torrent* tor, tr_tracker_info const* trackers_
     auto const lock = tor->unique_lock();
 
     auto metainfo = tr_variant{};
+    auto arena = tr_variant_arena{};
+    auto contents = std::vector<char>{};
     auto ok = bool{ true };
 
     /* ensure the trackers' tiers are in ascending order */
@@ -2177,7 +2201,12 @@ bool tr_torrentSetAnnounceList(tr_torrent* tor, tr_tracker_info const* trackers_
     }
 
     /* save to the .torrent file */
-    if (ok && tr_variantFromFile(&metainfo, TR_VARIANT_PARSE_BENC, tor->info.torrent, nullptr))
+    if (ok && tr_loadFile(contents, tor->info.torrent) &&
+        tr_variantFromBuf(
+            &metainfo,
+            arena,
+            TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE,
+            { std::data(contents), std::size(contents) }))
     {
         /* remove the old fields */
         tr_variantDictRemove(&metainfo, TR_KEY_announce);
@@ -2216,6 +2245,7 @@ bool tr_torrentSetAnnounceList(tr_torrent* tor, tr_tracker_info const* trackers_
             std::swap(tor->info.trackerCount, parsed->info.trackerCount);
             tr_torrentMarkEdited(tor);
             tr_variantToFile(&metainfo, TR_VARIANT_FMT_BENC, tor->info.torrent);
+            tor->infoDictOffset.reset();
         }
 
         /* cleanup */
@@ -2419,6 +2449,7 @@ static void deleteLocalData(tr_torrent* tor, tr_fileFunc func)
 
     auto tmpdir = tr_strvPath(top, TR_PATH_DELIMITER_STR, tr_torrentName(tor), "__XXXXXX");
     tr_sys_dir_create_temp(std::data(tmpdir), nullptr);
+    tor->invalidateFileLocations();
 
     for (tr_file_index_t f = 0, n = tor->fileCount(); f < n; ++f)
     {
@@ -2566,6 +2597,351 @@ struct LocationData
     bool move_from_old_location = false;
 };
 
+enum class RelocationSwitch
+{
+    Done,
+    Failed,
+    Recopy
+};
+
+/* switches the torrent over to the files that tor->relocation prepared.
+ * Files that changed while they were being copied, or that only showed up
+ * after the job started, are renamed now if they're on the same filesystem
+ * as the new location. If any of them would need copying instead, nothing
+ * is switched and Recopy is returned, since copying here would block the
+ * event thread. If anything goes wrong, the files that were already
+ * switched over are put back. */
+static RelocationSwitch switchToRelocatedFiles(tr_torrent* tor, tr_relocation const& job)
+{
+    auto const& location = job.location();
+    auto const& prepared_files = job.files();
+
+    tr_cacheFlushTorrent(tor->session->cache, tor);
+    tor->invalidateFileLocations();
+
+    auto copies = std::vector<tr_relocation::File const*>{};
+    auto moves = std::vector<std::pair<std::string, std::string>>{};
+    auto prepared_it = std::begin(prepared_files);
+
+    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    {
+        tr_relocation::File const* prepared = nullptr;
+        if (prepared_it != std::end(prepared_files) && prepared_it->index == i)
+        {
+            prepared = &*prepared_it++;
+        }
+
+        char const* oldbase = nullptr;
+        char* sub = nullptr;
+        if (!tr_torrentFindFile2(tor, i, &oldbase, &sub, nullptr))
+        {
+            continue;
+        }
+
+        auto oldpath = tr_strvPath(oldbase, sub);
+        auto newpath = tr_strvPath(location, sub);
+        tr_free(sub);
+
+        if (prepared != nullptr && !std::empty(prepared->tmppath) && prepared->oldpath == oldpath &&
+            prepared->newpath == newpath &&
+            prepared->has_bytes == tor->completion.countHasBytesInFile(i))
+        {
+            copies.push_back(prepared);
+        }
+        else if (!tr_sys_path_is_same(oldpath.c_str(), newpath.c_str(), nullptr))
+        {
+            if (!tr_sys_path_is_same_filesystem(oldpath.c_str(), location.c_str(), nullptr))
+            {
+                return RelocationSwitch::Recopy;
+            }
+
+            moves.emplace_back(std::move(oldpath), std::move(newpath));
+        }
+    }
+
+    /* close all the files because we're about to move them */
+    tr_fdTorrentClose(tor->session, tor->uniqueId);
+
+    tr_error* error = nullptr;
+    auto n_copied = size_t{ 0 };
+    auto n_moved = size_t{ 0 };
+
+    for (auto const n = std::size(copies); n_copied < n; ++n_copied)
+    {
+        auto const* const file = copies[n_copied];
+
+        if (!tr_sys_path_rename(file->tmppath.c_str(), file->newpath.c_str(), &error))
+        {
+            tr_logAddTorErr(tor, "error moving \"%s\" to \"%s\": %s", file->oldpath.c_str(), file->newpath.c_str(), error->message);
+            break;
+        }
+    }
+
+    for (auto const n = std::size(moves); error == nullptr && n_moved < n; ++n_moved)
+    {
+        auto const& [oldpath, newpath] = moves[n_moved];
+
+        tr_logAddTorInfo(tor, "moving \"%s\" to \"%s\"", oldpath.c_str(), newpath.c_str());
+
+        char* const newdir = tr_sys_path_dirname(newpath, &error);
+        bool const ok = newdir != nullptr && tr_sys_dir_create(newdir, TR_SYS_DIR_CREATE_PARENTS, 0777, &error) &&
+            tr_sys_path_rename(oldpath.c_str(), newpath.c_str(), &error);
+        tr_free(newdir);
+
+        if (!ok)
+        {
+            tr_logAddTorErr(tor, "error moving \"%s\" to \"%s\": %s", oldpath.c_str(), newpath.c_str(), error->message);
+            break;
+        }
+    }
+
+    if (error != nullptr)
+    {
+        /* put everything back the way it was */
+        while (n_moved > 0)
+        {
+            --n_moved;
+            tr_sys_path_rename(moves[n_moved].second.c_str(), moves[n_moved].first.c_str(), nullptr);
+        }
+
+        while (n_copied > 0)
+        {
+            --n_copied;
+            tr_sys_path_remove(copies[n_copied]->newpath.c_str(), nullptr);
+        }
+
+        job.removeTempFiles();
+        tr_error_free(error);
+        return RelocationSwitch::Failed;
+    }
+
+    for (auto const* const file : copies)
+    {
+        if (!tr_sys_path_remove(file->oldpath.c_str(), &error))
+        {
+            tr_logAddTorErr(tor, "Unable to remove file at old path: %s", error->message);
+            tr_error_clear(&error);
+        }
+    }
+
+    /* the copies of files that changed while they were being copied */
+    job.removeTempFiles();
+
+    /* blow away the leftover subdirectories in the old location */
+    tr_torrentDeleteLocalData(tor, tr_sys_path_remove);
+
+    return RelocationSwitch::Done;
+}
+
+static void startRelocation(
+    tr_torrent* tor,
+    std::string const& location,
+    double volatile* setme_progress,
+    int volatile* setme_state,
+    tr_relocation const* previous = nullptr);
+
+/* called in the libtransmission thread once tor->relocation's workers are done */
+static void finishRelocation(tr_torrent* tor)
+{
+    auto* const job = tor->relocation;
+    tor->relocation = nullptr;
+    job->join();
+
+    auto result = RelocationSwitch::Failed;
+
+    if (!job->isCancelled())
+    {
+        result = switchToRelocatedFiles(tor, *job);
+    }
+    else if (auto const errmsg = job->errorMessage(); !std::empty(errmsg))
+    {
+        tr_logAddTorErr(tor, "%s", errmsg.c_str());
+        job->removeTempFiles();
+    }
+    else
+    {
+        tr_logAddTorInfo(tor, "%s", _("Cancelled moving files"));
+        job->removeTempFiles();
+    }
+
+    if (result == RelocationSwitch::Recopy)
+    {
+        if (tor->isRunning)
+        {
+            /* pause so that the files hold still while they're copied again.
+             * The peers are closed and the cache flushed right here, before
+             * the next job looks at the files, not whenever a queued stop runs. */
+            TR_ASSERT(tr_amInEventThread(tor->session));
+            tr_logAddTorInfo(tor, "%s", _("Pausing to copy the files that changed while they were being moved"));
+            torrentMarkStopped(tor);
+            stopTorrent(tor);
+            startRelocation(tor, job->location(), job->progressTarget(), job->stateTarget(), job);
+            tor->relocation->setRestartTorrent(true);
+            delete job;
+            return;
+        }
+
+        /* nothing should have written to them */
+        tr_logAddTorErr(tor, "%s", _("Files changed while they were being moved"));
+        job->removeTempFiles();
+        result = RelocationSwitch::Failed;
+    }
+
+    if (result == RelocationSwitch::Done)
+    {
+        /* set the new location and reverify */
+        tr_torrentSetDownloadDir(tor, job->location().c_str());
+
+        tr_free(tor->incompleteDir);
+        tor->incompleteDir = nullptr;
+        tor->currentDir = tor->downloadDir;
+
+        job->setProgress(1.0);
+    }
+    else
+    {
+        job->publishProgress();
+    }
+
+    job->setState(result == RelocationSwitch::Done ? TR_LOC_DONE : TR_LOC_ERROR);
+
+    if (job->restartTorrent())
+    {
+        tr_torrentStartNow(tor);
+    }
+
+    delete job;
+}
+
+/* called in the libtransmission thread when a relocation has progress to
+ * report or its workers are done. It doesn't say which relocation, so that
+ * there's nothing to free if the session closes before it's called. */
+static void onRelocationsUpdated(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+    auto const lock = session->unique_lock();
+
+    /* finishing one can start another, so find them all first */
+    auto done = std::vector<tr_torrent*>{};
+    for (auto* const tor : session->torrents)
+    {
+        if (auto* const job = tor->relocation; job != nullptr)
+        {
+            job->clearNotified();
+            job->publishProgress();
+
+            if (job->isDone())
+            {
+                done.push_back(tor);
+            }
+        }
+    }
+
+    for (auto* const tor : done)
+    {
+        finishRelocation(tor);
+    }
+}
+
+/* called in a relocation worker thread */
+static void onRelocationNotify(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+    tr_runInEventThread(session, onRelocationsUpdated, session);
+}
+
+/* `previous` is an earlier job for the same location whose copies
+ * that are still good should be kept rather than made again */
+static void startRelocation(
+    tr_torrent* tor,
+    std::string const& location,
+    double volatile* setme_progress,
+    int volatile* setme_state,
+    tr_relocation const* previous)
+{
+    /* the copies are made from what's on disk, so write the cache out first */
+    tr_cacheFlushTorrent(tor->session->cache, tor);
+
+    auto files = std::vector<tr_relocation::File>{};
+    auto kept = std::vector<std::string_view>{};
+
+    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    {
+        char const* oldbase = nullptr;
+        char* sub = nullptr;
+        if (!tr_torrentFindFile2(tor, i, &oldbase, &sub, nullptr))
+        {
+            continue;
+        }
+
+        auto file = tr_relocation::File{};
+        file.index = i;
+        file.oldpath = tr_strvPath(oldbase, sub);
+        file.newpath = tr_strvPath(location, sub);
+        file.length = tor->info.files[i].length;
+        file.has_bytes = tor->completion.countHasBytesInFile(i);
+        tr_free(sub);
+
+        tr_logAddDebug("Found file #%d: %s", (int)i, file.oldpath.c_str());
+
+        if (tr_sys_path_is_same(file.oldpath.c_str(), file.newpath.c_str(), nullptr))
+        {
+            continue;
+        }
+
+        if (previous != nullptr)
+        {
+            auto const& prev = previous->files();
+            auto const it = std::find_if(
+                std::begin(prev),
+                std::end(prev),
+                [&file](auto const& p) { return p.index == file.index; });
+
+            if (it != std::end(prev) && !std::empty(it->tmppath) && it->oldpath == file.oldpath &&
+                it->newpath == file.newpath && it->has_bytes == file.has_bytes)
+            {
+                file.tmppath = it->tmppath;
+                kept.push_back(it->tmppath);
+            }
+        }
+
+        files.push_back(std::move(file));
+    }
+
+    if (previous != nullptr)
+    {
+        for (auto const& prev : previous->files())
+        {
+            if (!std::empty(prev.tmppath) && std::find(std::begin(kept), std::end(kept), prev.tmppath) == std::end(kept))
+            {
+                tr_sys_path_remove(prev.tmppath.c_str(), nullptr);
+            }
+        }
+    }
+
+    tr_logAddTorInfo(tor, "moving to \"%s\"", location.c_str());
+
+    auto* const job = new tr_relocation(location, std::move(files), setme_progress, setme_state);
+    tor->relocation = job;
+    job->start(onRelocationNotify, tor->session);
+}
+
+static void abortRelocation(tr_torrent* tor)
+{
+    auto* const job = tor->relocation;
+    if (job == nullptr)
+    {
+        return;
+    }
+
+    tor->relocation = nullptr;
+    job->cancel();
+    job->join();
+    job->removeTempFiles();
+    job->setState(TR_LOC_ERROR);
+    delete job;
+}
+
 static void setLocationImpl(void* vdata)
 {
     auto* data = static_cast<struct LocationData*>(vdata);
@@ -2573,10 +2949,8 @@ static void setLocationImpl(void* vdata)
     TR_ASSERT(tr_isTorrent(tor));
     auto const lock = tor->unique_lock();
 
-    bool err = false;
     bool const do_move = data->move_from_old_location;
     auto const& location = data->location;
-    double bytesHandled = 0;
 
     tr_logAddDebug(
         "Moving \"%s\" location from currentDir \"%s\" to \"%s\"",
@@ -2584,81 +2958,56 @@ static void setLocationImpl(void* vdata)
         tor->currentDir,
         location.c_str());
 
-    tr_sys_dir_create(location.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0777, nullptr);
-
-    if (!tr_sys_path_is_same(location.c_str(), tor->currentDir, nullptr))
+    if (tor->relocation != nullptr)
     {
-        /* bad idea to move files while they're being verified... */
-        tr_verifyRemove(tor);
+        tr_logAddTorErr(tor, "%s", _("Can't change the location while files are being moved"));
 
-        /* try to move the files.
-         * FIXME: there are still all kinds of nasty cases, like what
-         * if the target directory runs out of space halfway through... */
-        for (tr_file_index_t i = 0, n = tor->fileCount(); !err && i < n; ++i)
+        if (data->setme_state != nullptr)
         {
-            tr_file const* const f = &tor->info.files[i];
-
-            char const* oldbase = nullptr;
-            char* sub = nullptr;
-            if (tr_torrentFindFile2(tor, i, &oldbase, &sub, nullptr))
-            {
-                auto const oldpath = tr_strvPath(oldbase, sub);
-                auto const newpath = tr_strvPath(location, sub);
+            *data->setme_state = TR_LOC_ERROR;
+        }
 
-                tr_logAddDebug("Found file #%d: %s", (int)i, oldpath.c_str());
+        delete data;
+        return;
+    }
 
-                if (do_move && !tr_sys_path_is_same(oldpath.c_str(), newpath.c_str(), nullptr))
-                {
-                    tr_error* error = nullptr;
-
-                    tr_logAddTorInfo(tor, "moving \"%s\" to \"%s\"", oldpath.c_str(), newpath.c_str());
-
-                    if (!tr_moveFile(oldpath.c_str(), newpath.c_str(), &error))
-                    {
-                        err = true;
-                        tr_logAddTorErr(
-                            tor,
-                            "error moving \"%s\" to \"%s\": %s",
-                            oldpath.c_str(),
-                            newpath.c_str(),
-                            error->message);
-                        tr_error_free(error);
-                    }
-                }
+    tr_sys_dir_create(location.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0777, nullptr);
 
-                tr_free(sub);
-            }
+    bool const is_same_dir = tr_sys_path_is_same(location.c_str(), tor->currentDir, nullptr);
 
-            if (data->setme_progress != nullptr)
-            {
-                bytesHandled += f->length;
-                *data->setme_progress = bytesHandled / tor->info.totalSize;
-            }
-        }
+    if (!is_same_dir)
+    {
+        /* bad idea to move files while they're being verified... */
+        tr_verifyRemove(tor);
+    }
 
-        if (!err && do_move)
-        {
-            /* blow away the leftover subdirectories in the old location */
-            tr_torrentDeleteLocalData(tor, tr_sys_path_remove);
-        }
+    if (do_move && !is_same_dir)
+    {
+        /* copying can take a long time, so it's done in the background.
+         * The torrent keeps using the old files until they're all ready. */
+        startRelocation(tor, location, data->setme_progress, data->setme_state);
+        delete data;
+        return;
     }
 
-    if (!err)
+    /* set the new location and reverify */
+    tr_torrentSetDownloadDir(tor, location.c_str());
+
+    if (do_move)
     {
-        /* set the new location and reverify */
-        tr_torrentSetDownloadDir(tor, location.c_str());
+        tr_free(tor->incompleteDir);
+        tor->incompleteDir = nullptr;
+        tor->currentDir = tor->downloadDir;
+    }
 
-        if (do_move)
-        {
-            tr_free(tor->incompleteDir);
-            tor->incompleteDir = nullptr;
-            tor->currentDir = tor->downloadDir;
-        }
+    if (data->setme_progress != nullptr)
+    {
+        *data->setme_progress = 1.0;
     }
 
     if (data->setme_state != nullptr)
     {
-        *data->setme_state = err ? TR_LOC_ERROR : TR_LOC_DONE;
+        *data->setme_state = TR_LOC_DONE;
     }
 
     /* cleanup */
@@ -2704,6 +3053,26 @@ void tr_torrentSetLocation(
     return tor->setLocation(location ? location : "", move_from_old_location, setme_progress, setme_state);
 }
 
+static void cancelSetLocationImpl(void* vtor)
+{
+    auto* const tor = static_cast<tr_torrent*>(vtor);
+    TR_ASSERT(tr_isTorrent(tor));
+    auto const lock = tor->unique_lock();
+
+    if (tor->relocation != nullptr)
+    {
+        tor->relocation->cancel();
+    }
+}
+
+void tr_torrentCancelSetLocation(tr_torrent* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    /* queued behind any setLocation() that hasn't started yet */
+    tr_runInEventThread(tor->session, cancelSetLocationImpl, tor);
+}
+
 std::string_view tr_torrentPrimaryMimeType(tr_torrent const* tor)
 {
     tr_info const* inf = &tor->info;
@@ -2770,6 +3139,8 @@ static void tr_torrentFileCompleted(tr_torrent* tor, tr_file_index_t fileIndex)
                 tr_logAddTorErr(tor, "Error moving \"%s\" to \"%s\": %s", oldpath.c_str(), newpath.c_str(), error->message);
                 tr_error_free(error);
             }
+
+            tor->invalidateFileLocation(fileIndex);
         }
 
         tr_free(sub);
@@ -2784,7 +3155,7 @@ static void tr_torrentPieceCompleted(tr_torrent* tor, tr_piece_index_t pieceInde
     auto const [begin, end] = tor->fpm_.fileSpan(pieceIndex);
     for (tr_file_index_t file = begin; file < end; ++file)
     {
-        if (tor->completion.hasBlocks(tr_torGetFileBlockSpan(tor, file)))
+        if (tor->completion.countHasBytesInFile(file) == tor->info.files[file].length)
         {
             tr_torrentFileCompleted(tor, file);
         }
@@ -2809,6 +3180,8 @@ void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
         {
             if (tor->checkPiece(p))
             {
+                // no need to check it again before uploading it
+                tor->setPieceChecked(p, true);
                 tr_torrentPieceCompleted(tor, p);
             }
             else
@@ -2833,54 +3206,102 @@ void tr_torrentGotBlock(tr_torrent* tor, tr_block_index_t block)
 ****
 ***/
 
-std::optional<tr_torrent::tr_found_file_t> tr_torrent::findFile(std::string& filename, tr_file_index_t i) const
+static char const* getFileLocationBase(tr_torrent const* tor, tr_file_locations::Location location)
+{
+    return tr_file_locations::isIncomplete(location) ? tor->incompleteDir : tor->downloadDir;
+}
+
+static void buildFileLocationPath(
+    std::string& setme,
+    tr_torrent const* tor,
+    tr_file_index_t i,
+    tr_file_locations::Location location)
+{
+    auto const base = std::string_view{ getFileLocationBase(tor, location) };
+    auto const* const name = tor->info.files[i].name;
+
+    if (tr_file_locations::isPartial(location))
+    {
+        tr_buildBuf(setme, base, "/"sv, name, ".part"sv);
+    }
+    else
+    {
+        tr_buildBuf(setme, base, "/"sv, name);
+    }
+}
+
+std::optional<tr_torrent::tr_found_file_t> tr_torrent::findFile(
+    std::string& filename,
+    tr_file_index_t i,
+    tr_sys_path_info* setme_info) const
 {
+    using Location = tr_file_locations::Location;
+
     TR_ASSERT(i < this->fileCount());
-    tr_file const& file = info.files[i];
+
     auto file_info = tr_sys_path_info{};
+    auto location = file_locations_.get(i);
 
-    if (this->downloadDir != nullptr)
+    // use where we found it last time, unless it's not there anymore
+    if (location != Location::Unknown && getFileLocationBase(this, location) != nullptr)
     {
-        auto base = std::string_view{ this->downloadDir };
+        buildFileLocationPath(filename, this, i, location);
 
-        tr_buildBuf(filename, base, "/"sv, file.name);
-        if (tr_sys_path_get_info(filename.c_str(), 0, &file_info, nullptr))
+        if (setme_info == nullptr || tr_sys_path_get_info(filename.c_str(), 0, setme_info, nullptr))
         {
-            return tr_found_file_t{ file_info, filename, base };
-        }
-
-        tr_buildBuf(filename, base, "/"sv, file.name, ".part"sv);
-        if (tr_sys_path_get_info(filename.c_str(), 0, &file_info, nullptr))
-        {
-            return tr_found_file_t{ file_info, filename, base };
+            return tr_found_file_t{ filename, getFileLocationBase(this, location) };
         }
     }
 
-    if (this->incompleteDir != nullptr)
-    {
-        auto const base = std::string_view{ this->incompleteDir };
+    // look for it
+    location = Location::Unknown;
 
-        tr_buildBuf(filename, base, "/"sv, file.name);
-        if (tr_sys_path_get_info(filename.c_str(), 0, &file_info, nullptr))
+    for (auto const candidate :
+         { Location::Download, Location::DownloadPartial, Location::Incomplete, Location::IncompletePartial })
+    {
+        if (getFileLocationBase(this, candidate) == nullptr)
         {
-            return tr_found_file_t{ file_info, filename, base };
+            continue;
         }
 
-        tr_buildBuf(filename, base, "/"sv, file.name, ".part"sv);
+        buildFileLocationPath(filename, this, i, candidate);
         if (tr_sys_path_get_info(filename.c_str(), 0, &file_info, nullptr))
         {
-            return tr_found_file_t{ file_info, filename, base };
+            location = candidate;
+            break;
         }
     }
 
-    return {};
+    file_locations_.set(i, location);
+
+    if (location == Location::Unknown)
+    {
+        return {};
+    }
+
+    if (setme_info != nullptr)
+    {
+        *setme_info = file_info;
+    }
+
+    return tr_found_file_t{ filename, getFileLocationBase(this, location) };
+}
+
+void tr_torrent::refreshFileLocations() const
+{
+    file_locations_.refresh(
+        downloadDir != nullptr ? downloadDir : "",
+        incompleteDir != nullptr ? incompleteDir : "",
+        info.files,
+        info.fileCount);
 }
 
 // TODO: clients that call this should call tr_torrent::findFile() instead
 bool tr_torrentFindFile2(tr_torrent const* tor, tr_file_index_t fileNum, char const** base, char** subpath, time_t* mtime)
 {
     auto filename = std::string{};
-    auto const found = tor->findFile(filename, fileNum);
+    auto info = tr_sys_path_info{};
+    auto const found = tor->findFile(filename, fileNum, mtime != nullptr ? &info : nullptr);
 
     if (!found)
     {
@@ -2899,7 +3320,7 @@ bool tr_torrentFindFile2(tr_torrent const* tor, tr_file_index_t fileNum, char co
 
     if (mtime != nullptr)
     {
-        *mtime = found->last_modified_at;
+        *mtime = info.last_modified_at;
     }
 
     return true;
@@ -2946,129 +3367,87 @@ char* tr_torrentBuildPartial(tr_torrent const* tor, tr_file_index_t fileNum)
 ****
 ***/
 
-#ifdef TR_ENABLE_ASSERTS
-
-static bool queueIsSequenced(tr_session* session)
-{
-    auto torrents = tr_sessionGetTorrents(session);
-    std::sort(
-        std::begin(torrents),
-        std::end(torrents),
-        [](auto const* a, auto const* b) { return a->queuePosition < b->queuePosition; });
-
-#if 0
-
-    fprintf(stderr, "%s", "queue: ");
-
-    for (int i = 0; i < n; ++i)
-    {
-        fprintf(stderr, "%d ", tmp[i]->queuePosition);
-    }
-
-    fputc('\n', stderr);
-
-#endif
-
-    /* test them */
-    bool is_sequenced = true;
-
-    for (int i = 0, n = std::size(torrents); is_sequenced && i < n; ++i)
-    {
-        is_sequenced = torrents[i]->queuePosition == i;
-    }
-
-    return is_sequenced;
-}
-
-#endif
-
 int tr_torrentGetQueuePosition(tr_torrent const* tor)
 {
-    return tor->queuePosition;
+    return static_cast<int>(tor->session->torrentQueue.position(tor));
 }
 
 void tr_torrentSetQueuePosition(tr_torrent* tor, int pos)
 {
-    int back = -1;
-    int const old_pos = tor->queuePosition;
+    auto& queue = tor->session->torrentQueue;
     time_t const now = tr_time();
 
-    if (pos < 0)
+    if (!queue.contains(tor))
     {
-        pos = 0;
+        return;
     }
 
-    tor->queuePosition = -1;
+    auto const old_pos = queue.position(tor);
+    auto const new_pos = std::min(static_cast<size_t>(std::max(pos, 0)), std::size(queue) - 1);
 
-    for (auto* walk : tor->session->torrents)
+    if (old_pos != new_pos)
     {
-        if ((old_pos < pos) && (old_pos <= walk->queuePosition) && (walk->queuePosition <= pos))
-        {
-            walk->queuePosition--;
-            walk->anyDate = now;
-        }
+        queue.move(tor, new_pos);
 
-        if ((old_pos > pos) && (pos <= walk->queuePosition) && (walk->queuePosition < old_pos))
+        // every torrent between old_pos and new_pos shifted by one
+        for (auto* const shifted : queue.range(std::min(old_pos, new_pos), std::max(old_pos, new_pos) + 1))
         {
-            walk->queuePosition++;
-            walk->anyDate = now;
-        }
-
-        if (back < walk->queuePosition)
-        {
-            back = walk->queuePosition;
+            shifted->anyDate = now;
         }
     }
 
-    tor->queuePosition = std::min(pos, back + 1);
     tor->anyDate = now;
-
-    TR_ASSERT(queueIsSequenced(tor->session));
 }
 
-struct CompareTorrentByQueuePosition
+// returns the torrents sorted by queue position.
+// positions are looked up once up front since each lookup is O(log n)
+static std::vector<tr_torrent*> sortedByQueuePosition(tr_torrent* const* torrents_in, size_t n)
 {
-    bool operator()(tr_torrent const* a, tr_torrent const* b) const
-    {
-        return a->queuePosition < b->queuePosition;
-    }
-};
+    auto positioned = std::vector<std::pair<int, tr_torrent*>>{};
+    positioned.reserve(n);
+    std::transform(
+        torrents_in,
+        torrents_in + n,
+        std::back_inserter(positioned),
+        [](auto* tor) { return std::make_pair(tr_torrentGetQueuePosition(tor), tor); });
+    std::sort(std::begin(positioned), std::end(positioned));
+
+    auto torrents = std::vector<tr_torrent*>{};
+    torrents.reserve(n);
+    std::transform(
+        std::begin(positioned),
+        std::end(positioned),
+        std::back_inserter(torrents),
+        [](auto const& p) { return p.second; });
+    return torrents;
+}
 
 void tr_torrentsQueueMoveTop(tr_torrent* const* torrents_in, size_t n)
 {
-    auto torrents = std::vector<tr_torrent*>(torrents_in, torrents_in + n);
-    std::sort(std::rbegin(torrents), std::rend(torrents), CompareTorrentByQueuePosition{});
-    for (auto* tor : torrents)
-    {
-        tr_torrentSetQueuePosition(tor, 0);
-    }
+    auto const torrents = sortedByQueuePosition(torrents_in, n);
+    std::for_each(std::rbegin(torrents), std::rend(torrents), [](auto* tor) { tr_torrentSetQueuePosition(tor, 0); });
 }
 
 void tr_torrentsQueueMoveUp(tr_torrent* const* torrents_in, size_t n)
 {
-    auto torrents = std::vector<tr_torrent*>(torrents_in, torrents_in + n);
-    std::sort(std::begin(torrents), std::end(torrents), CompareTorrentByQueuePosition{});
-    for (auto* tor : torrents)
+    for (auto* tor : sortedByQueuePosition(torrents_in, n))
     {
-        tr_torrentSetQueuePosition(tor, tor->queuePosition - 1);
+        tr_torrentSetQueuePosition(tor, tr_torrentGetQueuePosition(tor) - 1);
     }
 }
 
 void tr_torrentsQueueMoveDown(tr_torrent* const* torrents_in, size_t n)
 {
-    auto torrents = std::vector<tr_torrent*>(torrents_in, torrents_in + n);
-    std::sort(std::rbegin(torrents), std::rend(torrents), CompareTorrentByQueuePosition{});
-    for (auto* tor : torrents)
-    {
-        tr_torrentSetQueuePosition(tor, tor->queuePosition + 1);
-    }
+    auto const torrents = sortedByQueuePosition(torrents_in, n);
+    std::for_each(
+        std::rbegin(torrents),
+        std::rend(torrents),
+        [](auto* tor) { tr_torrentSetQueuePosition(tor, tr_torrentGetQueuePosition(tor) + 1); });
 }
 
 void tr_torrentsQueueMoveBottom(tr_torrent* const* torrents_in, size_t n)
 {
-    auto torrents = std::vector<tr_torrent*>(torrents_in, torrents_in + n);
-    std::sort(std::begin(torrents), std::end(torrents), CompareTorrentByQueuePosition{});
-    for (auto* tor : torrents)
+    for (auto* tor : sortedByQueuePosition(torrents_in, n))
     {
         tr_torrentSetQueuePosition(tor, INT_MAX);
     }
@@ -3083,6 +3462,14 @@ static void torrentSetQueued(tr_torrent* tor, bool queued)
         tor->isQueued = queued;
         tor->anyDate = tr_time();
         tr_torrentSetDirty(tor);
+
+        auto const dir = queued ? std::make_optional(tr_torrentGetQueueDirection(tor)) : std::nullopt;
+        tor->session->torrentQueue.setWaiting(tor, dir);
+
+        if (queued)
+        {
+            tr_peerMgrQueueChanged(tor->session->peerMgr);
+        }
     }
 }
 
@@ -3268,6 +3655,7 @@ static void torrentRenamePath(void* vdata)
                 for (size_t i = 0; i < n; ++i)
                 {
                     renameTorrentFileString(tor, oldpath, newname, file_indices[i]);
+                    tor->invalidateFileLocation(file_indices[i]);
                 }
 
                 /* update tr_info.name if user changed the toplevel */
@@ -26,11 +26,13 @@
 #include "completion.h"
 #include "file.h"
 #include "file-piece-map.h"
+#include "torrent-file-locations.h"
 #include "quark.h"
 #include "session.h"
 #include "tr-assert.h"
 #include "tr-macros.h"
 
+class tr_relocation;
 class tr_swarm;
 struct tr_magnet_info;
 struct tr_metainfo_parsed;
@@ -54,7 +56,14 @@ void tr_ctorInitTorrentWanted(tr_ctor const* ctor, tr_torrent* tor);
 
 bool tr_ctorSaveContents(tr_ctor const* ctor, char const* filename, tr_error** error);
 
-bool tr_ctorGetMetainfo(tr_ctor const* ctor, tr_variant const** setme);
+/* The ctor's bencoded metainfo, if it has any */
+std::optional<std::string_view> tr_ctorGetMetainfo(tr_ctor const* ctor);
+
+/* The name to use if the metainfo doesn't have one */
+std::string_view tr_ctorGetDefaultName(tr_ctor const* ctor);
+
+/* Where the "info" dict begins in the ctor's bencoded metainfo, if known */
+std::optional<uint64_t> tr_ctorGetInfoDictOffset(tr_ctor const* ctor);
 
 tr_session* tr_ctorGetSession(tr_ctor const* ctor);
 
@@ -281,31 +290,29 @@ public:
     {
         file_priorities_.set(files, fileCount, priority);
         setDirty();
+        onFilesChanged();
     }
 
     void setFilePriority(tr_file_index_t file, tr_priority_t priority)
     {
         file_priorities_.set(file, priority);
         setDirty();
+        onFilesChanged();
     }
 
     /// CHECKSUMS
 
-    bool ensurePieceIsChecked(tr_piece_index_t piece)
+    [[nodiscard]] bool isPieceChecked(tr_piece_index_t piece) const
     {
-        TR_ASSERT(piece < info.pieceCount);
-
-        if (checked_pieces_.test(piece))
-        {
-            return true;
-        }
+        return checked_pieces_.test(piece);
+    }
 
-        bool const checked = checkPiece(piece);
+    void setPieceChecked(tr_piece_index_t piece, bool checked)
+    {
         this->anyDate = tr_time();
         this->setDirty();
 
         checked_pieces_.set(piece, checked);
-        return checked;
     }
 
     void initCheckedPieces(tr_bitfield const& checked, time_t const* mtimes /*fileCount*/)
@@ -316,8 +323,9 @@ public:
         auto filename = std::string{};
         for (size_t i = 0, n = this->fileCount(); i < n; ++i)
         {
-            auto const found = this->findFile(filename, i);
-            auto const mtime = found ? found->last_modified_at : 0;
+            auto file_info = tr_sys_path_info{};
+            auto const found = this->findFile(filename, i, &file_info);
+            auto const mtime = found ? file_info.last_modified_at : 0;
 
             info.files[i].priv.mtime = mtime;
 
@@ -337,22 +345,46 @@ public:
         return info.fileCount;
     }
 
-    struct tr_found_file_t : public tr_sys_path_info
+    struct tr_found_file_t
     {
         std::string& filename; // /home/foo/Downloads/torrent/01-file-one.txt
         std::string_view base; // /home/foo/Downloads
         std::string_view subpath; // /torrent/01-file-one.txt
 
-        tr_found_file_t(tr_sys_path_info info, std::string& f, std::string_view b)
-            : tr_sys_path_info{ info }
-            , filename{ f }
+        tr_found_file_t(std::string& f, std::string_view b)
+            : filename{ f }
             , base{ b }
             , subpath{ f.c_str() + std::size(b) + 1 }
         {
         }
     };
 
-    std::optional<tr_found_file_t> findFile(std::string& filename, tr_file_index_t i) const;
+    // Where a file was last found is remembered, so this only touches the
+    // filesystem the first time, or if `setme_info` asks for the file's info.
+    std::optional<tr_found_file_t> findFile(
+        std::string& filename,
+        tr_file_index_t i,
+        tr_sys_path_info* setme_info = nullptr) const;
+
+    // forget where the files were found, e.g. because they've been moved
+    void invalidateFileLocations() const
+    {
+        file_locations_.invalidateAll();
+    }
+
+    void invalidateFileLocation(tr_file_index_t i) const
+    {
+        file_locations_.invalidate(i);
+    }
+
+    // true if file `i` was found the last time it was looked for
+    [[nodiscard]] bool hasFileLocation(tr_file_index_t i) const
+    {
+        return file_locations_.get(i) != tr_file_locations::Location::Unknown;
+    }
+
+    // look for all the files at once, listing each of their folders once
+    void refreshFileLocations() const;
 
     tr_info info = {};
 
@@ -360,6 +392,9 @@ public:
 
     tr_bitfield checked_pieces_ = tr_bitfield{ 0 };
 
+    // where tr_verifyScrub() left off looking for unchecked pieces
+    tr_piece_index_t scrub_cursor_ = 0;
+
     // TODO(ckerr): make private once some of torrent.cc's `tr_torrentFoo()` methods are member functions
     tr_completion completion;
 
@@ -412,22 +447,22 @@ public:
      * This pointer will be equal to downloadDir or incompleteDir */
     char const* currentDir = nullptr;
 
+    /* The files being moved to a new location, if any.
+     * Owned by the torrent; see setLocation() */
+    tr_relocation* relocation = nullptr;
+
     /* Length, in bytes, of the "info" dict in the .torrent file. */
     uint64_t infoDictLength = 0;
 
     /* Offset, in bytes, of the beginning of the "info" dict in the .torrent file.
      *
      * Used by the torrent-magnet code for serving metainfo to peers.
-     * This field is lazy-generated and might not be initialized yet. */
-    size_t infoDictOffset = 0;
+     * It's recorded when the .torrent is parsed, and is looked up again
+     * if the file has been rewritten since then. */
+    std::optional<uint64_t> infoDictOffset;
 
     tr_completeness completeness = TR_LEECH;
 
-    time_t dhtAnnounceAt = 0;
-    time_t dhtAnnounce6At = 0;
-    bool dhtAnnounceInProgress = false;
-    bool dhtAnnounce6InProgress = false;
-
     time_t lpdAnnounceAt = 0;
 
     uint64_t downloadedCur = 0;
@@ -452,8 +487,6 @@ public:
     int secondsDownloading = 0;
     int secondsSeeding = 0;
 
-    int queuePosition = 0;
-
     tr_torrent_metadata_func metadata_func = nullptr;
     void* metadata_func_user_data = nullptr;
 
@@ -479,9 +512,6 @@ public:
     bool prefetchMagnetMetadata = false;
     bool magnetVerify = false;
 
-    // TODO(ckerr) use std::optional
-    bool infoDictOffsetIsCached = false;
-
     void setDirty()
     {
         this->isDirty = true;
@@ -503,6 +533,8 @@ public:
     tr_idlelimit idleLimitMode = TR_IDLELIMIT_GLOBAL;
     bool finishedSeedingByIdle = false;
 
+    tr_choke_algorithm chokeAlgorithm = TR_CHOKE_TIT_FOR_TAT;
+
     tr_labels_t labels;
 
     static auto constexpr MagicNumber = int{ 95549 };
@@ -510,22 +542,30 @@ public:
     tr_file_piece_map fpm_ = tr_file_piece_map{ info };
     tr_file_priorities file_priorities_{ &fpm_ };
     tr_files_wanted files_wanted_{ &fpm_ };
+    mutable tr_file_locations file_locations_;
 
 private:
     void setFilesWanted(tr_file_index_t const* files, size_t n_files, bool wanted, bool is_bootstrapping)
     {
         auto const lock = unique_lock();
 
-        files_wanted_.set(files, n_files, wanted);
-        completion.invalidateSizeWhenDone();
+        for (size_t i = 0; i < n_files; ++i)
+        {
+            auto const [begin, end] = fpm_.pieceSpan(files[i]);
+            completion.updateWanted(begin, end, [&]() { files_wanted_.set(files[i], wanted); });
+        }
 
         if (!is_bootstrapping)
         {
             setDirty();
             recheckCompleteness();
+            onFilesChanged();
         }
     }
 
+    // tells the peer manager that which pieces we want, or how much, has changed
+    void onFilesChanged();
+
     mutable std::vector<tr_sha1_digest_t> piece_checksums_;
 };
 
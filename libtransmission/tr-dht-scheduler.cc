@@ -0,0 +1,219 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include "transmission.h"
+
+#include "crypto-utils.h" // tr_rand_int_weak()
+#include "tr-dht-scheduler.h"
+
+namespace
+{
+
+auto constexpr AnnounceIntervalSec = tr_dht_scheduler::AnnounceIntervalSec;
+auto constexpr AnnounceJitterSec = 3 * 60;
+
+// the budgets allow twice the rate that announces each torrent once per
+// interval, so that a backlog, e.g. from startup, drains in half of one
+auto constexpr BudgetHeadroom = size_t{ 2 };
+
+// until some searches have finished, guess that they take this long
+auto constexpr InitialSearchSec = time_t{ 60 };
+
+// each minute that a due torrent waits divides its peer count by one more
+auto constexpr AgingSec = time_t{ 60 };
+
+// each search that finds nobody doubles the interval, up to this many times
+auto constexpr MaxEmptyStreak = 2;
+
+// how soon to retry a search that couldn't be started, doubling on each failure
+auto constexpr RetryIntervalSec = time_t{ 5 };
+auto constexpr MaxRetryIntervalSec = time_t{ 5 * 60 };
+auto constexpr RetryJitterSec = 5;
+auto constexpr MaxFailStreak = 6;
+
+// libdht doesn't always tell us when it gives up on a search,
+// so consider a search to be done after this long
+auto constexpr SearchTimeoutSec = time_t{ 5 * 60 };
+
+} // namespace
+
+tr_dht_scheduler::tr_dht_scheduler(size_t min_in_flight, size_t min_starts_per_upkeep, time_t upkeep_interval_sec)
+    : min_in_flight_{ min_in_flight }
+    , min_starts_per_upkeep_{ min_starts_per_upkeep }
+    , upkeep_interval_sec_{ upkeep_interval_sec }
+    , max_in_flight_{ min_in_flight }
+    , max_starts_per_upkeep_{ min_starts_per_upkeep }
+    , search_sec_{ InitialSearchSec }
+{
+}
+
+void tr_dht_scheduler::updateBudgets()
+{
+    // Little's law: to start `rate` searches per second when each takes
+    // search_sec_, about `rate * search_sec_` of them are in flight
+    auto const interval = size_t(AnnounceIntervalSec);
+    auto const n = std::size(entries_) * BudgetHeadroom;
+    auto const starts = (n * size_t(upkeep_interval_sec_) + interval - 1) / interval;
+    auto const in_flight = (n * size_t(search_sec_) + interval - 1) / interval;
+
+    max_starts_per_upkeep_ = std::max(min_starts_per_upkeep_, starts);
+    max_in_flight_ = std::min(std::max(min_in_flight_, in_flight), MaxSearchesInFlight);
+}
+
+void tr_dht_scheduler::add(Key const& key, size_t peer_count, bool ready, time_t now)
+{
+    auto [it, inserted] = entries_.try_emplace(key);
+    auto& entry = it->second;
+
+    if (inserted)
+    {
+        entry.due = now;
+    }
+
+    entry.peer_count = peer_count;
+    entry.ready = ready;
+    entry.seen = round_;
+}
+
+std::vector<tr_dht_scheduler::Key> const& tr_dht_scheduler::next(time_t now)
+{
+    candidates_.clear();
+    starts_.clear();
+
+    for (auto it = std::begin(entries_); it != std::end(entries_);)
+    {
+        auto& entry = it->second;
+
+        if (entry.seen != round_)
+        {
+            if (entry.in_flight)
+            {
+                --stats_.searches_in_flight;
+            }
+
+            it = entries_.erase(it);
+            continue;
+        }
+
+        if (entry.in_flight && entry.started_at + SearchTimeoutSec <= now)
+        {
+            onSearchDone(it->first, now);
+        }
+
+        if (!entry.in_flight && entry.ready && entry.due <= now)
+        {
+            candidates_.push_back(&*it);
+        }
+
+        ++it;
+    }
+
+    ++round_;
+
+    updateBudgets();
+    stats_.searches_queued = std::size(candidates_);
+
+    auto const free_slots = max_in_flight_ > stats_.searches_in_flight ? max_in_flight_ - stats_.searches_in_flight : 0;
+    auto const n = std::min({ free_slots, max_starts_per_upkeep_, std::size(candidates_) });
+    if (n == 0)
+    {
+        return starts_;
+    }
+
+    std::partial_sort(
+        std::begin(candidates_),
+        std::begin(candidates_) + n,
+        std::end(candidates_),
+        [now](auto const* a, auto const* b)
+        {
+            auto const weight = [now](Entry const& entry)
+            {
+                return entry.peer_count / size_t(1 + (now - entry.due) / AgingSec);
+            };
+
+            if (auto const wa = weight(a->second), wb = weight(b->second); wa != wb)
+            {
+                return wa < wb;
+            }
+
+            return a->second.due < b->second.due;
+        });
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto& [key, entry] = *candidates_[i];
+        entry.in_flight = true;
+        entry.started_at = now;
+        entry.peers_found = 0;
+        starts_.push_back(key);
+    }
+
+    stats_.searches_in_flight += n;
+    stats_.searches_queued -= n;
+    stats_.searches_started += n;
+    return starts_;
+}
+
+void tr_dht_scheduler::finish(Entry& entry)
+{
+    entry.in_flight = false;
+    --stats_.searches_in_flight;
+}
+
+void tr_dht_scheduler::onPeersFound(Key const& key, size_t n_peers)
+{
+    if (auto const it = entries_.find(key); it != std::end(entries_) && it->second.in_flight)
+    {
+        it->second.peers_found += n_peers;
+    }
+}
+
+void tr_dht_scheduler::onSearchDone(Key const& key, time_t now)
+{
+    auto const it = entries_.find(key);
+    if (it == std::end(entries_) || !it->second.in_flight)
+    {
+        return;
+    }
+
+    auto& entry = it->second;
+    finish(entry);
+    ++stats_.searches_done;
+    search_sec_ = (search_sec_ * 7 + (now - entry.started_at)) / 8;
+    stats_.peers_found += entry.peers_found;
+
+    entry.fail_streak = 0;
+    entry.empty_streak = entry.peers_found == 0 ? std::min(entry.empty_streak + 1, MaxEmptyStreak) : 0;
+    entry.due = now + (AnnounceIntervalSec << entry.empty_streak) + tr_rand_int_weak(AnnounceJitterSec);
+}
+
+void tr_dht_scheduler::onSearchFailed(Key const& key, time_t now)
+{
+    auto const it = entries_.find(key);
+    if (it == std::end(entries_) || !it->second.in_flight)
+    {
+        return;
+    }
+
+    auto& entry = it->second;
+    finish(entry);
+    ++stats_.searches_failed;
+
+    auto const retry_sec = std::min(RetryIntervalSec << entry.fail_streak, MaxRetryIntervalSec);
+    entry.fail_streak = std::min(entry.fail_streak + 1, MaxFailStreak);
+    entry.due = now + retry_sec + tr_rand_int_weak(RetryJitterSec);
+}
+
+time_t tr_dht_scheduler::dueAt(Key const& key) const
+{
+    auto const it = entries_.find(key);
+    return it != std::end(entries_) ? it->second.due : 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <ctime> // time_t
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * Decides when to start each torrent's DHT announces.
+ *
+ * Starting a search for every torrent as soon as it's due floods the
+ * routing table and the UDP socket when thousands of torrents start at
+ * once, so instead this starts a few searches per upkeep and caps how
+ * many can be in flight. Both budgets grow with the number of torrents,
+ * so that each one can still be announced once per AnnounceIntervalSec.
+ *
+ * Due torrents with the fewest peers go first, but a torrent's peer count
+ * weighs less the longer it's been waiting, so busy torrents aren't starved.
+ *
+ * Each torrent's announce interval backs off when its searches keep
+ * coming back empty, and its retry delay backs off when they keep failing.
+ */
+class tr_dht_scheduler
+{
+public:
+    // a torrent's uniqueId and the address family to announce on
+    using Key = std::pair<int, int>;
+
+    struct Stats
+    {
+        size_t searches_in_flight = 0;
+        size_t searches_queued = 0; // due, but waiting for a free slot
+        uint64_t searches_started = 0;
+        uint64_t searches_done = 0;
+        uint64_t searches_failed = 0;
+        uint64_t peers_found = 0; // in searches that are done
+    };
+
+    // how often to announce a torrent that's finding peers
+    static auto constexpr AnnounceIntervalSec = time_t{ 25 * 60 };
+
+    // the budgets never go below these, however few torrents there are
+    static auto constexpr MinSearchesInFlight = size_t{ 16 };
+    static auto constexpr MinSearchStartsPerUpkeep = size_t{ 4 };
+
+    // nor above this, which is how many searches libdht can run at once
+    static auto constexpr MaxSearchesInFlight = size_t{ 1024 };
+
+    // `upkeep_interval_sec` is how often next() is called
+    explicit tr_dht_scheduler(
+        size_t min_in_flight = MinSearchesInFlight,
+        size_t min_starts_per_upkeep = MinSearchStartsPerUpkeep,
+        time_t upkeep_interval_sec = 1);
+
+    /**
+     * Call once per upkeep for every torrent that should announce on `key`'s
+     * address family. If that family's DHT isn't ready yet, pass `ready` as
+     * false: the torrent will keep its place but won't be started.
+     */
+    void add(Key const& key, size_t peer_count, bool ready, time_t now);
+
+    /**
+     * Returns the announces to start now, fewest peers first, and counts them
+     * as in flight. Torrents that weren't add()ed since the last call are forgotten.
+     */
+    [[nodiscard]] std::vector<Key> const& next(time_t now);
+
+    // the DHT found `n_peers` more peers for an in-flight search
+    void onPeersFound(Key const& key, size_t n_peers);
+
+    // an in-flight search finished
+    void onSearchDone(Key const& key, time_t now);
+
+    // a search that next() returned couldn't be started
+    void onSearchFailed(Key const& key, time_t now);
+
+    [[nodiscard]] Stats const& stats() const
+    {
+        return stats_;
+    }
+
+    // returns when `key`'s next announce is due, or 0 if it's not scheduled
+    [[nodiscard]] time_t dueAt(Key const& key) const;
+
+    // the budgets that the last call to next() used
+    [[nodiscard]] size_t maxInFlight() const
+    {
+        return max_in_flight_;
+    }
+
+    [[nodiscard]] size_t maxStartsPerUpkeep() const
+    {
+        return max_starts_per_upkeep_;
+    }
+
+private:
+    struct Entry
+    {
+        size_t peer_count = 0;
+        uint64_t seen = 0;
+        time_t due = 0;
+        time_t started_at = 0;
+        size_t peers_found = 0;
+        int empty_streak = 0;
+        int fail_streak = 0;
+        bool ready = false;
+        bool in_flight = false;
+    };
+
+    void finish(Entry& entry);
+    void updateBudgets();
+
+    std::map<Key, Entry> entries_;
+
+    // scratch space for next(), kept to avoid reallocating every upkeep
+    std::vector<std::map<Key, Entry>::value_type*> candidates_;
+    std::vector<Key> starts_;
+
+    size_t const min_in_flight_;
+    size_t const min_starts_per_upkeep_;
+    time_t const upkeep_interval_sec_;
+
+    size_t max_in_flight_;
+    size_t max_starts_per_upkeep_;
+
+    // a moving average of how long searches take
+    time_t search_sec_;
+
+    uint64_t round_ = 1;
+
+    Stats stats_;
+};
@@ -23,6 +23,7 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <csignal> /* sig_atomic_t */
 #include <cstdio>
@@ -50,14 +51,18 @@
 #include "transmission.h"
 #include "crypto-utils.h"
 #include "file.h"
+#include "history.h"
 #include "log.h"
 #include "net.h"
+#include "peer-common.h" /* tr_swarmGetStats() */
 #include "peer-mgr.h" /* tr_peerMgrCompactToPex() */
 #include "platform.h" /* tr_threadNew() */
 #include "session.h"
 #include "torrent.h" /* tr_torrentFindFromHash() */
 #include "tr-assert.h"
 #include "tr-dht.h"
+#include "tr-dht-scheduler.h"
+#include "tr-udp.h" /* tr_udpSendTo() */
 #include "trevent.h" /* tr_runInEventThread() */
 #include "utils.h"
 #include "variant.h"
@@ -67,6 +72,12 @@ using namespace std::literals;
 static struct event* dht_timer = nullptr;
 static unsigned char myid[20];
 static tr_session* session_ = nullptr;
+static tr_dht_scheduler* scheduler_ = nullptr;
+static tr_recentHistory packets_received_;
+static tr_recentHistory packets_sent_;
+
+// how many seconds of history to use when reporting packets per second
+static auto constexpr PacketRateSec = 10;
 
 static void timer_callback(evutil_socket_t s, short type, void* ignore);
 
@@ -376,6 +387,7 @@ int tr_dhtInit(tr_session* ss)
     }
 
     session_ = ss;
+    scheduler_ = new tr_dht_scheduler{};
 
     auto* const cl = tr_new(struct bootstrap_closure, 1);
     cl->session = session_;
@@ -472,6 +484,8 @@ void tr_dhtUninit(tr_session* ss)
     dht_uninit();
     tr_logAddNamedDbg("DHT", "Done uninitializing DHT");
 
+    delete scheduler_;
+    scheduler_ = nullptr;
     session_ = nullptr;
 }
 
@@ -631,6 +645,7 @@ static void callback(void* /*ignore*/, int event, unsigned char const* info_hash
                                                             tr_peerMgrCompact6ToPex(data, data_len, nullptr, 0, &n);
 
             tr_peerMgrAddPex(tor, TR_PEER_FROM_DHT, pex, n);
+            scheduler_->onPeersFound({ tor->uniqueId, event == DHT_EVENT_VALUES ? AF_INET : AF_INET6 }, n);
 
             tr_free(pex);
             tr_logAddTorDbg(tor, "Learned %d %s peers from DHT", (int)n, event == DHT_EVENT_VALUES6 ? "IPv6" : "IPv4");
@@ -645,51 +660,20 @@ static void callback(void* /*ignore*/, int event, unsigned char const* info_hash
             if (event == DHT_EVENT_SEARCH_DONE)
             {
                 tr_logAddTorInfo(tor, "%s", "IPv4 DHT announce done");
-                tor->dhtAnnounceInProgress = false;
+                scheduler_->onSearchDone({ tor->uniqueId, AF_INET }, tr_time());
             }
             else
             {
                 tr_logAddTorInfo(tor, "%s", "IPv6 DHT announce done");
-                tor->dhtAnnounce6InProgress = false;
+                scheduler_->onSearchDone({ tor->uniqueId, AF_INET6 }, tr_time());
             }
         }
     }
 }
 
-enum class AnnounceResult
-{
-    INVALID,
-    OK,
-    FAILED
-};
-
-static AnnounceResult tr_dhtAnnounce(tr_torrent* tor, int af, bool announce)
+static bool tr_dhtAnnounce(tr_torrent* tor, int af, int status, int numnodes)
 {
-    if (!tr_torrentAllowsDHT(tor))
-    {
-        return AnnounceResult::INVALID;
-    }
-
-    int numnodes = 0;
-    int const status = tr_dhtStatus(tor->session, af, &numnodes);
-    if (status == TR_DHT_STOPPED)
-    {
-        // let the caller believe everything is all right.
-        return AnnounceResult::OK;
-    }
-
-    if (status < TR_DHT_POOR)
-    {
-        tr_logAddTorDbg(
-            tor,
-            "%s DHT not ready (%s, %d nodes)",
-            af == AF_INET6 ? "IPv6" : "IPv4",
-            tr_dhtPrintableStatus(status),
-            numnodes);
-        return AnnounceResult::FAILED;
-    }
-
-    int const rc = dht_search(tor->info.hash, announce ? tr_sessionGetPeerPort(session_) : 0, af, callback, nullptr);
+    int const rc = dht_search(tor->info.hash, tr_sessionGetPeerPort(session_), af, callback, nullptr);
     if (rc < 0)
     {
         tr_logAddTorErr(
@@ -699,7 +683,7 @@ static AnnounceResult tr_dhtAnnounce(tr_torrent* tor, int af, bool announce)
             tr_dhtPrintableStatus(status),
             numnodes,
             tr_strerror(errno));
-        return AnnounceResult::FAILED;
+        return false;
     }
 
     tr_logAddTorInfo(
@@ -709,22 +693,27 @@ static AnnounceResult tr_dhtAnnounce(tr_torrent* tor, int af, bool announce)
         tr_dhtPrintableStatus(status),
         numnodes);
 
-    if (af == AF_INET)
-    {
-        tor->dhtAnnounceInProgress = true;
-    }
-    else
-    {
-        tor->dhtAnnounce6InProgress = true;
-    }
-
-    return AnnounceResult::OK;
+    return true;
 }
 
 void tr_dhtUpkeep(tr_session* session)
 {
+    if (!tr_dhtEnabled(session))
+    {
+        return;
+    }
+
     time_t const now = tr_time();
 
+    auto constexpr Families = std::array<int, 2>{ AF_INET, AF_INET6 };
+    auto statuses = std::array<int, 2>{};
+    auto numnodes = std::array<int, 2>{};
+
+    for (size_t i = 0; i < std::size(Families); ++i)
+    {
+        statuses[i] = tr_dhtStatus(session, Families[i], &numnodes[i]);
+    }
+
     for (auto* tor : session->torrents)
     {
         if (!tor->isRunning || !tr_torrentAllowsDHT(tor))
@@ -732,24 +721,52 @@ void tr_dhtUpkeep(tr_session* session)
             continue;
         }
 
-        if (tor->dhtAnnounceAt <= now)
-        {
-            auto const rc = tr_dhtAnnounce(tor, AF_INET, true);
+        auto swarm_stats = tr_swarm_stats{};
+        tr_swarmGetStats(tor->swarm, &swarm_stats);
 
-            tor->dhtAnnounceAt = now +
-                ((rc == AnnounceResult::FAILED) ? 5 + tr_rand_int_weak(5) : 25 * 60 + tr_rand_int_weak(3 * 60));
+        for (size_t i = 0; i < std::size(Families); ++i)
+        {
+            if (statuses[i] != TR_DHT_STOPPED)
+            {
+                scheduler_->add({ tor->uniqueId, Families[i] }, swarm_stats.peerCount, statuses[i] >= TR_DHT_POOR, now);
+            }
         }
+    }
 
-        if (tor->dhtAnnounce6At <= now)
-        {
-            auto const rc = tr_dhtAnnounce(tor, AF_INET6, true);
+    for (auto const& [id, af] : scheduler_->next(now))
+    {
+        auto* const tor = tr_torrentFindFromId(session, id);
+        auto const i = af == AF_INET ? 0 : 1;
 
-            tor->dhtAnnounce6At = now +
-                ((rc == AnnounceResult::FAILED) ? 5 + tr_rand_int_weak(5) : 25 * 60 + tr_rand_int_weak(3 * 60));
+        if (tor == nullptr || !tr_dhtAnnounce(tor, af, statuses[i], numnodes[i]))
+        {
+            scheduler_->onSearchFailed({ id, af }, now);
         }
     }
 }
 
+void tr_dhtGetStats(tr_session const* session, tr_dht_stats* setme)
+{
+    *setme = {};
+
+    if (!tr_dhtEnabled(session))
+    {
+        return;
+    }
+
+    auto const& stats = scheduler_->stats();
+    auto const now = tr_time();
+
+    setme->searches_in_flight = stats.searches_in_flight;
+    setme->searches_queued = stats.searches_queued;
+    setme->searches_started = stats.searches_started;
+    setme->searches_done = stats.searches_done;
+    setme->searches_failed = stats.searches_failed;
+    setme->peers_per_search = stats.searches_done != 0 ? double(stats.peers_found) / stats.searches_done : 0.0;
+    setme->packets_received_per_second = double(packets_received_.count(now, PacketRateSec)) / PacketRateSec;
+    setme->packets_sent_per_second = double(packets_sent_.count(now, PacketRateSec)) / PacketRateSec;
+}
+
 void tr_dhtCallback(unsigned char* buf, int buflen, struct sockaddr* from, socklen_t fromlen, void* sv)
 {
     TR_ASSERT(tr_isSession(static_cast<tr_session*>(sv)));
@@ -759,6 +776,11 @@ void tr_dhtCallback(unsigned char* buf, int buflen, struct sockaddr* from, sockl
         return;
     }
 
+    if (buf != nullptr)
+    {
+        packets_received_.add(tr_time(), 1);
+    }
+
     time_t tosleep = 0;
     int rc = dht_periodic(buf, buflen, from, fromlen, &tosleep, callback, nullptr);
 
@@ -818,7 +840,16 @@ int dht_random_bytes(void* buf, size_t size)
 
 int dht_sendto(int sockfd, void const* buf, int len, int flags, struct sockaddr const* to, int tolen)
 {
-    return sendto(sockfd, static_cast<char const*>(buf), len, flags, to, tolen);
+    packets_sent_.add(tr_time(), 1);
+
+    if (session_ == nullptr || flags != 0)
+    {
+        return sendto(sockfd, static_cast<char const*>(buf), len, flags, to, tolen);
+    }
+
+    // send it with the rest of this event loop iteration's UDP datagrams
+    tr_udpSendTo(session_, sockfd, buf, len, to, tolen);
+    return len;
 }
 
 #if defined(_WIN32) && !defined(__MINGW32__)
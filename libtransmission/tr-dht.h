@@ -28,6 +28,9 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
 enum
 {
     TR_DHT_STOPPED = 0,
@@ -45,4 +48,18 @@ int tr_dhtStatus(tr_session*, int af, int* setme_nodeCount);
 char const* tr_dhtPrintableStatus(int status);
 bool tr_dhtAddNode(tr_session*, tr_address const*, tr_port, bool bootstrap);
 void tr_dhtUpkeep(tr_session*);
+
+struct tr_dht_stats
+{
+    size_t searches_in_flight;
+    size_t searches_queued;
+    uint64_t searches_started;
+    uint64_t searches_done;
+    uint64_t searches_failed;
+    double peers_per_search;
+    double packets_received_per_second;
+    double packets_sent_per_second;
+};
+
+void tr_dhtGetStats(tr_session const*, tr_dht_stats* setme);
 void tr_dhtCallback(unsigned char* buf, int buflen, struct sockaddr* from, socklen_t fromlen, void* sv);
@@ -26,6 +26,9 @@ THE SOFTWARE.
 #include <csignal> /* sig_atomic_t */
 #include <cstdio>
 #include <cstring> /* strlen(), strncpy(), strstr(), memset() */
+#include <functional> /* std::greater */
+#include <queue>
+#include <utility>
 
 #ifdef _WIN32
 #include <inttypes.h>
@@ -45,6 +48,7 @@ using in_port_t = uint16_t; /* all missing */
 
 /* libT */
 #include "transmission.h"
+#include "crypto-utils.h" /* tr_sha1_to_hex(), tr_hex_to_sha1() */
 #include "log.h"
 #include "net.h"
 #include "peer-mgr.h" /* tr_peerMgrAddPex() */
@@ -62,7 +66,8 @@ using in_port_t = uint16_t; /* all missing */
 * @file tr-lpd.c
 *
 * This module implements the Local Peer Discovery (LPD) protocol as supported by the
-* uTorrent client application. A typical LPD datagram is 119 bytes long.
+* uTorrent client application. A typical LPD datagram announcing one torrent is 119
+* bytes long; each additional Infohash header adds another 52.
 *
 */
 
@@ -79,7 +84,11 @@ static tr_port lpd_port;
 
 static tr_session* session;
 
-static auto constexpr lpd_maxDatagramLength = int{ 200 }; /**<the size an LPD datagram must not exceed */
+/** the size an LPD datagram must not exceed, so that it fits in one packet on an Ethernet LAN.
+ * Note that Transmission 3.00 and older discard LPD datagrams longer than 200 bytes, and
+ * only read the first Infohash header. tr_sessionSetLPDPackAnnounces() can turn packing
+ * off for LANs that still have such peers. */
+static auto constexpr lpd_maxDatagramLength = int{ 1400 };
 static char constexpr lpd_mcastGroup[] = "239.192.152.143"; /**<LPD multicast group */
 static auto constexpr lpd_mcastPort = int{ 6771 }; /**<LPD source and destination UPD port */
 static auto lpd_mcastAddr = sockaddr_in{}; /**<initialized from the above constants in tr_lpdInit */
@@ -99,8 +108,25 @@ static auto constexpr lpd_ttlSameSubnet = int{ 1 };
 // static auto constexpr lpd_ttlUnrestricted = int{ 255 };
 
 static auto constexpr lpd_announceInterval = int{ 4 * 60 }; /**<4 min announce interval per torrent */
+static auto constexpr lpd_retryInterval = int{ 30 }; /**<for running torrents that can't be announced yet */
+
+/** at most this many torrents are announced per upkeep interval; about eight full datagrams */
+static auto constexpr lpd_maxAnnouncesPerUpkeep = size_t{ 200 };
+
+/** the same, when each torrent gets a datagram of its own. Two datagrams per second stays
+ * well under the ten that receivers accept from everyone on the LAN, see lpd_announceCapFactor */
+static auto constexpr lpd_maxUnpackedAnnouncesPerUpkeep = size_t{ 10 };
+
 static auto constexpr lpd_announceScope = int{ lpd_ttlSameSubnet }; /**<the maximum scope for LPD datagrams */
 
+/**
+* @brief When each running torrent is next due to be announced, soonest first
+*
+* An entry is stale, and skipped, if its torrent has gone away or the
+* torrent's lpdAnnounceAt no longer matches it. */
+using lpd_due_t = std::pair<time_t, int>; /* lpdAnnounceAt, torrent id */
+static std::priority_queue<lpd_due_t, std::vector<lpd_due_t>, std::greater<>> lpd_dueQueue;
+
 /**
 * @defgroup DoS Message Flood Protection
 * @{
@@ -272,12 +298,6 @@ static void on_upkeep_timer(evutil_socket_t, short, void*);
 */
 int tr_lpdInit(tr_session* ss, tr_address* /*tr_addr*/)
 {
-    /* if this check fails (i.e. the definition of hashString changed), update
-     * string handling in tr_lpdSendAnnounce() and tr_lpdConsiderAnnounce().
-     * However, the code should work as long as interfaces to the rest of
-     * libtransmission are compatible with char* strings. */
-    static_assert(sizeof(((struct tr_info*)nullptr)->hashString[0]) == sizeof(char), "");
-
     struct ip_mreq mcastReq;
     int const opt_on = 1;
     int const opt_off = 0;
@@ -381,6 +401,15 @@ int tr_lpdInit(tr_session* ss, tr_address* /*tr_addr*/)
 
     session = ss;
 
+    /* pick up the torrents that were started before LPD was */
+    for (auto const* const tor : ss->torrents)
+    {
+        if (tor->isRunning)
+        {
+            lpd_dueQueue.emplace(tor->lpdAnnounceAt, tor->uniqueId);
+        }
+    }
+
     /* Note: lpd_unsolicitedMsgCounter remains 0 until the first timeout event, thus
      * any announcement received during the initial interval will be discarded. */
 
@@ -428,6 +457,7 @@ void tr_lpdUninit(tr_session* ss)
     evutil_closesocket(lpd_socket2);
     tr_logAddNamedDbg("LPD", "Done uninitialising Local Peer Discovery");
 
+    lpd_dueQueue = {};
     session = nullptr;
 }
 
@@ -444,71 +474,123 @@ bool tr_lpdEnabled(tr_session const* ss)
 * @{
 */
 
-/**
-* @brief Announce the given torrent on the local network
-*
-* @param[in] t Torrent to announce
-* @return Returns true on success
-*
-* Send a query for torrent t out to the LPD multicast group (or the LAN, for that
-* matter). A listening client on the same network might react by adding us to his
-* peer pool for torrent t.
-*/
-bool tr_lpdSendAnnounce(tr_torrent const* t)
+std::vector<std::string> tr_lpdMakeAnnounces(tr_port port, std::vector<tr_sha1_digest_t> const& info_hashes, bool pack)
 {
-    char const fmt[] = //
-        "BT-SEARCH * HTTP/%u.%u" CRLF //
-        "Host: %s:%u" CRLF //
-        "Port: %u" CRLF //
-        "Infohash: %s" CRLF //
-        "" CRLF //
-        "" CRLF;
-
-    char hashString[SIZEOF_HASH_STRING];
-    char query[lpd_maxDatagramLength + 1] = { 0 };
-
-    if (t == nullptr)
+    auto ret = std::vector<std::string>{};
+
+    char header[lpd_maxDatagramLength];
+    tr_snprintf(
+        header,
+        sizeof(header),
+        "BT-SEARCH * HTTP/%u.%u" CRLF "Host: %s:%u" CRLF "Port: %u" CRLF,
+        1,
+        1,
+        lpd_mcastGroup,
+        lpd_mcastPort,
+        port);
+
+    auto constexpr Trailer = std::string_view{ CRLF CRLF };
+    auto datagram = std::string{};
+
+    for (auto const& info_hash : info_hashes)
     {
-        return false;
+        /* make sure the hash string is normalized, just in case */
+        char hash_string[SHA_DIGEST_LENGTH * 2 + 1];
+        tr_sha1_to_hex(hash_string, std::data(info_hash));
+        std::transform(
+            std::begin(hash_string),
+            std::end(hash_string),
+            std::begin(hash_string),
+            [](unsigned char ch) { return toupper(ch); });
+
+        auto const line = tr_strvJoin("Infohash: ", hash_string, CRLF);
+
+        if (!std::empty(datagram) &&
+            (!pack || std::size(datagram) + std::size(line) + std::size(Trailer) > lpd_maxDatagramLength))
+        {
+            ret.push_back(datagram + std::string{ Trailer });
+            datagram.clear();
+        }
+
+        if (std::empty(datagram))
+        {
+            datagram = header;
+        }
+
+        datagram += line;
     }
 
-    /* make sure the hash string is normalized, just in case */
-    for (size_t i = 0; i < TR_N_ELEMENTS(hashString); ++i)
+    if (!std::empty(datagram))
     {
-        hashString[i] = toupper(t->info.hashString[i]);
+        ret.push_back(datagram + std::string{ Trailer });
     }
 
-    /* prepare a zero-terminated announce message */
-    tr_snprintf(query, lpd_maxDatagramLength + 1, fmt, 1, 1, lpd_mcastGroup, lpd_mcastPort, lpd_port, hashString);
+    return ret;
+}
 
-    /* actually send the query out using [lpd_socket2] */
+std::optional<tr_lpd_announce> tr_lpdParseAnnounce(char const* datagram)
+{
+    auto constexpr MaxValueLen = int{ 25 };
+
+    auto ver = lpd_protocolVersion{ -1, -1 };
+    char value[MaxValueLen] = { 0 };
+    int peerPort = 0;
+
+    char const* const params = datagram != nullptr ? lpd_extractHeader(datagram, &ver) : nullptr;
+
+    if (params == nullptr || ver.major != 1) /* allow messages of protocol v1 */
     {
-        int const len = strlen(query);
+        return {};
+    }
 
-        /* destination address info has already been set up in tr_lpdInit(),
-         * so we refrain from preparing another sockaddr_in here */
-        int res = sendto(lpd_socket2, query, len, 0, (struct sockaddr const*)&lpd_mcastAddr, sizeof(lpd_mcastAddr));
+    /* save the effort to check Host, which seems to be optional anyway */
+
+    if (!lpd_extractParam(params, "Port", MaxValueLen, value))
+    {
+        return {};
+    }
 
-        if (res != len)
+    /* determine announced peer port, refuse if value too large */
+    if (sscanf(value, "%d", &peerPort) != 1 || peerPort <= 0 || peerPort > (in_port_t)-1)
+    {
+        return {};
+    }
+
+    auto ret = tr_lpd_announce{};
+    ret.port = tr_port(peerPort);
+
+    /* there may be more than one Infohash header */
+    auto constexpr Key = std::string_view{ CRLF "Infohash: " };
+    auto constexpr HashStringLen = size_t{ SHA_DIGEST_LENGTH * 2 };
+
+    for (char const* walk = strstr(params, std::data(Key)); walk != nullptr; walk = strstr(walk, std::data(Key)))
+    {
+        walk += std::size(Key);
+
+        char const* const value_end = strstr(walk, CRLF);
+        if (value_end == nullptr || size_t(value_end - walk) != HashStringLen ||
+            !std::all_of(walk, value_end, [](unsigned char ch) { return isxdigit(ch) != 0; }))
         {
-            return false;
+            continue;
         }
-    }
 
-    tr_logAddTorDbg(t, "LPD announce message away");
+        auto info_hash = tr_sha1_digest_t{};
+        tr_hex_to_sha1(std::data(info_hash), walk);
+        ret.info_hashes.push_back(info_hash);
+    }
 
-    return true;
+    return ret;
 }
 
 /**
 * @brief Process incoming unsolicited messages and add the peer to the announced
-* torrent if all checks are passed.
+* torrents if all checks are passed.
 *
 * @param[in,out] peer Adress information of the peer to add
 * @param[in] msg The announcement message to consider
 * @return Returns 0 if any input parameter or the announce was invalid, 1 if the peer
-* was successfully added, -1 if not; a non-null return value indicates a side-effect to
-* the peer in/out parameter.
+* was added to at least one torrent, -1 if not; a non-null return value indicates a
+* side-effect to the peer in/out parameter.
 *
 * @note The port information gets added to the peer structure if tr_lpdConsiderAnnounce
 * is able to extract the necessary information from the announce message. That is, if
@@ -516,61 +598,44 @@ bool tr_lpdSendAnnounce(tr_torrent const* t)
 */
 static int tr_lpdConsiderAnnounce(tr_pex* peer, char const* const msg)
 {
-    auto constexpr MaxValueLen = int{ 25 };
-    auto constexpr MaxHashLen = int{ SIZEOF_HASH_STRING };
-
-    auto ver = lpd_protocolVersion{ -1, -1 };
-    char value[MaxValueLen] = { 0 };
-    char hashString[MaxHashLen] = { 0 };
-    int res = 0;
-    int peerPort = 0;
-
-    if (peer != nullptr && msg != nullptr)
+    if (peer == nullptr)
     {
-        tr_torrent* tor = nullptr;
-
-        char const* params = lpd_extractHeader(msg, &ver);
-
-        if (params == nullptr || ver.major != 1) /* allow messages of protocol v1 */
-        {
-            return 0;
-        }
-
-        /* save the effort to check Host, which seems to be optional anyway */
-
-        if (!lpd_extractParam(params, "Port", MaxValueLen, value))
-        {
-            return 0;
-        }
-
-        /* determine announced peer port, refuse if value too large */
-        if (sscanf(value, "%d", &peerPort) != 1 || peerPort > (in_port_t)-1)
-        {
-            return 0;
-        }
+        return 0;
+    }
 
-        peer->port = htons(peerPort);
-        res = -1; /* signal caller side-effect to peer->port via return != 0 */
+    auto const announce = tr_lpdParseAnnounce(msg);
+    if (!announce)
+    {
+        return 0;
+    }
 
-        if (!lpd_extractParam(params, "Infohash", MaxHashLen, hashString))
-        {
-            return res;
-        }
+    peer->port = htons(announce->port);
+    int res = -1; /* signal caller side-effect to peer->port via return != 0 */
 
-        tor = tr_torrentFindFromHashString(session, hashString);
+    for (auto const& info_hash : announce->info_hashes)
+    {
+        tr_torrent* const tor = tr_torrentFindFromHash(session, info_hash);
 
         if (tr_isTorrent(tor) && tr_torrentAllowsLPD(tor))
         {
             /* we found a suitable peer, add it to the torrent */
             tr_peerMgrAddPex(tor, TR_PEER_FROM_LPD, peer, 1);
-            tr_logAddTorDbg(tor, "Learned %d local peer from LPD (%s:%u)", 1, tr_address_to_string(&peer->addr), peerPort);
+            tr_logAddTorDbg(
+                tor,
+                "Learned %d local peer from LPD (%s:%u)",
+                1,
+                tr_address_to_string(&peer->addr),
+                unsigned(announce->port));
 
             /* periodic reconnectPulse() deals with the rest... */
 
-            return 1;
+            res = 1;
         }
+    }
 
-        tr_logAddNamedDbg("LPD", "Cannot serve torrent #%s", hashString);
+    if (res < 0)
+    {
+        tr_logAddNamedDbg("LPD", "Cannot serve any of the %zu announced torrents", std::size(announce->info_hashes));
     }
 
     return res;
@@ -579,15 +644,42 @@ static int tr_lpdConsiderAnnounce(tr_pex* peer, char const* const msg)
 /**
 * @} */
 
+static void lpd_scheduleAnnounce(tr_torrent* tor, time_t when)
+{
+    tor->lpdAnnounceAt = when;
+
+    if (session != nullptr)
+    {
+        lpd_dueQueue.emplace(when, tor->uniqueId);
+    }
+}
+
+void tr_lpdTorrentStarted(tr_torrent* tor)
+{
+    lpd_scheduleAnnounce(tor, tr_time());
+}
+
+static bool lpd_sendDatagram(std::string const& datagram)
+{
+    /* destination address info has already been set up in tr_lpdInit(),
+     * so we refrain from preparing another sockaddr_in here */
+    int const len = std::size(datagram);
+    int const res = sendto(
+        lpd_socket2,
+        std::data(datagram),
+        len,
+        0,
+        (struct sockaddr const*)&lpd_mcastAddr,
+        sizeof(lpd_mcastAddr));
+
+    return res == len;
+}
+
 /**
-* @note Since it possible for tr_lpdAnnounceMore to get called from outside the LPD module,
-* the function needs to be informed of the externally employed housekeeping interval.
-* Further, by setting interval to zero (or negative) the caller may actually disable LPD
-* announces on a per-interval basis.
+* @brief Announce the torrents that are due, packing several into each datagram
 *
-* TODO: since this function's been made private and is called by a periodic timer,
-* most of the previous paragraph isn't true anymore... we weren't using that functionality
-* before. are there cases where we should? if not, should we remove the bells & whistles?
+* Only the due entries of lpd_dueQueue are looked at, so this doesn't
+* depend on how many torrents the session has.
 */
 static int tr_lpdAnnounceMore(time_t const now, int const interval)
 {
@@ -600,11 +692,19 @@ static int tr_lpdAnnounceMore(time_t const now, int const interval)
 
     if (tr_sessionAllowsLPD(session))
     {
-        for (auto* tor : session->torrents)
+        auto const pack = tr_sessionGetLPDPackAnnounces(session);
+        auto const max_announces = pack ? lpd_maxAnnouncesPerUpkeep : lpd_maxUnpackedAnnouncesPerUpkeep;
+        auto info_hashes = std::vector<tr_sha1_digest_t>{};
+
+        while (!std::empty(lpd_dueQueue) && lpd_dueQueue.top().first <= now && std::size(info_hashes) < max_announces)
         {
-            int announcePrio = 0;
+            auto const [due, id] = lpd_dueQueue.top();
+            lpd_dueQueue.pop();
+
+            tr_torrent* const tor = tr_torrentFindFromId(session, id);
 
-            if (!tr_torrentAllowsLPD(tor))
+            /* stale entry: the torrent was removed, stopped, or rescheduled */
+            if (tor == nullptr || !tor->isRunning || tor->lpdAnnounceAt != due || !tr_torrentAllowsLPD(tor))
             {
                 continue;
             }
@@ -613,29 +713,37 @@ static int tr_lpdAnnounceMore(time_t const now, int const interval)
             switch (tr_torrentGetActivity(tor))
             {
             case TR_STATUS_DOWNLOAD:
-                announcePrio = 1;
+                info_hashes.push_back(tr_torrentInfoHash(tor));
+                lpd_scheduleAnnounce(tor, now + lpd_announceInterval);
                 break;
 
             case TR_STATUS_SEED:
-                announcePrio = 2;
+                info_hashes.push_back(tr_torrentInfoHash(tor));
+                lpd_scheduleAnnounce(tor, now + lpd_announceInterval * 2);
                 break;
 
-            default:
+            default: /* e.g. still being verified; try again later */
+                lpd_scheduleAnnounce(tor, now + lpd_retryInterval);
                 break;
             }
+        }
 
-            if (announcePrio > 0 && tor->lpdAnnounceAt <= now)
+        for (auto const& datagram : tr_lpdMakeAnnounces(lpd_port, info_hashes, pack))
+        {
+            if (lpd_sendDatagram(datagram))
             {
-                if (tr_lpdSendAnnounce(tor))
-                {
-                    announcesSent++;
-                }
-
-                tor->lpdAnnounceAt = now + lpd_announceInterval * announcePrio;
-
-                break; /* that's enough; for this interval */
+                ++announcesSent;
             }
         }
+
+        if (!std::empty(info_hashes))
+        {
+            tr_logAddNamedDbg(
+                "LPD",
+                "Announced %zu torrents in %d LPD announce messages",
+                std::size(info_hashes),
+                announcesSent);
+        }
     }
 
     /* perform housekeeping for the flood protection mechanism */
@@ -26,10 +26,40 @@ THE SOFTWARE.
 #error only libtransmission should #include this header.
 #endif
 
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "tr-macros.h" // tr_sha1_digest_t
+
+struct tr_address;
+
 int tr_lpdInit(tr_session*, tr_address*);
 void tr_lpdUninit(tr_session*);
 bool tr_lpdEnabled(tr_session const*);
-bool tr_lpdSendAnnounce(tr_torrent const*);
+
+/** @brief queue a torrent that was just started to be announced on the LAN */
+void tr_lpdTorrentStarted(tr_torrent*);
+
+/**
+* @brief Build the BT-SEARCH datagrams that announce `info_hashes` on the LAN
+*
+* BEP 14 allows more than one Infohash header per datagram, so if `pack`
+* is set, each one carries as many of the hashes as fit in a single
+* unfragmented packet. Otherwise each hash gets a datagram of its own,
+* which is all that Transmission 3.00 and older understand.
+*/
+std::vector<std::string> tr_lpdMakeAnnounces(tr_port port, std::vector<tr_sha1_digest_t> const& info_hashes, bool pack);
+
+struct tr_lpd_announce
+{
+    tr_port port; /* in host byte order */
+    std::vector<tr_sha1_digest_t> info_hashes;
+};
+
+/** @brief parse a BT-SEARCH datagram. Infohash headers that aren't valid hex are skipped. */
+std::optional<tr_lpd_announce> tr_lpdParseAnnounce(char const* datagram);
 
 /**
 * @} */
@@ -0,0 +1,371 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring> /* memcmp(), memcpy(), memmove() */
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#include <sys/socket.h> /* recvmmsg(), sendmmsg() */
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#endif
+
+#include "transmission.h"
+
+#include "tr-assert.h"
+#include "tr-udp-batch.h"
+
+#if defined(HAVE_SENDMMSG) && defined(UDP_SEGMENT)
+#define TR_UDP_GSO
+#endif
+
+namespace
+{
+
+[[nodiscard]] bool isTransientSendError(int err)
+{
+    // the send buffer is full, so the rest of this batch won't fit either
+    return err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS;
+}
+
+#ifdef TR_UDP_GSO
+
+// errors that mean this socket or its route can't do UDP GSO
+[[nodiscard]] bool isGSOError(int err)
+{
+    return err == EIO || err == EINVAL || err == EOPNOTSUPP || err == ENOPROTOOPT;
+}
+
+#endif
+
+} // namespace
+
+tr_udp_batch::tr_udp_batch(bool use_gso)
+    : send_buf_(MaxBatch * MaxQueuedPacketSize)
+    , recv_buf_(MaxBatch * MaxPacketSize)
+#ifdef TR_UDP_GSO
+    , use_gso_{ use_gso }
+#else
+    , use_gso_{ false }
+#endif
+{
+    static_cast<void>(use_gso);
+}
+
+size_t tr_udp_batch::receive(tr_socket_t sock, Handler handler, void* user_data)
+{
+    auto n_received = size_t{ 0 };
+
+#ifdef HAVE_RECVMMSG
+
+    auto iovs = std::array<iovec, MaxBatch>{};
+    auto msgs = std::array<mmsghdr, MaxBatch>{};
+
+    for (size_t i = 0; i < MaxBatch; ++i)
+    {
+        // leave room for the handler's terminating zero
+        iovs[i].iov_base = std::data(recv_buf_) + i * MaxPacketSize;
+        iovs[i].iov_len = MaxPacketSize - 1;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &recv_from_[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(recv_from_[i]);
+    }
+
+    ++stats_.receive_calls;
+    int const rc = recvmmsg(sock, std::data(msgs), MaxBatch, MSG_DONTWAIT, nullptr);
+
+    for (int i = 0; i < rc; ++i)
+    {
+        auto const& msg = msgs[i];
+
+        if (msg.msg_len > 0)
+        {
+            ++n_received;
+            handler(
+                static_cast<unsigned char*>(iovs[i].iov_base),
+                msg.msg_len,
+                reinterpret_cast<sockaddr const*>(&recv_from_[i]),
+                msg.msg_hdr.msg_namelen,
+                user_data);
+        }
+    }
+
+#else
+
+    for (size_t i = 0; i < MaxBatch; ++i)
+    {
+        auto* const buf = std::data(recv_buf_) + i * MaxPacketSize;
+        auto* const from = reinterpret_cast<sockaddr*>(&recv_from_[i]);
+        socklen_t fromlen = sizeof(recv_from_[i]);
+
+        ++stats_.receive_calls;
+        int const rc = recvfrom(sock, reinterpret_cast<char*>(buf), MaxPacketSize - 1, 0, from, &fromlen);
+
+        if (rc < 0)
+        {
+            break;
+        }
+
+        if (rc > 0)
+        {
+            ++n_received;
+            handler(buf, rc, from, fromlen, user_data);
+        }
+    }
+
+#endif
+
+    stats_.packets_received += n_received;
+    return n_received;
+}
+
+void tr_udp_batch::send(tr_socket_t sock, void const* buf, size_t buflen, sockaddr const* to, socklen_t tolen)
+{
+    TR_ASSERT(tolen <= static_cast<socklen_t>(sizeof(sockaddr_storage)));
+
+    if (buflen > MaxQueuedPacketSize)
+    {
+        // too big to queue, so send it now. Flush first to keep the order.
+        flush();
+        ++stats_.send_calls;
+
+        if (sendto(sock, static_cast<char const*>(buf), buflen, 0, to, tolen) >= 0)
+        {
+            ++stats_.packets_sent;
+        }
+        else
+        {
+            ++stats_.packets_dropped;
+        }
+
+        return;
+    }
+
+    if (n_queued_ == MaxBatch || send_buf_used_ + buflen > std::size(send_buf_))
+    {
+        flush();
+
+        if (n_queued_ == MaxBatch || send_buf_used_ + buflen > std::size(send_buf_))
+        {
+            ++stats_.packets_dropped;
+            return;
+        }
+    }
+
+    auto& q = queue_[n_queued_++];
+    q.sock = sock;
+    q.offset = send_buf_used_;
+    q.len = buflen;
+    memcpy(&q.to, to, tolen);
+    q.tolen = tolen;
+
+    memcpy(std::data(send_buf_) + send_buf_used_, buf, buflen);
+    send_buf_used_ += buflen;
+}
+
+bool tr_udp_batch::isSameDestination(Queued const& a, Queued const& b)
+{
+    return a.sock == b.sock && a.tolen == b.tolen && memcmp(&a.to, &b.to, a.tolen) == 0;
+}
+
+bool tr_udp_batch::isQueued(tr_socket_t sock) const
+{
+    auto const end = std::begin(queue_) + n_queued_;
+    return std::any_of(std::begin(queue_), end, [sock](auto const& q) { return q.sock == sock; });
+}
+
+bool tr_udp_batch::sendOne(Queued const& q)
+{
+    ++stats_.send_calls;
+
+    auto const* const buf = reinterpret_cast<char const*>(std::data(send_buf_) + q.offset);
+    if (sendto(q.sock, buf, q.len, 0, reinterpret_cast<sockaddr const*>(&q.to), q.tolen) < 0)
+    {
+        return false;
+    }
+
+    ++stats_.packets_sent;
+    return true;
+}
+
+void tr_udp_batch::flush()
+{
+    auto n_kept = size_t{ 0 };
+    auto kept_buf_used = size_t{ 0 };
+
+    // sendmmsg() takes a single socket, so send each run of same-socket datagrams separately
+    for (size_t begin = 0; begin < n_queued_;)
+    {
+        auto end = begin + 1;
+        while (end < n_queued_ && queue_[end].sock == queue_[begin].sock)
+        {
+            ++end;
+        }
+
+        // keep what didn't fit, in order, at the front of the queue.
+        // It only ever moves towards the front, so nothing is overwritten.
+        for (auto i = flushRun(begin, end); i < end; ++i)
+        {
+            auto q = queue_[i];
+            memmove(std::data(send_buf_) + kept_buf_used, std::data(send_buf_) + q.offset, q.len);
+            q.offset = kept_buf_used;
+            kept_buf_used += q.len;
+            queue_[n_kept++] = q;
+        }
+
+        begin = end;
+    }
+
+    n_queued_ = n_kept;
+    send_buf_used_ = kept_buf_used;
+}
+
+#ifdef HAVE_SENDMMSG
+
+size_t tr_udp_batch::flushRun(size_t begin, size_t end)
+{
+    struct Message
+    {
+        size_t first;
+        size_t count;
+    };
+
+#ifdef TR_UDP_GSO
+    using Control = std::array<char, CMSG_SPACE(sizeof(uint16_t))>;
+    alignas(cmsghdr) auto controls = std::array<Control, MaxBatch>{};
+#endif
+
+    auto messages = std::array<Message, MaxBatch>{};
+    auto iovs = std::array<iovec, MaxBatch>{};
+    auto msgs = std::array<mmsghdr, MaxBatch>{};
+    auto n_msgs = size_t{ 0 };
+
+    for (auto i = begin; i < end; ++n_msgs)
+    {
+        auto const& first = queue_[i];
+        auto count = size_t{ 1 };
+        auto len = first.len;
+
+#ifdef TR_UDP_GSO
+        // with GSO, every segment but the last must be the same size,
+        // and the last can't be bigger than the others
+        while (use_gso_ && i + count < end && queue_[i + count - 1].len == first.len &&
+               queue_[i + count].len <= first.len && isSameDestination(first, queue_[i + count]))
+        {
+            len += queue_[i + count].len;
+            ++count;
+        }
+#endif
+
+        messages[n_msgs] = Message{ i, count };
+        iovs[n_msgs].iov_base = std::data(send_buf_) + first.offset;
+        iovs[n_msgs].iov_len = len;
+
+        auto& hdr = msgs[n_msgs].msg_hdr;
+        hdr.msg_iov = &iovs[n_msgs];
+        hdr.msg_iovlen = 1;
+        hdr.msg_name = const_cast<sockaddr_storage*>(&first.to);
+        hdr.msg_namelen = first.tolen;
+
+#ifdef TR_UDP_GSO
+        if (count > 1)
+        {
+            hdr.msg_control = std::data(controls[n_msgs]);
+            hdr.msg_controllen = std::size(controls[n_msgs]);
+
+            auto* const cm = CMSG_FIRSTHDR(&hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            auto const segment_size = static_cast<uint16_t>(first.len);
+            memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+        }
+#endif
+
+        i += count;
+    }
+
+    auto const sock = queue_[begin].sock;
+
+    for (size_t m = 0; m < n_msgs;)
+    {
+        ++stats_.send_calls;
+        int const rc = sendmmsg(sock, std::data(msgs) + m, n_msgs - m, MSG_DONTWAIT);
+
+        if (rc > 0)
+        {
+            for (auto const end_m = m + rc; m < end_m; ++m)
+            {
+                stats_.packets_sent += messages[m].count;
+
+                if (messages[m].count > 1)
+                {
+                    stats_.packets_sent_with_gso += messages[m].count;
+                }
+            }
+
+            continue;
+        }
+
+        auto const err = errno;
+
+        if (isTransientSendError(err))
+        {
+            return messages[m].first;
+        }
+
+#ifdef TR_UDP_GSO
+        if (messages[m].count > 1 && isGSOError(err))
+        {
+            // this path can't segment for us, so stop trying and send them one by one
+            use_gso_ = false;
+
+            for (size_t i = 0; i < messages[m].count; ++i)
+            {
+                if (!sendOne(queue_[messages[m].first + i]))
+                {
+                    ++stats_.packets_dropped;
+                }
+            }
+
+            ++m;
+            continue;
+        }
+#endif
+
+        // drop the datagram that failed and carry on with the rest
+        stats_.packets_dropped += messages[m].count;
+        ++m;
+    }
+
+    return end;
+}
+
+#else
+
+size_t tr_udp_batch::flushRun(size_t begin, size_t end)
+{
+    for (auto i = begin; i < end; ++i)
+    {
+        if (!sendOne(queue_[i]))
+        {
+            if (isTransientSendError(sockerrno))
+            {
+                return i;
+            }
+
+            ++stats_.packets_dropped;
+        }
+    }
+
+    return end;
+}
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <vector>
+
+#include "net.h" // tr_socket_t, sockaddr_storage, socklen_t
+
+/**
+ * Batched I/O for the session's UDP sockets.
+ *
+ * uTP, the DHT and UDP trackers all share one UDP socket per address
+ * family, and at high uTP rates the syscall per datagram becomes the
+ * bottleneck. receive() drains up to MaxBatch datagrams per call with
+ * a single recvmmsg() where it's available, and send() queues outgoing
+ * datagrams so that flush() can hand them to the kernel with a single
+ * sendmmsg(). Where UDP GSO is available, runs of equal-sized datagrams
+ * to the same peer are sent as one segmented buffer.
+ *
+ * On platforms without those syscalls this falls back to one recvfrom()
+ * or sendto() per datagram, so the sockets must be non-blocking.
+ */
+class tr_udp_batch
+{
+public:
+    struct Stats
+    {
+        uint64_t packets_received = 0;
+        uint64_t receive_calls = 0;
+        uint64_t packets_sent = 0;
+        uint64_t send_calls = 0;
+        uint64_t packets_sent_with_gso = 0;
+        uint64_t packets_dropped = 0;
+    };
+
+    // how many datagrams to read or write per syscall
+    static auto constexpr MaxBatch = size_t{ 32 };
+
+    // the largest datagram we'll read. Bigger ones are truncated.
+    static auto constexpr MaxPacketSize = size_t{ 4096 };
+
+    // the largest datagram that can be queued. Bigger ones are sent right away.
+    static auto constexpr MaxQueuedPacketSize = size_t{ 2048 };
+
+    // `buf` has room for one more byte after `buflen`, e.g. for a terminating zero
+    using Handler = void (*)(unsigned char* buf, size_t buflen, sockaddr const* from, socklen_t fromlen, void* user_data);
+
+    explicit tr_udp_batch(bool use_gso = true);
+
+    tr_udp_batch(tr_udp_batch const&) = delete;
+    tr_udp_batch& operator=(tr_udp_batch const&) = delete;
+
+    /**
+     * Reads up to MaxBatch datagrams that are waiting on `sock` and passes
+     * each of them to `handler`. Returns how many datagrams were read.
+     */
+    size_t receive(tr_socket_t sock, Handler handler, void* user_data);
+
+    /**
+     * Queues a datagram to be sent on `sock` at the next flush().
+     * If the queue is full, it's flushed first. If that doesn't make
+     * room because the send buffers are full too, the datagram is dropped.
+     */
+    void send(tr_socket_t sock, void const* buf, size_t buflen, sockaddr const* to, socklen_t tolen);
+
+    /**
+     * Sends everything that's queued. If a socket's send buffer fills up,
+     * the datagrams that didn't fit stay queued, in order, to be tried
+     * again once it's writable; see isQueued(). Datagrams that fail for
+     * any other reason are dropped.
+     */
+    void flush();
+
+    [[nodiscard]] bool empty() const
+    {
+        return n_queued_ == 0;
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return n_queued_;
+    }
+
+    // true if datagrams for `sock` are waiting for its send buffer to drain
+    [[nodiscard]] bool isQueued(tr_socket_t sock) const;
+
+    [[nodiscard]] bool usesGSO() const
+    {
+        return use_gso_;
+    }
+
+    [[nodiscard]] Stats const& stats() const
+    {
+        return stats_;
+    }
+
+private:
+    struct Queued
+    {
+        tr_socket_t sock;
+        size_t offset;
+        size_t len;
+        sockaddr_storage to;
+        socklen_t tolen;
+    };
+
+    [[nodiscard]] static bool isSameDestination(Queued const& a, Queued const& b);
+    bool sendOne(Queued const& q);
+
+    // returns the first datagram in [begin, end) that didn't fit in the send buffer, or `end`
+    size_t flushRun(size_t begin, size_t end);
+
+    // queued datagrams are packed back to back, so a run of them is contiguous
+    std::vector<unsigned char> send_buf_;
+    std::array<Queued, MaxBatch> queue_ = {};
+    size_t n_queued_ = 0;
+    size_t send_buf_used_ = 0;
+
+    std::vector<unsigned char> recv_buf_;
+    std::array<sockaddr_storage, MaxBatch> recv_from_ = {};
+
+    bool use_gso_;
+
+    Stats stats_;
+};
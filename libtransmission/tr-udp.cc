@@ -41,8 +41,10 @@ THE SOFTWARE.
 #include "session.h"
 #include "tr-assert.h"
 #include "tr-dht.h"
+#include "tr-udp-batch.h"
 #include "tr-utp.h"
 #include "tr-udp.h"
+#include "trevent.h" /* tr_amInEventThread() */
 
 /* Since we use a single UDP socket in order to implement multiple
    uTP sockets, try to set up huge buffers. */
@@ -182,6 +184,9 @@ static void rebind_ipv6(tr_session* ss, bool force)
         goto FAIL;
     }
 
+    /* the batched reads and writes mustn't block */
+    (void)evutil_make_socket_nonblocking(s);
+
 #ifdef IPV6_V6ONLY
     /* Since we always open an IPv4 socket on the same port, this
        shouldn't matter.  But I'm superstitious. */
@@ -257,18 +262,10 @@ FAIL:
     }
 }
 
-static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+static void handle_packet(unsigned char* buf, size_t buflen, struct sockaddr const* from, socklen_t fromlen, void* vsession)
 {
-    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
-    TR_ASSERT(type == EV_READ);
-
-    unsigned char buf[4096];
-    struct sockaddr_storage from;
     auto* session = static_cast<tr_session*>(vsession);
 
-    socklen_t fromlen = sizeof(from);
-    int rc = recvfrom(s, reinterpret_cast<char*>(buf), 4096 - 1, 0, (struct sockaddr*)&from, &fromlen);
-
     /* Since most packets we receive here are ÂµTP, make quick inline
        checks for the other protocols.  The logic is as follows:
        - all DHT packets start with 'd'
@@ -276,40 +273,110 @@ static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void*
          is between 0 and 3
        - the above cannot be ÂµTP packets, since these start with a 4-bit
          version number (1). */
-    if (rc > 0)
+    if (buf[0] == 'd')
     {
-        if (buf[0] == 'd')
+        if (tr_sessionAllowsDHT(session))
         {
-            if (tr_sessionAllowsDHT(session))
-            {
-                buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback(buf, rc, (struct sockaddr*)&from, fromlen, vsession);
-            }
+            buf[buflen] = '\0'; /* required by the DHT code */
+            tr_dhtCallback(buf, buflen, const_cast<struct sockaddr*>(from), fromlen, vsession);
         }
-        else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    }
+    else if (buflen >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    {
+        if (!tau_handle_message(session, buf, buflen))
         {
-            rc = tau_handle_message(session, buf, rc);
-
-            if (rc == 0)
-            {
-                tr_logAddNamedDbg("UDP", "Couldn't parse UDP tracker packet.");
-            }
+            tr_logAddNamedDbg("UDP", "Couldn't parse UDP tracker packet.");
         }
-        else
+    }
+    else
+    {
+        if (tr_sessionIsUTPEnabled(session))
         {
-            if (tr_sessionIsUTPEnabled(session))
+            if (tr_utpPacket(buf, buflen, from, fromlen, session) == 0)
             {
-                rc = tr_utpPacket(buf, rc, (struct sockaddr*)&from, fromlen, session);
-
-                if (rc == 0)
-                {
-                    tr_logAddNamedDbg("UDP", "Unexpected UDP packet");
-                }
+                tr_logAddNamedDbg("UDP", "Unexpected UDP packet");
             }
         }
     }
 }
 
+/* If a socket's send buffer filled up, the rest of the batch
+   is still queued. Send it once the socket is writable again. */
+static void schedule_retry(tr_session* ss)
+{
+    if (ss->udp_write_event != nullptr && ss->udp_batch->isQueued(ss->udp_socket))
+    {
+        event_add(ss->udp_write_event, nullptr);
+    }
+
+    if (ss->udp6_write_event != nullptr && ss->udp_batch->isQueued(ss->udp6_socket))
+    {
+        event_add(ss->udp6_write_event, nullptr);
+    }
+}
+
+static void flush_batch(tr_session* ss)
+{
+    ss->udp_batch->flush();
+    schedule_retry(ss);
+}
+
+static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
+{
+    TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
+    TR_ASSERT(type == EV_READ);
+
+    auto* session = static_cast<tr_session*>(vsession);
+
+    session->udp_batch->receive(s, handle_packet, session);
+
+    /* send the replies to everything we just read, e.g. uTP acks, together */
+    flush_batch(session);
+}
+
+static void flush_callback(evutil_socket_t /*s*/, short /*type*/, void* vsession)
+{
+    flush_batch(static_cast<tr_session*>(vsession));
+}
+
+static void write_callback(evutil_socket_t /*s*/, short /*type*/, void* vsession)
+{
+    auto* const ss = static_cast<tr_session*>(vsession);
+    auto const n_queued = ss->udp_batch->size();
+
+    ss->udp_batch->flush();
+
+    if (!ss->udp_batch->empty() && ss->udp_batch->size() == n_queued)
+    {
+        /* writable, but still nothing went out, e.g. ENOBUFS from a full
+           device queue. Wait a moment instead of spinning on it. */
+        auto constexpr RetryDelay = timeval{ 0, 10000 };
+        event_add(ss->udp_flush_event, &RetryDelay);
+        return;
+    }
+
+    schedule_retry(ss);
+}
+
+void tr_udpSendTo(tr_session* ss, tr_socket_t sock, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
+{
+    /* the DHT's bootstrap thread sends too, but the batch belongs to the event thread */
+    if (ss->udp_batch == nullptr || !tr_amInEventThread(ss))
+    {
+        (void)sendto(sock, static_cast<char const*>(buf), buflen, 0, to, tolen);
+        return;
+    }
+
+    /* the first datagram in a batch schedules the flush, so that
+       everything queued in this event loop iteration goes out together */
+    if (ss->udp_flush_event != nullptr && event_pending(ss->udp_flush_event, EV_TIMEOUT, nullptr) == 0)
+    {
+        event_active(ss->udp_flush_event, EV_TIMEOUT, 0);
+    }
+
+    ss->udp_batch->send(sock, buf, buflen, to, tolen);
+}
+
 void tr_udpInit(tr_session* ss)
 {
     TR_ASSERT(ss->udp_socket == TR_BAD_SOCKET);
@@ -322,6 +389,9 @@ void tr_udpInit(tr_session* ss)
         return;
     }
 
+    ss->udp_batch = new tr_udp_batch{};
+    ss->udp_flush_event = event_new(ss->event_base, TR_BAD_SOCKET, 0, flush_callback, ss);
+
     ss->udp_socket = socket(PF_INET, SOCK_DGRAM, 0);
 
     if (ss->udp_socket == TR_BAD_SOCKET)
@@ -351,9 +421,13 @@ void tr_udpInit(tr_session* ss)
         }
         else
         {
+            /* the batched reads and writes mustn't block */
+            (void)evutil_make_socket_nonblocking(ss->udp_socket);
+
             ss->udp_event = event_new(ss->event_base, ss->udp_socket, EV_READ | EV_PERSIST, event_callback, ss);
+            ss->udp_write_event = event_new(ss->event_base, ss->udp_socket, EV_WRITE, write_callback, ss);
 
-            if (ss->udp_event == nullptr)
+            if (ss->udp_event == nullptr || ss->udp_write_event == nullptr)
             {
                 tr_logAddNamedError("UDP", "Couldn't allocate IPv4 event");
             }
@@ -370,8 +444,9 @@ void tr_udpInit(tr_session* ss)
     if (ss->udp6_socket != TR_BAD_SOCKET)
     {
         ss->udp6_event = event_new(ss->event_base, ss->udp6_socket, EV_READ | EV_PERSIST, event_callback, ss);
+        ss->udp6_write_event = event_new(ss->event_base, ss->udp6_socket, EV_WRITE, write_callback, ss);
 
-        if (ss->udp6_event == nullptr)
+        if (ss->udp6_event == nullptr || ss->udp6_write_event == nullptr)
         {
             tr_logAddNamedError("UDP", "Couldn't allocate IPv6 event");
         }
@@ -401,6 +476,29 @@ void tr_udpUninit(tr_session* ss)
 {
     tr_dhtUninit(ss);
 
+    if (ss->udp_batch != nullptr)
+    {
+        ss->udp_batch->flush();
+    }
+
+    if (ss->udp_flush_event != nullptr)
+    {
+        event_free(ss->udp_flush_event);
+        ss->udp_flush_event = nullptr;
+    }
+
+    if (ss->udp_write_event != nullptr)
+    {
+        event_free(ss->udp_write_event);
+        ss->udp_write_event = nullptr;
+    }
+
+    if (ss->udp6_write_event != nullptr)
+    {
+        event_free(ss->udp6_write_event);
+        ss->udp6_write_event = nullptr;
+    }
+
     if (ss->udp_socket != TR_BAD_SOCKET)
     {
         tr_netCloseSocket(ss->udp_socket);
@@ -430,4 +528,7 @@ void tr_udpUninit(tr_session* ss)
         free(ss->udp6_bound);
         ss->udp6_bound = nullptr;
     }
+
+    delete ss->udp_batch;
+    ss->udp_batch = nullptr;
 }
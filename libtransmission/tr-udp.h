@@ -32,4 +32,10 @@ void tr_udpUninit(tr_session*);
 void tr_udpSetSocketBuffers(tr_session*);
 void tr_udpSetSocketTOS(tr_session*);
 
+/* Queues a datagram to be sent on `sock` with the next batch.
+   The batch is sent at the end of the current event loop iteration,
+   or as soon as the socket is writable if its send buffer is full.
+   Used by uTP, the DHT, and UDP trackers. */
+void tr_udpSendTo(tr_session*, tr_socket_t sock, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
 bool tau_handle_message(tr_session* session, uint8_t const* msg, size_t msglen);
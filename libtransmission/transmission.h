@@ -463,9 +463,26 @@ void tr_sessionSetUTPEnabled(tr_session* session, bool);
 bool tr_sessionIsLPDEnabled(tr_session const* session);
 void tr_sessionSetLPDEnabled(tr_session* session, bool enabled);
 
+/** @brief Set whether LPD announces list several torrents per datagram. On by default.
+           Transmission 3.00 and older only hear the first, so turn it off if they're on the LAN. */
+void tr_sessionSetLPDPackAnnounces(tr_session* session, bool pack);
+bool tr_sessionGetLPDPackAnnounces(tr_session const* session);
+
 void tr_sessionSetCacheLimit_MB(tr_session* session, int mb);
 int tr_sessionGetCacheLimit_MB(tr_session const* session);
 
+/** @brief Set how much memory the seeding read cache may use. 0 disables it. */
+void tr_sessionSetReadCacheLimit_MB(tr_session* session, int mb);
+int tr_sessionGetReadCacheLimit_MB(tr_session const* session);
+
+/** @brief Set how fast idle torrents' unchecked pieces are checked in the background. 0 disables it. */
+void tr_sessionSetScrubSpeedLimit_KBps(tr_session* session, unsigned int KBps);
+unsigned int tr_sessionGetScrubSpeedLimit_KBps(tr_session const* session);
+
+/** @brief Set whether .resume files are fsync()ed before they replace the old ones. */
+void tr_sessionSetResumeFsync(tr_session* session, bool fsync);
+bool tr_sessionGetResumeFsync(tr_session const* session);
+
 tr_encryption_mode tr_sessionGetEncryption(tr_session* session);
 void tr_sessionSetEncryption(tr_session* session, tr_encryption_mode mode);
 
@@ -601,6 +618,15 @@ int tr_sessionGetAntiBruteForceThreshold(tr_session const*);
 void tr_sessionSetAntiBruteForceEnabled(tr_session*, bool enabled);
 bool tr_sessionGetAntiBruteForceEnabled(tr_session const*);
 
+/**
+ * Record latency histograms for the event loop and its busiest callbacks,
+ * plus counters for cache and disk I/O. They're reported by the
+ * "session-metrics" RPC method and, in Prometheus' text format,
+ * at the RPC server's "metrics" URL. Off by default.
+ */
+void tr_sessionSetMetricsEnabled(tr_session*, bool enabled);
+bool tr_sessionGetMetricsEnabled(tr_session const*);
+
 /**
 **/
 
@@ -738,6 +764,17 @@ enum tr_log_level
 
 void tr_logSetLevel(tr_log_level);
 
+enum tr_log_format
+{
+    TR_LOG_FORMAT_TEXT = 0,
+    /* one JSON object per line, for log collectors.
+     * Can also be chosen by setting TR_LOG_FORMAT=json in the environment. */
+    TR_LOG_FORMAT_JSON = 1
+};
+
+void tr_logSetFormat(tr_log_format);
+tr_log_format tr_logGetFormat(void);
+
 struct tr_log_message
 {
     /* TR_LOG_ERROR, TR_LOG_INFO, or TR_LOG_DEBUG */
@@ -806,7 +843,7 @@ char const* tr_blocklistGetURL(tr_session const*);
 
 /** @brief the file in the $config/blocklists/ directory that's
            used by tr_blocklistSetContent() and "blocklist-update" */
-#define DEFAULT_BLOCKLIST_FILENAME "blocklist.bin"
+#define DEFAULT_BLOCKLIST_FILENAME "blocklist.bin2"
 
 /** @} */
 
@@ -1045,6 +1082,12 @@ enum
  * if move_from_previous_location is `true', the torrent's incompleteDir
  * will be clobberred s.t. additional files being added will be saved
  * to the torrent's downloadDir.
+ *
+ * Moving is done in the background. The torrent keeps using the files in
+ * their old location until they've all been copied, and setme_progress is
+ * updated as they are. setme_state becomes TR_LOC_DONE when the torrent has
+ * switched over to the new location, or TR_LOC_ERROR if the move failed or
+ * was cancelled with tr_torrentCancelSetLocation().
  */
 void tr_torrentSetLocation(
     tr_torrent* torrent,
@@ -1053,6 +1096,14 @@ void tr_torrentSetLocation(
     double volatile* setme_progress,
     int volatile* setme_state);
 
+/**
+ * @brief Stop moving a torrent's local data.
+ *
+ * The files stay in their old location and any copies that have been
+ * made are removed. Does nothing if the torrent's data isn't being moved.
+ */
+void tr_torrentCancelSetLocation(tr_torrent* torrent);
+
 uint64_t tr_torrentGetBytesLeftToAllocate(tr_torrent const* torrent);
 
 /**
@@ -1149,6 +1200,22 @@ uint16_t tr_torrentGetIdleLimit(tr_torrent const* tor);
 
 bool tr_torrentGetSeedIdle(tr_torrent const*, uint16_t* minutes);
 
+/****
+*****  Choking
+****/
+
+enum tr_choke_algorithm
+{
+    /* unchoke the peers that give us the best rates, plus an optimistic unchoke */
+    TR_CHOKE_TIT_FOR_TAT = 0,
+    /* when seeding, give every interested peer a turn at an upload slot */
+    TR_CHOKE_ROUND_ROBIN = 1
+};
+
+void tr_torrentSetChokeAlgorithm(tr_torrent* tor, tr_choke_algorithm algorithm);
+
+tr_choke_algorithm tr_torrentGetChokeAlgorithm(tr_torrent const* tor);
+
 /****
 *****  Peer Limits
 ****/
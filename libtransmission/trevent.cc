@@ -166,6 +166,7 @@ struct tr_run_data
 {
     void (*func)(void*);
     void* user_data;
+    uint64_t queued_usec; /* for tr_metrics; zero when metrics are off */
 };
 
 #define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
@@ -197,7 +198,15 @@ static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
 
             if (!eh->die && ngot == (ev_ssize_t)nwant)
             {
+                auto& metrics = eh->session->metrics;
+
+                if (data.queued_usec != 0)
+                {
+                    metrics.record(tr_metrics::Timer::EventQueueWait, tr_metrics::nowUsec() - data.queued_usec);
+                }
+
                 dbgmsg("invoking function in libevent thread");
+                auto const timer = metrics.time(tr_metrics::Timer::RunInEventThread);
                 (*data.func)(data.user_data);
             }
 
@@ -345,6 +354,7 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
 
         data.func = func;
         data.user_data = user_data;
+        data.queued_usec = session->metrics.isEnabled() ? tr_metrics::nowUsec() : 0;
         ev_ssize_t const res_2 = pipewrite(fd, &data, sizeof(data));
 
         if (res_1 == -1 || res_2 == -1)
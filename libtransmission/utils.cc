@@ -378,7 +378,7 @@ bool tr_loadFile(std::vector<char>& setme, char const* path, tr_error** error)
     return true;
 }
 
-bool tr_saveFile(char const* filename_in, std::string_view contents, tr_error** error)
+bool tr_saveFile(char const* filename_in, std::string_view contents, tr_error** error, bool fsync)
 {
     auto filename = std::string{ filename_in };
 
@@ -412,6 +412,12 @@ bool tr_saveFile(char const* filename_in, std::string_view contents, tr_error**
         contents.remove_prefix(n_written);
     }
 
+    // Make sure a crash right after the rename can't leave an empty file behind
+    if (ok && fsync)
+    {
+        ok = tr_sys_file_flush(fd, error);
+    }
+
     // If we saved it to disk successfully, move it from '.tmp' to the correct filename
     if (!tr_sys_file_close(fd, error) || !ok || !tr_sys_path_rename(tmp.c_str(), filename.c_str(), error))
     {
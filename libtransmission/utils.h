@@ -81,7 +81,11 @@ uint8_t* tr_loadFile(char const* filename, size_t* size, struct tr_error** error
 
 bool tr_loadFile(std::vector<char>& setme, char const* filename, tr_error** error = nullptr);
 
-bool tr_saveFile(char const* filename_in, std::string_view contents, tr_error** error = nullptr);
+/**
+ * @brief Atomically replaces a file's contents by writing a temporary and renaming it into place.
+ * If `fsync` is true, the temporary is flushed to disk before the rename.
+ */
+bool tr_saveFile(char const* filename_in, std::string_view contents, tr_error** error = nullptr, bool fsync = false);
 
 /** @brief build a filename from a series of elements using the
            platform's correct directory separator. */
@@ -8,7 +8,6 @@
 
 #include <cstdlib>
 #include <cctype> /* isdigit() */
-#include <deque>
 #include <cerrno>
 #include <cstdlib> /* strtoul() */
 #include <cstring> /* strlen(), memchr() */
@@ -119,47 +118,28 @@ std::optional<std::string_view> tr_bencParseStr(std::string_view* benc)
     return string;
 }
 
-static tr_variant* get_node(std::deque<tr_variant*>& stack, std::optional<tr_quark>& dict_key, tr_variant* top, int* err)
-{
-    tr_variant* node = nullptr;
-
-    if (std::empty(stack))
-    {
-        node = top;
-    }
-    else
-    {
-        auto* parent = stack.back();
-
-        if (tr_variantIsList(parent))
-        {
-            node = tr_variantListAdd(parent);
-        }
-        else if (dict_key && tr_variantIsDict(parent))
-        {
-            node = tr_variantDictAdd(parent, *dict_key);
-            dict_key.reset();
-        }
-        else
-        {
-            *err = EILSEQ;
-        }
-    }
-
-    return node;
-}
-
 /**
  * This function's previous recursive implementation was
  * easier to read, but was vulnerable to a smash-stacking
  * attack via maliciously-crafted bencoded data. (#667)
  */
-int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc, char const** setme_end)
+int tr_variantParseBenc(
+    tr_variant& top,
+    int parse_opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_quark span_key,
+    std::string_view* setme_span,
+    tr_variant_arena* arena)
 {
     TR_ASSERT((parse_opts & TR_VARIANT_PARSE_BENC) != 0);
 
-    auto stack = std::deque<tr_variant*>{};
-    auto key = std::optional<tr_quark>{};
+    auto stack = VariantParseStack{ arena };
+    auto const inplace = (parse_opts & TR_VARIANT_PARSE_INPLACE) != 0;
+
+    // where the top-level dict's `span_key` value begins and ends
+    char const* span_begin = nullptr;
+    char const* span_end = nullptr;
 
     tr_variantInit(&top, 0);
 
@@ -176,6 +156,11 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
             break;
         }
 
+        if (setme_span != nullptr && span_begin == nullptr && stack.depth() == 1 && stack.key() == span_key)
+        {
+            span_begin = std::data(benc);
+        }
+
         switch (benc.front())
         {
         case 'i': // int
@@ -183,44 +168,45 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
                 auto const value = tr_bencParseInt(&benc);
                 if (!value)
                 {
+                    err = EILSEQ;
                     break;
                 }
 
-                if (tr_variant* const v = get_node(stack, key, &top, &err); v != nullptr)
+                if (tr_variant* const v = stack.add(); v != nullptr)
                 {
                     tr_variantInitInt(v, *value);
                 }
+                else
+                {
+                    err = EILSEQ;
+                }
                 break;
             }
         case 'l': // list
             benc.remove_prefix(1);
 
-            if (tr_variant* const v = get_node(stack, key, &top, &err); v != nullptr)
+            if (!stack.push(TR_VARIANT_TYPE_LIST))
             {
-                tr_variantInitList(v, 0);
-                stack.push_back(v);
+                err = EILSEQ;
             }
             break;
 
         case 'd': // dict
             benc.remove_prefix(1);
 
-            if (tr_variant* const v = get_node(stack, key, &top, &err); v != nullptr)
+            if (!stack.push(TR_VARIANT_TYPE_DICT))
             {
-                tr_variantInitDict(v, 0);
-                stack.push_back(v);
+                err = EILSEQ;
             }
             break;
+
         case 'e': // end of list or dict
             benc.remove_prefix(1);
 
-            if (std::empty(stack) || key)
+            if (!stack.pop())
             {
                 err = EILSEQ;
-                break;
             }
-
-            stack.pop_back();
             break;
 
         case '0':
@@ -237,27 +223,17 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
                 auto const sv = tr_bencParseStr(&benc);
                 if (!sv)
                 {
+                    err = EILSEQ;
                     break;
                 }
 
-                if (!key && !std::empty(stack) && tr_variantIsDict(stack.back()))
+                if (stack.inDict() && !stack.key())
                 {
-                    key = tr_quark_new(*sv);
+                    stack.setKey(tr_quark_new(*sv));
                 }
-                else
+                else if (!stack.addStr(*sv, inplace))
                 {
-                    tr_variant* const v = get_node(stack, key, &top, &err);
-                    if (v != nullptr)
-                    {
-                        if ((parse_opts & TR_VARIANT_PARSE_INPLACE) != 0)
-                        {
-                            tr_variantInitStrView(v, *sv);
-                        }
-                        else
-                        {
-                            tr_variantInitStr(v, *sv);
-                        }
-                    }
+                    err = EILSEQ;
                 }
                 break;
             }
@@ -266,13 +242,19 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
             break;
         }
 
-        if (std::empty(stack))
+        // the value ends when we're back in the top-level dict
+        if (span_begin != nullptr && span_end == nullptr && stack.depth() == 1)
+        {
+            span_end = std::data(benc);
+        }
+
+        if (stack.depth() == 0)
         {
             break;
         }
     }
 
-    if (err == 0 && (top.type == 0 || !std::empty(stack)))
+    if (err == 0 && !stack.finish(top))
     {
         err = EILSEQ;
     }
@@ -283,11 +265,12 @@ int tr_variantParseBenc(tr_variant& top, int parse_opts, std::string_view benc,
         {
             *setme_end = std::data(benc);
         }
-    }
-    else if (top.type != 0)
-    {
-        tr_variantFree(&top);
-        tr_variantInit(&top, 0);
+
+        if (setme_span != nullptr)
+        {
+            *setme_span = span_end != nullptr ? std::string_view{ span_begin, size_t(span_end - span_begin) } :
+                                                std::string_view{};
+        }
     }
 
     return err;
@@ -14,6 +14,7 @@
 
 #include <optional>
 #include <string_view>
+#include <vector>
 
 #include "transmission.h"
 
@@ -40,12 +41,103 @@ void tr_variantToBufBenc(tr_variant const* top, struct evbuffer* buf);
 
 void tr_variantInit(tr_variant* v, char type);
 
+/**
+ * Builds a parse's variants from the bottom up. A container's children
+ * are collected here until it's closed, then moved into one array sized
+ * to fit, which is taken from the arena or, if there isn't one, the heap.
+ * A closed dict's children are sorted by key so that lookups can bisect.
+ */
+class VariantParseStack
+{
+public:
+    explicit VariantParseStack(tr_variant_arena* arena)
+        : arena_{ arena }
+    {
+    }
+
+    ~VariantParseStack();
+
+    VariantParseStack(VariantParseStack const&) = delete;
+    VariantParseStack& operator=(VariantParseStack const&) = delete;
+
+    // the number of open containers
+    [[nodiscard]] size_t depth() const
+    {
+        return std::size(frames_);
+    }
+
+    [[nodiscard]] bool inDict() const
+    {
+        return !std::empty(frames_) && frames_.back().type == TR_VARIANT_TYPE_DICT;
+    }
+
+    // the key for the innermost dict's next child, if it's been set
+    [[nodiscard]] std::optional<tr_quark> key() const
+    {
+        return std::empty(frames_) ? std::nullopt : frames_.back().key;
+    }
+
+    // the key for the next child of the innermost dict
+    void setKey(tr_quark key)
+    {
+        frames_.back().key = key;
+    }
+
+    // Returns a node for the next value to be initialized into,
+    // or nullptr if it's in a dict that hasn't been given its key.
+    // The node is only valid until the next call.
+    [[nodiscard]] tr_variant* add();
+
+    // Like add() + tr_variantInitStr(), but copies long strings into
+    // the arena. If `inplace` is true, `str` is referenced, not copied.
+    bool addStr(std::string_view str, bool inplace);
+
+    // opens a TR_VARIANT_TYPE_LIST or TR_VARIANT_TYPE_DICT container
+    bool push(char type);
+
+    // closes the innermost container
+    bool pop();
+
+    // Moves the finished top-level value into `setme`.
+    // Fails if there isn't one or if a container is still open.
+    bool finish(tr_variant& setme);
+
+private:
+    struct Frame
+    {
+        char type;
+        tr_quark key_in_parent;
+        size_t first_child;
+        std::optional<tr_quark> key;
+    };
+
+    [[nodiscard]] std::optional<tr_quark> takeKey();
+
+    tr_variant_arena* const arena_;
+    std::vector<Frame> frames_;
+    std::vector<tr_variant> nodes_;
+};
+
 /** @brief Private function that's exposed here only for unit tests */
 std::optional<int64_t> tr_bencParseInt(std::string_view* benc_inout);
 
 /** @brief Private function that's exposed here only for unit tests */
 std::optional<std::string_view> tr_bencParseStr(std::string_view* benc_inout);
 
-int tr_variantParseBenc(tr_variant& setme, int opts, std::string_view benc, char const** setme_end);
+/* If `setme_span` isn't null, it's set to the bencoded text of the
+ * top-level dict's `span_key` value, or to an empty view if there isn't one */
+int tr_variantParseBenc(
+    tr_variant& setme,
+    int opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_quark span_key = TR_KEY_NONE,
+    std::string_view* setme_span = nullptr,
+    tr_variant_arena* arena = nullptr);
 
-int tr_variantParseJson(tr_variant& setme, int opts, std::string_view benc, char const** setme_end);
+int tr_variantParseJson(
+    tr_variant& setme,
+    int opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_variant_arena* arena = nullptr);
@@ -13,6 +13,7 @@
 #include <cmath> /* fabs() */
 #include <cstdio>
 #include <cstring>
+#include <string>
 
 #include <utf8.h>
 #include <event2/buffer.h> /* evbuffer_add() */
@@ -35,41 +36,28 @@ using namespace std::literals;
 
 struct json_wrapper_data
 {
-    bool has_content;
-    std::string_view key;
-    evbuffer* keybuf;
-    evbuffer* strbuf;
-    int error;
-    std::deque<tr_variant*> stack;
-    tr_variant* top;
-    int parse_opts;
-
-    /* A very common pattern is for a container's children to be similar,
-     * e.g. they may all be objects with the same set of keys. So when
-     * a container is popped off the stack, remember its size to use as
-     * a preallocation heuristic for the next container at that depth. */
-    std::array<size_t, MAX_DEPTH> preallocGuess;
+    explicit json_wrapper_data(tr_variant_arena* arena)
+        : stack{ arena }
+    {
+    }
+
+    bool has_content = false;
+    int error = 0;
+    int parse_opts = 0;
+    VariantParseStack stack;
+
+    // scratch space for unescaping strings
+    std::string strbuf;
 };
 
 static tr_variant* get_node(struct jsonsl_st* jsn)
 {
     auto* data = static_cast<struct json_wrapper_data*>(jsn->data);
 
-    auto* parent = std::empty(data->stack) ? nullptr : data->stack.back();
-
-    tr_variant* node = nullptr;
-    if (parent == nullptr)
-    {
-        node = data->top;
-    }
-    else if (tr_variantIsList(parent))
-    {
-        node = tr_variantListAdd(parent);
-    }
-    else if (tr_variantIsDict(parent) && !std::empty(data->key))
+    auto* const node = data->stack.add();
+    if (node == nullptr)
     {
-        node = tr_variantDictAdd(parent, tr_quark_new(data->key));
-        data->key = ""sv;
+        data->error = EILSEQ;
     }
 
     return node;
@@ -101,18 +89,10 @@ static void action_callback_PUSH(
     if ((state->type == JSONSL_T_LIST) || (state->type == JSONSL_T_OBJECT))
     {
         data->has_content = true;
-        tr_variant* node = get_node(jsn);
-        data->stack.push_back(node);
 
-        int const depth = std::size(data->stack);
-        size_t const n = depth < MAX_DEPTH ? data->preallocGuess[depth] : 0;
-        if (state->type == JSONSL_T_LIST)
+        if (!data->stack.push(state->type == JSONSL_T_LIST ? TR_VARIANT_TYPE_LIST : TR_VARIANT_TYPE_DICT))
         {
-            tr_variantInitList(node, n);
-        }
-        else
-        {
-            tr_variantInitDict(node, n);
+            data->error = EILSEQ;
         }
     }
 }
@@ -155,11 +135,11 @@ static bool decode_hex_string(char const* in, unsigned int* setme)
     return true;
 }
 
-static std::string_view extract_escaped_string(char const* in, size_t in_len, struct evbuffer* buf)
+static std::string_view extract_escaped_string(char const* in, size_t in_len, std::string& buf)
 {
     char const* const in_end = in + in_len;
 
-    evbuffer_drain(buf, evbuffer_get_length(buf));
+    buf.clear();
 
     while (in < in_end)
     {
@@ -170,49 +150,49 @@ static std::string_view extract_escaped_string(char const* in, size_t in_len, st
             switch (in[1])
             {
             case 'b':
-                evbuffer_add(buf, "\b", 1);
+                buf += '\b';
                 in += 2;
                 unescaped = true;
                 break;
 
             case 'f':
-                evbuffer_add(buf, "\f", 1);
+                buf += '\f';
                 in += 2;
                 unescaped = true;
                 break;
 
             case 'n':
-                evbuffer_add(buf, "\n", 1);
+                buf += '\n';
                 in += 2;
                 unescaped = true;
                 break;
 
             case 'r':
-                evbuffer_add(buf, "\r", 1);
+                buf += '\r';
                 in += 2;
                 unescaped = true;
                 break;
 
             case 't':
-                evbuffer_add(buf, "\t", 1);
+                buf += '\t';
                 in += 2;
                 unescaped = true;
                 break;
 
             case '/':
-                evbuffer_add(buf, "/", 1);
+                buf += '/';
                 in += 2;
                 unescaped = true;
                 break;
 
             case '"':
-                evbuffer_add(buf, "\"", 1);
+                buf += '"';
                 in += 2;
                 unescaped = true;
                 break;
 
             case '\\':
-                evbuffer_add(buf, "\\", 1);
+                buf += '\\';
                 in += 2;
                 unescaped = true;
                 break;
@@ -229,11 +209,11 @@ static std::string_view extract_escaped_string(char const* in, size_t in_len, st
                             {
                                 auto buf8 = std::array<char, 8>{};
                                 auto const it = utf8::append(val, std::data(buf8));
-                                evbuffer_add(buf, std::data(buf8), it - std::data(buf8));
+                                buf.append(std::data(buf8), it - std::data(buf8));
                             }
                             catch (utf8::exception const&)
                             { // invalid codepoint
-                                evbuffer_add(buf, "?", 1);
+                                buf += '?';
                             }
                             unescaped = true;
                             in += 6;
@@ -246,15 +226,15 @@ static std::string_view extract_escaped_string(char const* in, size_t in_len, st
 
         if (!unescaped)
         {
-            evbuffer_add(buf, in, 1);
+            buf += *in;
             ++in;
         }
     }
 
-    return { (char const*)evbuffer_pullup(buf, -1), evbuffer_get_length(buf) };
+    return buf;
 }
 
-static std::pair<std::string_view, bool> extract_string(jsonsl_t jsn, struct jsonsl_state_st* state, struct evbuffer* buf)
+static std::pair<std::string_view, bool> extract_string(jsonsl_t jsn, struct jsonsl_state_st* state, std::string& buf)
 {
     // figure out where the string is
     char const* in_begin = jsn->base + state->pos_begin;
@@ -285,65 +265,82 @@ static void action_callback_POP(
     if (state->type == JSONSL_T_STRING)
     {
         auto const [str, inplace] = extract_string(jsn, state, data->strbuf);
-        if (inplace && ((data->parse_opts & TR_VARIANT_PARSE_INPLACE) != 0))
+        if (!data->stack.addStr(str, inplace && ((data->parse_opts & TR_VARIANT_PARSE_INPLACE) != 0)))
         {
-            tr_variantInitStrView(get_node(jsn), str);
-        }
-        else
-        {
-            tr_variantInitStr(get_node(jsn), str);
+            data->error = EILSEQ;
         }
         data->has_content = true;
     }
     else if (state->type == JSONSL_T_HKEY)
     {
         data->has_content = true;
-        auto const [key, inplace] = extract_string(jsn, state, data->keybuf);
-        data->key = key;
+        auto const [key, inplace] = extract_string(jsn, state, data->strbuf);
+        if (data->stack.inDict())
+        {
+            data->stack.setKey(tr_quark_new(key));
+        }
+        else
+        {
+            data->error = EILSEQ;
+        }
     }
     else if (state->type == JSONSL_T_LIST || state->type == JSONSL_T_OBJECT)
     {
-        int const depth = std::size(data->stack);
-        auto* v = data->stack.back();
-        data->stack.pop_back();
-        if (depth < MAX_DEPTH)
+        if (!data->stack.pop())
         {
-            data->preallocGuess[depth] = v->val.l.count;
+            data->error = EILSEQ;
         }
     }
     else if (state->type == JSONSL_T_SPECIAL)
     {
+        auto constexpr Known = JSONSL_SPECIALf_NUMNOINT | JSONSL_SPECIALf_NUMERIC | JSONSL_SPECIALf_BOOLEAN |
+            JSONSL_SPECIALf_NULL;
+        if ((state->special_flags & Known) == 0)
+        {
+            return;
+        }
+
+        data->has_content = true;
+
+        tr_variant* const node = get_node(jsn);
+        if (node == nullptr)
+        {
+            return;
+        }
+
         if ((state->special_flags & JSONSL_SPECIALf_NUMNOINT) != 0)
         {
             char const* begin = jsn->base + state->pos_begin;
-            data->has_content = true;
-            tr_variantInitReal(get_node(jsn), strtod(begin, nullptr));
+            tr_variantInitReal(node, strtod(begin, nullptr));
         }
         else if ((state->special_flags & JSONSL_SPECIALf_NUMERIC) != 0)
         {
             char const* begin = jsn->base + state->pos_begin;
-            data->has_content = true;
-            tr_variantInitInt(get_node(jsn), std::strtoll(begin, nullptr, 10));
+            tr_variantInitInt(node, std::strtoll(begin, nullptr, 10));
         }
         else if ((state->special_flags & JSONSL_SPECIALf_BOOLEAN) != 0)
         {
-            bool const b = (state->special_flags & JSONSL_SPECIALf_TRUE) != 0;
-            data->has_content = true;
-            tr_variantInitBool(get_node(jsn), b);
+            tr_variantInitBool(node, (state->special_flags & JSONSL_SPECIALf_TRUE) != 0);
         }
-        else if ((state->special_flags & JSONSL_SPECIALf_NULL) != 0)
+        else
         {
-            data->has_content = true;
-            tr_variantInitQuark(get_node(jsn), TR_KEY_NONE);
+            tr_variantInitQuark(node, TR_KEY_NONE);
         }
     }
 }
 
-int tr_variantParseJson(tr_variant& setme, int parse_opts, std::string_view benc, char const** setme_end)
+int tr_variantParseJson(
+    tr_variant& setme,
+    int parse_opts,
+    std::string_view benc,
+    char const** setme_end,
+    tr_variant_arena* arena)
 {
     TR_ASSERT((parse_opts & TR_VARIANT_PARSE_JSON) != 0);
 
-    auto data = json_wrapper_data{};
+    auto data = json_wrapper_data{ arena };
+    data.parse_opts = parse_opts;
+    tr_variantInit(&setme, 0);
 
     jsonsl_t jsn = jsonsl_new(MAX_DEPTH);
     jsn->action_callback_PUSH = action_callback_PUSH;
@@ -352,16 +349,6 @@ int tr_variantParseJson(tr_variant& setme, int parse_opts, std::string_view benc
     jsn->data = &data;
     jsonsl_enable_all_callbacks(jsn);
 
-    data.error = 0;
-    data.has_content = false;
-    data.key = ""sv;
-    data.keybuf = evbuffer_new();
-    data.parse_opts = parse_opts;
-    data.preallocGuess = {};
-    data.stack = {};
-    data.strbuf = evbuffer_new();
-    data.top = &setme;
-
     /* parse it */
     jsonsl_feed(jsn, static_cast<jsonsl_char_t const*>(std::data(benc)), std::size(benc));
 
@@ -371,6 +358,11 @@ int tr_variantParseJson(tr_variant& setme, int parse_opts, std::string_view benc
         data.error = EINVAL;
     }
 
+    if (data.error == 0 && !data.stack.finish(setme))
+    {
+        data.error = EILSEQ;
+    }
+
     /* maybe set the end ptr */
     if (setme_end != nullptr)
     {
@@ -379,8 +371,6 @@ int tr_variantParseJson(tr_variant& setme, int parse_opts, std::string_view benc
 
     /* cleanup */
     int const error = data.error;
-    evbuffer_free(data.keybuf);
-    evbuffer_free(data.strbuf);
     jsonsl_destroy(jsn);
     return error;
 }
@@ -127,6 +127,7 @@ static bool tr_variantIsSomething(tr_variant const* v)
 void tr_variantInit(tr_variant* v, char type)
 {
     v->type = type;
+    v->flags = 0;
     memset(&v->val, 0, sizeof(v->val));
 }
 
@@ -227,14 +228,29 @@ static constexpr char const* getStr(tr_variant const* v)
 
 static int dictIndexOf(tr_variant const* dict, tr_quark const key)
 {
-    if (tr_variantIsDict(dict))
+    if (!tr_variantIsDict(dict))
     {
-        for (size_t i = 0; i < dict->val.l.count; ++i)
+        return -1;
+    }
+
+    auto const* const begin = dict->val.l.vals;
+    auto const* const end = begin + dict->val.l.count;
+
+    if ((dict->flags & TR_VARIANT_FLAG_SORTED) != 0)
+    {
+        auto const* const it = std::lower_bound(
+            begin,
+            end,
+            key,
+            [](tr_variant const& child, tr_quark const k) { return child.key < k; });
+        return it != end && it->key == key ? int(it - begin) : -1;
+    }
+
+    for (auto const* it = begin; it != end; ++it)
+    {
+        if (it->key == key)
         {
-            if (dict->val.l.vals[i].key == key)
-            {
-                return (int)i;
-            }
+            return int(it - begin);
         }
     }
 
@@ -515,7 +531,19 @@ static tr_variant* containerReserve(tr_variant* v, size_t count)
             n *= 2U;
         }
 
-        v->val.l.vals = tr_renew(tr_variant, v->val.l.vals, n);
+        if ((v->flags & TR_VARIANT_FLAG_ARENA) != 0)
+        {
+            // arena memory can't be grown, so move the children to the heap
+            auto* const vals = tr_new(tr_variant, n);
+            std::copy_n(v->val.l.vals, v->val.l.count, vals);
+            v->val.l.vals = vals;
+            v->flags &= ~TR_VARIANT_FLAG_ARENA;
+        }
+        else
+        {
+            v->val.l.vals = tr_renew(tr_variant, v->val.l.vals, n);
+        }
+
         v->val.l.alloc = n;
     }
 
@@ -532,6 +560,7 @@ void tr_variantListReserve(tr_variant* list, size_t count)
 void tr_variantInitDict(tr_variant* v, size_t reserve_count)
 {
     tr_variantInit(v, TR_VARIANT_TYPE_DICT);
+    v->flags |= TR_VARIANT_FLAG_SORTED;
     tr_variantDictReserve(v, reserve_count);
 }
 
@@ -621,6 +650,12 @@ tr_variant* tr_variantDictAdd(tr_variant* dict, tr_quark const key)
 {
     TR_ASSERT(tr_variantIsDict(dict));
 
+    // appending keeps the children sorted only if `key` sorts last
+    if (dict->val.l.count > 0 && key < dict->val.l.vals[dict->val.l.count - 1].key)
+    {
+        dict->flags &= ~TR_VARIANT_FLAG_SORTED;
+    }
+
     tr_variant* val = containerReserve(dict, 1);
     ++dict->val.l.count;
     val->key = key;
@@ -741,6 +776,7 @@ bool tr_variantDictRemove(tr_variant* dict, tr_quark const key)
         if (i != last)
         {
             dict->val.l.vals[i] = dict->val.l.vals[last];
+            dict->flags &= ~TR_VARIANT_FLAG_SORTED;
         }
 
         --dict->val.l.count;
@@ -751,6 +787,222 @@ bool tr_variantDictRemove(tr_variant* dict, tr_quark const key)
     return removed;
 }
 
+/***
+****  PARSING
+***/
+
+void* tr_variant_arena::alloc(size_t size, size_t align)
+{
+    TR_ASSERT(align != 0 && (align & (align - 1)) == 0);
+
+    if (!std::empty(blocks_))
+    {
+        auto const offset = (used_ + align - 1) & ~(align - 1);
+        if (offset + size <= blocks_.back().size)
+        {
+            used_ = offset + size;
+            return blocks_.back().data.get() + offset;
+        }
+
+        // Too big to share a block, so give it one of its own and keep
+        // carving up the current one. operator new[]'s alignment suffices.
+        if (size > block_size_ / 4)
+        {
+            auto block = Block{ std::unique_ptr<char[]>{ new char[size] }, size };
+            auto* const ret = block.data.get();
+            blocks_.insert(std::end(blocks_) - 1, std::move(block));
+            return ret;
+        }
+    }
+
+    auto const n = std::max(size, block_size_);
+    blocks_.push_back(Block{ std::unique_ptr<char[]>{ new char[n] }, n });
+    used_ = size;
+    return blocks_.back().data.get();
+}
+
+std::string_view tr_variant_arena::copy(std::string_view str)
+{
+    auto const len = std::size(str);
+    auto* const ret = static_cast<char*>(alloc(len + 1, 1));
+    std::copy_n(std::data(str), len, ret);
+    ret[len] = '\0';
+    return { ret, len };
+}
+
+void tr_variant_arena::reset()
+{
+    if (std::empty(blocks_))
+    {
+        return;
+    }
+
+    // keep the biggest block, since the next parse is probably similar
+    auto const biggest = std::max_element(
+        std::begin(blocks_),
+        std::end(blocks_),
+        [](Block const& a, Block const& b) { return a.size < b.size; });
+    std::iter_swap(std::begin(blocks_), biggest);
+    blocks_.resize(1);
+    used_ = 0;
+}
+
+size_t tr_variant_arena::capacity() const noexcept
+{
+    auto ret = size_t{};
+
+    for (auto const& block : blocks_)
+    {
+        ret += block.size;
+    }
+
+    return ret;
+}
+
+VariantParseStack::~VariantParseStack()
+{
+    // anything left here is from a parse that failed partway through
+    for (auto& node : nodes_)
+    {
+        tr_variantFree(&node);
+    }
+}
+
+std::optional<tr_quark> VariantParseStack::takeKey()
+{
+    if (std::empty(frames_) || frames_.back().type == TR_VARIANT_TYPE_LIST)
+    {
+        return TR_KEY_NONE;
+    }
+
+    auto& frame = frames_.back();
+    auto const key = frame.key;
+    frame.key.reset();
+    return key;
+}
+
+tr_variant* VariantParseStack::add()
+{
+    auto const key = takeKey();
+    if (!key)
+    {
+        return nullptr;
+    }
+
+    auto& node = nodes_.emplace_back();
+    node.key = *key;
+    return &node;
+}
+
+bool VariantParseStack::addStr(std::string_view str, bool inplace)
+{
+    auto* const node = add();
+    if (node == nullptr)
+    {
+        return false;
+    }
+
+    if (inplace)
+    {
+        tr_variantInitStrView(node, str);
+    }
+    else if (arena_ != nullptr && std::size(str) >= sizeof(node->val.s.str.buf))
+    {
+        tr_variantInitStrView(node, arena_->copy(str));
+    }
+    else
+    {
+        tr_variantInitStr(node, str);
+    }
+
+    return true;
+}
+
+bool VariantParseStack::push(char type)
+{
+    TR_ASSERT(type == TR_VARIANT_TYPE_LIST || type == TR_VARIANT_TYPE_DICT);
+
+    auto const key = takeKey();
+    if (!key)
+    {
+        return false;
+    }
+
+    frames_.push_back(Frame{ type, *key, std::size(nodes_), {} });
+    return true;
+}
+
+bool VariantParseStack::pop()
+{
+    if (std::empty(frames_) || frames_.back().key)
+    {
+        return false;
+    }
+
+    auto const frame = frames_.back();
+    frames_.pop_back();
+
+    auto const begin = std::begin(nodes_) + frame.first_child;
+    auto const end = std::end(nodes_);
+    auto const n = static_cast<size_t>(end - begin);
+
+    if (frame.type == TR_VARIANT_TYPE_DICT)
+    {
+        // stable, so that lookups still find the first of any duplicate keys.
+        // std::stable_sort() allocates a scratch buffer, so small dicts -- which
+        // is most of them, and benc ones arrive sorted -- are sorted in place.
+        static auto constexpr MaxInsertionSort = size_t{ 32 };
+        auto const key_less = [](tr_variant const& a, tr_variant const& b)
+        {
+            return a.key < b.key;
+        };
+
+        if (n > MaxInsertionSort)
+        {
+            std::stable_sort(begin, end, key_less);
+        }
+        else if (!std::is_sorted(begin, end, key_less))
+        {
+            for (auto it = begin + 1; it != end; ++it)
+            {
+                std::rotate(std::upper_bound(begin, it, *it, key_less), it, it + 1);
+            }
+        }
+    }
+
+    tr_variant* vals = nullptr;
+    if (n > 0)
+    {
+        vals = arena_ != nullptr ? arena_->allocVariants(n) : tr_new(tr_variant, n);
+        std::copy(begin, end, vals);
+    }
+
+    nodes_.erase(begin, end);
+
+    auto& node = nodes_.emplace_back();
+    node.type = frame.type;
+    node.key = frame.key_in_parent;
+    node.flags = (frame.type == TR_VARIANT_TYPE_DICT ? TR_VARIANT_FLAG_SORTED : 0) |
+        (arena_ != nullptr ? TR_VARIANT_FLAG_ARENA : 0);
+    node.val.l.alloc = n;
+    node.val.l.count = n;
+    node.val.l.vals = vals;
+    return true;
+}
+
+bool VariantParseStack::finish(tr_variant& setme)
+{
+    if (!std::empty(frames_) || std::empty(nodes_))
+    {
+        return false;
+    }
+
+    setme = nodes_.back();
+    setme.key = TR_KEY_NONE;
+    nodes_.pop_back();
+    return true;
+}
+
 /***
 ****  BENC WALKING
 ***/
@@ -990,7 +1242,10 @@ static void freeStringFunc(tr_variant const* v, void* /*user_data*/)
 
 static void freeContainerEndFunc(tr_variant const* v, void* /*user_data*/)
 {
-    tr_free(v->val.l.vals);
+    if ((v->flags & TR_VARIANT_FLAG_ARENA) == 0)
+    {
+        tr_free(v->val.l.vals);
+    }
 }
 
 static struct VariantWalkFuncs const freeWalkFuncs = {
@@ -1225,7 +1480,13 @@ int tr_variantToFile(tr_variant const* v, tr_variant_fmt fmt, char const* filena
 ****
 ***/
 
-bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char const** setme_end, tr_error** error)
+static bool variantFromBuf(
+    tr_variant* setme,
+    tr_variant_arena* arena,
+    int opts,
+    std::string_view buf,
+    char const** setme_end,
+    tr_error** error)
 {
     // supported formats: benc, json
     TR_ASSERT((opts & (TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_JSON)) != 0);
@@ -1234,8 +1495,9 @@ bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char c
     auto locale_ctx = locale_context{};
     use_numeric_locale(&locale_ctx, "C");
 
-    auto err = (opts & TR_VARIANT_PARSE_BENC) ? tr_variantParseBenc(*setme, opts, buf, setme_end) :
-                                                tr_variantParseJson(*setme, opts, buf, setme_end);
+    auto err = (opts & TR_VARIANT_PARSE_BENC) ?
+        tr_variantParseBenc(*setme, opts, buf, setme_end, TR_KEY_NONE, nullptr, arena) :
+        tr_variantParseJson(*setme, opts, buf, setme_end, arena);
 
     /* restore the previous locale */
     restore_locale(&locale_ctx);
@@ -1249,6 +1511,47 @@ bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char c
     return true;
 }
 
+bool tr_variantFromBuf(tr_variant* setme, int opts, std::string_view buf, char const** setme_end, tr_error** error)
+{
+    return variantFromBuf(setme, nullptr, opts, buf, setme_end, error);
+}
+
+bool tr_variantFromBuf(
+    tr_variant* setme,
+    tr_variant_arena& arena,
+    int opts,
+    std::string_view buf,
+    char const** setme_end,
+    tr_error** error)
+{
+    return variantFromBuf(setme, &arena, opts, buf, setme_end, error);
+}
+
+bool tr_variantFromBenc(
+    tr_variant* setme,
+    int opts,
+    std::string_view benc,
+    tr_quark span_key,
+    std::string_view* setme_span,
+    tr_error** error,
+    tr_variant_arena* arena)
+{
+    TR_ASSERT((opts & TR_VARIANT_PARSE_BENC) != 0);
+
+    auto locale_ctx = locale_context{};
+    use_numeric_locale(&locale_ctx, "C");
+    auto const err = tr_variantParseBenc(*setme, opts, benc, nullptr, span_key, setme_span, arena);
+    restore_locale(&locale_ctx);
+
+    if (err)
+    {
+        tr_error_set_literal(error, EILSEQ, "error parsing encoded data");
+        return false;
+    }
+
+    return true;
+}
+
 bool tr_variantFromFile(tr_variant* setme, tr_variant_parse_opts opts, char const* filename, tr_error** error)
 {
     // can't do inplace when this function is allocating & freeing the memory...
@@ -10,6 +10,9 @@
 
 #include <cstddef> // size_t
 #include <inttypes.h> // int64_t
+#include <memory>
+#include <string_view>
+#include <vector>
 
 #include "tr-macros.h"
 #include "quark.h"
@@ -65,6 +68,15 @@ enum
     TR_VARIANT_TYPE_REAL = 32
 };
 
+/* private tr_variant.flags bits */
+enum
+{
+    /* a dict whose children are sorted by key, so lookups can bisect */
+    TR_VARIANT_FLAG_SORTED = (1 << 0),
+    /* a container whose children are in a tr_variant_arena's memory */
+    TR_VARIANT_FLAG_ARENA = (1 << 1)
+};
+
 /* These are PRIVATE IMPLEMENTATION details that should not be touched.
  * I'll probably change them just to break your code! HA HA HA!
  * it's included in the header for inlining and composition */
@@ -72,6 +84,8 @@ struct tr_variant
 {
     char type = '\0';
 
+    uint8_t flags = 0;
+
     tr_quark key = TR_KEY_NONE;
 
     union
@@ -112,6 +126,63 @@ char* tr_variantToStr(tr_variant const* variant, tr_variant_fmt fmt, size_t* len
 
 struct evbuffer* tr_variantToBuf(tr_variant const* variant, tr_variant_fmt fmt);
 
+/**
+ * A bump allocator for parsing into. Every container and long string that
+ * a parse creates is carved out of a few big blocks, which are all freed
+ * at once when the arena is reset or destroyed, so the parsed variant must
+ * not outlive its arena.
+ *
+ * The variant can still be modified and tr_variantFree()d as usual:
+ * a container that has to grow is moved to the heap, and freeing skips
+ * anything that's still in the arena.
+ */
+class tr_variant_arena
+{
+public:
+    static auto constexpr DefaultBlockSize = size_t{ 64 * 1024 };
+
+    tr_variant_arena()
+        : tr_variant_arena{ DefaultBlockSize }
+    {
+    }
+
+    explicit tr_variant_arena(size_t block_size)
+        : block_size_{ block_size }
+    {
+    }
+
+    tr_variant_arena(tr_variant_arena const&) = delete;
+    tr_variant_arena& operator=(tr_variant_arena const&) = delete;
+
+    [[nodiscard]] void* alloc(size_t size, size_t align);
+
+    [[nodiscard]] tr_variant* allocVariants(size_t n)
+    {
+        return static_cast<tr_variant*>(alloc(sizeof(tr_variant) * n, alignof(tr_variant)));
+    }
+
+    // returns a zero-terminated copy of `str`
+    [[nodiscard]] std::string_view copy(std::string_view str);
+
+    // free everything that's been allocated, but keep a block to reuse
+    void reset();
+
+    // the total size of the blocks currently held
+    [[nodiscard]] size_t capacity() const noexcept;
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+    };
+
+    // the last block is the one being carved up
+    std::vector<Block> blocks_;
+    size_t used_ = 0;
+    size_t const block_size_;
+};
+
 enum tr_variant_parse_opts
 {
     TR_VARIANT_PARSE_BENC = (1 << 0),
@@ -129,6 +200,28 @@ bool tr_variantFromBuf(
     char const** setme_end = nullptr,
     tr_error** error = nullptr);
 
+/* Like tr_variantFromBuf(), but allocates from `arena` instead of the heap.
+ * This is a lot faster for big inputs like .torrent or resume files. */
+bool tr_variantFromBuf(
+    tr_variant* setme,
+    tr_variant_arena& arena,
+    int variant_parse_opts,
+    std::string_view buf,
+    char const** setme_end = nullptr,
+    tr_error** error = nullptr);
+
+/* Like tr_variantFromBuf() for bencoded text, but also sets `setme_span`
+ * to the bencoded text of the top-level dict's `span_key` value, e.g. the
+ * "info" dict of a .torrent file. It's empty if there's no such value. */
+bool tr_variantFromBenc(
+    tr_variant* setme,
+    int opts,
+    std::string_view benc,
+    tr_quark span_key,
+    std::string_view* setme_span,
+    tr_error** error = nullptr,
+    tr_variant_arena* arena = nullptr);
+
 constexpr bool tr_variantIsType(tr_variant const* b, int type)
 {
     return b != nullptr && b->type == type;
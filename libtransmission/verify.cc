@@ -9,17 +9,25 @@
 #include <algorithm>
 #include <cstdlib> /* free() */
 #include <cstring> /* memcmp() */
+#include <deque>
+#include <functional> // std::less
 #include <mutex>
 #include <set>
+#include <string>
+#include <tuple>
+#include <vector>
 
 #include "transmission.h"
 #include "completion.h"
 #include "crypto-utils.h"
 #include "file.h"
+#include "inout.h"
 #include "log.h"
+#include "session.h"
 #include "platform.h"
 #include "torrent.h"
 #include "tr-assert.h"
+#include "trevent.h"
 #include "utils.h" /* tr_malloc(), tr_free() */
 #include "verify.h"
 
@@ -49,6 +57,9 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
     tr_logAddTorDbg(tor, "%s", "verifying torrent...");
     tor->verify_progress = 0;
 
+    // find all the files up front instead of one at a time
+    tor->refreshFileLocations();
+
     while (!*stopFlag && piece < tor->info.pieceCount)
     {
         auto const file_length = tor->info.files[fileIndex].length;
@@ -185,6 +196,12 @@ struct verify_node
             return current_size < that.current_size ? -1 : 1;
         }
 
+        // verifyList is a set, so torrents that tie must still compare unequal
+        if (torrent != that.torrent)
+        {
+            return std::less<tr_torrent*>{}(torrent, that.torrent) ? -1 : 1;
+        }
+
         return 0;
     }
 
@@ -305,10 +322,417 @@ void tr_verifyRemove(tr_torrent* tor)
     verify_mutex_.unlock();
 }
 
-void tr_verifyClose(tr_session* /*session*/)
+/***
+****  Checking single pieces
+***/
+
+namespace
 {
-    auto const lock = std::lock_guard(verify_mutex_);
 
-    stopCurrent = true;
-    verifyList.clear();
+struct piece_span
+{
+    tr_file_index_t file_index;
+    std::string filename; // empty if the file wasn't found
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct piece_job
+{
+    tr_session* session;
+    int tor_id;
+    tr_piece_index_t piece;
+    tr_sha1_digest_t hash;
+    std::vector<piece_span> spans;
+    bool is_scrub;
+    bool pass;
+    bool readable; // false if a file couldn't be opened or was too short
+    int attempts;
+};
+
+// a piece that can't be read is looked for again this many times before giving up,
+// since its files may have been moved or renamed after the job was queued
+auto constexpr MaxPieceAttempts = 3;
+
+// how many pieces tr_verifyScrub() looks at per call, across all torrents
+auto constexpr MaxScrubPiecesExamined = size_t{ 4096 };
+
+using piece_key = std::tuple<tr_session const*, int, tr_piece_index_t>;
+
+// peers are waiting on the wanted pieces, so they're checked before scrubbed ones
+auto& wantedPieces{ *new std::deque<piece_job*>{} };
+auto& scrubPieces{ *new std::deque<piece_job*>{} };
+
+// every piece that's queued, being checked, or waiting for onPieceChecked()
+auto& queuedPieces{ *new std::set<piece_key>{} };
+
+piece_job const* currentPieceJob = nullptr;
+tr_thread* pieceThread = nullptr;
+uint64_t scrubCredit = 0;
+
+std::mutex piece_mutex_;
+
+void pieceThreadFunc(void* user_data);
+
+void checkPieceSpans(piece_job& job)
+{
+    auto sha = tr_sha1_init();
+    auto buffer = std::vector<uint8_t>(1024 * 128);
+
+    job.pass = false;
+    job.readable = false;
+
+    for (auto const& span : job.spans)
+    {
+        auto const fd = std::empty(span.filename) ? TR_BAD_SYS_FILE :
+                                                    tr_sys_file_open(span.filename.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+        if (fd == TR_BAD_SYS_FILE)
+        {
+            tr_sha1_final(sha, nullptr);
+            return;
+        }
+
+        auto offset = span.offset;
+        auto left = span.length;
+        while (left > 0)
+        {
+            auto numRead = uint64_t{};
+            auto const len = std::min(left, uint64_t{ std::size(buffer) });
+            if (!tr_sys_file_read_at(fd, std::data(buffer), len, offset, &numRead, nullptr) || numRead == 0)
+            {
+                break;
+            }
+
+            tr_sha1_update(sha, std::data(buffer), numRead);
+            offset += numRead;
+            left -= numRead;
+        }
+
+        // a peer is about to be sent a requested piece, so keep it in the page cache
+        if (job.is_scrub)
+        {
+            tr_sys_file_advise(fd, span.offset, span.length, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
+        }
+
+        tr_sys_file_close(fd, nullptr);
+
+        if (left > 0)
+        {
+            tr_sha1_final(sha, nullptr);
+            return;
+        }
+    }
+
+    auto const hash = tr_sha1_final(sha);
+    job.readable = true;
+    job.pass = hash && *hash == job.hash;
+}
+
+// find the piece's files in the event thread, since tr_torrent isn't thread-safe
+void findPieceSpans(tr_torrent const* tor, piece_job& job)
+{
+    job.spans.clear();
+
+    auto file_index = tr_file_index_t{};
+    auto file_offset = uint64_t{};
+    tr_ioFindFileLocation(tor, job.piece, 0, &file_index, &file_offset);
+
+    auto filename = std::string{};
+    auto left = uint64_t{ tor->pieceSize(job.piece) };
+    for (auto const n_files = tor->fileCount(); left > 0 && file_index < n_files; ++file_index, file_offset = 0)
+    {
+        auto const length = std::min(left, tor->info.files[file_index].length - file_offset);
+        if (length == 0)
+        {
+            continue;
+        }
+
+        auto const found = tor->findFile(filename, file_index);
+        job.spans.push_back({ file_index, found ? filename : std::string{}, file_offset, length });
+        left -= length;
+    }
+}
+
+// assumes piece_mutex_ is locked
+void pushPieceJob(piece_job* job)
+{
+    (job->is_scrub ? scrubPieces : wantedPieces).push_back(job);
+
+    if (pieceThread == nullptr)
+    {
+        pieceThread = tr_threadNew(pieceThreadFunc, nullptr);
+    }
+}
+
+// The piece's files may have been moved or renamed since its job was queued.
+// Look for them again and put the job back in line. Returns false if it's given up.
+bool retryPieceJob(tr_torrent const* tor, piece_job* job)
+{
+    if (++job->attempts >= MaxPieceAttempts)
+    {
+        return false;
+    }
+
+    for (auto const& span : job->spans)
+    {
+        tor->invalidateFileLocation(span.file_index);
+    }
+
+    findPieceSpans(tor, *job);
+
+    auto const lock = std::lock_guard(piece_mutex_);
+
+    if (tor->session->isClosing())
+    {
+        return false;
+    }
+
+    pushPieceJob(job);
+    return true;
+}
+
+void onPieceChecked(void* vjob)
+{
+    auto* const job = static_cast<piece_job*>(vjob);
+    auto* const tor = tr_torrentFindFromId(job->session, job->tor_id);
+    auto const has_piece = tor != nullptr && tor->hasPiece(job->piece);
+
+    if (has_piece && !job->readable && retryPieceJob(tor, job))
+    {
+        return;
+    }
+
+    {
+        auto const lock = std::lock_guard(piece_mutex_);
+        queuedPieces.erase({ job->session, job->tor_id, job->piece });
+    }
+
+    if (has_piece && !job->readable)
+    {
+        // Not the same as corrupt, so there's no error. But the data isn't there to upload either:
+        // mark the piece as missing, so peers' requests for it are rejected, it isn't queued to be
+        // checked again, and it's downloaded again if it's wanted. This is what a full verify would do.
+        tr_logAddTorErr(tor, "Couldn't read piece %zu to check it in the background", size_t(job->piece));
+        tor->setHasPiece(job->piece, false);
+        tor->setPieceChecked(job->piece, false);
+        tor->recheckCompleteness();
+    }
+    else if (has_piece)
+    {
+        tr_logAddTorDbg(tor, "[LAZY] checked piece %zu in the background, pass==%d", size_t(job->piece), int(job->pass));
+        tor->setPieceChecked(job->piece, job->pass);
+
+        if (!job->pass)
+        {
+            tr_torrentSetLocalError(tor, _("Please Verify Local Data! Piece #%zu is corrupt."), size_t(job->piece));
+        }
+    }
+
+    delete job;
+}
+
+void pieceThreadFunc(void* /*user_data*/)
+{
+    for (;;)
+    {
+        piece_job* job = nullptr;
+
+        {
+            auto const lock = std::lock_guard(piece_mutex_);
+
+            auto& queue = std::empty(wantedPieces) ? scrubPieces : wantedPieces;
+            if (std::empty(queue))
+            {
+                pieceThread = nullptr;
+                break;
+            }
+
+            job = queue.front();
+            queue.pop_front();
+            currentPieceJob = job;
+        }
+
+        checkPieceSpans(*job);
+
+        auto const lock = std::lock_guard(piece_mutex_);
+        currentPieceJob = nullptr;
+        tr_runInEventThread(job->session, onPieceChecked, job);
+    }
+}
+
+piece_job* newPieceJob(tr_torrent const* tor, tr_piece_index_t piece, bool is_scrub)
+{
+    auto* const job = new piece_job{};
+    job->session = tor->session;
+    job->tor_id = tor->uniqueId;
+    job->piece = piece;
+    job->hash = tor->pieceHash(piece);
+    job->is_scrub = is_scrub;
+    findPieceSpans(tor, *job);
+    return job;
+}
+
+// assumes piece_mutex_ is locked
+bool queuePiece(tr_torrent const* tor, tr_piece_index_t piece, bool is_scrub)
+{
+    if (tor->session->isClosing() || !queuedPieces.insert({ tor->session, tor->uniqueId, piece }).second)
+    {
+        return false;
+    }
+
+    pushPieceJob(newPieceJob(tor, piece, is_scrub));
+    return true;
+}
+
+void dropPieceJobs(std::deque<piece_job*>& queue, tr_session const* session)
+{
+    auto const it = std::remove_if(
+        std::begin(queue),
+        std::end(queue),
+        [session](auto const* job)
+        {
+            if (job->session != session)
+            {
+                return false;
+            }
+
+            queuedPieces.erase({ job->session, job->tor_id, job->piece });
+            delete job;
+            return true;
+        });
+
+    queue.erase(it, std::end(queue));
+}
+
+} // namespace
+
+void tr_verifyPieceAdd(tr_torrent* tor, tr_piece_index_t piece)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tr_amInEventThread(tor->session));
+    TR_ASSERT(piece < tor->info.pieceCount);
+
+    auto const lock = std::lock_guard(piece_mutex_);
+    queuePiece(tor, piece, false);
+}
+
+bool tr_verifyPieceIsQueued(tr_torrent const* tor, tr_piece_index_t piece)
+{
+    auto const lock = std::lock_guard(piece_mutex_);
+    return queuedPieces.count({ tor->session, tor->uniqueId, piece }) != 0;
+}
+
+void tr_verifyScrub(tr_session* session, uint64_t bytes_per_second)
+{
+    TR_ASSERT(tr_amInEventThread(session));
+
+    auto credit = uint64_t{};
+
+    {
+        auto const lock = std::lock_guard(piece_mutex_);
+
+        if (bytes_per_second == 0)
+        {
+            scrubCredit = 0;
+            return;
+        }
+
+        // only scrub when nothing else is being checked
+        if (!std::empty(wantedPieces) || !std::empty(scrubPieces))
+        {
+            return;
+        }
+
+        scrubCredit += bytes_per_second;
+        credit = scrubCredit;
+    }
+
+    // Pick the pieces to check without holding the lock. Each torrent's
+    // cursor remembers where it left off, so the walk is spread over several
+    // calls instead of looking at every piece of every torrent in one.
+    auto picks = std::vector<std::pair<tr_torrent*, tr_piece_index_t>>{};
+    auto n_examined = size_t{ 0 };
+    auto out_of_credit = false;
+
+    for (auto* tor : session->torrents)
+    {
+        if (!tor->isRunning || tor->isStopping || tor->verifyState != TR_VERIFY_NONE || tor->checked_pieces_.hasAll())
+        {
+            continue;
+        }
+
+        auto const n_pieces = tor->info.pieceCount;
+        for (tr_piece_index_t i = 0; i < n_pieces && n_examined < MaxScrubPiecesExamined; ++i, ++n_examined)
+        {
+            auto const piece = tor->scrub_cursor_ < n_pieces ? tor->scrub_cursor_ : 0;
+            if (!tor->hasPiece(piece) || tor->isPieceChecked(piece))
+            {
+                tor->scrub_cursor_ = piece + 1;
+                continue;
+            }
+
+            // wait until there's enough credit to check the whole piece
+            auto const piece_size = tor->pieceSize(piece);
+            if (piece_size > credit)
+            {
+                out_of_credit = true;
+                break;
+            }
+
+            credit -= piece_size;
+            picks.emplace_back(tor, piece);
+            tor->scrub_cursor_ = piece + 1;
+        }
+
+        if (out_of_credit || n_examined >= MaxScrubPiecesExamined)
+        {
+            break;
+        }
+    }
+
+    auto const lock = std::lock_guard(piece_mutex_);
+
+    for (auto const& [tor, piece] : picks)
+    {
+        if (queuePiece(tor, piece, true))
+        {
+            scrubCredit -= std::min(scrubCredit, uint64_t{ tor->pieceSize(piece) });
+        }
+    }
+
+    // everything's been checked, so don't save up credit for later
+    if (!out_of_credit && n_examined < MaxScrubPiecesExamined)
+    {
+        scrubCredit = 0;
+    }
+}
+
+void tr_verifyClose(tr_session* session)
+{
+    {
+        auto const lock = std::lock_guard(verify_mutex_);
+
+        stopCurrent = true;
+        verifyList.clear();
+    }
+
+    piece_mutex_.lock();
+
+    dropPieceJobs(wantedPieces, session);
+    dropPieceJobs(scrubPieces, session);
+
+    // wait for the session's current job, if any, so that it can't call back into a closed session
+    while (currentPieceJob != nullptr && currentPieceJob->session == session)
+    {
+        piece_mutex_.unlock();
+        tr_wait_msec(10);
+        piece_mutex_.lock();
+    }
+
+    for (auto it = std::begin(queuedPieces); it != std::end(queuedPieces);)
+    {
+        it = std::get<0>(*it) == session ? queuedPieces.erase(it) : std::next(it);
+    }
+
+    piece_mutex_.unlock();
 }
@@ -23,4 +23,22 @@ void tr_verifyRemove(tr_torrent* tor);
 
 void tr_verifyClose(tr_session*);
 
+/**
+ * Hash one piece in a background thread, e.g. because a peer asked for a
+ * piece that hasn't been checked since the torrent was resumed.
+ * When it's done, the event thread marks the piece as checked, or flags
+ * the torrent with a local error if the data on disk doesn't match.
+ * Queueing a piece that's already queued does nothing.
+ */
+void tr_verifyPieceAdd(tr_torrent* tor, tr_piece_index_t piece);
+
+bool tr_verifyPieceIsQueued(tr_torrent const* tor, tr_piece_index_t piece);
+
+/**
+ * While no other pieces are queued, queue the running torrents' unchecked
+ * pieces so that about `bytes_per_second` get checked each second.
+ * Called once per second.
+ */
+void tr_verifyScrub(tr_session* session, uint64_t bytes_per_second);
+
 /* @} */
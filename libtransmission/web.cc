@@ -42,6 +42,9 @@ using namespace std::literals;
 
 static auto constexpr ThreadfuncMaxSleepMsec = int{ 200 };
 
+/* bigger reads mean fewer trips through writeFunc() on fast links */
+static auto constexpr WebseedBufferSize = long{ 128 * 1024 };
+
 #define dbgmsg(...) tr_logAddDeepNamed("web", __VA_ARGS__)
 
 /***
@@ -59,6 +62,7 @@ struct tr_web_task
     evbuffer* response = nullptr;
     tr_session* session = nullptr;
     tr_web_done_func done_func = nullptr;
+    tr_web_write_func write_func = nullptr;
     tr_web_task* next = nullptr;
     void* done_func_user_data = nullptr;
 
@@ -120,6 +124,11 @@ static size_t writeFunc(void* ptr, size_t size, size_t nmemb, void* vtask)
         }
     }
 
+    if (task->write_func != nullptr)
+    {
+        return (*task->write_func)(task, ptr, byteCount, task->done_func_user_data) ? byteCount : 0;
+    }
+
     evbuffer_add(task->response, ptr, byteCount);
     dbgmsg("wrote %zu bytes to task %p's buffer", byteCount, (void*)task);
     return byteCount;
@@ -300,6 +309,13 @@ static CURL* createEasy(tr_session* s, struct tr_web* web, struct tr_web_task* t
         curl_easy_setopt(e, CURLOPT_RANGE, task->range.c_str());
         /* don't bother asking the server to compress webseed fragments */
         curl_easy_setopt(e, CURLOPT_ENCODING, "identity");
+        /* webseeds send a steady stream of range requests to the same
+           host, so keep connections warm and share them when we can */
+        curl_easy_setopt(e, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072B00 /* CURLOPT_PIPEWAIT was added in 7.43.0 */
+        curl_easy_setopt(e, CURLOPT_PIPEWAIT, 1L);
+#endif
+        curl_easy_setopt(e, CURLOPT_BUFFERSIZE, WebseedBufferSize);
     }
 
     return e;
@@ -337,8 +353,8 @@ static struct tr_web_task* tr_webRunImpl(
     std::string_view range,
     std::string_view cookies,
     tr_web_done_func done_func,
-    void* done_func_user_data,
-    struct evbuffer* buffer)
+    tr_web_write_func write_func,
+    void* done_func_user_data)
 {
     struct tr_web_task* task = nullptr;
 
@@ -361,9 +377,10 @@ static struct tr_web_task* tr_webRunImpl(
         task->range = range;
         task->cookies = cookies;
         task->done_func = done_func;
+        task->write_func = write_func;
         task->done_func_user_data = done_func_user_data;
-        task->response = buffer != nullptr ? buffer : evbuffer_new();
-        task->freebuf = buffer != nullptr ? nullptr : task->response;
+        task->response = evbuffer_new();
+        task->freebuf = task->response;
 
         auto const lock = std::unique_lock(session->web->web_tasks_mutex);
         task->next = session->web->tasks;
@@ -380,7 +397,7 @@ struct tr_web_task* tr_webRunWithCookies(
     tr_web_done_func done_func,
     void* done_func_user_data)
 {
-    return tr_webRunImpl(session, -1, url, {}, cookies, done_func, done_func_user_data, nullptr);
+    return tr_webRunImpl(session, -1, url, {}, cookies, done_func, nullptr, done_func_user_data);
 }
 
 struct tr_web_task* tr_webRun(tr_session* session, std::string_view url, tr_web_done_func done_func, void* done_func_user_data)
@@ -393,10 +410,10 @@ struct tr_web_task* tr_webRunWebseed(
     std::string_view url,
     std::string_view range,
     tr_web_done_func done_func,
-    void* done_func_user_data,
-    struct evbuffer* buffer)
+    tr_web_write_func write_func,
+    void* user_data)
 {
-    return tr_webRunImpl(tor->session, tr_torrentId(tor), url, range, {}, done_func, done_func_user_data, buffer);
+    return tr_webRunImpl(tor->session, tr_torrentId(tor), url, range, {}, done_func, write_func, user_data);
 }
 
 static void tr_webThreadFunc(void* vsession)
@@ -8,12 +8,12 @@
 
 #pragma once
 
+#include <cstddef> // size_t
 #include <cstdint>
 #include <string_view>
 
 #include "transmission.h"
 
-struct evbuffer;
 struct tr_address;
 struct tr_web_task;
 
@@ -42,13 +42,20 @@ struct tr_web_task* tr_webRunWithCookies(
     tr_web_done_func done_func,
     void* done_func_user_data);
 
+/**
+ * Called from the web thread as response data arrives, instead of
+ * the data being buffered up for tr_web_done_func. Return false to
+ * abort the transfer.
+ */
+using tr_web_write_func = bool (*)(struct tr_web_task* task, void const* data, size_t len, void* user_data);
+
 struct tr_web_task* tr_webRunWebseed(
     tr_torrent* tor,
     std::string_view url,
     std::string_view range,
     tr_web_done_func done_func,
-    void* done_func_user_data,
-    struct evbuffer* buffer);
+    tr_web_write_func write_func,
+    void* user_data);
 
 long tr_webGetTaskResponseCode(struct tr_web_task* task);
 
@@ -7,7 +7,7 @@
  */
 
 #include <algorithm>
-#include <cstring> /* strlen() */
+#include <cstring> /* memcpy() */
 #include <set>
 #include <vector>
 
@@ -32,20 +32,53 @@ namespace
 
 struct tr_webseed;
 
+/* A run of contiguous blocks fetched with one HTTP range request per file
+ * that the run touches. The run can span many pieces. */
 struct tr_webseed_task
 {
-    bool dead;
-    struct evbuffer* content;
-    struct tr_webseed* webseed;
-    tr_session* session;
-    tr_block_index_t block;
-    tr_piece_index_t piece_index;
-    uint32_t piece_offset;
-    uint32_t length;
-    tr_block_index_t blocks_done;
-    uint32_t block_size;
-    struct tr_web_task* web_task;
-    long response_code;
+    tr_webseed_task(tr_torrent* tor, tr_webseed* webseed_in, tr_block_span_t blocks_in)
+        : webseed{ webseed_in }
+        , session{ tor->session }
+        , blocks{ blocks_in }
+        , block_size{ tor->block_size }
+        , last_block_size{ tor->blockSize(blocks_in.end - 1) }
+        , begin_byte{ uint64_t{ blocks_in.begin } * tor->block_size }
+        , end_byte{ begin_byte + uint64_t{ blocks_in.end - 1 - blocks_in.begin } * tor->block_size + last_block_size }
+        , requested_byte{ begin_byte }
+    {
+    }
+
+    ~tr_webseed_task()
+    {
+        tr_free(partial_block);
+    }
+
+    [[nodiscard]] uint32_t blockSize(tr_block_index_t block) const
+    {
+        return block + 1 == blocks.end ? last_block_size : block_size;
+    }
+
+    tr_webseed* const webseed;
+    tr_session* const session;
+    tr_block_span_t const blocks;
+    uint32_t const block_size;
+    uint32_t const last_block_size;
+    uint64_t const begin_byte;
+    uint64_t const end_byte;
+
+    /* how far into the torrent we've asked for so far */
+    uint64_t requested_byte;
+    tr_file_index_t file_index = 0;
+
+    /* these are written by the web thread while it holds the session lock */
+    uint64_t received_bytes = 0;
+    uint8_t* partial_block = nullptr;
+    uint32_t partial_block_len = 0;
+    tr_block_index_t blocks_done = 0;
+    long response_code = 0;
+
+    struct tr_web_task* web_task = nullptr;
+    bool dead = false;
 };
 
 auto constexpr TR_IDLE_TIMER_MSEC = 2000;
@@ -54,7 +87,17 @@ auto constexpr FAILURE_RETRY_INTERVAL = 150;
 
 auto constexpr MAX_CONSECUTIVE_FAILURES = 5;
 
-auto constexpr MAX_WEBSEED_CONNECTIONS = 4;
+/* how many range requests to keep running at once.
+   we start at the low end and work up while it keeps paying off */
+auto constexpr MIN_WEBSEED_TASKS = size_t{ 1 };
+auto constexpr INITIAL_WEBSEED_TASKS = size_t{ 4 };
+auto constexpr MAX_WEBSEED_TASKS = size_t{ 16 };
+
+/* size each request to take about this long at the speed we're getting,
+   so that per-request overhead stays small no matter how fast the link is */
+auto constexpr TASK_TARGET_SECS = 4;
+auto constexpr MIN_TASK_BLOCKS = tr_block_index_t{ 16 };
+auto constexpr MAX_TASK_BLOCKS = tr_block_index_t{ 1024 };
 
 void webseed_timer_func(evutil_socket_t fd, short what, void* vw);
 
@@ -81,8 +124,20 @@ public:
 
     ~tr_webseed() override
     {
-        // flag all the pending tasks as dead
-        std::for_each(std::begin(tasks), std::end(tasks), [](auto* task) { task->dead = true; });
+        // tasks with a request in flight are freed when it finishes;
+        // flag them as dead so that they know not to touch us
+        for (auto* task : tasks)
+        {
+            if (task->web_task == nullptr)
+            {
+                delete task;
+            }
+            else
+            {
+                task->dead = true;
+            }
+        }
+
         tasks.clear();
 
         event_free(timer);
@@ -107,6 +162,42 @@ public:
         return is_active;
     }
 
+    // If every task was busy and the speed went up since the last tick,
+    // the extra task we added last time helped. Try another.
+    void tune(uint64_t now)
+    {
+        auto const Bps = bandwidth.getPieceSpeedBytesPerSecond(now, TR_DOWN);
+
+        if (std::size(tasks) >= max_tasks && Bps > prev_Bps + prev_Bps / 8)
+        {
+            max_tasks = std::min(max_tasks + 1, MAX_WEBSEED_TASKS);
+        }
+
+        prev_Bps = Bps;
+    }
+
+    [[nodiscard]] tr_block_index_t blocksPerTask(uint64_t now, uint32_t block_size) const
+    {
+        auto const Bps = uint64_t{ bandwidth.getPieceSpeedBytesPerSecond(now, TR_DOWN) };
+        auto const n_blocks = Bps / max_tasks * TASK_TARGET_SECS / block_size;
+        return tr_block_index_t(std::clamp(n_blocks, uint64_t{ MIN_TASK_BLOCKS }, uint64_t{ MAX_TASK_BLOCKS }));
+    }
+
+    void onTaskSucceeded()
+    {
+        consecutive_failures = 0;
+        retry_tickcount = 0;
+    }
+
+    void onTaskFailed()
+    {
+        // the server may be telling us to back off
+        max_tasks = std::max(max_tasks / 2, MIN_WEBSEED_TASKS);
+        prev_Bps = 0;
+
+        ++consecutive_failures;
+    }
+
     int const torrent_id;
     std::string const base_url;
     tr_peer_callback const callback;
@@ -115,11 +206,10 @@ public:
     Bandwidth bandwidth;
     std::set<tr_webseed_task*> tasks;
     struct event* timer = nullptr;
+    size_t max_tasks = INITIAL_WEBSEED_TASKS;
+    unsigned int prev_Bps = 0;
     int consecutive_failures = 0;
     int retry_tickcount = 0;
-    int retry_challenge = 0;
-    int idle_connections = 0;
-    int active_transfers = 0;
     std::vector<std::string> file_urls;
 };
 
@@ -137,39 +227,15 @@ static void publish(tr_webseed* w, tr_peer_event* e)
     }
 }
 
-static void fire_client_got_rejs(tr_torrent* tor, tr_webseed* w, tr_block_index_t block, tr_block_index_t count)
-{
-    auto e = tr_peer_event{};
-    e.eventType = TR_PEER_CLIENT_GOT_REJ;
-    tr_torrentGetBlockLocation(tor, block, &e.pieceIndex, &e.offset, &e.length);
-
-    for (tr_block_index_t i = 1; i <= count; i++)
-    {
-        if (i == count)
-        {
-            e.length = tor->blockSize(block + count - 1);
-        }
-
-        publish(w, &e);
-        e.offset += e.length;
-    }
-}
-
-static void fire_client_got_blocks(tr_torrent* tor, tr_webseed* w, tr_block_index_t block, tr_block_index_t count)
+static void fire_client_got_blocks(tr_torrent* tor, tr_webseed* w, tr_block_span_t span, PeerEventType type)
 {
     auto e = tr_peer_event{};
-    e.eventType = TR_PEER_CLIENT_GOT_BLOCK;
-    tr_torrentGetBlockLocation(tor, block, &e.pieceIndex, &e.offset, &e.length);
+    e.eventType = type;
 
-    for (tr_block_index_t i = 1; i <= count; i++)
+    for (auto block = span.begin; block < span.end; ++block)
     {
-        if (i == count)
-        {
-            e.length = tor->blockSize(block + count - 1);
-        }
-
+        tr_torrentGetBlockLocation(tor, block, &e.pieceIndex, &e.offset, &e.length);
         publish(w, &e);
-        e.offset += e.length;
     }
 }
 
@@ -189,40 +255,40 @@ struct write_block_data
 {
     tr_session* session;
     int torrent_id;
-    struct tr_webseed* webseed;
+    struct tr_webseed_task* task;
     struct evbuffer* content;
-    tr_piece_index_t piece_index;
-    tr_block_index_t block_index;
-    tr_block_index_t count;
-    uint32_t block_offset;
+    tr_block_span_t blocks;
 };
 
+/* `content` holds the blocks' own buffers by reference,
+   so the cache takes them over without copying them */
 static void write_block_func(void* vdata)
 {
     auto* const data = static_cast<struct write_block_data*>(vdata);
-    struct tr_webseed* const w = data->webseed;
+    struct tr_webseed_task* const task = data->task;
     struct evbuffer* const buf = data->content;
 
     auto* const tor = tr_torrentFindFromId(data->session, data->torrent_id);
-    if (tor != nullptr)
+    if (tor != nullptr && !task->dead)
     {
-        uint32_t const block_size = tor->block_size;
-        uint32_t len = evbuffer_get_length(buf);
-        uint32_t const offset_end = data->block_offset + len;
-        tr_cache* cache = data->session->cache;
-        tr_piece_index_t const piece = data->piece_index;
-
-        if (!tor->hasPiece(piece))
+        for (auto block = data->blocks.begin; block < data->blocks.end; ++block)
         {
-            while (len > 0)
+            auto piece = tr_piece_index_t{};
+            auto offset = uint32_t{};
+            auto length = uint32_t{};
+            tr_torrentGetBlockLocation(tor, block, &piece, &offset, &length);
+
+            if (tor->hasPiece(piece))
             {
-                uint32_t const bytes_this_pass = std::min(len, block_size);
-                tr_cacheWriteBlock(cache, tor, piece, offset_end - len, bytes_this_pass, buf);
-                len -= bytes_this_pass;
+                evbuffer_drain(buf, length);
+            }
+            else
+            {
+                tr_cacheWriteBlock(data->session->cache, tor, piece, offset, length, buf);
             }
-
-            fire_client_got_blocks(tor, w, data->block_index, data->count);
         }
+
+        fire_client_got_blocks(tor, task->webseed, data->blocks, TR_PEER_CLIENT_GOT_BLOCK);
     }
 
     evbuffer_free(buf);
@@ -235,35 +301,19 @@ static void write_block_func(void* vdata)
 
 struct connection_succeeded_data
 {
-    struct tr_webseed* webseed;
+    struct tr_webseed_task* task;
     char* real_url;
-    tr_piece_index_t piece_index;
-    uint32_t piece_offset;
+    tr_file_index_t file_index;
 };
 
 static void connection_succeeded(void* vdata)
 {
     auto* data = static_cast<struct connection_succeeded_data*>(vdata);
-    struct tr_webseed* w = data->webseed;
-
-    if (++w->active_transfers >= w->retry_challenge && w->retry_challenge != 0)
-    {
-        /* the server seems to be accepting more connections now */
-        w->consecutive_failures = w->retry_tickcount = w->retry_challenge = 0;
-    }
 
-    if (data->real_url != nullptr)
+    /* remember where we were redirected to */
+    if (!data->task->dead && data->real_url != nullptr)
     {
-        tr_torrent const* const tor = tr_torrentFindFromId(w->session, w->torrent_id);
-
-        if (tor != nullptr)
-        {
-            auto file_index = tr_file_index_t{};
-            auto file_offset = uint64_t{};
-            tr_ioFindFileLocation(tor, data->piece_index, data->piece_offset, &file_index, &file_offset);
-            w->file_urls[file_index].assign(data->real_url);
-            data->real_url = nullptr;
-        }
+        data->task->webseed->file_urls[data->file_index].assign(data->real_url);
     }
 
     tr_free(data->real_url);
@@ -274,123 +324,202 @@ static void connection_succeeded(void* vdata)
 ****
 ***/
 
-static void on_content_changed(struct evbuffer* buf, struct evbuffer_cb_info const* info, void* vtask)
+static void free_block_buffer(void const* /*data*/, size_t /*len*/, void* vblock)
+{
+    tr_free(vblock);
+}
+
+/* called from the web thread */
+static bool on_content(struct tr_web_task* web_task, void const* content, size_t n_bytes, void* vtask)
 {
-    size_t const n_added = info->n_added;
     auto* task = static_cast<struct tr_webseed_task*>(vtask);
     auto* session = task->session;
     auto const lock = session->unique_lock();
 
-    if (!task->dead && n_added > 0)
+    if (task->dead)
     {
-        struct tr_webseed* w = task->webseed;
+        return false;
+    }
+
+    struct tr_webseed* w = task->webseed;
 
-        w->bandwidth.notifyBandwidthConsumed(TR_DOWN, n_added, true, tr_time_msec());
-        fire_client_got_piece_data(w, n_added);
-        uint32_t const len = evbuffer_get_length(buf);
+    if (task->response_code == 0)
+    {
+        task->response_code = tr_webGetTaskResponseCode(web_task);
 
-        if (task->response_code == 0)
+        if (task->response_code == 206)
         {
-            task->response_code = tr_webGetTaskResponseCode(task->web_task);
+            auto* const data = tr_new(struct connection_succeeded_data, 1);
+            data->task = task;
+            data->real_url = tr_strdup(tr_webGetTaskRealUrl(web_task));
+            data->file_index = task->file_index;
+
+            /* processing this uses a tr_torrent pointer,
+               so push the work to the libevent thread... */
+            tr_runInEventThread(session, connection_succeeded, data);
+        }
+    }
 
-            if (task->response_code == 206)
-            {
-                auto* const data = tr_new(struct connection_succeeded_data, 1);
-                data->webseed = w;
-                data->real_url = tr_strdup(tr_webGetTaskRealUrl(task->web_task));
-                data->piece_index = task->piece_index;
-                data->piece_offset = task->piece_offset + task->blocks_done * task->block_size + len - 1;
-
-                /* processing this uses a tr_torrent pointer,
-                   so push the work to the libevent thread... */
-                tr_runInEventThread(session, connection_succeeded, data);
-            }
+    /* don't download error pages, or whole files when we asked for a range */
+    if (task->response_code != 206 || task->received_bytes + n_bytes > task->requested_byte - task->begin_byte)
+    {
+        return false;
+    }
+
+    w->bandwidth.notifyBandwidthConsumed(TR_DOWN, n_bytes, true, tr_time_msec());
+    fire_client_got_piece_data(w, n_bytes);
+    task->received_bytes += n_bytes;
+
+    /* copy the payload straight into block-sized buffers that are
+       handed to the cache as they fill up */
+    auto const first_block = task->blocks.begin + task->blocks_done;
+    auto* walk = static_cast<uint8_t const*>(content);
+    struct evbuffer* done = nullptr;
+
+    while (n_bytes > 0)
+    {
+        auto const block_size = task->blockSize(task->blocks.begin + task->blocks_done);
+
+        if (task->partial_block == nullptr)
+        {
+            task->partial_block = tr_new(uint8_t, block_size);
         }
 
-        if (task->response_code == 206 && len >= task->block_size)
+        auto const n_this_pass = std::min(n_bytes, size_t{ block_size - task->partial_block_len });
+        memcpy(task->partial_block + task->partial_block_len, walk, n_this_pass);
+        task->partial_block_len += n_this_pass;
+        walk += n_this_pass;
+        n_bytes -= n_this_pass;
+
+        if (task->partial_block_len == block_size)
         {
-            /* once we've got at least one full block, save it */
-
-            uint32_t const block_size = task->block_size;
-            tr_block_index_t const completed = len / block_size;
-
-            auto* const data = tr_new(struct write_block_data, 1);
-            data->webseed = task->webseed;
-            data->piece_index = task->piece_index;
-            data->block_index = task->block + task->blocks_done;
-            data->count = completed;
-            data->block_offset = task->piece_offset + task->blocks_done * block_size;
-            data->content = evbuffer_new();
-            data->torrent_id = w->torrent_id;
-            data->session = w->session;
-
-            /* we don't use locking on this evbuffer so we must copy out the data
-               that will be needed when writing the block in a different thread */
-            evbuffer_remove_buffer(task->content, data->content, (size_t)block_size * (size_t)completed);
-
-            tr_runInEventThread(w->session, write_block_func, data);
-            task->blocks_done += completed;
+            if (done == nullptr)
+            {
+                done = evbuffer_new();
+            }
+
+            evbuffer_add_reference(done, task->partial_block, block_size, free_block_buffer, task->partial_block);
+            task->partial_block = nullptr;
+            task->partial_block_len = 0;
+            ++task->blocks_done;
         }
     }
+
+    if (done != nullptr)
+    {
+        auto* const data = tr_new(struct write_block_data, 1);
+        data->session = session;
+        data->torrent_id = w->torrent_id;
+        data->task = task;
+        data->content = done;
+        data->blocks = { first_block, task->blocks.begin + task->blocks_done };
+        tr_runInEventThread(session, write_block_func, data);
+    }
+
+    return true;
 }
 
-static void task_request_next_chunk(struct tr_webseed_task* task);
+static void task_request_next_range(struct tr_webseed_task* task);
 
-static void on_idle(tr_webseed* w)
+static void task_finish(tr_torrent* tor, struct tr_webseed_task* t, bool ok)
 {
-    auto want = int{};
-    int const running_tasks = std::size(w->tasks);
-    tr_torrent* tor = tr_torrentFindFromId(w->session, w->torrent_id);
+    tr_webseed* w = t->webseed;
 
-    if (w->consecutive_failures >= MAX_CONSECUTIVE_FAILURES)
+    if (ok)
     {
-        want = w->idle_connections;
-
-        if (w->retry_tickcount >= FAILURE_RETRY_INTERVAL)
-        {
-            /* some time has passed since our connection attempts failed. try again */
-            ++want;
-            /* if this challenge is fulfilled we will reset consecutive_failures */
-            w->retry_challenge = running_tasks + want;
-        }
+        w->onTaskSucceeded();
     }
     else
     {
-        want = MAX_WEBSEED_CONNECTIONS - running_tasks;
-        w->retry_challenge = running_tasks + w->idle_connections + 1;
+        auto const remain = tr_block_span_t{ t->blocks.begin + t->blocks_done, t->blocks.end };
+
+        if (remain.begin < remain.end)
+        {
+            fire_client_got_blocks(tor, w, remain, TR_PEER_CLIENT_GOT_REJ);
+        }
+
+        if (t->blocks_done == 0)
+        {
+            w->onTaskFailed();
+        }
     }
 
-    if (tor != nullptr && tor->isRunning && !tr_torrentIsSeed(tor) && want > 0)
+    w->tasks.erase(t);
+    delete t;
+}
+
+/* the wishlist hands out spans that stop at piece boundaries.
+   join the neighbours back up so that one request can cover
+   many pieces, then cut them into task-sized pieces */
+static std::vector<tr_block_span_t> make_task_spans(std::vector<tr_block_span_t> spans, tr_block_index_t max_blocks)
+{
+    std::sort(std::begin(spans), std::end(spans), [](auto const& a, auto const& b) { return a.begin < b.begin; });
+
+    auto task_spans = std::vector<tr_block_span_t>{};
+
+    for (auto span : spans)
     {
-        auto n_tasks = size_t{};
+        if (!std::empty(task_spans))
+        {
+            auto& prev = task_spans.back();
 
-        for (auto const span : tr_peerMgrGetNextRequests(tor, w, want))
+            if (prev.end == span.begin && prev.end - prev.begin < max_blocks)
+            {
+                auto const n = std::min(max_blocks - (prev.end - prev.begin), span.end - span.begin);
+                prev.end += n;
+                span.begin += n;
+            }
+        }
+
+        while (span.begin < span.end)
         {
-            auto const [begin, end] = span;
-            auto* const task = tr_new0(tr_webseed_task, 1);
-            task->session = tor->session;
-            task->webseed = w;
-            task->block = begin;
-            task->piece_index = tor->pieceForBlock(begin);
-            task->piece_offset = tor->block_size * begin - tor->info.pieceSize * task->piece_index;
-            task->length = (end - 1 - begin) * tor->block_size + tor->blockSize(end - 1);
-            task->blocks_done = 0;
-            task->response_code = 0;
-            task->block_size = tor->block_size;
-            task->content = evbuffer_new();
-            evbuffer_add_cb(task->content, on_content_changed, task);
-            w->tasks.insert(task);
-            task_request_next_chunk(task);
-
-            --w->idle_connections;
-            ++n_tasks;
-            tr_peerMgrClientSentRequests(tor, w, span);
+            auto const n = std::min(max_blocks, span.end - span.begin);
+            task_spans.push_back({ span.begin, span.begin + n });
+            span.begin += n;
         }
+    }
+
+    return task_spans;
+}
+
+static void on_idle(tr_webseed* w)
+{
+    tr_torrent* tor = tr_torrentFindFromId(w->session, w->torrent_id);
+
+    if (tor == nullptr || !tor->isRunning || tr_torrentIsSeed(tor))
+    {
+        return;
+    }
 
-        if (w->retry_tickcount >= FAILURE_RETRY_INTERVAL && n_tasks > 0)
+    auto n_slots = std::size(w->tasks) < w->max_tasks ? w->max_tasks - std::size(w->tasks) : size_t{ 0 };
+
+    if (w->consecutive_failures >= MAX_CONSECUTIVE_FAILURES)
+    {
+        /* the server's been failing us. try again once in a while */
+        if (!std::empty(w->tasks) || w->retry_tickcount < FAILURE_RETRY_INTERVAL)
         {
-            w->retry_tickcount = 0;
+            return;
         }
+
+        n_slots = 1;
+        w->retry_tickcount = 0;
+    }
+
+    if (n_slots == 0)
+    {
+        return;
+    }
+
+    auto const blocks_per_task = w->blocksPerTask(tr_time_msec(), tor->block_size);
+    auto spans = make_task_spans(tr_peerMgrGetNextRequests(tor, w, n_slots * blocks_per_task), blocks_per_task);
+    spans.resize(std::min(std::size(spans), n_slots));
+
+    for (auto const span : spans)
+    {
+        auto* const task = new tr_webseed_task{ tor, w, span };
+        w->tasks.insert(task);
+        tr_peerMgrClientSentRequests(tor, w, span);
+        task_request_next_range(task);
     }
 }
 
@@ -398,17 +527,16 @@ static void web_response_func(
     tr_session* session,
     bool /*did_connect*/,
     bool /*did_timeout*/,
-    long response_code,
+    long /*response_code*/,
     std::string_view /*response*/,
     void* vtask)
 {
     auto* t = static_cast<struct tr_webseed_task*>(vtask);
-    bool const success = response_code == 206;
+    t->web_task = nullptr;
 
     if (t->dead)
     {
-        evbuffer_free(t->content);
-        tr_free(t);
+        delete t;
         return;
     }
 
@@ -417,64 +545,21 @@ static void web_response_func(
 
     if (tor != nullptr)
     {
-        /* active_transfers was only increased if the connection was successful */
-        if (t->response_code == 206)
-        {
-            --w->active_transfers;
-        }
+        /* the server gave us everything we asked for */
+        bool const success = t->response_code == 206 && t->received_bytes == t->requested_byte - t->begin_byte;
 
-        if (!success)
+        if (success && t->requested_byte < t->end_byte)
         {
-            tr_block_index_t const blocks_remain = (t->length + tor->block_size - 1) / tor->block_size - t->blocks_done;
-
-            if (blocks_remain != 0)
-            {
-                fire_client_got_rejs(tor, w, t->block + t->blocks_done, blocks_remain);
-            }
-
-            if (t->blocks_done != 0)
-            {
-                ++w->idle_connections;
-            }
-            else if (++w->consecutive_failures >= MAX_CONSECUTIVE_FAILURES && w->retry_tickcount == 0)
-            {
-                /* now wait a while until retrying to establish a connection */
-                ++w->retry_tickcount;
-            }
-
-            w->tasks.erase(t);
-            evbuffer_free(t->content);
-            tr_free(t);
+            /* we reached the end of a file; ask for the rest from the next one */
+            t->response_code = 0;
+            task_request_next_range(t);
         }
         else
         {
-            uint32_t const bytes_done = t->blocks_done * tor->block_size;
-            uint32_t const buf_len = evbuffer_get_length(t->content);
+            task_finish(tor, t, success);
 
-            if (bytes_done + buf_len < t->length)
-            {
-                /* request finished successfully but there's still data missing. that
-                   means we've reached the end of a file and need to request the next one */
-                t->response_code = 0;
-                task_request_next_chunk(t);
-            }
-            else
+            if (success)
             {
-                if (buf_len != 0 && !tor->hasPiece(t->piece_index))
-                {
-                    /* on_content_changed() will not write a block if it is smaller than
-                       the torrent's block size, i.e. the torrent's very last block */
-                    tr_cacheWriteBlock(session->cache, tor, t->piece_index, t->piece_offset + bytes_done, buf_len, t->content);
-
-                    fire_client_got_blocks(tor, t->webseed, t->block + t->blocks_done, 1);
-                }
-
-                ++w->idle_connections;
-
-                w->tasks.erase(t);
-                evbuffer_free(t->content);
-                tr_free(t);
-
                 on_idle(w);
             }
         }
@@ -498,38 +583,40 @@ static std::string make_url(tr_webseed* w, char const* name)
     return url;
 }
 
-static void task_request_next_chunk(struct tr_webseed_task* t)
+static void task_request_next_range(struct tr_webseed_task* t)
 {
     tr_webseed* w = t->webseed;
     tr_torrent* tor = tr_torrentFindFromId(w->session, w->torrent_id);
 
     if (tor != nullptr)
     {
-        auto& urls = t->webseed->file_urls;
+        auto& urls = w->file_urls;
 
         tr_info const* inf = tr_torrentInfo(tor);
-        uint64_t const remain = t->length - t->blocks_done * tor->block_size - evbuffer_get_length(t->content);
+        auto const piece = tr_piece_index_t(t->requested_byte / inf->pieceSize);
+        auto const piece_offset = uint32_t(t->requested_byte - uint64_t{ inf->pieceSize } * piece);
 
-        uint64_t const total_offset = tr_pieceOffset(tor, t->piece_index, t->piece_offset, t->length - remain);
-        tr_piece_index_t const step_piece = total_offset / inf->pieceSize;
-        uint64_t const step_piece_offset = total_offset - (uint64_t)inf->pieceSize * step_piece;
-
-        auto file_index = tr_file_index_t{};
         auto file_offset = uint64_t{};
-        tr_ioFindFileLocation(tor, step_piece, step_piece_offset, &file_index, &file_offset);
+        tr_ioFindFileLocation(tor, piece, piece_offset, &t->file_index, &file_offset);
 
-        auto const& file = inf->files[file_index];
-        uint64_t this_pass = std::min(remain, file.length - file_offset);
+        auto const& file = inf->files[t->file_index];
+        uint64_t const this_pass = std::min(t->end_byte - t->requested_byte, file.length - file_offset);
 
-        if (std::empty(urls[file_index]))
+        if (std::empty(urls[t->file_index]))
         {
-            urls[file_index] = make_url(t->webseed, file.name);
+            urls[t->file_index] = make_url(w, file.name);
         }
 
         char range[64];
         tr_snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, file_offset, file_offset + this_pass - 1);
 
-        t->web_task = tr_webRunWebseed(tor, urls[file_index].c_str(), range, web_response_func, t, t->content);
+        t->requested_byte += this_pass;
+        t->web_task = tr_webRunWebseed(tor, urls[t->file_index].c_str(), range, web_response_func, on_content, t);
+
+        if (t->web_task == nullptr)
+        {
+            task_finish(tor, t, false);
+        }
     }
 }
 
@@ -544,11 +631,12 @@ void webseed_timer_func(evutil_socket_t /*fd*/, short /*what*/, void* vw)
 {
     auto* w = static_cast<tr_webseed*>(vw);
 
-    if (w->retry_tickcount != 0)
+    if (w->consecutive_failures >= MAX_CONSECUTIVE_FAILURES)
     {
         ++w->retry_tickcount;
     }
 
+    w->tune(tr_time_msec());
     on_idle(w);
 
     tr_timerAddMsec(w->timer, TR_IDLE_TIMER_MSEC);
@@ -0,0 +1,1505 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+/*
+ * Runs a swarm of in-process sessions against each other over loopback
+ * and reports how fast the transfer path moved the data:
+ *
+ * - MiB/s, both wall-clock and per CPU-second, for the whole process,
+ *   from the first block received to the last
+ * - how long connecting took, and how long until that first block
+ *   arrived, i.e. handshakes, unchoking, and the first requests
+ * - how long work posted to each session's event loop waited to run
+ * - heap allocations per block transferred (glibc only)
+ *
+ * Other modes time a single piece of that path on its own:
+ *
+ * - udp: uTP-sized datagrams over loopback, through the session's
+ *   batched UDP I/O and through one sendto() and recvfrom() apiece
+ * - parse: a big .torrent and a big RPC response, parsed into a
+ *   tr_variant on the heap and in an arena, and the .torrent through
+ *   tr_metainfoParse()
+ * - handshake: a burst of connections from one session to another,
+ *   with the Diffie-Hellman math of encrypted handshakes done on the
+ *   session's DH pool and on the event thread
+ *
+ * The result is one line of JSON on stdout, so runs can be collected
+ * and compared before and after a change to peer-msgs, peer-io, the
+ * cache, or bandwidth allocation.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes> // PRIu64
+#include <cstdio>
+#include <cstdlib> // strtoul(), EXIT_FAILURE
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h> // getrusage()
+#include <sys/select.h> // select()
+#endif
+
+#include <event2/util.h> // evutil_make_socket_nonblocking()
+
+#include "transmission.h"
+
+#include "crypto-utils.h" // tr_rand_buffer()
+#include "dh-pool.h"
+#include "fdlimit.h" // tr_fdSocketCreate(), tr_fdSocketAccept()
+#include "file.h"
+#include "makemeta.h"
+#include "metainfo.h" // tr_metainfoParse()
+#include "net.h"
+#include "peer-mgr.h" // tr_peerMgrAddIncoming(), tr_peerMgrAddOutgoing(), tr_peerMgrHandshakeCount()
+#include "quark.h"
+#include "session.h"
+#include "torrent.h"
+#include "tr-getopt.h"
+#include "tr-udp-batch.h"
+#include "trevent.h" // tr_runInEventThread()
+#include "utils.h"
+#include "variant.h"
+#include "version.h"
+
+using namespace std::literals;
+
+#define MY_NAME "libtransmission-bench"
+
+/***
+****  Allocation counting
+***/
+
+namespace
+{
+
+auto n_allocations = std::atomic<uint64_t>{};
+
+} // namespace
+
+#ifdef __GLIBC__
+
+#define HAVE_ALLOCATION_COUNT
+
+/* wrap glibc's allocator so that every allocation in the process is counted,
+   whether it comes from libtransmission, libevent, or the C++ runtime */
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t n, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+
+    void* malloc(size_t size) noexcept
+    {
+        ++n_allocations;
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t n, size_t size) noexcept
+    {
+        ++n_allocations;
+        return __libc_calloc(n, size);
+    }
+
+    void* realloc(void* ptr, size_t size) noexcept
+    {
+        ++n_allocations;
+        return __libc_realloc(ptr, size);
+    }
+}
+
+#endif
+
+namespace
+{
+
+/***
+****  Options
+***/
+
+enum class Mode
+{
+    Swarm,
+    Udp,
+    Parse,
+    Handshake
+};
+
+struct Options
+{
+    Mode mode = Mode::Swarm;
+    size_t n_leechers = 4;
+    uint64_t torrent_mib = 64;
+    size_t n_files = 0; /* 0 picks the mode's default */
+    size_t n_handshakes = 200;
+    uint32_t piece_kib = 0; /* 0 lets tr_metaInfoBuilderCreate() decide */
+    int64_t cache_mib = -1; /* -1 keeps the session default */
+    tr_encryption_mode encryption = TR_ENCRYPTION_PREFERRED;
+    uint32_t speed_limit_kib = 0;
+    int timeout_secs = 300;
+    bool show_version = false;
+
+    /* set by the handshake mode, which runs with and without it */
+    bool offload_handshakes = true;
+};
+
+tr_option options[] = {
+    { 'm', "mode", "What to measure: swarm, udp, parse, or handshake (default: swarm)", "m", true, "<mode>" },
+    { 'n', "leechers", "How many leeching sessions to run against the seeder (default: 4)", "n", true, "<count>" },
+    { 's', "size", "Total size of the synthetic torrent, or of the udp transfer, in MiB (default: 64)", "s", true, "<MiB>" },
+    { 'f', "files", "How many files to split the torrent into (default: 1, or 10000 to parse)", "f", true, "<count>" },
+    { 'H', "handshakes", "How many connections to open in handshake mode (default: 200)", "H", true, "<count>" },
+    { 'p', "piecesize", "Piece size in KiB (default: chosen by the torrent builder)", "p", true, "<KiB>" },
+    { 'c', "cache", "Each session's cache size in MiB (default: the session default)", "c", true, "<MiB>" },
+    { 'e', "encryption", "Encryption mode: required, preferred, or tolerated (default: preferred)", "e", true, "<mode>" },
+    { 'd', "downlimit", "Limit each leecher's download speed in KiB/s (default: unlimited)", "d", true, "<KiB/s>" },
+    { 't', "timeout", "Give up after this many seconds (default: 300)", "t", true, "<seconds>" },
+    { 'V', "version", "Show version number and exit", "V", false, nullptr },
+    { 0, nullptr, nullptr, nullptr, false, nullptr }
+};
+
+char const* getUsage()
+{
+    return "Usage: " MY_NAME " [options]";
+}
+
+bool parseCommandLine(Options& opts, int argc, char const* const* argv)
+{
+    int c = 0;
+    char const* optarg = nullptr;
+
+    while ((c = tr_getopt(getUsage(), argc, argv, options, &optarg)) != TR_OPT_DONE)
+    {
+        switch (c)
+        {
+        case 'm':
+            if (tr_strcmp0(optarg, "swarm") == 0)
+            {
+                opts.mode = Mode::Swarm;
+            }
+            else if (tr_strcmp0(optarg, "udp") == 0)
+            {
+                opts.mode = Mode::Udp;
+            }
+            else if (tr_strcmp0(optarg, "parse") == 0)
+            {
+                opts.mode = Mode::Parse;
+            }
+            else if (tr_strcmp0(optarg, "handshake") == 0)
+            {
+                opts.mode = Mode::Handshake;
+            }
+            else
+            {
+                return false;
+            }
+
+            break;
+
+        case 'n':
+            opts.n_leechers = std::clamp(strtoul(optarg, nullptr, 10), 1UL, 200UL);
+            break;
+
+        case 's':
+            opts.torrent_mib = std::max(strtoul(optarg, nullptr, 10), 1UL);
+            break;
+
+        case 'f':
+            opts.n_files = std::max(strtoul(optarg, nullptr, 10), 1UL);
+            break;
+
+        case 'H':
+            opts.n_handshakes = std::clamp(strtoul(optarg, nullptr, 10), 1UL, 10000UL);
+            break;
+
+        case 'p':
+            opts.piece_kib = strtoul(optarg, nullptr, 10);
+            break;
+
+        case 'c':
+            opts.cache_mib = strtoul(optarg, nullptr, 10);
+            break;
+
+        case 'e':
+            if (tr_strcmp0(optarg, "required") == 0)
+            {
+                opts.encryption = TR_ENCRYPTION_REQUIRED;
+            }
+            else if (tr_strcmp0(optarg, "preferred") == 0)
+            {
+                opts.encryption = TR_ENCRYPTION_PREFERRED;
+            }
+            else if (tr_strcmp0(optarg, "tolerated") == 0)
+            {
+                opts.encryption = TR_CLEAR_PREFERRED;
+            }
+            else
+            {
+                return false;
+            }
+
+            break;
+
+        case 'd':
+            opts.speed_limit_kib = strtoul(optarg, nullptr, 10);
+            break;
+
+        case 't':
+            opts.timeout_secs = std::max(atoi(optarg), 1);
+            break;
+
+        case 'V':
+            opts.show_version = true;
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    if (opts.n_files == 0)
+    {
+        opts.n_files = opts.mode == Mode::Parse ? 10000 : 1;
+    }
+
+    return true;
+}
+
+char const* modeName(Mode mode)
+{
+    switch (mode)
+    {
+    case Mode::Udp:
+        return "udp";
+
+    case Mode::Parse:
+        return "parse";
+
+    case Mode::Handshake:
+        return "handshake";
+
+    default:
+        return "swarm";
+    }
+}
+
+char const* encryptionName(tr_encryption_mode mode)
+{
+    switch (mode)
+    {
+    case TR_ENCRYPTION_REQUIRED:
+        return "required";
+
+    case TR_CLEAR_PREFERRED:
+        return "tolerated";
+
+    default:
+        return "preferred";
+    }
+}
+
+/***
+****  Helpers
+***/
+
+bool waitFor(std::function<bool()> const& test, int timeout_secs)
+{
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_secs);
+
+    while (!test())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            return false;
+        }
+
+        tr_wait_msec(20);
+    }
+
+    return true;
+}
+
+// run `func` in the session's event thread and wait for it to finish
+void runInEventThread(tr_session* session, std::function<void()> const& func)
+{
+    struct Job
+    {
+        std::function<void()> const& func;
+        std::promise<void> done;
+    };
+
+    auto job = Job{ func, {} };
+    auto done = job.done.get_future();
+
+    tr_runInEventThread(
+        session,
+        [](void* vjob)
+        {
+            auto* const j = static_cast<Job*>(vjob);
+            j->func();
+            j->done.set_value();
+        },
+        &job);
+
+    done.wait();
+}
+
+void rimraf(std::string const& path)
+{
+    auto info = tr_sys_path_info{};
+
+    if (tr_sys_path_get_info(path.c_str(), 0, &info, nullptr) && info.type == TR_SYS_PATH_IS_DIRECTORY)
+    {
+        auto children = std::vector<std::string>{};
+
+        if (auto const odir = tr_sys_dir_open(path.c_str(), nullptr); odir != TR_BAD_SYS_DIR)
+        {
+            char const* name = nullptr;
+
+            while ((name = tr_sys_dir_read_name(odir, nullptr)) != nullptr)
+            {
+                if (tr_strcmp0(name, ".") != 0 && tr_strcmp0(name, "..") != 0)
+                {
+                    children.push_back(tr_strvPath(path, name));
+                }
+            }
+
+            tr_sys_dir_close(odir, nullptr);
+        }
+
+        std::for_each(std::begin(children), std::end(children), rimraf);
+    }
+
+    tr_sys_path_remove(path.c_str(), nullptr);
+}
+
+double cpuSeconds()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    auto const secs = [](timeval const& tv)
+    {
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    };
+    return secs(usage.ru_utime) + secs(usage.ru_stime);
+#endif
+}
+
+/***
+****  Event loop latency
+***/
+
+// Every few msec, post a probe to each session's event loop
+// and record how long it waited before it ran.
+class LoopLatency
+{
+public:
+    explicit LoopLatency(std::vector<tr_session*> sessions)
+        : sessions_{ std::move(sessions) }
+        , probes_{ new Probe[std::size(sessions_)] }
+    {
+        // reserve up front so that recording a sample never allocates
+        samples_usec_.reserve(MaxSamples);
+
+        for (size_t i = 0; i < std::size(sessions_); ++i)
+        {
+            probes_[i].owner = this;
+        }
+    }
+
+    ~LoopLatency()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        thread_ = std::thread(&LoopLatency::run, this);
+    }
+
+    void stop()
+    {
+        if (thread_.joinable())
+        {
+            stopping_ = true;
+            thread_.join();
+
+            // let the last probes land before they go away
+            for (size_t i = 0; i < std::size(sessions_); ++i)
+            {
+                waitFor([this, i]() { return !probes_[i].in_flight; }, 5);
+            }
+        }
+    }
+
+    [[nodiscard]] std::vector<uint64_t> samples() const
+    {
+        auto const lock = std::lock_guard(mutex_);
+        return samples_usec_;
+    }
+
+private:
+    static auto constexpr MaxSamples = size_t{ 1 << 20 };
+    static auto constexpr ProbeIntervalMsec = 5;
+
+    struct Probe
+    {
+        LoopLatency* owner = nullptr;
+        std::chrono::steady_clock::time_point sent;
+        std::atomic<bool> in_flight = false;
+    };
+
+    void run()
+    {
+        while (!stopping_)
+        {
+            for (size_t i = 0; i < std::size(sessions_); ++i)
+            {
+                auto& probe = probes_[i];
+
+                if (!probe.in_flight)
+                {
+                    probe.in_flight = true;
+                    probe.sent = std::chrono::steady_clock::now();
+                    tr_runInEventThread(sessions_[i], onProbe, &probe);
+                }
+            }
+
+            tr_wait_msec(ProbeIntervalMsec);
+        }
+    }
+
+    static void onProbe(void* vprobe)
+    {
+        auto* const probe = static_cast<Probe*>(vprobe);
+        auto const waited = std::chrono::steady_clock::now() - probe->sent;
+        auto* const self = probe->owner;
+
+        {
+            auto const lock = std::lock_guard(self->mutex_);
+
+            if (std::size(self->samples_usec_) < MaxSamples)
+            {
+                self->samples_usec_.push_back(std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+            }
+        }
+
+        probe->in_flight = false;
+    }
+
+    std::vector<tr_session*> const sessions_;
+    std::unique_ptr<Probe[]> probes_;
+    mutable std::mutex mutex_;
+    std::vector<uint64_t> samples_usec_;
+    std::atomic<bool> stopping_ = false;
+    std::thread thread_;
+};
+
+/***
+****  The swarm
+***/
+
+struct Node
+{
+    std::string dir;
+    tr_session* session = nullptr;
+    tr_torrent* tor = nullptr;
+
+    // the made-up address that other nodes know this one by
+    tr_address addr = {};
+    tr_port port = 0;
+};
+
+class Swarm
+{
+public:
+    Swarm(Options const& opts, std::string root)
+        : opts_{ opts }
+        , root_{ std::move(root) }
+    {
+    }
+
+    ~Swarm()
+    {
+        for (auto& node : nodes_)
+        {
+            if (node.session != nullptr)
+            {
+                tr_sessionClose(node.session);
+            }
+        }
+
+        if (listener_ != TR_BAD_SOCKET)
+        {
+            tr_netCloseSocket(listener_);
+        }
+    }
+
+    bool makeTorrent()
+    {
+        auto const top = tr_strvPath(root_, "seed", "bench");
+        tr_sys_dir_create(top.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0700, nullptr);
+
+        auto const total_bytes = opts_.torrent_mib * 1024 * 1024;
+        auto chunk = std::vector<char>(1024 * 1024);
+
+        for (size_t i = 0; i < opts_.n_files; ++i)
+        {
+            auto const path = tr_strvPath(top, "file" + std::to_string(i));
+            auto const fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+            if (fd == TR_BAD_SYS_FILE)
+            {
+                return false;
+            }
+
+            auto left = total_bytes / opts_.n_files + (i + 1 == opts_.n_files ? total_bytes % opts_.n_files : 0);
+
+            while (left > 0)
+            {
+                auto const n = std::min(left, uint64_t{ std::size(chunk) });
+                tr_rand_buffer(std::data(chunk), n);
+                tr_sys_file_write(fd, std::data(chunk), n, nullptr, nullptr);
+                left -= n;
+            }
+
+            tr_sys_file_close(fd, nullptr);
+        }
+
+        auto* const builder = tr_metaInfoBuilderCreate(top.c_str());
+
+        if (opts_.piece_kib != 0 && !tr_metaInfoBuilderSetPieceSize(builder, opts_.piece_kib * 1024))
+        {
+            fprintf(stderr, "Invalid piece size: %" PRIu32 " KiB\n", opts_.piece_kib);
+            tr_metaInfoBuilderFree(builder);
+            return false;
+        }
+
+        torrent_file_ = tr_strvJoin(top, ".torrent");
+        tr_makeMetaInfo(builder, torrent_file_.c_str(), nullptr, 0, nullptr, false, nullptr);
+        waitFor([builder]() { return builder->isDone; }, opts_.timeout_secs);
+        auto const ok = builder->isDone && builder->result == TR_MAKEMETA_OK;
+        tr_metaInfoBuilderFree(builder);
+        return ok;
+    }
+
+    // node 0 seeds; the rest leech
+    bool startSessions()
+    {
+        nodes_.resize(opts_.n_leechers + 1);
+        auto const peer_limit = std::size(nodes_) + (opts_.mode == Mode::Handshake ? opts_.n_handshakes : 0) + 10;
+
+        for (size_t i = 0; i < std::size(nodes_); ++i)
+        {
+            auto& node = nodes_[i];
+            node.dir = tr_strvPath(root_, "node" + std::to_string(i));
+            tr_sys_dir_create(node.dir.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0700, nullptr);
+
+            // TEST-NET-1 addresses (RFC 5737) never route anywhere, so nothing is
+            // dialed for real if a session tries to reconnect on its own
+            tr_address_from_string(&node.addr, ("192.0.2." + std::to_string(i + 1)).c_str());
+            node.port = htons(51413);
+
+            auto settings = tr_variant{};
+            tr_variantInitDict(&settings, 0);
+            tr_sessionGetDefaultSettings(&settings);
+            tr_variantDictAddStr(&settings, TR_KEY_download_dir, node.dir.c_str());
+            tr_variantDictAddBool(&settings, TR_KEY_peer_port_random_on_start, true);
+            tr_variantDictAddBool(&settings, TR_KEY_port_forwarding_enabled, false);
+            tr_variantDictAddBool(&settings, TR_KEY_dht_enabled, false);
+            tr_variantDictAddBool(&settings, TR_KEY_lpd_enabled, false);
+            tr_variantDictAddBool(&settings, TR_KEY_pex_enabled, false);
+            tr_variantDictAddBool(&settings, TR_KEY_utp_enabled, false);
+            tr_variantDictAddBool(&settings, TR_KEY_rpc_enabled, false);
+            tr_variantDictAddInt(&settings, TR_KEY_encryption, opts_.encryption);
+            tr_variantDictAddBool(&settings, TR_KEY_handshake_offload_enabled, opts_.offload_handshakes);
+            tr_variantDictAddInt(&settings, TR_KEY_peer_limit_per_torrent, peer_limit);
+            tr_variantDictAddInt(&settings, TR_KEY_peer_limit_global, peer_limit);
+            tr_variantDictAddInt(&settings, TR_KEY_message_level, TR_LOG_ERROR);
+
+            if (opts_.cache_mib >= 0)
+            {
+                tr_variantDictAddInt(&settings, TR_KEY_cache_size_mb, opts_.cache_mib);
+            }
+
+            if (i > 0 && opts_.speed_limit_kib > 0)
+            {
+                tr_variantDictAddInt(&settings, TR_KEY_speed_limit_down, opts_.speed_limit_kib);
+                tr_variantDictAddBool(&settings, TR_KEY_speed_limit_down_enabled, true);
+            }
+
+            node.session = tr_sessionInit(node.dir.c_str(), false, &settings);
+            tr_variantFree(&settings);
+
+            auto* const ctor = tr_ctorNew(node.session);
+            tr_ctorSetMetainfoFromFile(ctor, torrent_file_.c_str());
+            tr_ctorSetPaused(ctor, TR_FORCE, false);
+            if (i == 0)
+            {
+                auto const seed_dir = tr_strvPath(root_, "seed");
+                tr_ctorSetDownloadDir(ctor, TR_FORCE, seed_dir.c_str());
+            }
+
+            auto err = int{};
+            node.tor = tr_torrentNew(ctor, &err, nullptr);
+            tr_ctorFree(ctor);
+
+            if (node.tor == nullptr)
+            {
+                fprintf(stderr, "Couldn't add the torrent to session %zu\n", i);
+                return false;
+            }
+        }
+
+        // wait for the seeder to verify its data and everyone else to start
+        return waitFor(
+            [this]()
+            {
+                return std::all_of(
+                    std::begin(nodes_),
+                    std::end(nodes_),
+                    [](auto const& node)
+                    {
+                        auto const activity = tr_torrentStat(node.tor)->activity;
+                        return activity == TR_STATUS_DOWNLOAD || activity == TR_STATUS_SEED;
+                    });
+            },
+            opts_.timeout_secs);
+    }
+
+    // connect every node to every other node over loopback TCP
+    bool connectAll()
+    {
+        if (!startListening())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < std::size(nodes_); ++i)
+        {
+            for (size_t j = i + 1; j < std::size(nodes_); ++j)
+            {
+                if (!connect(nodes_[j], nodes_[j].addr, nodes_[j].port, nodes_[i], nodes_[i].addr, nodes_[i].port))
+                {
+                    fprintf(stderr, "Couldn't connect session %zu to session %zu\n", j, i);
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // open `n` connections from node 1 to node 0, each between its own pair of
+    // made-up addresses so that both sessions keep every one of them as a peer
+    bool connectMany(size_t n)
+    {
+        if (!startListening())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            // RFC 2544's benchmarking range, 198.18.0.0/15
+            auto const host = std::to_string(i / 254) + '.' + std::to_string(i % 254 + 1);
+            auto from_addr = tr_address{};
+            auto to_addr = tr_address{};
+            tr_address_from_string(&from_addr, ("198.18." + host).c_str());
+            tr_address_from_string(&to_addr, ("198.19." + host).c_str());
+
+            if (!connect(nodes_[1], from_addr, nodes_[1].port, nodes_[0], to_addr, nodes_[0].port))
+            {
+                fprintf(stderr, "Couldn't open connection %zu\n", i);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Unlike the session-wide limit from --downlimit, this leaves handshakes alone,
+    // since peers only come under their torrent's bandwidth once the handshake is done
+    void limitLeechers(unsigned int kib)
+    {
+        for (size_t i = 1; i < std::size(nodes_); ++i)
+        {
+            tr_torrentSetSpeedLimit_KBps(nodes_[i].tor, TR_DOWN, kib);
+            tr_torrentUseSpeedLimit(nodes_[i].tor, TR_DOWN, true);
+        }
+    }
+
+    [[nodiscard]] size_t peersConnected(size_t node) const
+    {
+        return tr_torrentStat(nodes_[node].tor)->peersConnected;
+    }
+
+    [[nodiscard]] size_t handshakesInProgress() const
+    {
+        auto n = size_t{};
+
+        for (auto const& node : nodes_)
+        {
+            n += tr_peerMgrHandshakeCount(node.tor);
+        }
+
+        return n;
+    }
+
+    [[nodiscard]] uint64_t bytesLeft() const
+    {
+        auto left = uint64_t{};
+
+        for (auto const& node : nodes_)
+        {
+            auto const lock = node.tor->unique_lock();
+            left += node.tor->leftUntilDone();
+        }
+
+        return left;
+    }
+
+    [[nodiscard]] std::vector<tr_session*> sessions() const
+    {
+        auto ret = std::vector<tr_session*>{};
+        std::transform(
+            std::begin(nodes_),
+            std::end(nodes_),
+            std::back_inserter(ret),
+            [](auto const& node) { return node.session; });
+        return ret;
+    }
+
+    [[nodiscard]] tr_torrent const* seed() const
+    {
+        return nodes_.front().tor;
+    }
+
+private:
+    bool startListening()
+    {
+        if (listener_ != TR_BAD_SOCKET)
+        {
+            return true;
+        }
+
+        listener_ = socket(AF_INET, SOCK_STREAM, 0);
+        listen_addr_.sin_family = AF_INET;
+        listen_addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        auto len = socklen_t{ sizeof(listen_addr_) };
+
+        if (listener_ == TR_BAD_SOCKET || bind(listener_, reinterpret_cast<sockaddr*>(&listen_addr_), len) == -1 ||
+            listen(listener_, 128) == -1 || getsockname(listener_, reinterpret_cast<sockaddr*>(&listen_addr_), &len) == -1)
+        {
+            fprintf(stderr, "Couldn't listen on loopback\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    // `from_addr` and `to_addr` are what each end is told the other's address is
+    bool connect(
+        Node& from,
+        tr_address const& from_addr,
+        tr_port from_port,
+        Node& to,
+        tr_address const& to_addr,
+        tr_port to_port)
+    {
+        // use the sessions' own socket bookkeeping on both ends so that
+        // closing the sockets later keeps their counts straight
+        auto from_sock = TR_BAD_SOCKET;
+        runInEventThread(
+            from.session,
+            [&]()
+            {
+                from_sock = tr_fdSocketCreate(from.session, AF_INET, SOCK_STREAM);
+
+                if (from_sock != TR_BAD_SOCKET &&
+                    (::connect(from_sock, reinterpret_cast<sockaddr const*>(&listen_addr_), sizeof(listen_addr_)) == -1 ||
+                     evutil_make_socket_nonblocking(from_sock) == -1))
+                {
+                    tr_netClose(from.session, from_sock);
+                    from_sock = TR_BAD_SOCKET;
+                }
+            });
+
+        if (from_sock == TR_BAD_SOCKET)
+        {
+            return false;
+        }
+
+        auto to_sock = TR_BAD_SOCKET;
+        runInEventThread(
+            to.session,
+            [&]()
+            {
+                auto addr = tr_address{};
+                auto port = tr_port{};
+                to_sock = tr_fdSocketAccept(to.session, listener_, &addr, &port);
+
+                if (to_sock != TR_BAD_SOCKET && evutil_make_socket_nonblocking(to_sock) == -1)
+                {
+                    tr_netClose(to.session, to_sock);
+                    to_sock = TR_BAD_SOCKET;
+                }
+
+                if (to_sock != TR_BAD_SOCKET)
+                {
+                    auto addr_in = from_addr;
+                    tr_peerMgrAddIncoming(to.session->peerMgr, &addr_in, from_port, tr_peer_socket_tcp_create(to_sock));
+                }
+            });
+
+        if (to_sock == TR_BAD_SOCKET)
+        {
+            runInEventThread(from.session, [&]() { tr_netClose(from.session, from_sock); });
+            return false;
+        }
+
+        runInEventThread(
+            from.session,
+            [&]() { tr_peerMgrAddOutgoing(from.tor, &to_addr, to_port, tr_peer_socket_tcp_create(from_sock)); });
+
+        return true;
+    }
+
+    Options const& opts_;
+    std::string const root_;
+    std::string torrent_file_;
+    std::vector<Node> nodes_;
+    tr_socket_t listener_ = TR_BAD_SOCKET;
+    sockaddr_in listen_addr_ = {};
+};
+
+uint64_t percentile(std::vector<uint64_t> const& sorted, double p)
+{
+    return std::empty(sorted) ? 0 : sorted[std::min(size_t(p * std::size(sorted)), std::size(sorted) - 1)];
+}
+
+void addLatency(tr_variant* result, LoopLatency const& latency)
+{
+    auto samples = latency.samples();
+    std::sort(std::begin(samples), std::end(samples));
+    auto* const loop = tr_variantDictAddDict(result, tr_quark_new("loop_latency_usec"sv), 4);
+    tr_variantDictAddInt(loop, tr_quark_new("count"sv), std::size(samples));
+    tr_variantDictAddInt(loop, tr_quark_new("p50"sv), percentile(samples, 0.50));
+    tr_variantDictAddInt(loop, tr_quark_new("p99"sv), percentile(samples, 0.99));
+    tr_variantDictAddInt(loop, tr_quark_new("max"sv), std::empty(samples) ? 0 : samples.back());
+}
+
+bool runSwarm(Options const& opts, std::string const& root, tr_variant* result)
+{
+    auto ok = false;
+    auto swarm = Swarm{ opts, root };
+
+    if (swarm.makeTorrent() && swarm.startSessions())
+    {
+        auto latency = LoopLatency{ swarm.sessions() };
+        auto const* const seed = swarm.seed();
+        auto const total_bytes = seed->info.totalSize * opts.n_leechers;
+
+        // connecting, handshaking, and getting unchoked are timed on their own...
+        auto const connect_at = std::chrono::steady_clock::now();
+        latency.start();
+
+        auto const connected = swarm.connectAll();
+        auto const connected_at = std::chrono::steady_clock::now();
+        auto const started = connected &&
+            waitFor([&swarm, total_bytes]() { return swarm.bytesLeft() < total_bytes; }, opts.timeout_secs);
+
+        // ...so that the throughput is measured from the first block received...
+        auto const bytes_at_start = total_bytes - std::min(total_bytes, swarm.bytesLeft());
+        auto const allocations_at_start = n_allocations.load();
+        auto const cpu_at_start = cpuSeconds();
+        auto const wall_at_start = std::chrono::steady_clock::now();
+
+        auto const complete = started && waitFor([&swarm]() { return swarm.bytesLeft() == 0; }, opts.timeout_secs);
+
+        // ...to the last
+        latency.stop();
+        auto const wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_at_start).count();
+        auto const cpu_secs = cpuSeconds() - cpu_at_start;
+        auto const allocations = n_allocations.load() - allocations_at_start;
+        auto const connect_secs = std::chrono::duration<double>(connected_at - connect_at).count();
+        auto const first_block_secs = std::chrono::duration<double>(wall_at_start - connect_at).count();
+
+        auto const bytes = total_bytes - std::min(total_bytes, swarm.bytesLeft()) - bytes_at_start;
+        auto const mib = bytes / 1048576.0;
+        auto const n_blocks = bytes / seed->block_size;
+
+        tr_variantDictAddInt(result, tr_quark_new("leechers"sv), opts.n_leechers);
+        tr_variantDictAddInt(result, tr_quark_new("files"sv), opts.n_files);
+        tr_variantDictAddInt(result, tr_quark_new("size"sv), seed->info.totalSize);
+        tr_variantDictAddInt(result, tr_quark_new("piece_size"sv), seed->info.pieceSize);
+        tr_variantDictAddInt(result, tr_quark_new("block_size"sv), seed->block_size);
+        tr_variantDictAddStr(result, tr_quark_new("encryption"sv), encryptionName(opts.encryption));
+        tr_variantDictAddBool(result, tr_quark_new("finished"sv), complete);
+        tr_variantDictAddReal(result, tr_quark_new("connect_seconds"sv), connect_secs);
+        tr_variantDictAddReal(result, tr_quark_new("first_block_seconds"sv), first_block_secs);
+        tr_variantDictAddInt(result, tr_quark_new("bytes"sv), bytes);
+        tr_variantDictAddReal(result, tr_quark_new("seconds"sv), wall_secs);
+        tr_variantDictAddReal(result, tr_quark_new("cpu_seconds"sv), cpu_secs);
+        tr_variantDictAddReal(result, tr_quark_new("mib_per_second"sv), wall_secs > 0 ? mib / wall_secs : 0);
+        tr_variantDictAddReal(result, tr_quark_new("mib_per_cpu_second"sv), cpu_secs > 0 ? mib / cpu_secs : 0);
+
+        addLatency(result, latency);
+
+#ifdef HAVE_ALLOCATION_COUNT
+        tr_variantDictAddInt(result, tr_quark_new("allocations"sv), allocations);
+        tr_variantDictAddReal(
+            result,
+            tr_quark_new("allocations_per_block"sv),
+            n_blocks > 0 ? double(allocations) / n_blocks : 0);
+#else
+        TR_UNUSED(allocations);
+        TR_UNUSED(n_blocks);
+#endif
+
+        ok = complete;
+    }
+
+    return ok;
+}
+
+/***
+****  Handshakes
+***/
+
+bool runHandshakes(Options const& opts, std::string const& root, tr_variant* result)
+{
+    auto swarm = Swarm{ opts, root };
+
+    if (!swarm.makeTorrent() || !swarm.startSessions())
+    {
+        return false;
+    }
+
+    // keep the leecher from finishing, which would close its connections as seed-to-seed ones
+    swarm.limitLeechers(1);
+
+    auto const n = opts.n_handshakes;
+    auto latency = LoopLatency{ swarm.sessions() };
+    auto const cpu_at_start = cpuSeconds();
+    auto const wall_at_start = std::chrono::steady_clock::now();
+    latency.start();
+
+    // Wait for every handshake to succeed or fail. A few fail now and then, e.g. when
+    // an MSE public key starts with the byte that a plaintext handshake does, and the
+    // outgoing side's retry in plaintext can't reach the made-up address it dials.
+    auto const connected = swarm.connectMany(n);
+    auto const done = connected && waitFor([&swarm]() { return swarm.handshakesInProgress() == 0; }, opts.timeout_secs);
+
+    latency.stop();
+    auto const wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_at_start).count();
+    auto const cpu_secs = cpuSeconds() - cpu_at_start;
+    auto const n_done = std::min(swarm.peersConnected(0), swarm.peersConnected(1));
+
+    auto pool_stats = tr_dh_pool::Stats{};
+    for (auto* const session : swarm.sessions())
+    {
+        auto const stats = session->dh_pool->stats();
+        pool_stats.hits += stats.hits;
+        pool_stats.misses += stats.misses;
+    }
+
+    tr_variantDictAddBool(result, tr_quark_new("finished"sv), done);
+    tr_variantDictAddInt(result, tr_quark_new("handshakes"sv), n_done);
+    tr_variantDictAddInt(result, tr_quark_new("failed"sv), n - std::min(n, n_done));
+    tr_variantDictAddReal(result, tr_quark_new("seconds"sv), wall_secs);
+    tr_variantDictAddReal(result, tr_quark_new("cpu_seconds"sv), cpu_secs);
+    tr_variantDictAddReal(result, tr_quark_new("handshakes_per_second"sv), wall_secs > 0 ? n_done / wall_secs : 0);
+    tr_variantDictAddInt(result, tr_quark_new("keypair_pool_hits"sv), pool_stats.hits);
+    tr_variantDictAddInt(result, tr_quark_new("keypair_pool_misses"sv), pool_stats.misses);
+    addLatency(result, latency);
+
+    return done;
+}
+
+bool runHandshake(Options const& opts, std::string const& root, tr_variant* result)
+{
+    auto run_opts = opts;
+    run_opts.n_leechers = 1;
+
+    tr_variantDictAddInt(result, tr_quark_new("connections"sv), opts.n_handshakes);
+    tr_variantDictAddStr(result, tr_quark_new("encryption"sv), encryptionName(opts.encryption));
+
+    run_opts.offload_handshakes = true;
+    auto* const offloaded = tr_variantDictAddDict(result, tr_quark_new("offloaded"sv), 11);
+    auto ok = runHandshakes(run_opts, tr_strvPath(root, "offloaded"), offloaded);
+
+    run_opts.offload_handshakes = false;
+    auto* const inline_result = tr_variantDictAddDict(result, tr_quark_new("inline"sv), 11);
+    ok &= runHandshakes(run_opts, tr_strvPath(root, "inline"), inline_result);
+
+    return ok;
+}
+
+/***
+****  UDP loopback throughput
+***/
+
+tr_socket_t makeLoopbackUdpSocket(sockaddr_in* setme)
+{
+    auto const sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == TR_BAD_SOCKET)
+    {
+        return TR_BAD_SOCKET;
+    }
+
+    auto addr = sockaddr_in{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto len = socklen_t{ sizeof(addr) };
+
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), len) == -1 ||
+        getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len) == -1 || evutil_make_socket_nonblocking(sock) == -1)
+    {
+        tr_netCloseSocket(sock);
+        return TR_BAD_SOCKET;
+    }
+
+    // the same large buffers that tr_udpSetSocketBuffers() asks for
+    auto const bufsize = 4 * 1024 * 1024;
+    (void)setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char const*>(&bufsize), sizeof(bufsize));
+    (void)setsockopt(sock, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char const*>(&bufsize), sizeof(bufsize));
+
+    *setme = addr;
+    return sock;
+}
+
+// wait up to 100 msec for `sock` to be readable
+void waitReadable(tr_socket_t sock)
+{
+    auto fds = fd_set{};
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    auto timeout = timeval{ 0, 100000 };
+    (void)select(sock + 1, &fds, nullptr, nullptr, &timeout);
+}
+
+// Sends `n_packets` uTP-sized datagrams from one loopback socket to another,
+// either through tr_udp_batch on both ends or with one syscall per datagram.
+// Like uTP, the sender keeps a window of datagrams in flight, so that the
+// receiver's socket buffer never overflows and nothing is lost.
+bool runUdpTransfer(Options const& opts, bool batched, uint64_t n_packets, tr_variant* result)
+{
+    static auto constexpr PacketSize = size_t{ 1400 };
+    static auto constexpr Window = uint64_t{ 512 };
+
+    auto sender_addr = sockaddr_in{};
+    auto receiver_addr = sockaddr_in{};
+    auto const sender = makeLoopbackUdpSocket(&sender_addr);
+    auto const receiver = makeLoopbackUdpSocket(&receiver_addr);
+    if (sender == TR_BAD_SOCKET || receiver == TR_BAD_SOCKET)
+    {
+        fprintf(stderr, "Couldn't open loopback UDP sockets\n");
+
+        for (auto const sock : { sender, receiver })
+        {
+            if (sock != TR_BAD_SOCKET)
+            {
+                tr_netCloseSocket(sock);
+            }
+        }
+
+        return false;
+    }
+
+    auto const* const to = reinterpret_cast<sockaddr const*>(&receiver_addr);
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(opts.timeout_secs);
+    auto payload = std::vector<char>(PacketSize);
+    tr_rand_buffer(std::data(payload), std::size(payload));
+
+    auto n_received = std::atomic<uint64_t>{};
+    auto n_receive_calls = uint64_t{};
+    auto stopping = std::atomic<bool>{};
+
+    auto const cpu_at_start = cpuSeconds();
+    auto const wall_at_start = std::chrono::steady_clock::now();
+
+    auto reader = std::thread(
+        [&]()
+        {
+            auto batch = tr_udp_batch{};
+            auto buf = std::vector<char>(tr_udp_batch::MaxPacketSize);
+            // the datagrams are only counted
+            auto const handler = [](unsigned char*, size_t, sockaddr const*, socklen_t, void*) {};
+
+            while (!stopping && n_received < n_packets)
+            {
+                auto n = size_t{};
+
+                if (batched)
+                {
+                    n = batch.receive(receiver, handler, nullptr);
+                }
+                else
+                {
+                    ++n_receive_calls;
+                    n = recvfrom(receiver, std::data(buf), std::size(buf), 0, nullptr, nullptr) > 0 ? 1 : 0;
+                }
+
+                if (n == 0)
+                {
+                    waitReadable(receiver);
+                }
+
+                n_received += n;
+            }
+
+            if (batched)
+            {
+                n_receive_calls = batch.stats().receive_calls;
+            }
+        });
+
+    auto batch = tr_udp_batch{};
+    auto n_send_calls = uint64_t{};
+    auto timed_out = false;
+
+    for (uint64_t i = 0; i < n_packets && !timed_out; ++i)
+    {
+        while (i - n_received >= Window)
+        {
+            if (batched)
+            {
+                batch.flush();
+            }
+
+            timed_out = std::chrono::steady_clock::now() > deadline;
+            if (timed_out)
+            {
+                break;
+            }
+
+            std::this_thread::yield();
+        }
+
+        if (batched)
+        {
+            batch.send(sender, std::data(payload), std::size(payload), to, sizeof(receiver_addr));
+            continue;
+        }
+
+        // a full send buffer isn't a lost packet, so try again
+        while (!timed_out)
+        {
+            ++n_send_calls;
+            if (sendto(sender, std::data(payload), std::size(payload), 0, to, sizeof(receiver_addr)) >= 0)
+            {
+                break;
+            }
+
+            timed_out = std::chrono::steady_clock::now() > deadline;
+            std::this_thread::yield();
+        }
+    }
+
+    while (n_received < n_packets && std::chrono::steady_clock::now() < deadline)
+    {
+        if (batched)
+        {
+            batch.flush();
+        }
+
+        std::this_thread::yield();
+    }
+
+    stopping = true;
+    reader.join();
+
+    auto const wall_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_at_start).count();
+    auto const cpu_secs = cpuSeconds() - cpu_at_start;
+
+    tr_netCloseSocket(sender);
+    tr_netCloseSocket(receiver);
+
+    if (batched)
+    {
+        n_send_calls = batch.stats().send_calls;
+        tr_variantDictAddInt(result, tr_quark_new("packets_sent_with_gso"sv), batch.stats().packets_sent_with_gso);
+    }
+
+    auto const received = n_received.load();
+    auto const mib = received * PacketSize / 1048576.0;
+    tr_variantDictAddBool(result, tr_quark_new("finished"sv), received == n_packets);
+    tr_variantDictAddInt(result, tr_quark_new("packets"sv), received);
+    tr_variantDictAddReal(result, tr_quark_new("seconds"sv), wall_secs);
+    tr_variantDictAddReal(result, tr_quark_new("cpu_seconds"sv), cpu_secs);
+    tr_variantDictAddReal(result, tr_quark_new("packets_per_second"sv), wall_secs > 0 ? received / wall_secs : 0);
+    tr_variantDictAddReal(result, tr_quark_new("mib_per_second"sv), wall_secs > 0 ? mib / wall_secs : 0);
+    tr_variantDictAddReal(result, tr_quark_new("mib_per_cpu_second"sv), cpu_secs > 0 ? mib / cpu_secs : 0);
+    tr_variantDictAddReal(
+        result,
+        tr_quark_new("packets_per_send_call"sv),
+        n_send_calls > 0 ? double(received) / n_send_calls : 0);
+    tr_variantDictAddReal(
+        result,
+        tr_quark_new("packets_per_receive_call"sv),
+        n_receive_calls > 0 ? double(received) / n_receive_calls : 0);
+
+    return received == n_packets;
+}
+
+bool runUdp(Options const& opts, tr_variant* result)
+{
+    auto const n_packets = opts.torrent_mib * 1024 * 1024 / 1400;
+
+    tr_variantDictAddInt(result, tr_quark_new("size"sv), opts.torrent_mib * 1024 * 1024);
+
+    auto const batched_ok = runUdpTransfer(opts, true, n_packets, tr_variantDictAddDict(result, tr_quark_new("batched"sv), 10));
+    auto const plain_ok = runUdpTransfer(opts, false, n_packets, tr_variantDictAddDict(result, tr_quark_new("plain"sv), 9));
+    return batched_ok && plain_ok;
+}
+
+/***
+****  Parsing
+***/
+
+// a .torrent with `n_files` files in 100-file folders, and a piece per 256 KiB of `size_mib`
+std::string makeMetainfoSample(size_t n_files, uint64_t size_mib)
+{
+    static auto constexpr PieceSize = uint64_t{ 256 * 1024 };
+    auto const total_size = size_mib * 1024 * 1024;
+
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 4);
+    tr_variantDictAddStrView(&top, TR_KEY_announce, "http://tracker.example.com:6969/announce"sv);
+    tr_variantDictAddStrView(&top, TR_KEY_comment, "a synthetic torrent for " MY_NAME ""sv);
+    tr_variantDictAddStrView(&top, TR_KEY_created_by, MY_NAME ""sv);
+
+    auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+    auto* const files = tr_variantDictAddList(info, TR_KEY_files, n_files);
+    for (size_t i = 0; i < n_files; ++i)
+    {
+        auto* const file = tr_variantListAddDict(files, 2);
+        tr_variantDictAddInt(file, TR_KEY_length, total_size / n_files + (i + 1 == n_files ? total_size % n_files : 0));
+        auto* const path = tr_variantDictAddList(file, TR_KEY_path, 2);
+        tr_variantListAddStr(path, "folder" + std::to_string(i / 100));
+        tr_variantListAddStr(path, "file" + std::to_string(i) + ".bin");
+    }
+
+    tr_variantDictAddStrView(info, TR_KEY_name, "bench"sv);
+    tr_variantDictAddInt(info, TR_KEY_piece_length, PieceSize);
+
+    auto pieces = std::vector<char>((total_size + PieceSize - 1) / PieceSize * SHA_DIGEST_LENGTH);
+    tr_rand_buffer(std::data(pieces), std::size(pieces));
+    tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+
+    auto len = size_t{};
+    auto* const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+    auto ret = std::string{ benc, len };
+    tr_free(benc);
+    tr_variantFree(&top);
+    return ret;
+}
+
+// a "torrent-get" response like the one a client polls for, listing `n_torrents` torrents
+std::string makeRpcSample(size_t n_torrents)
+{
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 2);
+    tr_variantDictAddStrView(&top, TR_KEY_result, "success"sv);
+
+    auto* const args = tr_variantDictAddDict(&top, TR_KEY_arguments, 1);
+    auto* const torrents = tr_variantDictAddList(args, TR_KEY_torrents, n_torrents);
+    for (size_t i = 0; i < n_torrents; ++i)
+    {
+        auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+        auto hash_string = std::array<char, SHA_DIGEST_LENGTH * 2 + 1>{};
+        tr_rand_buffer(std::data(hash), std::size(hash));
+        tr_sha1_to_hex(std::data(hash_string), std::data(hash));
+
+        auto* const tor = tr_variantListAddDict(torrents, 12);
+        tr_variantDictAddInt(tor, TR_KEY_id, i + 1);
+        tr_variantDictAddStr(tor, TR_KEY_name, "Some Linux Distribution " + std::to_string(i) + " x86_64 DVD");
+        tr_variantDictAddStr(tor, TR_KEY_hashString, std::data(hash_string));
+        tr_variantDictAddStrView(tor, TR_KEY_downloadDir, "/var/lib/transmission/downloads"sv);
+        tr_variantDictAddInt(tor, TR_KEY_status, i % 7);
+        tr_variantDictAddInt(tor, TR_KEY_totalSize, 4700000000 + i);
+        tr_variantDictAddInt(tor, TR_KEY_addedDate, 1600000000 + i);
+        tr_variantDictAddInt(tor, TR_KEY_rateDownload, i * 1000);
+        tr_variantDictAddInt(tor, TR_KEY_rateUpload, i * 100);
+        tr_variantDictAddInt(tor, TR_KEY_peersConnected, i % 50);
+        tr_variantDictAddReal(tor, TR_KEY_percentDone, (i % 100) / 100.0);
+        tr_variantDictAddReal(tor, TR_KEY_uploadRatio, (i % 300) / 100.0);
+    }
+
+    auto len = size_t{};
+    auto* const json = tr_variantToStr(&top, TR_VARIANT_FMT_JSON_LEAN, &len);
+    auto ret = std::string{ json, len };
+    tr_free(json);
+    tr_variantFree(&top);
+    return ret;
+}
+
+// Calls `parse` repeatedly for about half a second and records how long it took
+// per call, how fast it got through `sample`, and how often it allocated.
+bool timeParse(std::string_view sample, tr_variant* result, std::function<bool()> const& parse)
+{
+    static auto constexpr MinIterations = uint64_t{ 3 };
+    static auto constexpr MinDuration = 500ms;
+
+    auto n_iterations = uint64_t{};
+    auto ok = true;
+    auto const allocations_at_start = n_allocations.load();
+    auto const begin = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration{};
+
+    while (ok && (n_iterations < MinIterations || elapsed < MinDuration))
+    {
+        ok = parse();
+        ++n_iterations;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    }
+
+    auto const allocations = n_allocations.load() - allocations_at_start;
+    auto const secs = std::chrono::duration<double>(elapsed).count();
+    auto const mib = std::size(sample) * n_iterations / 1048576.0;
+
+    tr_variantDictAddBool(result, tr_quark_new("ok"sv), ok);
+    tr_variantDictAddInt(result, tr_quark_new("iterations"sv), n_iterations);
+    tr_variantDictAddReal(result, tr_quark_new("usec_per_parse"sv), secs * 1e6 / n_iterations);
+    tr_variantDictAddReal(result, tr_quark_new("mib_per_second"sv), secs > 0 ? mib / secs : 0);
+
+#ifdef HAVE_ALLOCATION_COUNT
+    tr_variantDictAddReal(result, tr_quark_new("allocations_per_parse"sv), double(allocations) / n_iterations);
+#else
+    TR_UNUSED(allocations);
+#endif
+
+    return ok;
+}
+
+// times parsing `sample` into a tr_variant on the heap, and in an arena that's reused for each parse
+bool timeVariantParse(std::string_view sample, int parse_opts, tr_variant* result)
+{
+    tr_variantDictAddInt(result, tr_quark_new("bytes"sv), std::size(sample));
+
+    auto const heap_ok = timeParse(
+        sample,
+        tr_variantDictAddDict(result, tr_quark_new("heap"sv), 5),
+        [&]()
+        {
+            auto top = tr_variant{};
+            auto const parsed = tr_variantFromBuf(&top, parse_opts | TR_VARIANT_PARSE_INPLACE, sample);
+            tr_variantFree(&top);
+            return parsed;
+        });
+
+    auto arena = tr_variant_arena{};
+    auto const arena_ok = timeParse(
+        sample,
+        tr_variantDictAddDict(result, tr_quark_new("arena"sv), 5),
+        [&]()
+        {
+            auto top = tr_variant{};
+            arena.reset();
+            auto const parsed = tr_variantFromBuf(&top, arena, parse_opts | TR_VARIANT_PARSE_INPLACE, sample);
+            tr_variantFree(&top);
+            return parsed;
+        });
+
+    return heap_ok && arena_ok;
+}
+
+bool runParse(Options const& opts, tr_variant* result)
+{
+    auto const metainfo = makeMetainfoSample(opts.n_files, opts.torrent_mib);
+    auto const rpc = makeRpcSample(opts.n_files);
+
+    tr_variantDictAddInt(result, tr_quark_new("files"sv), opts.n_files);
+
+    auto* const metainfo_result = tr_variantDictAddDict(result, tr_quark_new("metainfo"sv), 4);
+    auto ok = timeVariantParse(metainfo, TR_VARIANT_PARSE_BENC, metainfo_result);
+
+    // what adding a torrent does with it
+    ok &= timeParse(
+        metainfo,
+        tr_variantDictAddDict(metainfo_result, tr_quark_new("tr_metainfoParse"sv), 5),
+        [&metainfo]() { return tr_metainfoParse(nullptr, metainfo, nullptr).has_value(); });
+
+    ok &= timeVariantParse(rpc, TR_VARIANT_PARSE_JSON, tr_variantDictAddDict(result, tr_quark_new("rpc"sv), 3));
+
+    return ok;
+}
+
+} // namespace
+
+int tr_main(int argc, char* argv[])
+{
+    auto opts = Options{};
+
+    if (!parseCommandLine(opts, argc, (char const* const*)argv))
+    {
+        tr_getopt_usage(MY_NAME, getUsage(), options);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.show_version)
+    {
+        fprintf(stderr, MY_NAME " " LONG_VERSION_STRING "\n");
+        return EXIT_SUCCESS;
+    }
+
+    auto const* const tmpdir = getenv("TMPDIR");
+    auto root = tr_strvPath(tmpdir != nullptr ? tmpdir : "/tmp", MY_NAME ".XXXXXX");
+    if (!tr_sys_dir_create_temp(std::data(root), nullptr))
+    {
+        fprintf(stderr, "Couldn't create a temporary folder\n");
+        return EXIT_FAILURE;
+    }
+
+    auto result = tr_variant{};
+    tr_variantInitDict(&result, 20);
+    tr_variantDictAddStr(&result, tr_quark_new("mode"sv), modeName(opts.mode));
+
+    auto ok = false;
+
+    switch (opts.mode)
+    {
+    case Mode::Udp:
+        ok = runUdp(opts, &result);
+        break;
+
+    case Mode::Parse:
+        ok = runParse(opts, &result);
+        break;
+
+    case Mode::Handshake:
+        ok = runHandshake(opts, root, &result);
+        break;
+
+    default:
+        ok = runSwarm(opts, root, &result);
+        break;
+    }
+
+    auto len = size_t{};
+    auto* const json = tr_variantToStr(&result, TR_VARIANT_FMT_JSON_LEAN, &len);
+    fwrite(json, 1, len, stdout);
+    fputc('\n', stdout);
+    tr_free(json);
+    tr_variantFree(&result);
+
+    rimraf(root);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
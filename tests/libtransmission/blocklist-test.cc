@@ -6,12 +6,23 @@
  *
  */
 
+#include <algorithm>
+#include <array>
 #include <cstdio>
 #include <cstring> // strlen()
+#include <ctime>
+#include <string>
+#include <vector>
 // #include <unistd.h> // sync()
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+
 #include "transmission.h"
 #include "blocklist.h"
+#include "crypto-utils.h" // tr_rand_int_weak()
 #include "file.h"
 #include "peer-socket.h"
 #include "net.h"
@@ -139,6 +150,190 @@ TEST_F(BlocklistTest, updating)
     // cleanup
 }
 
+/***
+****
+***/
+
+TEST_F(BlocklistTest, ipv6)
+{
+    auto const path = tr_strvPath(tr_sessionGetConfigDir(session_), "blocklists", "level1");
+    createFileWithContents(
+        path,
+        "2001:db8::/32\n"
+        "Some Corp: Inc.:2001:db9::10-2001:db9::1f\n"
+        "Austin Law Firm:216.16.1.144-216.16.1.151\n");
+    tr_sessionReloadBlocklists(session_);
+    EXPECT_EQ(3, tr_blocklistGetRuleCount(session_));
+    tr_blocklistSetEnabled(session_, true);
+
+    EXPECT_FALSE(addressIsBlocked("2001:db7:ffff:ffff:ffff:ffff:ffff:ffff"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8::"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8:1234::1"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8:ffff:ffff:ffff:ffff:ffff:ffff"));
+    EXPECT_FALSE(addressIsBlocked("2001:db9::f"));
+    EXPECT_TRUE(addressIsBlocked("2001:db9::10"));
+    EXPECT_TRUE(addressIsBlocked("2001:db9::1f"));
+    EXPECT_FALSE(addressIsBlocked("2001:db9::20"));
+
+    // IPv4-mapped addresses are checked against the IPv4 ranges
+    EXPECT_TRUE(addressIsBlocked("::ffff:216.16.1.150"));
+    EXPECT_FALSE(addressIsBlocked("::ffff:216.16.1.152"));
+}
+
+TEST_F(BlocklistTest, mergesAllTheLists)
+{
+    auto const dir = tr_strvPath(tr_sessionGetConfigDir(session_), "blocklists");
+    createFileWithContents(tr_strvPath(dir, "level1"), Contents1);
+    createFileWithContents(
+        tr_strvPath(dir, "level2"),
+        "Overlaps Austin:216.16.1.150-216.16.1.160\n"
+        "Evilcorp:216.88.88.0-216.88.88.255\n"
+        "2001:db8::/32\n");
+    tr_sessionReloadBlocklists(session_);
+    EXPECT_EQ(8, tr_blocklistGetRuleCount(session_));
+
+    // nothing is blocked until the blocklists are enabled
+    auto const generation = session_->blocklist_index.generation();
+    EXPECT_FALSE(addressIsBlocked("216.88.88.1"));
+    tr_blocklistSetEnabled(session_, true);
+    EXPECT_NE(generation, session_->blocklist_index.generation());
+
+    // the overlapping Austin ranges are merged into one
+    EXPECT_EQ(7U, session_->blocklist_index.size());
+
+    EXPECT_TRUE(addressIsBlocked("10.1.2.3"));
+    EXPECT_FALSE(addressIsBlocked("216.16.1.143"));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.144"));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.155"));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.160"));
+    EXPECT_FALSE(addressIsBlocked("216.16.1.161"));
+    EXPECT_TRUE(addressIsBlocked("216.88.88.1"));
+    EXPECT_TRUE(addressIsBlocked("2001:db8::1"));
+
+    tr_blocklistSetEnabled(session_, false);
+    EXPECT_FALSE(addressIsBlocked("216.88.88.1"));
+    EXPECT_FALSE(addressIsBlocked("2001:db8::1"));
+}
+
+TEST_F(BlocklistTest, indexMatchesLinearSearch)
+{
+    for (int n_ranges : { 0, 1, 2, 3, 7, 8, 9, 100, 1000 })
+    {
+        auto ranges = std::vector<tr_ipv4_range>{};
+        for (int i = 0; i < n_ranges; ++i)
+        {
+            auto const begin = static_cast<uint32_t>(tr_rand_int_weak(100000));
+            ranges.push_back({ begin, begin + static_cast<uint32_t>(tr_rand_int_weak(100)) });
+        }
+
+        // both on the heap and mapped from a saved file
+        for (bool const saved : { false, true })
+        {
+            auto index = tr_blocklist_index{};
+            if (saved)
+            {
+                index.setFilename(tr_strvPath(sandboxDir(), "blocklists.index"));
+            }
+
+            index.rebuild(ranges, {});
+            EXPECT_EQ(saved, index.isMapped());
+
+            auto addr = tr_address{};
+            addr.type = TR_AF_INET;
+
+            for (uint32_t a = 0; a < 100200; a += 7)
+            {
+                auto const expected = std::any_of(
+                    std::begin(ranges),
+                    std::end(ranges),
+                    [a](auto const& range) { return range.begin <= a && a <= range.end; });
+
+                addr.addr.addr4.s_addr = htonl(a);
+                EXPECT_EQ(expected, index.contains(addr)) << "n_ranges " << n_ranges << " address " << a;
+            }
+        }
+    }
+}
+
+TEST_F(BlocklistTest, olderVersionsBinFilesAreKept)
+{
+    auto const dir = tr_strvPath(tr_sessionGetConfigDir(session_), "blocklists");
+    auto const legacy_bin = tr_strvPath(dir, "level1.bin");
+
+    // older versions saved bare IPv4 ranges in host byte order
+    auto const legacy_range = std::array<uint32_t, 2>{ 0xD8100190, 0xD8100197 }; // 216.16.1.144-216.16.1.151
+    createFileWithContents(legacy_bin, std::data(legacy_range), sizeof(legacy_range));
+    tr_sessionReloadBlocklists(session_);
+    tr_blocklistSetEnabled(session_, true);
+    EXPECT_EQ(1, tr_blocklistGetRuleCount(session_));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.144"));
+
+    // a source list is compiled to a .bin2, which replaces the .bin
+    // without touching it, so that an older version can still read it
+    createFileWithContents(tr_strvPath(dir, "level1"), Contents2);
+    tr_sessionReloadBlocklists(session_);
+    EXPECT_TRUE(tr_sys_path_exists(tr_strvPath(dir, "level1.bin2").c_str(), nullptr));
+    EXPECT_EQ(6, tr_blocklistGetRuleCount(session_));
+    EXPECT_TRUE(addressIsBlocked("216.88.88.1"));
+
+    auto info = tr_sys_path_info{};
+    EXPECT_TRUE(tr_sys_path_get_info(legacy_bin.c_str(), 0, &info, nullptr));
+    EXPECT_EQ(sizeof(legacy_range), info.size);
+}
+
+#ifndef _WIN32
+
+TEST_F(BlocklistTest, savedIndexIsReused)
+{
+    auto const dir = tr_strvPath(tr_sessionGetConfigDir(session_), "blocklists");
+    auto const index_file = tr_strvPath(tr_sessionGetConfigDir(session_), "blocklists.index");
+    auto const inodeOf = [](std::string const& path)
+    {
+        struct stat sb = {};
+        EXPECT_EQ(0, stat(path.c_str(), &sb));
+        return sb.st_ino;
+    };
+
+    createFileWithContents(tr_strvPath(dir, "level1"), Contents1);
+    tr_sessionReloadBlocklists(session_);
+    tr_blocklistSetEnabled(session_, true);
+    EXPECT_TRUE(session_->blocklist_index.isMapped());
+    EXPECT_TRUE(addressIsBlocked("216.16.1.144"));
+
+    // modification times only have a resolution of a second, so backdate the
+    // lists to make sure the index is saved after them. The source list has
+    // to be older than its .bin2, or the .bin2 is remade.
+    auto const then = time(nullptr) - 60;
+    auto const source_times = utimbuf{ then - 60, then - 60 };
+    auto const bin_times = utimbuf{ then, then };
+    EXPECT_EQ(0, utime(tr_strvPath(dir, "level1").c_str(), &source_times));
+    EXPECT_EQ(0, utime(tr_strvPath(dir, "level1.bin2").c_str(), &bin_times));
+
+    // the list changed since the index was saved, so it's rebuilt
+    auto const old_inode = inodeOf(index_file);
+    tr_sessionReloadBlocklists(session_);
+    auto const inode = inodeOf(index_file);
+    EXPECT_NE(old_inode, inode);
+
+    // but now it's up to date, so it's reused
+    tr_sessionReloadBlocklists(session_);
+    EXPECT_EQ(inode, inodeOf(index_file));
+    EXPECT_TRUE(session_->blocklist_index.isMapped());
+    EXPECT_EQ(5U, session_->blocklist_index.size());
+    EXPECT_EQ(5, tr_blocklistGetRuleCount(session_));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.144"));
+    EXPECT_FALSE(addressIsBlocked("216.16.1.152"));
+
+    // turning the lists off and on again doesn't throw the saved index away
+    tr_blocklistSetEnabled(session_, false);
+    EXPECT_FALSE(addressIsBlocked("216.16.1.144"));
+    tr_blocklistSetEnabled(session_, true);
+    EXPECT_EQ(inode, inodeOf(index_file));
+    EXPECT_TRUE(addressIsBlocked("216.16.1.144"));
+}
+
+#endif
+
 } // namespace test
 
 } // namespace libtransmission
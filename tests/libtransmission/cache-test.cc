@@ -0,0 +1,217 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+
+#include "transmission.h"
+
+#include "cache.h"
+#include "inout.h"
+#include "rpcimpl.h"
+#include "session.h"
+#include "torrent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+using Key = tr_read_cache::Key;
+
+auto constexpr SpanLen = size_t{ 1000 };
+
+// room for four spans, so `in_` holds one of them
+auto constexpr Budget = SpanLen * 4;
+
+namespace
+{
+
+void addSpan(tr_read_cache& cache, Key const& key)
+{
+    auto* const buf = cache.add(key, SpanLen);
+    ASSERT_NE(nullptr, buf);
+    std::fill_n(buf, SpanLen, uint8_t(key.piece));
+}
+
+} // namespace
+
+TEST(ReadCache, hitsAndMisses)
+{
+    auto cache = tr_read_cache{ Budget };
+    auto const key = Key{ 1, 2, 0 };
+
+    EXPECT_EQ(nullptr, cache.get(key));
+    addSpan(cache, key);
+    EXPECT_EQ(SpanLen, cache.size());
+
+    auto const* const data = cache.get(key);
+    ASSERT_NE(nullptr, data);
+    EXPECT_EQ(2, data[SpanLen - 1]);
+
+    EXPECT_EQ(1U, cache.stats().hits);
+    EXPECT_EQ(1U, cache.stats().misses);
+}
+
+TEST(ReadCache, disabledOrTooBig)
+{
+    auto cache = tr_read_cache{};
+    EXPECT_EQ(nullptr, cache.add({ 1, 0, 0 }, SpanLen));
+
+    // a span bigger than `in_`'s share of the budget isn't cached
+    cache.setLimit(Budget);
+    EXPECT_EQ(nullptr, cache.add({ 1, 0, 0 }, SpanLen + 1));
+    EXPECT_EQ(0U, cache.size());
+}
+
+TEST(ReadCache, scanDoesNotEvictPopularSpans)
+{
+    auto cache = tr_read_cache{ Budget };
+    auto const popular = Key{ 1, 0, 0 };
+
+    // the popular span is read, falls out of `in_`, and is asked for again
+    addSpan(cache, popular);
+    for (tr_piece_index_t piece = 1; piece <= 4; ++piece)
+    {
+        addSpan(cache, { 1, piece, 0 });
+    }
+    EXPECT_FALSE(cache.has(popular));
+    EXPECT_EQ(nullptr, cache.get(popular));
+    addSpan(cache, popular);
+
+    // a long scan only churns `in_`
+    for (tr_piece_index_t piece = 100; piece < 200; ++piece)
+    {
+        addSpan(cache, { 2, piece, 0 });
+        EXPECT_LE(cache.size(), Budget);
+    }
+
+    EXPECT_TRUE(cache.has(popular));
+    EXPECT_NE(nullptr, cache.get(popular));
+}
+
+TEST(ReadCache, lruWithinMain)
+{
+    auto cache = tr_read_cache{ Budget };
+    auto const a = Key{ 1, 0, 0 };
+    auto const b = Key{ 1, 1, 0 };
+    auto const c = Key{ 1, 2, 0 };
+    auto const d = Key{ 1, 3, 0 };
+    auto const e = Key{ 1, 4, 0 };
+
+    // each re-add finds the key of a span that just fell out of `in_`
+    // and promotes it, until the main list is [c, b, a] and `in_` is [e]
+    for (auto const& key : { a, b, c, d, e, a, b, c })
+    {
+        addSpan(cache, key);
+    }
+
+    // using `a` makes `b` the least recently used
+    EXPECT_NE(nullptr, cache.get(a));
+
+    // `in_` is within its share now, so making room for `d` evicts from main
+    addSpan(cache, d);
+    EXPECT_TRUE(cache.has(a));
+    EXPECT_FALSE(cache.has(b));
+    EXPECT_TRUE(cache.has(c));
+    EXPECT_TRUE(cache.has(d));
+    EXPECT_TRUE(cache.has(e));
+    EXPECT_EQ(Budget, cache.size());
+}
+
+TEST(ReadCache, remove)
+{
+    auto cache = tr_read_cache{ Budget };
+    addSpan(cache, { 1, 0, 0 });
+    addSpan(cache, { 1, 0, 1 });
+    addSpan(cache, { 2, 0, 0 });
+    EXPECT_LE(cache.size(), Budget);
+
+    cache.remove({ 2, 0, 0 });
+    EXPECT_FALSE(cache.has({ 2, 0, 0 }));
+
+    cache.removeTorrent(1);
+    EXPECT_EQ(0U, cache.size());
+
+    addSpan(cache, { 1, 0, 0 });
+    cache.setLimit(0);
+    EXPECT_EQ(0U, cache.size());
+}
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using CacheTest = SessionTest;
+
+TEST_F(CacheTest, readCacheServesSeededBlocks)
+{
+    tr_sessionSetReadCacheLimit_MB(session_, 16);
+    EXPECT_EQ(16, tr_sessionGetReadCacheLimit_MB(session_));
+
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    ASSERT_TRUE(tor->hasPiece(0));
+
+    auto const before = tr_cacheGetReadStats(session_->cache);
+    auto buf = std::array<uint8_t, 16384>{};
+
+    // the first block of a piece reads the piece in; the rest come from memory
+    buf.fill(0xFF);
+    EXPECT_EQ(0, tr_cacheReadBlock(session_->cache, tor, 0, 0, std::size(buf), std::data(buf)));
+    EXPECT_EQ(std::size(buf), size_t(std::count(std::begin(buf), std::end(buf), 0)));
+
+    buf.fill(0xFF);
+    EXPECT_EQ(0, tr_cacheReadBlock(session_->cache, tor, 0, 16384, std::size(buf), std::data(buf)));
+    EXPECT_EQ(std::size(buf), size_t(std::count(std::begin(buf), std::end(buf), 0)));
+
+    auto const after = tr_cacheGetReadStats(session_->cache);
+    EXPECT_EQ(before.misses + 1, after.misses);
+    EXPECT_EQ(before.hits + 1, after.hits);
+    EXPECT_LE(size_t{ 2 * 16384 }, after.cached_bytes);
+
+    // session-stats reports them too, even though metrics are off
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    EXPECT_FALSE(tr_sessionGetMetricsEnabled(session_));
+    auto request = tr_variant{};
+    tr_variantInitDict(&request, 1);
+    tr_variantDictAddStrView(&request, TR_KEY_method, "session-stats");
+    auto response = tr_variant{};
+    tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+    tr_variantFree(&request);
+
+    tr_variant* args = nullptr;
+    tr_variant* read_stats = nullptr;
+    auto hits = int64_t{};
+    auto misses = int64_t{};
+    auto cached_bytes = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    EXPECT_TRUE(tr_variantDictFindDict(args, TR_KEY_read_cache_stats, &read_stats));
+    EXPECT_TRUE(tr_variantDictFindInt(read_stats, TR_KEY_hits, &hits));
+    EXPECT_TRUE(tr_variantDictFindInt(read_stats, TR_KEY_misses, &misses));
+    EXPECT_TRUE(tr_variantDictFindInt(read_stats, TR_KEY_cachedBytes, &cached_bytes));
+    EXPECT_EQ(after.hits, uint64_t(hits));
+    EXPECT_EQ(after.misses, uint64_t(misses));
+    EXPECT_EQ(after.cached_bytes, size_t(cached_bytes));
+    tr_variantFree(&response);
+
+    // checking a piece reads it from disk again
+    EXPECT_TRUE(tr_ioTestPiece(tor, 0));
+    EXPECT_EQ(after.misses + 1, tr_cacheGetReadStats(session_->cache).misses);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
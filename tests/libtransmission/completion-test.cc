@@ -8,13 +8,16 @@
 
 #include <array>
 #include <cstdint>
+#include <numeric>
 #include <set>
+#include <vector>
 
 #include "transmission.h"
 
 #include "block-info.h"
 #include "completion.h"
 #include "crypto-utils.h"
+#include "file-piece-map.h"
 
 #include "gtest/gtest.h"
 
@@ -372,6 +375,138 @@ TEST_F(CompletionTest, sizeWhenDone)
     EXPECT_EQ(block_info.total_size - 16 * block_info.piece_size, completion.sizeWhenDone());
 }
 
+TEST_F(CompletionTest, sizeWhenDoneIsUpdatedIncrementally)
+{
+    auto torrent = TestTorrent{};
+    auto constexpr TotalSize = uint64_t{ BlockSize * 4096 } + 1;
+    auto constexpr PieceSize = uint64_t{ BlockSize * 64 };
+    auto const block_info = tr_block_info{ TotalSize, PieceSize };
+
+    auto completion = tr_completion(&torrent, &block_info);
+    auto const recounted = [&completion]()
+    {
+        auto copy = completion;
+        copy.invalidateSizeWhenDone();
+        return copy.sizeWhenDone();
+    };
+
+    EXPECT_EQ(block_info.total_size, completion.sizeWhenDone());
+
+    // pieces that stop being wanted
+    completion.addPiece(1);
+    completion.addBlock(block_info.blockSpanForPiece(2).begin);
+    completion.updateWanted(0, 4, [&torrent]() { torrent.dnd_pieces.insert({ 0, 1, 2, 3 }); });
+    EXPECT_EQ(block_info.total_size - 3 * PieceSize + BlockSize, completion.sizeWhenDone());
+    EXPECT_EQ(recounted(), completion.sizeWhenDone());
+
+    // getting or losing blocks of pieces that aren't wanted
+    completion.addBlock(0);
+    EXPECT_EQ(recounted(), completion.sizeWhenDone());
+    completion.addPiece(3);
+    EXPECT_EQ(recounted(), completion.sizeWhenDone());
+    completion.removePiece(1);
+    EXPECT_EQ(recounted(), completion.sizeWhenDone());
+
+    // pieces that are wanted again
+    completion.updateWanted(2, 3, [&torrent]() { torrent.dnd_pieces.erase(2); });
+    EXPECT_EQ(recounted(), completion.sizeWhenDone());
+}
+
+TEST_F(CompletionTest, hasValidIsUpdatedIncrementally)
+{
+    auto torrent = TestTorrent{};
+    auto constexpr TotalSize = uint64_t{ BlockSize * 4096 } + 1;
+    auto constexpr PieceSize = uint64_t{ BlockSize * 64 };
+    auto const block_info = tr_block_info{ TotalSize, PieceSize };
+    auto completion = tr_completion(&torrent, &block_info);
+
+    // a piece only counts once all of its blocks are here
+    auto const [begin, end] = block_info.blockSpanForPiece(0);
+    for (auto block = begin; block < end - 1; ++block)
+    {
+        completion.addBlock(block);
+        EXPECT_EQ(0U, completion.hasValid());
+    }
+    completion.addBlock(end - 1);
+    EXPECT_EQ(PieceSize, completion.hasValid());
+
+    // including the short final piece
+    completion.addPiece(block_info.n_pieces - 1);
+    EXPECT_EQ(PieceSize + 1, completion.hasValid());
+
+    completion.removePiece(0);
+    EXPECT_EQ(1U, completion.hasValid());
+    completion.removePiece(0);
+    EXPECT_EQ(1U, completion.hasValid());
+}
+
+TEST_F(CompletionTest, countHasBytesInFile)
+{
+    auto torrent = TestTorrent{};
+
+    // files that share blocks, span blocks, and are empty
+    auto const file_sizes = std::vector<uint64_t>{
+        BlockSize / 2, 0, BlockSize, 100, 0, 0, BlockSize * 70 + 5, 1, 1, BlockSize * 3, BlockSize / 3,
+    };
+    auto const total_size = std::accumulate(std::begin(file_sizes), std::end(file_sizes), uint64_t{ 0 });
+    auto const block_info = tr_block_info{ total_size, BlockSize * 4 };
+    auto const fpm = tr_file_piece_map{ block_info, std::data(file_sizes), std::size(file_sizes) };
+    auto completion = tr_completion(&torrent, &block_info, &fpm);
+
+    // count each file's bytes the slow way
+    auto const expect_file_bytes = [&]()
+    {
+        for (tr_file_index_t file = 0; file < std::size(file_sizes); ++file)
+        {
+            auto const [file_begin, file_end] = fpm.byteSpan(file);
+            auto expected = uint64_t{ 0 };
+            for (auto byte = file_begin; byte < file_end; ++byte)
+            {
+                expected += completion.hasBlock(block_info.blockOf(byte)) ? 1 : 0;
+            }
+
+            EXPECT_EQ(expected, completion.countHasBytesInFile(file)) << "file " << file;
+        }
+    };
+
+    expect_file_bytes();
+
+    // a random assortment of blocks
+    auto buf = std::vector<char>(block_info.n_blocks);
+    EXPECT_TRUE(tr_rand_buffer(std::data(buf), std::size(buf)));
+    for (tr_block_index_t block = 0; block < block_info.n_blocks; ++block)
+    {
+        if (buf[block] % 2 != 0)
+        {
+            completion.addBlock(block);
+        }
+    }
+    expect_file_bytes();
+
+    completion.addPiece(0);
+    completion.addPiece(block_info.n_pieces - 1);
+    expect_file_bytes();
+
+    completion.removePiece(1);
+    expect_file_bytes();
+
+    // counted from scratch
+    auto blocks = completion.blocks();
+    blocks.unset(2);
+    blocks.set(3);
+    completion.setBlocks(blocks);
+    expect_file_bytes();
+
+    for (tr_piece_index_t piece = 0; piece < block_info.n_pieces; ++piece)
+    {
+        completion.addPiece(piece);
+    }
+    for (tr_file_index_t file = 0; file < std::size(file_sizes); ++file)
+    {
+        EXPECT_EQ(file_sizes[file], completion.countHasBytesInFile(file));
+    }
+}
+
 TEST_F(CompletionTest, createPieceBitfield)
 {
     auto torrent = TestTorrent{};
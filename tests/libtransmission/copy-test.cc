@@ -7,6 +7,8 @@
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <vector>
 
 #include "transmission.h"
 #include "error.h"
@@ -48,7 +50,7 @@ protected:
         tr_sys_path_remove(path2.c_str(), nullptr);
     }
 
-private:
+protected:
     uint64_t fillBufferFromFd(tr_sys_file_t fd, uint64_t bytes_remaining, char* buf, size_t buf_len)
     {
         memset(buf, 0, buf_len);
@@ -128,6 +130,72 @@ TEST_F(CopyTest, copy)
     testImpl(filename1, filename2, random_file_length);
 }
 
+TEST_F(CopyTest, copyReportsProgress)
+{
+    auto const path1 = tr_strvPath(sandboxDir(), "orig-blob.txt");
+    auto const path2 = tr_strvPath(sandboxDir(), "copy-blob.txt");
+
+    // big enough to be copied in more than one chunk
+    auto const file_length = size_t{ 1024 * 1024 * 24 };
+    auto file_content = std::vector<char>(file_length);
+    tr_rand_buffer(std::data(file_content), file_length);
+    createFileWithContents(path1, std::data(file_content), file_length);
+
+    auto progress = std::vector<uint64_t>{};
+    auto const on_progress = [](uint64_t bytes_copied, void* vprogress)
+    {
+        static_cast<std::vector<uint64_t>*>(vprogress)->push_back(bytes_copied);
+        return true;
+    };
+
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_path_copy(path1.c_str(), path2.c_str(), on_progress, &progress, &err));
+    EXPECT_EQ(nullptr, err);
+    tr_error_clear(&err);
+
+    EXPECT_TRUE(filesAreIdentical(path1.c_str(), path2.c_str()));
+    EXPECT_GT(std::size(progress), 1U);
+    EXPECT_TRUE(std::is_sorted(std::begin(progress), std::end(progress)));
+    EXPECT_EQ(file_length, progress.back());
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+    tr_sys_path_remove(path2.c_str(), nullptr);
+}
+
+TEST_F(CopyTest, copyCanBeCancelled)
+{
+    auto const path1 = tr_strvPath(sandboxDir(), "orig-blob.txt");
+    auto const path2 = tr_strvPath(sandboxDir(), "copy-blob.txt");
+
+    auto const file_length = size_t{ 1024 * 1024 * 24 };
+    auto file_content = std::vector<char>(file_length);
+    tr_rand_buffer(std::data(file_content), file_length);
+    createFileWithContents(path1, std::data(file_content), file_length);
+
+    auto n_calls = size_t{ 0 };
+    auto const on_progress = [](uint64_t /*bytes_copied*/, void* vn_calls)
+    {
+        ++*static_cast<size_t*>(vn_calls);
+        return false;
+    };
+
+    tr_error* err = nullptr;
+    EXPECT_FALSE(tr_sys_path_copy(path1.c_str(), path2.c_str(), on_progress, &n_calls, &err));
+    EXPECT_NE(nullptr, err);
+#ifdef _WIN32
+    EXPECT_EQ(ERROR_REQUEST_ABORTED, err->code);
+#else
+    EXPECT_EQ(ECANCELED, err->code);
+#endif
+    tr_error_clear(&err);
+
+    // it stopped as soon as it was told to
+    EXPECT_EQ(1U, n_calls);
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+    tr_sys_path_remove(path2.c_str(), nullptr);
+}
+
 } // namespace test
 
 } // namespace libtransmission
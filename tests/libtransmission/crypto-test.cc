@@ -9,13 +9,17 @@
 #include "transmission.h"
 #include "crypto.h"
 #include "crypto-utils.h"
+#include "dh-pool.h"
+#include "session.h"
+#include "trevent.h"
 #include "utils.h"
 
 #include "crypto-test-ref.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
 
 #include <array>
+#include <atomic>
 #include <cstring>
 #include <string>
 #include <unordered_set>
@@ -274,3 +278,124 @@ TEST(Crypto, base64)
         tr_free(out);
     }
 }
+
+namespace
+{
+
+bool secretsMatch(tr_crypto const* a, tr_crypto const* b)
+{
+    auto hash_a = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto hash_b = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    return tr_cryptoSecretKeySha1(a, "req1", 4, "", 0, hash_a.data()) &&
+        tr_cryptoSecretKeySha1(b, "req1", 4, "", 0, hash_b.data()) && hash_a == hash_b;
+}
+
+} // namespace
+
+TEST(Crypto, dhPoolFillsAndTakes)
+{
+    auto pool = tr_dh_pool{ nullptr, 4 };
+    EXPECT_EQ(4U, pool.capacity());
+    EXPECT_TRUE(libtransmission::test::waitFor([&pool]() { return pool.size() == pool.capacity(); }, 5000));
+
+    // taking one doesn't trigger a refill; taking half of them does
+    auto keypair = pool.take();
+    ASSERT_TRUE(keypair);
+    EXPECT_NE(nullptr, keypair->dh);
+    tr_dh_free(keypair->dh);
+    EXPECT_EQ(3U, pool.size());
+
+    for (int i = 0; i < 2; ++i)
+    {
+        keypair = pool.take();
+        ASSERT_TRUE(keypair);
+        tr_dh_free(keypair->dh);
+    }
+
+    EXPECT_TRUE(libtransmission::test::waitFor([&pool]() { return pool.size() == pool.capacity(); }, 5000));
+    EXPECT_EQ(3U, pool.stats().hits);
+}
+
+TEST(Crypto, pooledKeyExchange)
+{
+    auto pool = tr_dh_pool{ nullptr, 4 };
+    EXPECT_TRUE(libtransmission::test::waitFor([&pool]() { return pool.size() == pool.capacity(); }, 5000));
+
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+    auto a = tr_crypto{};
+    tr_cryptoConstruct(&a, hash.data(), false, &pool);
+    auto b = tr_crypto{};
+    tr_cryptoConstruct(&b, hash.data(), true);
+
+    // `a` uses a pooled key and computes the secret out of band; `b` does it the usual way
+    auto len = int{};
+    uint8_t const* const a_public_key = tr_cryptoGetMyPublicKey(&a, &len);
+    EXPECT_EQ(1U, pool.stats().hits);
+    EXPECT_TRUE(tr_cryptoComputeSecret(&b, a_public_key));
+
+    tr_dh_ctx_t const dh = tr_cryptoTakeKey(&a);
+    ASSERT_NE(nullptr, dh);
+    EXPECT_EQ(a_public_key, tr_cryptoGetMyPublicKey(&a, &len));
+    tr_cryptoSetSecret(&a, tr_dh_agree(dh, tr_cryptoGetMyPublicKey(&b, &len), KEY_LEN));
+    tr_dh_free(dh);
+
+    EXPECT_TRUE(secretsMatch(&a, &b));
+
+    tr_cryptoDestruct(&b);
+    tr_cryptoDestruct(&a);
+}
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using DhPoolTest = SessionTest;
+
+TEST_F(DhPoolTest, agreedSecretsArriveInTheEventThread)
+{
+    auto* const pool = session_->dh_pool.get();
+    ASSERT_NE(nullptr, pool);
+    EXPECT_TRUE(waitFor([pool]() { return pool->size() == pool->capacity(); }, 20000));
+
+    auto const peer = tr_dh_pool::makeKeypair();
+    ASSERT_TRUE(peer);
+    auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+
+    struct Agreed
+    {
+        tr_session* session = nullptr;
+        std::atomic<size_t> n_secrets = {};
+        std::atomic<size_t> n_in_event_thread = {};
+    };
+
+    auto agreed = Agreed{};
+    agreed.session = session_;
+    auto const on_agreed = [](tr_dh_secret_t secret, void* vagreed)
+    {
+        auto* const a = static_cast<Agreed*>(vagreed);
+        a->n_secrets += secret != nullptr ? 1 : 0;
+        a->n_in_event_thread += tr_amInEventThread(a->session) ? 1 : 0;
+        tr_dh_secret_free(secret);
+    };
+
+    auto constexpr NumHandshakes = size_t{ 4 };
+    for (size_t i = 0; i < NumHandshakes; ++i)
+    {
+        auto crypto = tr_crypto{};
+        tr_cryptoConstruct(&crypto, hash.data(), true, pool);
+        pool->agree(tr_cryptoTakeKey(&crypto), peer->public_key.data(), on_agreed, &agreed);
+        tr_cryptoDestruct(&crypto);
+    }
+
+    EXPECT_TRUE(waitFor([&agreed]() { return agreed.n_in_event_thread == NumHandshakes; }, 20000));
+    EXPECT_EQ(NumHandshakes, agreed.n_secrets);
+    EXPECT_EQ(NumHandshakes, pool->stats().hits);
+
+    tr_dh_free(peer->dh);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -87,6 +87,40 @@ TEST_F(FilePieceMapTest, pieceSpan)
     EXPECT_EQ(block_info_.n_pieces, fpm.pieceSpan(std::size(FileSizes) - 1).end);
 }
 
+TEST_F(FilePieceMapTest, fileSpanOfBytes)
+{
+    auto const fpm = tr_file_piece_map{ block_info_, std::data(FileSizes), std::size(FileSizes) };
+
+    // byte spans match the file sizes
+    uint64_t offset = 0;
+    for (tr_file_index_t file = 0; file < std::size(fpm); ++file)
+    {
+        EXPECT_EQ(offset, fpm.byteSpan(file).begin);
+        EXPECT_EQ(offset + FileSizes[file], fpm.byteSpan(file).end);
+        offset += FileSizes[file];
+    }
+
+    auto const expect_files = [&fpm](uint64_t begin, uint64_t end, tr_file_index_t file_begin, tr_file_index_t file_end)
+    {
+        auto const span = fpm.fileSpan(tr_file_piece_map::byte_span_t{ begin, end });
+        EXPECT_EQ(file_begin, span.begin) << '[' << begin << ',' << end << ')';
+        EXPECT_EQ(file_end, span.end) << '[' << begin << ',' << end << ')';
+    };
+
+    // inside one file
+    expect_files(0, 1, 0, 1);
+    expect_files(100, 500, 0, 1);
+    // across the empty files at offset 500
+    expect_files(499, 501, 0, 6);
+    // starting right where the empty files are skips them
+    expect_files(500, 501, 5, 6);
+    // the small files
+    expect_files(650, 690, 7, 12);
+    expect_files(655, 661, 7, 9);
+    // the last byte
+    expect_files(1000, 1001, 12, 13);
+}
+
 TEST_F(FilePieceMapTest, priorities)
 {
     auto const fpm = tr_file_piece_map{ block_info_, std::data(FileSizes), std::size(FileSizes) };
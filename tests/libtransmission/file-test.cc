@@ -631,6 +631,34 @@ TEST_F(FileTest, pathIsSame)
     tr_sys_path_remove(path1.c_str(), nullptr);
 }
 
+TEST_F(FileTest, pathIsSameFilesystem)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    auto const path2 = tr_strvPath(test_dir, "b"sv);
+
+    /* Non-existent paths are not on the same filesystem */
+    tr_error* err = nullptr;
+    EXPECT_FALSE(tr_sys_path_is_same_filesystem(path1.c_str(), test_dir.c_str(), &err));
+    EXPECT_EQ(nullptr, err);
+
+    /* A file is on the same filesystem as itself and its directory */
+    createFileWithContents(path1, "test");
+    EXPECT_TRUE(tr_sys_path_is_same_filesystem(path1.c_str(), path1.c_str(), &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_TRUE(tr_sys_path_is_same_filesystem(path1.c_str(), test_dir.c_str(), &err));
+    EXPECT_EQ(nullptr, err);
+
+    /* Two separate files in the same directory are on the same filesystem */
+    tr_sys_dir_create(path2.c_str(), 0, 0777, nullptr);
+    EXPECT_TRUE(tr_sys_path_is_same_filesystem(path1.c_str(), path2.c_str(), &err));
+    EXPECT_EQ(nullptr, err);
+
+    tr_sys_path_remove(path2.c_str(), nullptr);
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
 TEST_F(FileTest, pathResolve)
 {
     auto const test_dir = createTestDir(currentTestName());
@@ -25,3 +25,17 @@ TEST(History, recentHistory)
     EXPECT_EQ(2, h.count(22000, 15000));
     EXPECT_EQ(2, h.count(22000, 20000));
 }
+
+TEST(History, recentHistoryReusesOldSlices)
+{
+    auto h = tr_recentHistory{};
+
+    // add more seconds than the history holds, so that its slices get reused
+    for (time_t now = 1; now <= 200; ++now)
+    {
+        h.add(now, 1);
+    }
+
+    EXPECT_EQ(1, h.count(200, 0));
+    EXPECT_EQ(10, h.count(200, 9));
+}
@@ -0,0 +1,226 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdio> // sscanf()
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+
+#include "log.h"
+#include "variant.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+
+class LogTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        old_level_ = tr_logGetLevel();
+        old_queue_enabled_ = tr_logGetQueueEnabled();
+        old_format_ = tr_logGetFormat();
+
+        tr_logSetLevel(TR_LOG_DEBUG);
+        tr_logFlush();
+        tr_logFreeQueue(tr_logGetQueue());
+    }
+
+    void TearDown() override
+    {
+        tr_logFlush();
+        tr_logFreeQueue(tr_logGetQueue());
+
+        tr_logSetLevel(old_level_);
+        tr_logSetQueueEnabled(old_queue_enabled_);
+        tr_logSetFormat(old_format_);
+    }
+
+    // the queued messages that were logged under `name`
+    static std::vector<std::string> takeQueue(std::string_view name)
+    {
+        auto ret = std::vector<std::string>{};
+
+        tr_logFlush();
+        auto* const queue = tr_logGetQueue();
+        for (auto const* msg = queue; msg != nullptr; msg = msg->next)
+        {
+            if (msg->name != nullptr && msg->name == name)
+            {
+                ret.emplace_back(msg->message);
+            }
+        }
+        tr_logFreeQueue(queue);
+
+        return ret;
+    }
+
+    // whether each thread's "thread.message" messages are in the order that thread logged them
+    static bool isInOrderPerThread(std::vector<std::string> const& messages, int n_threads)
+    {
+        auto last = std::vector<int>(n_threads, -1);
+
+        for (auto const& message : messages)
+        {
+            auto thread = int{};
+            auto n = int{};
+            if (sscanf(message.c_str(), "%d.%d", &thread, &n) != 2 || thread < 0 || thread >= n_threads ||
+                n <= last[thread])
+            {
+                return false;
+            }
+
+            last[thread] = n;
+        }
+
+        return true;
+    }
+
+private:
+    tr_log_level old_level_ = TR_LOG_ERROR;
+    bool old_queue_enabled_ = false;
+    tr_log_format old_format_ = TR_LOG_FORMAT_TEXT;
+};
+
+TEST_F(LogTest, queuedMessagesArriveAfterFlush)
+{
+    tr_logSetQueueEnabled(true);
+
+    tr_logAddNamedInfo("log-test", "hello %d", 1);
+    tr_logAddNamedDbg("log-test", "%s", "");
+    tr_logAddNamedError("log-test", "goodbye %s", "world");
+
+    // empty messages are skipped, as before
+    EXPECT_EQ((std::vector<std::string>{ "hello 1", "goodbye world" }), takeQueue("log-test"));
+}
+
+TEST_F(LogTest, levelIsCheckedBeforeFormatting)
+{
+    tr_logSetQueueEnabled(true);
+    tr_logSetLevel(TR_LOG_ERROR);
+
+    auto n_formatted = int{};
+    auto const count = [&n_formatted]()
+    {
+        ++n_formatted;
+        return "counted";
+    };
+
+    tr_logAddNamedDbg("log-test", "%s", count());
+    EXPECT_EQ(0, n_formatted);
+    EXPECT_TRUE(std::empty(takeQueue("log-test")));
+
+    tr_logAddNamedError("log-test", "%s", count());
+    EXPECT_EQ(1, n_formatted);
+    EXPECT_EQ(1U, std::size(takeQueue("log-test")));
+}
+
+TEST_F(LogTest, errorsAreNotDroppedUnderLoad)
+{
+    tr_logSetQueueEnabled(true);
+
+    auto constexpr NumThreads = 4;
+    auto constexpr NumMessages = 1000;
+
+    // more messages than the ring holds, so callers wait for the writer to make room
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < NumThreads; ++i)
+    {
+        threads.emplace_back(
+            [i]()
+            {
+                for (int j = 0; j < NumMessages; ++j)
+                {
+                    tr_logAddNamedError("log-test", "%d.%d", i, j);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto const messages = takeQueue("log-test");
+    EXPECT_EQ(size_t{ NumThreads * NumMessages }, std::size(messages));
+    EXPECT_TRUE(isInOrderPerThread(messages, NumThreads));
+}
+
+TEST_F(LogTest, infoIsNotDroppedUnderLoad)
+{
+    tr_logSetQueueEnabled(true);
+
+    auto constexpr NumThreads = 4;
+    auto constexpr NumMessages = 1000;
+
+    // more messages than the ring holds, so the ring fills up
+    auto threads = std::vector<std::thread>{};
+    for (int i = 0; i < NumThreads; ++i)
+    {
+        threads.emplace_back(
+            [i]()
+            {
+                for (int j = 0; j < NumMessages; ++j)
+                {
+                    tr_logAddNamedInfo("log-test", "%d.%d", i, j);
+                }
+            });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto const messages = takeQueue("log-test");
+    EXPECT_EQ(size_t{ NumThreads * NumMessages }, std::size(messages));
+    EXPECT_TRUE(isInOrderPerThread(messages, NumThreads));
+}
+
+TEST_F(LogTest, jsonLines)
+{
+    tr_logSetQueueEnabled(false);
+    tr_logSetFormat(TR_LOG_FORMAT_JSON);
+    if (tr_logGetFile() != TR_BAD_SYS_FILE)
+    {
+        GTEST_SKIP() << "log messages are going to TR_DEBUG_FD";
+    }
+
+    testing::internal::CaptureStderr();
+    tr_logAddNamedError("log \"test\"", "line one\nline \\two\\ %d", 2);
+    tr_logFlush();
+    auto const output = testing::internal::GetCapturedStderr();
+
+    auto line = std::string_view{ output };
+    ASSERT_EQ('\n', line.back());
+    line.remove_suffix(1);
+    EXPECT_EQ(std::string_view::npos, line.find('\n'));
+
+    auto top = tr_variant{};
+    ASSERT_TRUE(tr_variantFromBuf(&top, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, line));
+
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(&top, tr_quark_new("message"sv), &sv));
+    EXPECT_EQ("line one\nline \\two\\ 2"sv, sv);
+    EXPECT_TRUE(tr_variantDictFindStrView(&top, TR_KEY_name, &sv));
+    EXPECT_EQ("log \"test\""sv, sv);
+    EXPECT_TRUE(tr_variantDictFindStrView(&top, tr_quark_new("level"sv), &sv));
+    EXPECT_EQ("error"sv, sv);
+
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(&top, tr_quark_new("line"sv), &i));
+    EXPECT_GT(i, 0);
+    EXPECT_TRUE(tr_variantDictFindInt(&top, tr_quark_new("time"sv), &i));
+    EXPECT_GT(i, 0);
+
+    tr_variantFree(&top);
+}
@@ -11,6 +11,7 @@
 #include "file.h"
 #include "makemeta.h"
 #include "utils.h" // tr_free()
+#include "variant.h"
 
 #include "test-fixtures.h"
 
@@ -18,6 +19,7 @@
 #include <cstdlib> // mktemp()
 #include <cstring> // strlen()
 #include <string>
+#include <vector>
 
 using namespace std::literals;
 
@@ -311,6 +313,79 @@ TEST_F(MakemetaTest, singleDirectoryRandomPayload)
     }
 }
 
+TEST_F(MakemetaTest, piecesDontDependOnThreadCount)
+{
+    auto constexpr PieceSize = uint32_t{ 16 * 1024 };
+    auto const thread_counts = std::array<uint32_t, 4>{ 1, 2, 3, 8 };
+
+    // files that start and end in the middle of pieces, including an empty one
+    auto top = tr_strvPath(sandboxDir(), "folder.XXXXXX");
+    tr_sys_path_native_separators(std::data(top));
+    tr_sys_dir_create_temp(std::data(top), nullptr);
+
+    auto const file_sizes = std::array<size_t, 5>{ 100000, 0, PieceSize, 3, 250000 };
+    auto payload = std::string{};
+    for (size_t i = 0; i < std::size(file_sizes); ++i)
+    {
+        auto contents = std::string(file_sizes[i], '\0');
+        tr_rand_buffer(std::data(contents), std::size(contents));
+        payload += contents;
+
+        auto path = tr_strvPath(top, "file." + std::to_string(i));
+        createFileWithContents(path, std::data(contents), std::size(contents));
+    }
+
+    sync();
+
+    // the pieces we expect
+    auto expected = std::string{};
+    for (size_t offset = 0; offset < std::size(payload); offset += PieceSize)
+    {
+        auto hash = std::array<uint8_t, SHA_DIGEST_LENGTH>{};
+        auto const len = std::min(std::size(payload) - offset, size_t{ PieceSize });
+        tr_sha1(std::data(hash), std::data(payload) + offset, len, nullptr);
+        expected.append(reinterpret_cast<char const*>(std::data(hash)), std::size(hash));
+    }
+
+    // build them all at once, so that some of them run concurrently
+    auto builders = std::vector<tr_metainfo_builder*>{};
+    for (auto const n_threads : thread_counts)
+    {
+        auto* const builder = tr_metaInfoBuilderCreate(top.c_str());
+        EXPECT_TRUE(tr_metaInfoBuilderSetPieceSize(builder, PieceSize));
+        tr_metaInfoBuilderSetThreadCount(builder, n_threads);
+        EXPECT_EQ(n_threads, builder->threadCount);
+
+        auto const torrent_file = tr_strvJoin(top, "." + std::to_string(n_threads) + ".torrent");
+        tr_makeMetaInfo(builder, torrent_file.c_str(), nullptr, 0, nullptr, false, nullptr);
+        builders.push_back(builder);
+    }
+
+    for (auto* const builder : builders)
+    {
+        auto test = [builder]()
+        {
+            return builder->isDone;
+        };
+        EXPECT_TRUE(waitFor(test, 5000));
+        EXPECT_EQ(TR_MAKEMETA_OK, builder->result);
+        EXPECT_EQ(builder->pieceCount, builder->pieceIndex);
+
+        // check the pieces
+        auto top_dict = tr_variant{};
+        EXPECT_TRUE(tr_variantFromFile(&top_dict, TR_VARIANT_PARSE_BENC, builder->outputFile, nullptr));
+        tr_variant* info = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(&top_dict, TR_KEY_info, &info));
+        uint8_t const* raw = nullptr;
+        auto raw_len = size_t{};
+        EXPECT_TRUE(tr_variantDictFindRaw(info, TR_KEY_pieces, &raw, &raw_len));
+        EXPECT_EQ(expected, std::string(reinterpret_cast<char const*>(raw), raw_len));
+
+        tr_variantFree(&top_dict);
+        tr_metaInfoBuilderFree(builder);
+    }
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,272 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h"
+
+#include "crypto-utils.h"
+#include "metainfo-view.h"
+#include "metainfo.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+
+using MetainfoViewTest = ::testing::Test;
+
+namespace
+{
+
+auto constexpr Pieces = "aaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbb"sv;
+
+std::string makeMultifile(std::string_view files)
+{
+    return tr_strvJoin(
+        "d8:announce22:http://example.com/ann7:comment5:hello4:infod5:files"sv,
+        files,
+        "4:name3:foo12:piece lengthi32768e6:pieces40:"sv,
+        Pieces,
+        "7:privatei1eee"sv);
+}
+
+std::vector<std::string> filePaths(tr_metainfo_view const& view)
+{
+    auto ret = std::vector<std::string>{};
+
+    for (auto it = view.filesBegin(), end = view.filesEnd(); it != end; ++it)
+    {
+        auto path = std::string{};
+        for (auto const component : it->path)
+        {
+            path = tr_strvJoin(path, "/"sv, component);
+        }
+        ret.push_back(path);
+    }
+
+    return ret;
+}
+
+} // namespace
+
+TEST_F(MetainfoViewTest, singleFile)
+{
+    auto const benc = tr_strvJoin(
+        "d8:announce22:http://example.com/ann13:creation datei1234e4:infod6:lengthi40000e4:name5:a.txt"
+        "12:piece lengthi32768e6:pieces40:"sv,
+        Pieces,
+        "6:source3:bare8:url-list19:http://example.com/e"sv);
+
+    auto const view = tr_metainfo_view::parse(benc);
+    ASSERT_TRUE(view);
+    EXPECT_FALSE(view->isMagnet());
+    EXPECT_FALSE(view->isFolder());
+    EXPECT_EQ("a.txt"sv, view->name());
+    EXPECT_EQ(40000, view->length().value_or(0));
+    EXPECT_EQ(32768, view->pieceSize());
+    EXPECT_EQ(2U, view->pieceCount());
+    EXPECT_EQ(1234, view->dateCreated());
+    EXPECT_EQ("bar"sv, view->source());
+    EXPECT_FALSE(view->isPrivate());
+    EXPECT_EQ("http://example.com/ann"sv, view->announce());
+    EXPECT_EQ(std::vector<std::string_view>{ "http://example.com/"sv }, view->urlList());
+    EXPECT_EQ(view->filesBegin(), view->filesEnd());
+
+    auto const piece = view->pieceHash(1);
+    EXPECT_EQ("bbbbbbbbbbbbbbbbbbbb"sv, std::string_view(reinterpret_cast<char const*>(std::data(piece)), std::size(piece)));
+}
+
+TEST_F(MetainfoViewTest, multiFile)
+{
+    auto const benc = makeMultifile(
+        "ld6:lengthi20000e4:pathl1:a5:b.txteed6:lengthi20000e4:pathl5:c.txte10:path.utf-8l5:d.txteee"sv);
+
+    auto const view = tr_metainfo_view::parse(benc);
+    ASSERT_TRUE(view);
+    EXPECT_TRUE(view->isFolder());
+    EXPECT_EQ(nullptr, view->filesError());
+    EXPECT_EQ(2U, view->fileCount());
+    EXPECT_EQ(40000, view->totalSize());
+    EXPECT_TRUE(view->isPrivate());
+    EXPECT_EQ("hello"sv, view->comment());
+
+    // "path.utf-8" is preferred
+    EXPECT_EQ((std::vector<std::string>{ "/a/b.txt", "/d.txt" }), filePaths(*view));
+}
+
+TEST_F(MetainfoViewTest, filesErrors)
+{
+    auto view = tr_metainfo_view::parse(makeMultifile("ld4:pathl1:aeee"sv));
+    ASSERT_TRUE(view);
+    EXPECT_STREQ("length", view->filesError());
+    EXPECT_EQ(view->filesBegin(), view->filesEnd());
+
+    view = tr_metainfo_view::parse(makeMultifile("ld6:lengthi1e4:pathli1eeee"sv));
+    ASSERT_TRUE(view);
+    EXPECT_STREQ("path", view->filesError());
+
+    view = tr_metainfo_view::parse(makeMultifile("li1ee"sv));
+    ASSERT_TRUE(view);
+    EXPECT_STREQ("files", view->filesError());
+}
+
+TEST_F(MetainfoViewTest, infoHashIsOverRawBytes)
+{
+    auto const benc = makeMultifile("ld6:lengthi40000e4:pathl1:aeee"sv);
+    auto const view = tr_metainfo_view::parse(benc);
+    ASSERT_TRUE(view);
+
+    auto const info = view->infoDict();
+    EXPECT_EQ('d', info.front());
+    EXPECT_EQ('e', info.back());
+    EXPECT_EQ(benc.find("4:infod"sv) + 6, view->infoDictOffset());
+    EXPECT_EQ(std::size(benc) - 1, view->infoDictOffset() + std::size(info));
+
+    auto expected = tr_sha1_digest_t{};
+    tr_sha1(reinterpret_cast<uint8_t*>(std::data(expected)), std::data(info), int(std::size(info)), nullptr);
+    EXPECT_EQ(expected, view->infoHash());
+}
+
+TEST_F(MetainfoViewTest, magnet)
+{
+    auto const benc = "d13:announce-listll8:http://aee11:magnet-infod12:display-name3:foo9:info_hash20:aaaaaaaaaaaaaaaaaaaaee"sv;
+
+    auto const view = tr_metainfo_view::parse(benc);
+    ASSERT_TRUE(view);
+    EXPECT_TRUE(view->isMagnet());
+    EXPECT_EQ("foo"sv, view->displayName());
+
+    auto const hash = view->infoHash();
+    ASSERT_TRUE(hash);
+    EXPECT_EQ(std::byte{ 'a' }, hash->front());
+
+    auto const trackers = view->announceList();
+    ASSERT_EQ(1U, std::size(trackers));
+    EXPECT_EQ("http://a"sv, trackers.front().announce);
+}
+
+TEST_F(MetainfoViewTest, announceListTiers)
+{
+    auto const benc = "d13:announce-listll3:onee3:badl3:two5:threeee4:infod6:lengthi1eee"sv;
+
+    auto const view = tr_metainfo_view::parse(benc);
+    ASSERT_TRUE(view);
+
+    auto const trackers = view->announceList();
+    ASSERT_EQ(3U, std::size(trackers));
+    EXPECT_EQ(0U, trackers[0].tier);
+    EXPECT_EQ(2U, trackers[1].tier);
+    EXPECT_EQ(2U, trackers[2].tier);
+    EXPECT_EQ("three"sv, trackers[2].announce);
+}
+
+TEST_F(MetainfoViewTest, malformed)
+{
+    EXPECT_FALSE(tr_metainfo_view::parse(""sv));
+    EXPECT_FALSE(tr_metainfo_view::parse("le"sv));
+    EXPECT_FALSE(tr_metainfo_view::parse("d4:infod"sv));
+    EXPECT_FALSE(tr_metainfo_view::parse("d4:name5:abce"sv));
+    EXPECT_FALSE(tr_metainfo_view::parse("d4:namei01ee"sv));
+    EXPECT_FALSE(tr_metainfo_view::parse("d4:namei-0ee"sv));
+    EXPECT_FALSE(tr_metainfo_view::parse("d4:namei99999999999999999999ee"sv));
+
+    // like the variant parser, bytes that can't start a value are skipped
+    auto const view = tr_metainfo_view::parse("d4:name\x80\x81" "3:fooe"sv);
+    ASSERT_TRUE(view);
+}
+
+TEST_F(MetainfoViewTest, matchesVariantParse)
+{
+    auto const benc = makeMultifile(
+        "ld6:lengthi20000e4:pathl1:a5:b.txteed6:lengthi20000e4:pathl5:c.txteee"sv);
+
+    auto from_bytes = tr_metainfoParse(nullptr, benc, nullptr);
+    ASSERT_TRUE(from_bytes);
+
+    auto top = tr_variant{};
+    ASSERT_TRUE(tr_variantFromBuf(&top, TR_VARIANT_PARSE_BENC, benc));
+    auto from_variant = tr_metainfoParse(nullptr, &top, nullptr);
+    tr_variantFree(&top);
+    ASSERT_TRUE(from_variant);
+
+    auto const& a = from_bytes->info;
+    auto const& b = from_variant->info;
+    EXPECT_STREQ(b.hashString, a.hashString);
+    EXPECT_STREQ(b.name, a.name);
+    EXPECT_STREQ(b.comment, a.comment);
+    EXPECT_EQ(b.isPrivate, a.isPrivate);
+    EXPECT_EQ(b.pieceCount, a.pieceCount);
+    EXPECT_EQ(b.totalSize, a.totalSize);
+    ASSERT_EQ(b.fileCount, a.fileCount);
+    for (tr_file_index_t i = 0; i < a.fileCount; ++i)
+    {
+        EXPECT_STREQ(b.files[i].name, a.files[i].name);
+        EXPECT_EQ(b.files[i].length, a.files[i].length);
+    }
+    EXPECT_EQ(from_variant->pieces, from_bytes->pieces);
+    EXPECT_EQ(from_variant->info_dict_length, from_bytes->info_dict_length);
+}
+
+TEST_F(MetainfoViewTest, defaultName)
+{
+    auto const benc = tr_strvJoin("d4:infod6:lengthi1e12:piece lengthi1e6:pieces20:"sv, Pieces.substr(0, 20), "ee"sv);
+
+    EXPECT_FALSE(tr_metainfoParse(nullptr, benc, nullptr));
+
+    auto const parsed = tr_metainfoParse(nullptr, benc, nullptr, "fallback"sv);
+    ASSERT_TRUE(parsed);
+    EXPECT_STREQ("fallback", parsed->info.name);
+}
+
+TEST_F(MetainfoViewTest, manyFiles)
+{
+    auto constexpr NumFiles = 1024;
+    auto constexpr FileSize = 1024;
+
+    auto files = std::string{ "l" };
+    for (int i = 0; i < NumFiles; ++i)
+    {
+        auto const filename = std::to_string(i) + ".dat";
+        files += tr_strvJoin("d6:lengthi"sv, std::to_string(FileSize), "e4:pathl3:dir"sv);
+        files += tr_strvJoin(std::to_string(std::size(filename)), ":"sv, filename, "ee"sv);
+    }
+    files += 'e';
+
+    auto const n_pieces = size_t{ NumFiles } * FileSize / 32768;
+    auto const benc = tr_strvJoin(
+        "d4:infod5:files"sv,
+        files,
+        "4:name3:foo12:piece lengthi32768e6:pieces"sv,
+        std::to_string(n_pieces * 20),
+        ":"sv,
+        std::string(n_pieces * 20, 'x'),
+        "ee"sv);
+
+    auto const view = tr_metainfo_view::parse(benc);
+    ASSERT_TRUE(view);
+    EXPECT_EQ(size_t{ NumFiles }, view->fileCount());
+    EXPECT_EQ(int64_t{ NumFiles } * FileSize, view->totalSize());
+
+    auto const from_bytes = tr_metainfoParse(nullptr, benc, nullptr);
+    ASSERT_TRUE(from_bytes);
+    ASSERT_EQ(tr_file_index_t{ NumFiles }, from_bytes->info.fileCount);
+    EXPECT_STREQ("foo/dir/1023.dat", from_bytes->info.files[NumFiles - 1].name);
+
+    // the variant path agrees
+    auto top = tr_variant{};
+    ASSERT_TRUE(tr_variantFromBuf(&top, TR_VARIANT_PARSE_BENC, benc));
+    auto const from_variant = tr_metainfoParse(nullptr, &top, nullptr);
+    tr_variantFree(&top);
+    ASSERT_TRUE(from_variant);
+    EXPECT_STREQ(from_variant->info.hashString, from_bytes->info.hashString);
+    EXPECT_EQ(from_variant->info.totalSize, from_bytes->info.totalSize);
+}
@@ -0,0 +1,132 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <memory>
+#include <string>
+
+#include <event2/event.h>
+
+#include "transmission.h"
+
+#include "metrics.h"
+#include "utils.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+
+using MetricsTest = ::testing::Test;
+using Timer = tr_metrics::Timer;
+using Counter = tr_metrics::Counter;
+
+TEST_F(MetricsTest, bucketOf)
+{
+    EXPECT_EQ(0U, tr_metrics::bucketOf(0));
+    EXPECT_EQ(1U, tr_metrics::bucketOf(1));
+    EXPECT_EQ(2U, tr_metrics::bucketOf(2));
+    EXPECT_EQ(2U, tr_metrics::bucketOf(3));
+    EXPECT_EQ(3U, tr_metrics::bucketOf(4));
+    EXPECT_EQ(10U, tr_metrics::bucketOf(1023));
+    EXPECT_EQ(11U, tr_metrics::bucketOf(1024));
+
+    // the last bucket catches everything too big for the others
+    EXPECT_EQ(tr_metrics::NumBuckets - 1, tr_metrics::bucketOf(uint64_t{ 1 } << 40));
+    EXPECT_EQ(tr_metrics::NumBuckets - 1, tr_metrics::bucketOf(UINT64_MAX));
+}
+
+TEST_F(MetricsTest, recordsNothingWhenDisabled)
+{
+    auto metrics = tr_metrics{};
+    EXPECT_FALSE(metrics.isEnabled());
+
+    metrics.record(Timer::RechokePulse, 100);
+    metrics.add(Counter::DiskReads);
+    {
+        auto const timer = metrics.time(Timer::AtomPulse);
+    }
+
+    EXPECT_EQ(0U, metrics.get(Timer::RechokePulse).count);
+    EXPECT_EQ(0U, metrics.get(Timer::AtomPulse).count);
+    EXPECT_EQ(0U, metrics.get(Counter::DiskReads));
+}
+
+TEST_F(MetricsTest, recordsWhenEnabled)
+{
+    auto metrics = tr_metrics{};
+    metrics.setEnabled(true);
+
+    metrics.record(Timer::RechokePulse, 3);
+    metrics.record(Timer::RechokePulse, 1000);
+    metrics.record(Timer::RechokePulse, 5);
+    metrics.add(Counter::DiskWriteBytes, 16384);
+    metrics.add(Counter::DiskWriteBytes, 16384);
+    {
+        auto const timer = metrics.time(Timer::AtomPulse);
+    }
+
+    auto const h = metrics.get(Timer::RechokePulse);
+    EXPECT_EQ(3U, h.count);
+    EXPECT_EQ(1008U, h.total_usec);
+    EXPECT_EQ(1000U, h.max_usec);
+    EXPECT_EQ(1U, h.buckets[2]);
+    EXPECT_EQ(1U, h.buckets[3]);
+    EXPECT_EQ(1U, h.buckets[10]);
+    EXPECT_EQ(1U, metrics.get(Timer::AtomPulse).count);
+    EXPECT_EQ(32768U, metrics.get(Counter::DiskWriteBytes));
+
+    metrics.reset();
+    EXPECT_EQ(0U, metrics.get(Timer::RechokePulse).count);
+    EXPECT_EQ(0U, metrics.get(Counter::DiskWriteBytes));
+}
+
+TEST_F(MetricsTest, prometheus)
+{
+    auto metrics = tr_metrics{};
+    metrics.setEnabled(true);
+    metrics.record(Timer::BandwidthPulse, 3);
+    metrics.record(Timer::BandwidthPulse, 1500000);
+    metrics.add(Counter::BlocksCached, 7);
+
+    auto const text = metrics.toPrometheus();
+    auto const has = [&text](std::string_view line)
+    {
+        return text.find(tr_strvJoin(line, "\n"sv)) != std::string::npos;
+    };
+
+    EXPECT_TRUE(has("# TYPE transmission_bandwidth_pulse_seconds histogram"sv));
+    // buckets are cumulative and their bounds are inclusive
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_bucket{le=\"0.000001\"} 0"sv));
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_bucket{le=\"0.000003\"} 1"sv));
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_bucket{le=\"1.048575\"} 1"sv));
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_bucket{le=\"2.097151\"} 2"sv));
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_bucket{le=\"+Inf\"} 2"sv));
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_sum 1.500003"sv));
+    EXPECT_TRUE(has("transmission_bandwidth_pulse_seconds_count 2"sv));
+    EXPECT_TRUE(has("# TYPE transmission_blocks_cached_total counter"sv));
+    EXPECT_TRUE(has("transmission_blocks_cached_total 7"sv));
+}
+
+TEST_F(MetricsTest, eventLoopLag)
+{
+    auto const base = std::unique_ptr<event_base, void (*)(event_base*)>{ event_base_new(), event_base_free };
+
+    auto metrics = tr_metrics{};
+    metrics.setEnabled(true);
+    metrics.startLagTimer(base.get());
+
+    auto const timeout = timeval{ 0, tr_metrics::LagIntervalMsec * 1000 * 3 + 50000 };
+    event_base_loopexit(base.get(), &timeout);
+    event_base_dispatch(base.get());
+    EXPECT_LE(2U, metrics.get(Timer::EventLoopLag).count);
+
+    // stopping it means the loop has nothing left to wait for
+    metrics.stopLagTimer();
+    auto const count = metrics.get(Timer::EventLoopLag).count;
+    EXPECT_EQ(1, event_base_dispatch(base.get()));
+    EXPECT_EQ(count, metrics.get(Timer::EventLoopLag).count);
+}
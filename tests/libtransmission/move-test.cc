@@ -11,10 +11,15 @@
 #include "transmission.h"
 #include "cache.h" // tr_cacheWriteBlock()
 #include "file.h" // tr_sys_path_*()
+#include "session.h"
+#include "torrent.h"
+#include "torrent-relocate.h"
+#include "trevent.h" // tr_runInEventThread()
 #include "variant.h"
 
 #include "test-fixtures.h"
 
+#include <atomic>
 #include <string>
 #include <utility>
 
@@ -125,6 +130,14 @@ TEST_P(IncompleteDirTest, incompleteDir)
     EXPECT_TRUE(waitFor(test, 300));
     EXPECT_EQ(TR_SEED, completeness);
 
+    // the files are moved to download_dir in the background
+    auto const moved = [tor]()
+    {
+        auto const lock = tor->unique_lock();
+        return tor->currentDir == tor->downloadDir;
+    };
+    EXPECT_TRUE(waitFor(moved, 1000));
+
     auto const n = tr_torrentFileCount(tor);
     for (tr_file_index_t i = 0; i < n; ++i)
     {
@@ -189,6 +202,188 @@ TEST_F(MoveTest, setLocation)
     tr_torrentRemove(tor, true, tr_sys_path_remove);
 }
 
+TEST_F(MoveTest, setLocationReportsProgress)
+{
+    auto const target_dir = tr_strvPath(tr_sessionGetConfigDir(session_), "target");
+
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    blockingTorrentVerify(tor);
+
+    auto progress = double{ -1 };
+    auto state = int{ -1 };
+    tr_torrentSetLocation(tor, target_dir.data(), true, &progress, &state);
+    auto test = [&state]()
+    {
+        return state != TR_LOC_MOVING;
+    };
+    EXPECT_TRUE(waitFor(test, 300));
+    EXPECT_EQ(TR_LOC_DONE, state);
+    EXPECT_EQ(1.0, progress);
+
+    // the torrent switched over to the new location
+    EXPECT_EQ(target_dir, tr_torrentGetDownloadDir(tor));
+    EXPECT_EQ(tr_strvPath(target_dir.data(), tr_torrentFile(tor, 0).name), makeString(tr_torrentFindFile(tor, 0)));
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(MoveTest, setLocationCanBeCancelled)
+{
+    auto const target_dir = tr_strvPath(tr_sessionGetConfigDir(session_), "target");
+
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    blockingTorrentVerify(tor);
+    auto const old_dir = std::string{ tr_torrentGetDownloadDir(tor) };
+    auto const n = tr_torrentFileCount(tor);
+
+    // the cancel is queued behind the move, and holding the session lock keeps the
+    // move from starting until both are queued, so the cancel lands while it's running
+    auto state = int{ -1 };
+    {
+        auto const lock = session_->unique_lock();
+        tr_torrentSetLocation(tor, target_dir.data(), true, nullptr, &state);
+        tr_torrentCancelSetLocation(tor);
+    }
+
+    auto test = [&state]()
+    {
+        return state != TR_LOC_MOVING;
+    };
+    EXPECT_TRUE(waitFor(test, 300));
+    EXPECT_EQ(TR_LOC_ERROR, state);
+
+    // the files didn't move
+    EXPECT_EQ(old_dir, tr_torrentGetDownloadDir(tor));
+    for (tr_file_index_t i = 0; i < n; ++i)
+    {
+        auto const newpath = tr_strvPath(target_dir.data(), tr_torrentFile(tor, i).name);
+        EXPECT_EQ(tr_strvPath(old_dir, tr_torrentFile(tor, i).name), makeString(tr_torrentFindFile(tor, i)));
+        EXPECT_FALSE(tr_sys_path_exists(newpath.c_str(), nullptr));
+        EXPECT_FALSE(tr_sys_path_exists(tr_strvJoin(newpath, ".relocating").c_str(), nullptr));
+    }
+
+    // cancelling when nothing's being moved is harmless
+    tr_torrentCancelSetLocation(tor);
+
+    // and the torrent can still be moved
+    tr_torrentSetLocation(tor, target_dir.data(), true, nullptr, &state);
+    EXPECT_TRUE(waitFor(test, 300));
+    EXPECT_EQ(TR_LOC_DONE, state);
+    EXPECT_EQ(target_dir, tr_torrentGetDownloadDir(tor));
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(MoveTest, filesThatChangeAcrossFilesystemsAreCopiedAgainInTheBackground)
+{
+    // the target has to be on another filesystem, or nothing gets copied
+    auto tmpl = std::string{ "/dev/shm/transmission-test-XXXXXX" };
+    if (!tr_sys_dir_create_temp(std::data(tmpl), nullptr))
+    {
+        GTEST_SKIP() << "no /dev/shm";
+    }
+
+    auto const target_dir = tr_strvPath(tmpl, "target");
+    if (tr_sys_path_is_same_filesystem(tmpl.c_str(), sandboxDir().c_str(), nullptr))
+    {
+        tr_sys_path_remove(tmpl.c_str(), nullptr);
+        GTEST_SKIP() << "/dev/shm is on the same filesystem as " << sandboxDir();
+    }
+
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    blockingTorrentVerify(tor);
+    tr_torrentStart(tor);
+    EXPECT_TRUE(waitFor([tor]() { return tor->isRunning; }, 1000));
+
+    struct Data
+    {
+        tr_torrent* tor = nullptr;
+        int volatile state = -1;
+        std::atomic<bool> changed = false;
+        std::atomic<bool> observer_queued = false;
+        std::atomic<bool> paused_while_moving = false;
+        std::atomic<bool> observed = false;
+    };
+
+    auto data = Data{};
+    data.tor = tor;
+
+    // Once the copies are made, and before the switch-over runs, change a file.
+    // Holding the session lock keeps the move from starting until this is queued behind it.
+    {
+        auto const lock = session_->unique_lock();
+        tr_torrentSetLocation(tor, target_dir.data(), true, nullptr, &data.state);
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const data = static_cast<Data*>(vdata);
+                auto const copied = [data]()
+                {
+                    return data->tor->relocation != nullptr && data->tor->relocation->isDone();
+                };
+                EXPECT_TRUE(waitFor(copied, 5000));
+                tr_wait_msec(100); // let the worker queue the switch-over
+
+                data->tor->setHasPiece(0, false);
+                data->changed = true;
+                EXPECT_TRUE(waitFor([data]() { return data->observer_queued.load(); }, 5000));
+            },
+            &data);
+    }
+
+    // queued right behind the switch-over
+    EXPECT_TRUE(waitFor([&data]() { return data.changed.load(); }, 5000));
+    tr_runInEventThread(
+        session_,
+        [](void* vdata)
+        {
+            auto* const data = static_cast<Data*>(vdata);
+            data->paused_while_moving = data->state == TR_LOC_MOVING && !data->tor->isRunning &&
+                data->tor->relocation != nullptr;
+            data->observed = true;
+        },
+        &data);
+    data.observer_queued = true;
+
+    // the changed file was copied again by the workers, with the torrent paused
+    EXPECT_TRUE(waitFor([&data]() { return data.observed.load() && data.state != TR_LOC_MOVING; }, 5000));
+    EXPECT_TRUE(data.paused_while_moving);
+    EXPECT_EQ(TR_LOC_DONE, data.state);
+    EXPECT_TRUE(waitFor([tor]() { return tor->isRunning; }, 1000));
+
+    // and the files that arrived are the right ones
+    EXPECT_EQ(target_dir, tr_torrentGetDownloadDir(tor));
+    blockingTorrentVerify(tor);
+    EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
+    auto const n = tr_torrentFileCount(tor);
+    for (tr_file_index_t i = 0; i < n; ++i)
+    {
+        auto const newpath = tr_strvPath(target_dir.data(), tr_torrentFile(tor, i).name);
+        EXPECT_EQ(newpath, makeString(tr_torrentFindFile(tor, i)));
+        EXPECT_FALSE(tr_sys_path_exists(tr_strvJoin(newpath, ".relocating").c_str(), nullptr));
+    }
+
+    // cleanup. The sandbox doesn't cover /dev/shm, so remove what's there before the torrent goes
+    for (tr_file_index_t i = 0; i < n; ++i)
+    {
+        auto path = tr_strvPath(target_dir.data(), tr_torrentFile(tor, i).name);
+        while (path != tmpl)
+        {
+            tr_sys_path_remove(path.c_str(), nullptr);
+            path = makeString(tr_sys_path_dirname(path, nullptr));
+        }
+    }
+
+    tr_sys_path_remove(tmpl.c_str(), nullptr);
+    tr_torrentRemove(tor, false, nullptr);
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,174 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#ifndef _WIN32
+#include <netinet/tcp.h> /* TCP_CORK */
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "transmission.h"
+
+#include "bandwidth.h"
+#include "net.h"
+#include "peer-io.h"
+#include "session.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class PeerIoTest : public SessionTest
+{
+protected:
+    void runInEventThread(std::function<void()> func)
+    {
+        struct Data
+        {
+            std::function<void()> func;
+            bool done = false;
+        };
+
+        auto data = Data{ std::move(func) };
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const data = static_cast<Data*>(vdata);
+                data->func();
+                data->done = true;
+            },
+            &data);
+        EXPECT_TRUE(waitFor([&data]() { return data.done; }, 2000));
+    }
+};
+
+#ifndef _WIN32
+
+TEST_F(PeerIoTest, queuedMessagesGoOutInOneWrite)
+{
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    auto& metrics = session_->metrics;
+    metrics.setEnabled(true);
+
+    // a few protocol messages queued ahead of a piece message
+    auto const protocol_msgs = std::string(3 * 9, 'p');
+    auto const piece_msg = std::string(13 + 16384, 'b');
+    auto const expected = protocol_msgs + piece_msg;
+
+    auto writes = uint64_t{};
+    auto bytes = uint64_t{};
+
+    runInEventThread(
+        [&]()
+        {
+            auto addr = tr_address{};
+            tr_address_from_string(&addr, "127.0.0.1");
+            auto const socket = tr_peer_socket_tcp_create(fds[0]);
+            auto* const io = tr_peerIoNewIncoming(session_, session_->bandwidth, &addr, htons(6881), socket);
+
+            tr_peerIoWriteBytes(io, std::data(protocol_msgs), std::size(protocol_msgs), false);
+            tr_peerIoWriteBytes(io, std::data(piece_msg), std::size(piece_msg), true);
+
+            auto const writes_before = metrics.get(tr_metrics::Counter::PeerWrites);
+            auto const bytes_before = metrics.get(tr_metrics::Counter::PeerWriteBytes);
+            tr_peerIoFlush(io, TR_UP, SIZE_MAX);
+            writes = metrics.get(tr_metrics::Counter::PeerWrites) - writes_before;
+            bytes = metrics.get(tr_metrics::Counter::PeerWriteBytes) - bytes_before;
+
+            tr_peerIoUnref(io);
+        });
+
+    EXPECT_EQ(1U, writes);
+    EXPECT_EQ(std::size(expected), bytes);
+
+    auto received = std::string(std::size(expected), '\0');
+    auto n_received = size_t{};
+    while (n_received < std::size(received))
+    {
+        auto const n = read(fds[1], std::data(received) + n_received, std::size(received) - n_received);
+        if (n <= 0)
+        {
+            break;
+        }
+
+        n_received += n;
+    }
+
+    EXPECT_EQ(expected, received);
+
+    close(fds[1]);
+}
+
+TEST_F(PeerIoTest, busyPeersStayCorkedBetweenPulses)
+{
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+    auto corked_while_busy = false;
+    auto corked_when_done = true;
+
+    runInEventThread(
+        [&]()
+        {
+            auto addr = tr_address{};
+            tr_address_from_string(&addr, "127.0.0.1");
+            auto const socket = tr_peer_socket_tcp_create(fds[0]);
+            auto* const io = tr_peerIoNewIncoming(session_, session_->bandwidth, &addr, htons(6881), socket);
+
+            // a few piece messages, more than a throttled pulse can send
+            auto const piece_msgs = std::string(4 * (13 + 16384), 'b');
+            tr_peerIoWriteBytes(io, std::data(piece_msgs), std::size(piece_msgs), true);
+
+            tr_sessionSetSpeedLimit_KBps(session_, TR_UP, 16);
+            tr_sessionLimitSpeed(session_, TR_UP, true);
+            session_->bandwidth->allocate(TR_UP, 500);
+            corked_while_busy = io->isCorked;
+
+            tr_sessionLimitSpeed(session_, TR_UP, false);
+            session_->bandwidth->allocate(TR_UP, 500);
+            corked_when_done = io->isCorked;
+
+            tr_peerIoUnref(io);
+        });
+
+    EXPECT_TRUE(corked_while_busy);
+    EXPECT_FALSE(corked_when_done);
+
+    close(fds[1]);
+}
+
+TEST_F(PeerIoTest, corkTcpSockets)
+{
+#if !defined(TCP_CORK) && !defined(TCP_NOPUSH)
+    GTEST_SKIP() << "no way to cork a socket on this platform";
+#endif
+
+    auto const sock = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(TR_BAD_SOCKET, sock);
+    EXPECT_TRUE(tr_netSetCorked(sock, true));
+    EXPECT_TRUE(tr_netSetCorked(sock, false));
+    close(sock);
+}
+
+#endif
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,225 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+
+#include "peer-mgr-choker.h"
+
+#include "gtest/gtest.h"
+
+class PeerMgrChokerTest : public ::testing::Test
+{
+protected:
+    // the choker never dereferences its peers, so fake ones are fine
+    static tr_peerMsgs* fakePeer(uintptr_t i)
+    {
+        return reinterpret_cast<tr_peerMsgs*>((i + 1) * 16);
+    }
+
+    static std::vector<Choker::Peer> makePeers(size_t n)
+    {
+        auto peers = std::vector<Choker::Peer>(n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            peers[i].msgs = fakePeer(i);
+            peers[i].is_interested = true;
+        }
+
+        return peers;
+    }
+
+    // run a rechoke, feed the decisions back into `peers`, and return the unchoked ones
+    static std::set<tr_peerMsgs*> rechoke(
+        Choker& choker,
+        std::vector<Choker::Peer>& peers,
+        tr_choke_algorithm algorithm,
+        size_t slots,
+        bool is_seeding = false,
+        bool is_maxed_out = false)
+    {
+        for (auto const& peer : peers)
+        {
+            choker.add(peer);
+        }
+
+        auto const& decisions = choker.rechoke(algorithm, slots, is_seeding, is_maxed_out);
+        EXPECT_EQ(std::size(peers), std::size(decisions));
+
+        auto choked = std::map<tr_peerMsgs*, bool>{ std::begin(decisions), std::end(decisions) };
+        auto unchoked = std::set<tr_peerMsgs*>{};
+
+        for (auto& peer : peers)
+        {
+            peer.is_choked = choked.at(peer.msgs);
+
+            if (!peer.is_choked)
+            {
+                unchoked.insert(peer.msgs);
+            }
+        }
+
+        return unchoked;
+    }
+};
+
+TEST_F(PeerMgrChokerTest, titForTatUnchokesTheFastestPeers)
+{
+    auto choker = Choker{};
+    auto peers = makePeers(10);
+    for (size_t i = 0; i < std::size(peers); ++i)
+    {
+        peers[i].rate = (i + 1) * 10000;
+    }
+
+    auto const unchoked = rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 4);
+
+    // the four fastest, plus one optimistic unchoke from the rest
+    auto const* const optimistic = choker.optimistic();
+    ASSERT_NE(nullptr, optimistic);
+    EXPECT_EQ(5U, std::size(unchoked));
+    EXPECT_EQ(1U, unchoked.count(choker.optimistic()));
+    for (uintptr_t i = 6; i < 10; ++i)
+    {
+        EXPECT_EQ(1U, unchoked.count(fakePeer(i)));
+        EXPECT_NE(fakePeer(i), optimistic);
+    }
+}
+
+TEST_F(PeerMgrChokerTest, titForTatHonorsMaxedOutBandwidth)
+{
+    auto choker = Choker{};
+    auto peers = makePeers(4);
+    for (size_t i = 0; i < std::size(peers); ++i)
+    {
+        peers[i].rate = (i + 1) * 10000;
+    }
+
+    // when we're maxed out, nobody new gets unchoked and nobody is optimistic
+    auto const unchoked = rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 2, false, true);
+    EXPECT_TRUE(std::empty(unchoked));
+    EXPECT_EQ(nullptr, choker.optimistic());
+}
+
+TEST_F(PeerMgrChokerTest, onlySignificantRateChangesRerank)
+{
+    auto choker = Choker{};
+    auto peers = makePeers(3);
+    peers[0].rate = 100000;
+    peers[1].rate = 99000;
+    peers[1].is_interested = false;
+    peers[2].rate = 50000;
+
+    // peer 0 takes the only slot; uninterested peer 1 ranks below it so stays choked
+    auto unchoked = rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 1);
+    EXPECT_EQ(1U, unchoked.count(fakePeer(0)));
+    EXPECT_EQ(0U, unchoked.count(fakePeer(1)));
+
+    // a small bump isn't enough to re-rank peer 1
+    peers[1].rate = 105000;
+    unchoked = rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 1);
+    EXPECT_EQ(1U, unchoked.count(fakePeer(0)));
+    EXPECT_EQ(0U, unchoked.count(fakePeer(1)));
+
+    // but a big one is, and faster uninterested peers get unchoked
+    peers[1].rate = 200000;
+    unchoked = rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 1);
+    EXPECT_EQ(1U, unchoked.count(fakePeer(0)));
+    EXPECT_EQ(1U, unchoked.count(fakePeer(1)));
+}
+
+TEST_F(PeerMgrChokerTest, forgetsPeersThatAreRemovedOrNotAdded)
+{
+    auto choker = Choker{};
+    auto peers = makePeers(5);
+    static_cast<void>(rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 2));
+
+    choker.remove(peers[4].msgs);
+    peers.pop_back();
+    EXPECT_NE(fakePeer(4), choker.optimistic());
+
+    // peer 3 is still connected, but e.g. became a seed so wasn't added
+    auto const dropped = peers.back();
+    peers.pop_back();
+    static_cast<void>(rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 2));
+
+    // a new peer at a recycled address starts fresh
+    peers.push_back(dropped);
+    static_cast<void>(rechoke(choker, peers, TR_CHOKE_TIT_FOR_TAT, 2));
+}
+
+TEST_F(PeerMgrChokerTest, roundRobinGivesEveryoneATurn)
+{
+    auto constexpr Slots = size_t{ 2 };
+    auto choker = Choker{};
+    auto peers = makePeers(6);
+    for (size_t i = 0; i < std::size(peers); ++i)
+    {
+        // rates don't matter in round-robin
+        peers[i].rate = (i + 1) * 100000;
+    }
+
+    auto served = std::set<tr_peerMsgs*>{};
+    auto previous = std::set<tr_peerMsgs*>{};
+
+    for (int i = 0; i < 9; ++i)
+    {
+        auto const unchoked = rechoke(choker, peers, TR_CHOKE_ROUND_ROBIN, Slots, true);
+        EXPECT_EQ(Slots, std::size(unchoked));
+        EXPECT_EQ(nullptr, choker.optimistic());
+
+        // slots only change hands at the end of a turn
+        if (i % 3 != 0)
+        {
+            EXPECT_EQ(previous, unchoked);
+        }
+
+        served.insert(std::begin(unchoked), std::end(unchoked));
+        previous = unchoked;
+    }
+
+    EXPECT_EQ(std::size(peers), std::size(served));
+}
+
+TEST_F(PeerMgrChokerTest, roundRobinKeepsSlotsWhenNobodyIsWaiting)
+{
+    auto choker = Choker{};
+    auto peers = makePeers(3);
+    peers[2].is_interested = false;
+
+    auto const first = rechoke(choker, peers, TR_CHOKE_ROUND_ROBIN, 2, true);
+    EXPECT_EQ((std::set<tr_peerMsgs*>{ fakePeer(0), fakePeer(1) }), first);
+
+    for (int i = 0; i < 5; ++i)
+    {
+        EXPECT_EQ(first, rechoke(choker, peers, TR_CHOKE_ROUND_ROBIN, 2, true));
+    }
+}
+
+TEST_F(PeerMgrChokerTest, roundRobinIsOnlyForSeeding)
+{
+    auto choker = Choker{};
+    auto peers = makePeers(4);
+    for (size_t i = 0; i < std::size(peers); ++i)
+    {
+        peers[i].rate = (i + 1) * 100000;
+    }
+
+    // while downloading, reciprocation matters more, so it's tit-for-tat
+    auto const unchoked = rechoke(choker, peers, TR_CHOKE_ROUND_ROBIN, 1, false);
+    EXPECT_EQ(1U, unchoked.count(fakePeer(3)));
+    EXPECT_NE(nullptr, choker.optimistic());
+}
@@ -0,0 +1,166 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define LIBTRANSMISSION_PEER_MODULE
+
+#include "transmission.h"
+
+#include "net.h"
+#include "peer-mgr-pex.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+
+class PeerMgrPexTest : public ::testing::Test
+{
+protected:
+    static tr_pex makePex(std::string_view address, tr_port port = 51413)
+    {
+        auto pex = tr_pex{};
+        EXPECT_TRUE(tr_address_from_string(&pex.addr, address));
+        pex.port = htons(port);
+        return pex;
+    }
+
+    static std::vector<tr_pex> sorted(std::vector<tr_pex> pex)
+    {
+        std::sort(std::begin(pex), std::end(pex), [](auto const& a, auto const& b) { return tr_pexCompare(&a, &b) < 0; });
+        return pex;
+    }
+
+    struct Decoded
+    {
+        std::vector<std::string> added;
+        std::vector<std::string> dropped;
+    };
+
+    // decode a ut_pex payload into the addresses it adds and drops
+    static Decoded decode(std::string const& message)
+    {
+        auto top = tr_variant{};
+        auto ret = Decoded{};
+        EXPECT_TRUE(tr_variantFromBuf(&top, TR_VARIANT_PARSE_BENC, message));
+
+        auto const collect = [&top](tr_quark key, bool ipv6, std::vector<std::string>& setme)
+        {
+            auto const* raw = static_cast<uint8_t const*>(nullptr);
+            auto len = size_t{};
+            if (!tr_variantDictFindRaw(&top, key, &raw, &len))
+            {
+                return;
+            }
+
+            auto n = size_t{};
+            auto* const pex = ipv6 ? tr_peerMgrCompact6ToPex(raw, len, nullptr, 0, &n) :
+                                     tr_peerMgrCompactToPex(raw, len, nullptr, 0, &n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                char buf[TR_ADDRSTRLEN];
+                setme.emplace_back(tr_address_to_string_with_buf(&pex[i].addr, buf, sizeof(buf)));
+            }
+            tr_free(pex);
+        };
+
+        collect(TR_KEY_added, false, ret.added);
+        collect(TR_KEY_added6, true, ret.added);
+        collect(TR_KEY_dropped, false, ret.dropped);
+        collect(TR_KEY_dropped6, true, ret.dropped);
+        std::sort(std::begin(ret.added), std::end(ret.added));
+        std::sort(std::begin(ret.dropped), std::end(ret.dropped));
+
+        tr_variantFree(&top);
+        return ret;
+    }
+};
+
+TEST_F(PeerMgrPexTest, newPeersGetEverything)
+{
+    auto snapshot = PexSnapshot{};
+    EXPECT_EQ(0U, snapshot.version());
+    EXPECT_EQ(""sv, snapshot.message(0));
+
+    snapshot.update(sorted({ makePex("10.0.0.1"), makePex("10.0.0.2"), makePex("fe80::1") }));
+    EXPECT_EQ(1U, snapshot.version());
+
+    auto const decoded = decode(snapshot.message(0));
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.1", "10.0.0.2", "fe80::1" }), decoded.added);
+    EXPECT_TRUE(std::empty(decoded.dropped));
+
+    // peers that are up to date have nothing to send
+    EXPECT_EQ(""sv, snapshot.message(1));
+}
+
+TEST_F(PeerMgrPexTest, unchangedListKeepsItsVersion)
+{
+    auto snapshot = PexSnapshot{};
+    snapshot.update(sorted({ makePex("10.0.0.1"), makePex("10.0.0.2") }));
+    snapshot.update(sorted({ makePex("10.0.0.2"), makePex("10.0.0.1") }));
+    EXPECT_EQ(1U, snapshot.version());
+}
+
+TEST_F(PeerMgrPexTest, changesAreReplayedFromThePeersVersion)
+{
+    auto snapshot = PexSnapshot{};
+    snapshot.update(sorted({ makePex("10.0.0.1"), makePex("10.0.0.2") }));
+    snapshot.update(sorted({ makePex("10.0.0.2"), makePex("10.0.0.3") }));
+    snapshot.update(sorted({ makePex("10.0.0.1"), makePex("10.0.0.3"), makePex("fe80::1") }));
+    EXPECT_EQ(3U, snapshot.version());
+
+    // 10.0.0.1 was dropped and then re-added, so a peer at version 1 never hears of it
+    auto decoded = decode(snapshot.message(1));
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.3", "fe80::1" }), decoded.added);
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.2" }), decoded.dropped);
+
+    decoded = decode(snapshot.message(2));
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.1", "fe80::1" }), decoded.added);
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.2" }), decoded.dropped);
+
+    decoded = decode(snapshot.message(0));
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.1", "10.0.0.3", "fe80::1" }), decoded.added);
+    EXPECT_TRUE(std::empty(decoded.dropped));
+}
+
+TEST_F(PeerMgrPexTest, peersAtTheSameVersionShareAMessage)
+{
+    auto snapshot = PexSnapshot{};
+    snapshot.update(sorted({ makePex("10.0.0.1") }));
+    snapshot.update(sorted({ makePex("10.0.0.2") }));
+
+    auto const* const message = &snapshot.message(1);
+    EXPECT_FALSE(std::empty(*message));
+    EXPECT_EQ(message, &snapshot.message(1));
+    EXPECT_NE(message, &snapshot.message(0));
+}
+
+TEST_F(PeerMgrPexTest, peersBehindTheLogStartOver)
+{
+    auto snapshot = PexSnapshot{};
+
+    for (size_t i = 0; i <= PexSnapshot::MaxLogSize + 1; ++i)
+    {
+        snapshot.update({ makePex("10.0.0.1", tr_port(1000 + i)) });
+    }
+
+    // the peer at version 1 can't be told what was dropped, but it still learns who's connected
+    auto const decoded = decode(snapshot.message(1));
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.1" }), decoded.added);
+    EXPECT_TRUE(std::empty(decoded.dropped));
+
+    // a peer that's only one version behind is told the port changed
+    auto const recent = decode(snapshot.message(snapshot.version() - 1));
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.1" }), recent.added);
+    EXPECT_EQ((std::vector<std::string>{ "10.0.0.1" }), recent.dropped);
+}
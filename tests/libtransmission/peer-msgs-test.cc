@@ -6,11 +6,39 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <event2/util.h> // evutil_make_socket_nonblocking()
+
 #include "transmission.h"
+
+#include "fdlimit.h"
+#include "net.h"
+#include "peer-mgr.h"
 #include "peer-msgs.h"
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
 #include "utils.h"
 
-#include "gtest/gtest.h"
+#include "test-fixtures.h"
+
+using namespace std::literals;
 
 TEST(PeerMsgs, placeholder)
 {
@@ -40,3 +68,367 @@ TEST(PeerMsgs, placeholder)
 
 #endif
 }
+
+#ifndef _WIN32
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+auto constexpr BtUnchoke = uint8_t{ 1 };
+auto constexpr BtInterested = uint8_t{ 2 };
+auto constexpr BtHave = uint8_t{ 4 };
+auto constexpr BtBitfield = uint8_t{ 5 };
+auto constexpr BtRequest = uint8_t{ 6 };
+auto constexpr BtPiece = uint8_t{ 7 };
+
+auto constexpr BlockSize = uint32_t{ 16384 };
+
+struct Message
+{
+    uint8_t id = 0;
+    std::string payload;
+
+    [[nodiscard]] uint32_t u32(size_t offset) const
+    {
+        auto val = uint32_t{};
+        memcpy(&val, std::data(payload) + offset, sizeof(val));
+        return ntohl(val);
+    }
+
+    [[nodiscard]] bool isHave(tr_piece_index_t piece) const
+    {
+        return id == BtHave && u32(0) == piece;
+    }
+};
+
+std::string u32(uint32_t val)
+{
+    val = htonl(val);
+    return std::string(reinterpret_cast<char const*>(&val), sizeof(val));
+}
+
+std::string makeMessage(uint8_t id, std::string_view payload = {})
+{
+    return u32(1 + std::size(payload)) + char(id) + std::string{ payload };
+}
+
+// the remote end of a plaintext BitTorrent connection, driven by the test
+class FakePeer
+{
+public:
+    explicit FakePeer(tr_socket_t sock)
+        : sock_{ sock }
+    {
+    }
+
+    FakePeer(FakePeer const&) = delete;
+    FakePeer& operator=(FakePeer const&) = delete;
+
+    ~FakePeer()
+    {
+        close(sock_);
+    }
+
+    void send(std::string_view data) const
+    {
+        while (!std::empty(data))
+        {
+            auto const n = ::send(sock_, std::data(data), std::size(data), 0);
+            ASSERT_GT(n, 0);
+            data.remove_prefix(n);
+        }
+    }
+
+    void sendHandshake(tr_torrent const* tor) const
+    {
+        auto const flags = std::string(8, '\0');
+        auto const* const hash = reinterpret_cast<char const*>(tor->info.hash);
+        send("\023BitTorrent protocol"sv);
+        send(flags);
+        send(std::string_view{ hash, SHA_DIGEST_LENGTH });
+        send("-TT0000-fakepeer0000"sv);
+    }
+
+    // reads until `test` matches a message or `timeout` passes
+    std::optional<Message> waitFor(std::function<bool(Message const&)> const& test, std::chrono::milliseconds timeout)
+    {
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+
+        for (;;)
+        {
+            while (auto msg = popMessage())
+            {
+                received.push_back(*msg);
+
+                if (test(*msg))
+                {
+                    return msg;
+                }
+            }
+
+            auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            auto pfd = pollfd{ sock_, POLLIN, 0 };
+            if (left.count() <= 0 || poll(&pfd, 1, left.count()) <= 0)
+            {
+                return {};
+            }
+
+            char buf[4096];
+            auto const n = recv(sock_, buf, sizeof(buf), 0);
+            if (n <= 0)
+            {
+                return {};
+            }
+
+            inbuf_.append(buf, n);
+        }
+    }
+
+    std::optional<Message> waitFor(uint8_t id, std::chrono::milliseconds timeout)
+    {
+        return waitFor([id](auto const& msg) { return msg.id == id; }, timeout);
+    }
+
+    [[nodiscard]] std::optional<size_t> indexOf(std::function<bool(Message const&)> const& test) const
+    {
+        auto const it = std::find_if(std::begin(received), std::end(received), test);
+        return it == std::end(received) ? std::nullopt : std::make_optional(std::distance(std::begin(received), it));
+    }
+
+    // every message read so far, oldest first
+    std::vector<Message> received;
+
+private:
+    std::optional<Message> popMessage()
+    {
+        // the handshake reply is the only thing that isn't length-prefixed
+        if (!got_handshake_)
+        {
+            if (std::size(inbuf_) < 68)
+            {
+                return {};
+            }
+
+            inbuf_.erase(0, 68);
+            got_handshake_ = true;
+        }
+
+        while (std::size(inbuf_) >= 4)
+        {
+            auto len = uint32_t{};
+            memcpy(&len, std::data(inbuf_), sizeof(len));
+            len = ntohl(len);
+
+            if (std::size(inbuf_) < 4 + len)
+            {
+                return {};
+            }
+
+            if (len == 0) // keepalive
+            {
+                inbuf_.erase(0, 4);
+                continue;
+            }
+
+            auto msg = Message{ uint8_t(inbuf_[4]), inbuf_.substr(5, len - 1) };
+            inbuf_.erase(0, 4 + len);
+            return msg;
+        }
+
+        return {};
+    }
+
+    tr_socket_t const sock_;
+    std::string inbuf_;
+    bool got_handshake_ = false;
+};
+
+} // namespace
+
+class PeerMsgsTest : public SessionTest
+{
+protected:
+    void runInEventThread(std::function<void()> func)
+    {
+        struct Data
+        {
+            std::function<void()> func;
+            bool done = false;
+        };
+
+        auto data = Data{ std::move(func) };
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const data = static_cast<Data*>(vdata);
+                data->func();
+                data->done = true;
+            },
+            &data);
+        EXPECT_TRUE(waitFor([&data]() { return data.done; }, 2000));
+    }
+
+    // a running torrent that's missing its first `n_missing` pieces
+    tr_torrent* partialTorrent(tr_piece_index_t n_missing)
+    {
+        auto* const tor = zeroTorrentInit();
+        zeroTorrentPopulate(tor, false);
+
+        auto* const path = tr_torrentFindFile(tor, 0);
+        auto const fd = tr_sys_file_open(path, TR_SYS_FILE_WRITE, 0, nullptr);
+        auto const junk = std::vector<char>(tor->info.pieceSize * n_missing, '\1');
+        blockingFileWrite(fd, std::data(junk), std::size(junk));
+        tr_sys_file_close(fd, nullptr);
+        tr_free(path);
+        blockingTorrentVerify(tor);
+        EXPECT_EQ(uint64_t{ tor->info.pieceSize } * n_missing, tr_torrentStat(tor)->leftUntilDone);
+
+        tr_torrentStart(tor);
+        EXPECT_TRUE(waitFor([tor]() { return tr_torrentStat(tor)->activity == TR_STATUS_DOWNLOAD; }, 2000));
+        return tor;
+    }
+
+    // a FakePeer that's finished its handshake with `tor`
+    std::unique_ptr<FakePeer> connect(tr_torrent const* tor)
+    {
+        auto const listener = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_NE(TR_BAD_SOCKET, listener);
+        auto listen_addr = sockaddr_in{};
+        listen_addr.sin_family = AF_INET;
+        listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        auto addr_len = socklen_t{ sizeof(listen_addr) };
+        EXPECT_EQ(0, bind(listener, reinterpret_cast<sockaddr const*>(&listen_addr), sizeof(listen_addr)));
+        EXPECT_EQ(0, listen(listener, 1));
+        EXPECT_EQ(0, getsockname(listener, reinterpret_cast<sockaddr*>(&listen_addr), &addr_len));
+
+        auto const sock = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_EQ(0, ::connect(sock, reinterpret_cast<sockaddr const*>(&listen_addr), sizeof(listen_addr)));
+        auto peer = std::make_unique<FakePeer>(sock);
+
+        runInEventThread(
+            [&]()
+            {
+                // TEST-NET-1 (RFC 5737), so nothing tries to dial it for real
+                auto addr = tr_address{};
+                tr_address_from_string(&addr, "192.0.2.1");
+
+                auto accepted_addr = tr_address{};
+                auto accepted_port = tr_port{};
+                auto const accepted = tr_fdSocketAccept(session_, listener, &accepted_addr, &accepted_port);
+                EXPECT_NE(TR_BAD_SOCKET, accepted);
+                evutil_make_socket_nonblocking(accepted);
+                tr_peerMgrAddIncoming(session_->peerMgr, &addr, htons(51413), tr_peer_socket_tcp_create(accepted));
+            });
+        close(listener);
+
+        peer->sendHandshake(tor);
+        return peer;
+    }
+
+    // a Bitfield message saying that we have every piece but `missing`
+    static std::string bitfield(tr_torrent const* tor, std::optional<tr_piece_index_t> missing = {})
+    {
+        auto bits = std::string((tor->info.pieceCount + 7) / 8, '\0');
+        for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
+        {
+            if (i != missing)
+            {
+                bits[i / 8] |= char(0x80 >> (i % 8));
+            }
+        }
+
+        return makeMessage(BtBitfield, bits);
+    }
+
+    static std::string block(tr_piece_index_t piece, uint32_t offset)
+    {
+        return makeMessage(BtPiece, u32(piece) + u32(offset) + std::string(BlockSize, '\0'));
+    }
+};
+
+TEST_F(PeerMsgsTest, havesForAPulseGoOutTogether)
+{
+    auto* const tor = partialTorrent(2);
+    auto peer = connect(tor);
+    peer->send(bitfield(tor));
+    peer->send(makeMessage(BtUnchoke));
+
+    // the torrent decides it's interested on its next rechoke. Wait for it
+    // to ask for all four blocks, then send them in one go
+    auto n_requests = 0;
+    auto const got_requests = peer->waitFor(
+        [&n_requests](auto const& msg) { return msg.id == BtRequest && ++n_requests == 4; },
+        std::chrono::seconds{ 15 });
+    ASSERT_TRUE(got_requests);
+    peer->send(block(0, 0) + block(0, BlockSize) + block(1, 0) + block(1, BlockSize));
+
+    // both pieces were completed before the next pulse, so their Haves are adjacent
+    ASSERT_TRUE(peer->waitFor([](auto const& msg) { return msg.isHave(0) || msg.isHave(1); }, std::chrono::seconds{ 5 }));
+    ASSERT_TRUE(peer->waitFor(BtHave, std::chrono::seconds{ 5 }));
+    auto const first = peer->indexOf([](auto const& msg) { return msg.id == BtHave; });
+    ASSERT_TRUE(first);
+    auto const& next = peer->received[*first + 1];
+    EXPECT_TRUE(peer->received[*first].isHave(0) ? next.isHave(1) : next.isHave(0));
+    EXPECT_EQ(0U, tr_torrentStat(tor)->leftUntilDone);
+}
+
+TEST_F(PeerMsgsTest, pendingMessagesGoOutWithABlock)
+{
+    auto* const tor = partialTorrent(2);
+    auto peer = connect(tor);
+    // seeds are never unchoked, so leave out the piece we'll ask for
+    auto const piece = tr_piece_index_t{ 2 };
+    peer->send(bitfield(tor, piece));
+    peer->send(makeMessage(BtUnchoke));
+    peer->send(makeMessage(BtInterested));
+
+    // the torrent unchokes us on its next rechoke
+    ASSERT_TRUE(peer->waitFor(BtUnchoke, std::chrono::seconds{ 15 }));
+
+    // give it piece 0, but not piece 1, so it stays interested and doesn't
+    // send anything urgent that would flush its Have for piece 0
+    auto wanted = std::vector<uint32_t>{ 0, BlockSize };
+    auto const got_requests = peer->waitFor(
+        [&wanted](auto const& msg)
+        {
+            if (msg.id == BtRequest && msg.u32(0) == 0)
+            {
+                wanted.erase(std::remove(std::begin(wanted), std::end(wanted), msg.u32(4)), std::end(wanted));
+            }
+
+            return std::empty(wanted);
+        },
+        std::chrono::seconds{ 10 });
+    ASSERT_TRUE(got_requests);
+    peer->send(block(0, 0) + block(0, BlockSize));
+    EXPECT_TRUE(waitFor([tor]() { return tor->hasPiece(0); }, 5000));
+
+    // let a pulse queue the Have
+    peer->waitFor([](auto const&) { return false; }, std::chrono::seconds{ 1 });
+    auto const have_was_sent = peer->indexOf([](auto const& msg) { return msg.isHave(0); });
+    if (have_was_sent)
+    {
+        GTEST_SKIP() << "the Have went out before a block could carry it";
+    }
+
+    // the Have would otherwise wait out its batch period, well past this timeout
+    peer->send(makeMessage(BtRequest, u32(piece) + u32(0) + u32(BlockSize)));
+    ASSERT_TRUE(peer->waitFor(BtPiece, std::chrono::seconds{ 5 }));
+    auto const have = peer->indexOf([](auto const& msg) { return msg.isHave(0); });
+    ASSERT_TRUE(have);
+    EXPECT_LT(*have, *peer->indexOf([](auto const& msg) { return msg.id == BtPiece; }));
+}
+
+} // namespace test
+
+} // namespace libtransmission
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h"
+
+#include "file.h"
+#include "resume-writer.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class ResumeWriterTest : public SandboxedTest
+{
+protected:
+    static auto constexpr FlushTimeout = std::chrono::seconds{ 10 };
+
+    [[nodiscard]] std::string path(std::string_view basename) const
+    {
+        return tr_strvPath(sandboxDir(), basename);
+    }
+
+    [[nodiscard]] static std::string contentsOf(std::string const& filename)
+    {
+        auto buf = std::vector<char>{};
+        EXPECT_TRUE(tr_loadFile(buf, filename.c_str()));
+        return std::string{ std::data(buf), std::size(buf) };
+    }
+};
+
+TEST_F(ResumeWriterTest, newestContentsWin)
+{
+    auto writer = tr_resume_writer{ nullptr, 4 };
+    auto const filename = path("a.resume"sv);
+
+    auto constexpr NumSaves = 200;
+    for (int i = 0; i < NumSaves; ++i)
+    {
+        writer.save(1, filename, "version " + std::to_string(i));
+    }
+
+    EXPECT_TRUE(writer.flush(FlushTimeout));
+    EXPECT_EQ(0U, writer.pending());
+    EXPECT_EQ("version 199", contentsOf(filename));
+
+    // every save was either written or folded into a newer one
+    auto const stats = writer.stats();
+    EXPECT_EQ(uint64_t{ NumSaves }, stats.saves);
+    EXPECT_EQ(stats.saves, stats.writes + stats.coalesced);
+    EXPECT_EQ(0U, stats.errors);
+}
+
+TEST_F(ResumeWriterTest, manyFilesAreWritten)
+{
+    auto writer = tr_resume_writer{ nullptr, 4 };
+    writer.setFsync(true);
+    EXPECT_TRUE(writer.fsync());
+
+    auto constexpr NumFiles = 50;
+    for (int i = 0; i < NumFiles; ++i)
+    {
+        writer.save(i, path(std::to_string(i) + ".resume"), std::to_string(i));
+    }
+
+    EXPECT_TRUE(writer.flush(FlushTimeout));
+    for (int i = 0; i < NumFiles; ++i)
+    {
+        EXPECT_EQ(std::to_string(i), contentsOf(path(std::to_string(i) + ".resume")));
+    }
+}
+
+TEST_F(ResumeWriterTest, waitForOneFile)
+{
+    auto writer = tr_resume_writer{ nullptr, 1 };
+    auto const filename = path("a.resume"sv);
+
+    writer.save(1, filename, "hello");
+    writer.wait(filename);
+    EXPECT_EQ("hello", contentsOf(filename));
+}
+
+TEST_F(ResumeWriterTest, cancelledFilesStayRemoved)
+{
+    auto writer = tr_resume_writer{ nullptr, 2 };
+    auto const filename = path("a.resume"sv);
+
+    writer.save(1, filename, "hello");
+    writer.cancel(filename);
+    tr_sys_path_remove(filename.c_str(), nullptr);
+
+    EXPECT_TRUE(writer.flush(FlushTimeout));
+    EXPECT_FALSE(tr_sys_path_exists(filename.c_str(), nullptr));
+}
+
+TEST_F(ResumeWriterTest, failedWritesAreCounted)
+{
+    auto writer = tr_resume_writer{ nullptr, 1 };
+    auto const filename = path("no-such-dir/a.resume"sv);
+
+    writer.save(1, filename, "hello");
+    EXPECT_TRUE(writer.flush(FlushTimeout));
+    EXPECT_EQ(1U, writer.stats().errors);
+    EXPECT_FALSE(tr_sys_path_exists(filename.c_str(), nullptr));
+
+    // failures aren't reported once the session starts closing, but they still count
+    writer.stopReporting();
+    writer.save(1, filename, "hello");
+    EXPECT_TRUE(writer.flush(FlushTimeout));
+    EXPECT_EQ(2U, writer.stats().errors);
+}
+
+TEST_F(ResumeWriterTest, destructorFlushes)
+{
+    auto const filename = path("a.resume"sv);
+
+    {
+        auto writer = tr_resume_writer{ nullptr, 2 };
+        writer.save(1, filename, "goodbye");
+    }
+
+    EXPECT_EQ("goodbye", contentsOf(filename));
+}
+
+} // namespace test
+
+} // namespace libtransmission
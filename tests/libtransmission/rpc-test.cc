@@ -7,6 +7,7 @@
  */
 
 #include "transmission.h"
+#include "metrics.h"
 #include "rpcimpl.h"
 #include "utils.h"
 #include "variant.h"
@@ -97,7 +98,7 @@ TEST_F(RpcTest, sessionGet)
     EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
 
     // what we expected
-    auto const expected_keys = std::array<tr_quark, 55>{
+    auto const expected_keys = std::array<tr_quark, 60>{
         TR_KEY_alt_speed_down,
         TR_KEY_alt_speed_enabled,
         TR_KEY_alt_speed_time_begin,
@@ -123,6 +124,8 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_incomplete_dir,
         TR_KEY_incomplete_dir_enabled,
         TR_KEY_lpd_enabled,
+        TR_KEY_lpd_pack_announces,
+        TR_KEY_metrics_enabled,
         TR_KEY_peer_limit_global,
         TR_KEY_peer_limit_per_torrent,
         TR_KEY_peer_port,
@@ -131,7 +134,9 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_port_forwarding_enabled,
         TR_KEY_queue_stalled_enabled,
         TR_KEY_queue_stalled_minutes,
+        TR_KEY_read_cache_size_mb,
         TR_KEY_rename_partial_files,
+        TR_KEY_resume_fsync,
         TR_KEY_rpc_version,
         TR_KEY_rpc_version_minimum,
         TR_KEY_rpc_version_semver,
@@ -139,6 +144,7 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_script_torrent_added_filename,
         TR_KEY_script_torrent_done_enabled,
         TR_KEY_script_torrent_done_filename,
+        TR_KEY_scrub_speed_limit,
         TR_KEY_seed_queue_enabled,
         TR_KEY_seed_queue_size,
         TR_KEY_seedRatioLimit,
@@ -188,6 +194,171 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr);
 }
 
+TEST_F(RpcTest, sessionMetrics)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    auto const exec = [this, &rpc_response_func](std::string_view method, bool metrics_enabled)
+    {
+        auto request = tr_variant{};
+        tr_variantInitDict(&request, 2);
+        tr_variantDictAddStrView(&request, TR_KEY_method, method);
+        auto* const args = tr_variantDictAddDict(&request, TR_KEY_arguments, 1);
+        tr_variantDictAddBool(args, TR_KEY_metrics_enabled, metrics_enabled);
+        auto response = tr_variant{};
+        tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+        tr_variantFree(&request);
+        return response;
+    };
+
+    auto const rpc_request_count = [](tr_variant* response)
+    {
+        tr_variant* args = nullptr;
+        tr_variant* timers = nullptr;
+        tr_variant* timer = nullptr;
+        auto count = int64_t{ -1 };
+        EXPECT_TRUE(tr_variantDictFindDict(response, TR_KEY_arguments, &args));
+        EXPECT_TRUE(tr_variantDictFindDict(args, TR_KEY_timers, &timers));
+        EXPECT_TRUE(tr_variantDictFindDict(timers, tr_quark_new("rpc-request"sv), &timer));
+        EXPECT_TRUE(tr_variantDictFindInt(timer, TR_KEY_count, &count));
+
+        tr_variant* buckets = nullptr;
+        EXPECT_TRUE(tr_variantDictFindList(timer, TR_KEY_buckets, &buckets));
+        EXPECT_EQ(tr_metrics::NumBuckets, tr_variantListSize(buckets));
+
+        tr_variant* counters = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(args, TR_KEY_counters, &counters));
+        return count;
+    };
+
+    // off by default, so nothing's recorded
+    auto response = exec("session-metrics"sv, false);
+    EXPECT_EQ(0, rpc_request_count(&response));
+    tr_variantFree(&response);
+    EXPECT_FALSE(tr_sessionGetMetricsEnabled(session_));
+
+    response = exec("session-set"sv, true);
+    tr_variantFree(&response);
+    EXPECT_TRUE(tr_sessionGetMetricsEnabled(session_));
+
+    // a request is recorded once it's done, so the next one sees it
+    response = exec("session-metrics"sv, true);
+    tr_variantFree(&response);
+    response = exec("session-metrics"sv, true);
+    EXPECT_LT(0, rpc_request_count(&response));
+    tr_variantFree(&response);
+}
+
+TEST_F(RpcTest, batch)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    // count the notifications the batch sends
+    struct Notifications
+    {
+        int torrent_changed = 0;
+        int queue_changed = 0;
+    };
+    auto notifications = Notifications{};
+    auto const rpc_func =
+        [](tr_session* /*session*/, tr_rpc_callback_type type, tr_torrent* /*tor*/, void* vnotifications) noexcept
+    {
+        auto* const n = static_cast<Notifications*>(vnotifications);
+        n->torrent_changed += type == TR_RPC_TORRENT_CHANGED ? 1 : 0;
+        n->queue_changed += type == TR_RPC_SESSION_QUEUE_POSITIONS_CHANGED ? 1 : 0;
+        return TR_RPC_OK;
+    };
+    tr_sessionSetRPCCallback(session_, rpc_func, &notifications);
+
+    auto* tor = zeroTorrentInit();
+    EXPECT_NE(nullptr, tor);
+
+    auto request = tr_variant{};
+    tr_variantInitDict(&request, 2);
+    tr_variantDictAddStrView(&request, TR_KEY_method, "batch"sv);
+    auto* args = tr_variantDictAddDict(&request, TR_KEY_arguments, 2);
+    tr_variantListAddInt(tr_variantDictAddList(args, TR_KEY_ids, 1), tr_torrentId(tor));
+    auto* const requests = tr_variantDictAddList(args, TR_KEY_requests, 5);
+
+    // sub-requests without ids use the batch's
+    auto* sub = tr_variantListAddDict(requests, 3);
+    tr_variantDictAddStrView(sub, TR_KEY_method, "torrent-set"sv);
+    tr_variantDictAddInt(sub, TR_KEY_tag, 1);
+    tr_variantDictAddInt(tr_variantDictAddDict(sub, TR_KEY_arguments, 1), TR_KEY_seedRatioMode, TR_RATIOLIMIT_SINGLE);
+
+    sub = tr_variantListAddDict(requests, 2);
+    tr_variantDictAddStrView(sub, TR_KEY_method, "torrent-set"sv);
+    tr_variantDictAddReal(tr_variantDictAddDict(sub, TR_KEY_arguments, 1), TR_KEY_seedRatioLimit, 2.5);
+
+    sub = tr_variantListAddDict(requests, 2);
+    tr_variantDictAddStrView(sub, TR_KEY_method, "torrent-get"sv);
+    auto* const fields = tr_variantDictAddList(tr_variantDictAddDict(sub, TR_KEY_arguments, 1), TR_KEY_fields, 2);
+    tr_variantListAddStrView(fields, "id"sv);
+    tr_variantListAddStrView(fields, "seedRatioLimit"sv);
+
+    sub = tr_variantListAddDict(requests, 1);
+    tr_variantDictAddStrView(sub, TR_KEY_method, "torrent-add"sv);
+
+    sub = tr_variantListAddDict(requests, 1);
+    tr_variantDictAddStrView(sub, TR_KEY_method, "no-such-method"sv);
+
+    auto response = tr_variant{};
+    tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+    tr_variantFree(&request);
+
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(&response, TR_KEY_result, &sv));
+    EXPECT_EQ("success"sv, sv);
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+    tr_variant* responses = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_responses, &responses));
+    EXPECT_EQ(5U, tr_variantListSize(responses));
+
+    auto const result_of = [responses](size_t i)
+    {
+        auto result = std::string_view{};
+        EXPECT_TRUE(tr_variantDictFindStrView(tr_variantListChild(responses, i), TR_KEY_result, &result));
+        return result;
+    };
+    EXPECT_EQ("success"sv, result_of(0));
+    EXPECT_EQ("success"sv, result_of(1));
+    EXPECT_EQ("success"sv, result_of(2));
+    EXPECT_EQ("method can't be batched"sv, result_of(3));
+    EXPECT_EQ("method name not recognized"sv, result_of(4));
+
+    auto tag = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(tr_variantListChild(responses, 0), TR_KEY_tag, &tag));
+    EXPECT_EQ(1, tag);
+
+    // the torrent-get saw the torrent-sets' changes
+    tr_variant* get_args = nullptr;
+    tr_variant* torrents = nullptr;
+    EXPECT_TRUE(tr_variantDictFindDict(tr_variantListChild(responses, 2), TR_KEY_arguments, &get_args));
+    EXPECT_TRUE(tr_variantDictFindList(get_args, TR_KEY_torrents, &torrents));
+    EXPECT_EQ(1U, tr_variantListSize(torrents));
+    auto d = double{};
+    EXPECT_TRUE(tr_variantDictFindReal(tr_variantListChild(torrents, 0), TR_KEY_seedRatioLimit, &d));
+    EXPECT_EQ(2.5, d);
+    EXPECT_EQ(TR_RATIOLIMIT_SINGLE, tr_torrentGetRatioMode(tor));
+
+    // both torrent-sets changed the torrent, but that's only sent once
+    EXPECT_EQ(1, notifications.torrent_changed);
+    EXPECT_EQ(0, notifications.queue_changed);
+
+    // cleanup
+    tr_variantFree(&response);
+    tr_sessionSetRPCCallback(session_, nullptr, nullptr);
+    tr_torrentRemove(tor, false, nullptr);
+}
+
 } // namespace test
 
 } // namespace libtransmission
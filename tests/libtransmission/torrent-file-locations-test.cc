@@ -0,0 +1,187 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+
+#include "file.h"
+#include "torrent.h"
+#include "torrent-file-locations.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using TorrentFileLocationsTest = SandboxedTest;
+using Location = tr_file_locations::Location;
+
+TEST_F(TorrentFileLocationsTest, refreshListsEachFolderOnce)
+{
+    auto const download_dir = tr_strvPath(sandboxDir(), "Downloads");
+    auto const incomplete_dir = tr_strvPath(sandboxDir(), "Incomplete");
+
+    auto names = std::array<std::string, 6>{
+        "torrent/a.txt", "torrent/b.txt", "torrent/sub/c.txt", "torrent/sub/d.txt", "torrent/e.txt", "torrent/f.txt",
+    };
+    auto files = std::array<tr_file, std::size(names)>{};
+    for (size_t i = 0; i < std::size(names); ++i)
+    {
+        files[i].name = std::data(names[i]);
+    }
+
+    createFileWithContents(tr_strvPath(download_dir, "torrent/a.txt"), "a");
+    createFileWithContents(tr_strvPath(download_dir, "torrent/b.txt.part"), "b");
+    createFileWithContents(tr_strvPath(incomplete_dir, "torrent/sub/c.txt"), "c");
+    createFileWithContents(tr_strvPath(incomplete_dir, "torrent/sub/d.txt.part"), "d");
+    // the download dir wins when a file's in both
+    createFileWithContents(tr_strvPath(download_dir, "torrent/e.txt"), "e");
+    createFileWithContents(tr_strvPath(incomplete_dir, "torrent/e.txt"), "e");
+    // f.txt is nowhere
+
+    auto locations = tr_file_locations{};
+    locations.reset(std::size(files));
+    EXPECT_EQ(Location::Unknown, locations.get(0));
+
+    // two folders in each dir
+    EXPECT_EQ(4U, locations.refresh(download_dir, incomplete_dir, std::data(files), std::size(files)));
+    EXPECT_EQ(Location::Download, locations.get(0));
+    EXPECT_EQ(Location::DownloadPartial, locations.get(1));
+    EXPECT_EQ(Location::Incomplete, locations.get(2));
+    EXPECT_EQ(Location::IncompletePartial, locations.get(3));
+    EXPECT_EQ(Location::Download, locations.get(4));
+    EXPECT_EQ(Location::Unknown, locations.get(5));
+
+    locations.invalidate(0);
+    EXPECT_EQ(Location::Unknown, locations.get(0));
+    EXPECT_EQ(Location::DownloadPartial, locations.get(1));
+
+    locations.invalidateAll();
+    for (tr_file_index_t i = 0; i < std::size(files); ++i)
+    {
+        EXPECT_EQ(Location::Unknown, locations.get(i));
+    }
+
+    // without an incomplete dir
+    EXPECT_EQ(2U, locations.refresh(download_dir, "", std::data(files), std::size(files)));
+    EXPECT_EQ(Location::Download, locations.get(0));
+    EXPECT_EQ(Location::Unknown, locations.get(2));
+}
+
+TEST_F(TorrentFileLocationsTest, refreshDoesNotUndoAnInvalidation)
+{
+    auto const download_dir = tr_strvPath(sandboxDir(), "Downloads");
+    auto const path = tr_strvPath(download_dir, "a/a.txt");
+    auto const partial = path + ".part";
+    createFileWithContents(path, "a");
+
+    // "a/" is listed first, and the other folders keep the refresh busy afterwards
+    auto names = std::vector<std::string>{ "a/a.txt" };
+    for (int i = 0; i < 2000; ++i)
+    {
+        names.push_back("b" + std::to_string(i) + "/b.txt");
+    }
+
+    auto files = std::vector<tr_file>(std::size(names));
+    for (size_t i = 0; i < std::size(names); ++i)
+    {
+        files[i].name = std::data(names[i]);
+    }
+
+    auto locations = tr_file_locations{};
+    locations.reset(std::size(files));
+
+    auto n_refreshes = std::atomic<int>{ 0 };
+    auto stop = std::atomic<bool>{ false };
+    auto refresher = std::thread(
+        [&]()
+        {
+            while (!stop)
+            {
+                locations.refresh(download_dir, "", std::data(files), std::size(files));
+                ++n_refreshes;
+            }
+        });
+
+    for (int i = 0; i < 100; ++i)
+    {
+        auto const is_partial = i % 2 == 0;
+        auto const [from, to] = is_partial ? std::pair{ path, partial } : std::pair{ partial, path };
+        ASSERT_TRUE(tr_sys_path_rename(from.c_str(), to.c_str(), nullptr));
+        locations.invalidate(0);
+
+        // once the refresh that may have listed the folder before the rename is done,
+        // the file is either unknown or where it is now
+        auto const n = n_refreshes.load();
+        while (n_refreshes.load() < n + 1)
+        {
+            std::this_thread::yield();
+        }
+
+        auto const location = locations.get(0);
+        EXPECT_TRUE(location == Location::Unknown || location == (is_partial ? Location::DownloadPartial : Location::Download))
+            << "iteration " << i;
+    }
+
+    stop = true;
+    refresher.join();
+}
+
+using TorrentFindFileTest = SessionTest;
+
+TEST_F(TorrentFindFileTest, foundFilesAreRemembered)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    auto filename = std::string{};
+    auto const found = tor->findFile(filename, 1);
+    ASSERT_TRUE(found);
+    auto const path = filename;
+    EXPECT_EQ(std::string_view{ tor->downloadDir }, found->base);
+
+    // remove it behind the torrent's back; it's still remembered...
+    EXPECT_TRUE(tr_sys_path_remove(path.c_str(), nullptr));
+    EXPECT_TRUE(tor->findFile(filename, 1));
+    EXPECT_EQ(path, filename);
+
+    // ...unless the caller wants to know about the file itself
+    auto info = tr_sys_path_info{};
+    EXPECT_FALSE(tor->findFile(filename, 1, &info));
+    EXPECT_FALSE(tor->findFile(filename, 1));
+
+    // new files are found
+    createFileWithContents(path + ".part", "hello");
+    auto const found_partial = tor->findFile(filename, 1, &info);
+    ASSERT_TRUE(found_partial);
+    EXPECT_EQ(path + ".part", filename);
+    EXPECT_EQ(5U, info.size);
+
+    // a rename is noticed
+    tr_sys_path_rename((path + ".part").c_str(), path.c_str(), nullptr);
+    tor->refreshFileLocations();
+    EXPECT_TRUE(tor->findFile(filename, 1));
+    EXPECT_EQ(path, filename);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
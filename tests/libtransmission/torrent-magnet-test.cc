@@ -0,0 +1,149 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h"
+
+#include "crypto-utils.h" // tr_sha1()
+#include "file.h" // tr_sys_path_remove()
+#include "torrent.h"
+#include "torrent-magnet.h"
+#include "utils.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using TorrentMagnetTest = SessionTest;
+
+namespace
+{
+
+tr_sha1_digest_t makeHash(char ch)
+{
+    auto hash = tr_sha1_digest_t{};
+    hash.fill(std::byte(ch));
+    return hash;
+}
+
+// all of the torrent's metadata pieces, glued back together
+std::string getMetadata(tr_torrent* tor)
+{
+    auto metadata = std::string{};
+
+    for (int piece = 0;; ++piece)
+    {
+        auto len = size_t{};
+        auto* const data = static_cast<char*>(tr_torrentGetMetadataPiece(tor, piece, &len));
+        if (data == nullptr)
+        {
+            break;
+        }
+
+        metadata.append(data, len);
+        tr_free(data);
+    }
+
+    return metadata;
+}
+
+} // namespace
+
+TEST_F(TorrentMagnetTest, infoDictCacheEvictsLeastRecentlyUsed)
+{
+    auto cache = tr_info_dict_cache{ 2, 1024 };
+
+    cache.add(makeHash('a'), "aaa");
+    cache.add(makeHash('b'), "bbb");
+    EXPECT_EQ(2U, std::size(cache));
+    EXPECT_EQ(6U, cache.bytes());
+
+    // using 'a' makes 'b' the oldest
+    auto const* const a = cache.get(makeHash('a'));
+    ASSERT_NE(nullptr, a);
+    EXPECT_EQ("aaa"sv, *a);
+
+    cache.add(makeHash('c'), "ccc");
+    EXPECT_EQ(2U, std::size(cache));
+    EXPECT_NE(nullptr, cache.get(makeHash('a')));
+    EXPECT_EQ(nullptr, cache.get(makeHash('b')));
+    EXPECT_NE(nullptr, cache.get(makeHash('c')));
+
+    // too many bytes evicts too, but the newest entry is always kept
+    cache.add(makeHash('d'), std::string(2000, 'd'));
+    EXPECT_EQ(1U, std::size(cache));
+    EXPECT_EQ(2000U, cache.bytes());
+    EXPECT_NE(nullptr, cache.get(makeHash('d')));
+
+    cache.erase(makeHash('d'));
+    EXPECT_EQ(0U, std::size(cache));
+    EXPECT_EQ(0U, cache.bytes());
+}
+
+TEST_F(TorrentMagnetTest, metadataPiecesAreServedFromCache)
+{
+    auto* const tor = zeroTorrentInit();
+    ASSERT_NE(nullptr, tor);
+
+    // the info dict's offset was found while the .torrent was parsed
+    EXPECT_TRUE(tor->infoDictOffset);
+
+    auto const metadata = getMetadata(tor);
+    EXPECT_EQ(tor->infoDictLength, std::size(metadata));
+    uint8_t sha1[SHA_DIGEST_LENGTH];
+    EXPECT_TRUE(tr_sha1(sha1, std::data(metadata), int(std::size(metadata)), nullptr));
+    EXPECT_EQ(0, memcmp(sha1, tor->info.hash, SHA_DIGEST_LENGTH));
+
+    // after the first read, the .torrent file isn't needed anymore
+    EXPECT_NE(nullptr, session_->info_dict_cache.get(tr_torrentInfoHash(tor)));
+    EXPECT_TRUE(tr_sys_path_remove(tor->info.torrent, nullptr));
+    EXPECT_EQ(metadata, getMetadata(tor));
+
+    // but a cache miss goes back to it
+    session_->info_dict_cache.erase(tr_torrentInfoHash(tor));
+    EXPECT_EQ(""sv, getMetadata(tor));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(TorrentMagnetTest, metadataSurvivesTorrentFileRewrite)
+{
+    auto* const tor = zeroTorrentInit();
+    ASSERT_NE(nullptr, tor);
+    auto const metadata = getMetadata(tor);
+    session_->info_dict_cache.erase(tr_torrentInfoHash(tor));
+
+    // move the info dict to somewhere else in the file
+    auto contents = std::vector<char>{};
+    ASSERT_TRUE(tr_loadFile(contents, tor->info.torrent));
+    auto const padding = "7:comment20:xxxxxxxxxxxxxxxxxxxx"sv;
+    contents.insert(std::begin(contents) + 1, std::begin(padding), std::end(padding));
+    ASSERT_TRUE(tr_saveFile(tor->info.torrent, { std::data(contents), std::size(contents) }));
+
+    // the stale offset is noticed and the info dict is found again
+    auto const old_offset = tor->infoDictOffset;
+    EXPECT_EQ(metadata, getMetadata(tor));
+    ASSERT_TRUE(tor->infoDictOffset);
+    EXPECT_EQ(*old_offset + std::size(padding), *tor->infoDictOffset);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
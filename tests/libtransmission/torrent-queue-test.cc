@@ -0,0 +1,225 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "transmission.h"
+
+#include "torrent-queue.h"
+
+#include "gtest/gtest.h"
+
+class TorrentQueueTest : public ::testing::Test
+{
+protected:
+    // the queue never dereferences its torrents, so fake ones are fine
+    static tr_torrent* fakeTorrent(uintptr_t i)
+    {
+        return reinterpret_cast<tr_torrent*>((i + 1) * 16);
+    }
+
+    static void expectOrder(tr_torrent_queue const& queue, std::vector<tr_torrent*> const& expected)
+    {
+        ASSERT_EQ(std::size(expected), std::size(queue));
+
+        for (size_t i = 0, n = std::size(expected); i < n; ++i)
+        {
+            EXPECT_EQ(expected[i], queue.at(i));
+            EXPECT_EQ(i, queue.position(expected[i]));
+        }
+    }
+};
+
+TEST_F(TorrentQueueTest, pushBackAppends)
+{
+    auto queue = tr_torrent_queue{};
+    auto expected = std::vector<tr_torrent*>{};
+
+    for (uintptr_t i = 0; i < 100; ++i)
+    {
+        queue.push_back(fakeTorrent(i));
+        expected.push_back(fakeTorrent(i));
+    }
+
+    expectOrder(queue, expected);
+}
+
+TEST_F(TorrentQueueTest, eraseMovesEveryoneUp)
+{
+    auto queue = tr_torrent_queue{};
+    auto expected = std::vector<tr_torrent*>{};
+
+    for (uintptr_t i = 0; i < 10; ++i)
+    {
+        queue.push_back(fakeTorrent(i));
+        expected.push_back(fakeTorrent(i));
+    }
+
+    queue.erase(fakeTorrent(3));
+    expected.erase(std::begin(expected) + 3);
+    expectOrder(queue, expected);
+    EXPECT_FALSE(queue.contains(fakeTorrent(3)));
+
+    // erasing something that isn't there is a no-op
+    queue.erase(fakeTorrent(3));
+    expectOrder(queue, expected);
+}
+
+TEST_F(TorrentQueueTest, moveClampsToEnd)
+{
+    auto queue = tr_torrent_queue{};
+
+    for (uintptr_t i = 0; i < 5; ++i)
+    {
+        queue.push_back(fakeTorrent(i));
+    }
+
+    queue.move(fakeTorrent(0), 1000);
+    expectOrder(queue, { fakeTorrent(1), fakeTorrent(2), fakeTorrent(3), fakeTorrent(4), fakeTorrent(0) });
+
+    queue.move(fakeTorrent(0), 0);
+    queue.move(fakeTorrent(4), 2);
+    expectOrder(queue, { fakeTorrent(0), fakeTorrent(1), fakeTorrent(4), fakeTorrent(2), fakeTorrent(3) });
+}
+
+TEST_F(TorrentQueueTest, rangeReturnsPositionsInOrder)
+{
+    auto queue = tr_torrent_queue{};
+    auto expected = std::vector<tr_torrent*>{};
+
+    for (uintptr_t i = 0; i < 50; ++i)
+    {
+        queue.push_back(fakeTorrent(i));
+        expected.push_back(fakeTorrent(i));
+    }
+
+    queue.move(fakeTorrent(40), 5);
+    expected.erase(std::begin(expected) + 40);
+    expected.insert(std::begin(expected) + 5, fakeTorrent(40));
+
+    EXPECT_EQ(expected, queue.range(0, 50));
+    EXPECT_EQ(std::vector<tr_torrent*>(std::begin(expected) + 5, std::begin(expected) + 41), queue.range(5, 41));
+    EXPECT_EQ(std::vector<tr_torrent*>(std::begin(expected) + 45, std::end(expected)), queue.range(45, 1000));
+    EXPECT_TRUE(std::empty(queue.range(7, 7)));
+    EXPECT_TRUE(std::empty(queue.range(60, 70)));
+}
+
+TEST_F(TorrentQueueTest, nextWaitingHonorsDirectionAndOrder)
+{
+    auto queue = tr_torrent_queue{};
+
+    for (uintptr_t i = 0; i < 10; ++i)
+    {
+        queue.push_back(fakeTorrent(i));
+    }
+
+    queue.setWaiting(fakeTorrent(7), TR_DOWN);
+    queue.setWaiting(fakeTorrent(2), TR_DOWN);
+    queue.setWaiting(fakeTorrent(5), TR_UP);
+    queue.setWaiting(fakeTorrent(9), TR_DOWN);
+    EXPECT_EQ(3, queue.countWaiting(TR_DOWN));
+    EXPECT_EQ(1, queue.countWaiting(TR_UP));
+
+    auto expected = std::vector<tr_torrent*>{ fakeTorrent(2), fakeTorrent(7) };
+    EXPECT_EQ(expected, queue.nextWaiting(TR_DOWN, 2));
+    expected = { fakeTorrent(5) };
+    EXPECT_EQ(expected, queue.nextWaiting(TR_UP, 10));
+
+    // moving a waiting torrent changes the order it's started in
+    queue.move(fakeTorrent(9), 0);
+    expected = { fakeTorrent(9), fakeTorrent(2), fakeTorrent(7) };
+    EXPECT_EQ(expected, queue.nextWaiting(TR_DOWN, 10));
+
+    // switching directions and erasing are both reflected
+    queue.setWaiting(fakeTorrent(2), TR_UP);
+    queue.erase(fakeTorrent(7));
+    queue.setWaiting(fakeTorrent(5), std::nullopt);
+    expected = { fakeTorrent(9) };
+    EXPECT_EQ(expected, queue.nextWaiting(TR_DOWN, 10));
+    expected = { fakeTorrent(2) };
+    EXPECT_EQ(expected, queue.nextWaiting(TR_UP, 10));
+    EXPECT_EQ(1, queue.countWaiting(TR_DOWN));
+    EXPECT_EQ(1, queue.countWaiting(TR_UP));
+}
+
+TEST_F(TorrentQueueTest, matchesVectorModel)
+{
+    auto queue = tr_torrent_queue{};
+    auto expected = std::vector<tr_torrent*>{};
+    auto waiting = std::vector<std::optional<tr_direction>>(1000);
+    auto rng = std::mt19937{ 1234 };
+    auto next_id = uintptr_t{};
+
+    for (int i = 0; i < 5000; ++i)
+    {
+        auto const op = rng() % 4;
+
+        if (op == 0 || std::empty(expected))
+        {
+            auto* const tor = fakeTorrent(next_id++ % std::size(waiting));
+            if (!queue.contains(tor))
+            {
+                queue.push_back(tor);
+                expected.push_back(tor);
+            }
+        }
+        else if (op == 1)
+        {
+            auto const pos = rng() % std::size(expected);
+            auto* const tor = expected[pos];
+            queue.erase(tor);
+            expected.erase(std::begin(expected) + pos);
+            waiting[reinterpret_cast<uintptr_t>(tor) / 16 - 1].reset();
+        }
+        else if (op == 2)
+        {
+            auto const from = rng() % std::size(expected);
+            auto const to = rng() % std::size(expected);
+            auto* const tor = expected[from];
+            queue.move(tor, to);
+            expected.erase(std::begin(expected) + from);
+            expected.insert(std::begin(expected) + to, tor);
+        }
+        else
+        {
+            auto* const tor = expected[rng() % std::size(expected)];
+            auto const r = rng() % 3;
+            auto const dir = r == 0 ? std::nullopt : std::make_optional(r == 1 ? TR_UP : TR_DOWN);
+            queue.setWaiting(tor, dir);
+            waiting[reinterpret_cast<uintptr_t>(tor) / 16 - 1] = dir;
+        }
+    }
+
+    expectOrder(queue, expected);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        auto begin = rng() % (std::size(expected) + 1);
+        auto end = rng() % (std::size(expected) + 1);
+        std::tie(begin, end) = std::minmax(begin, end);
+        EXPECT_EQ(std::vector<tr_torrent*>(std::begin(expected) + begin, std::begin(expected) + end), queue.range(begin, end));
+    }
+
+    for (auto const dir : { TR_UP, TR_DOWN })
+    {
+        auto expected_waiting = std::vector<tr_torrent*>{};
+        std::copy_if(
+            std::begin(expected),
+            std::end(expected),
+            std::back_inserter(expected_waiting),
+            [&waiting, dir](auto* tor) { return waiting[reinterpret_cast<uintptr_t>(tor) / 16 - 1] == dir; });
+
+        EXPECT_EQ(std::size(expected_waiting), queue.countWaiting(dir));
+        EXPECT_EQ(expected_waiting, queue.nextWaiting(dir, SIZE_MAX));
+    }
+}
@@ -0,0 +1,230 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <vector>
+
+#include "transmission.h"
+
+#include "tr-dht-scheduler.h"
+
+#include "gtest/gtest.h"
+
+using Key = tr_dht_scheduler::Key;
+
+class DhtSchedulerTest : public ::testing::Test
+{
+protected:
+    static auto constexpr Af = int{ 2 };
+
+    static void addAll(tr_dht_scheduler& scheduler, int n_torrents, time_t now, bool ready = true)
+    {
+        for (int id = 0; id < n_torrents; ++id)
+        {
+            scheduler.add({ id, Af }, 100 - id, ready, now);
+        }
+    }
+};
+
+TEST_F(DhtSchedulerTest, spreadsOutTheStartupBurst)
+{
+    auto scheduler = tr_dht_scheduler{ 6, 2 };
+    auto now = time_t{ 1000 };
+
+    addAll(scheduler, 50, now);
+    EXPECT_EQ(2U, std::size(scheduler.next(now)));
+    EXPECT_EQ(48U, scheduler.stats().searches_queued);
+
+    addAll(scheduler, 50, ++now);
+    EXPECT_EQ(2U, std::size(scheduler.next(now)));
+    addAll(scheduler, 50, ++now);
+    EXPECT_EQ(2U, std::size(scheduler.next(now)));
+
+    // we're at the in-flight limit now
+    addAll(scheduler, 50, ++now);
+    EXPECT_TRUE(std::empty(scheduler.next(now)));
+    EXPECT_EQ(6U, scheduler.stats().searches_in_flight);
+    EXPECT_EQ(44U, scheduler.stats().searches_queued);
+
+    // finishing a search frees up a slot
+    scheduler.onSearchDone({ 49, Af }, now);
+    addAll(scheduler, 50, ++now);
+    EXPECT_EQ(1U, std::size(scheduler.next(now)));
+    EXPECT_EQ(7U, scheduler.stats().searches_started);
+    EXPECT_EQ(1U, scheduler.stats().searches_done);
+}
+
+TEST_F(DhtSchedulerTest, prefersTorrentsWithFewPeers)
+{
+    auto scheduler = tr_dht_scheduler{ 10, 3 };
+    auto const now = time_t{ 1000 };
+
+    // torrent N has 100 - N peers
+    addAll(scheduler, 20, now);
+    auto starts = scheduler.next(now);
+    std::sort(std::begin(starts), std::end(starts));
+    auto const expected = std::vector<Key>{ { 17, Af }, { 18, Af }, { 19, Af } };
+    EXPECT_EQ(expected, starts);
+}
+
+TEST_F(DhtSchedulerTest, waitsForTheDhtToBeReady)
+{
+    auto scheduler = tr_dht_scheduler{};
+    auto const now = time_t{ 1000 };
+
+    addAll(scheduler, 5, now, false);
+    EXPECT_TRUE(std::empty(scheduler.next(now)));
+    addAll(scheduler, 5, now, true);
+    EXPECT_FALSE(std::empty(scheduler.next(now)));
+}
+
+TEST_F(DhtSchedulerTest, backsOffEmptySearches)
+{
+    auto scheduler = tr_dht_scheduler{};
+    auto const key = Key{ 1, Af };
+    auto now = time_t{ 1000 };
+
+    auto intervals = std::vector<time_t>{};
+    for (int i = 0; i < 4; ++i)
+    {
+        scheduler.add(key, 0, true, now);
+        ASSERT_EQ(1U, std::size(scheduler.next(now)));
+        scheduler.onSearchDone(key, now);
+        intervals.push_back(scheduler.dueAt(key) - now);
+        now = scheduler.dueAt(key);
+    }
+
+    // intervals grow, but are capped
+    EXPECT_LT(intervals[0] * 3 / 2, intervals[1]);
+    EXPECT_LT(intervals[2], intervals[1] * 3 / 2);
+    EXPECT_LT(intervals[3], intervals[1] * 3 / 2);
+
+    // and finding peers resets the backoff
+    scheduler.add(key, 0, true, now);
+    ASSERT_EQ(1U, std::size(scheduler.next(now)));
+    scheduler.onPeersFound(key, 20);
+    scheduler.onSearchDone(key, now);
+    EXPECT_LT(scheduler.dueAt(key) - now, intervals[0]);
+    EXPECT_EQ(20U, scheduler.stats().peers_found);
+    EXPECT_EQ(5U, scheduler.stats().searches_done);
+}
+
+TEST_F(DhtSchedulerTest, retriesFailedSearchesSoon)
+{
+    auto scheduler = tr_dht_scheduler{};
+    auto const key = Key{ 1, Af };
+    auto const now = time_t{ 1000 };
+
+    scheduler.add(key, 0, true, now);
+    ASSERT_EQ(1U, std::size(scheduler.next(now)));
+    scheduler.onSearchFailed(key, now);
+    EXPECT_EQ(0U, scheduler.stats().searches_in_flight);
+    EXPECT_EQ(1U, scheduler.stats().searches_failed);
+    EXPECT_LE(scheduler.dueAt(key) - now, 10);
+}
+
+TEST_F(DhtSchedulerTest, forgetsTorrentsThatStopAnnouncing)
+{
+    auto scheduler = tr_dht_scheduler{};
+    auto const now = time_t{ 1000 };
+
+    addAll(scheduler, 3, now);
+    EXPECT_EQ(3U, std::size(scheduler.next(now)));
+    EXPECT_EQ(3U, scheduler.stats().searches_in_flight);
+
+    // nobody's added this time, e.g. because they were all paused
+    EXPECT_TRUE(std::empty(scheduler.next(now + 1)));
+    EXPECT_EQ(0U, scheduler.stats().searches_in_flight);
+    EXPECT_EQ(0, scheduler.dueAt({ 0, Af }));
+}
+
+TEST_F(DhtSchedulerTest, budgetsGrowWithTheTorrentCount)
+{
+    auto scheduler = tr_dht_scheduler{};
+    auto const now = time_t{ 1000 };
+
+    addAll(scheduler, 10, now);
+    (void)scheduler.next(now);
+    EXPECT_EQ(tr_dht_scheduler::MinSearchesInFlight, scheduler.maxInFlight());
+    EXPECT_EQ(tr_dht_scheduler::MinSearchStartsPerUpkeep, scheduler.maxStartsPerUpkeep());
+
+    // twice as many starts per second as it takes to announce each key once per interval
+    auto constexpr NumKeys = 20000;
+    for (int id = 0; id < NumKeys; ++id)
+    {
+        scheduler.add({ id, Af }, 0, true, now + 1);
+    }
+    auto const n_starts = std::size(scheduler.next(now + 1));
+    auto const expected = size_t(2 * NumKeys + tr_dht_scheduler::AnnounceIntervalSec - 1) /
+        size_t(tr_dht_scheduler::AnnounceIntervalSec);
+    EXPECT_EQ(expected, scheduler.maxStartsPerUpkeep());
+    EXPECT_EQ(expected, n_starts);
+    EXPECT_EQ(tr_dht_scheduler::MaxSearchesInFlight, scheduler.maxInFlight());
+}
+
+TEST_F(DhtSchedulerTest, busyTorrentsAreNotStarved)
+{
+    auto scheduler = tr_dht_scheduler{ 16, 1 };
+    auto const busy = Key{ 1, Af };
+    auto const quiet = Key{ 2, Af };
+    auto now = time_t{ 1000 };
+
+    // `busy` has been due for ten minutes, but the DHT wasn't ready
+    scheduler.add(busy, 100, false, now);
+    now += 10 * 60;
+
+    // `quiet` has fewer peers, but has only just become due
+    scheduler.add(busy, 100, true, now);
+    scheduler.add(quiet, 50, true, now);
+    EXPECT_EQ(std::vector<Key>{ busy }, scheduler.next(now));
+}
+
+TEST_F(DhtSchedulerTest, announcesEveryTorrentWithinTheInterval)
+{
+    // far more than 16 searches in flight can announce, when each takes 45 seconds
+    auto constexpr NumTorrents = 3000;
+    auto constexpr SearchSec = time_t{ 45 };
+    auto constexpr Interval = tr_dht_scheduler::AnnounceIntervalSec;
+    auto constexpr UpkeepSec = time_t{ 5 };
+
+    auto scheduler = tr_dht_scheduler{ tr_dht_scheduler::MinSearchesInFlight,
+                                       tr_dht_scheduler::MinSearchStartsPerUpkeep,
+                                       UpkeepSec };
+    auto const start = time_t{ 1000 };
+    auto searches = std::multimap<time_t, Key>{}; // when they finish
+    auto n_announces = std::vector<int>(NumTorrents);
+    auto longest_wait = time_t{};
+
+    for (auto now = start; now < start + 3 * Interval; now += UpkeepSec)
+    {
+        for (auto it = std::begin(searches); it != std::end(searches) && it->first <= now; it = searches.erase(it))
+        {
+            scheduler.onPeersFound(it->second, 10);
+            scheduler.onSearchDone(it->second, now);
+        }
+
+        for (int id = 0; id < NumTorrents; ++id)
+        {
+            scheduler.add({ id, Af }, id % 50, true, now);
+        }
+
+        for (auto const& key : scheduler.next(now))
+        {
+            longest_wait = std::max(longest_wait, now - scheduler.dueAt(key));
+            ++n_announces[key.first];
+            searches.emplace(now + SearchSec, key);
+        }
+    }
+
+    // the startup backlog drains within half an interval, and nothing waits longer than that afterwards
+    EXPECT_LE(longest_wait, Interval / 2);
+    EXPECT_EQ(0U, scheduler.stats().searches_failed);
+    EXPECT_LE(2, *std::min_element(std::begin(n_announces), std::end(n_announces)));
+}
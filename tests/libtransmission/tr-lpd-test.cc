@@ -0,0 +1,146 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+
+#include "tr-lpd.h"
+
+#include "gtest/gtest.h"
+
+class LpdTest : public ::testing::Test
+{
+protected:
+    static tr_sha1_digest_t makeHash(int seed)
+    {
+        auto hash = tr_sha1_digest_t{};
+        for (size_t i = 0; i < std::size(hash); ++i)
+        {
+            hash[i] = std::byte(seed * 31 + i);
+        }
+        return hash;
+    }
+
+    static std::vector<tr_sha1_digest_t> makeHashes(int n)
+    {
+        auto hashes = std::vector<tr_sha1_digest_t>{};
+        for (int i = 0; i < n; ++i)
+        {
+            hashes.push_back(makeHash(i));
+        }
+        return hashes;
+    }
+};
+
+TEST_F(LpdTest, singleAnnounceMatchesTheOldFormat)
+{
+    auto const datagrams = tr_lpdMakeAnnounces(51413, { makeHash(1) }, true);
+    ASSERT_EQ(1U, std::size(datagrams));
+    EXPECT_EQ(
+        "BT-SEARCH * HTTP/1.1\r\n"
+        "Host: 239.192.152.143:6771\r\n"
+        "Port: 51413\r\n"
+        "Infohash: 1F202122232425262728292A2B2C2D2E2F303132\r\n"
+        "\r\n"
+        "\r\n",
+        datagrams.front());
+
+    // it still fits in what older receivers accept
+    EXPECT_LE(std::size(datagrams.front()), 200U);
+}
+
+TEST_F(LpdTest, announcesRoundTrip)
+{
+    auto const hashes = makeHashes(3);
+
+    auto const datagrams = tr_lpdMakeAnnounces(6881, hashes, true);
+    ASSERT_EQ(1U, std::size(datagrams));
+
+    auto const announce = tr_lpdParseAnnounce(datagrams.front().c_str());
+    ASSERT_TRUE(announce);
+    EXPECT_EQ(6881, announce->port);
+    EXPECT_EQ(hashes, announce->info_hashes);
+}
+
+TEST_F(LpdTest, manyHashesArePackedIntoFullDatagrams)
+{
+    auto const hashes = makeHashes(100);
+
+    auto const datagrams = tr_lpdMakeAnnounces(6881, hashes, true);
+    EXPECT_GT(std::size(datagrams), 1U);
+    EXPECT_LT(std::size(datagrams), std::size(hashes) / 10);
+
+    auto parsed = std::vector<tr_sha1_digest_t>{};
+    for (auto const& datagram : datagrams)
+    {
+        EXPECT_LE(std::size(datagram), 1400U);
+
+        auto const announce = tr_lpdParseAnnounce(datagram.c_str());
+        ASSERT_TRUE(announce);
+        parsed.insert(std::end(parsed), std::begin(announce->info_hashes), std::end(announce->info_hashes));
+    }
+
+    EXPECT_EQ(hashes, parsed);
+}
+
+TEST_F(LpdTest, unpackedAnnouncesHaveOneHashEach)
+{
+    auto const hashes = makeHashes(5);
+
+    auto const datagrams = tr_lpdMakeAnnounces(65535, hashes, false);
+    ASSERT_EQ(std::size(hashes), std::size(datagrams));
+
+    for (size_t i = 0; i < std::size(datagrams); ++i)
+    {
+        // the old format, which older receivers accept
+        EXPECT_LE(std::size(datagrams[i]), 200U);
+        EXPECT_EQ(tr_lpdMakeAnnounces(65535, { hashes[i] }, true), std::vector<std::string>{ datagrams[i] });
+
+        auto const announce = tr_lpdParseAnnounce(datagrams[i].c_str());
+        ASSERT_TRUE(announce);
+        EXPECT_EQ(std::vector<tr_sha1_digest_t>{ hashes[i] }, announce->info_hashes);
+    }
+}
+
+TEST_F(LpdTest, invalidHashesAreSkipped)
+{
+    auto const announce = tr_lpdParseAnnounce(
+        "BT-SEARCH * HTTP/1.1\r\n"
+        "Host: 239.192.152.143:6771\r\n"
+        "Port: 6881\r\n"
+        "Infohash: 1F202122232425262728292A2B2C2D2E2F30313\r\n"
+        "Infohash: XX202122232425262728292A2B2C2D2E2F303132\r\n"
+        "Infohash: 1f202122232425262728292a2b2c2d2e2f303132\r\n"
+        "\r\n"
+        "\r\n");
+    ASSERT_TRUE(announce);
+    EXPECT_EQ(std::vector<tr_sha1_digest_t>{ makeHash(1) }, announce->info_hashes);
+}
+
+TEST_F(LpdTest, malformedAnnouncesAreRejected)
+{
+    // no port
+    EXPECT_FALSE(tr_lpdParseAnnounce("BT-SEARCH * HTTP/1.1\r\n"
+                                     "Infohash: 1F202122232425262728292A2B2C2D2E2F303132\r\n"
+                                     "\r\n"
+                                     "\r\n"));
+
+    // no trailing blank lines
+    EXPECT_FALSE(tr_lpdParseAnnounce("BT-SEARCH * HTTP/1.1\r\n"
+                                     "Port: 6881\r\n"
+                                     "Infohash: 1F202122232425262728292A2B2C2D2E2F303132\r\n"));
+
+    // wrong protocol version
+    EXPECT_FALSE(tr_lpdParseAnnounce("BT-SEARCH * HTTP/2.0\r\n"
+                                     "Port: 6881\r\n"
+                                     "Infohash: 1F202122232425262728292A2B2C2D2E2F303132\r\n"
+                                     "\r\n"
+                                     "\r\n"));
+}
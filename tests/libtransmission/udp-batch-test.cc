@@ -0,0 +1,326 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/un.h> /* sockaddr_un */
+#include <unistd.h> /* getpid(), unlink() */
+#endif
+
+#include <event2/util.h>
+
+#include "transmission.h"
+
+#include "net.h"
+#include "tr-udp-batch.h"
+#include "utils.h"
+
+#include "gtest/gtest.h"
+
+using namespace std::literals;
+
+class UdpBatchTest : public ::testing::Test
+{
+protected:
+    tr_socket_t sender_ = TR_BAD_SOCKET;
+    tr_socket_t receiver_ = TR_BAD_SOCKET;
+    sockaddr_in receiver_addr_ = {};
+
+    static tr_socket_t makeLoopbackSocket(sockaddr_in* setme)
+    {
+        auto const sock = socket(AF_INET, SOCK_DGRAM, 0);
+        EXPECT_NE(TR_BAD_SOCKET, sock);
+
+        auto addr = sockaddr_in{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(0, bind(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+
+        socklen_t len = sizeof(addr);
+        EXPECT_EQ(0, getsockname(sock, reinterpret_cast<sockaddr*>(&addr), &len));
+        EXPECT_EQ(0, evutil_make_socket_nonblocking(sock));
+
+        // room for a whole test's worth of datagrams
+        auto const bufsize = 4 * 1024 * 1024;
+        (void)setsockopt(sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char const*>(&bufsize), sizeof(bufsize));
+
+        if (setme != nullptr)
+        {
+            *setme = addr;
+        }
+
+        return sock;
+    }
+
+    void SetUp() override
+    {
+        sender_ = makeLoopbackSocket(nullptr);
+        receiver_ = makeLoopbackSocket(&receiver_addr_);
+    }
+
+    void TearDown() override
+    {
+        tr_netCloseSocket(sender_);
+        tr_netCloseSocket(receiver_);
+    }
+
+    static std::string makePayload(size_t i, size_t len)
+    {
+        auto payload = std::string(len, '\0');
+        for (size_t j = 0; j < len; ++j)
+        {
+            payload[j] = static_cast<char>('a' + (i + j) % 26);
+        }
+
+        return payload;
+    }
+
+    void send(tr_udp_batch& batch, std::string const& payload)
+    {
+        batch.send(
+            sender_,
+            std::data(payload),
+            std::size(payload),
+            reinterpret_cast<sockaddr const*>(&receiver_addr_),
+            sizeof(receiver_addr_));
+    }
+
+    // read until `n` datagrams arrive or we give up waiting
+    std::vector<std::string> receive(tr_udp_batch& batch, size_t n)
+    {
+        auto received = std::vector<std::string>{};
+        auto const deadline = std::chrono::steady_clock::now() + 5s;
+
+        while (std::size(received) < n && std::chrono::steady_clock::now() < deadline)
+        {
+            auto const handler = [](unsigned char* buf, size_t buflen, sockaddr const*, socklen_t, void* vreceived)
+            {
+                // the handler is allowed to write one byte past the end
+                buf[buflen] = '\0';
+                static_cast<std::vector<std::string>*>(vreceived)->emplace_back(reinterpret_cast<char*>(buf), buflen);
+            };
+
+            if (batch.receive(receiver_, handler, &received) == 0)
+            {
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+
+        return received;
+    }
+};
+
+TEST_F(UdpBatchTest, sendsAndReceivesInOrder)
+{
+    auto constexpr N = size_t{ 100 };
+    auto sender = tr_udp_batch{ false };
+    auto receiver = tr_udp_batch{};
+
+    auto expected = std::vector<std::string>{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        expected.push_back(makePayload(i, 100 + i * 13));
+        send(sender, expected.back());
+    }
+
+    sender.flush();
+    EXPECT_TRUE(sender.empty());
+    EXPECT_EQ(expected, receive(receiver, N));
+
+    auto const& sent = sender.stats();
+    EXPECT_EQ(N, sent.packets_sent);
+    EXPECT_EQ(0U, sent.packets_sent_with_gso);
+
+    auto const& received = receiver.stats();
+    EXPECT_EQ(N, received.packets_received);
+
+#ifdef HAVE_SENDMMSG
+    // the queue is flushed whenever it fills up, so one syscall per MaxBatch datagrams
+    EXPECT_EQ((N + tr_udp_batch::MaxBatch - 1) / tr_udp_batch::MaxBatch, sent.send_calls);
+#else
+    EXPECT_EQ(N, sent.send_calls);
+#endif
+
+#ifdef HAVE_RECVMMSG
+    EXPECT_LT(received.receive_calls, N);
+#endif
+}
+
+TEST_F(UdpBatchTest, sendsOversizedPacketsInOrder)
+{
+    auto sender = tr_udp_batch{ false };
+    auto receiver = tr_udp_batch{};
+
+    auto const expected = std::vector<std::string>{
+        makePayload(0, 500),
+        makePayload(1, tr_udp_batch::MaxQueuedPacketSize + 1),
+        makePayload(2, 500),
+    };
+
+    for (auto const& payload : expected)
+    {
+        send(sender, payload);
+    }
+
+    // the big one can't be queued, so it and everything before it has gone out already
+    EXPECT_FALSE(sender.empty());
+    EXPECT_EQ(2U, sender.stats().packets_sent);
+
+    sender.flush();
+    EXPECT_EQ(expected, receive(receiver, std::size(expected)));
+}
+
+#ifndef _WIN32
+
+TEST_F(UdpBatchTest, keepsWhatDoesNotFitInTheSendBuffer)
+{
+    // a local datagram socket's send buffer stays full until the peer reads,
+    // so it's easy to fill up. Loopback UDP drops datagrams instead.
+    auto addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    auto const path = tr_strvJoin(::testing::TempDir(), "udp-batch-test-"s, std::to_string(getpid()));
+    ASSERT_LT(std::size(path), sizeof(addr.sun_path));
+    memcpy(addr.sun_path, std::data(path), std::size(path));
+    unlink(path.c_str());
+
+    auto const receiver = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_NE(TR_BAD_SOCKET, receiver);
+    ASSERT_EQ(0, bind(receiver, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    EXPECT_EQ(0, evutil_make_socket_nonblocking(receiver));
+
+    auto const sender = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_NE(TR_BAD_SOCKET, sender);
+    EXPECT_EQ(0, evutil_make_socket_nonblocking(sender));
+    auto const bufsize = 4096;
+    (void)setsockopt(sender, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<char const*>(&bufsize), sizeof(bufsize));
+
+    auto batch = tr_udp_batch{ false };
+    auto expected = std::vector<std::string>{};
+    for (size_t i = 0; i < tr_udp_batch::MaxBatch; ++i)
+    {
+        expected.push_back(makePayload(i, 1000));
+        batch.send(sender, std::data(expected.back()), 1000, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr));
+    }
+
+    batch.flush();
+    EXPECT_FALSE(batch.empty());
+    EXPECT_TRUE(batch.isQueued(sender));
+    EXPECT_FALSE(batch.isQueued(receiver));
+    EXPECT_EQ(std::size(expected), batch.stats().packets_sent + batch.size());
+
+    // as the receiver drains the socket, the rest go out in order
+    auto received = std::vector<std::string>{};
+    auto const handler = [](unsigned char* buf, size_t buflen, sockaddr const*, socklen_t, void* vreceived)
+    {
+        static_cast<std::vector<std::string>*>(vreceived)->emplace_back(reinterpret_cast<char*>(buf), buflen);
+    };
+
+    auto reader = tr_udp_batch{};
+    for (size_t i = 0; i < 100 && std::size(received) < std::size(expected); ++i)
+    {
+        reader.receive(receiver, handler, &received);
+        batch.flush();
+    }
+
+    EXPECT_TRUE(batch.empty());
+    EXPECT_EQ(expected, received);
+    EXPECT_EQ(0U, batch.stats().packets_dropped);
+
+    tr_netCloseSocket(sender);
+    tr_netCloseSocket(receiver);
+    unlink(path.c_str());
+}
+
+#endif
+
+TEST_F(UdpBatchTest, segmentsEqualSizedPacketsWithGSO)
+{
+    auto constexpr N = size_t{ 2 * tr_udp_batch::MaxBatch };
+    auto constexpr Len = size_t{ 1200 };
+    auto sender = tr_udp_batch{ true };
+    auto receiver = tr_udp_batch{};
+
+    auto expected = std::vector<std::string>{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        // a short one at the end of each run is allowed
+        expected.push_back(makePayload(i, i % tr_udp_batch::MaxBatch == tr_udp_batch::MaxBatch - 1 ? Len / 2 : Len));
+        send(sender, expected.back());
+    }
+
+    sender.flush();
+
+    // GSO falls back to plain datagrams if this kernel can't do it,
+    // so either way the receiver gets the same datagrams
+    EXPECT_EQ(expected, receive(receiver, N));
+    EXPECT_EQ(N, sender.stats().packets_sent);
+
+    if (sender.usesGSO())
+    {
+        EXPECT_EQ(N, sender.stats().packets_sent_with_gso);
+        EXPECT_EQ(2U, sender.stats().send_calls);
+    }
+}
+
+TEST_F(UdpBatchTest, bulkTransferIsBatched)
+{
+    // a bulk transfer of uTP-sized datagrams, read as they arrive
+    auto constexpr N = size_t{ 8 * tr_udp_batch::MaxBatch };
+    static auto constexpr Len = size_t{ 1400 };
+    auto sender = tr_udp_batch{};
+    auto receiver = tr_udp_batch{};
+    auto const payload = makePayload(0, Len);
+
+    auto n_received = size_t{ 0 };
+    auto const handler = [](unsigned char*, size_t buflen, sockaddr const*, socklen_t, void* vn_received)
+    {
+        EXPECT_EQ(Len, buflen);
+        ++*static_cast<size_t*>(vn_received);
+    };
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        // a full queue is flushed by the next send(), so read what the
+        // last batch delivered before the socket buffer overflows
+        if (i % tr_udp_batch::MaxBatch == 1)
+        {
+            while (receiver.receive(receiver_, handler, &n_received) != 0)
+            {
+            }
+        }
+
+        send(sender, payload);
+    }
+
+    sender.flush();
+
+    auto const deadline = std::chrono::steady_clock::now() + 5s;
+    while (n_received < sender.stats().packets_sent && std::chrono::steady_clock::now() < deadline)
+    {
+        if (receiver.receive(receiver_, handler, &n_received) == 0)
+        {
+            std::this_thread::sleep_for(1ms);
+        }
+    }
+
+    auto const& sent = sender.stats();
+    auto const& received = receiver.stats();
+
+    // loopback can still drop datagrams under pressure, but not many
+    EXPECT_EQ(received.packets_received, n_received);
+    EXPECT_GE(n_received, N * 9 / 10);
+
+#ifdef HAVE_SENDMMSG
+    EXPECT_GT(sent.packets_sent, sent.send_calls * 4);
+#endif
+}
@@ -313,6 +313,30 @@ TEST_F(VariantTest, bencSortWhenSerializing)
     tr_variantFree(&val);
 }
 
+TEST_F(VariantTest, bencFindsSpanOfTopLevelKey)
+{
+    auto constexpr In = "d8:announce3:foo4:infod6:lengthi1e4:name1:x4:infoi2ee4:zzzzi3ee"sv;
+
+    auto val = tr_variant{};
+    auto span = std::string_view{};
+    EXPECT_TRUE(tr_variantFromBenc(&val, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, In, TR_KEY_info, &span));
+    EXPECT_EQ("d6:lengthi1e4:name1:x4:infoi2ee"sv, span);
+    tr_variantFree(&val);
+
+    // nested dicts' keys don't count
+    auto constexpr NoInfo = "d4:infx1:a1:bd4:infoi1eee"sv;
+    span = "not empty"sv;
+    EXPECT_TRUE(tr_variantFromBenc(&val, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, NoInfo, TR_KEY_info, &span));
+    EXPECT_EQ(""sv, span);
+    tr_variantFree(&val);
+
+    // scalars work too
+    auto constexpr StrInfo = "d4:info5:hello4:namei1ee"sv;
+    EXPECT_TRUE(tr_variantFromBenc(&val, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, StrInfo, TR_KEY_info, &span));
+    EXPECT_EQ("5:hello"sv, span);
+    tr_variantFree(&val);
+}
+
 TEST_F(VariantTest, bencMalformedTooManyEndings)
 {
     auto constexpr In = "leee"sv;
@@ -556,3 +580,186 @@ TEST_F(VariantTest, dictFindType)
 
     tr_variantFree(&top);
 }
+
+TEST_F(VariantTest, dictFindUnsortedKeys)
+{
+    auto const key_a = tr_quark_new("dict-find-unsorted-a"sv);
+    auto const key_b = tr_quark_new("dict-find-unsorted-b"sv);
+    auto const key_c = tr_quark_new("dict-find-unsorted-c"sv);
+    auto const key_d = tr_quark_new("dict-find-unsorted-d"sv);
+
+    auto top = tr_variant{};
+    tr_variantInitDict(&top, 0);
+    tr_variantDictAddInt(&top, key_a, 1);
+    tr_variantDictAddInt(&top, key_c, 3);
+    tr_variantDictAddInt(&top, key_b, 2);
+    tr_variantDictAddInt(&top, key_d, 4);
+
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(&top, key_b, &i));
+    EXPECT_EQ(2, i);
+
+    // removing a key swaps the last child into its place
+    EXPECT_TRUE(tr_variantDictRemove(&top, key_a));
+    for (auto const& [key, expected] : { std::pair{ key_b, 2 }, std::pair{ key_c, 3 }, std::pair{ key_d, 4 } })
+    {
+        EXPECT_TRUE(tr_variantDictFindInt(&top, key, &i));
+        EXPECT_EQ(expected, i);
+    }
+    EXPECT_EQ(nullptr, tr_variantDictFind(&top, key_a));
+
+    tr_variantFree(&top);
+}
+
+TEST_F(VariantTest, parsedDictsFindDuplicateKeys)
+{
+    // parsed dicts are sorted for lookup, but should still find the
+    // first of any duplicate keys just like an unsorted search would
+    auto const benc = "d3:zzzi1e3:aaai2e3:zzzi3ee"sv;
+
+    auto val = tr_variant{};
+    EXPECT_TRUE(tr_variantFromBuf(&val, TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE, benc));
+
+    auto i = int64_t{};
+    EXPECT_TRUE(tr_variantDictFindInt(&val, tr_quark_new("zzz"sv), &i));
+    EXPECT_EQ(1, i);
+    EXPECT_TRUE(tr_variantDictFindInt(&val, tr_quark_new("aaa"sv), &i));
+    EXPECT_EQ(2, i);
+
+    tr_variantFree(&val);
+
+    // same again with a dict too big to be sorted in place
+    auto json = std::string{ "{\"zzz\":1" };
+    for (int n = 0; n < 64; ++n)
+    {
+        json += ",\"dup-key-" + std::to_string(63 - n) + "\":" + std::to_string(n);
+    }
+    json += ",\"zzz\":2}";
+
+    EXPECT_TRUE(tr_variantFromBuf(&val, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, json));
+    EXPECT_TRUE(tr_variantDictFindInt(&val, tr_quark_new("zzz"sv), &i));
+    EXPECT_EQ(1, i);
+    EXPECT_TRUE(tr_variantDictFindInt(&val, tr_quark_new("dup-key-63"sv), &i));
+    EXPECT_EQ(0, i);
+
+    tr_variantFree(&val);
+}
+
+TEST_F(VariantTest, arenaParse)
+{
+    auto constexpr LongStr = "a string that is too long to fit inside the variant"sv;
+    auto const benc = tr_strvJoin("d4:listli1ei2ee3:str"sv, std::to_string(std::size(LongStr)), ":"sv, LongStr, "e"sv);
+
+    auto arena = tr_variant_arena{ 256 };
+    auto val = tr_variant{};
+    char const* end = nullptr;
+    EXPECT_TRUE(tr_variantFromBuf(&val, arena, TR_VARIANT_PARSE_BENC, benc, &end));
+    EXPECT_EQ(std::data(benc) + std::size(benc), end);
+    EXPECT_LT(size_t{ 0 }, arena.capacity());
+
+    // long strings are copied into the arena, not referenced
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(&val, tr_quark_new("str"sv), &sv));
+    EXPECT_EQ(LongStr, sv);
+    EXPECT_FALSE(std::data(benc) <= std::data(sv) && std::data(sv) < std::data(benc) + std::size(benc));
+
+    // the parsed variant can still be modified
+    tr_variant* list = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(&val, tr_quark_new("list"sv), &list));
+    for (int i = 3; i <= 20; ++i)
+    {
+        tr_variantListAddInt(list, i);
+    }
+    tr_variantDictAddStr(&val, tr_quark_new("added"sv), LongStr);
+
+    auto len = size_t{};
+    auto* saved = tr_variantToStr(&val, TR_VARIANT_FMT_JSON_LEAN, &len);
+    EXPECT_EQ(
+        tr_strvJoin(
+            R"({"added":")"sv,
+            LongStr,
+            R"(","list":[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20],"str":")"sv,
+            LongStr,
+            "\"}\n"sv),
+        std::string_view(saved, len));
+    tr_free(saved);
+
+    tr_variantFree(&val);
+}
+
+TEST_F(VariantTest, arenaParseJson)
+{
+    auto constexpr Json = R"({ "escaped": "tab\there", "nested": { "list": [ 1, 2.5, true, null, "a string longer than a few bytes" ] } })"sv;
+
+    auto arena = tr_variant_arena{};
+    auto val = tr_variant{};
+    EXPECT_TRUE(tr_variantFromBuf(&val, arena, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, Json));
+
+    auto sv = std::string_view{};
+    EXPECT_TRUE(tr_variantDictFindStrView(&val, tr_quark_new("escaped"sv), &sv));
+    EXPECT_EQ("tab\there"sv, sv);
+
+    tr_variant* nested = nullptr;
+    tr_variant* list = nullptr;
+    EXPECT_TRUE(tr_variantDictFindDict(&val, tr_quark_new("nested"sv), &nested));
+    EXPECT_TRUE(tr_variantDictFindList(nested, tr_quark_new("list"sv), &list));
+    EXPECT_EQ(size_t{ 5 }, tr_variantListSize(list));
+    EXPECT_TRUE(tr_variantGetStrView(tr_variantListChild(list, 4), &sv));
+    EXPECT_EQ("a string longer than a few bytes"sv, sv);
+
+    tr_variantFree(&val);
+
+    // a parse that fails leaves nothing behind
+    arena.reset();
+    EXPECT_FALSE(tr_variantFromBuf(&val, arena, TR_VARIANT_PARSE_JSON, R"({ "key": [ 1, 2 )"sv));
+    EXPECT_EQ(0, val.type);
+}
+
+TEST_F(VariantTest, parseManyFiles)
+{
+    // a .torrent-like dict with a lot of files
+    auto constexpr NumFiles = 500;
+    auto benc = std::string{ "d8:announce30:http://tracker.example.com/ann4:infod5:filesl" };
+    for (int i = 0; i < NumFiles; ++i)
+    {
+        auto const path = "file-" + std::to_string(i) + ".dat";
+        benc += tr_strvJoin("d6:lengthi"sv, std::to_string(16384 + i), "e4:pathl9:directory"sv);
+        benc += tr_strvJoin(std::to_string(std::size(path)), ":"sv, path, "ee"sv);
+    }
+    benc += "e4:name8:big-test12:piece lengthi16384eee";
+
+    auto const opts = TR_VARIANT_PARSE_BENC | TR_VARIANT_PARSE_INPLACE;
+
+    auto const check = [&benc, opts](tr_variant_arena* arena)
+    {
+        auto val = tr_variant{};
+        auto const ok = arena != nullptr ? tr_variantFromBuf(&val, *arena, opts, benc) : tr_variantFromBuf(&val, opts, benc);
+        EXPECT_TRUE(ok);
+
+        tr_variant* info = nullptr;
+        tr_variant* files = nullptr;
+        EXPECT_TRUE(tr_variantDictFindDict(&val, TR_KEY_info, &info));
+        EXPECT_TRUE(tr_variantDictFindList(info, TR_KEY_files, &files));
+        EXPECT_EQ(size_t{ NumFiles }, tr_variantListSize(files));
+
+        auto length = int64_t{};
+        tr_variant* path = nullptr;
+        auto sv = std::string_view{};
+        auto* const last = tr_variantListChild(files, NumFiles - 1);
+        EXPECT_TRUE(tr_variantDictFindInt(last, TR_KEY_length, &length));
+        EXPECT_EQ(16384 + NumFiles - 1, length);
+        EXPECT_TRUE(tr_variantDictFindList(last, TR_KEY_path, &path));
+        EXPECT_TRUE(tr_variantGetStrView(tr_variantListChild(path, 1), &sv));
+        EXPECT_EQ("file-499.dat"sv, sv);
+
+        tr_variantFree(&val);
+    };
+
+    check(nullptr);
+
+    // an arena can be reused after it's reset
+    auto arena = tr_variant_arena{};
+    check(&arena);
+    arena.reset();
+    check(&arena);
+}
@@ -0,0 +1,219 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+
+#include "crypto-utils.h"
+#include "file.h"
+#include "makemeta.h"
+#include "torrent.h"
+#include "utils.h"
+#include "verify.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class VerifyTest : public SessionTest
+{
+protected:
+    void SetUp() override
+    {
+        SessionTest::SetUp();
+
+        // keep the scrubber from checking pieces behind the tests' backs
+        tr_sessionSetScrubSpeedLimit_KBps(session_, 0);
+    }
+
+    struct piece_data
+    {
+        tr_torrent* tor;
+        tr_piece_index_t piece;
+        bool queued;
+    };
+
+    void checkInBackground(tr_torrent* tor, tr_piece_index_t piece)
+    {
+        auto data = piece_data{ tor, piece, false };
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const data = static_cast<piece_data*>(vdata);
+                tr_verifyPieceAdd(data->tor, data->piece);
+                data->queued = true;
+            },
+            &data);
+        EXPECT_TRUE(waitFor([&data]() { return data.queued; }, 2000));
+        EXPECT_TRUE(waitFor([tor, piece]() { return !tr_verifyPieceIsQueued(tor, piece); }, 2000));
+    }
+
+    static bool allPiecesChecked(tr_torrent const* tor)
+    {
+        for (tr_piece_index_t i = 0; i < tor->info.pieceCount; ++i)
+        {
+            if (!tor->isPieceChecked(i))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+TEST_F(VerifyTest, backgroundCheckPasses)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_FALSE(tor->isPieceChecked(1));
+
+    checkInBackground(tor, 1);
+    EXPECT_TRUE(tor->isPieceChecked(1));
+    EXPECT_FALSE(tor->isPieceChecked(0));
+    EXPECT_EQ(TR_STAT_OK, tor->error);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, backgroundCheckFailsOnCorruptData)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    // corrupt the second piece after the torrent's been verified
+    auto const path = makeString(tr_torrentFindFile(tor, 0));
+    auto const fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE, 0600, nullptr);
+    ASSERT_NE(TR_BAD_SYS_FILE, fd);
+    EXPECT_TRUE(tr_sys_file_write_at(fd, "\1", 1, tor->info.pieceSize, nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    checkInBackground(tor, 1);
+    EXPECT_FALSE(tor->isPieceChecked(1));
+    EXPECT_EQ(TR_STAT_LOCAL_ERROR, tor->error);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, backgroundCheckFindsMovedFiles)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    // rename the file behind the torrent's back, so the check is queued with the old path
+    auto filename = std::string{};
+    ASSERT_TRUE(tor->findFile(filename, 0));
+    auto const path = filename;
+    ASSERT_TRUE(tr_sys_path_rename(path.c_str(), (path + ".part").c_str(), nullptr));
+    ASSERT_TRUE(tor->findFile(filename, 0));
+    EXPECT_EQ(path, filename);
+
+    checkInBackground(tor, 1);
+    EXPECT_TRUE(tor->isPieceChecked(1));
+    EXPECT_EQ(TR_STAT_OK, tor->error);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, backgroundCheckDoesNotBlameMissingFiles)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    auto const path = makeString(tr_torrentFindFile(tor, 0));
+    ASSERT_TRUE(tr_sys_path_remove(path.c_str(), nullptr));
+
+    // a file that can't be read isn't corrupt, but its pieces can't be uploaded either
+    EXPECT_TRUE(tor->hasPiece(1));
+    checkInBackground(tor, 1);
+    EXPECT_FALSE(tor->isPieceChecked(1));
+    EXPECT_FALSE(tor->hasPiece(1));
+    EXPECT_TRUE(tor->hasPiece(0));
+    EXPECT_EQ(TR_LEECH, tor->completeness);
+    EXPECT_EQ(TR_STAT_OK, tor->error);
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, scrubberChecksRunningTorrents)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    EXPECT_FALSE(allPiecesChecked(tor));
+
+    // the zero torrent is about 1 MiB
+    tr_sessionSetScrubSpeedLimit_KBps(session_, 4096);
+    EXPECT_EQ(4096U, tr_sessionGetScrubSpeedLimit_KBps(session_));
+
+    // paused torrents aren't scrubbed
+    tr_wait_msec(1500);
+    EXPECT_FALSE(allPiecesChecked(tor));
+
+    tr_torrentStart(tor);
+    EXPECT_TRUE(waitFor([tor]() { return allPiecesChecked(tor); }, 5000));
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+TEST_F(VerifyTest, verifiesTorrentsQueuedTogether)
+{
+    // same size, same priority, and nothing on disk yet: these all sort the same in the queue
+    auto torrents = std::array<tr_torrent*, 4>{};
+    auto payload = std::vector<char>(16384);
+    for (size_t i = 0; i < std::size(torrents); ++i)
+    {
+        auto const name = "same-size-" + std::to_string(i);
+        auto const path = tr_strvPath(sandboxDir(), "source", name);
+        tr_rand_buffer(std::data(payload), std::size(payload));
+        createFileWithContents(path, std::data(payload), std::size(payload));
+
+        auto const torrent_file = path + ".torrent";
+        auto* const builder = tr_metaInfoBuilderCreate(path.c_str());
+        tr_makeMetaInfo(builder, torrent_file.c_str(), nullptr, 0, nullptr, false, nullptr);
+        EXPECT_TRUE(waitFor([builder]() { return builder->isDone; }, 5000));
+        tr_metaInfoBuilderFree(builder);
+
+        auto* const ctor = tr_ctorNew(session_);
+        tr_ctorSetMetainfoFromFile(ctor, torrent_file.c_str());
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        torrents[i] = tr_torrentNew(ctor, nullptr, nullptr);
+        tr_ctorFree(ctor);
+        ASSERT_NE(nullptr, torrents[i]);
+    }
+
+    auto n_done = std::atomic<size_t>{};
+    auto constexpr OnVerifyDone = [](tr_torrent*, bool, void* vn_done) noexcept
+    {
+        ++*static_cast<std::atomic<size_t>*>(vn_done);
+    };
+
+    for (auto* const tor : torrents)
+    {
+        tr_torrentVerify(tor, OnVerifyDone, &n_done);
+    }
+
+    EXPECT_TRUE(waitFor([&n_done, &torrents]() { return n_done == std::size(torrents); }, 5000));
+
+    for (auto* const tor : torrents)
+    {
+        tr_torrentRemove(tor, false, nullptr);
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,228 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <atomic>
+#include <cinttypes> // SCNu64
+#include <cstdio> // sscanf()
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+
+#include "transmission.h"
+
+#include "crypto-utils.h" // tr_rand_buffer()
+#include "file.h"
+#include "makemeta.h"
+#include "net.h" // sockaddr_storage, socklen_t
+#include "torrent.h"
+#include "utils.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+// A tiny HTTP server that serves files out of a folder,
+// answering "Range: bytes=begin-end" requests like a CDN would.
+class FileServer
+{
+public:
+    explicit FileServer(std::string root)
+        : root_{ std::move(root) }
+        , base_{ event_base_new(), event_base_free }
+        , http_{ evhttp_new(base_.get()), evhttp_free }
+    {
+        evhttp_set_gencb(http_.get(), onRequest, this);
+        auto* const bound = evhttp_bind_socket_with_handle(http_.get(), "127.0.0.1", 0);
+        EXPECT_NE(nullptr, bound);
+
+        auto addr = sockaddr_storage{};
+        auto addrlen = socklen_t{ sizeof(addr) };
+        getsockname(evhttp_bound_socket_get_fd(bound), reinterpret_cast<sockaddr*>(&addr), &addrlen);
+        port_ = ntohs(reinterpret_cast<sockaddr_in const*>(&addr)->sin_port);
+
+        thread_ = std::thread(
+            [this]()
+            {
+                // libevent isn't built thread-aware here, so wake up now and then to see if it's time to stop
+                while (!stopping_)
+                {
+                    auto constexpr FiftyMsec = timeval{ 0, 50000 };
+                    event_base_loopexit(base_.get(), &FiftyMsec);
+                    event_base_dispatch(base_.get());
+                }
+            });
+    }
+
+    ~FileServer()
+    {
+        stopping_ = true;
+        thread_.join();
+    }
+
+    [[nodiscard]] std::string url() const
+    {
+        return tr_strvJoin("http://127.0.0.1:"sv, std::to_string(port_), "/"sv);
+    }
+
+    [[nodiscard]] size_t requestCount() const
+    {
+        return n_requests_;
+    }
+
+    [[nodiscard]] size_t connectionCount() const
+    {
+        return n_connections_;
+    }
+
+private:
+    static void onRequest(evhttp_request* req, void* vself)
+    {
+        auto* const self = static_cast<FileServer*>(vself);
+        ++self->n_requests_;
+
+        // count each connection once; keep-alive means fewer of these than requests
+        if (self->connections_.insert(evhttp_request_get_connection(req)).second)
+        {
+            ++self->n_connections_;
+        }
+
+        auto* const path = evhttp_uridecode(evhttp_request_get_uri(req), 0, nullptr);
+        auto contents = std::vector<char>{};
+        auto const found = tr_loadFile(contents, tr_strvJoin(self->root_, path).c_str());
+        free(path);
+
+        auto begin = uint64_t{};
+        auto end = uint64_t{};
+        auto const* const range = evhttp_find_header(evhttp_request_get_input_headers(req), "Range");
+        if (!found || range == nullptr || sscanf(range, "bytes=%" SCNu64 "-%" SCNu64, &begin, &end) != 2 ||
+            end < begin || end >= std::size(contents))
+        {
+            evhttp_send_error(req, found ? 416 : HTTP_NOTFOUND, nullptr);
+            return;
+        }
+
+        auto const content_range = tr_strvJoin(
+            "bytes "sv,
+            std::to_string(begin),
+            "-"sv,
+            std::to_string(end),
+            "/"sv,
+            std::to_string(std::size(contents)));
+        evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Range", content_range.c_str());
+
+        auto* const buf = evbuffer_new();
+        evbuffer_add(buf, std::data(contents) + begin, end + 1 - begin);
+        evhttp_send_reply(req, 206, "Partial Content", buf);
+        evbuffer_free(buf);
+    }
+
+    std::string const root_;
+    std::unique_ptr<event_base, void (*)(event_base*)> base_;
+    std::unique_ptr<evhttp, void (*)(evhttp*)> http_;
+    std::set<evhttp_connection*> connections_;
+    std::atomic<size_t> n_requests_ = {};
+    std::atomic<size_t> n_connections_ = {};
+    uint16_t port_ = {};
+    std::atomic<bool> stopping_ = false;
+    std::thread thread_;
+};
+
+} // namespace
+
+class WebseedTest : public SessionTest
+{
+protected:
+    // make a multi-file torrent whose files don't line up with its pieces
+    std::string makeTorrent(std::string const& top, std::vector<size_t> const& file_sizes, uint32_t piece_size)
+    {
+        for (size_t i = 0; i < std::size(file_sizes); ++i)
+        {
+            auto contents = std::vector<char>(file_sizes[i]);
+            tr_rand_buffer(std::data(contents), std::size(contents));
+            createFileWithContents(tr_strvPath(top, "file" + std::to_string(i)), std::data(contents), std::size(contents));
+        }
+
+        auto* const builder = tr_metaInfoBuilderCreate(top.c_str());
+        EXPECT_TRUE(tr_metaInfoBuilderSetPieceSize(builder, piece_size));
+        auto const torrent_file = tr_strvJoin(top, ".torrent");
+        tr_makeMetaInfo(builder, torrent_file.c_str(), nullptr, 0, nullptr, false, nullptr);
+        EXPECT_TRUE(waitFor([builder]() { return builder->isDone; }, 5000));
+        EXPECT_EQ(TR_MAKEMETA_OK, builder->result);
+        tr_metaInfoBuilderFree(builder);
+
+        return torrent_file;
+    }
+
+    tr_torrent* addWithWebseed(std::string const& torrent_file, std::string const& url)
+    {
+        auto top = tr_variant{};
+        EXPECT_TRUE(tr_variantFromFile(&top, TR_VARIANT_PARSE_BENC, torrent_file.c_str()));
+        tr_variantDictAddStr(&top, TR_KEY_url_list, url.c_str());
+        auto len = size_t{};
+        auto* const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC, &len);
+        tr_variantFree(&top);
+
+        auto* const ctor = tr_ctorNew(session_);
+        tr_ctorSetMetainfo(ctor, benc, len);
+        tr_ctorSetPaused(ctor, TR_FORCE, false);
+        auto err = int{};
+        auto* const tor = tr_torrentNew(ctor, &err, nullptr);
+        EXPECT_EQ(0, err);
+        tr_ctorFree(ctor);
+        tr_free(benc);
+
+        return tor;
+    }
+};
+
+TEST_F(WebseedTest, downloadsMultiFileTorrent)
+{
+    auto const seed_dir = tr_strvPath(sandboxDir(), "seed");
+    auto const torrent_file = makeTorrent(
+        tr_strvPath(seed_dir, "webseed-test"),
+        { 100000, 1, 70000, 33000, 300000, 12345 },
+        32768);
+
+    auto server = FileServer{ seed_dir };
+    auto* const tor = addWithWebseed(torrent_file, server.url());
+    ASSERT_NE(nullptr, tor);
+    EXPECT_EQ(1, tor->info.webseedCount);
+
+    // every piece passed its checksum, so the data's all there
+    EXPECT_TRUE(waitFor([tor]() { return tr_torrentStat(tor)->leftUntilDone == 0; }, 20000));
+    EXPECT_EQ(0, tr_torrentStat(tor)->corruptEver);
+    EXPECT_EQ(tor->info.totalSize, tr_torrentStat(tor)->downloadedEver);
+
+    // ranges span pieces, so there are fewer requests than pieces.
+    // connections are reused, so there are fewer connections than requests.
+    EXPECT_LT(server.requestCount(), size_t{ tor->info.pieceCount });
+    EXPECT_LT(server.connectionCount(), server.requestCount());
+
+    tr_torrentRemove(tor, false, nullptr);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -2028,6 +2028,7 @@ static char id[4096];
 static int processResponse(char const* rpcurl, std::string_view response)
 {
     tr_variant top;
+    auto arena = tr_variant_arena{};
     int status = EXIT_SUCCESS;
 
     if (debug)
@@ -2039,7 +2040,7 @@ static int processResponse(char const* rpcurl, std::string_view response)
             TR_PRIsv_ARG(response));
     }
 
-    if (!tr_variantFromBuf(&top, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, response))
+    if (!tr_variantFromBuf(&top, arena, TR_VARIANT_PARSE_JSON | TR_VARIANT_PARSE_INPLACE, response))
     {
         tr_logAddNamedError(MY_NAME, "Unable to parse response \"%" TR_PRIsv "\"", TR_PRIsv_ARG(response));
         status |= EXIT_FAILURE;